@@ -18,7 +18,7 @@ enum
 {
 	FZ_IMAGE_UNKNOWN = 0,
 	FZ_IMAGE_JPEG = 1,
-	FZ_IMAGE_JPX = 2, /* Placeholder until supported */
+	FZ_IMAGE_JPX = 2, /* SumatraPDF: decoded by fz_image_get_pixmap */
 	FZ_IMAGE_FAX = 3,
 	FZ_IMAGE_JBIG2 = 4, /* Placeholder until supported */
 	FZ_IMAGE_RAW = 5,
@@ -39,6 +39,7 @@ struct fz_compression_params_s
 		} jpeg;
 		struct {
 			int smask_in_data;
+			int indexed; /* SumatraPDF: cf. fz_load_jpx */
 		} jpx;
 		struct {
 			int columns;
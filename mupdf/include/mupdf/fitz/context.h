@@ -237,6 +237,7 @@ enum {
 	FZ_LOCK_FILE, /* Unused now */
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
+	FZ_LOCK_JBIG2, /* SumatraPDF: cf. fz_open_jbig2d */
 	FZ_LOCK_MAX
 };
 
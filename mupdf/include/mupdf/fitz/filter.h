@@ -23,11 +23,14 @@ fz_stream *fz_open_faxd(fz_stream *chain,
 	int k, int end_of_line, int encoded_byte_align,
 	int columns, int rows, int end_of_block, int black_is_1);
 fz_stream *fz_open_flated(fz_stream *chain);
+/* SumatraPDF: same as fz_open_flated but inflates all of chain at once */
+fz_stream *fz_open_flated_all(fz_stream *chain, int initial);
 fz_stream *fz_open_lzwd(fz_stream *chain, int early_change);
 fz_stream *fz_open_predict(fz_stream *chain, int predictor, int columns, int colors, int bpc);
 fz_stream *fz_open_jbig2d(fz_stream *chain, fz_jbig2_globals *globals);
 
 fz_jbig2_globals *fz_load_jbig2_globals(fz_context *ctx, unsigned char *data, int size);
+void fz_drop_jbig2_globals(fz_context *ctx, fz_jbig2_globals *globals);
 void fz_free_jbig2_globals_imp(fz_context *ctx, fz_storable *globals);
 
 #endif
@@ -17,6 +17,9 @@ void fz_new_glyph_cache_context(fz_context *ctx);
 fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
 void fz_drop_glyph_cache_context(fz_context *ctx);
 void fz_purge_glyph_cache(fz_context *ctx);
+/* SumatraPDF: max_size is in bytes (0 for the default of 1 MB) */
+void fz_set_glyph_cache_size(fz_context *ctx, int max_size);
+void fz_glyph_cache_stats(fz_context *ctx, int *hits, int *misses);
 
 fz_path *fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm);
 fz_path *fz_outline_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *ctm);
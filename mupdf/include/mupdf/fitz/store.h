@@ -169,6 +169,16 @@ void fz_remove_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store
 */
 void fz_empty_store(fz_context *ctx);
 
+/*
+	SumatraPDF: fz_set_store_limit: Change the maximum size of the store
+	(shared by ctx and all its clones), evicting as many unused items as
+	needed for fitting the new limit.
+
+	fz_store_size: Returns the current size of the store in bytes.
+*/
+void fz_set_store_limit(fz_context *ctx, unsigned int max);
+unsigned int fz_store_size(fz_context *ctx);
+
 /*
 	fz_store_scavenge: Internal function used as part of the scavenging
 	allocator; when we fail to allocate memory, before returning a
@@ -31,6 +31,18 @@ fz_stream *fz_open_file(fz_context *ctx, const char *filename);
 fz_stream *fz_open_fd_progressive(fz_context *ctx, int fd, int bps);
 fz_stream *fz_open_file_progressive(fz_context *ctx, const char *filename, int bps);
 
+/*
+	SumatraPDF: fz_open_buffer_progressive: Open a buffer as a stream while
+	it's still being filled (e.g. by a background thread loading a file).
+
+	buf: The buffer to open (buf->len is the length of the complete data).
+
+	available: Number of bytes at the start of buf which can already be
+	read. Throws FZ_ERROR_TRYLATER when data beyond that is needed and
+	FZ_ERROR_GENERIC once available is negative (for read errors).
+*/
+fz_stream *fz_open_buffer_progressive(fz_context *ctx, fz_buffer *buf, volatile int *available);
+
 /*
 	fz_open_file_w: Open the named file and wrap it in a stream.
 
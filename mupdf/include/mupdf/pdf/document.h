@@ -89,6 +89,20 @@ pdf_document *pdf_open_document_with_stream(fz_context *ctx, fz_stream *file);
 pdf_document *pdf_open_document_no_run(fz_context *ctx, const char *filename);
 pdf_document *pdf_open_document_no_run_with_stream(fz_context *ctx, fz_stream *file);
 
+/*
+	SumatraPDF: pdf_open_document_with_stream_and_xref: Opens a PDF document
+	which had to be repaired before without repairing it again.
+
+	repaired_xref: Output of pdf_save_repaired_xref for the same file or NULL
+	(if it turns out to be invalid, the document is opened as usual).
+
+	repaired_len: Length of the file repaired_xref has been saved for, if
+	incremental updates have been appended to it since (or 0). Only the xref
+	sections of these updates are read then.
+*/
+pdf_document *pdf_open_document_with_stream_and_xref(fz_context *ctx, fz_stream *file, fz_buffer *repaired_xref, int repaired_len);
+pdf_document *pdf_open_document_no_run_with_stream_and_xref(fz_context *ctx, fz_stream *file, fz_buffer *repaired_xref, int repaired_len);
+
 /*
 	pdf_close_document: Closes and frees an opened PDF document.
 
@@ -218,6 +232,11 @@ struct pdf_document_s
 
 	int page_count;
 
+	/* SumatraPDF: documents with the same (non-NULL) image_store_id share
+	 * the images they load through the store (cf. pdf_load_image), so
+	 * it may only be set for instances of the same file */
+	void *image_store_id;
+
 	int repair_attempted;
 
 	/* State indicating which file parsing method we are using */
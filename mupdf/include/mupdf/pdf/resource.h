@@ -7,6 +7,9 @@
 void pdf_store_item(fz_context *ctx, pdf_obj *key, void *val, unsigned int itemsize);
 void *pdf_find_item(fz_context *ctx, fz_store_free_fn *free, pdf_obj *key);
 void pdf_remove_item(fz_context *ctx, fz_store_free_fn *free, pdf_obj *key);
+/* SumatraPDF: share items between documents with the same image_store_id */
+void *pdf_store_shared_item(pdf_document *doc, pdf_obj *key, void *val, unsigned int itemsize);
+void *pdf_find_shared_item(pdf_document *doc, fz_store_free_fn *free, pdf_obj *key);
 
 /*
  * Functions, Colorspaces, Shadings and Images
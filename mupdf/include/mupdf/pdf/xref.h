@@ -81,6 +81,9 @@ int pdf_xref_is_incremental(pdf_document *doc, int num);
 
 void pdf_repair_xref(pdf_document *doc, pdf_lexbuf *buf);
 void pdf_repair_obj_stms(pdf_document *doc);
+/* SumatraPDF: allow to cache the result of repairing a broken xref */
+fz_buffer *pdf_save_repaired_xref(pdf_document *doc);
+int pdf_load_repaired_xref(pdf_document *doc, fz_buffer *data);
 pdf_obj *pdf_new_ref(pdf_document *doc, pdf_obj *obj);
 
 int pdf_repair_obj(pdf_document *doc, pdf_lexbuf *buf, int *stmofsp, int *stmlenp, pdf_obj **encrypt, pdf_obj **id, pdf_obj **page, int *tmpofs);
@@ -173,6 +173,16 @@ struct xps_resource_s
 	xps_resource *parent; /* up to the previous dict in the stack */
 };
 
+/* SumatraPDF: remote resource dictionaries are parsed only once per document */
+typedef struct xps_resource_cache_s xps_resource_cache;
+
+struct xps_resource_cache_s
+{
+	char *name;
+	fz_xml *xml;
+	xps_resource_cache *next;
+};
+
 xps_resource * xps_parse_resource_dictionary(xps_document *doc, char *base_uri, fz_xml *root);
 void xps_free_resource_dictionary(xps_document *doc, xps_resource *dict);
 void xps_resolve_resource_reference(xps_document *doc, xps_resource *dict, char **attp, fz_xml **tagp, char **urip);
@@ -248,6 +258,9 @@ struct xps_document_s
 	/* We cache font resources */
 	xps_font_cache *font_table;
 
+	/* SumatraPDF: and remote resource dictionaries */
+	xps_resource_cache *resource_table;
+
 	/* Opacity attribute stack */
 	float opacity[64];
 	int opacity_top;
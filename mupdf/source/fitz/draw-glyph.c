@@ -34,6 +34,10 @@ struct fz_glyph_cache_s
 {
 	int refs;
 	int total;
+	/* SumatraPDF: allow to configure the cache size and collect statistics */
+	int max_size;
+	int hits;
+	int misses;
 #ifndef NDEBUG
 	int num_evictions;
 	int evicted;
@@ -51,6 +55,7 @@ fz_new_glyph_cache_context(fz_context *ctx)
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
 	cache->total = 0;
 	cache->refs = 1;
+	cache->max_size = MAX_CACHE_SIZE;
 
 	ctx->glyph_cache = cache;
 }
@@ -121,6 +126,31 @@ fz_drop_glyph_cache_context(fz_context *ctx)
 	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 }
 
+/* SumatraPDF: the cache (and thus its size) is shared with all cloned contexts */
+void
+fz_set_glyph_cache_size(fz_context *ctx, int max_size)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	cache->max_size = max_size > 0 ? max_size : MAX_CACHE_SIZE;
+	while (cache->total > cache->max_size && cache->lru_tail)
+		drop_glyph_cache_entry(ctx, cache->lru_tail);
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+/* SumatraPDF: misses only count glyphs small enough for being cached */
+void
+fz_glyph_cache_stats(fz_context *ctx, int *hits, int *misses)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	*hits = cache->hits;
+	*misses = cache->misses;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
 fz_glyph_cache *
 fz_keep_glyph_cache(fz_context *ctx)
 {
@@ -296,6 +326,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		{
 			move_to_front(cache, entry);
 			val = fz_keep_glyph(ctx, entry->val);
+			cache->hits++;
 			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 			return val;
 		}
@@ -305,6 +336,8 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	locked = 1;
 	caching = 0;
 	val = NULL;
+	if (do_cache)
+		cache->misses++;
 
 	fz_try(ctx)
 	{
@@ -376,7 +409,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				cache->lru_head = entry;
 
 				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
+				while (cache->total > cache->max_size)
 				{
 #ifndef NDEBUG
 					cache->num_evictions++;
@@ -455,6 +488,7 @@ fz_dump_glyph_cache_stats(fz_context *ctx)
 	fz_glyph_cache *cache = ctx->glyph_cache;
 
 	printf("Glyph Cache Size: %d\n", cache->total);
+	printf("Glyph Cache Hits: %d, Misses: %d\n", cache->hits, cache->misses);
 #ifndef NDEBUG
 	printf("Glyph Cache Evictions: %d (%d bytes)\n", cache->num_evictions, cache->evicted);
 #endif
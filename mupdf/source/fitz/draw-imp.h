@@ -28,6 +28,10 @@ fz_irect *fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, const fz_irect
  * Plotting functions.
  */
 
+/* SumatraPDF: whether SSE2 variants of the painters and scalers can be used
+ * (only defined for x86 and x64 builds) */
+int fz_has_sse2(void);
+
 void fz_paint_solid_alpha(unsigned char * restrict dp, int w, int alpha);
 void fz_paint_solid_color(unsigned char * restrict dp, int n, int w, unsigned char *color);
 
@@ -73,6 +73,60 @@ and stick to using the premultiplied form.
 
 typedef unsigned char byte;
 
+/* SumatraPDF: the hottest span painters for 4 component pixmaps have SSE2
+ * variants which produce exactly the same output as the scalar code (which
+ * is still used for all remaining pixels and for CPUs without SSE2). */
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FZ_PAINT_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER) && !defined(_M_X64)
+#include <intrin.h>
+#endif
+
+int fz_has_sse2(void)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+	return 1;
+#else
+	static int has_sse2 = -1;
+	if (has_sse2 == -1)
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		has_sse2 = (info[3] >> 26) & 1;
+#else
+		has_sse2 = __builtin_cpu_supports("sse2") ? 1 : 0;
+#endif
+	}
+	return has_sse2;
+#endif
+}
+
+/* FZ_BLEND for 8 16-bit values; the intermediate results are always in the
+ * 0..65280 range, so computing them modulo 2^16 is exact */
+static inline __m128i
+fz_blend_sse2(__m128i src, __m128i dst, __m128i amount)
+{
+	__m128i t = _mm_mullo_epi16(_mm_sub_epi16(src, dst), amount);
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_slli_epi16(dst, 8)), 8);
+}
+
+/* blends 4 pixels at dp with color according to the 16-bit amounts ma0..ma3 */
+static inline void
+fz_blend_4_pixels_sse2(byte * restrict dp, __m128i color, __m128i ma)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i d = _mm_loadu_si128((const __m128i *)dp);
+	__m128i lo, hi;
+	ma = _mm_unpacklo_epi16(ma, ma);
+	lo = fz_blend_sse2(color, _mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(ma, ma));
+	hi = fz_blend_sse2(color, _mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(ma, ma));
+	_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(lo, hi));
+}
+#endif
+
 /* These are used by the non-aa scan converter */
 
 void
@@ -142,6 +196,15 @@ fz_paint_solid_color_4(byte * restrict dp, int w, byte *color)
 		unsigned int mask = 0xFF00FF00;
 		unsigned int rb = rgba & (mask>>8);
 		unsigned int ga = (rgba & mask)>>8;
+#ifdef FZ_PAINT_SSE2
+		if (fz_has_sse2())
+		{
+			__m128i color16 = _mm_unpacklo_epi8(_mm_set1_epi32(rgba), _mm_setzero_si128());
+			__m128i sa16 = _mm_set1_epi16((short)sa);
+			for (; w >= 4; w -= 4, dp += 16)
+				fz_blend_4_pixels_sse2(dp, color16, sa16);
+		}
+#endif
 		while (w--)
 		{
 			unsigned int RGBA = *(unsigned int *)dp;
@@ -262,6 +325,26 @@ fz_paint_span_with_color_4(byte * restrict dp, byte * restrict mp, int w, byte *
 	mask = 0xFF00FF00;
 	rb = rgba & (mask>>8);
 	ga = (rgba & mask)>>8;
+#ifdef FZ_PAINT_SSE2
+	if (fz_has_sse2())
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i color16 = _mm_unpacklo_epi8(_mm_set1_epi32(rgba), zero);
+		__m128i sa16 = _mm_set1_epi16((short)sa);
+		for (; w >= 4; w -= 4, dp += 16, mp += 4)
+		{
+			unsigned int m4 = mp[0] | (mp[1] << 8) | (mp[2] << 16) | ((unsigned int)mp[3] << 24);
+			__m128i ma;
+			if (m4 == 0)
+				continue;
+			ma = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)m4), zero);
+			ma = _mm_add_epi16(ma, _mm_srli_epi16(ma, 7));
+			if (sa != 256)
+				ma = _mm_srli_epi16(_mm_mullo_epi16(ma, sa16), 8);
+			fz_blend_4_pixels_sse2(dp, color16, ma);
+		}
+	}
+#endif
 	if (sa == 256)
 	{
 		while (w--)
@@ -621,6 +704,33 @@ fz_paint_span_2(byte * restrict dp, byte * restrict sp, int w)
 static inline void
 fz_paint_span_4(byte * restrict dp, byte * restrict sp, int w)
 {
+#ifdef FZ_PAINT_SSE2
+	if (fz_has_sse2())
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i c256 = _mm_set1_epi16(256);
+		for (; w >= 4; w -= 4, dp += 16, sp += 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i *)sp);
+			__m128i d = _mm_loadu_si128((const __m128i *)dp);
+			__m128i sa = _mm_srli_epi32(s, 24);
+			/* pixels with a transparent source are left alone */
+			__m128i keep = _mm_cmpeq_epi32(sa, zero);
+			__m128i t, lo, hi, r;
+			if (_mm_movemask_epi8(keep) == 0xFFFF)
+				continue;
+			/* t = 256 - FZ_EXPAND(sa), broadcast to all components of a pixel */
+			t = _mm_sub_epi16(c256, _mm_add_epi16(sa, _mm_srli_epi16(sa, 7)));
+			t = _mm_shufflehi_epi16(_mm_shufflelo_epi16(t, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+			lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(t, t)), 8);
+			hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(t, t)), 8);
+			/* *dp = *sp + FZ_COMBINE(*dp, t) (wrapping around just like the scalar code) */
+			r = _mm_add_epi8(s, _mm_packus_epi16(lo, hi));
+			r = _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, r));
+			_mm_storeu_si128((__m128i *)dp, r);
+		}
+	}
+#endif
 	while (w--)
 	{
 		int t = FZ_EXPAND(sp[3]);
@@ -3,18 +3,57 @@
 
 #define MAX_DEPTH 8
 
+/* SumatraPDF: for paths with this many segments (e.g. in CAD drawings
+ * and maps), consecutive segments which don't leave a box of
+ * SIMPLIFY_TOLERANCE device pixels around their start are merged,
+ * which considerably reduces the number of edges at low zoom levels */
+#define SIMPLIFY_MIN_CMDS 10000
+#define SIMPLIFY_TOLERANCE 0.25f
+
+struct fctx
+{
+	fz_gel *gel;
+	const fz_matrix *ctm;
+	float flatness;
+	int simplify;
+	int pending;
+	fz_point from;
+	fz_point to;
+};
+
 static void
-line(fz_gel *gel, const fz_matrix *ctm, float x0, float y0, float x1, float y1)
+flush_line(struct fctx *s)
 {
-	float tx0 = ctm->a * x0 + ctm->c * y0 + ctm->e;
-	float ty0 = ctm->b * x0 + ctm->d * y0 + ctm->f;
+	if (s->pending)
+		fz_insert_gel(s->gel, s->from.x, s->from.y, s->to.x, s->to.y);
+	s->pending = 0;
+}
+
+static void
+line(struct fctx *s, float x0, float y0, float x1, float y1)
+{
+	const fz_matrix *ctm = s->ctm;
 	float tx1 = ctm->a * x1 + ctm->c * y1 + ctm->e;
 	float ty1 = ctm->b * x1 + ctm->d * y1 + ctm->f;
-	fz_insert_gel(gel, tx0, ty0, tx1, ty1);
+
+	if (!s->pending)
+	{
+		s->from.x = ctm->a * x0 + ctm->c * y0 + ctm->e;
+		s->from.y = ctm->b * x0 + ctm->d * y0 + ctm->f;
+	}
+	if (s->simplify && fz_abs(tx1 - s->from.x) < SIMPLIFY_TOLERANCE && fz_abs(ty1 - s->from.y) < SIMPLIFY_TOLERANCE)
+	{
+		s->to.x = tx1;
+		s->to.y = ty1;
+		s->pending = 1;
+		return;
+	}
+	fz_insert_gel(s->gel, s->from.x, s->from.y, tx1, ty1);
+	s->pending = 0;
 }
 
 static void
-bezier(fz_gel *gel, const fz_matrix *ctm, float flatness,
+bezier(struct fctx *s,
 	float xa, float ya,
 	float xb, float yb,
 	float xc, float yc,
@@ -33,9 +72,9 @@ bezier(fz_gel *gel, const fz_matrix *ctm, float flatness,
 	dmax = fz_max(dmax, fz_abs(ya - yb));
 	dmax = fz_max(dmax, fz_abs(xd - xc));
 	dmax = fz_max(dmax, fz_abs(yd - yc));
-	if (dmax < flatness || depth >= MAX_DEPTH)
+	if (dmax < s->flatness || depth >= MAX_DEPTH)
 	{
-		line(gel, ctm, xa, ya, xd, yd);
+		line(s, xa, ya, xd, yd);
 		return;
 	}
 
@@ -63,13 +102,14 @@ bezier(fz_gel *gel, const fz_matrix *ctm, float flatness,
 
 	xabcd *= 0.125f; yabcd *= 0.125f;
 
-	bezier(gel, ctm, flatness, xa, ya, xab, yab, xabc, yabc, xabcd, yabcd, depth + 1);
-	bezier(gel, ctm, flatness, xabcd, yabcd, xbcd, ybcd, xcd, ycd, xd, yd, depth + 1);
+	bezier(s, xa, ya, xab, yab, xabc, yabc, xabcd, yabcd, depth + 1);
+	bezier(s, xabcd, yabcd, xbcd, ybcd, xcd, ycd, xd, yd, depth + 1);
 }
 
 void
 fz_flatten_fill_path(fz_gel *gel, fz_path *path, const fz_matrix *ctm, float flatness)
 {
+	struct fctx s;
 	float x1, y1, x2, y2, x3, y3;
 	float cx = 0;
 	float cy = 0;
@@ -77,6 +117,12 @@ fz_flatten_fill_path(fz_gel *gel, fz_path *path, const fz_matrix *ctm, float fla
 	float by = 0;
 	int i = 0, k = 0;
 
+	s.gel = gel;
+	s.ctm = ctm;
+	s.flatness = flatness;
+	s.simplify = path->cmd_len >= SIMPLIFY_MIN_CMDS;
+	s.pending = 0;
+
 	while (i < path->cmd_len)
 	{
 		switch (path->cmds[i++])
@@ -84,7 +130,8 @@ fz_flatten_fill_path(fz_gel *gel, fz_path *path, const fz_matrix *ctm, float fla
 		case FZ_MOVETO:
 			/* implicit closepath before moveto */
 			if (cx != bx || cy != by)
-				line(gel, ctm, cx, cy, bx, by);
+				line(&s, cx, cy, bx, by);
+			flush_line(&s);
 			x1 = path->coords[k++];
 			y1 = path->coords[k++];
 			cx = bx = x1;
@@ -94,7 +141,7 @@ fz_flatten_fill_path(fz_gel *gel, fz_path *path, const fz_matrix *ctm, float fla
 		case FZ_LINETO:
 			x1 = path->coords[k++];
 			y1 = path->coords[k++];
-			line(gel, ctm, cx, cy, x1, y1);
+			line(&s, cx, cy, x1, y1);
 			cx = x1;
 			cy = y1;
 			break;
@@ -106,13 +153,14 @@ fz_flatten_fill_path(fz_gel *gel, fz_path *path, const fz_matrix *ctm, float fla
 			y2 = path->coords[k++];
 			x3 = path->coords[k++];
 			y3 = path->coords[k++];
-			bezier(gel, ctm, flatness, cx, cy, x1, y1, x2, y2, x3, y3, 0);
+			bezier(&s, cx, cy, x1, y1, x2, y2, x3, y3, 0);
 			cx = x3;
 			cy = y3;
 			break;
 
 		case FZ_CLOSE_PATH:
-			line(gel, ctm, cx, cy, bx, by);
+			line(&s, cx, cy, bx, by);
+			flush_line(&s);
 			cx = bx;
 			cy = by;
 			break;
@@ -120,7 +168,8 @@ fz_flatten_fill_path(fz_gel *gel, fz_path *path, const fz_matrix *ctm, float fla
 	}
 
 	if (cx != bx || cy != by)
-		line(gel, ctm, cx, cy, bx, by);
+		line(&s, cx, cy, bx, by);
+	flush_line(&s);
 }
 
 struct sctx
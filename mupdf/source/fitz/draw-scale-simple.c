@@ -21,6 +21,14 @@ intermediate results rather than ints.
  */
 #define SINGLE_PIXEL_SPECIALS
 
+/* SumatraPDF: the horizontal scaling of 4 component rows and the vertical
+ * scaling of all rows have SSE2 variants (chosen at runtime), which produce
+ * exactly the same output as the C code. */
+#if !defined(ARCH_ARM) && (defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__))
+#define SCALE_SSE2
+#include <emmintrin.h>
+#endif
+
 #ifdef DEBUG_SCALING
 #ifdef WIN32
 #include <windows.h>
@@ -976,6 +984,112 @@ scale_row_to_temp2(unsigned char *dst, unsigned char *src, fz_weights *weights)
 	}
 }
 
+#ifdef SCALE_SSE2
+
+/* Weights are at most 256 (cf. check_weights), so two of them can be
+ * multiplied with two source values at once by _mm_madd_epi16 */
+static inline __m128i
+weight_pair(int w0, int w1)
+{
+	return _mm_set1_epi32((w1 << 16) | (w0 & 0xFFFF));
+}
+
+/* (unsigned char)(val>>8) for 4 32-bit values, returned as 4 packed bytes */
+static inline int
+pack_scaled(__m128i val)
+{
+	val = _mm_and_si128(_mm_srai_epi32(val, 8), _mm_set1_epi32(0xFF));
+	val = _mm_packs_epi32(val, val);
+	return _mm_cvtsi128_si32(_mm_packus_epi16(val, val));
+}
+
+static inline int
+scale_pixel4_sse2(const unsigned char *min, const int *contrib, int len)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_set1_epi32(128);
+	for (; len >= 2; len -= 2, min += 8, contrib += 2)
+	{
+		/* interleave the components of two pixels (r0 r1 g0 g1 b0 b1 a0 a1) */
+		__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)min), zero);
+		p = _mm_unpacklo_epi16(p, _mm_srli_si128(p, 8));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair(contrib[0], contrib[1])));
+	}
+	if (len > 0)
+	{
+		__m128i p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)min), zero);
+		p = _mm_unpacklo_epi16(p, zero);
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair(contrib[0], 0)));
+	}
+	return pack_scaled(acc);
+}
+
+static void
+scale_row_to_temp4_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i;
+	unsigned char *min;
+
+	if (weights->flip)
+	{
+		dst += 4*weights->count;
+		for (i=weights->count; i > 0; i--)
+		{
+			min = &src[4 * *contrib++];
+			len = *contrib++;
+			dst -= 4;
+			*(int *)dst = scale_pixel4_sse2(min, contrib, len);
+			contrib += len;
+		}
+	}
+	else
+	{
+		for (i=weights->count; i > 0; i--)
+		{
+			min = &src[4 * *contrib++];
+			len = *contrib++;
+			*(int *)dst = scale_pixel4_sse2(min, contrib, len);
+			dst += 4;
+			contrib += len;
+		}
+	}
+}
+
+/* scales width / 8 * 8 bytes and returns how many bytes have been scaled */
+static int
+scale_row_from_temp_sse2(unsigned char *dst, unsigned char *src, int *contrib, int len, int width)
+{
+	__m128i zero = _mm_setzero_si128();
+	int x, k;
+
+	for (x = 0; width - x >= 8; x += 8)
+	{
+		__m128i acc_lo = _mm_set1_epi32(128);
+		__m128i acc_hi = _mm_set1_epi32(128);
+		unsigned char *min = src + x;
+		for (k = 0; k < len; k += 2)
+		{
+			__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)min), zero);
+			__m128i b = zero, w;
+			if (k + 1 < len)
+			{
+				b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(min + width)), zero);
+				w = weight_pair(contrib[k], contrib[k+1]);
+			}
+			else
+				w = weight_pair(contrib[k], 0);
+			acc_lo = _mm_add_epi32(acc_lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			acc_hi = _mm_add_epi32(acc_hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+			min += 2 * width;
+		}
+		*(int *)(dst + x) = pack_scaled(acc_lo);
+		*(int *)(dst + x + 4) = pack_scaled(acc_hi);
+	}
+	return x;
+}
+#endif
+
 static void
 scale_row_to_temp4(unsigned char *dst, unsigned char *src, fz_weights *weights)
 {
@@ -984,6 +1098,13 @@ scale_row_to_temp4(unsigned char *dst, unsigned char *src, fz_weights *weights)
 	unsigned char *min;
 
 	assert(weights->n == 4);
+#ifdef SCALE_SSE2
+	if (fz_has_sse2())
+	{
+		scale_row_to_temp4_sse2(dst, src, weights);
+		return;
+	}
+#endif
 	if (weights->flip)
 	{
 		dst += 4*weights->count;
@@ -1041,7 +1162,17 @@ scale_row_from_temp(unsigned char *dst, unsigned char *src, fz_weights *weights,
 
 	contrib++; /* Skip min */
 	len = *contrib++;
-	for (x=width; x > 0; x--)
+	x = width;
+#ifdef SCALE_SSE2
+	if (fz_has_sse2())
+	{
+		int done = scale_row_from_temp_sse2(dst, src, contrib, len, width);
+		dst += done;
+		src += done;
+		x -= done;
+	}
+#endif
+	for (; x > 0; x--)
 	{
 		unsigned char *min = src;
 		int val = 128;
@@ -170,6 +170,11 @@ read_dctd(fz_stream *stm, unsigned char *buf, int len)
 
 		cinfo->scale_num = 8/(1<<state->l2factor);
 		cinfo->scale_denom = 8;
+		/* SumatraPDF: reduced images are only ever drawn scaled down, so
+		 * the smoother chroma of fancy upsampling isn't worth its cost
+		 * (without it, libjpeg-turbo merges upsampling and color conversion) */
+		if (state->l2factor > 0)
+			cinfo->do_fancy_upsampling = FALSE;
 
 		jpeg_start_decompress(cinfo);
 
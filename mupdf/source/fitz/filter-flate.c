@@ -128,3 +128,93 @@ fz_open_flated(fz_stream *chain)
 	}
 	return fz_new_stream(ctx, state, read_flated, close_flated, rebind_flated);
 }
+
+/* SumatraPDF: inflating an entire buffer with a single call lets zlib spend
+ * most of its time in inflate_fast instead of handling chunk boundaries;
+ * returns NULL for any broken stream, as those are better left to the
+ * more lenient error handling of read_flated */
+static fz_buffer *
+fz_inflate_all(fz_context *ctx, unsigned char *data, int len, int initial)
+{
+	fz_buffer *buf = NULL;
+	z_stream z;
+	int code;
+
+	memset(&z, 0, sizeof(z));
+	z.zalloc = zalloc;
+	z.zfree = zfree;
+	z.opaque = ctx;
+	if (inflateInit(&z) != Z_OK)
+		return NULL;
+
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		/* Deflate can't compress better than about 1032:1, so larger
+		 * initial sizes (e.g. from a broken /DL) are ignored */
+		if (initial <= 0 || initial / 1032 > len)
+			initial = len * 3;
+		buf = fz_new_buffer(ctx, initial);
+		z.next_in = data;
+		z.avail_in = len;
+		do
+		{
+			if (buf->len == buf->cap)
+				fz_grow_buffer(ctx, buf);
+			z.next_out = buf->data + buf->len;
+			z.avail_out = buf->cap - buf->len;
+			code = inflate(&z, Z_NO_FLUSH);
+			buf->len = buf->cap - z.avail_out;
+		} while ((code == Z_OK || code == Z_BUF_ERROR) && z.avail_out == 0);
+		if (code != Z_STREAM_END)
+		{
+			fz_drop_buffer(ctx, buf);
+			buf = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		inflateEnd(&z);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		buf = NULL;
+	}
+
+	return buf;
+}
+
+fz_stream *
+fz_open_flated_all(fz_stream *chain, int initial)
+{
+	fz_context *ctx = chain->ctx;
+	fz_buffer *raw = NULL, *buf = NULL;
+	fz_stream *stm = NULL;
+
+	fz_var(raw);
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		raw = fz_read_all(chain, 0);
+		buf = fz_inflate_all(ctx, raw->data, raw->len, initial);
+		if (buf)
+			stm = fz_open_buffer(ctx, buf);
+		else
+			stm = fz_open_flated(fz_open_buffer(ctx, raw));
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_drop_buffer(ctx, raw);
+		fz_close(chain);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return stm;
+}
@@ -19,21 +19,28 @@ struct fz_jbig2d_s
 	int idx;
 };
 
-static void
+void
 fz_drop_jbig2_globals(fz_context *ctx, fz_jbig2_globals *globals)
 {
-	fz_drop_storable(ctx, &globals->storable);
+	if (globals)
+		fz_drop_storable(ctx, &globals->storable);
 }
 
 static void
 close_jbig2d(fz_context *ctx, void *state_)
 {
 	fz_jbig2d *state = (fz_jbig2d *)state_;
+	/* SumatraPDF: freeing releases images borrowed from the globals */
+	if (state->gctx)
+		fz_lock(ctx, FZ_LOCK_JBIG2);
 	if (state->page)
 		jbig2_release_page(state->ctx, state->page);
+	jbig2_ctx_free(state->ctx);
 	if (state->gctx)
+	{
+		fz_unlock(ctx, FZ_LOCK_JBIG2);
 		fz_drop_jbig2_globals(ctx, state->gctx);
-	jbig2_ctx_free(state->ctx);
+	}
 	fz_close(state->chain);
 	fz_free(ctx, state);
 }
@@ -50,17 +57,28 @@ read_jbig2d(fz_stream *stm, unsigned char *buf, int len)
 
 	if (!state->page)
 	{
+		/* SumatraPDF: the globals may be shared between threads (cf.
+		 * pdf_load_jbig2_globals) and jbig2dec isn't thread-safe when
+		 * decoding text regions from their symbol dictionaries */
 		while (1)
 		{
 			n = fz_read(state->chain, tmp, sizeof tmp);
 			if (n == 0)
 				break;
+			if (state->gctx)
+				fz_lock(stm->ctx, FZ_LOCK_JBIG2);
 			jbig2_data_in(state->ctx, tmp, n);
+			if (state->gctx)
+				fz_unlock(stm->ctx, FZ_LOCK_JBIG2);
 		}
 
+		if (state->gctx)
+			fz_lock(stm->ctx, FZ_LOCK_JBIG2);
 		jbig2_complete_page(state->ctx);
-
 		state->page = jbig2_page_out(state->ctx);
+		if (state->gctx)
+			fz_unlock(stm->ctx, FZ_LOCK_JBIG2);
+
 		if (!state->page)
 			fz_throw(stm->ctx, FZ_ERROR_GENERIC, "jbig2_page_out failed");
 	}
@@ -325,6 +325,15 @@ public:
 	{
 		assert(GetMapMode(hDC) == MM_TEXT);
 		graphics = _setup(new Graphics(hDC));
+		// antialiasing makes GDI+ send rasterized bands instead of vector
+		// graphics to printers, which bloats the spool files (while it
+		// doesn't make a visible difference at printer resolutions)
+		if (GetDeviceCaps(hDC, TECHNOLOGY) == DT_RASPRINTER)
+		{
+			graphics->SetSmoothingMode(SmoothingModeNone);
+			graphics->SetTextRenderingHint(TextRenderingHintSingleBitPerPixelGridFit);
+			graphics->SetPixelOffsetMode(PixelOffsetModeNone);
+		}
 		graphics->GetClip(&stack->clip);
 		graphics->SetClip(RectF(clip->x0, clip->y0, clip->x1 - clip->x0, clip->y1 - clip->y0));
 	}
@@ -377,6 +377,23 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	case FZ_IMAGE_JXR:
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
+	/* SumatraPDF: decode JPX images only at the resolution needed */
+	case FZ_IMAGE_JPX:
+	{
+		fz_colorspace *cs = image->colorspace;
+		indexed = image->buffer->params.u.jpx.indexed;
+		/* device colorspaces are picked by fz_load_jpx_reduced itself
+		   (e.g. images with alpha and 4 color components end up in RGB) */
+		if (cs == fz_device_gray(ctx) || cs == fz_device_rgb(ctx) || cs == fz_device_cmyk(ctx))
+			cs = NULL;
+		native_l2factor = l2factor;
+		tile = fz_load_jpx_reduced(ctx, image->buffer->buffer->data, image->buffer->buffer->len, cs, indexed, &native_l2factor);
+		if (!indexed)
+			fz_decode_tile(tile, image->decode);
+		if (l2factor > native_l2factor)
+			fz_subsample_pixmap(ctx, tile, l2factor - native_l2factor);
+		break;
+	}
 	default:
 		native_l2factor = l2factor;
 		stm = fz_open_image_decomp_stream(ctx, image->buffer, &native_l2factor);
@@ -71,20 +71,16 @@ OPJ_BOOL stream_seek(OPJ_OFF_T seek_pos, void * p_user_data)
 	return OPJ_TRUE;
 }
 
-fz_pixmap *
-fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+/* SumatraPDF: reads the header of a JPX image and (unless header_only is set)
+ * decodes it at 1/2^reduce of its resolution */
+static opj_image_t *
+jpx_read_image(fz_context *ctx, unsigned char *data, int size, int indexed, int reduce, int header_only)
 {
-	fz_pixmap *img;
-	fz_colorspace *origcs;
 	opj_dparameters_t params;
 	opj_codec_t *codec;
 	opj_image_t *jpx;
 	opj_stream_t *stream;
-	fz_colorspace *colorspace;
-	unsigned char *p;
 	OPJ_CODEC_FORMAT format;
-	int a, n, w, h, depth, sgnd;
-	int x, y, k, v;
 	stream_block sb;
 
 	if (size < 2)
@@ -99,6 +95,7 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 	opj_set_default_decoder_parameters(&params);
 	if (indexed)
 		params.flags |= OPJ_DPARAMETERS_IGNORE_PCLR_CMAP_CDEF_FLAG;
+	params.cp_reduce = reduce;
 
 	codec = opj_create_decompress(format);
 	opj_set_info_handler(codec, fz_opj_info_callback, ctx);
@@ -129,7 +126,7 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
-	if (!opj_decode(codec, stream, jpx))
+	if (!header_only && !opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
 		opj_destroy_codec(codec);
@@ -144,6 +141,100 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 	if (!jpx)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "opj_decode failed");
 
+	return jpx;
+}
+
+/* determines the number of color components (n) and whether the image
+ * has an alpha channel (a) and picks the matching colorspace */
+static fz_colorspace *
+jpx_colorspace(fz_context *ctx, opj_image_t *jpx, fz_colorspace *defcs, int *n_out, int *a_out)
+{
+	int n = jpx->numcomps, a;
+
+	if (jpx->color_space == OPJ_CLRSPC_SRGB && n == 4) { n = 3; a = 1; }
+	else if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 4) { n = 3; a = 1; }
+	else if (n == 2) { n = 1; a = 1; }
+	else if (n > 4) { n = 4; a = 1; }
+	else { a = 0; }
+
+	*n_out = n;
+	*a_out = a;
+
+	if (defcs)
+	{
+		if (defcs->n == n)
+			return defcs;
+		fz_warn(ctx, "jpx file and dict colorspaces do not match");
+	}
+
+	switch (n)
+	{
+	case 1: return fz_device_gray(ctx);
+	case 3: return fz_device_rgb(ctx);
+	case 4: return fz_device_cmyk(ctx);
+	}
+	return NULL;
+}
+
+void
+fz_load_jpx_info(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, int *wp, int *hp, fz_colorspace **cspacep)
+{
+	opj_image_t *jpx = jpx_read_image(ctx, data, size, indexed, 0, 1);
+	fz_colorspace *colorspace;
+	int n, a, dx, dy;
+
+	if (jpx->numcomps < 1 || !jpx->comps[0].dx || !jpx->comps[0].dy)
+	{
+		opj_image_destroy(jpx);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid JPX image header");
+	}
+
+	/* cf. opj_j2k_update_image_data */
+	dx = jpx->comps[0].dx;
+	dy = jpx->comps[0].dy;
+	*wp = (jpx->x1 + dx - 1) / dx - (jpx->x0 + dx - 1) / dx;
+	*hp = (jpx->y1 + dy - 1) / dy - (jpx->y0 + dy - 1) / dy;
+
+	colorspace = jpx_colorspace(ctx, jpx, defcs, &n, &a);
+	/* images with alpha and 4 color components are converted to RGB */
+	if (a && n == 4)
+		colorspace = fz_device_rgb(ctx);
+	*cspacep = fz_keep_colorspace(ctx, colorspace);
+
+	opj_image_destroy(jpx);
+}
+
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed, int *l2factor)
+{
+	fz_pixmap *img;
+	opj_image_t *jpx = NULL;
+	fz_colorspace *colorspace;
+	unsigned char *p;
+	int a, n, w, h, depth, sgnd;
+	int x, y, k, v;
+
+	fz_var(jpx);
+
+	/* the reduction is limited by the number of resolution levels
+	 * in the codestream, so fall back to decoding at full size */
+	if (*l2factor > 0)
+	{
+		fz_try(ctx)
+		{
+			jpx = jpx_read_image(ctx, data, size, indexed, *l2factor, 0);
+		}
+		fz_catch(ctx)
+		{
+			jpx = NULL;
+		}
+	}
+	if (!jpx)
+	{
+		*l2factor = 0;
+		jpx = jpx_read_image(ctx, data, size, indexed, 0, 0);
+	}
+
 	for (k = 1; k < (int)jpx->numcomps; k++)
 	{
 		if (!jpx->comps[k].data)
@@ -168,41 +259,12 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 		}
 	}
 
-	n = jpx->numcomps;
 	w = jpx->comps[0].w;
 	h = jpx->comps[0].h;
 	depth = jpx->comps[0].prec;
 	sgnd = jpx->comps[0].sgnd;
 
-	if (jpx->color_space == OPJ_CLRSPC_SRGB && n == 4) { n = 3; a = 1; }
-	else if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 4) { n = 3; a = 1; }
-	else if (n == 2) { n = 1; a = 1; }
-	else if (n > 4) { n = 4; a = 1; }
-	else { a = 0; }
-
-	origcs = defcs;
-	if (defcs)
-	{
-		if (defcs->n == n)
-		{
-			colorspace = defcs;
-		}
-		else
-		{
-			fz_warn(ctx, "jpx file and dict colorspaces do not match");
-			defcs = NULL;
-		}
-	}
-
-	if (!defcs)
-	{
-		switch (n)
-		{
-		case 1: colorspace = fz_device_gray(ctx); break;
-		case 3: colorspace = fz_device_rgb(ctx); break;
-		case 4: colorspace = fz_device_cmyk(ctx); break;
-		}
-	}
+	colorspace = jpx_colorspace(ctx, jpx, defcs, &n, &a);
 
 	fz_try(ctx)
 	{
@@ -249,3 +311,10 @@ fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs
 
 	return img;
 }
+
+fz_pixmap *
+fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *defcs, int indexed)
+{
+	int l2factor = 0;
+	return fz_load_jpx_reduced(ctx, data, size, defcs, indexed, &l2factor);
+}
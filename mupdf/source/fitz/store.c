@@ -636,3 +636,35 @@ int fz_store_scavenge(fz_context *ctx, unsigned int size, int *phase)
 #endif
 	return 0;
 }
+
+/* SumatraPDF: allow to adjust a store's budget while it's in use */
+void
+fz_set_store_limit(fz_context *ctx, unsigned int max)
+{
+	fz_store *store = ctx->store;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->max = max;
+	/* only items which are no longer used elsewhere can be evicted */
+	if (store->size > max)
+		scavenge(ctx, store->size - max);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+unsigned int
+fz_store_size(fz_context *ctx)
+{
+	fz_store *store = ctx->store;
+	unsigned int size;
+
+	if (store == NULL)
+		return 0;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	size = store->size;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return size;
+}
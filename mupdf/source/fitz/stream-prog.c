@@ -179,3 +179,126 @@ fz_open_file_progressive(fz_context *ctx, const char *name, int bps)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open %s", name);
 	return fz_open_fd_progressive(ctx, fd, bps);
 }
+
+/* SumatraPDF: progressive reading from a buffer which is filled by another thread */
+
+typedef struct prog_buffer_state
+{
+	fz_buffer *buffer;
+	volatile int *available;
+} prog_buffer_state;
+
+static int read_prog_buffer(fz_stream *stm, unsigned char *buf, int len)
+{
+	prog_buffer_state *ps = (prog_buffer_state *)stm->state;
+	int av = *ps->available;
+
+	if (av < 0)
+		fz_throw(stm->ctx, FZ_ERROR_GENERIC, "read error: data couldn't be loaded");
+	/* Limit any fetches to be within the data we have */
+	if (len + stm->pos > av)
+	{
+		len = av - stm->pos;
+		if (len <= 0 && av < ps->buffer->len)
+		{
+			show_progress(av, stm->pos);
+			fz_throw(stm->ctx, FZ_ERROR_TRYLATER, "Not enough data yet");
+		}
+	}
+	if (len <= 0)
+		return 0;
+
+	memcpy(buf, ps->buffer->data + stm->pos, len);
+	return len;
+}
+
+static void seek_prog_buffer(fz_stream *stm, int offset, int whence)
+{
+	prog_buffer_state *ps = (prog_buffer_state *)stm->state;
+	int av = *ps->available;
+
+	if (whence == SEEK_END)
+	{
+		if (av < ps->buffer->len)
+		{
+			show_progress(av, ps->buffer->len);
+			fz_throw(stm->ctx, FZ_ERROR_TRYLATER, "Not enough data to seek to end yet");
+		}
+		offset += ps->buffer->len;
+	}
+	else if (whence == SEEK_CUR)
+		offset += stm->pos;
+	if (offset > av && av < ps->buffer->len)
+	{
+		show_progress(av, offset);
+		fz_throw(stm->ctx, FZ_ERROR_TRYLATER, "Not enough data to seek to offset yet");
+	}
+
+	stm->pos = fz_clampi(offset, 0, ps->buffer->len);
+	stm->rp = stm->bp;
+	stm->wp = stm->bp;
+}
+
+static void close_prog_buffer(fz_context *ctx, void *state)
+{
+	prog_buffer_state *ps = (prog_buffer_state *)state;
+	fz_drop_buffer(ctx, ps->buffer);
+	fz_free(ctx, state);
+}
+
+static int meta_prog_buffer(fz_stream *stm, int key, int size, void *ptr)
+{
+	prog_buffer_state *ps = (prog_buffer_state *)stm->state;
+	switch(key)
+	{
+	case FZ_STREAM_META_PROGRESSIVE:
+		return 1;
+	case FZ_STREAM_META_LENGTH:
+		return ps->buffer->len;
+	}
+	return -1;
+}
+
+static fz_stream *reopen_prog_buffer(fz_context *ctx, fz_stream *stm)
+{
+	prog_buffer_state *ps = (prog_buffer_state *)stm->state;
+	fz_stream *clone;
+	fz_buffer *buf;
+
+	if (*ps->available != ps->buffer->len)
+		fz_throw(ctx, FZ_ERROR_TRYLATER, "can't clone stream before all data has arrived");
+	/* cf. reopen_buffer in stream-open.c */
+	buf = fz_new_buffer(ctx, ps->buffer->len);
+	memcpy(buf->data, ps->buffer->data, (buf->len = buf->cap));
+	clone = fz_open_buffer(ctx, buf);
+	fz_drop_buffer(ctx, buf);
+
+	return clone;
+}
+
+fz_stream *
+fz_open_buffer_progressive(fz_context *ctx, fz_buffer *buf, volatile int *available)
+{
+	fz_stream *stm;
+	prog_buffer_state *state;
+
+	state = fz_malloc_struct(ctx, prog_buffer_state);
+	state->buffer = fz_keep_buffer(ctx, buf);
+	state->available = available;
+
+	fz_try(ctx)
+	{
+		stm = fz_new_stream(ctx, state, read_prog_buffer, close_prog_buffer, NULL);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_free(ctx, state);
+		fz_rethrow(ctx);
+	}
+	stm->seek = seek_prog_buffer;
+	stm->meta = meta_prog_buffer;
+	stm->reopen = reopen_prog_buffer;
+
+	return stm;
+}
@@ -1352,18 +1352,28 @@ pdf_load_font(pdf_document *doc, pdf_obj *rdb, pdf_obj *dict, int nested_depth)
 	pdf_obj *dfonts;
 	pdf_obj *charprocs;
 	fz_context *ctx = doc->ctx;
-	pdf_font_desc *fontdesc;
+	pdf_font_desc *fontdesc, *existing;
 	int type3 = 0;
-
-	if ((fontdesc = pdf_find_item(ctx, pdf_free_font_imp, dict)) != NULL)
-	{
-		return fontdesc;
-	}
+	int shared;
 
 	subtype = pdf_to_name(pdf_dict_gets(dict, "Subtype"));
 	dfonts = pdf_dict_gets(dict, "DescendantFonts");
 	charprocs = pdf_dict_gets(dict, "CharProcs");
 
+	/* SumatraPDF: share fonts (and thus their FreeType faces) between
+	 * instances of the same document, except for Type 3 fonts which
+	 * reference the document they've been loaded from */
+	shared = !charprocs && strcmp(subtype, "Type3") != 0;
+
+	if (shared)
+		fontdesc = pdf_find_shared_item(doc, pdf_free_font_imp, dict);
+	else
+		fontdesc = pdf_find_item(ctx, pdf_free_font_imp, dict);
+	if (fontdesc != NULL)
+	{
+		return fontdesc;
+	}
+
 	if (subtype && !strcmp(subtype, "Type0"))
 		fontdesc = pdf_load_type0_font(doc, dict);
 	else if (subtype && !strcmp(subtype, "Type1"))
@@ -1398,7 +1408,14 @@ pdf_load_font(pdf_document *doc, pdf_obj *rdb, pdf_obj *dict, int nested_depth)
 	if (fontdesc->font->ft_substitute && !fontdesc->to_ttf_cmap)
 		pdf_make_width_table(ctx, fontdesc);
 
-	pdf_store_item(ctx, dict, fontdesc, fontdesc->size);
+	if (!shared)
+		pdf_store_item(ctx, dict, fontdesc, fontdesc->size);
+	else if ((existing = pdf_store_shared_item(doc, dict, fontdesc, fontdesc->size)) != NULL)
+	{
+		/* Another instance has loaded the font in the meantime */
+		pdf_drop_font(ctx, fontdesc);
+		fontdesc = existing;
+	}
 
 	if (type3)
 		pdf_load_type3_glyphs(doc, fontdesc, nested_depth);
@@ -211,6 +211,73 @@ pdf_is_jpx_image(fz_context *ctx, pdf_obj *dict)
 	return 0;
 }
 
+/* SumatraPDF: JPX images (except for soft masks) are only decoded when
+ * they're drawn, so that they can be decoded at a reduced resolution */
+static fz_image *
+pdf_load_jpx_lazily(pdf_document *doc, pdf_obj *dict, fz_buffer *buf)
+{
+	fz_colorspace *colorspace = NULL;
+	fz_colorspace *jpxcs = NULL;
+	fz_compressed_buffer *cbuf = NULL;
+	fz_image *mask = NULL;
+	float decode[FZ_MAX_COLORS * 2];
+	int has_decode = 0;
+	int indexed = 0;
+	int w, h, i;
+	pdf_obj *obj;
+	fz_context *ctx = doc->ctx;
+
+	fz_var(colorspace);
+	fz_var(jpxcs);
+	fz_var(cbuf);
+	fz_var(mask);
+
+	fz_try(ctx)
+	{
+		obj = pdf_dict_gets(dict, "ColorSpace");
+		if (obj)
+		{
+			colorspace = pdf_load_colorspace(doc, obj);
+			indexed = fz_colorspace_is_indexed(colorspace);
+		}
+
+		fz_load_jpx_info(ctx, buf->data, buf->len, colorspace, indexed, &w, &h, &jpxcs);
+
+		obj = pdf_dict_getsa(dict, "SMask", "Mask");
+		if (pdf_is_dict(obj))
+			mask = pdf_load_image_imp(doc, NULL, obj, NULL, 1);
+
+		obj = pdf_dict_getsa(dict, "Decode", "D");
+		if (obj && !indexed)
+		{
+			for (i = 0; i < FZ_MAX_COLORS * 2; i++)
+				decode[i] = pdf_to_real(pdf_array_get(obj, i));
+			has_decode = 1;
+		}
+
+		cbuf = fz_malloc_struct(ctx, fz_compressed_buffer);
+		cbuf->params.type = FZ_IMAGE_JPX;
+		cbuf->params.u.jpx.smask_in_data = pdf_to_int(pdf_dict_gets(dict, "SMaskInData"));
+		cbuf->params.u.jpx.indexed = indexed;
+		cbuf->buffer = buf;
+		buf = NULL;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_colorspace(ctx, colorspace);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_colorspace(ctx, jpxcs);
+		fz_drop_image(ctx, mask);
+		fz_rethrow(ctx);
+	}
+
+	/* takes ownership of jpxcs, cbuf and mask */
+	return fz_new_image(ctx, w, h, 8, jpxcs, 96, 96, 0, 0, has_decode ? decode : NULL, NULL, cbuf, mask);
+}
+
 static fz_image *
 pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 {
@@ -229,6 +296,10 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 
 	buf = pdf_load_stream(doc, pdf_to_num(dict), pdf_to_gen(dict));
 
+	/* soft masks are accessed through image->tile (cf. pdf_load_image_imp) */
+	if (!forcemask)
+		return pdf_load_jpx_lazily(doc, dict, buf);
+
 	/* FIXME: We can't handle decode arrays for indexed images currently */
 	fz_try(ctx)
 	{
@@ -243,12 +314,7 @@ pdf_load_jpx(pdf_document *doc, pdf_obj *dict, int forcemask)
 
 		obj = pdf_dict_getsa(dict, "SMask", "Mask");
 		if (pdf_is_dict(obj))
-		{
-			if (forcemask)
-				fz_warn(ctx, "Ignoring recursive JPX soft mask");
-			else
-				mask = pdf_load_image_imp(doc, NULL, obj, NULL, 1);
-		}
+			fz_warn(ctx, "Ignoring recursive JPX soft mask");
 
 		obj = pdf_dict_getsa(dict, "Decode", "D");
 		if (obj && !indexed)
@@ -288,16 +354,25 @@ fz_image *
 pdf_load_image(pdf_document *doc, pdf_obj *dict)
 {
 	fz_context *ctx = doc->ctx;
-	fz_image *image;
+	fz_image *image, *existing;
 
-	if ((image = pdf_find_item(ctx, fz_free_image, dict)) != NULL)
+	/* SumatraPDF: share images (and their decoded pixmaps, which
+	 * fz_image_get_pixmap caches per subsampling factor) between
+	 * instances of the same document */
+	if ((image = pdf_find_shared_item(doc, fz_free_image, dict)) != NULL)
 	{
 		return (fz_image *)image;
 	}
 
 	image = pdf_load_image_imp(doc, NULL, dict, NULL, 0);
 
-	pdf_store_item(ctx, dict, image, fz_image_size(ctx, image));
+	existing = pdf_store_shared_item(doc, dict, image, fz_image_size(ctx, image));
+	if (existing)
+	{
+		/* Another instance has loaded the image in the meantime */
+		fz_drop_image(ctx, image);
+		image = existing;
+	}
 
 	return (fz_image *)image;
 }
@@ -622,3 +622,143 @@ pdf_repair_obj_stms(pdf_document *doc)
 			fz_throw(doc->ctx, FZ_ERROR_GENERIC, "invalid reference to non-object-stream: %d (%d 0 R)", entry->ofs, i);
 	}
 }
+
+/* SumatraPDF: allow to cache the result of repairing a broken xref */
+
+fz_buffer *
+pdf_save_repaired_xref(pdf_document *doc)
+{
+	fz_context *ctx = doc->ctx;
+	fz_buffer *buf;
+	char *trailer = NULL;
+	int i, n, len, encrypted;
+
+	/* there's only a single xref section after repairing */
+	if (!doc->repair_attempted || doc->num_xref_sections != 1 || !pdf_trailer(doc))
+		return NULL;
+
+	len = pdf_xref_len(doc);
+	encrypted = pdf_dict_gets(pdf_trailer(doc), "Encrypt") != NULL;
+	buf = fz_new_buffer(ctx, len * 32 + 256);
+
+	fz_var(trailer);
+
+	fz_try(ctx)
+	{
+		fz_buffer_printf(ctx, buf, "%d\n", len);
+		for (i = 0; i < len; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_xref_entry(doc, i);
+			/* remember stream lengths as corrected by pdf_repair_xref (for unencrypted documents) */
+			pdf_obj *length = !encrypted && entry->obj && entry->stm_ofs ? pdf_dict_gets(entry->obj, "Length") : NULL;
+			fz_buffer_printf(ctx, buf, "%c %d %d %d %d\n", entry->type ? entry->type : '-',
+				entry->ofs, entry->gen, entry->stm_ofs, pdf_is_int(length) ? pdf_to_int(length) : -1);
+		}
+		n = pdf_sprint_obj(NULL, 0, pdf_trailer(doc), 1);
+		trailer = fz_malloc(ctx, n + 1);
+		pdf_sprint_obj(trailer, n + 1, pdf_trailer(doc), 1);
+		fz_write_buffer(ctx, buf, trailer, n);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, trailer);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
+/* populates the (empty) xref section from data saved by pdf_save_repaired_xref;
+ * returns 0 if the data is invalid (in which case the xref must be freed) */
+int
+pdf_load_repaired_xref(pdf_document *doc, fz_buffer *data)
+{
+	fz_context *ctx = doc->ctx;
+	fz_stream *stm = NULL;
+	pdf_obj *trailer = NULL;
+	char *s = NULL;
+	int *lengths = NULL;
+	int len = 0, ok = 0, i, n;
+
+	fz_var(stm);
+	fz_var(trailer);
+	fz_var(s);
+	fz_var(lengths);
+
+	fz_try(ctx)
+	{
+		char *p;
+
+		s = fz_malloc(ctx, data->len + 1);
+		memcpy(s, data->data, data->len);
+		s[data->len] = '\0';
+
+		if (sscanf(s, "%d\n%n", &len, &n) != 1 || len <= 0 || len > data->len / 10)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "invalid repaired xref");
+		p = s + n;
+
+		lengths = fz_malloc_array(ctx, len, sizeof(int));
+		(void)pdf_get_populating_xref_entry(doc, len - 1);
+		for (i = 0; i < len; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_populating_xref_entry(doc, i);
+			char type;
+			if (sscanf(p, "%c %d %d %d %d\n%n", &type, &entry->ofs, &entry->gen, &entry->stm_ofs, &lengths[i], &n) != 5)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid repaired xref entry (%d)", i);
+			p += n;
+			if (type == 'n' && (entry->ofs < 0 || entry->ofs >= doc->file_length))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid repaired xref entry (%d)", i);
+			if (type == 'o' && (entry->ofs <= 0 || entry->ofs >= len))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid repaired xref entry (%d)", i);
+			if (type != 'n' && type != 'o' && type != 'f' && type != '-')
+				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid repaired xref entry (%d)", i);
+			entry->type = type != '-' ? type : 0;
+		}
+
+		stm = fz_open_memory(ctx, (unsigned char *)p, strlen(p));
+		trailer = pdf_parse_stm_obj(doc, stm, &doc->lexbuf.base);
+		if (!pdf_is_dict(trailer))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "invalid repaired trailer");
+		pdf_set_populating_xref_trailer(doc, trailer);
+
+		/* cf. pdf_repair_xref */
+		doc->repair_attempted = 1;
+		doc->dirty = 1;
+		doc->freeze_updates = 1;
+
+		for (i = 0; i < len; i++)
+		{
+			/* (objects replaced by appended incremental updates keep their own length) */
+			if (lengths[i] >= 0 && !pdf_dict_gets(trailer, "Encrypt") &&
+				pdf_get_xref_entry(doc, i) == pdf_get_populating_xref_entry(doc, i))
+			{
+				pdf_obj *dict = pdf_load_object(doc, i, pdf_get_xref_entry(doc, i)->gen);
+				pdf_obj *length = pdf_new_int(doc, lengths[i]);
+				pdf_dict_puts(dict, "Length", length);
+				pdf_drop_obj(length);
+				pdf_drop_obj(dict);
+			}
+		}
+		ok = 1;
+	}
+	fz_always(ctx)
+	{
+		fz_close(stm);
+		pdf_drop_obj(trailer);
+		fz_free(ctx, lengths);
+		fz_free(ctx, s);
+	}
+	fz_catch(ctx)
+	{
+		doc->repair_attempted = doc->dirty = doc->freeze_updates = 0;
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "ignoring cached repaired xref");
+		ok = 0;
+	}
+
+	return ok;
+}
@@ -75,3 +75,135 @@ pdf_remove_item(fz_context *ctx, fz_store_free_fn *free, pdf_obj *key)
 {
 	fz_remove_item(ctx, free, key, &pdf_obj_store_type);
 }
+
+/* SumatraPDF: items stored through pdf_store_shared_item are keyed by
+ * object number and doc->image_store_id instead of by object, so that
+ * several instances of the same document can share them */
+typedef struct pdf_shared_key_s pdf_shared_key;
+
+struct pdf_shared_key_s {
+	int refs;
+	void *store_id;
+	int num;
+	int gen;
+};
+
+static int
+pdf_make_hash_shared_key(fz_store_hash *hash, void *key_)
+{
+	pdf_shared_key *key = (pdf_shared_key *)key_;
+
+	hash->u.i.i0 = key->num;
+	hash->u.i.i1 = key->gen;
+	hash->u.i.ptr = key->store_id;
+	return 1;
+}
+
+static void *
+pdf_keep_shared_key(fz_context *ctx, void *key_)
+{
+	pdf_shared_key *key = (pdf_shared_key *)key_;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	key->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return (void *)key;
+}
+
+static void
+pdf_drop_shared_key(fz_context *ctx, void *key_)
+{
+	pdf_shared_key *key = (pdf_shared_key *)key_;
+	int drop;
+
+	if (key == NULL)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	drop = --key->refs;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop == 0)
+		fz_free(ctx, key);
+}
+
+static int
+pdf_cmp_shared_key(void *k0_, void *k1_)
+{
+	pdf_shared_key *k0 = (pdf_shared_key *)k0_;
+	pdf_shared_key *k1 = (pdf_shared_key *)k1_;
+
+	return k0->store_id == k1->store_id && k0->num == k1->num && k0->gen == k1->gen;
+}
+
+#ifndef NDEBUG
+static void
+pdf_debug_shared_key(FILE *out, void *key_)
+{
+	pdf_shared_key *key = (pdf_shared_key *)key_;
+
+	fprintf(out, "(shared %d %d R) ", key->num, key->gen);
+}
+#endif
+
+static fz_store_type pdf_shared_store_type =
+{
+	pdf_make_hash_shared_key,
+	pdf_keep_shared_key,
+	pdf_drop_shared_key,
+	pdf_cmp_shared_key,
+#ifndef NDEBUG
+	pdf_debug_shared_key
+#endif
+};
+
+/* Any failure here will just result in the item not being stored.
+ * Returns the item an instance has stored in the meantime, if any */
+void *
+pdf_store_shared_item(pdf_document *doc, pdf_obj *key, void *val, unsigned int itemsize)
+{
+	fz_context *ctx = doc->ctx;
+	pdf_shared_key *keyp = NULL;
+	void *existing = NULL;
+
+	if (!doc->image_store_id || !pdf_is_indirect(key))
+	{
+		pdf_store_item(ctx, key, val, itemsize);
+		return NULL;
+	}
+
+	fz_var(keyp);
+	fz_try(ctx)
+	{
+		keyp = fz_malloc_struct(ctx, pdf_shared_key);
+		keyp->refs = 1;
+		keyp->store_id = doc->image_store_id;
+		keyp->num = pdf_to_num(key);
+		keyp->gen = pdf_to_gen(key);
+		existing = fz_store_item(ctx, keyp, val, itemsize, &pdf_shared_store_type);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_shared_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return existing;
+}
+
+void *
+pdf_find_shared_item(pdf_document *doc, fz_store_free_fn *free, pdf_obj *key)
+{
+	pdf_shared_key sharedkey;
+
+	if (!doc->image_store_id || !pdf_is_indirect(key))
+		return pdf_find_item(doc->ctx, free, key);
+
+	sharedkey.refs = 1;
+	sharedkey.store_id = doc->image_store_id;
+	sharedkey.num = pdf_to_num(key);
+	sharedkey.gen = pdf_to_gen(key);
+	return fz_find_item(doc->ctx, free, &sharedkey, &pdf_shared_store_type);
+}
@@ -55,16 +55,24 @@ pdf_load_jbig2_globals(pdf_document *doc, pdf_obj *dict)
 
 	fz_var(buf);
 
-	if ((globals = pdf_find_item(ctx, fz_free_jbig2_globals_imp, dict)) != NULL)
+	/* SumatraPDF: decode shared symbol dictionaries only once for all
+	 * instances of the same document (cf. fz_open_jbig2d) */
+	if ((globals = pdf_find_shared_item(doc, fz_free_jbig2_globals_imp, dict)) != NULL)
 	{
 		return globals;
 	}
 
 	fz_try(ctx)
 	{
+		fz_jbig2_globals *existing;
 		buf = pdf_load_stream(doc, pdf_to_num(dict), pdf_to_gen(dict));
 		globals = fz_load_jbig2_globals(ctx, buf->data, buf->len);
-		pdf_store_item(ctx, dict, globals, buf->len);
+		existing = pdf_store_shared_item(doc, dict, globals, buf->len);
+		if (existing)
+		{
+			fz_drop_jbig2_globals(ctx, globals);
+			globals = existing;
+		}
 	}
 	fz_always(ctx)
 	{
@@ -296,6 +304,32 @@ pdf_open_raw_filter(fz_stream *chain, pdf_document *doc, pdf_obj *stmobj, int nu
 	return chain;
 }
 
+/* SumatraPDF: streams compressed with nothing but FlateDecode (which covers
+ * most content streams, object streams and fonts) are inflated all at once
+ * (cf. fz_open_flated_all), unless they're too large to be held in memory */
+#define MAX_INFLATE_ALL_LENGTH (4 << 20)
+
+static int
+pdf_is_plain_flate_stream(pdf_obj *stmobj, pdf_obj *filters, pdf_obj *params)
+{
+	char *name;
+	int len;
+
+	if (pdf_is_array(filters) && pdf_array_len(filters) == 1)
+	{
+		filters = pdf_array_get(filters, 0);
+		if (pdf_is_array(params))
+			params = pdf_array_get(params, 0);
+	}
+	name = pdf_to_name(filters);
+	if (strcmp(name, "FlateDecode") && strcmp(name, "Fl"))
+		return 0;
+	if (pdf_to_int(pdf_dict_gets(params, "Predictor")) > 1)
+		return 0;
+	len = pdf_to_int(pdf_dict_gets(stmobj, "Length"));
+	return 0 < len && len <= MAX_INFLATE_ALL_LENGTH;
+}
+
 /*
  * Construct a filter to decode a stream, constraining
  * to stream length and decrypting.
@@ -315,7 +349,15 @@ pdf_open_filter(fz_stream *chain, pdf_document *doc, pdf_obj *stmobj, int num, i
 
 	fz_try(doc->ctx)
 	{
-		if (pdf_is_name(filters))
+		/* compressed images are only decoded when needed (cf. pdf_load_compressed_stream) */
+		if (!imparams && pdf_is_plain_flate_stream(stmobj, filters, params))
+		{
+			fz_stream *chain2 = chain;
+			int len = pdf_to_int(pdf_dict_gets(stmobj, "DL"));
+			chain = NULL;
+			chain = fz_open_flated_all(chain2, len);
+		}
+		else if (pdf_is_name(filters))
 		{
 			fz_stream *chain2 = chain;
 			chain = NULL;
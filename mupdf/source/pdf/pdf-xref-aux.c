@@ -18,6 +18,17 @@ pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	return doc;
 }
 
+/* SumatraPDF: allow to skip repairing a document again */
+pdf_document *
+pdf_open_document_with_stream_and_xref(fz_context *ctx, fz_stream *file, fz_buffer *repaired_xref, int repaired_len)
+{
+	pdf_document *doc = pdf_open_document_no_run_with_stream_and_xref(ctx, file, repaired_xref, repaired_len);
+	doc->super.run_page_contents = (fz_document_run_page_contents_fn *)pdf_run_page_contents;
+	doc->super.run_annot = (fz_document_run_annot_fn *)pdf_run_annot;
+	doc->update_appearance = pdf_update_appearance;
+	return doc;
+}
+
 pdf_document *
 pdf_open_document(fz_context *ctx, const char *filename)
 {
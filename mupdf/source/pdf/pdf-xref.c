@@ -784,6 +784,42 @@ pdf_read_xref_sections(pdf_document *doc, int ofs, pdf_lexbuf *buf, int read_pre
 	}
 }
 
+/* SumatraPDF: read the xref sections of incremental updates appended to a
+ * file of length prefix_len (which is then to be populated separately) */
+static void
+pdf_read_appended_xref_sections(pdf_document *doc, int prefix_len, pdf_lexbuf *buf)
+{
+	fz_context *ctx = doc->ctx;
+	ofs_list list;
+	int ofs;
+
+	pdf_read_start_xref(doc);
+	ofs = doc->startxref;
+	if (ofs < prefix_len)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "no xref section in appended data");
+
+	list.len = 0;
+	list.max = 10;
+	list.list = fz_malloc_array(ctx, 10, sizeof(int));
+	fz_try(ctx)
+	{
+		while (ofs >= prefix_len)
+		{
+			pdf_populate_next_xref_level(doc);
+			ofs = read_xref_section(doc, ofs, buf, &list);
+		}
+		pdf_populate_next_xref_level(doc);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, list.list);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 /*
  * load xref tables from pdf
  *
@@ -1048,17 +1084,18 @@ pdf_free_ocg(fz_context *ctx, pdf_ocg_descriptor *desc)
  */
 
 static void
-pdf_init_document(pdf_document *doc)
+pdf_init_document(pdf_document *doc, fz_buffer *repaired_xref, int repaired_len)
 {
 	fz_context *ctx = doc->ctx;
 	pdf_obj *encrypt, *id;
 	pdf_obj *dict = NULL;
 	pdf_obj *obj;
 	pdf_obj *nobj = NULL;
-	int i, repaired = 0;
+	int i, repaired = 0, restored = 0;
 
 	fz_var(dict);
 	fz_var(nobj);
+	fz_var(restored);
 
 	fz_try(ctx)
 	{
@@ -1072,15 +1109,26 @@ pdf_init_document(pdf_document *doc)
 		if (fz_stream_meta(doc->file, FZ_STREAM_META_PROGRESSIVE, 0, NULL) > 0)
 			doc->file_reading_linearly = 1;
 
+		/* SumatraPDF: reuse the result of an earlier repair, if available */
+		if (repaired_xref)
+		{
+			/* SumatraPDF: incrementally updated files only need the updates' xref sections read */
+			if (repaired_len > 0)
+				pdf_read_appended_xref_sections(doc, repaired_len, &doc->lexbuf.base);
+			restored = pdf_load_repaired_xref(doc, repaired_xref);
+			if (!restored)
+				pdf_free_xref_sections(doc);
+		}
+
 		/* Try to load the linearized file if we are in progressive
 		 * mode. */
-		if (doc->file_reading_linearly)
+		if (doc->file_reading_linearly && !restored)
 			pdf_load_linear(doc);
 
 		/* If we aren't in progressive mode (or the linear load failed
 		 * and has set us back to non-progressive mode), load normally.
 		 */
-		if (!doc->file_reading_linearly)
+		if (!doc->file_reading_linearly && !restored)
 			pdf_load_xref(doc, &doc->lexbuf.base);
 	}
 	fz_catch(ctx)
@@ -1999,6 +2047,13 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 
 pdf_document *
 pdf_open_document_no_run_with_stream(fz_context *ctx, fz_stream *file)
+{
+	return pdf_open_document_no_run_with_stream_and_xref(ctx, file, NULL, 0);
+}
+
+/* SumatraPDF: allow to skip repairing a document again */
+pdf_document *
+pdf_open_document_no_run_with_stream_and_xref(fz_context *ctx, fz_stream *file, fz_buffer *repaired_xref, int repaired_len)
 {
 	pdf_document *doc = pdf_new_document(ctx, file);
 
@@ -2006,7 +2061,7 @@ pdf_open_document_no_run_with_stream(fz_context *ctx, fz_stream *file)
 
 	fz_try(ctx)
 	{
-		pdf_init_document(doc);
+		pdf_init_document(doc, repaired_xref, repaired_len);
 	}
 	fz_catch(ctx)
 	{
@@ -2029,7 +2084,7 @@ pdf_open_document_no_run(fz_context *ctx, const char *filename)
 	{
 		file = fz_open_file(ctx, filename);
 		doc = pdf_new_document(ctx, file);
-		pdf_init_document(doc);
+		pdf_init_document(doc, NULL, 0);
 	}
 	fz_always(ctx)
 	{
@@ -51,19 +51,21 @@ xps_resolve_resource_reference(xps_document *doc, xps_resource *dict,
 	}
 }
 
-static xps_resource *
-xps_parse_remote_resource_dictionary(xps_document *doc, char *base_uri, char *source_att)
+/* SumatraPDF: the pages of print spools usually all share the same remote
+   resource dictionaries, so their XML is only read and parsed once and is
+   then owned by doc->resource_table */
+static fz_xml *
+xps_load_remote_resource_xml(xps_document *doc, char *part_name)
 {
-	char part_name[1024];
-	char part_uri[1024];
-	xps_resource *dict;
+	xps_resource_cache *cache;
 	xps_part *part;
 	fz_xml *xml;
-	char *s;
 	fz_context *ctx = doc->ctx;
 
-	/* External resource dictionaries MUST NOT reference other resource dictionaries */
-	xps_resolve_url(part_name, base_uri, source_att, sizeof part_name);
+	for (cache = doc->resource_table; cache; cache = cache->next)
+		if (!xps_strcasecmp(cache->name, part_name))
+			return cache->xml;
+
 	part = xps_read_part(doc, part_name);
 	fz_try(ctx)
 	{
@@ -82,20 +84,52 @@ xps_parse_remote_resource_dictionary(xps_document *doc, char *base_uri, char *so
 	if (!xml)
 		return NULL;
 
-	if (strcmp(fz_xml_tag(xml), "ResourceDictionary"))
+	cache = NULL;
+	fz_var(cache);
+	fz_try(ctx)
 	{
-		fz_free_xml(doc->ctx, xml);
-		fz_throw(doc->ctx, FZ_ERROR_GENERIC, "expected ResourceDictionary element");
+		cache = fz_malloc_struct(ctx, xps_resource_cache);
+		cache->name = fz_strdup(ctx, part_name);
 	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, cache);
+		fz_free_xml(ctx, xml);
+		fz_rethrow(ctx);
+	}
+	cache->xml = xml;
+	cache->next = doc->resource_table;
+	doc->resource_table = cache;
+
+	return xml;
+}
+
+static xps_resource *
+xps_parse_remote_resource_dictionary(xps_document *doc, char *base_uri, char *source_att)
+{
+	char part_name[1024];
+	char part_uri[1024];
+	xps_resource *dict;
+	fz_xml *xml;
+	char *s;
+
+	/* External resource dictionaries MUST NOT reference other resource dictionaries */
+	xps_resolve_url(part_name, base_uri, source_att, sizeof part_name);
+	xml = xps_load_remote_resource_xml(doc, part_name);
+
+	if (!xml)
+		return NULL;
+
+	if (strcmp(fz_xml_tag(xml), "ResourceDictionary"))
+		fz_throw(doc->ctx, FZ_ERROR_GENERIC, "expected ResourceDictionary element");
 
 	fz_strlcpy(part_uri, part_name, sizeof part_uri);
 	s = strrchr(part_uri, '/');
 	if (s)
 		s[1] = 0;
 
+	/* the XML remains owned by doc->resource_table */
 	dict = xps_parse_resource_dictionary(doc, part_uri, xml);
-	if (dict)
-		dict->base_xml = xml; /* pass on ownership */
 
 	return dict;
 }
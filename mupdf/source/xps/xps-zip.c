@@ -644,6 +644,7 @@ void
 xps_close_document(xps_document *doc)
 {
 	xps_font_cache *font, *next;
+	xps_resource_cache *rsrc, *next_rsrc;
 	int i;
 
 	if (!doc)
@@ -666,6 +667,17 @@ xps_close_document(xps_document *doc)
 		font = next;
 	}
 
+	/* SumatraPDF: cache remote resource dictionaries */
+	rsrc = doc->resource_table;
+	while (rsrc)
+	{
+		next_rsrc = rsrc->next;
+		fz_free_xml(doc->ctx, rsrc->xml);
+		fz_free(doc->ctx, rsrc->name);
+		fz_free(doc->ctx, rsrc);
+		rsrc = next_rsrc;
+	}
+
 	/* cf. http://code.google.com/p/sumatrapdf/issues/detail?id=2094 */
 	fz_empty_store(doc->ctx);
 
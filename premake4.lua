@@ -126,6 +126,7 @@ solution "all_tests"
       "src/utils/HtmlPrettyPrint*",
       "src/utils/HtmlPullParser*",
       "src/utils/JsonParser*",
+      "src/utils/RectIndex*",
       "src/utils/SettingsUtil*",
       "src/utils/SimpleLog*",
       "src/utils/StrFormat*",
@@ -147,6 +148,46 @@ solution "all_tests"
     includedirs { "src/utils", "src/utils/msvc" }
     links { "gdiplus", "comctl32", "shlwapi", "Version" }
 
+  -- throughput of utils (should be built in release configuration)
+  project "bench_util"
+    kind "ConsoleApp"
+    language "C++"
+    files {
+      "src/utils/BaseUtil*",
+      "src/utils/BencUtil*",
+      "src/utils/BitManip*",
+      "src/utils/CmdLineParser*",
+      "src/utils/CssParser*",
+      "src/utils/Dict*",
+      "src/utils/DirIter*",
+      "src/utils/FileUtil*",
+      "src/utils/HtmlParserLookup*",
+      "src/utils/HtmlPullParser*",
+      "src/utils/JsonParser*",
+      "src/utils/LzmaSimpleArchive*",
+      "src/utils/SquareTreeParser*",
+      "src/utils/StrUtil*",
+      "src/utils/ThreadUtil*",
+      "src/utils/WinUtil*",
+      "src/utils/ZipUtil*",
+      "ext/zlib/adler32.c", "ext/zlib/compress.c", "ext/zlib/crc32.c", "ext/zlib/deflate.c",
+      "ext/zlib/inffast.c", "ext/zlib/inflate.c", "ext/zlib/inftrees.c", "ext/zlib/trees.c",
+      "ext/zlib/zutil.c",
+      "ext/zlib/minizip/unzip.c", "ext/zlib/minizip/unzalloc.c", "ext/zlib/minizip/ioapi.c",
+      "ext/zlib/minizip/iowin32.c", "ext/zlib/minizip/iowin32s.c", "ext/zlib/minizip/zip.c",
+      "ext/bzip2/bzip_all.c",
+      "ext/lzma/C/LzmaDec.c", "ext/lzma/C/Bra86.c",
+      "tools/bench_util/*.cpp"
+    }
+    excludes
+    {
+      "src/utils/*_ut.cpp",
+    }
+    -- cf. MINIZIP_CFLAGS and BZIP2_CFLAGS in ext/makefile.msvc
+    defines { "HAVE_BZIP2", "NOCRYPT", "BZ_NO_STDIO", "BZ_DEBUG=0", "INC_CUSTOM_ALLOC=\"unzalloc.h\"" }
+    includedirs { "src/utils", "src/utils/msvc", "ext/zlib", "ext/zlib/minizip", "ext/bzip2", "ext/lzma/C" }
+    links { "gdiplus", "comctl32", "shlwapi", "Version" }
+
 
 solution "muitest"
   solution_common()
@@ -183,3 +224,63 @@ solution "muitest"
     }
     includedirs { "src", "src/utils", "src/utils/msvc", "src/mui"}
     links { "gdiplus", "comctl32", "shlwapi", "Version", "WindowsCodecs" }
+
+solution "layout_bench"
+  solution_common()
+
+  -- benchmarks HtmlFormatter without EbookEngine (should be built in release configuration)
+  project "layout_bench"
+    kind "ConsoleApp"
+    language "C++"
+
+    files {
+      "tools/layout_bench/*",
+      "tools/mui_test/WebpNullReader.cpp",
+      "src/EbookDoc*",
+      "src/EbookFormatter*",
+      "src/HtmlFormatter*",
+      "src/MobiDoc*",
+      "src/utils/BaseUtil*",
+      "src/utils/BitManip.h",
+      "src/utils/BitReader*",
+      "src/utils/ByteOrderDecoder*",
+      "src/utils/CmdLineParser*",
+      "src/utils/CssParser*",
+      "src/utils/Dict*",
+      "src/utils/DebugLog*",
+      "src/utils/DirIter*",
+      "src/utils/FileUtil*",
+      "src/utils/GdiPlusUtil*",
+      "src/utils/HtmlParserLookup*",
+      "src/utils/HtmlPullParser*",
+      "src/utils/PalmDbReader*",
+      "src/utils/SerializeTxt*",
+      "src/utils/StrSlice*",
+      "src/utils/StrUtil*",
+      "src/utils/TgaReader*",
+      "src/utils/ThreadUtil*",
+      "src/utils/Trace*",
+      "src/utils/TrivialHtmlParser*",
+      "src/utils/TxtParser*",
+      "src/utils/WebpReader.h", -- building without WebP support (cf. muitest)
+      "src/utils/WinUtil*",
+      "src/utils/ZipUtil*",
+      "src/mui/*.h",
+      "src/mui/*.cpp",
+      "ext/zlib/adler32.c", "ext/zlib/compress.c", "ext/zlib/crc32.c", "ext/zlib/deflate.c",
+      "ext/zlib/inffast.c", "ext/zlib/inflate.c", "ext/zlib/inftrees.c", "ext/zlib/trees.c",
+      "ext/zlib/zutil.c",
+      "ext/zlib/minizip/unzip.c", "ext/zlib/minizip/unzalloc.c", "ext/zlib/minizip/ioapi.c",
+      "ext/zlib/minizip/iowin32.c", "ext/zlib/minizip/iowin32s.c", "ext/zlib/minizip/zip.c",
+      "ext/bzip2/bzip_all.c",
+    }
+    excludes
+    {
+      "src/utils/*_ut.cpp",
+      "src/mui/*_ut.cpp",
+      "src/mui/MiniMui*",
+    }
+    -- cf. MINIZIP_CFLAGS and BZIP2_CFLAGS in ext/makefile.msvc
+    defines { "HAVE_BZIP2", "NOCRYPT", "BZ_NO_STDIO", "BZ_DEBUG=0", "INC_CUSTOM_ALLOC=\"unzalloc.h\"" }
+    includedirs { "src", "src/utils", "src/utils/msvc", "src/mui", "ext/zlib", "ext/zlib/minizip", "ext/bzip2" }
+    links { "gdiplus", "comctl32", "shlwapi", "Version", "WindowsCodecs" }
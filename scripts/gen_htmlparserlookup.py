@@ -3,38 +3,55 @@
 This script generates fairly fast C code for the following function:
 Given a string, see if it belongs to a known set of strings. If it does,
 return a value corresponding to that string.
+
+The lookup uses a perfect hash over the length and a few characters
+of the string (hash and displace): a first hash selects a displacement
+which makes a second hash map every known string to a different slot,
+so that at most a single string comparison is needed.
 """
 
 import util2
 
 Template_Defines = """\
-#define CS1(c1)             (c1)
-#define CS2(c1, c2)         (CS1(c1) | (c2 << 8))
-#define CS3(c1, c2, c3)     (CS2(c1, c2) | (c3 << 16))
-#define CS4(c1, c2, c3, c4) (CS3(c1, c2, c3) | (c4 << 24))
-
-#define STR1(s) ((s)[0])
-#define STR2(s) (STR1(s) | ((s)[1] << 8))
-#define STR3(s) (STR2(s) | ((s)[2] << 16))
-#define STR4(s) (STR3(s) | ((s)[3] << 24))
-
 #define lower(c) ((c) < 'A' || (c) > 'Z' ? (c) : (c) - 'A' + 'a')
 
-#define STR1i(s) (lower((s)[0]))
-#define STR2i(s) (STR1i(s) | (lower((s)[1]) << 8))
-#define STR3i(s) (STR2i(s) | (lower((s)[2]) << 16))
-#define STR4i(s) (STR3i(s) | (lower((s)[3]) << 24))
+// the key combines the length with the first, second, middle,
+// second to last and last character (len must be at least 2)
+#define KEY_STEP(key, c) ((key) * 31 + (uint8_t)(c))
+#define KEY(s, len) KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP((uint32_t)(len), \\
+    (s)[0]), (s)[1]), (s)[(len) / 2]), (s)[(len) - 2]), (s)[(len) - 1])
+#define KEYi(s, len) KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP((uint32_t)(len), \\
+    lower((s)[0])), lower((s)[1])), lower((s)[(len) / 2])), lower((s)[(len) - 2])), lower((s)[(len) - 1]))
+#define KEY1(s) KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(1, (s)[0]), (s)[0]), (s)[0]), (s)[0]), (s)[0])
+#define KEY1i(s) KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(1, lower((s)[0])), lower((s)[0])), \\
+    lower((s)[0])), lower((s)[0])), lower((s)[0]))
+
+// returns the top bits of a multiplicative hash of key and seed
+#define SLOT(key, seed, bits) ((((key) ^ (seed)) * 0x9E3779B1) >> (32 - (bits)))
 """
 
 Template_Find_Function = """\
-%s Find%s(const char *name, size_t len)
+static const uint16_t g%(name)sDisp[%(dispCount)d] = {
+	%(disp)s
+};
+
+static const struct {
+	const char *name;
+	size_t len;
+	%(type)s value;
+} g%(name)sTable[%(tableCount)d] = {
+	%(table)s
+};
+
+%(type)s Find%(name)s(const char *name, size_t len)
 {
-	uint32_t key = 0 == len ? 0 : 1 == len ? STR1i(name) :
-	               2 == len ? STR2i(name) : 3 == len ? STR3i(name) : STR4i(name);
-	switch (key) {
-	%s
-	}
-	return %s;
+	if (0 == len)
+		return %(default)s;
+	uint32_t key = 1 == len ? KEY1i(name) : KEYi(name, len);
+	uint32_t slot = SLOT(key, g%(name)sDisp[SLOT(key, 0, %(dispBits)d)], %(tableBits)d);
+	if (len == g%(name)sTable[slot].len && str::EqNI(g%(name)sTable[slot].name, name, len))
+		return g%(name)sTable[slot].value;
+	return %(default)s;
 }
 """
 
@@ -62,47 +79,81 @@ def getEnumName(name, prefix):
 	parts = [p[0].upper() + p[1:].lower() for p in parts]
 	return "_".join([prefix] + parts)
 
-# given e.g. "abcd" returns "'a','b','c','d'"
-def splitChars(chars):
-	return "'" + "','".join(chars) + "'"
-
 def unTab(string):
 	return string.replace("\t", "    ")
 
-# creates a lookup function that works with one switch for quickly
-# finding (or failing to find) the correct value
+# mirrors the KEY and KEYi macros
+def getKey(name, caseInsensitive):
+	if caseInsensitive:
+		name = name.lower()
+	key = len(name)
+	for c in [name[0], name[1 % len(name)], name[len(name) // 2], name[len(name) - 2 if len(name) > 1 else 0], name[-1]]:
+		key = (key * 31 + ord(c)) & 0xFFFFFFFF
+	return key
+
+# mirrors the SLOT macro
+def getSlot(key, seed, bits):
+	return (((key ^ seed) * 0x9E3779B1) & 0xFFFFFFFF) >> (32 - bits)
+
+# returns the displacements (one per bucket) and the slots of all keys
+# or None if no displacement could be found for one of the buckets
+def findDisplacements(keys, dispBits, tableBits):
+	buckets = [[] for i in range(1 << dispBits)]
+	for key in keys:
+		buckets[getSlot(key, 0, dispBits)].append(key)
+	disp = [0] * (1 << dispBits)
+	slots = {}
+	# place the largest buckets first while there are still many free slots
+	for bucket in sorted(range(len(buckets)), key=lambda b: -len(buckets[b])):
+		if not buckets[bucket]:
+			break
+		for seed in range(1, 1 << 16):
+			bucketSlots = set([getSlot(key, seed, tableBits) for key in buckets[bucket]])
+			if len(bucketSlots) == len(buckets[bucket]) and not [s for s in bucketSlots if s in slots]:
+				break
+		else:
+			return None
+		disp[bucket] = seed
+		for key in buckets[bucket]:
+			slots[getSlot(key, seed, tableBits)] = key
+	return disp, slots
+
+# creates a lookup function that finds (or fails to find) the correct
+# value with two table lookups and a single string comparison
 def createFastFinder(list, type, default, caseInsensitive, funcName=None):
-	list = sorted(list, key=lambda a: a[0])
-	output = []
-	while list:
-		name, value = list.pop(0)
-		if len(name) < 4:
-			# no further comparison is needed for names less than 4 characters in length
-			output.append('case CS%d(%s): return %s;' % (len(name), splitChars(name), value))
+	keys = {}
+	for name, value in list:
+		key = getKey(name, caseInsensitive)
+		assert key not in keys, "%s and %s have the same key" % (name, keys[key][0])
+		keys[key] = (name, value)
+
+	# a table about as large as the number of strings and a bucket for every four strings
+	tableBits = max(len(keys) - 1, 1).bit_length()
+	dispBits = max(tableBits - 2, 1)
+	result = findDisplacements(keys.keys(), dispBits, tableBits)
+	while not result:
+		dispBits += 1
+		if dispBits >= tableBits:
+			tableBits += 1
+		result = findDisplacements(keys.keys(), dispBits, tableBits)
+	disp, slots = result
+
+	table = []
+	for slot in range(1 << tableBits):
+		if slot in slots:
+			name, value = keys[slots[slot]]
+			table.append('{ "%s", %d, %s },' % (name, len(name), value))
 		else:
-			# for longer names, do either another quick check (up to 8 characters)
-			# or use str::EqN(I) for longer names
-			output.append('case CS4(%s):' % "'%s'" % "','".join(name[:4]))
-			while True:
-				if len(name) == 4:
-					output.append("	if (4 == len) return %s;" % value)
-				elif len(name) <= 8:
-					rest = name[4:]
-					output.append('	if (%d == len && CS%d(%s) == STR%di(name + 4)) return %s;' %
-						(len(name), len(rest), splitChars(rest), len(rest), value))
-				else:
-					output.append('	if (%d == len && str::EqNI(name + 4, "%s", %d)) return %s;' %
-						(len(name), name[4:], len(name) - 4, value))
-				# reuse the same case for names that start the same
-				if not list or list[0][0][:4] != name[:4]:
-					break
-				name, value = list.pop(0)
-			output.append('	break;')
-
-	output = Template_Find_Function % (type, funcName or type, "\n	".join(output), default)
+			table.append('{ "", 0, %s },' % default)
+
+	output = Template_Find_Function % {
+		"name": funcName or type, "type": type, "default": default,
+		"dispCount": len(disp), "dispBits": dispBits, "tableCount": len(table), "tableBits": tableBits,
+		"disp": ",\n	".join([", ".join(part) for part in util2.group([str(d) for d in disp], 16)]),
+		"table": "\n	".join(table),
+	}
 	if not caseInsensitive:
-		output = output.replace("STR1i(", "STR1(").replace("STR2i(", "STR2(")
-		output = output.replace("STR3i(", "STR3(").replace("STR4i(", "STR4(")
+		output = output.replace("KEY1i(", "KEY1(").replace("KEYi(", "KEY(")
 		output = output.replace("str::EqNI(", "str::EqN(")
 	else:
 		assert not [c for c in output if c > '\x7f'], "lower() only supports ASCII letters"
@@ -330,6 +330,11 @@ GlobalPrefs = [
 	Field("ReuseInstance", Bool, False,
 		"if true, we'll always open files using existing SumatraPDF process",
 		expert=True),
+	Field("ResidentMode", Bool, False,
+		"if true, SumatraPDF keeps running in the notification area after its " +
+		"last window has been closed, so that further documents open faster " +
+		"(this implies ReuseInstance)",
+		expert=True, version="2.5"),
 	Struct("FixedPageUI", FixedPageUI,
 		"customization options for PDF, XPS, DjVu and PostScript UI",
 		expert=True),
@@ -375,6 +380,41 @@ GlobalPrefs = [
 		"if true, a document will be reloaded automatically whenever it's changed " +
 		"(currently doesn't work for documents shown in the ebook UI)",
 		expert=True, version="2.5"),
+	Field("BitmapCacheSize", Int, 0,
+		"maximum amount of memory (in MB) used for caching rendered pages. " +
+		"if zero or negative, the limit is determined from the available memory",
+		expert=True, version="2.5"),
+	Field("DisplayListCacheSize", Int, 0,
+		"maximum amount of memory (in MB) used per document for caching parsed page content. " +
+		"if zero or negative, a default of 40 MB is used",
+		expert=True, version="2.5"),
+	Field("GlyphCacheSize", Int, 0,
+		"maximum amount of memory (in MB) used per document for caching rasterized glyphs " +
+		"(applies to documents opened afterwards). if zero or negative, a default of 8 MB is used",
+		expert=True, version="2.5"),
+	Field("ResourceCacheSize", Int, 0,
+		"maximum amount of memory (in MB) used by all documents together for caching decoded " +
+		"images, fonts, etc. (the document used most recently gets the largest share). " +
+		"if zero or negative, a default of 512 MB is used",
+		expert=True, version="2.5"),
+	Field("MemoryMapLargeFiles", Bool, False,
+		"if true, large PDF and XPS documents on local drives are memory mapped instead of " +
+		"being read through the file system (note: other programs can't overwrite such " +
+		"documents while they're open)",
+		expert=True, version="2.5"),
+	Field("TextIndexCache", Bool, True,
+		"if true, the text extracted for searching a document is cached on disk " +
+		"so that repeated searches don't have to extract it again " +
+		"(not for password protected documents)",
+		expert=True, version="2.5"),
+	Field("UseGpuCanvas", Bool, False,
+		"if true, documents are painted with Direct2D (if available) which makes " +
+		"scrolling and zooming on large displays less CPU intensive",
+		expert=True, version="2.5"),
+	Field("HighlightAllMatches", Bool, False,
+		"if true, all matches of the search text are highlighted (in addition to the " +
+		"current one) and their number is shown once they've all been found",
+		expert=True, version="2.5"),
 	Struct("AnnotationDefaults", AnnotationDefaults,
 		"default values for user added annotations in FixedPageUI documents " +
 		"(preliminary and still subject to change)",
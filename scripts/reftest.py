@@ -3,20 +3,37 @@ Renders all files in a directory to page TGA images and an XML dump
 and checks these renderings against a previous known-good reference
 rendering, creating TGA difference files for easier comparison.
 
+The MD5 hash and render time of every reference page are recorded in
+a .ref.txt file next to the references: pages slowing down considerably
+are reported, and reference TGA images may be deleted to save space
+(renderings are then only checked against the reference hashes).
+
 Use for regression testing:
 
 reftest.py /dir/to/test -refdir /dir/for/references
 reftest.py /dir/one /dir/two /dir/three
+reftest.py -zoom 50,100,200 /dir/to/test
 """
 
-import os, sys, struct, fnmatch
+import os, re, sys, struct, fnmatch, hashlib
 from subprocess import Popen, PIPE
 pjoin = os.path.join
 
-def EngineDump(EngineDumpExe, file, tgaPath):
-	proc = Popen([EngineDumpExe, file, "-full", "-render", tgaPath], stdout=PIPE)
-	xmlDump, _ = proc.communicate()
-	return xmlDump
+# a page is reported as slower, if it renders that much slower
+# than for the reference (both relatively and absolutely)
+SLOWDOWN_FACTOR, SLOWDOWN_MIN_MS = 1.5, 50
+
+def EngineDump(EngineDumpExe, file, tgaPath, zoom, dumpXml):
+	args = [EngineDumpExe, file, "-full" if dumpXml else "-loadonly", "-render"]
+	if zoom != 100:
+		args.append("%d%%" % zoom)
+	proc = Popen(args + [tgaPath], stdout=PIPE, stderr=PIPE)
+	xmlDump, log = proc.communicate()
+	# EngineDump prints the render time of every page to stderr
+	times = {}
+	for (pageNo, ms) in re.findall(r"Rendered page (\d+) in (\d+(?:\.\d+)?) ms", log):
+		times[int(pageNo)] = float(ms)
+	return xmlDump, times
 
 def TgaRleUnpack(data):
 	# unpacks data from a type 2 TGA file (24-bit uncompressed)
@@ -96,16 +113,44 @@ def BitmapDiff(tgaRef, tgaCmp, tgaDiff):
 	open(tgaDiff, "wb").write("".join(diff))
 	return True
 
-def RefTestFile(EngineDumpExe, file, refdir):
+def TgaHash(tgaPath):
+	# hashes the pixel data (so that differently compressed files match)
+	if not os.path.isfile(tgaPath):
+		return None
+	data = open(tgaPath, "rb").read()
+	if len(data) < 18:
+		return None
+	width, height = struct.unpack("<HH", data[12:16])
+	pixels = TgaRleUnpack(data)[:width * height * 3]
+	return hashlib.md5(data[12:16] + pixels).hexdigest()
+
+def LoadRefInfo(infoPath):
+	# maps page numbers to (MD5 hash, render time in ms)
+	info = {}
+	if os.path.isfile(infoPath):
+		for line in open(infoPath, "rb").read().splitlines():
+			parts = line.split()
+			if len(parts) == 3:
+				info[int(parts[0])] = (parts[1], float(parts[2]))
+	return info
+
+def SaveRefInfo(infoPath, info):
+	lines = ["%d %s %.2f" % (pageNo, info[pageNo][0], info[pageNo][1]) for pageNo in sorted(info.keys())]
+	open(infoPath, "wb").write("\r\n".join(lines) + "\r\n")
+
+def RefTestFile(EngineDumpExe, file, refdir, zoom, dumpXml):
 	# create an XML dump and bitmap renderings of all pages
 	base = os.path.splitext(os.path.split(file)[1])[0]
-	tgaPath = pjoin(refdir, base + "-%d.cmp.tga")
-	xmlDump = EngineDump(EngineDumpExe, file, tgaPath)
+	name = base if zoom == 100 else "%s-z%d" % (base, zoom)
+	tgaPath = pjoin(refdir, name + "-%d.cmp.tga")
+	xmlDump, times = EngineDump(EngineDumpExe, file, tgaPath, zoom, dumpXml)
 	
 	# compare the XML dumps (remove the dump if it's the same as the reference)
 	xmlRefPath = pjoin(refdir, base + ".ref.xml")
 	xmlCmpPath = pjoin(refdir, base + ".cmp.xml")
-	if not os.path.isfile(xmlRefPath):
+	if not dumpXml:
+		pass
+	elif not os.path.isfile(xmlRefPath):
 		open(xmlRefPath, "wb").write(xmlDump)
 	elif open(xmlRefPath, "rb").read() != xmlDump:
 		open(xmlCmpPath, "wb").write(xmlDump)
@@ -113,23 +158,54 @@ def RefTestFile(EngineDumpExe, file, refdir):
 	elif os.path.isfile(xmlCmpPath):
 		os.remove(xmlCmpPath)
 	
+	# renderings matching the reference hash are identical to the reference
+	infoPath = pjoin(refdir, name + ".ref.txt")
+	refInfo = LoadRefInfo(infoPath)
+	for (pageNo, (refHash, refMs)) in refInfo.items():
+		tgaCmpPath = pjoin(refdir, "%s-%d.cmp.tga" % (name, pageNo))
+		tgaRefPath, tgaDiffPath = tgaCmpPath[:-8] + ".ref.tga", tgaCmpPath[:-8] + ".diff.tga"
+		if TgaHash(tgaCmpPath) == refHash:
+			os.remove(tgaCmpPath)
+			if os.path.isfile(tgaDiffPath):
+				os.remove(tgaDiffPath)
+		elif not os.path.isfile(tgaRefPath):
+			# the reference bitmap is gone, so there's nothing to diff against
+			if not os.path.isfile(tgaCmpPath):
+				open(tgaCmpPath, "wb").write("")
+			print "  FAIL!", tgaCmpPath
+		if pageNo in times and times[pageNo] > refMs * SLOWDOWN_FACTOR and times[pageNo] - refMs > SLOWDOWN_MIN_MS:
+			print "  SLOWER! %s page %d: %.2f ms (reference: %.2f ms)" % (name, pageNo, times[pageNo], refMs)
+	
 	# compare all bitmap renderings (and create diff bitmaps where needed)
-	for file in fnmatch.filter(os.listdir(refdir), base + "-[0-9]*.ref.tga"):
+	for file in fnmatch.filter(os.listdir(refdir), name + "-[0-9]*.ref.tga"):
 		tgaRefPath = pjoin(refdir, file)
 		tgaCmpPath, tgaDiffPath = tgaRefPath[:-8] + ".cmp.tga", tgaRefPath[:-8] + ".diff.tga"
+		pageNo = int(file[len(name) + 1:-8])
+		if pageNo in refInfo and not os.path.isfile(tgaCmpPath):
+			continue # already matched by hash
 		if BitmapDiff(tgaRefPath, tgaCmpPath, tgaDiffPath):
 			print "  FAIL!", tgaCmpPath
 		else:
 			os.remove(tgaCmpPath)
 			if os.path.isfile(tgaDiffPath):
 				os.remove(tgaDiffPath)
-	for file in fnmatch.filter(os.listdir(refdir), base + "-[0-9]*.cmp.tga"):
+	for file in fnmatch.filter(os.listdir(refdir), name + "-[0-9]*.cmp.tga"):
 		tgaCmpPath = pjoin(refdir, file)
 		tgaRefPath = tgaCmpPath[:-8] + ".ref.tga"
-		if not os.path.isfile(tgaRefPath):
+		pageNo = int(file[len(name) + 1:-8])
+		if not os.path.isfile(tgaRefPath) and pageNo not in refInfo:
 			os.rename(tgaCmpPath, tgaRefPath)
+	
+	# record hash and render time for all new reference pages
+	refCount = len(refInfo)
+	for file in fnmatch.filter(os.listdir(refdir), name + "-[0-9]*.ref.tga"):
+		pageNo = int(file[len(name) + 1:-8])
+		if pageNo not in refInfo and pageNo in times:
+			refInfo[pageNo] = (TgaHash(pjoin(refdir, file)), times[pageNo])
+	if len(refInfo) != refCount:
+		SaveRefInfo(infoPath, refInfo)
 
-def RefTestDir(EngineDumpExe, dir, refdir):
+def RefTestDir(EngineDumpExe, dir, refdir, zooms):
 	# create reference directory, if it doesn't exists yet
 	if not os.path.isdir(refdir):
 		os.makedirs(refdir)
@@ -139,7 +215,8 @@ def RefTestDir(EngineDumpExe, dir, refdir):
 		file = pjoin(dir, file)
 		if os.path.isfile(file):
 			print "Testing", file
-			RefTestFile(EngineDumpExe, file, refdir)
+			for zoom in zooms:
+				RefTestFile(EngineDumpExe, file, refdir, zoom, zoom == zooms[0])
 	
 	# list all differences (again)
 	diffs = fnmatch.filter(os.listdir(refdir), "*.cmp.*")
@@ -158,9 +235,15 @@ def main(args):
 	else:
 		EngineDumpExe = pjoin(os.path.dirname(__file__), "..", "obj-dbg", "EngineDump.exe")
 	
+	# render at 100% zoom by default
+	zooms = [100]
+	if len(args) > 2 and args[1] == "-zoom":
+		zooms = [int(zoom) for zoom in args[2].split(",")]
+		del args[1:3]
+	
 	# minimal sanity check of arguments
 	if not args[1:] or not os.path.isdir(args[1]):
-		print "Usage: %s [EngineDump.exe] <dir> [-refdir <dir>] [<dir> ...]" % (os.path.split(args[0])[1])
+		print "Usage: %s [EngineDump.exe] [-zoom <percent>[,<percent>...]] <dir> [-refdir <dir>] [<dir> ...]" % (os.path.split(args[0])[1])
 		return
 	
 	# collect all directories to test (and the corresonding reference directories)
@@ -176,7 +259,7 @@ def main(args):
 	# run the test
 	fails = 0
 	for (dir, refdir) in dirs:
-		fails += RefTestDir(EngineDumpExe, dir, refdir)
+		fails += RefTestDir(EngineDumpExe, dir, refdir, zooms)
 	sys.exit(fails)
 
 if __name__ == "__main__":
@@ -127,6 +127,53 @@ def c_escape_for_compact(txt):
     txt = re.sub(r"[\x80-\xFF]", lambda m: c_oct(m.group(0)[0]), txt)
     return '"%s\\0"' % txt
 
+# the strings are kept as they appear in the C sources, so they still
+# contain the escape sequences which the C compiler will resolve
+def c_unescape(txt):
+    escapes = { "n": "\n", "t": "\t", "r": "\r", "\\": "\\", '"': '"', "'": "'" }
+    return re.sub(r'\\([0-7]{1,3}|.)', lambda m: chr(int(m.group(1), 8)) if m.group(1)[0] in "01234567" else escapes[m.group(1)], txt)
+
+# FNV-1a, must match HashString in src/Translations.cpp
+def hash_string(txt, seed):
+    h = 2166136261 ^ seed
+    for c in txt:
+        h = ((h ^ ord(c)) * 16777619) & 0xFFFFFFFF
+    return h
+
+def c_number_lines(numbers, per_line=16):
+    lines = ["  " + ", ".join([str(n) for n in numbers[i:i+per_line]]) for i in range(0, len(numbers), per_line)]
+    return ",\n".join(lines)
+
+# builds a perfect hash ("hash and displace"): strings are distributed into
+# buckets by hash_string(s, 0) and for every bucket a seed is determined for
+# which hash_string(s, seed) maps all its strings to distinct free slots
+def gen_strings_hash(strings):
+    strings = [c_unescape(s) for s in strings]
+    slots_count = 1
+    while slots_count < 2 * len(strings):
+        slots_count *= 2
+    buckets_count = max(slots_count // 8, 1)
+    buckets = [[] for i in range(buckets_count)]
+    for (idx, s) in enumerate(strings):
+        buckets[hash_string(s, 0) % buckets_count].append(idx)
+    seeds = [0] * buckets_count
+    slots = [0] * slots_count
+    # place the largest buckets first, while most slots are still free
+    for b in sorted(range(buckets_count), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            continue
+        seed = 1
+        while True:
+            wanted = [hash_string(strings[idx], seed) % slots_count for idx in buckets[b]]
+            if len(set(wanted)) == len(wanted) and not [slot for slot in wanted if slots[slot]]:
+                break
+            seed += 1
+        assert seed < 65536
+        seeds[b] = seed
+        for (idx, slot) in zip(buckets[b], wanted):
+            slots[slot] = idx + 1
+    return (buckets_count, c_number_lines(seeds), slots_count, c_number_lines(slots))
+
 def get_trans_for_lang(strings_dict, keys, lang_arg):
     if lang_arg == "en":
         return keys
@@ -188,6 +235,27 @@ const char *gOriginalStrings[STRINGS_COUNT] = {
 
 const char **GetOriginalStrings() { return &gOriginalStrings[0]; }
 
+#define STRINGS_HASH_BUCKETS %(strings_hash_buckets)d
+#define STRINGS_HASH_SLOTS %(strings_hash_slots)d
+
+// perfect hash of gOriginalStrings (cf. GetEnglishStringIndex): the seed
+// for the strings of every bucket and the index + 1 of the string in every slot
+static const uint16_t gOriginalStringsHashSeeds[STRINGS_HASH_BUCKETS] = {
+%(strings_hash_seeds)s
+};
+
+static const uint16_t gOriginalStringsHashSlots[STRINGS_HASH_SLOTS] = {
+%(strings_hash_slots_data)s
+};
+
+void GetOriginalStringsHash(const uint16_t **seeds, int *bucketsCount, const uint16_t **slots, int *slotsCount)
+{
+    *seeds = &gOriginalStringsHashSeeds[0];
+    *bucketsCount = STRINGS_HASH_BUCKETS;
+    *slots = &gOriginalStringsHashSlots[0];
+    *slotsCount = STRINGS_HASH_SLOTS;
+}
+
 %(translations)s
 
 const char *gLangCodes = \
@@ -352,6 +420,7 @@ def gen_c_code_for_dir(strings_dict, keys, dir_name, compressed=False):
 
     lines = ["  %s" % c_escape(t) for t in langs[0].translations]
     orignal_strings = ",\n".join(lines)
+    (strings_hash_buckets, strings_hash_seeds, strings_hash_slots, strings_hash_slots_data) = gen_strings_hash(langs[0].translations)
 
     langs_count = len(langs)
     translations_count = len(keys)
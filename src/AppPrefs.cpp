@@ -17,12 +17,14 @@
 #include "FileUtil.h"
 #include "FileWatcher.h"
 #include "SumatraPDF.h"
+#include "ThreadUtil.h"
 #include "Translations.h"
 #include "UITask.h"
 #include "WindowInfo.h"
 
 #define PREFS_FILE_NAME     L"SumatraPDF-settings.txt"
 #define LEGACY_FILE_NAME    L"sumatrapdfprefs.dat"
+#define PREFS_CACHE_NAME    L"SumatraPDF-settings.bin"
 
 GlobalPrefs *        gGlobalPrefs = NULL;
 
@@ -198,6 +200,184 @@ static int cmpFloat(const void *a, const void *b)
     return *(float *)a < *(float *)b ? -1 : *(float *)a > *(float *)b ? 1 : 0;
 }
 
+// binary snapshot of the settings file (which is faster to load than
+// parsing the text file and thus can be used as long as the text file
+// hasn't been modified since the snapshot has been written)
+#define PREFS_CACHE_MAGIC   'SSet'
+#define PREFS_CACHE_VERSION 1
+
+struct PrefsCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    // identifies the settings structs the snapshot has been written for
+    uint32_t schemaHash;
+    uint32_t reserved;
+    // modification time and size of the text file the snapshot corresponds to
+    FILETIME textModified;
+    int64 textSize;
+};
+
+static uint32_t GetPrefsSchemaHash()
+{
+    static uint32_t schemaHash = 0;
+    CrashIf(gFileStateInfo.fieldCount != dimof(gFileStateFields));
+    if (!schemaHash)
+        schemaHash = GetStructInfoHash(&gGlobalPrefsInfo);
+    return schemaHash;
+}
+
+static GlobalPrefs *LoadPrefsCache(const WCHAR *path)
+{
+    ScopedMem<WCHAR> cachePath(AppGenDataFilename(PREFS_CACHE_NAME));
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(cachePath, &len));
+    if (!data || len < sizeof(PrefsCacheHeader))
+        return NULL;
+    PrefsCacheHeader hdr;
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.magic != PREFS_CACHE_MAGIC || hdr.version != PREFS_CACHE_VERSION ||
+        hdr.schemaHash != GetPrefsSchemaHash()) {
+        return NULL;
+    }
+    if (!FileTimeEq(hdr.textModified, file::GetModificationTime(path)) ||
+        hdr.textSize != file::GetSize(path)) {
+        return NULL;
+    }
+    return (GlobalPrefs *)DeserializeStructBin(&gGlobalPrefsInfo, data + sizeof(hdr), len - sizeof(hdr));
+}
+
+// binData must be the result of SerializeStructBin for the prefs just written to path
+static bool SavePrefsCache(const WCHAR *path, const char *binData, size_t binDataLen, uint32_t schemaHash)
+{
+    PrefsCacheHeader hdr = { 0 };
+    hdr.magic = PREFS_CACHE_MAGIC;
+    hdr.version = PREFS_CACHE_VERSION;
+    hdr.schemaHash = schemaHash;
+    hdr.textModified = file::GetModificationTime(path);
+    hdr.textSize = file::GetSize(path);
+    if (hdr.textSize < 0)
+        return false;
+
+    str::Str<char> data(sizeof(hdr) + binDataLen);
+    data.Append((const char *)&hdr, sizeof(hdr));
+    data.Append(binData, binDataLen);
+    ScopedMem<WCHAR> cachePath(AppGenDataFilename(PREFS_CACHE_NAME));
+    return file::WriteAll(cachePath, data.Get(), data.Size());
+}
+
+// settings are written on a background thread so that slow disks (or virus
+// scanners) don't block the UI; of several versions queued while a write is
+// still in progress, only the most recent one will be written
+class PrefsWriter : public ThreadBase {
+    CRITICAL_SECTION cs;
+    // prevents this thread and Stop() from writing at the same time
+    CRITICAL_SECTION writeCs;
+    HANDLE hQueuedEvent;
+
+    WCHAR *     path;
+    char *      data;
+    size_t      dataLen;
+    char *      binData;
+    size_t      binDataLen;
+    uint32_t    schemaHash;
+    FILETIME    lastWritten;
+
+    void WriteQueued() {
+        ScopedCritSec writeScope(&writeCs);
+        ScopedMem<WCHAR> filePath;
+        ScopedMem<char> prefsData, prefsBinData;
+        size_t prefsDataLen, prefsBinDataLen;
+        uint32_t prefsSchemaHash;
+        {
+            ScopedCritSec scope(&cs);
+            if (!data)
+                return;
+            filePath.Set(path); path = NULL;
+            prefsData.Set(data); data = NULL;
+            prefsBinData.Set(binData); binData = NULL;
+            prefsDataLen = dataLen;
+            prefsBinDataLen = binDataLen;
+            prefsSchemaHash = schemaHash;
+        }
+
+        FileTransaction trans;
+        bool ok = trans.WriteAll(filePath, prefsData, prefsDataLen) && trans.Commit();
+        if (!ok)
+            return;
+        FILETIME time = file::GetModificationTime(filePath);
+        {
+            ScopedCritSec scope(&cs);
+            lastWritten = time;
+        }
+        SavePrefsCache(filePath, prefsBinData, prefsBinDataLen, prefsSchemaHash);
+    }
+
+public:
+    PrefsWriter() : ThreadBase("PrefsWriter"), path(NULL), data(NULL), dataLen(0),
+        binData(NULL), binDataLen(0), schemaHash(0) {
+        InitializeCriticalSection(&cs);
+        InitializeCriticalSection(&writeCs);
+        hQueuedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        ZeroMemory(&lastWritten, sizeof(lastWritten));
+    }
+    virtual ~PrefsWriter() {
+        free(path);
+        free(data);
+        free(binData);
+        CloseHandle(hQueuedEvent);
+        DeleteCriticalSection(&writeCs);
+        DeleteCriticalSection(&cs);
+    }
+
+    // takes ownership of filePath, prefsData and prefsBinData
+    void Queue(WCHAR *filePath, char *prefsData, size_t prefsDataLen, char *prefsBinData, size_t prefsBinDataLen, uint32_t prefsSchemaHash) {
+        ScopedCritSec scope(&cs);
+        free(path);
+        free(data);
+        free(binData);
+        path = filePath;
+        data = prefsData;
+        dataLen = prefsDataLen;
+        binData = prefsBinData;
+        binDataLen = prefsBinDataLen;
+        schemaHash = prefsSchemaHash;
+        SetEvent(hQueuedEvent);
+    }
+
+    // modification time of the settings file after the last successful write
+    FILETIME GetLastWritten() {
+        ScopedCritSec scope(&cs);
+        return lastWritten;
+    }
+
+    // synchronously writes whatever is still queued and terminates the thread
+    void Stop() {
+        RequestCancel();
+        SetEvent(hQueuedEvent);
+        Join();
+        WriteQueued();
+    }
+
+    virtual void Run() {
+        while (!WasCancelRequested()) {
+            WaitForSingleObject(hQueuedEvent, INFINITE);
+            if (!WasCancelRequested())
+                WriteQueued();
+        }
+    }
+};
+
+// delay after which changed settings are written out
+// (so that several changes in quick succession cause a single write)
+#define SAVE_PREFS_DELAY_MS 1000
+
+static PrefsWriter *    gPrefsWriter = NULL;
+static UINT_PTR         gSavePrefsTimerId = 0;
+// the settings file's content as last read or queued for writing (so that
+// it doesn't have to be re-read from disk before every save)
+static char *           gPrefsData = NULL;
+static size_t           gPrefsDataSize = 0;
+
 namespace prefs {
 
 WCHAR *GetSettingsPath()
@@ -211,9 +391,27 @@ bool Load()
     CrashIf(gGlobalPrefs);
 
     ScopedMem<WCHAR> path(GetSettingsPath());
-    ScopedMem<char> prefsData(file::ReadAll(path, NULL));
-    gGlobalPrefs = (GlobalPrefs *)DeserializeStruct(&gGlobalPrefsInfo, prefsData);
-    CrashAlwaysIf(!gGlobalPrefs);
+    gGlobalPrefs = LoadPrefsCache(path);
+    if (!gGlobalPrefs) {
+        size_t prefsDataSize;
+        ScopedMem<char> prefsData(file::ReadAll(path, &prefsDataSize));
+        gGlobalPrefs = (GlobalPrefs *)DeserializeStruct(&gGlobalPrefsInfo, prefsData);
+        CrashAlwaysIf(!gGlobalPrefs);
+        // snapshot the settings as read, so that the next start won't have to parse them again
+        if (prefsData && HasPermission(Perm_SavePreferences)) {
+            size_t binDataSize;
+            ScopedMem<char> binData(SerializeStructBin(&gGlobalPrefsInfo, gGlobalPrefs, &binDataSize));
+            SavePrefsCache(path, binData, binDataSize, GetPrefsSchemaHash());
+        }
+        free(gPrefsData);
+        gPrefsData = prefsData.StealData();
+        gPrefsDataSize = gPrefsData ? prefsDataSize : 0;
+    }
+    else {
+        // the text will only be re-read when it's needed for saving
+        free(gPrefsData);
+        gPrefsData = NULL;
+    }
 
     if (!file::Exists(path)) {
         ScopedMem<WCHAR> bencPath(AppGenDataFilename(LEGACY_FILE_NAME));
@@ -275,15 +473,8 @@ bool Load()
     return true;
 }
 
-// called whenever global preferences change or a file is
-// added or removed from gFileHistory (in order to keep
-// the list of recently opened documents in sync)
-bool Save()
+static void UpdateDisplayStatesForAllWindows()
 {
-    // don't save preferences without the proper permission
-    if (!HasPermission(Perm_SavePreferences))
-        return false;
-
     /* mark currently shown files as visible */
     for (size_t i = 0; i < gWindows.Count(); i++) {
         UpdateCurrentFileDisplayStateForWin(SumatraWindow::Make(gWindows.At(i)));
@@ -291,6 +482,17 @@ bool Save()
     for (size_t i = 0; i < gEbookWindows.Count(); i++) {
         UpdateCurrentFileDisplayStateForWin(SumatraWindow::Make(gEbookWindows.At(i)));
     }
+}
+
+// serializes the preferences (which must happen on the UI thread)
+// and queues them for being written by gPrefsWriter
+static bool QueuePrefsForWriting()
+{
+    // don't save preferences without the proper permission
+    if (!HasPermission(Perm_SavePreferences))
+        return false;
+
+    UpdateDisplayStatesForAllWindows();
 
     // remove entries which should (no longer) be remembered
     gFileHistory.Purge(!gGlobalPrefs->rememberStatePerDocument);
@@ -302,8 +504,9 @@ bool Save()
     CrashIf(!path);
     if (!path)
         return false;
-    size_t prevPrefsDataSize;
-    ScopedMem<char> prevPrefsData(file::ReadAll(path, &prevPrefsDataSize));
+    if (!gPrefsData)
+        gPrefsData = file::ReadAll(path, &gPrefsDataSize);
+    uint32_t schemaHash = GetPrefsSchemaHash();
 
     if (!gGlobalPrefs->rememberStatePerDocument) {
         for (DisplayState **ds = gGlobalPrefs->fileStates->IterStart(); ds; ds = gGlobalPrefs->fileStates->IterNext()) {
@@ -321,7 +524,10 @@ bool Save()
     }
 
     size_t prefsDataSize;
-    ScopedMem<char> prefsData(SerializeStruct(&gGlobalPrefsInfo, gGlobalPrefs, prevPrefsData, &prefsDataSize));
+    ScopedMem<char> prefsData(SerializeStruct(&gGlobalPrefsInfo, gGlobalPrefs, gPrefsData, &prefsDataSize));
+    // the snapshot must omit the same fields as the text file
+    size_t binDataSize;
+    ScopedMem<char> binData(SerializeStructBin(&gGlobalPrefsInfo, gGlobalPrefs, &binDataSize));
 
     if (!gGlobalPrefs->rememberStatePerDocument)
         gFileStateInfo.fieldCount = dimof(gFileStateFields);
@@ -331,17 +537,64 @@ bool Save()
         return false;
 
     // only save if anything's changed at all
-    if (prevPrefsDataSize == prefsDataSize && str::Eq(prefsData, prevPrefsData))
+    if (gPrefsData && gPrefsDataSize == prefsDataSize && str::Eq(prefsData, gPrefsData))
         return true;
 
-    FileTransaction trans;
-    bool ok = trans.WriteAll(path, prefsData, prefsDataSize) && trans.Commit();
-    if (!ok)
+    if (!gPrefsWriter) {
+        gPrefsWriter = new PrefsWriter();
+        gPrefsWriter->Start();
+    }
+    gPrefsWriter->Queue(path.StealData(), str::DupN(prefsData, prefsDataSize), prefsDataSize,
+                        binData.StealData(), binDataSize, schemaHash);
+    free(gPrefsData);
+    gPrefsData = prefsData.StealData();
+    gPrefsDataSize = prefsDataSize;
+    return true;
+}
+
+static VOID CALLBACK SavePrefsTimerProc(HWND hwnd, UINT msg, UINT_PTR timerId, DWORD time)
+{
+    KillTimer(NULL, gSavePrefsTimerId);
+    gSavePrefsTimerId = 0;
+    QueuePrefsForWriting();
+}
+
+// called whenever global preferences change or a file is
+// added or removed from gFileHistory (in order to keep
+// the list of recently opened documents in sync)
+// note: the preferences are only written after a short delay, call Flush()
+//       if they must have been written before continuing
+bool Save()
+{
+    if (!HasPermission(Perm_SavePreferences))
         return false;
-    gGlobalPrefs->lastPrefUpdate = file::GetModificationTime(path);
+    // windows might be closed before the preferences are written out
+    UpdateDisplayStatesForAllWindows();
+    if (!gSavePrefsTimerId)
+        gSavePrefsTimerId = SetTimer(NULL, 0, SAVE_PREFS_DELAY_MS, SavePrefsTimerProc);
+    if (!gSavePrefsTimerId)
+        return QueuePrefsForWriting();
     return true;
 }
 
+// synchronously writes out any pending changes (e.g. before exiting)
+void Flush()
+{
+    if (gSavePrefsTimerId) {
+        KillTimer(NULL, gSavePrefsTimerId);
+        gSavePrefsTimerId = 0;
+        QueuePrefsForWriting();
+    }
+    if (gPrefsWriter) {
+        gPrefsWriter->Stop();
+        FILETIME lastWritten = gPrefsWriter->GetLastWritten();
+        if (lastWritten.dwLowDateTime || lastWritten.dwHighDateTime)
+            gGlobalPrefs->lastPrefUpdate = lastWritten;
+        delete gPrefsWriter;
+        gPrefsWriter = NULL;
+    }
+}
+
 // refresh the preferences when a different SumatraPDF process saves them
 // or if they are edited by the user using a text editor
 bool Reload()
@@ -368,6 +621,11 @@ bool Reload()
     FILETIME time = file::GetModificationTime(path);
     if (FileTimeEq(time, gGlobalPrefs->lastPrefUpdate))
         return true;
+    if (gPrefsWriter && FileTimeEq(time, gPrefsWriter->GetLastWritten())) {
+        // the file has been changed by our own (asynchronous) write
+        gGlobalPrefs->lastPrefUpdate = time;
+        return true;
+    }
 
     ScopedMem<char> uiLanguage(str::Dup(gGlobalPrefs->uiLanguage));
     bool showToolbar = gGlobalPrefs->showToolbar;
@@ -393,6 +651,7 @@ bool Reload()
         ShowOrHideToolbarGlobally();
 
     UpdateDocumentColors();
+    UpdateRenderCacheSize();
     UpdateFavoritesTreeForAllWindows();
 
     size_t n = gEbookWindows.Count();
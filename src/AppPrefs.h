@@ -24,6 +24,7 @@ WCHAR *GetSettingsPath();
 
 bool Load();
 bool Save();
+void Flush();
 bool Reload();
 
 void RegisterForFileChanges();
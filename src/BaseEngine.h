@@ -33,24 +33,86 @@ enum DocumentProperty {
 
 class RenderedBitmap {
 protected:
-    HBITMAP hbmp;
+    mutable HBITMAP hbmp;
     SizeI size;
+    // alternatively, the pixels may be kept in memory as a DIB, in which
+    // case the HBITMAP is only created when GetBitmap is first called
+    // (saving a copy and a GDI handle for bitmaps that are only painted)
+    mutable BITMAPINFO *bmi;
+    mutable void *data;
+    LONG id;
+
+    static size_t BmiSize(const BITMAPINFO *bmi) {
+        return sizeof(BITMAPINFOHEADER) + bmi->bmiHeader.biClrUsed * sizeof(RGBQUAD);
+    }
+    static LONG NextId() {
+        static LONG lastId = 0;
+        return InterlockedIncrement(&lastId);
+    }
 
 public:
-    RenderedBitmap(HBITMAP hbmp, SizeI size) : hbmp(hbmp), size(size) { }
-    ~RenderedBitmap() { DeleteObject(hbmp); }
+    RenderedBitmap(HBITMAP hbmp, SizeI size) : hbmp(hbmp), size(size), bmi(NULL), data(NULL), id(NextId()) { }
+    // takes ownership of bmi and data (which must have been allocated with malloc)
+    RenderedBitmap(BITMAPINFO *bmi, void *data, SizeI size) : hbmp(NULL), size(size), bmi(bmi), data(data), id(NextId()) { }
+    ~RenderedBitmap() {
+        DeleteObject(hbmp);
+        free(bmi);
+        free(data);
+    }
 
     RenderedBitmap *Clone() const {
+        if (data) {
+            BITMAPINFO *bmi2 = (BITMAPINFO *)memdup(bmi, BmiSize(bmi));
+            void *data2 = memdup(data, bmi->bmiHeader.biSizeImage);
+            if (!bmi2 || !data2) {
+                free(bmi2);
+                free(data2);
+                return NULL;
+            }
+            return new RenderedBitmap(bmi2, data2, size);
+        }
         HBITMAP hbmp2 = (HBITMAP)CopyImage(hbmp, IMAGE_BITMAP, size.dx, size.dy, 0);
         return new RenderedBitmap(hbmp2, size);
     }
 
     // callers must not delete this (use Clone if you have to modify it)
-    HBITMAP GetBitmap() const { return hbmp; }
+    // note: for a DIB, this converts it into an HBITMAP (which from then on
+    //       holds the pixels, so that modifications of it are respected)
+    HBITMAP GetBitmap() const {
+        if (!hbmp && data) {
+            HDC hDC = GetDC(NULL);
+            hbmp = CreateDIBitmap(hDC, &bmi->bmiHeader, CBM_INIT, data, bmi, DIB_RGB_COLORS);
+            ReleaseDC(NULL, hDC);
+            if (hbmp) {
+                free(bmi);
+                free(data);
+                bmi = NULL;
+                data = NULL;
+            }
+        }
+        return hbmp;
+    }
+    // returns the pixels of a bitmap kept in memory as a DIB or NULL (e.g. after GetBitmap)
+    void *GetDIBData(BITMAPINFO **bmiOut) const {
+        if (bmiOut)
+            *bmiOut = data ? bmi : NULL;
+        return data;
+    }
+    bool IsValid() const { return hbmp || data; }
     SizeI Size() const { return size; }
-
-    // render the bitmap into the target rectangle (streching and skewing as requird)
-    bool StretchDIBits(HDC hdc, RectI target) const {
+    // unique for the lifetime of the process (e.g. for caching data derived
+    // from a bitmap that isn't modified anymore, such as a GPU texture)
+    LONG Id() const { return id; }
+
+    // copy the source rectangle of the bitmap into the target rectangle
+    // (stretching it as required, using hdc's current stretch mode)
+    bool Blit(HDC hdc, RectI target, RectI source) const {
+        if (data) {
+            int lines = ::StretchDIBits(hdc, target.x, target.y, target.dx, target.dy,
+                                        source.x, source.y, source.dx, source.dy,
+                                        data, bmi, DIB_RGB_COLORS, SRCCOPY);
+            return lines != 0 && lines != GDI_ERROR;
+        }
         HDC bmpDC = CreateCompatibleDC(hdc);
         if (!bmpDC)
             return false;
@@ -59,19 +121,46 @@ public:
             DeleteDC(bmpDC);
             return false;
         }
-        SetStretchBltMode(hdc, HALFTONE);
-        bool ok = StretchBlt(hdc, target.x, target.y, target.dx, target.dy,
-                             bmpDC, 0, 0, size.dx, size.dy, SRCCOPY);
+        bool ok;
+        if (target.dx == source.dx && target.dy == source.dy)
+            ok = BitBlt(hdc, target.x, target.y, target.dx, target.dy, bmpDC, source.x, source.y, SRCCOPY);
+        else
+            ok = StretchBlt(hdc, target.x, target.y, target.dx, target.dy,
+                            bmpDC, source.x, source.y, source.dx, source.dy, SRCCOPY);
         SelectObject(bmpDC, oldBmp);
         DeleteDC(bmpDC);
         return ok;
     }
+
+    // render the bitmap into the target rectangle (streching and skewing as requird)
+    bool StretchDIBits(HDC hdc, RectI target) const {
+        SetStretchBltMode(hdc, HALFTONE);
+        return Blit(hdc, target, RectI(PointI(), size));
+    }
 };
 
 // interface to be implemented for saving embedded documents that a link points to
 class LinkSaverUI {
 public:
     virtual bool SaveEmbedded(const unsigned char *data, size_t cbCount) = 0;
+    // alternatively, large embedded files can be written in chunks as they're
+    // decoded: if StartSaveEmbedded returns true, SaveEmbeddedChunk is called
+    // for all the data (totalSize is 0 if unknown) and FinishSaveEmbedded once
+    // with the overall result (which it returns)
+    virtual bool StartSaveEmbedded(size_t totalSize) { return false; }
+    virtual bool SaveEmbeddedChunk(const unsigned char *data, size_t cbCount) { return false; }
+    virtual bool FinishSaveEmbedded(bool ok) { return ok; }
+};
+
+// interface to be implemented for receiving the text of several pages at once
+// (cf. BaseEngine::ExtractTextRange)
+class TextExtractionSink {
+public:
+    virtual ~TextExtractionSink() { }
+    // text is NULL if no text could be extracted for pageNo and coords is
+    // only non-NULL if requested; the sink needs to free() both of them
+    // returning false stops the extraction of further pages
+    virtual bool PageTextExtracted(int pageNo, WCHAR *text, RectI *coords) = 0;
 };
 
 // a link destination
@@ -219,6 +308,9 @@ public:
     virtual ~BaseEngine() { }
     // creates a clone of this engine (e.g. for printing on a different thread)
     virtual BaseEngine *Clone() = 0;
+    // whether a Clone() may render on a different thread at the same time as this
+    // engine does (if true, the engine itself must also be thread-safe)
+    virtual bool SupportsConcurrentRendering() const { return false; }
 
     // the name of the file this engine handles
     virtual const WCHAR *FileName() const = 0;
@@ -232,6 +324,16 @@ public:
     virtual RectD PageContentBox(int pageNo, RenderTarget target=Target_View) {
         return PageMediabox(pageNo);
     }
+    // a cheap approximation of PageMediabox for engines where computing the
+    // exact boxes for all pages is expensive (*isExact is set, if the returned
+    // box is the one PageMediabox would return)
+    virtual RectD PageMediaboxEstimate(int pageNo, bool *isExact) {
+        *isExact = true;
+        return PageMediabox(pageNo);
+    }
+    // whether even small documents should be laid out with PageMediaboxEstimate
+    // (because PageMediabox might have to wait for the page to be loaded)
+    virtual bool PrefersPageSizeEstimates() const { return false; }
 
     // renders a page into a cacheable RenderedBitmap
     virtual RenderedBitmap *RenderBitmap(int pageNo, float zoom, int rotation,
@@ -242,6 +344,12 @@ public:
                          RectD *pageRect=NULL, /* if NULL: defaults to the page's mediabox */
                          RenderTarget target=Target_View, AbortCookie **cookie_out=NULL) = 0;
     // for both rendering methods: *cookie_out must be deleted after the call returns
+    // renders a quick, lower quality version of RenderBitmap's result (e.g. without
+    // anti-aliasing) to be displayed while the page is still being rendered
+    virtual RenderedBitmap *RenderPreviewBitmap(int pageNo, float zoom, int rotation,
+                         RectD *pageRect=NULL, AbortCookie **cookie_out=NULL) {
+        return RenderBitmap(pageNo, zoom, rotation, pageRect, Target_View, cookie_out);
+    }
 
     // applies zoom and rotation to a point in user/page space converting
     // it into device/screen space - or in the inverse direction
@@ -259,6 +367,20 @@ public:
     // caller needs to free() the result and *coords_out (if coords_out is non-NULL)
     virtual WCHAR * ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_out=NULL,
                                     RenderTarget target=Target_View) = 0;
+    // extracts the text of all pages from startPage to endPage (inclusively) and
+    // passes it in order to sink (engines can do this more efficiently than having
+    // ExtractPageText called for every single page)
+    // returns false if sink stopped the extraction before endPage
+    virtual bool ExtractTextRange(int startPage, int endPage, WCHAR *lineSep, TextExtractionSink *sink,
+                                  bool withCoords=false, RenderTarget target=Target_View) {
+        for (int pageNo = startPage; pageNo <= endPage; pageNo++) {
+            RectI *coords = NULL;
+            WCHAR *text = ExtractPageText(pageNo, lineSep, withCoords ? &coords : NULL, target);
+            if (!sink->PageTextExtracted(pageNo, text, coords))
+                return false;
+        }
+        return true;
+    }
     // pages where clipping doesn't help are rendered in larger tiles
     virtual bool HasClipOptimizations(int pageNo) = 0;
     // the layout type this document's author suggests (if the user doesn't care)
@@ -277,6 +399,10 @@ public:
     // informs the engine about annotations the user made so that they can be rendered, etc.
     // (this call supercedes any prior call to UpdateUserAnnotations)
     virtual void UpdateUserAnnotations(Vec<PageAnnotation> *list) = 0;
+    // asks the engine to leave out user highlights when rendering for Target_View, so
+    // that they can be painted on top of cached pages instead (and adding or removing
+    // a highlight doesn't require a page to be rerendered); returns false if unsupported
+    virtual bool SetHighlightOverlay(bool enable) { return false; }
 
     // TODO: needs a more general interface
     // whether it is allowed to print the current document
@@ -322,9 +448,36 @@ public:
     // caller must free() the result
     virtual char *GetDecryptionKey() const { return NULL; }
 
+    // whether the document is still being loaded in the background; until then,
+    // only some of its pages might be available and it should be reloaded afterwards
+    virtual bool IsStillLoading() const { return false; }
+
+    // returns an estimate of how much memory the document currently takes up
+    // (parsed pages, cached display lists, decoded images, etc.; 0 if unknown)
+    virtual size_t GetMemoryUsage() { return 0; }
+    // frees as much cached data (display lists, decoded images, etc.) as
+    // possible, e.g. under memory pressure (it's recreated when needed)
+    virtual void CompactMemory() { }
+    // fills digest with a hash of everything determining a page's appearance, so
+    // that unchanged pages can be recognized after a reload (returns false if
+    // that isn't supported)
+    virtual bool GetPageDigest(int pageNo, unsigned char digest[16]) { return false; }
+
     // loads the given page so that the time required can be measured
     // without also measuring rendering times
     virtual bool BenchLoadPage(int pageNo) = 0;
+    // returns how often cached page content could be reused for rendering
+    // (false if the engine doesn't cache any parsed page content)
+    virtual bool BenchCacheStats(int *hits, int *misses) { return false; }
+    // returns how often rasterized glyphs could be reused for rendering
+    virtual bool BenchGlyphCacheStats(int *hits, int *misses) { return false; }
+    // returns how much memory cached resources (images, fonts, etc.) currently
+    // use and how much they may use at most (which depends on other documents)
+    virtual bool BenchResourceCacheStats(size_t *used, size_t *budget) { return false; }
+    // returns how often threads had to wait for the engine's context resp.
+    // page locks (false if the engine doesn't have them or Windows doesn't
+    // keep track of contention for critical sections)
+    virtual bool BenchLockContention(int *ctxWaits, int *pagesWaits) { return false; }
 };
 
 #endif
@@ -12,9 +12,51 @@
 #define PPC_BSTR
 #include <chm_lib.h>
 
+// decompressing a block requires decompressing all the preceding blocks
+// of its reset interval, so neighbouring topics profit from keeping
+// more blocks decompressed than CHMLib's default of 5 (a block is usually 32 KB)
+#define MAX_BLOCKS_CACHED       64
+#define MAX_RESOLVED_OBJECTS    64
+
 ChmDoc::~ChmDoc()
 {
     chm_close(chmHandle);
+    for (size_t i = 0; i < resolvedObjects.Count(); i++) {
+        free(resolvedObjects.At(i).path);
+        free(resolvedObjects.At(i).info);
+    }
+    DeleteCriticalSection(&resolvedObjectsAccess);
+}
+
+bool ChmDoc::ResolveObject(const char *fileName, struct chmUnitInfo *info)
+{
+    ScopedCritSec scope(&resolvedObjectsAccess);
+
+    for (size_t i = 0; i < resolvedObjects.Count(); i++) {
+        ResolvedObject obj = resolvedObjects.At(i);
+        if (str::Eq(obj.path, fileName)) {
+            resolvedObjects.RemoveAt(i);
+            resolvedObjects.InsertAt(0, obj);
+            *info = *obj.info;
+            return true;
+        }
+    }
+
+    if (chm_resolve_object(chmHandle, fileName, info) != CHM_RESOLVE_SUCCESS)
+        return false;
+    ResolvedObject obj = { str::Dup(fileName), (struct chmUnitInfo *)memdup(info, sizeof(*info)) };
+    if (!obj.path || !obj.info) {
+        free(obj.path);
+        free(obj.info);
+        return true;
+    }
+    resolvedObjects.InsertAt(0, obj);
+    if (resolvedObjects.Count() > MAX_RESOLVED_OBJECTS) {
+        free(resolvedObjects.Last().path);
+        free(resolvedObjects.Last().info);
+        resolvedObjects.RemoveAt(resolvedObjects.Count() - 1);
+    }
+    return true;
 }
 
 bool ChmDoc::HasData(const char *fileName)
@@ -31,7 +73,7 @@ bool ChmDoc::HasData(const char *fileName)
         fileName += 2;
 
     struct chmUnitInfo info;
-    return chm_resolve_object(chmHandle, fileName, &info) == CHM_RESOLVE_SUCCESS;
+    return ResolveObject(fileName, &info);
 }
 
 unsigned char *ChmDoc::GetData(const char *fileName, size_t *lenOut)
@@ -45,8 +87,7 @@ unsigned char *ChmDoc::GetData(const char *fileName, size_t *lenOut)
     }
 
     struct chmUnitInfo info;
-    int res = chm_resolve_object(chmHandle, fileName, &info);
-    if (CHM_RESOLVE_SUCCESS != res)
+    if (!ResolveObject(fileName, &info))
         return NULL;
     size_t len = (size_t)info.length;
     if (len > 128 * 1024 * 1024) {
@@ -216,6 +257,7 @@ bool ChmDoc::Load(const WCHAR *fileName)
     chmHandle = chm_open((WCHAR *)fileName);
     if (!chmHandle)
         return false;
+    chm_set_param(chmHandle, CHM_PARAM_MAX_BLOCKS_CACHED, MAX_BLOCKS_CACHED);
 
     ParseWindowsData();
     if (!ParseSystemData())
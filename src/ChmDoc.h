@@ -9,6 +9,15 @@
 class ChmDoc {
     struct chmFile *chmHandle;
 
+    // the most recently resolved objects, most recent first
+    // (CHMLib reads the directory from disk for every lookup)
+    struct ResolvedObject {
+        char *path;
+        struct chmUnitInfo *info;
+    };
+    Vec<ResolvedObject> resolvedObjects;
+    CRITICAL_SECTION resolvedObjectsAccess;
+
     // Data parsed from /#WINDOWS, /#STRINGS, /#SYSTEM files inside CHM file
     ScopedMem<char> title;
     ScopedMem<char> tocPath;
@@ -22,9 +31,12 @@ class ChmDoc {
     bool ParseTocOrIndex(EbookTocVisitor *visitor, const char *path, bool isIndex);
 
     bool Load(const WCHAR *fileName);
+    bool ResolveObject(const char *fileName, struct chmUnitInfo *info);
 
 public:
-    ChmDoc() : chmHandle(NULL), codepage(0) { }
+    ChmDoc() : chmHandle(NULL), codepage(0) {
+        InitializeCriticalSection(&resolvedObjectsAccess);
+    }
     ~ChmDoc();
 
     bool HasData(const char *fileName);
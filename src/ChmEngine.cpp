@@ -65,14 +65,19 @@ public:
     }
 };
 
+// decompressed data is cached for going back and forth between pages (and
+// for prefetching the pages before and after the current one), but only up
+// to this size (least recently used entries are discarded first)
+#define CHM_MAX_CACHE_SIZE (32 * 1024 * 1024)
+
 class ChmCacheEntry {
 public:
-    const WCHAR *url; // owned by ChmEngineImpl::poolAllocator
+    WCHAR *url;
     unsigned char *data;
     size_t size;
 
-    ChmCacheEntry(const WCHAR *url) : url(url), data(NULL), size(0) { }
-    ~ChmCacheEntry() { free(data); }
+    ChmCacheEntry(const WCHAR *url) : url(str::Dup(url)), data(NULL), size(0) { }
+    ~ChmCacheEntry() { free(url); free(data); }
 };
 
 class ChmEngineImpl : public ChmEngine, public HtmlWindowCallback {
@@ -174,19 +179,22 @@ protected:
     HtmlWindow *htmlWindow;
     ChmNavigationCallback *navCb;
 
+    // ordered from least to most recently used
     Vec<ChmCacheEntry*> urlDataCache;
+    size_t urlDataCacheSize;
     // use a pool allocator for strings that aren't freed until this ChmEngineImpl
-    // is deleted (e.g. for titles and URLs for ChmTocItem and ChmCacheEntry)
+    // is deleted (e.g. for titles and URLs for ChmTocItem)
     PoolAllocator poolAlloc;
 
     bool Load(const WCHAR *fileName);
     void DisplayPage(const WCHAR *pageUrl);
+    void PrefetchPage(int pageNo);
 
-    ChmCacheEntry *FindDataForUrl(const WCHAR *url);
+    int FindDataForUrl(const WCHAR *url);
 };
 
 ChmEngineImpl::ChmEngineImpl() : fileName(NULL), doc(NULL),
-    htmlWindow(NULL), navCb(NULL), currentPageNo(1)
+    htmlWindow(NULL), navCb(NULL), currentPageNo(1), urlDataCacheSize(0)
 {
 }
 
@@ -215,9 +223,28 @@ void ChmEngineImpl::OnDocumentComplete(const WCHAR *url)
         currentPageNo = pageNo;
         if (navCb)
             navCb->PageNoChanged(pageNo);
+        // the previous and next pages are the most likely to be viewed next
+        PrefetchPage(pageNo + 1);
+        PrefetchPage(pageNo - 1);
     }
 }
 
+// decompresses a page's HTML ahead of time (the used
+// url must match the one DisplayPage navigates to)
+void ChmEngineImpl::PrefetchPage(int pageNo)
+{
+    if (pageNo < 1 || pageNo > PageCount())
+        return;
+    const WCHAR *pageUrl = pages.At(pageNo - 1);
+    if (IsExternalUrl(pageUrl))
+        return;
+    if (str::StartsWith(pageUrl, L"..\\"))
+        pageUrl += 3;
+    if (str::StartsWith(pageUrl, L"/"))
+        pageUrl++;
+    GetDataForUrl(pageUrl, NULL);
+}
+
 // Called before we start loading html for a given url. Will block
 // loading if returns false.
 bool ChmEngineImpl::OnBeforeNavigate(const WCHAR *url, bool newWindow)
@@ -385,23 +412,29 @@ bool ChmEngineImpl::Load(const WCHAR *fileName)
     return pages.Count() > 0;
 }
 
-ChmCacheEntry *ChmEngineImpl::FindDataForUrl(const WCHAR *url)
+int ChmEngineImpl::FindDataForUrl(const WCHAR *url)
 {
-    for (size_t i = 0; i < urlDataCache.Count(); i++) {
-        ChmCacheEntry *e = urlDataCache.At(i);
-        if (str::Eq(url, e->url))
-            return e;
+    for (size_t i = urlDataCache.Count(); i > 0; i--) {
+        if (str::Eq(url, urlDataCache.At(i - 1)->url))
+            return (int)i - 1;
     }
-    return NULL;
+    return -1;
 }
 
 // Load and cache data for a given url inside CHM file.
 const unsigned char *ChmEngineImpl::GetDataForUrl(const WCHAR *url, size_t *len)
 {
     ScopedMem<WCHAR> plainUrl(str::ToPlainUrl(url));
-    ChmCacheEntry *e = FindDataForUrl(plainUrl);
-    if (!e) {
-        e = new ChmCacheEntry(Allocator::StrDup(&poolAlloc, plainUrl));
+    ChmCacheEntry *e;
+    int idx = FindDataForUrl(plainUrl);
+    if (idx != -1) {
+        // mark the entry as the most recently used one
+        e = urlDataCache.At(idx);
+        urlDataCache.RemoveAt(idx);
+        urlDataCache.Append(e);
+    }
+    else {
+        e = new ChmCacheEntry(plainUrl);
         ScopedMem<char> urlUtf8(str::conv::ToUtf8(plainUrl));
         e->data = doc->GetData(urlUtf8, &e->size);
         if (!e->data) {
@@ -409,6 +442,15 @@ const unsigned char *ChmEngineImpl::GetDataForUrl(const WCHAR *url, size_t *len)
             return NULL;
         }
         urlDataCache.Append(e);
+        urlDataCacheSize += e->size;
+        // HtmlWindow copies the data it's been given, so
+        // any entry but the one to return can be discarded
+        while (urlDataCacheSize > CHM_MAX_CACHE_SIZE && urlDataCache.Count() > 1) {
+            ChmCacheEntry *old = urlDataCache.At(0);
+            urlDataCache.RemoveAt(0);
+            urlDataCacheSize -= old->size;
+            delete old;
+        }
     }
     if (len)
         *len = e->size;
@@ -87,6 +87,7 @@ static CrashHandlerAllocator *gCrashHandlerAllocator = NULL;
 // Note: intentionally not using ScopedMem<> to avoid
 // static initializers/destructors, which are bad
 static WCHAR *  gCrashDumpPath = NULL;
+static WCHAR *  gCrashInfoPath = NULL;
 static WCHAR *  gSymbolPathW = NULL;
 static WCHAR *  gSymbolsDir = NULL;
 static WCHAR *  gPdbZipPath = NULL;
@@ -97,17 +98,24 @@ static char *   gSystemInfo = NULL;
 static char *   gModulesInfo = NULL;
 static HANDLE   gDumpEvent = NULL;
 static HANDLE   gDumpThread = NULL;
+static HANDLE   gSubmitThread = NULL;
 static ExeType  gExeType = ExeSumatraStatic;
 static bool     gCrashed = false;
 
 static MINIDUMP_EXCEPTION_INFORMATION gMei = { 0 };
 static LPTOP_LEVEL_EXCEPTION_FILTER gPrevExceptionFilter = NULL;
 
+#define CRASH_INFO_NO_SYMBOLS "Symbols: missing\r\n"
+
 static char *BuildCrashInfoText()
 {
     lf("BuildCrashInfoText(): start");
 
     str::Str<char> s(16 * 1024, gCrashHandlerAllocator);
+    // the callstacks of such reports contain module offsets only,
+    // which have to be resolved on the server
+    if (!dbghelp::HasSymbols())
+        s.Append(CRASH_INFO_NO_SYMBOLS);
     if (gSystemInfo)
         s.Append(gSystemInfo);
 
@@ -258,51 +266,76 @@ static bool DownloadAndUnzipSymbols(const WCHAR *pdbZipPath, const WCHAR *symDir
 #endif
 }
 
-// If we can't resolve the symbols, we assume it's because we don't have symbols
-// so we'll try to download them and retry. If we can resolve symbols, we'll
-// get the callstacks etc. and submit to our server for analysis.
-void SubmitCrashInfo()
+// Downloading symbols and sending the report takes too long to be done at
+// the time of the crash (users tend to kill the process before we're done),
+// so we only write the minidump and the crash info (symbolized with whatever
+// symbols are available locally) and send the crash info at the next start
+// (cf. SubmitCrashInfo)
+static void SaveCrashInfo()
 {
-    if (!dir::Create(gSymbolsDir)) {
-        plog("SubmitCrashInfo(): couldn't create symbols dir");
+    lf("SaveCrashInfo(): start");
+    lf(L"SaveCrashInfo(): gSymbolPathW: '%s'", gSymbolPathW);
+    if (!dbghelp::Initialize(gSymbolPathW)) {
+        plog("SaveCrashInfo(): dbghelp::Initialize() failed");
         return;
     }
 
+    char *s = BuildCrashInfoText();
+    if (!s)
+        return;
+    if (!file::WriteAll(gCrashInfoPath, s, str::Len(s)))
+        plog("SaveCrashInfo(): couldn't write crash info");
+    gCrashHandlerAllocator->Free(s);
+}
+
+// Sends the crash info saved by a previous instance. If that crash info had
+// to be built without symbols, we download the symbols now so that future
+// crashes can be symbolized locally (the server resolves the module offsets
+// of the current report).
+static void SubmitCrashInfo()
+{
     lf("SubmitCrashInfo(): start");
-    lf(L"SubmitCrashInfo(): gSymbolPathW: '%s'", gSymbolPathW);
+    size_t len;
+    char *s = file::ReadAll(gCrashInfoPath, &len, gCrashHandlerAllocator);
+    // only ever try to submit a crash report once
+    file::Delete(gCrashInfoPath);
+    if (!s)
+        return;
     if (!CrashHandlerCanUseNet()) {
         plog("SubmitCrashInfo(): internet access not allowed");
+        gCrashHandlerAllocator->Free(s);
         return;
     }
 
-    char *s = NULL;
-    if (!dbghelp::Initialize(gSymbolPathW)) {
-        plog("SubmitCrashInfo(): dbghelp::Initialize() failed");
+    SendCrashInfo(s);
+    bool hadSymbols = !str::StartsWith(s, CRASH_INFO_NO_SYMBOLS);
+    gCrashHandlerAllocator->Free(s);
+    if (hadSymbols)
         return;
-    }
-
-    if (!dbghelp::HasSymbols()) {
-        if (!DownloadAndUnzipSymbols(gPdbZipPath, gSymbolsDir)) {
-            plog("SubmitCrashInfo(): failed to download symbols");
-            return;
-        }
-
-        if (!dbghelp::Initialize(gSymbolPathW, true)) {
-            plog("SubmitCrashInfo(): second dbghelp::Initialize() failed");
-            return;
-        }
-    }
 
-    if (!dbghelp::HasSymbols()) {
-        plog("SubmitCrashInfo(): HasSymbols() false after downloading symbols");
+    if (!dir::Create(gSymbolsDir)) {
+        plog("SubmitCrashInfo(): couldn't create symbols dir");
         return;
     }
+    if (!DownloadAndUnzipSymbols(gPdbZipPath, gSymbolsDir))
+        plog("SubmitCrashInfo(): failed to download symbols");
+}
 
-    s = BuildCrashInfoText();
-    if (!s)
+static DWORD WINAPI SubmitCrashInfoThread(LPVOID data)
+{
+    SubmitCrashInfo();
+    return 0;
+}
+
+// must be called after InstallCrashHandler and only once
+// CrashHandlerCanUseNet() returns the final answer
+void SubmitPendingCrashInfo()
+{
+    if (!gCrashInfoPath || !gCrashHandlerAllocator || gSubmitThread)
         return;
-    SendCrashInfo(s);
-    gCrashHandlerAllocator->Free(s);
+    if (!file::Exists(gCrashInfoPath))
+        return;
+    gSubmitThread = CreateThread(NULL, 0, SubmitCrashInfoThread, NULL, 0, 0);
 }
 
 static DWORD WINAPI CrashDumpThread(LPVOID data)
@@ -314,13 +347,13 @@ static DWORD WINAPI CrashDumpThread(LPVOID data)
     if (!dbghelp::Load())
         return 0;
 
-#ifndef HAS_NO_SYMBOLS
-    SubmitCrashInfo();
-#endif
     // always write a MiniDump (for the latest crash only)
     // set the SUMATRAPDF_FULLDUMP environment variable for more complete dumps
     bool fullDump = (NULL != GetEnvironmentVariableA("SUMATRAPDF_FULLDUMP", NULL, 0));
     dbghelp::WriteMiniDump(gCrashDumpPath, &gMei, fullDump);
+#ifndef HAS_NO_SYMBOLS
+    SaveCrashInfo();
+#endif
     return 0;
 }
 
@@ -679,6 +712,7 @@ void InstallCrashHandler(const WCHAR *crashDumpPath, const WCHAR *symDir)
     // allocation functions here.
     gCrashHandlerAllocator = new CrashHandlerAllocator();
     gCrashDumpPath = str::Dup(crashDumpPath);
+    gCrashInfoPath = str::Join(crashDumpPath, L".txt");
     gDumpEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
     if (!gDumpEvent)
         return;
@@ -706,7 +740,16 @@ void UninstallCrashHandler()
     CloseHandle(gDumpThread);
     CloseHandle(gDumpEvent);
 
+    if (gSubmitThread) {
+        // don't free the paths and the allocator while they're still in use
+        bool finished = WAIT_OBJECT_0 == WaitForSingleObject(gSubmitThread, 1000);
+        CloseHandle(gSubmitThread);
+        if (!finished)
+            return;
+    }
+
     free(gCrashDumpPath);
+    free(gCrashInfoPath);
     free(gSymbolsDir);
     free(gPdbZipPath);
     free(gLibMupdfPdbPath);
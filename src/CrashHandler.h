@@ -5,7 +5,7 @@
 #define CrashHandler_h
 
 void InstallCrashHandler(const WCHAR *crashDumpPath, const WCHAR *symDir);
-void SubmitCrashInfo();
+void SubmitPendingCrashInfo();
 void UninstallCrashHandler();
 
 #endif
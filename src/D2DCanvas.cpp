@@ -0,0 +1,269 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include <d2d1.h>
+#include "D2DCanvas.h"
+
+#include "WinUtil.h"
+
+// textures which haven't been painted for this long are released
+// (by then, RenderCache has usually dropped their bitmaps as well)
+#define TEXTURE_KEEP_MS 2000
+
+typedef HRESULT (WINAPI *D2D1CreateFactoryProc)(D2D1_FACTORY_TYPE factoryType, REFIID riid,
+                                                 const D2D1_FACTORY_OPTIONS *factoryOptions, void **factory);
+
+static D2D1_COLOR_F ToColorF(COLORREF c)
+{
+    return D2D1::ColorF(GetRValueSafe(c) / 255.0f, GetGValueSafe(c) / 255.0f, GetBValueSafe(c) / 255.0f);
+}
+
+static D2D1_COLOR_F ToColorF(const TRIVERTEX& tv)
+{
+    return D2D1::ColorF(tv.Red / 65280.0f, tv.Green / 65280.0f, tv.Blue / 65280.0f);
+}
+
+static D2D1_RECT_F ToRectF(RectI rc)
+{
+    return D2D1::RectF((float)rc.x, (float)rc.y, (float)(rc.x + rc.dx), (float)(rc.y + rc.dy));
+}
+
+D2DCanvas *D2DCanvas::Create(HWND hwnd)
+{
+    // don't retry for every WM_PAINT once we know that it won't work
+    static bool unavailable = false;
+    if (unavailable || GetSystemMetrics(SM_REMOTESESSION))
+        return NULL;
+
+    // d2d1.dll is loaded dynamically, as it isn't available on Windows XP
+    D2D1CreateFactoryProc _D2D1CreateFactory = (D2D1CreateFactoryProc)LoadDllFunc(L"d2d1.dll", "D2D1CreateFactory");
+    ID2D1Factory *factory = NULL;
+    if (!_D2D1CreateFactory || FAILED(_D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED,
+                                                           __uuidof(ID2D1Factory), NULL, (void **)&factory))) {
+        unavailable = true;
+        return NULL;
+    }
+
+    D2DCanvas *canvas = new D2DCanvas(hwnd, factory);
+    if (!canvas->CreateTarget()) {
+        unavailable = true;
+        delete canvas;
+        return NULL;
+    }
+    return canvas;
+}
+
+D2DCanvas::~D2DCanvas()
+{
+    DiscardTarget();
+    factory->Release();
+}
+
+bool D2DCanvas::CreateTarget()
+{
+    CrashIf(target || gdiTarget);
+    RectI rc = ClientRect(hwnd);
+    // a software render target wouldn't be any faster than GDI; using 96 DPI
+    // makes device independent pixels map to actual pixels; the GDI compatible
+    // pixel format allows to paint the rest of the UI with GDI (cf. GetDC)
+    D2D1_RENDER_TARGET_PROPERTIES props = D2D1::RenderTargetProperties(
+        D2D1_RENDER_TARGET_TYPE_HARDWARE,
+        D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED),
+        96.0f, 96.0f, D2D1_RENDER_TARGET_USAGE_GDI_COMPATIBLE);
+    D2D1_HWND_RENDER_TARGET_PROPERTIES hwndProps = D2D1::HwndRenderTargetProperties(
+        hwnd, D2D1::SizeU(max(rc.dx, 1), max(rc.dy, 1)));
+    HRESULT hr = factory->CreateHwndRenderTarget(props, hwndProps, &target);
+    if (FAILED(hr)) {
+        target = NULL;
+        return false;
+    }
+    hr = target->QueryInterface(&gdiTarget);
+    if (FAILED(hr)) {
+        gdiTarget = NULL;
+        DiscardTarget();
+        return false;
+    }
+    return true;
+}
+
+// all textures belong to the render target (and its device)
+void D2DCanvas::DiscardTarget()
+{
+    CrashIf(hdc);
+    for (size_t i = 0; i < textures.Count(); i++) {
+        textures.At(i).bmp->Release();
+    }
+    textures.Reset();
+    if (gdiTarget)
+        gdiTarget->Release();
+    if (target)
+        target->Release();
+    gdiTarget = NULL;
+    target = NULL;
+}
+
+bool D2DCanvas::BeginDraw()
+{
+    CrashIf(hdc);
+    if (!target && !CreateTarget())
+        return false;
+    target->BeginDraw();
+    return true;
+}
+
+bool D2DCanvas::EndDraw()
+{
+    ReleaseDC();
+    HRESULT hr = target->EndDraw();
+    if (D2DERR_RECREATE_TARGET == hr) {
+        // the graphics device was lost (e.g. due to a driver update)
+        DiscardTarget();
+        return false;
+    }
+    FreeUnusedTextures();
+    return SUCCEEDED(hr);
+}
+
+void D2DCanvas::Resize(SizeI size)
+{
+    if (target)
+        target->Resize(D2D1::SizeU(max(size.dx, 1), max(size.dy, 1)));
+}
+
+void D2DCanvas::FillRect(RectI rc, COLORREF col)
+{
+    ScopedComPtr<ID2D1SolidColorBrush> brush;
+    HRESULT hr = target->CreateSolidColorBrush(ToColorF(col), &brush);
+    if (SUCCEEDED(hr))
+        target->FillRectangle(ToRectF(rc), brush);
+}
+
+void D2DCanvas::GradientFill(TRIVERTEX *tv, ULONG nv, GRADIENT_RECT *gr, ULONG nr)
+{
+    for (ULONG i = 0; i < nr; i++) {
+        if (gr[i].UpperLeft >= nv || gr[i].LowerRight >= nv)
+            continue;
+        const TRIVERTEX& tl = tv[gr[i].UpperLeft];
+        const TRIVERTEX& br = tv[gr[i].LowerRight];
+        D2D1_GRADIENT_STOP stops[2] = { { 0.0f, ToColorF(tl) }, { 1.0f, ToColorF(br) } };
+        ScopedComPtr<ID2D1GradientStopCollection> stopCollection;
+        HRESULT hr = target->CreateGradientStopCollection(stops, dimof(stops), &stopCollection);
+        if (FAILED(hr))
+            continue;
+        ScopedComPtr<ID2D1LinearGradientBrush> brush;
+        hr = target->CreateLinearGradientBrush(D2D1::LinearGradientBrushProperties(
+            D2D1::Point2F(0.0f, (float)tl.y), D2D1::Point2F(0.0f, (float)br.y)), stopCollection, &brush);
+        if (SUCCEEDED(hr))
+            target->FillRectangle(D2D1::RectF((float)tl.x, (float)tl.y, (float)br.x, (float)br.y), brush);
+    }
+}
+
+// copies the pixels of bmp into a top-down 32-bit DIB section
+static HBITMAP CreateBgrxCopy(RenderedBitmap *bmp, void **dataOut)
+{
+    SizeI size = bmp->Size();
+    BITMAPINFO bmi = { 0 };
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HDC hdc = CreateCompatibleDC(NULL);
+    if (!hdc)
+        return NULL;
+    HBITMAP hbmp = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, dataOut, NULL, 0);
+    bool ok = false;
+    if (hbmp) {
+        HGDIOBJ prevBmp = SelectObject(hdc, hbmp);
+        ok = bmp->Blit(hdc, RectI(PointI(), size), RectI(PointI(), size));
+        SelectObject(hdc, prevBmp);
+        GdiFlush();
+    }
+    DeleteDC(hdc);
+    if (!ok) {
+        DeleteObject(hbmp);
+        return NULL;
+    }
+    return hbmp;
+}
+
+ID2D1Bitmap *D2DCanvas::GetTexture(RenderedBitmap *bmp)
+{
+    DWORD now = GetTickCount();
+    for (Texture *tex = textures.IterStart(); tex; tex = textures.IterNext()) {
+        if (tex->bmpId == bmp->Id()) {
+            tex->lastUsed = now;
+            return tex->bmp;
+        }
+    }
+
+    SizeI size = bmp->Size();
+    UINT32 maxSize = target->GetMaximumBitmapSize();
+    if (size.IsEmpty() || (UINT32)size.dx > maxSize || (UINT32)size.dy > maxSize)
+        return NULL;
+
+    // 32-bit DIBs (which most engines produce) are uploaded straight from
+    // memory, all other bitmaps are converted by GDI first
+    BITMAPINFO *bmi;
+    void *data = bmp->GetDIBData(&bmi);
+    HBITMAP hbmpCopy = NULL;
+    if (!data || bmi->bmiHeader.biBitCount != 32 || bmi->bmiHeader.biHeight > 0 ||
+        bmi->bmiHeader.biCompression != BI_RGB) {
+        hbmpCopy = CreateBgrxCopy(bmp, &data);
+        if (!hbmpCopy)
+            return NULL;
+    }
+
+    D2D1_BITMAP_PROPERTIES props = D2D1::BitmapProperties(
+        D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE));
+    ID2D1Bitmap *texture = NULL;
+    HRESULT hr = target->CreateBitmap(D2D1::SizeU(size.dx, size.dy), data, size.dx * 4, props, &texture);
+    DeleteObject(hbmpCopy);
+    if (FAILED(hr))
+        return NULL;
+
+    Texture tex = { bmp->Id(), texture, now };
+    textures.Append(tex);
+    return texture;
+}
+
+void D2DCanvas::FreeUnusedTextures()
+{
+    DWORD now = GetTickCount();
+    for (size_t i = textures.Count(); i > 0; i--) {
+        Texture& tex = textures.At(i - 1);
+        if (now - tex.lastUsed > TEXTURE_KEEP_MS) {
+            tex.bmp->Release();
+            textures.RemoveAt(i - 1);
+        }
+    }
+}
+
+void D2DCanvas::DrawTile(RenderedBitmap *bmp, RectI dst, RectI src)
+{
+    CrashIf(hdc);
+    ID2D1Bitmap *texture = GetTexture(bmp);
+    if (texture)
+        target->DrawBitmap(texture, ToRectF(dst), 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR, ToRectF(src));
+}
+
+HDC D2DCanvas::GetDC()
+{
+    if (!hdc) {
+        HRESULT hr = gdiTarget->GetDC(D2D1_DC_INITIALIZE_MODE_COPY, &hdc);
+        if (FAILED(hr))
+            hdc = NULL;
+    }
+    return hdc;
+}
+
+void D2DCanvas::ReleaseDC()
+{
+    if (hdc) {
+        gdiTarget->ReleaseDC(NULL);
+        hdc = NULL;
+    }
+}
@@ -0,0 +1,66 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#ifndef D2DCanvas_h
+#define D2DCanvas_h
+
+#include "RenderCache.h"
+
+struct ID2D1Factory;
+struct ID2D1HwndRenderTarget;
+struct ID2D1GdiInteropRenderTarget;
+struct ID2D1Bitmap;
+
+/* Paints a document with Direct2D instead of GDI, so that scrolling and zooming
+   only recomposite the cached tiles on the GPU: a tile is uploaded as a texture
+   the first time it's painted and then reused for as long as it keeps being painted.
+   Whatever isn't painted through the canvas (text, selection, etc.) can still be
+   painted with GDI into the DC returned by GetDC (until ReleaseDC is called). */
+class D2DCanvas : public TilePainter {
+    HWND hwnd;
+    ID2D1Factory *factory;
+    ID2D1HwndRenderTarget *target;
+    ID2D1GdiInteropRenderTarget *gdiTarget;
+    HDC hdc;
+
+    struct Texture {
+        // cf. RenderedBitmap::Id
+        LONG bmpId;
+        ID2D1Bitmap *bmp;
+        // GetTickCount() of when the texture was last painted
+        DWORD lastUsed;
+    };
+    Vec<Texture> textures;
+
+    D2DCanvas(HWND hwnd, ID2D1Factory *factory) :
+        hwnd(hwnd), factory(factory), target(NULL), gdiTarget(NULL), hdc(NULL) { }
+
+    bool CreateTarget();
+    void DiscardTarget();
+    ID2D1Bitmap *GetTexture(RenderedBitmap *bmp);
+    void FreeUnusedTextures();
+
+public:
+    // returns NULL if Direct2D isn't available (e.g. on Windows XP,
+    // in a remote session or without hardware acceleration)
+    static D2DCanvas *Create(HWND hwnd);
+    virtual ~D2DCanvas();
+
+    // all painting must happen between BeginDraw and EndDraw
+    bool BeginDraw();
+    // returns false if the canvas couldn't be presented (e.g. after
+    // the graphics device was lost), in which case it's to be repainted
+    bool EndDraw();
+    void Resize(SizeI size);
+
+    void FillRect(RectI rc, COLORREF col);
+    // same as ::GradientFill with GRADIENT_FILL_RECT_V
+    void GradientFill(TRIVERTEX *tv, ULONG nv, GRADIENT_RECT *gr, ULONG nr);
+    virtual void DrawTile(RenderedBitmap *bmp, RectI dst, RectI src);
+
+    // the canvas can't be painted to while a DC is obtained
+    HDC GetDC();
+    void ReleaseDC();
+};
+
+#endif
@@ -49,6 +49,8 @@
 #include "AppPrefs.h" // needed for gGlobalPrefs
 #include "TextSearch.h"
 #include "TextSelection.h"
+#include "ThreadUtil.h"
+#include "Timer.h"
 
 // Note: adding chm handling to DisplayModel is a hack, because DisplayModel
 // doesn't map to chm features well.
@@ -56,6 +58,15 @@
 // if true, we pre-render the pages right before and after the visible pages
 bool gPredictiveRender = true;
 
+// in presentation and manga mode, this many more rows of pages are pre-rendered
+// in reading direction (more for faster readers, cf. PrefetchRowCount)
+#define MIN_PREFETCH_ROWS       2
+#define MAX_PREFETCH_ROWS       6
+// pre-render the pages a reader is expected to reach within that many ms
+#define PREFETCH_LOOKAHEAD_MS   5000
+// page flips further apart than this don't count towards the reading pace
+#define MAX_FLIP_INTERVAL_MS    30000
+
 bool IsContinuous(DisplayMode displayMode)
 {
     return DM_CONTINUOUS == displayMode ||
@@ -151,7 +162,7 @@ SizeD DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent)
             return PageSizeAfterRotation(pageNo);
     }
 
-    RectD box = fitToContent ? pageInfo->contentBox : pageInfo->page;
+    RectD box = fitToContent ? pageInfo->contentBox : pageSizes.Get(pageNo);
     return engine->Transform(box, pageNo, 1.0, rotation).Size();
 }
 
@@ -183,14 +194,169 @@ static int LastPageInARowNo(int pageNo, int columns, bool showCover, int pageCou
 }
 
 // must call SetInitialViewSettings() after creation
+// documents with more pages are laid out with estimated page sizes
+// and the exact page sizes are resolved in the background
+#define MAX_EXACT_PAGE_SIZES        1000
+// number of pages around the initial page to get the exact sizes for right away
+#define EXACT_PAGE_SIZES_AROUND     16
+// minimal delay between two relayouts due to newly resolved page sizes
+#define PAGE_SIZES_UPDATE_DELAY     500
+
+size_t PageSizeRuns::FindRun(int pageNo) const
+{
+    CrashIf(pageNo < 1 || pageNo > pageCount);
+    // find the last run starting at or before pageNo
+    size_t lo = 0, hi = runs.Count() - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi + 1) / 2;
+        if (runs.At(mid).firstPageNo <= pageNo)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+RectD PageSizeRuns::Get(int pageNo) const
+{
+    return runs.At(FindRun(pageNo)).page;
+}
+
+void PageSizeRuns::Append(RectD page)
+{
+    pageCount++;
+    if (runs.Count() == 0 || runs.Last().page != page) {
+        Run run = { pageCount, page };
+        runs.Append(run);
+    }
+}
+
+void PageSizeRuns::Set(int pageNo, RectD page)
+{
+    size_t ix = FindRun(pageNo);
+    RectD prevPage = runs.At(ix).page;
+    if (prevPage == page)
+        return;
+
+    int first = runs.At(ix).firstPageNo;
+    int last = ix + 1 < runs.Count() ? runs.At(ix + 1).firstPageNo - 1 : pageCount;
+    bool sameAsPrev = ix > 0 && runs.At(ix - 1).page == page;
+    bool sameAsNext = ix + 1 < runs.Count() && runs.At(ix + 1).page == page;
+    Run run = { pageNo, page };
+
+    if (first == last) {
+        // replace a single page run and merge it with its neighbors
+        runs.At(ix).page = page;
+        if (sameAsNext)
+            runs.RemoveAt(ix + 1);
+        if (sameAsPrev)
+            runs.RemoveAt(ix);
+    }
+    else if (pageNo == first) {
+        runs.At(ix).firstPageNo++;
+        if (!sameAsPrev)
+            runs.InsertAt(ix, run);
+    }
+    else if (pageNo == last) {
+        if (sameAsNext)
+            runs.At(ix + 1).firstPageNo--;
+        else
+            runs.InsertAt(ix + 1, run);
+    }
+    else {
+        // split the run in three
+        Run rest = { pageNo + 1, prevPage };
+        runs.InsertAt(ix + 1, run);
+        runs.InsertAt(ix + 2, rest);
+    }
+}
+
+class PageSizesThread : public ThreadBase {
+    DisplayModel *  dm;
+    BaseEngine *    engine;
+    DisplayModelCallback *dmCb;
+
+public:
+    // number of pages (counting from the first one) with exactly known sizes
+    LONG            pagesResolved;
+
+    PageSizesThread(DisplayModel *dm, BaseEngine *engine, DisplayModelCallback *dmCb) :
+        ThreadBase("PageSizesThread"), dm(dm), engine(engine), dmCb(dmCb), pagesResolved(0) { }
+
+    virtual void Run() {
+        Timer t(true);
+        int pageCount = engine->PageCount();
+        for (int pageNo = 1; pageNo <= pageCount && !WasCancelRequested(); pageNo++) {
+            // PageMediabox caches the result, so that UpdatePageSizes can use it cheaply
+            engine->PageMediabox(pageNo);
+            InterlockedExchange(&pagesResolved, pageNo);
+            if (pageNo == pageCount || t.GetTimeInMs() > PAGE_SIZES_UPDATE_DELAY) {
+                dmCb->PageSizesChanged(dm);
+                t.Start();
+            }
+        }
+    }
+};
+
+// computes the content boxes of all pages (for ZOOM_FIT_CONTENT) in the background,
+// starting around startPageNo; the engine caches them, so that relayouts
+// and navigation don't have to wait for the pages to be run through a bbox device
+class ContentBoxesThread : public ThreadBase {
+    BaseEngine *    engine;
+    int             startPageNo;
+
+public:
+    ContentBoxesThread(BaseEngine *engine, int startPageNo) :
+        ThreadBase("ContentBoxesThread"), engine(engine), startPageNo(startPageNo) { }
+
+    virtual void Run() {
+        int pageCount = engine->PageCount();
+        for (int i = 0; i < 2 * pageCount && !WasCancelRequested(); i++) {
+            // alternate between the pages after and before startPageNo
+            int pageNo = startPageNo + (i % 2 ? -(i + 1) / 2 : i / 2);
+            if (1 <= pageNo && pageNo <= pageCount)
+                engine->PageContentBox(pageNo);
+        }
+    }
+};
+
+// interval at which to check whether a document has been loaded completely
+#define DOC_LOADING_CHECK_DELAY     500
+
+class DocLoadingThread : public ThreadBase {
+    DisplayModel *  dm;
+    BaseEngine *    engine;
+    DisplayModelCallback *dmCb;
+
+public:
+    DocLoadingThread(DisplayModel *dm, BaseEngine *engine, DisplayModelCallback *dmCb) :
+        ThreadBase("DocLoadingThread"), dm(dm), engine(engine), dmCb(dmCb) { }
+
+    virtual void Run() {
+        while (!WasCancelRequested()) {
+            Sleep(DOC_LOADING_CHECK_DELAY);
+            if (WasCancelRequested())
+                break;
+            bool completed = !engine->IsStillLoading();
+            dmCb->DocumentLoadingProgress(dm, completed);
+            if (completed)
+                break;
+        }
+    }
+};
+
+static LONG gDisplayModelCount = 0;
+
 DisplayModel::DisplayModel(BaseEngine *engine, DocType engineType, DisplayModelCallback *cb) :
     engine(engine), engineType(engineType), dmCb(cb),
-    pagesInfo(NULL), displayMode(DM_AUTOMATIC), startPage(1),
+    pagesInfo(NULL), pageSizesThread(NULL), contentBoxesThread(NULL), docLoadingThread(NULL), displayMode(DM_AUTOMATIC), startPage(1),
     zoomReal(INVALID_ZOOM), zoomVirtual(INVALID_ZOOM),
     rotation(0), dpiFactor(1.0f), displayR2L(false),
     presentationMode(false), presZoomVirtual(INVALID_ZOOM),
-    presDisplayMode(DM_AUTOMATIC), navHistoryIx(0),
-    dontRenderFlag(false)
+    presDisplayMode(DM_AUTOMATIC), flipDirection(1), lastFlipTime(0),
+    flipIntervalMs(0), navHistoryIx(0),
+    dontRenderFlag(false), deferRendering(false), renderMsPerMegapixel(0), layoutCount(0),
+    id(InterlockedIncrement(&gDisplayModelCount)), firstVisiblePageNo(0), lastVisiblePageNo(0)
 {
     CrashIf(!engine || engine->PageCount() <= 0);
 
@@ -213,6 +379,11 @@ DisplayModel::DisplayModel(BaseEngine *engine, DocType engineType, DisplayModelC
     textCache = new PageTextCache(engine);
     textSelection = new TextSelection(engine, textCache);
     textSearch = new TextSearch(engine, textCache);
+
+    if (engine->IsStillLoading()) {
+        docLoadingThread = new DocLoadingThread(this, engine, dmCb);
+        docLoadingThread->Start();
+    }
 }
 
 DisplayModel::~DisplayModel()
@@ -220,6 +391,22 @@ DisplayModel::~DisplayModel()
     dontRenderFlag = true;
     dmCb->CleanUp(this);
 
+    if (pageSizesThread) {
+        pageSizesThread->RequestCancel();
+        pageSizesThread->Join();
+        delete pageSizesThread;
+    }
+    if (contentBoxesThread) {
+        contentBoxesThread->RequestCancel();
+        contentBoxesThread->Join();
+        delete contentBoxesThread;
+    }
+    if (docLoadingThread) {
+        docLoadingThread->RequestCancel();
+        docLoadingThread->Join();
+        delete docLoadingThread;
+    }
+
     delete textSearch;
     delete textSelection;
     delete textCache;
@@ -283,12 +470,24 @@ void DisplayModel::BuildPagesInfo()
     int newStartPage = startPage;
     if (DisplayModeShowCover(displayMode) && newStartPage == 1 && columns > 1)
         newStartPage--;
+    // for large documents, only get the exact page sizes for the pages
+    // shown initially and resolve the remaining ones in the background
+    bool estimate = pageCount > MAX_EXACT_PAGE_SIZES || engine->PrefersPageSizeEstimates();
+    bool needsResolving = false;
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
-        pageInfo->page = engine->PageMediabox(pageNo);
+        bool isExact = true;
+        RectD page;
+        if (estimate && abs(pageNo - newStartPage) > EXACT_PAGE_SIZES_AROUND)
+            page = engine->PageMediaboxEstimate(pageNo, &isExact);
+        else
+            page = engine->PageMediabox(pageNo);
+        pageInfo->pageIsEstimate = !isExact;
+        needsResolving = needsResolving || !isExact;
         // layout pages with an empty mediabox as A4 size (resp. letter size)
-        if (pageInfo->page.IsEmpty())
-            pageInfo->page = defaultRect;
+        if (page.IsEmpty())
+            page = defaultRect;
+        pageSizes.Append(page);
         pageInfo->visibleRatio = 0.0;
         pageInfo->shown = false;
         if (IsContinuous(displayMode))
@@ -296,6 +495,56 @@ void DisplayModel::BuildPagesInfo()
         else if (newStartPage <= pageNo && pageNo < newStartPage + columns)
             pageInfo->shown = true;
     }
+
+    if (needsResolving) {
+        pageSizesThread = new PageSizesThread(this, engine, dmCb);
+        pageSizesThread->Start();
+    }
+}
+
+// replaces estimated page sizes with the ones resolved by pageSizesThread
+// so far and relayouts the document, if any page size has changed
+// (must be called from the UI thread)
+void DisplayModel::UpdatePageSizes()
+{
+    if (!pageSizesThread)
+        return;
+
+    ScrollState ss;
+    bool isDocReady = ValidPageNo(startPage) && zoomReal != 0 && zoomReal != INVALID_ZOOM;
+    if (isDocReady)
+        ss = GetScrollState();
+
+    int pagesResolved = pageSizesThread->pagesResolved;
+    bool changed = false;
+    for (int pageNo = 1; pageNo <= pagesResolved; pageNo++) {
+        PageInfo *pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->pageIsEstimate)
+            continue;
+        pageInfo->pageIsEstimate = false;
+        RectD page = engine->PageMediabox(pageNo);
+        // keep the estimate for pages with an empty mediabox
+        if (page.IsEmpty() || page == pageSizes.Get(pageNo))
+            continue;
+        pageSizes.Set(pageNo, page);
+        pageInfo->contentBox = RectD();
+        changed = true;
+    }
+
+    if (pagesResolved == PageCount()) {
+        pageSizesThread->Join();
+        delete pageSizesThread;
+        pageSizesThread = NULL;
+    }
+
+    if (!changed || !isDocReady)
+        return;
+    Relayout(zoomVirtual, rotation);
+    // when fitting to content, let GoToPage do the necessary scrolling
+    if (zoomVirtual != ZOOM_FIT_CONTENT)
+        SetScrollState(ss);
+    else
+        GoToPage(ss.page, 0);
 }
 
 // TODO: a better name e.g. ShouldShow() to better distinguish between
@@ -330,6 +579,50 @@ bool DisplayModel::PageVisibleNearby(int pageNo)
     return false;
 }
 
+/* Return true for the pages after the nearby ones in reading direction
+   which are pre-rendered in presentation and manga mode, so that flipping
+   through them doesn't have to wait for rendering */
+bool DisplayModel::PagePrefetched(int pageNo)
+{
+    if (!presentationMode && !displayR2L || !ValidPageNo(pageNo) || PageVisibleNearby(pageNo))
+        return false;
+
+    DisplayMode mode = GetDisplayMode();
+    int columns = ColumnsFromDisplayMode(mode);
+    int rows = PrefetchRowCount();
+
+    pageNo = FirstPageInARowNo(pageNo, columns, DisplayModeShowCover(mode));
+    int first = flipDirection > 0 ? pageNo - (rows + 1) * columns : pageNo + 2 * columns;
+    int last = flipDirection > 0 ? pageNo - columns : pageNo + (rows + 2) * columns;
+    for (int i = max(first, 1); i < last && i <= PageCount(); i++) {
+        if (PageVisible(i))
+            return true;
+    }
+    return false;
+}
+
+int DisplayModel::PrefetchRowCount() const
+{
+    if (flipIntervalMs <= 0)
+        return MIN_PREFETCH_ROWS;
+    return limitValue((int)(PREFETCH_LOOKAHEAD_MS / flipIntervalMs), MIN_PREFETCH_ROWS, MAX_PREFETCH_ROWS);
+}
+
+// keeps track of the reading direction and pace (cf. PagePrefetched)
+void DisplayModel::TrackPageFlip(int direction)
+{
+    DWORD now = GetTickCount();
+    DWORD interval = now - lastFlipTime;
+    if (direction != flipDirection || 0 == lastFlipTime || interval > MAX_FLIP_INTERVAL_MS)
+        flipIntervalMs = 0;
+    else if (0 == flipIntervalMs)
+        flipIntervalMs = interval;
+    else
+        flipIntervalMs = 0.7 * flipIntervalMs + 0.3 * interval;
+    flipDirection = direction;
+    lastFlipTime = now;
+}
+
 /* Return true if the first page is fully visible and alone on a line in
    show cover mode (i.e. it's not possible to flip to a previous page) */
 bool DisplayModel::FirstBookPageVisible()
@@ -377,7 +670,7 @@ float DisplayModel::ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo)
         int last = LastPageInARowNo(pageNo, columns, DisplayModeShowCover(GetDisplayMode()), PageCount());
         for (int i = first; i <= last; i++) {
             PageInfo *pageInfo = GetPageInfo(i);
-            RectD pageBox = engine->Transform(pageInfo->page, i, 1.0, rotation);
+            RectD pageBox = engine->Transform(pageSizes.Get(i), i, 1.0, rotation);
             row.dx += pageBox.dx;
 
             if (pageInfo->contentBox.IsEmpty())
@@ -421,14 +714,10 @@ int DisplayModel::FirstVisiblePageNo() const
     assert(pagesInfo);
     if (!pagesInfo) return INVALID_PAGE_NO;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0)
-            return pageNo;
-    }
-
     /* If no pages are visible */
-    return INVALID_PAGE_NO;
+    if (0 == firstVisiblePageNo)
+        return INVALID_PAGE_NO;
+    return firstVisiblePageNo;
 }
 
 // we consider the most visible page the current one
@@ -447,7 +736,7 @@ int DisplayModel::CurrentPageNo() const
     int mostVisiblePage = INVALID_PAGE_NO;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    for (int pageNo = firstVisiblePageNo; pageNo && pageNo <= lastVisiblePageNo; pageNo++) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
@@ -540,8 +829,14 @@ void DisplayModel::Relayout(float newZoomVirtual, int newRotation)
     if (!pagesInfo)
         return;
 
+    layoutCount++;
     rotation = NormalizeRotation(newRotation);
 
+    if (ZOOM_FIT_CONTENT == newZoomVirtual && !contentBoxesThread) {
+        contentBoxesThread = new ContentBoxesThread(engine, ValidPageNo(startPage) ? startPage : 1);
+        contentBoxesThread->Start();
+    }
+
     bool needHScroll = false;
     bool needVScroll = false;
     viewPort = RectI(viewPort.TL(), totalViewPortSize);
@@ -731,9 +1026,41 @@ void DisplayModel::ChangeStartPage(int newStartPage)
             pageInfo->shown = false;
         pageInfo->visibleRatio = 0.0;
     }
+    firstVisiblePageNo = lastVisiblePageNo = 0;
     Relayout(zoomVirtual, rotation);
 }
 
+/* Returns the first page of the row at position y on the canvas (or of the
+   closest row above it). Since Relayout() arranges the shown pages in rows
+   of increasing y, this is a binary search in continuous mode, so that the
+   pages in view can be found without iterating over all pages. */
+int DisplayModel::FirstPageInRowAt(int y) const
+{
+    DisplayMode mode = GetDisplayMode();
+    int columns = ColumnsFromDisplayMode(mode);
+    if (!IsContinuous(mode)) {
+        // only the pages of a single row are shown
+        int pageNo = startPage;
+        if (DisplayModeShowCover(mode) && pageNo == 1 && columns > 1)
+            pageNo--;
+        return max(pageNo, 1);
+    }
+
+    // find the last page starting above y
+    int lo = 1, hi = PageCount();
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (GetPageInfo(mid)->pos.y <= y)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    // all pages of a row start at the same y
+    for (int i = 1; i < columns && lo > 1 && GetPageInfo(lo - 1)->pos.y == GetPageInfo(lo)->pos.y; i++)
+        lo--;
+    return lo;
+}
+
 /* Given positions of each page in a large sheet that is continous view and
    coordinates of a current view into that large sheet, calculate which
    parts of each page is visible on the screen.
@@ -744,24 +1071,38 @@ void DisplayModel::RecalcVisibleParts()
     if (!pagesInfo)
         return;
 
+    for (int pageNo = firstVisiblePageNo; pageNo && pageNo <= lastVisiblePageNo; pageNo++) {
+        GetPageInfo(pageNo)->visibleRatio = 0.0;
+    }
+    firstVisiblePageNo = lastVisiblePageNo = 0;
+
+    // pageOnScreen is also used for converting coordinates on pages out of view
     for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         if (!pageInfo->shown) {
             assert(0.0 == pageInfo->visibleRatio);
             continue;
         }
+        pageInfo->pageOnScreen = pageInfo->pos;
+        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
+    }
+
+    // only the rows starting above the view port's bottom can be visible
+    for (int pageNo = FirstPageInRowAt(viewPort.y); pageNo <= PageCount(); ++pageNo) {
+        PageInfo *pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->shown || pageInfo->pos.y >= viewPort.y + viewPort.dy)
+            break;
 
         RectI pageRect = pageInfo->pos;
         RectI visiblePart = pageRect.Intersect(viewPort);
-
-        pageInfo->visibleRatio = 0.0;
         if (!visiblePart.IsEmpty()) {
             assert(pageRect.dx > 0 && pageRect.dy > 0);
             // calculate with floating point precision to prevent an integer overflow
             pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+            if (0 == firstVisiblePageNo)
+                firstVisiblePageNo = pageNo;
+            lastVisiblePageNo = pageNo;
         }
-        pageInfo->pageOnScreen = pageRect;
-        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
     }
 }
 
@@ -771,7 +1112,10 @@ int DisplayModel::GetPageNoByPoint(PointI pt)
     if (zoomReal <= 0)
         return -1;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    // only the pages within a single row can contain pt
+    int firstPageNo = FirstPageInRowAt(viewPort.y + pt.y);
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    for (int pageNo = firstPageNo; pageNo < firstPageNo + columns && pageNo <= PageCount(); ++pageNo) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         assert(0.0 == pageInfo->visibleRatio || pageInfo->shown);
         if (!pageInfo->shown)
@@ -890,18 +1234,8 @@ bool DisplayModel::IsOverText(PointI pt)
 
 void DisplayModel::RenderVisibleParts()
 {
-    int firstVisiblePage = 0;
-    int lastVisiblePage = 0;
-
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            assert(pageInfo->shown);
-            if (0 == firstVisiblePage)
-                firstVisiblePage = pageNo;
-            lastVisiblePage = pageNo;
-        }
-    }
+    int firstVisiblePage = firstVisiblePageNo;
+    int lastVisiblePage = lastVisiblePageNo;
     // no page is visible if e.g. the window is resized
     // vertically until only the title bar remains visible
     if (0 == firstVisiblePage)
@@ -914,7 +1248,9 @@ void DisplayModel::RenderVisibleParts()
         dmCb->RequestRendering(pageNo);
     }
 
-    if (gPredictiveRender) {
+    // in presentation mode, always prerender the previous and next slides,
+    // so that flipping to them doesn't show a blank page during a talk
+    if (gPredictiveRender || presentationMode) {
         // prerender two more pages in facing and book view modes
         // if the rendering queue still has place for them
         if (!IsSingle(GetDisplayMode())) {
@@ -927,6 +1263,17 @@ void DisplayModel::RenderVisibleParts()
             dmCb->RequestRendering(firstVisiblePage - 1);
         if (lastVisiblePage < PageCount())
             dmCb->RequestRendering(lastVisiblePage + 1);
+
+        // in presentation and manga mode, also request the pages which are
+        // about to be flipped to (farthest first, since rendering happens LIFO)
+        if (presentationMode || displayR2L) {
+            int columns = ColumnsFromDisplayMode(GetDisplayMode());
+            for (int i = PrefetchRowCount() * columns; i > 0; i--) {
+                int pageNo = flipDirection > 0 ? lastVisiblePage + columns + i : firstVisiblePage - columns - i;
+                if (ValidPageNo(pageNo) && PagePrefetched(pageNo))
+                    dmCb->RequestRendering(pageNo);
+            }
+        }
     }
 
     // request the visible pages last so that the above requested
@@ -1014,8 +1361,11 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     } else if (ZOOM_FIT_CONTENT == zoomVirtual) {
         // make sure that setZoomVirtual uses the correct page to calculate
         // the zoom level for (visibility will be recalculated below anyway)
-        for (int i =  PageCount(); i > 0; i--)
-            GetPageInfo(i)->visibleRatio = (i == pageNo ? 1.0f : 0);
+        for (int i = firstVisiblePageNo; i && i <= lastVisiblePageNo; i++) {
+            GetPageInfo(i)->visibleRatio = 0;
+        }
+        GetPageInfo(pageNo)->visibleRatio = 1.0f;
+        firstVisiblePageNo = lastVisiblePageNo = pageNo;
         Relayout(zoomVirtual, rotation);
     }
     //lf("DisplayModel::GoToPage(pageNo=%d, scrollY=%d)", pageNo, scrollY);
@@ -1082,6 +1432,7 @@ void DisplayModel::ChangeDisplayMode(DisplayMode newDisplayMode)
             pageInfo->shown = true;
             pageInfo->visibleRatio = 0.0;
         }
+        firstVisiblePageNo = lastVisiblePageNo = 0;
         Relayout(zoomVirtual, rotation);
     }
     GoToPage(currPageNo, 0);
@@ -1132,6 +1483,7 @@ bool DisplayModel::GoToNextPage(int scrollY)
         /* we're on a last row or after it, can't go any further */
         return false;
     }
+    TrackPageFlip(1);
     GoToPage(firstPageInNewRow, scrollY);
     return true;
 }
@@ -1172,6 +1524,7 @@ bool DisplayModel::GoToPrevPage(int scrollY)
     if (-1 == scrollY)
         scrollY = GetPageInfo(firstPageInNewRow)->pageOnScreen.dy;
 
+    TrackPageFlip(-1);
     GoToPage(firstPageInNewRow, scrollY);
     return true;
 }
@@ -1220,7 +1573,7 @@ void DisplayModel::ScrollXTo(int xOff)
 
     if (CurrentPageNo() != currPageNo)
         dmCb->PageNoChanged(CurrentPageNo());
-    RepaintDisplay();
+    dmCb->RepaintScrolled();
 }
 
 void DisplayModel::ScrollXBy(int dx)
@@ -1240,7 +1593,7 @@ void DisplayModel::ScrollYTo(int yOff)
     int newPageNo = CurrentPageNo();
     if (newPageNo != currPageNo)
         dmCb->PageNoChanged(newPageNo);
-    RepaintDisplay();
+    dmCb->RepaintScrolled();
 }
 
 /* Scroll the doc in y-axis by 'dy'. If 'changePage' is TRUE, automatically
@@ -1289,12 +1642,14 @@ void DisplayModel::ScrollYBy(int dy, bool changePage)
     currPageNo = CurrentPageNo();
     viewPort.y = newYOff;
     RecalcVisibleParts();
+    newPageNo = CurrentPageNo();
+    if (newPageNo != currPageNo)
+        TrackPageFlip(newPageNo > currPageNo ? 1 : -1);
     RenderVisibleParts();
     dmCb->UpdateScrollbars(canvasSize);
-    newPageNo = CurrentPageNo();
     if (newPageNo != currPageNo)
         dmCb->PageNoChanged(newPageNo);
-    RepaintDisplay();
+    dmCb->RepaintScrolled();
 }
 
 void DisplayModel::ZoomTo(float zoomLevel, PointI *fixPt)
@@ -1432,6 +1787,7 @@ void DisplayModel::RotateBy(int newRotation)
  * into a newly allocated buffer (which the caller needs to free()). */
 WCHAR *DisplayModel::GetTextInRegion(int pageNo, RectD region)
 {
+    ScopedTextPin pin(textCache, pageNo);
     RectI *coords;
     const WCHAR *pageText = textCache->GetData(pageNo, NULL, &coords);
     if (str::IsEmpty(pageText))
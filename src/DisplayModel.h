@@ -15,18 +15,13 @@
 
 extern bool gPredictiveRender;
 
-/* Describes many attributes of one page in one, convenient place */
+/* Describes many attributes of one page in one, convenient place
+   (the page size is kept in DisplayModel::pageSizes instead, as most
+   pages of a document share the same size) */
 struct PageInfo {
-    /* data that is constant for a given page. page size in document units */
-    RectD           page;
-
     /* data that is calculated when needed. actual content size within a page (View target) */
     RectD           contentBox;
 
-    /* data that needs to be set before DisplayModel::Relayout().
-       Determines whether a given page should be shown on the screen. */
-    bool            shown;
-
     /* data that changes when zoom and rotation changes */
     /* position and size within total area after applying zoom and rotation.
        Represents display rectangle for a given page.
@@ -34,9 +29,37 @@ struct PageInfo {
     RectI           pos;
 
     /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
-    float           visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
     /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
     RectI           pageOnScreen;
+    float           visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
+
+    /* data that needs to be set before DisplayModel::Relayout().
+       Determines whether a given page should be shown on the screen. */
+    bool            shown;
+    /* whether the page size is only an estimate until resolved by PageSizesThread
+       (cf. DisplayModel::UpdatePageSizes()) */
+    bool            pageIsEstimate;
+};
+
+/* Page sizes (in document units) stored as runs of consecutive pages
+   with identical sizes, so that a document with thousands of pages of
+   the same size only needs a single entry */
+class PageSizeRuns {
+    struct Run {
+        int firstPageNo;
+        RectD page;
+    };
+    Vec<Run> runs;
+    int pageCount;
+
+    size_t FindRun(int pageNo) const;
+
+public:
+    PageSizeRuns() : pageCount(0) { }
+
+    RectD Get(int pageNo) const;
+    void Set(int pageNo, RectD page);
+    void Append(RectD page);
 };
 
 /* The current scroll state (needed for saving/restoring the scroll position) */
@@ -52,6 +75,9 @@ struct ScrollState {
 };
 
 class DisplayModel;
+class PageSizesThread;
+class ContentBoxesThread;
+class DocLoadingThread;
 class PageTextCache;
 class TextSelection;
 class TextSearch;
@@ -59,10 +85,21 @@ struct TextSel;
 
 class DisplayModelCallback : public ChmNavigationCallback {
 public:
-    virtual void Repaint() = 0;
+    // repaints after delay ms (for coalescing several repaints)
+    virtual void Repaint(UINT delay) = 0;
+    // called instead of Repaint when only the viewport has been moved
+    // (so that the already painted content can be scrolled along)
+    virtual void RepaintScrolled() = 0;
     virtual void UpdateScrollbars(SizeI canvas) = 0;
     virtual void RequestRendering(int pageNo) = 0;
     virtual void CleanUp(DisplayModel *dm) = 0;
+    // called from a background thread whenever exact page sizes have been resolved
+    // (the callee must call DisplayModel::UpdatePageSizes on the UI thread)
+    virtual void PageSizesChanged(DisplayModel *dm) = 0;
+    // called from a background thread while the document is still being loaded
+    // (cf. BaseEngine::IsStillLoading) and once more after loading has completed
+    // (the callee should then reload the document on the UI thread)
+    virtual void DocumentLoadingProgress(DisplayModel *dm, bool completed) = 0;
 };
 
 // TODO: in hindsight, zoomVirtual is not a good name since it's either
@@ -125,12 +162,19 @@ public:
     bool            NeedHScroll() const { return viewPort.dy < totalViewPortSize.dy; }
     bool            NeedVScroll() const { return viewPort.dx < totalViewPortSize.dx; }
     SizeI           GetCanvasSize() const { return canvasSize; }
+    /* changes whenever the pages have been laid out anew */
+    int             GetLayoutCount() const { return layoutCount; }
+    /* unique for every DisplayModel (unlike its address, which might be reused
+       after a document has been closed) */
+    LONG            GetId() const { return id; }
 
     void            ChangeViewPortSize(SizeI newViewPortSize);
+    void            UpdatePageSizes();
 
     bool            PageShown(int pageNo);
     bool            PageVisible(int pageNo);
     bool            PageVisibleNearby(int pageNo);
+    bool            PagePrefetched(int pageNo);
     int             FirstVisiblePageNo() const;
     bool            FirstBookPageVisible();
     bool            LastBookPageVisible();
@@ -181,7 +225,7 @@ public:
     bool            GetDisplayR2L() const { return displayR2L; }
 
     // called when we decide that the display needs to be redrawn
-    void            RepaintDisplay() { dmCb->Repaint(); }
+    void            RepaintDisplay(UINT delay=0) { dmCb->Repaint(delay); }
 
     ChmEngine *     AsChmEngine() const;
 
@@ -191,10 +235,13 @@ protected:
     float           ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo);
     SizeD           PageSizeAfterRotation(int pageNo, bool fitToContent=false);
     void            ChangeStartPage(int startPage);
+    int             FirstPageInRowAt(int y) const;
     PointI          GetContentStart(int pageNo);
     void            SetZoomVirtual(float zoomVirtual);
     void            RecalcVisibleParts();
     void            RenderVisibleParts();
+    void            TrackPageFlip(int direction);
+    int             PrefetchRowCount() const;
 
     void            AddNavPoint();
     RectD           GetContentBox(int pageNo, RenderTarget target=Target_View);
@@ -203,6 +250,14 @@ protected:
 
     /* an array of PageInfo, len of array is pageCount */
     PageInfo *      pagesInfo;
+    /* the size of every page, len is pageCount */
+    PageSizeRuns    pageSizes;
+    /* resolves the exact size of pages laid out with an estimated size */
+    PageSizesThread*pageSizesThread;
+    /* precomputes the content boxes of all pages when fitting to content */
+    ContentBoxesThread*contentBoxesThread;
+    /* notifies dmCb until the engine has loaded the entire document */
+    DocLoadingThread*docLoadingThread;
 
     DisplayMode     displayMode;
     /* In non-continuous mode is the first page from a file that we're
@@ -215,6 +270,13 @@ protected:
 
     /* size of virtual canvas containing all rendered pages. */
     SizeI           canvasSize;
+    /* number of calls to Relayout() */
+    int             layoutCount;
+    LONG            id;
+    /* range of pages with visibleRatio > 0 (0 if no page is visible),
+       calculated in RecalcVisibleParts() */
+    int             firstVisiblePageNo;
+    int             lastVisiblePageNo;
 
     WindowMargin    windowMargin;
     SizeI           pageSpacing;
@@ -237,6 +299,12 @@ protected:
     float           presZoomVirtual;
     DisplayMode     presDisplayMode;
 
+    /* reading direction and pace (milliseconds per page, averaged) in
+       presentation and manga mode, cf. PagePrefetched */
+    int             flipDirection;
+    DWORD           lastFlipTime;
+    double          flipIntervalMs;
+
     Vec<ScrollState>navHistory;
     /* index of the "current" history entry (to be updated on navigation),
        resp. number of Back history entries */
@@ -245,6 +313,12 @@ protected:
 public:
     /* allow resizing a window without triggering a new rendering (needed for window destruction) */
     bool            dontRenderFlag;
+    /* while zooming continuously, the cached bitmaps are only scaled and no new
+       rendering is requested until zooming has stopped (cf. DeferRendering) */
+    bool            deferRendering;
+    /* running average of how long this document takes to render (0 until the
+       first tile has been rendered, cf. RenderCache::GetTileRes) */
+    float           renderMsPerMegapixel;
 };
 
 bool    IsContinuous(DisplayMode displayMode);
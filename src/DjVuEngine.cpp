@@ -12,6 +12,7 @@
 
 #include "ByteReader.h"
 #include "FileUtil.h"
+#include "ThreadUtil.h"
 
 // TODO: libdjvu leaks memory - among others
 //       DjVuPort::corpse_lock, DjVuPort::corpse_head, pcaster,
@@ -20,10 +21,11 @@
 
 class RenderedDjVuPixmap : public RenderedBitmap {
 public:
-    RenderedDjVuPixmap(const char *data, SizeI size, bool grayscale);
+    // takes ownership of data
+    RenderedDjVuPixmap(char *data, SizeI size, bool grayscale);
 };
 
-RenderedDjVuPixmap::RenderedDjVuPixmap(const char *data, SizeI size, bool grayscale) :
+RenderedDjVuPixmap::RenderedDjVuPixmap(char *data, SizeI size, bool grayscale) :
     RenderedBitmap(NULL, size)
 {
     int bpc = grayscale ? 1 : 3;
@@ -31,8 +33,10 @@ RenderedDjVuPixmap::RenderedDjVuPixmap(const char *data, SizeI size, bool graysc
     int colors = grayscale ? 256 : 0;
 
     BITMAPINFO *bmi = (BITMAPINFO *)calloc(1, sizeof(BITMAPINFOHEADER) + colors * sizeof(RGBQUAD));
-    if (!bmi)
+    if (!bmi) {
+        free(data);
         return;
+    }
     for (int i = 0; i < colors; i++) {
         bmi->bmiColors[i].rgbRed = bmi->bmiColors[i].rgbGreen = bmi->bmiColors[i].rgbBlue = (BYTE)i;
     }
@@ -46,11 +50,9 @@ RenderedDjVuPixmap::RenderedDjVuPixmap(const char *data, SizeI size, bool graysc
     bmi->bmiHeader.biSizeImage = size.dy * stride;
     bmi->bmiHeader.biClrUsed = colors;
 
-    HDC hDC = GetDC(NULL);
-    hbmp = CreateDIBitmap(hDC, &bmi->bmiHeader, CBM_INIT, data, bmi, DIB_RGB_COLORS);
-    ReleaseDC(NULL, hDC);
-
-    free(bmi);
+    // the HBITMAP is only created if it's actually needed
+    this->bmi = bmi;
+    this->data = data;
 }
 
 class DjVuDestination : public PageDestination {
@@ -147,11 +149,37 @@ public:
     virtual void Abort() { abort = true; }
 };
 
+// in case a status change isn't announced by a message
+#define DJVU_MAX_WAIT_MS    200
+// number of decoded pages kept per document (including pre-decoded ones)
+#define DJVU_PAGE_CACHE_SIZE 4
+// maximum number of bytes taken up by the cached text layers per document
+#define DJVU_TEXT_CACHE_SIZE (8 * 1024 * 1024)
+// number of pages whose text is extracted ahead in the background
+#define DJVU_TEXT_PREFETCH_PAGES 2
+
+/* libdjvu decodes all documents in threads of its own and posts a message
+   whenever a document's decoding has progressed. Engines wait for these
+   messages (instead of polling) and only lock their own document, so that
+   different documents can be rendered concurrently. */
 class DjVuContext {
     bool initialized;
     ddjvu_context_t *ctx;
+    // signaled whenever a message has been posted (one per engine)
+    Vec<HANDLE> progressEvents;
+    CRITICAL_SECTION eventsAccess;
+
+    // called by libdjvu's decoding threads
+    static void MessageCallback(ddjvu_context_t *context, void *closure) {
+        DjVuContext *self = (DjVuContext *)closure;
+        ScopedCritSec scope(&self->eventsAccess);
+        for (size_t i = 0; i < self->progressEvents.Count(); i++) {
+            SetEvent(self->progressEvents.At(i));
+        }
+    }
 
 public:
+    // minilisp (used for outlines, text and annotations) isn't thread-safe
     CRITICAL_SECTION lock;
 
     DjVuContext() : ctx(NULL), initialized(false) { }
@@ -162,6 +190,7 @@ public:
                 ddjvu_context_release(ctx);
             LeaveCriticalSection(&lock);
             DeleteCriticalSection(&lock);
+            DeleteCriticalSection(&eventsAccess);
         }
         minilisp_finish();
     }
@@ -170,36 +199,74 @@ public:
         if (!initialized) {
             initialized = true;
             InitializeCriticalSection(&lock);
+            InitializeCriticalSection(&eventsAccess);
             ctx = ddjvu_context_create("DjVuEngine");
             // reset the locale to "C" as most other code expects
             setlocale(LC_ALL, "C");
+            if (ctx)
+                ddjvu_message_set_callback(ctx, MessageCallback, this);
         }
 
         return ctx != NULL;
     }
 
-    void SpinMessageLoop(bool wait=true) {
-#if THREADMODEL!=NOTHREADS
-        if (wait)
-            ddjvu_message_wait(ctx);
-#endif
-        while (ddjvu_message_peek(ctx))
-            ddjvu_message_pop(ctx);
-    }
-
-    ddjvu_document_t *OpenFile(const WCHAR *fileName) {
+    ddjvu_document_t *OpenFile(const WCHAR *fileName, HANDLE progressEvent) {
         ScopedCritSec scope(&lock);
         ScopedMem<char> fileNameUtf8(str::conv::ToUtf8(fileName));
+        {
+            ScopedCritSec eventsScope(&eventsAccess);
+            progressEvents.Append(progressEvent);
+        }
         // TODO: libdjvu sooner or later crashes inside its caching code; cf.
         //       http://code.google.com/p/sumatrapdf/issues/detail?id=1434
         return ddjvu_document_create_by_filename_utf8(ctx, fileNameUtf8, /* cache */ FALSE);
     }
+
+    void CloseFile(ddjvu_document_t *doc, HANDLE progressEvent) {
+        if (doc)
+            ddjvu_document_release(doc);
+        ScopedCritSec scope(&eventsAccess);
+        progressEvents.Remove(progressEvent);
+    }
+
+    // blocks until any document's decoding has progressed
+    void WaitForProgress(HANDLE progressEvent) {
+        // Sumatra doesn't need the messages' content
+        while (ddjvu_message_peek(ctx))
+            ddjvu_message_pop(ctx);
+        WaitForSingleObject(progressEvent, DJVU_MAX_WAIT_MS);
+    }
 };
 
 static DjVuContext gDjVuContext;
 
+// a page's text layer in compact form: line breaks are stored as a single '\n'
+// and consecutive characters with the same bounding box share a single
+// rectangle (as the coordinates are usually only known per word)
+class DjVuPageText {
+public:
+    struct CoordRun {
+        RectI rect;
+        size_t count;
+    };
+
+    int pageNo;
+    // NULL if the page has no (valid) text layer
+    WCHAR *text;
+    size_t len;
+    Vec<CoordRun> runs;
+
+    explicit DjVuPageText(int pageNo) : pageNo(pageNo), text(NULL), len(0) { }
+    ~DjVuPageText() { free(text); }
+
+    size_t GetMemoryUsage() const {
+        return sizeof(*this) + len * sizeof(WCHAR) + runs.Count() * sizeof(CoordRun);
+    }
+};
+
 class DjVuEngineImpl : public DjVuEngine {
     friend DjVuEngine;
+    friend class DjVuTextPrefetchTask;
 
 public:
     DjVuEngineImpl();
@@ -211,11 +278,10 @@ public:
     virtual const WCHAR *FileName() const { return fileName; };
     virtual int PageCount() const { return pageCount; }
 
-    virtual RectD PageMediabox(int pageNo) {
-        assert(1 <= pageNo && pageNo <= PageCount());
-        return mediaboxes[pageNo-1];
-    }
+    virtual RectD PageMediabox(int pageNo);
     virtual RectD PageContentBox(int pageNo, RenderTarget target=Target_View);
+    virtual RectD PageMediaboxEstimate(int pageNo, bool *isExact);
+    virtual bool PrefersPageSizeEstimates() const { return !allMediaboxesLoaded; }
 
     virtual RenderedBitmap *RenderBitmap(int pageNo, float zoom, int rotation,
                          RectD *pageRect=NULL, /* if NULL: defaults to the page's mediabox */
@@ -230,6 +296,8 @@ public:
     virtual bool SaveFileAs(const WCHAR *copyFileName);
     virtual WCHAR * ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_out=NULL,
                                     RenderTarget target=Target_View);
+    virtual bool ExtractTextRange(int startPage, int endPage, WCHAR *lineSep, TextExtractionSink *sink,
+                                  bool withCoords=false, RenderTarget target=Target_View);
     virtual bool HasClipOptimizations(int pageNo) { return false; }
     virtual PageLayoutType PreferredLayout() { return Layout_Single; }
 
@@ -252,13 +320,35 @@ public:
     virtual bool HasTocTree() const { return outline != miniexp_nil; }
     virtual DocTocItem *GetTocTree();
 
+    virtual size_t GetMemoryUsage();
+    virtual void CompactMemory();
+
 protected:
     WCHAR *fileName;
 
     int pageCount;
     RectD *mediaboxes;
+    // set for pages whose mediabox has been determined (cf. PageMediabox)
+    bool *mediaboxLoaded;
+    bool allMediaboxesLoaded;
 
     ddjvu_document_t *doc;
+    // signaled by gDjVuContext whenever decoding has progressed
+    HANDLE progressEvent;
+    // guards doc (different documents can be accessed concurrently)
+    CRITICAL_SECTION docAccess;
+    // decoded pages, ordered most recently used first
+    struct CachedPage {
+        int pageNo;
+        ddjvu_page_t *page;
+    };
+    Vec<CachedPage> pageCache;
+    // parsed text layers, ordered most recently used first
+    Vec<DjVuPageText *> textCache;
+    size_t textCacheSize;
+    // text of upcoming pages is extracted by at most one task at a time
+    TaskGroup textPrefetch;
+    bool textPrefetchPending;
     miniexp_t outline;
     miniexp_t *annos;
     Vec<PageAnnotation> userAnnots;
@@ -268,34 +358,55 @@ protected:
     void AddUserAnnots(RenderedBitmap *bmp, int pageNo, float zoom, int rotation, RectI screen);
     bool ExtractPageText(miniexp_t item, const WCHAR *lineSep,
                          str::Str<WCHAR>& extracted, Vec<RectI>& coords);
+    DjVuPageText *LoadPageText(int pageNo);
+    DjVuPageText *GetPageText(int pageNo, bool prefetchNext=false);
+    void ClearTextCache();
     char *ResolveNamedDest(const char *name);
     DjVuTocItem *BuildTocTree(miniexp_t entry, int& idCounter);
     bool Load(const WCHAR *fileName);
     bool LoadMediaboxes();
+    ddjvu_page_t *GetDjVuPage(int pageNo, bool predecodeNext=false);
 };
 
 DjVuEngineImpl::DjVuEngineImpl() : fileName(NULL), pageCount(0), mediaboxes(NULL),
-    doc(NULL), outline(miniexp_nil), annos(NULL)
+    mediaboxLoaded(NULL), allMediaboxesLoaded(false), doc(NULL), textCacheSize(0),
+    textPrefetchPending(false), outline(miniexp_nil), annos(NULL)
 {
+    progressEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    InitializeCriticalSection(&docAccess);
 }
 
 DjVuEngineImpl::~DjVuEngineImpl()
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
+    // the prefetching task needs docAccess
+    textPrefetch.Wait();
+
+    EnterCriticalSection(&docAccess);
+    ClearTextCache();
+    {
+        ScopedCritSec scope(&gDjVuContext.lock);
+
+        if (annos) {
+            for (int i = 0; i < pageCount; i++)
+                if (annos[i])
+                    ddjvu_miniexp_release(doc, annos[i]);
+            free(annos);
+        }
+        if (outline != miniexp_nil)
+            ddjvu_miniexp_release(doc, outline);
+        for (size_t i = 0; i < pageCache.Count(); i++) {
+            ddjvu_page_release(pageCache.At(i).page);
+        }
+        gDjVuContext.CloseFile(doc, progressEvent);
+    }
 
     free(mediaboxes);
+    free(mediaboxLoaded);
     free(fileName);
 
-    if (annos) {
-        for (int i = 0; i < pageCount; i++)
-            if (annos[i])
-                ddjvu_miniexp_release(doc, annos[i]);
-        free(annos);
-    }
-    if (outline != miniexp_nil)
-        ddjvu_miniexp_release(doc, outline);
-    if (doc)
-        ddjvu_document_release(doc);
+    LeaveCriticalSection(&docAccess);
+    DeleteCriticalSection(&docAccess);
+    CloseHandle(progressEvent);
 }
 
 // Most functions of the ddjvu API such as ddjvu_document_get_pageinfo
@@ -377,14 +488,14 @@ bool DjVuEngineImpl::Load(const WCHAR *fileName)
         return false;
 
     this->fileName = str::Dup(fileName);
-    doc = gDjVuContext.OpenFile(fileName);
+    doc = gDjVuContext.OpenFile(fileName, progressEvent);
     if (!doc)
         return false;
 
-    ScopedCritSec scope(&gDjVuContext.lock);
+    ScopedCritSec scope(&docAccess);
 
     while (!ddjvu_document_decoding_done(doc))
-        gDjVuContext.SpinMessageLoop();
+        gDjVuContext.WaitForProgress(progressEvent);
     if (ddjvu_document_decoding_error(doc))
         return false;
 
@@ -393,26 +504,24 @@ bool DjVuEngineImpl::Load(const WCHAR *fileName)
         return false;
 
     mediaboxes = AllocArray<RectD>(pageCount);
-    bool ok = LoadMediaboxes();
-    if (!ok) {
-        // fall back to the slower but safer way to extract page mediaboxes
-        for (int i = 0; i < pageCount; i++) {
-            ddjvu_status_t status;
-            ddjvu_pageinfo_t info;
-            while ((status = ddjvu_document_get_pageinfo(doc, i, &info)) < DDJVU_JOB_OK)
-                gDjVuContext.SpinMessageLoop();
-            if (DDJVU_JOB_OK == status)
-                mediaboxes[i] = RectD(0, 0, info.width * GetFileDPI() / info.dpi,
-                                            info.height * GetFileDPI() / info.dpi);
-        }
+    mediaboxLoaded = AllocArray<bool>(pageCount);
+    if (!mediaboxes || !mediaboxLoaded)
+        return false;
+    // for indirect documents (where pages are stored in separate files),
+    // this fails and the mediaboxes are only determined when needed
+    allMediaboxesLoaded = LoadMediaboxes();
+    if (allMediaboxesLoaded) {
+        for (int i = 0; i < pageCount; i++)
+            mediaboxLoaded[i] = true;
     }
 
     annos = AllocArray<miniexp_t>(pageCount);
     for (int i = 0; i < pageCount; i++)
         annos[i] = miniexp_dummy;
 
+    ScopedCritSec ctxScope(&gDjVuContext.lock);
     while ((outline = ddjvu_document_get_outline(doc)) == miniexp_dummy)
-        gDjVuContext.SpinMessageLoop();
+        gDjVuContext.WaitForProgress(progressEvent);
     if (!miniexp_consp(outline) || miniexp_car(outline) != miniexp_symbol("bookmarks")) {
         ddjvu_miniexp_release(doc, outline);
         outline = miniexp_nil;
@@ -423,7 +532,7 @@ bool DjVuEngineImpl::Load(const WCHAR *fileName)
         ddjvu_status_t status;
         ddjvu_fileinfo_s info;
         while ((status = ddjvu_document_get_fileinfo(doc, i, &info)) < DDJVU_JOB_OK)
-            gDjVuContext.SpinMessageLoop();
+            gDjVuContext.WaitForProgress(progressEvent);
         if (DDJVU_JOB_OK == status && info.type == 'P')
             fileInfo.Append(info);
     }
@@ -431,6 +540,79 @@ bool DjVuEngineImpl::Load(const WCHAR *fileName)
     return true;
 }
 
+// the slower but safer way to extract page mediaboxes (requires that
+// the page's file has been loaded, which is why it's done lazily)
+RectD DjVuEngineImpl::PageMediabox(int pageNo)
+{
+    assert(1 <= pageNo && pageNo <= PageCount());
+    if (mediaboxLoaded[pageNo-1])
+        return mediaboxes[pageNo-1];
+
+    ScopedCritSec scope(&docAccess);
+    if (!mediaboxLoaded[pageNo-1]) {
+        ddjvu_status_t status;
+        ddjvu_pageinfo_t info;
+        while ((status = ddjvu_document_get_pageinfo(doc, pageNo-1, &info)) < DDJVU_JOB_OK)
+            gDjVuContext.WaitForProgress(progressEvent);
+        if (DDJVU_JOB_OK == status && info.dpi > 0)
+            mediaboxes[pageNo-1] = RectD(0, 0, info.width * GetFileDPI() / info.dpi,
+                                               info.height * GetFileDPI() / info.dpi);
+        mediaboxLoaded[pageNo-1] = true;
+    }
+    return mediaboxes[pageNo-1];
+}
+
+// pages of a book usually all have about the same size
+RectD DjVuEngineImpl::PageMediaboxEstimate(int pageNo, bool *isExact)
+{
+    assert(1 <= pageNo && pageNo <= PageCount());
+    *isExact = mediaboxLoaded[pageNo-1] || 1 == pageNo;
+    return PageMediabox(*isExact ? pageNo : 1);
+}
+
+// decoding a page (in particular its IW44 layers) takes far longer than rendering
+// it, so the most recently used pages are kept decoded for all zoom levels and
+// rotations; the caller must own docAccess and must not release the page
+ddjvu_page_t *DjVuEngineImpl::GetDjVuPage(int pageNo, bool predecodeNext)
+{
+    ddjvu_page_t *page = NULL;
+    for (size_t i = 0; i < pageCache.Count(); i++) {
+        if (pageCache.At(i).pageNo == pageNo) {
+            CachedPage item = pageCache.At(i);
+            pageCache.RemoveAt(i);
+            pageCache.InsertAt(0, item);
+            page = item.page;
+            break;
+        }
+    }
+    if (!page) {
+        page = ddjvu_page_create_by_pageno(doc, pageNo-1);
+        if (!page)
+            return NULL;
+        CachedPage item = { pageNo, page };
+        pageCache.InsertAt(0, item);
+    }
+
+    // libdjvu decodes the next page in the background, so that it's
+    // (mostly) ready by the time it's displayed
+    if (predecodeNext && pageNo < PageCount()) {
+        bool cached = false;
+        for (size_t i = 0; i < pageCache.Count() && !cached; i++) {
+            cached = pageCache.At(i).pageNo == pageNo + 1;
+        }
+        ddjvu_page_t *next = !cached ? ddjvu_page_create_by_pageno(doc, pageNo) : NULL;
+        if (next) {
+            CachedPage item = { pageNo + 1, next };
+            pageCache.InsertAt(1, item);
+        }
+    }
+
+    while (pageCache.Count() > DJVU_PAGE_CACHE_SIZE) {
+        ddjvu_page_release(pageCache.Pop().page);
+    }
+    return page;
+}
+
 // TODO: use AdjustLightness instead to compensate for the alpha?
 static Gdiplus::Color Unblend(PageAnnotation::Color c, BYTE alpha)
 {
@@ -510,21 +692,21 @@ void DjVuEngineImpl::AddUserAnnots(RenderedBitmap *bmp, int pageNo, float zoom,
 
 RenderedBitmap *DjVuEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
+    ScopedCritSec scope(&docAccess);
 
     RectD pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
     RectI screen = Transform(pageRc, pageNo, zoom, rotation).Round();
     RectI full = Transform(PageMediabox(pageNo), pageNo, zoom, rotation).Round();
     screen = full.Intersect(screen);
 
-    ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, pageNo-1);
+    ddjvu_page_t *page = GetDjVuPage(pageNo, target == Target_View);
     if (!page)
         return NULL;
     int rotation4 = (((-rotation / 90) % 4) + 4) % 4;
     ddjvu_page_set_rotation(page, (ddjvu_page_rotation_t)rotation4);
 
     while (!ddjvu_page_decoding_done(page))
-        gDjVuContext.SpinMessageLoop();
+        gDjVuContext.WaitForProgress(progressEvent);
     if (ddjvu_page_decoding_error(page))
         return NULL;
 
@@ -546,13 +728,12 @@ RenderedBitmap *DjVuEngineImpl::RenderBitmap(int pageNo, float zoom, int rotatio
         ddjvu_render_mode_t mode = DDJVU_RENDER_MASKONLY;
 #endif
         if (ddjvu_page_render(page, mode, &prect, &rrect, fmt, stride, bmpData.Get())) {
-            bmp = new RenderedDjVuPixmap(bmpData, screen.Size(), isBitonal);
+            bmp = new RenderedDjVuPixmap(bmpData.StealData(), screen.Size(), isBitonal);
             AddUserAnnots(bmp, pageNo, zoom, rotation, screen);
         }
     }
 
     ddjvu_format_release(fmt);
-    ddjvu_page_release(page);
 
     return bmp;
 }
@@ -580,7 +761,7 @@ bool DjVuEngineImpl::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoo
         screenBand.Offset(screenRect.x - pt.x, screenRect.y - pt.y);
 
         RenderedBitmap *bmp = RenderBitmap(pageNo, zoom, rotation, &pageBand, target, cookie_out);
-        if (bmp && bmp->GetBitmap())
+        if (bmp && bmp->IsValid())
             success = bmp->StretchDIBits(hDC, screenBand);
         else
             success = false;
@@ -598,16 +779,16 @@ bool DjVuEngineImpl::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoo
 
 RectD DjVuEngineImpl::PageContentBox(int pageNo, RenderTarget target)
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
+    ScopedCritSec scope(&docAccess);
 
     RectD pageRc = PageMediabox(pageNo);
-    ddjvu_page_t *page = ddjvu_page_create_by_pageno(doc, pageNo-1);
+    ddjvu_page_t *page = GetDjVuPage(pageNo);
     if (!page)
         return pageRc;
     ddjvu_page_set_rotation(page, DDJVU_ROTATE_0);
 
     while (!ddjvu_page_decoding_done(page))
-        gDjVuContext.SpinMessageLoop();
+        gDjVuContext.WaitForProgress(progressEvent);
     if (ddjvu_page_decoding_error(page))
         return pageRc;
 
@@ -649,7 +830,6 @@ RectD DjVuEngineImpl::PageContentBox(int pageNo, RenderTarget target)
     }
 
     ddjvu_format_release(fmt);
-    ddjvu_page_release(page);
 
     return pageRc;
 }
@@ -732,9 +912,14 @@ bool DjVuEngineImpl::ExtractPageText(miniexp_t item, const WCHAR *lineSep, str::
     int y1 = miniexp_to_int(miniexp_car(item)); item = miniexp_cdr(item);
     RectI rect = RectI::FromXY(x0, y0, x1, y1);
 
+    // symbols are unique for the lifetime of the process
+    // (and gDjVuContext.lock serializes their initialization)
+    static miniexp_t symChar = miniexp_symbol("char");
+    static miniexp_t symWord = miniexp_symbol("word");
+
     miniexp_t str = miniexp_car(item);
     if (miniexp_stringp(str) && !miniexp_cdr(item)) {
-        if (type != miniexp_symbol("char") && type != miniexp_symbol("word") ||
+        if (type != symChar && type != symWord ||
             coords.Count() > 0 && rect.y < coords.Last().y - coords.Last().dy * 0.8) {
             AppendNewline(extracted, coords, lineSep);
         }
@@ -747,7 +932,7 @@ bool DjVuEngineImpl::ExtractPageText(miniexp_t item, const WCHAR *lineSep, str::
                 coords.Append(RectI(rect.x, rect.y, rect.dx, rect.dy));
             extracted.AppendAndFree(value);
         }
-        if (miniexp_symbol("word") == type) {
+        if (symWord == type) {
             extracted.Append(' ');
             coords.Append(RectI(rect.x + rect.dx, rect.y, 2, rect.dy));
         }
@@ -761,58 +946,198 @@ bool DjVuEngineImpl::ExtractPageText(miniexp_t item, const WCHAR *lineSep, str::
     return !item;
 }
 
+// parses the page's text layer and converts its coordinates to mediabox
+// coordinates; the caller must own docAccess
+DjVuPageText *DjVuEngineImpl::LoadPageText(int pageNo)
+{
+    DjVuPageText *pageText = new DjVuPageText(pageNo);
+    str::Str<WCHAR> extracted;
+    Vec<RectI> coords;
+    {
+        ScopedCritSec ctxScope(&gDjVuContext.lock);
+
+        miniexp_t pagetext;
+        while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo-1, NULL)) == miniexp_dummy)
+            gDjVuContext.WaitForProgress(progressEvent);
+        if (miniexp_nil == pagetext)
+            return pageText;
+
+        bool success = ExtractPageText(pagetext, L"\n", extracted, coords);
+        ddjvu_miniexp_release(doc, pagetext);
+        if (!success)
+            return pageText;
+    }
+    if (extracted.Count() > 0 && extracted.Last() != '\n')
+        AppendNewline(extracted, coords, L"\n");
+    assert(str::Len(extracted.Get()) == coords.Count());
+
+    ddjvu_status_t status;
+    ddjvu_pageinfo_t info;
+    while ((status = ddjvu_document_get_pageinfo(doc, pageNo-1, &info)) < DDJVU_JOB_OK)
+        gDjVuContext.WaitForProgress(progressEvent);
+    float dpiFactor = 1.0;
+    if (DDJVU_JOB_OK == status)
+        dpiFactor = GetFileDPI() / info.dpi;
+
+    // TODO: the coordinates aren't completely correct yet
+    RectI page = PageMediabox(pageNo).Round();
+    for (size_t i = 0; i < coords.Count(); i++) {
+        RectI rect = coords.At(i);
+        if (rect != RectI()) {
+            if (dpiFactor != 1.0) {
+                geomutil::RectT<float> pageF = rect.Convert<float>();
+                pageF.x *= dpiFactor; pageF.dx *= dpiFactor;
+                pageF.y *= dpiFactor; pageF.dy *= dpiFactor;
+                rect = pageF.Round();
+            }
+            rect.y = page.dy - rect.y - rect.dy;
+        }
+        if (pageText->runs.Count() > 0 && pageText->runs.Last().rect == rect) {
+            pageText->runs.Last().count++;
+        }
+        else {
+            DjVuPageText::CoordRun run = { rect, 1 };
+            pageText->runs.Append(run);
+        }
+    }
+
+    pageText->len = extracted.Count();
+    pageText->text = extracted.StealData();
+    return pageText;
+}
+
+// extracts the text of the pages following the one last requested, so
+// that searching through a document doesn't have to wait for libdjvu
+class DjVuTextPrefetchTask : public ThreadPoolTask {
+    DjVuEngineImpl *engine;
+    int pageNo;
+
+public:
+    DjVuTextPrefetchTask(DjVuEngineImpl *engine, int pageNo) : engine(engine), pageNo(pageNo) { }
+
+    virtual void Run() {
+        int endPage = min(pageNo + DJVU_TEXT_PREFETCH_PAGES - 1, engine->PageCount());
+        for (int i = pageNo; i <= endPage; i++) {
+            // docAccess is only held for a single page at a time so that
+            // the page currently needed can be extracted in between
+            ScopedCritSec scope(&engine->docAccess);
+            engine->GetPageText(i);
+        }
+        ScopedCritSec scope(&engine->docAccess);
+        engine->textPrefetchPending = false;
+        // the task isn't accessed by the thread pool once it has run
+        delete this;
+    }
+};
+
+// the most recently used text layers are kept parsed, so that repeated
+// searches and text selection don't need to go through libdjvu and minilisp
+// again (and don't block other documents through gDjVuContext.lock);
+// the caller must own docAccess and must not delete the result
+DjVuPageText *DjVuEngineImpl::GetPageText(int pageNo, bool prefetchNext)
+{
+    DjVuPageText *pageText = NULL;
+    for (size_t i = 0; i < textCache.Count(); i++) {
+        if (textCache.At(i)->pageNo == pageNo) {
+            pageText = textCache.At(i);
+            textCache.RemoveAt(i);
+            textCache.InsertAt(0, pageText);
+            break;
+        }
+    }
+    if (!pageText) {
+        pageText = LoadPageText(pageNo);
+        textCache.InsertAt(0, pageText);
+        textCacheSize += pageText->GetMemoryUsage();
+        while (textCache.Count() > DJVU_TEXT_PREFETCH_PAGES + 1 && textCacheSize > DJVU_TEXT_CACHE_SIZE) {
+            DjVuPageText *last = textCache.Pop();
+            textCacheSize -= last->GetMemoryUsage();
+            delete last;
+        }
+    }
+
+    if (prefetchNext && pageNo < PageCount() && !textPrefetchPending) {
+        bool cached = false;
+        for (size_t i = 0; i < textCache.Count() && !cached; i++) {
+            cached = textCache.At(i)->pageNo == pageNo + 1;
+        }
+        if (!cached) {
+            textPrefetchPending = true;
+            textPrefetch.Queue(new DjVuTextPrefetchTask(this, pageNo + 1), TaskPriorityLow);
+        }
+    }
+
+    return pageText;
+}
+
+void DjVuEngineImpl::ClearTextCache()
+{
+    ScopedCritSec scope(&docAccess);
+    for (size_t i = 0; i < textCache.Count(); i++) {
+        delete textCache.At(i);
+    }
+    textCache.Reset();
+    textCacheSize = 0;
+}
+
 WCHAR *DjVuEngineImpl::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_out, RenderTarget target)
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
+    ScopedCritSec scope(&docAccess);
 
-    miniexp_t pagetext;
-    while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo-1, NULL)) == miniexp_dummy)
-        gDjVuContext.SpinMessageLoop();
-    if (miniexp_nil == pagetext)
+    DjVuPageText *pageText = GetPageText(pageNo, true);
+    if (!pageText->text)
         return NULL;
 
-    str::Str<WCHAR> extracted;
-    Vec<RectI> coords;
-    bool success = ExtractPageText(pagetext, lineSep, extracted, coords);
-    ddjvu_miniexp_release(doc, pagetext);
-    if (!success)
-        return NULL;
-    if (extracted.Count() > 0 && !str::EndsWith(extracted.Get(), lineSep))
-        AppendNewline(extracted, coords, lineSep);
+    // expand line breaks to lineSep and the coordinate runs to one rectangle per character
+    size_t sepLen = str::Len(lineSep);
+    str::Str<WCHAR> extracted(pageText->len + 1);
+    Vec<RectI> coords(coords_out ? pageText->len + 1 : 0);
+    size_t runIdx = 0, runLeft = pageText->runs.Count() > 0 ? pageText->runs.At(0).count : 0;
+    for (size_t i = 0; i < pageText->len; i++) {
+        WCHAR c = pageText->text[i];
+        if ('\n' == c)
+            extracted.Append(lineSep, sepLen);
+        else
+            extracted.Append(c);
+        if (coords_out) {
+            RectI rect = pageText->runs.At(runIdx).rect;
+            for (size_t j = 0; j < ('\n' == c ? sepLen : 1); j++)
+                coords.Append(rect);
+        }
+        if (0 == --runLeft && ++runIdx < pageText->runs.Count())
+            runLeft = pageText->runs.At(runIdx).count;
+    }
 
-    assert(str::Len(extracted.Get()) == coords.Count());
     if (coords_out) {
-        ddjvu_status_t status;
-        ddjvu_pageinfo_t info;
-        while ((status = ddjvu_document_get_pageinfo(doc, pageNo-1, &info)) < DDJVU_JOB_OK)
-            gDjVuContext.SpinMessageLoop();
-        float dpiFactor = 1.0;
-        if (DDJVU_JOB_OK == status)
-            dpiFactor = GetFileDPI() / info.dpi;
-
-        // TODO: the coordinates aren't completely correct yet
-        RectI page = PageMediabox(pageNo).Round();
-        for (size_t i = 0; i < coords.Count(); i++) {
-            if (coords.At(i) != RectI()) {
-                if (dpiFactor != 1.0) {
-                    geomutil::RectT<float> pageF = coords.At(i).Convert<float>();
-                    pageF.x *= dpiFactor; pageF.dx *= dpiFactor;
-                    pageF.y *= dpiFactor; pageF.dy *= dpiFactor;
-                    coords.At(i) = pageF.Round();
-                }
-                coords.At(i).y = page.dy - coords.At(i).y - coords.At(i).dy;
-            }
-        }
         CrashIf(coords.Count() != extracted.Count());
         *coords_out = coords.StealData();
     }
-
     return extracted.StealData();
 }
 
+bool DjVuEngineImpl::ExtractTextRange(int startPage, int endPage, WCHAR *lineSep, TextExtractionSink *sink, bool withCoords, RenderTarget target)
+{
+    // only the document is locked for the whole range, as gDjVuContext
+    // is shared with all other DjVu documents
+    ScopedCritSec scope(&docAccess);
+    return BaseEngine::ExtractTextRange(startPage, endPage, lineSep, sink, withCoords, target);
+}
+
+// note: decoded pages are allocated by libdjvu and aren't accounted for
+size_t DjVuEngineImpl::GetMemoryUsage()
+{
+    ScopedCritSec scope(&docAccess);
+    return textCacheSize;
+}
+
+void DjVuEngineImpl::CompactMemory()
+{
+    ClearTextCache();
+}
+
 void DjVuEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation> *list)
 {
-    ScopedCritSec scope(&gDjVuContext.lock);
+    ScopedCritSec scope(&docAccess);
     if (list)
         userAnnots = *list;
     else
@@ -822,23 +1147,23 @@ void DjVuEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation> *list)
 Vec<PageElement *> *DjVuEngineImpl::GetElements(int pageNo)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
+    ScopedCritSec scope(&docAccess);
+    ScopedCritSec ctxScope(&gDjVuContext.lock);
+
     if (annos && miniexp_dummy == annos[pageNo-1]) {
-        ScopedCritSec scope(&gDjVuContext.lock);
         while ((annos[pageNo-1] = ddjvu_document_get_pageanno(doc, pageNo-1)) == miniexp_dummy)
-            gDjVuContext.SpinMessageLoop();
+            gDjVuContext.WaitForProgress(progressEvent);
     }
     if (!annos || !annos[pageNo-1])
         return NULL;
 
-    ScopedCritSec scope(&gDjVuContext.lock);
-
     Vec<PageElement *> *els = new Vec<PageElement *>();
     RectI page = PageMediabox(pageNo).Round();
 
     ddjvu_status_t status;
     ddjvu_pageinfo_t info;
     while ((status = ddjvu_document_get_pageinfo(doc, pageNo-1, &info)) < DDJVU_JOB_OK)
-        gDjVuContext.SpinMessageLoop();
+        gDjVuContext.WaitForProgress(progressEvent);
     float dpiFactor = 1.0;
     if (DDJVU_JOB_OK == status)
         dpiFactor = GetFileDPI() / info.dpi;
@@ -13,7 +13,11 @@
 #include "PsEngine.h"
 
 #include "EbookDoc.h"
+#include "FileUtil.h"
+using namespace Gdiplus;
+#include "GdiPlusUtil.h"
 #include "MobiDoc.h"
+#include "Trace.h"
 
 Doc::Doc(const Doc& other)
 {
@@ -319,15 +323,81 @@ bool IsSupportedFile(const WCHAR *filePath, bool sniff, bool enableEbookEngines)
            );
 }
 
+#define SNIFF_HEADER_SIZE 4096
+
+// determines the engine type from a file's first few KB for all formats which
+// can be recognized unambiguously by their magic numbers (i.e. not for ZIP
+// based formats and not for weak signatures such as BMP's "BM") and which
+// would also be recognized by the engines' own sniffing
+static DocType SniffEngineType(const WCHAR *filePath, bool useAlternateChmEngine, bool enableEbookEngines)
+{
+    ScopedMem<char> header(AllocArray<char>(SNIFF_HEADER_SIZE + 1));
+    // (files shorter than SNIFF_HEADER_SIZE are zero-padded)
+    if (!header || !file::ReadAll(filePath, header, SNIFF_HEADER_SIZE) && !*header)
+        return Engine_None;
+
+    // cf. PdfEngine::IsSupportedFile
+    for (int i = 0; i < 1024 - 4; i++) {
+        if (str::EqN(header + i, "%PDF", 4))
+            return Engine_PDF;
+    }
+    if (str::StartsWith(header.Get(), "AT&T"))
+        return Engine_DjVu;
+    const WCHAR *imgExt = GfxFileExtFromData(header, SNIFF_HEADER_SIZE);
+    if (str::Eq(imgExt, L".png") || str::Eq(imgExt, L".jpg") || str::Eq(imgExt, L".gif") ||
+        str::Eq(imgExt, L".tif") || str::Eq(imgExt, L".jxr") || str::Eq(imgExt, L".webp")) {
+        return Engine_Image;
+    }
+    if (memeq(header, "Rar!\x1A\x07\x00", 7))
+        return Engine_ComicBook;
+    if (str::StartsWith(header.Get(), "%!PS-Adobe-") && PsEngine::IsAvailable())
+        return Engine_PS;
+    if (str::StartsWith(header.Get(), "ITSF"))
+        return useAlternateChmEngine ? Engine_Chm2 : Engine_Chm;
+    if (!enableEbookEngines)
+        return Engine_None;
+    // PalmDB type and creator (cf. PdbReader)
+    const char *typeCreator = header + 60;
+    if (memeq(typeCreator, "BOOKMOBI", 8))
+        return Engine_Mobi;
+    if (memeq(typeCreator, "TEXtREAd", 8) || memeq(typeCreator, "TEXtTlDc", 8))
+        return Engine_Pdb;
+    return Engine_None;
+}
+
+static BaseEngine *CreateEngineOfType(DocType engineType, const WCHAR *filePath, PasswordUI *pwdUI)
+{
+    switch (engineType) {
+    case Engine_PDF:        return PdfEngine::CreateFromFile(filePath, pwdUI);
+    case Engine_DjVu:       return DjVuEngine::CreateFromFile(filePath);
+    case Engine_Image:      return ImageEngine::CreateFromFile(filePath);
+    case Engine_ComicBook:  return CbxEngine::CreateFromFile(filePath);
+    case Engine_PS:         return PsEngine::CreateFromFile(filePath);
+    case Engine_Chm:        return ChmEngine::CreateFromFile(filePath);
+    case Engine_Chm2:       return Chm2Engine::CreateFromFile(filePath);
+    case Engine_Mobi:       return MobiEngine::CreateFromFile(filePath);
+    case Engine_Pdb:        return PdbEngine::CreateFromFile(filePath);
+    default:                return NULL;
+    }
+}
+
 BaseEngine *CreateEngine(const WCHAR *filePath, PasswordUI *pwdUI, DocType *typeOut, bool useAlternateChmEngine, bool enableEbookEngines)
 {
     CrashIf(!filePath);
-
-    BaseEngine *engine = NULL;
-    DocType engineType = Engine_None;
-    bool sniff = false;
+    TRACE_SCOPE("CreateEngine");
+
+    // a file's content is more reliable than its extension, so for formats
+    // with a distinct signature read that once and try the matching engine
+    // right away (instead of possibly failing to load a misnamed file first
+    // and then reading the file again for every engine's sniffing)
+    DocType engineType = SniffEngineType(filePath, useAlternateChmEngine, enableEbookEngines);
+    BaseEngine *engine = CreateEngineOfType(engineType, filePath, pwdUI);
+    // if it fails to load, the sniffed engine type isn't tried again below
+    bool sniff = engine != NULL;
 RetrySniffing:
-    if (PdfEngine::IsSupportedFile(filePath, sniff) && engineType != Engine_PDF) {
+    if (engine) {
+        // the sniffed engine type has loaded successfully
+    } else if (PdfEngine::IsSupportedFile(filePath, sniff) && engineType != Engine_PDF) {
         engine = PdfEngine::CreateFromFile(filePath, pwdUI);
         engineType = Engine_PDF;
     } else if (XpsEngine::IsSupportedFile(filePath, sniff) && engineType != Engine_XPS) {
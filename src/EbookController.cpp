@@ -5,16 +5,22 @@
 #include "EbookController.h"
 
 #include "AppPrefs.h"
+#include "AppTools.h"
 #include "DebugLog.h"
 #include "EbookControls.h"
 #include "MobiDoc.h"
 #include "EbookFormatter.h"
 #include "EbookWindow.h"
+#include "FileUtil.h"
+#include "PdfEngine.h"
+#include "SumatraAbout.h"
+#include "SumatraPDF.h"
 #include "SumatraWindow.h"
 #include "Translations.h"
 #include "ThreadUtil.h"
 #include "Timer.h"
 #include "UITask.h"
+#include "VarintGob.h"
 
 static const WCHAR *GetFontName()
 {
@@ -110,7 +116,101 @@ public:
     }
 };
 
+class EbookPageRenderedTask : public UITask {
+public:
+    HtmlPage *         page;
+    Bitmap *           bmp;
+    EbookController *  controller;
+    int                generation;
+
+    EbookPageRenderedTask(HtmlPage *page, Bitmap *bmp, EbookController *controller, int generation) :
+        page(page), bmp(bmp), controller(controller), generation(generation) { }
+    // HandlePageRendered takes ownership of bmp (if it wants it)
+    ~EbookPageRenderedTask() { ::delete bmp; }
+
+    virtual void Execute() {
+        EbookWindow *win = FindEbookWindowByController(controller);
+        if (win)
+            controller->HandlePageRendered(this);
+    }
+};
+
+class EbookPageRenderThread : public ThreadBase {
+    PageControl *       control;
+    Vec<HtmlPage *>     pages;
+    Size                size;
+    EbookController *   controller;
+    int                 generation;
+
+public:
+    EbookPageRenderThread(PageControl *control, Vec<HtmlPage *>& pages, Size size,
+                          EbookController *ctrl, int generation) :
+        ThreadBase("EbookPageRenderThread"), control(control), pages(pages), size(size),
+        controller(ctrl), generation(generation) { }
+
+    virtual void Run() {
+        for (size_t i = 0; i < pages.Count() && !WasCancelRequested(); i++) {
+            Bitmap *bmp = control->RenderPage(pages.At(i), size);
+            if (bmp)
+                uitask::Post(new EbookPageRenderedTask(pages.At(i), bmp, controller, generation));
+        }
+    }
+};
+
+// when laying out a book from the beginning, it's split at chapter boundaries
+// into chunks of at least this much html, which are laid out concurrently
+#define MIN_LAYOUT_CHUNK_SIZE   (128 * 1024)
+#define MAX_LAYOUT_THREADS      4
+
+// allows the formatters of all chunks to use the same (not thread-safe) allocator
+class SharedAllocator : public Allocator {
+    Allocator *         allocator;
+    CRITICAL_SECTION    cs;
+
+public:
+    explicit SharedAllocator(Allocator *allocator) : allocator(allocator) {
+        InitializeCriticalSection(&cs);
+    }
+    virtual ~SharedAllocator() { DeleteCriticalSection(&cs); }
+
+    virtual void *Alloc(size_t size) {
+        ScopedCritSec scope(&cs);
+        return Allocator::Alloc(allocator, size);
+    }
+    virtual void *Realloc(void *mem, size_t size) {
+        ScopedCritSec scope(&cs);
+        return Allocator::Realloc(allocator, mem, size);
+    }
+    virtual void Free(void *mem) {
+        ScopedCritSec scope(&cs);
+        Allocator::Free(allocator, mem);
+    }
+};
+
+struct EbookLayoutChunk {
+    // range of html to lay out
+    int                 start, end;
+    // NULL if layout has been cancelled
+    Vec<HtmlPage *> *   pages;
+    // signaled once pages have been set
+    HANDLE              done;
+};
+
+class EbookFormattingThread;
+
+class EbookChunkFormattingThread : public ThreadBase {
+    EbookFormattingThread * owner;
+
+public:
+    explicit EbookChunkFormattingThread(EbookFormattingThread *owner) :
+        ThreadBase("EbookChunkFormattingThread"), owner(owner) { }
+
+    virtual void Run();
+};
+
 class EbookFormattingThread : public ThreadBase {
+    friend class EbookChunkFormattingThread;
+
     // provided by the caller
     Doc                 doc; // we own it
     HtmlFormatterArgs * formatterArgs; // we own it
@@ -121,6 +221,21 @@ class EbookFormattingThread : public ThreadBase {
     HtmlPage *  pages[EbookFormattingTask::MAX_PAGES];
     int         pageCount;
 
+    // state used for laying out chunks in parallel (chunks.At(0)
+    // is laid out by this thread, all others by chunkThreads)
+    SharedAllocator *                   sharedAllocator;
+    Vec<EbookLayoutChunk>               chunks;
+    LONG                                nextChunk;
+    Vec<EbookChunkFormattingThread *>   chunkThreads;
+    // position of the next page to send
+    size_t                              currChunk, currChunkPage;
+
+    void        StartChunkThreads();
+    void        StopChunkThreads();
+    Vec<HtmlPage *> *FormatChunk(EbookLayoutChunk& chunk);
+    void        FormatChunks();
+    HtmlPage *  NextPage(HtmlFormatter *formatter);
+
 public:
     void        SendPagesIfNecessary(bool force, bool finished, bool fromBeginning);
     bool        Format(int reparseIdx);
@@ -133,7 +248,8 @@ public:
 };
 
 EbookFormattingThread::EbookFormattingThread(Doc doc, HtmlFormatterArgs *args, EbookController *ctrl, int reparseIdx) :
-    doc(doc), formatterArgs(args), controller(ctrl), reparseIdx(reparseIdx), pageCount(0)
+    doc(doc), formatterArgs(args), controller(ctrl), reparseIdx(reparseIdx), pageCount(0),
+    sharedAllocator(NULL), nextChunk(0), currChunk(0), currChunkPage(0)
 {
     AssertCrash(doc.IsEbook() || (doc.IsNone() && (NULL != args->htmlStr)));
 }
@@ -141,9 +257,126 @@ EbookFormattingThread::EbookFormattingThread(Doc doc, HtmlFormatterArgs *args, E
 EbookFormattingThread::~EbookFormattingThread()
 {
     //lf("ThreadLayoutEbook::~ThreadLayoutEbook()");
+    StopChunkThreads();
     delete formatterArgs;
 }
 
+// EPUB chapters and Mobi page breaks always start a new page, so that
+// laying out the book in chunks results in the same pages as laying it out at once
+static const char *FindNextChapter(Doc doc, const char *html)
+{
+    if (doc.AsEpub())
+        return str::Find(html, "<pagebreak page_path=");
+    if (doc.AsMobi())
+        return str::Find(html, "<mbp:pagebreak");
+    return NULL;
+}
+
+void EbookFormattingThread::StartChunkThreads()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    // this thread lays out the first chunk itself
+    int threadCount = limitValue((int)si.dwNumberOfProcessors - 1, 0, MAX_LAYOUT_THREADS);
+    if (0 == threadCount || !doc.IsEbook())
+        return;
+
+    const char *html = formatterArgs->htmlStr;
+    int htmlLen = (int)formatterArgs->htmlStrLen;
+    int chunkSize = max(htmlLen / (4 * (threadCount + 1)), MIN_LAYOUT_CHUNK_SIZE);
+    EbookLayoutChunk chunk = { 0 };
+    while (chunk.start < htmlLen) {
+        const char *next = NULL;
+        if (chunk.start + chunkSize < htmlLen)
+            next = FindNextChapter(doc, html + chunk.start + chunkSize);
+        chunk.end = next ? (int)(next - html) : htmlLen;
+        chunks.Append(chunk);
+        chunk.start = chunk.end;
+    }
+    if (chunks.Count() < 2) {
+        chunks.Reset();
+        return;
+    }
+
+    sharedAllocator = new SharedAllocator(formatterArgs->textAllocator);
+    for (size_t i = 0; i < chunks.Count(); i++) {
+        chunks.At(i).done = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+    nextChunk = 0;
+    for (int i = 0; i < threadCount && i < (int)chunks.Count() - 1; i++) {
+        EbookChunkFormattingThread *thread = new EbookChunkFormattingThread(this);
+        chunkThreads.Append(thread);
+        thread->Start();
+    }
+}
+
+void EbookFormattingThread::StopChunkThreads()
+{
+    // chunkThreads check WasCancelRequested() for this thread
+    for (size_t i = 0; i < chunkThreads.Count(); i++) {
+        chunkThreads.At(i)->Join();
+        delete chunkThreads.At(i);
+    }
+    chunkThreads.Reset();
+    for (size_t i = 0; i < chunks.Count(); i++) {
+        if (chunks.At(i).pages) {
+            DeleteVecMembers(*chunks.At(i).pages);
+            delete chunks.At(i).pages;
+        }
+        CloseHandle(chunks.At(i).done);
+    }
+    chunks.Reset();
+    delete sharedAllocator;
+    sharedAllocator = NULL;
+}
+
+// called by the chunkThreads
+void EbookFormattingThread::FormatChunks()
+{
+    for (;;) {
+        LONG idx = InterlockedIncrement(&nextChunk);
+        if (idx >= (LONG)chunks.Count())
+            return;
+        EbookLayoutChunk& chunk = chunks.At(idx);
+        chunk.pages = FormatChunk(chunk);
+        SetEvent(chunk.done);
+    }
+}
+
+void EbookChunkFormattingThread::Run()
+{
+    owner->FormatChunks();
+}
+
+// returns NULL if layout has been cancelled
+Vec<HtmlPage *> *EbookFormattingThread::FormatChunk(EbookLayoutChunk& chunk)
+{
+    HtmlFormatterArgs args;
+    args.pageDx = formatterArgs->pageDx;
+    args.pageDy = formatterArgs->pageDy;
+    args.SetFontName(formatterArgs->GetFontName());
+    args.fontSize = formatterArgs->fontSize;
+    args.textAllocator = sharedAllocator;
+    args.measureAlgo = formatterArgs->measureAlgo;
+    args.htmlStr = formatterArgs->htmlStr;
+    args.htmlStrLen = chunk.end;
+    args.reparseIdx = chunk.start;
+
+    Vec<HtmlPage *> *chunkPages = new Vec<HtmlPage *>();
+    HtmlFormatter *formatter = CreateFormatter(doc, &args);
+    for (HtmlPage *pd = formatter->Next(); pd; pd = formatter->Next()) {
+        chunkPages->Append(pd);
+        if (WasCancelRequested()) {
+            DeleteVecMembers(*chunkPages);
+            delete chunkPages;
+            chunkPages = NULL;
+            break;
+        }
+    }
+    delete formatter;
+    return chunkPages;
+}
+
 // send accumulated pages if we filled the buffer or the caller forces us
 void EbookFormattingThread::SendPagesIfNecessary(bool force, bool finished, bool fromBeginning)
 {
@@ -159,6 +392,36 @@ void EbookFormattingThread::SendPagesIfNecessary(bool force, bool finished, bool
     uitask::Post(msg);
 }
 
+// layout pages from a given reparse point (beginning if NULL)
+// returns true if layout thread was cancelled
+// returns the next page either from formatter or (once it's done with
+// the first chunk) from the chunks laid out by chunkThreads
+HtmlPage *EbookFormattingThread::NextPage(HtmlFormatter *formatter)
+{
+    if (0 == currChunk) {
+        HtmlPage *pd = formatter->Next();
+        if (pd || chunks.Count() == 0)
+            return pd;
+        currChunk = 1;
+        currChunkPage = 0;
+    }
+    while (currChunk < chunks.Count()) {
+        EbookLayoutChunk& chunk = chunks.At(currChunk);
+        WaitForSingleObject(chunk.done, INFINITE);
+        // chunk.pages is NULL if this thread has been cancelled
+        if (!chunk.pages)
+            return NULL;
+        if (currChunkPage < chunk.pages->Count()) {
+            HtmlPage *pd = chunk.pages->At(currChunkPage);
+            chunk.pages->At(currChunkPage++) = NULL;
+            return pd;
+        }
+        currChunk++;
+        currChunkPage = 0;
+    }
+    return NULL;
+}
+
 // layout pages from a given reparse point (beginning if NULL)
 // returns true if layout thread was cancelled
 bool EbookFormattingThread::Format(int reparseIdx)
@@ -166,23 +429,24 @@ bool EbookFormattingThread::Format(int reparseIdx)
     bool fromBeginning = (0 == reparseIdx);
     //lf("Started laying out mobi, fromBeginning=%d", (int)fromBeginning);
     int totalPageCount = 0;
+    size_t htmlStrLen = formatterArgs->htmlStrLen;
+    Allocator *textAllocator = formatterArgs->textAllocator;
+    if (fromBeginning)
+        StartChunkThreads();
+    if (chunks.Count() > 0) {
+        formatterArgs->htmlStrLen = chunks.At(0).end;
+        formatterArgs->textAllocator = sharedAllocator;
+    }
+    currChunk = currChunkPage = 0;
     formatterArgs->reparseIdx = reparseIdx;
     HtmlFormatter *formatter = CreateFormatter(doc, formatterArgs);
     int lastReparseIdx = reparseIdx;
-    for (HtmlPage *pd = formatter->Next(); pd; pd = formatter->Next()) {
+    for (HtmlPage *pd = NextPage(formatter); pd; pd = NextPage(formatter)) {
         CrashIf(pd->reparseIdx < lastReparseIdx);
         lastReparseIdx = pd->reparseIdx;
         if (WasCancelRequested()) {
-            lf("layout cancelled");
-            for (int i = 0; i < pageCount; i++) {
-                delete pages[i];
-            }
-            pageCount = 0;
             delete pd;
-            // send a 'finished' message so that the thread object gets deleted
-            SendPagesIfNecessary(true, true, fromBeginning);
-            delete formatter;
-            return true;
+            break;
         }
         pages[pageCount++] = pd;
         ++totalPageCount;
@@ -191,10 +455,24 @@ bool EbookFormattingThread::Format(int reparseIdx)
         SendPagesIfNecessary(totalPageCount < 5, false, fromBeginning);
         CrashIf(pageCount >= dimof(pages));
     }
+    delete formatter;
+    StopChunkThreads();
+    formatterArgs->htmlStrLen = htmlStrLen;
+    formatterArgs->textAllocator = textAllocator;
+
+    if (WasCancelRequested()) {
+        lf("layout cancelled");
+        for (int i = 0; i < pageCount; i++) {
+            delete pages[i];
+        }
+        pageCount = 0;
+        // send a 'finished' message so that the thread object gets deleted
+        SendPagesIfNecessary(true, true, fromBeginning);
+        return true;
+    }
     // this is the last message only if we're laying out from the beginning
     bool finished = fromBeginning;
     SendPagesIfNecessary(true, finished, fromBeginning);
-    delete formatter;
     return false;
 }
 
@@ -213,7 +491,7 @@ EbookController::EbookController(EbookControls *ctrls) : ctrls(ctrls),
     fileBeingLoaded(NULL), pagesFromBeginning(NULL), pagesFromPage(NULL),
     currPageNo(0), pageShown(NULL), deletePageShown(false),
     pageSize(0, 0), formattingThread(NULL), formattingThreadNo(-1),
-    startReparseIdx(-1)
+    startReparseIdx(-1), renderThread(NULL), renderGeneration(0)
 {
     EventMgr *em = ctrls->mainWnd->evtMgr;
     em->EventsForName("next")->Clicked.connect(this, &EbookController::ClickedNext);
@@ -241,11 +519,24 @@ EbookController::~EbookController()
 
 void EbookController::DeletePageShown()
 {
-    if (deletePageShown)
+    if (deletePageShown) {
+        DiscardRenderedPages();
         delete pageShown;
+        FreeOldTextAllocators();
+    }
     pageShown = NULL;
 }
 
+// all pages of previous layout passes have been deleted
+// by the time the last page we've kept from them is
+void EbookController::FreeOldTextAllocators()
+{
+    while (textAllocators.Count() > 1) {
+        delete textAllocators.At(0);
+        textAllocators.RemoveAt(0);
+    }
+}
+
 // stop layout thread (if we're closing a document we'll delete
 // the ebook data, so we can't have the thread keep using it)
 void EbookController::StopFormattingThread()
@@ -258,20 +549,256 @@ void EbookController::StopFormattingThread()
     delete formattingThread;
     formattingThread = NULL;
     formattingThreadNo = -1;
+    if (formattingTemp.pagesFromBeginning.Count() > 0 || formattingTemp.pagesFromPage.Count() > 0)
+        DiscardRenderedPages();
     formattingTemp.DeletePages();
 }
 
+Bitmap *EbookController::GetRenderedPage(HtmlPage *pd)
+{
+    for (size_t i = 0; i < renderedPages.Count(); i++) {
+        if (renderedPages.At(i).page == pd)
+            return renderedPages.At(i).bmp;
+    }
+    return NULL;
+}
+
+void EbookController::StopRenderThread()
+{
+    if (!renderThread)
+        return;
+    renderThread->RequestCancel();
+    bool ok = renderThread->Join();
+    CrashIf(!ok);
+    delete renderThread;
+    renderThread = NULL;
+}
+
+// stops rendering and drops all rendered pages (which might be about to be deleted)
+void EbookController::DiscardRenderedPages()
+{
+    StopRenderThread();
+    renderGeneration++;
+    if (0 == renderedPages.Count())
+        return;
+    ctrls->pagesLayout->GetPage1()->SetPage(ctrls->pagesLayout->GetPage1()->GetPage());
+    for (size_t i = 0; i < renderedPages.Count(); i++) {
+        ::delete renderedPages.At(i).bmp;
+    }
+    renderedPages.Reset();
+}
+
+// renders pageShown and the pages around it that haven't been rendered yet
+void EbookController::PrerenderPages()
+{
+    Vec<HtmlPage *> wanted;
+    if (pageShown)
+        wanted.Append(pageShown);
+    Vec<HtmlPage *> *pagesList[] = { pagesFromPage, &formattingTemp.pagesFromPage, GetPagesFromBeginning() };
+    for (size_t i = 0; i < dimof(pagesList) && wanted.Count() == 1; i++) {
+        Vec<HtmlPage *> *pages = pagesList[i];
+        int idx = pages ? pages->Find(pageShown) : -1;
+        if (-1 == idx)
+            continue;
+        // the next page is more likely needed than the previous one
+        if ((size_t)idx + 1 < pages->Count())
+            wanted.Append(pages->At(idx + 1));
+        if (idx > 0)
+            wanted.Append(pages->At(idx - 1));
+    }
+
+    for (size_t i = renderedPages.Count(); i > 0; i--) {
+        if (!wanted.Contains(renderedPages.At(i - 1).page)) {
+            ::delete renderedPages.At(i - 1).bmp;
+            renderedPages.RemoveAt(i - 1);
+        }
+    }
+    Vec<HtmlPage *> toRender;
+    for (size_t i = 0; i < wanted.Count(); i++) {
+        if (!GetRenderedPage(wanted.At(i)))
+            toRender.Append(wanted.At(i));
+    }
+
+    // pages already rendered by a previous thread are still accepted
+    StopRenderThread();
+    if (0 == toRender.Count())
+        return;
+    PageControl *page1 = ctrls->pagesLayout->GetPage1();
+    renderThread = new EbookPageRenderThread(page1, toRender, page1->GetDrawableSize(), this, renderGeneration);
+    renderThread->Start();
+}
+
+void EbookController::HandlePageRendered(EbookPageRenderedTask *rendered)
+{
+    // the page might have been deleted since (and its address reused)
+    if (rendered->generation != renderGeneration)
+        return;
+    if (GetRenderedPage(rendered->page))
+        return;
+    RenderedPage rp = { rendered->page, rendered->bmp };
+    renderedPages.Append(rp);
+    rendered->bmp = NULL;
+    if (rendered->page == pageShown)
+        ctrls->pagesLayout->GetPage1()->SetPage(pageShown, rp.bmp);
+}
+
 void EbookController::CloseCurrentDocument()
 {
     ctrls->pagesLayout->GetPage1()->SetPage(NULL);
     ctrls->pagesLayout->GetPage2()->SetPage(NULL);
+    DiscardRenderedPages();
     StopFormattingThread();
     DeletePageShown();
     DeletePages(&pagesFromBeginning);
     DeletePages(&pagesFromPage);
+    DeleteVecMembers(textAllocators);
     doc.Delete();
     formattingTemp.reparseIdx = 0; // mark as being laid out from the beginning
     pageSize = SizeI(0, 0);
+    docDigest.Set(NULL);
+    cachedPageStarts.Reset();
+}
+
+// don't keep the layouts of more than that many documents/sizes cached on disk
+#define MAX_LAYOUT_CACHE_FILES 64
+#define LAYOUT_CACHE_MAGIC 0x4C59454D /* 'MEYL' */
+#define LAYOUT_CACHE_VERSION 2
+
+// a layout cache file is a GobEncoder record containing the number of pages
+// and the reparse points of all pages (each relative to the previous one);
+// everything a layout depends on (the html data, the page size and the font)
+// is part of the file name
+WCHAR *EbookController::GetLayoutCachePath()
+{
+    if (!gGlobalPrefs->rememberOpenedFiles || !HasPermission(Perm_SavePreferences | Perm_DiskAccess))
+        return NULL;
+
+    if (!docDigest) {
+        size_t len;
+        const char *html = doc.GetHtmlData(len);
+        if (!html)
+            return NULL;
+        unsigned char digest[16];
+        CalcMD5Digest((const unsigned char *)html, len, digest);
+        docDigest.Set(str::MemToHex(digest, 16));
+    }
+    ScopedMem<WCHAR> key(str::Format(L"%S %dx%d %s %.2f", docDigest.Get(), pageSize.dx, pageSize.dy,
+                                     GetFontName(), GetFontSize()));
+    ScopedMem<char> keyU(str::conv::ToUtf8(key));
+    unsigned char digest[16];
+    CalcMD5Digest((unsigned char *)keyU.Get(), str::Len(keyU), digest);
+    ScopedMem<char> fingerPrint(str::MemToHex(digest, 16));
+
+    ScopedMem<WCHAR> cachePath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+    if (!cachePath)
+        return NULL;
+    ScopedMem<WCHAR> fname(str::conv::FromAnsi(fingerPrint));
+    return str::Format(L"%s\\%s.layout", cachePath, fname);
+}
+
+void EbookController::LoadLayoutCache()
+{
+    cachedPageStarts.Reset();
+    ScopedMem<WCHAR> path(GetLayoutCachePath());
+    if (!path || !file::Exists(path))
+        return;
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(path, &len));
+    GobDecoder dec(data, len, LAYOUT_CACHE_MAGIC, LAYOUT_CACHE_VERSION);
+    uint64_t count = dec.UInt();
+    uint64_t htmlSize = doc.GetHtmlDataSize();
+    uint64_t reparseIdx = 0;
+    for (uint64_t i = 0; i < count && dec.IsOk(); i++) {
+        reparseIdx += dec.UInt();
+        if (reparseIdx > htmlSize)
+            break;
+        cachedPageStarts.Append((int)reparseIdx);
+    }
+    if (!dec.IsOk() || !dec.AtEnd() || cachedPageStarts.Count() != count)
+        cachedPageStarts.Reset();
+}
+
+// removes the least recently written layouts
+static void CleanUpLayoutCache()
+{
+    ScopedMem<WCHAR> cachePath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+    if (!cachePath)
+        return;
+    ScopedMem<WCHAR> pattern(path::Join(cachePath, L"*.layout"));
+
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind)
+        return;
+    Vec<WIN32_FIND_DATA> files;
+    do {
+        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            files.Append(fdata);
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    while (files.Count() > MAX_LAYOUT_CACHE_FILES) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < files.Count(); i++) {
+            if (CompareFileTime(&files.At(i).ftLastWriteTime, &files.At(oldest).ftLastWriteTime) < 0)
+                oldest = i;
+        }
+        ScopedMem<WCHAR> filePath(path::Join(cachePath, files.At(oldest).cFileName));
+        file::Delete(filePath);
+        files.RemoveAt(oldest);
+    }
+}
+
+// only rewrites the cache if the pages differ from the cached ones
+void EbookController::SaveLayoutCache(Vec<HtmlPage*> *pages)
+{
+    bool changed = pages->Count() != cachedPageStarts.Count();
+    GobEncoder enc(LAYOUT_CACHE_MAGIC, LAYOUT_CACHE_VERSION);
+    enc.UInt(pages->Count());
+    int prevIdx = 0;
+    for (size_t i = 0; i < pages->Count(); i++) {
+        int reparseIdx = pages->At(i)->reparseIdx;
+        changed = changed || reparseIdx != cachedPageStarts.At(i);
+        // reparse points only increase, so the deltas are small and non-negative
+        enc.UInt(max(reparseIdx - prevIdx, 0));
+        prevIdx = max(reparseIdx, prevIdx);
+    }
+    cachedPageStarts.Reset();
+    if (!changed || pages->Count() == 0)
+        return;
+
+    ScopedMem<WCHAR> path(GetLayoutCachePath());
+    if (!path)
+        return;
+    ScopedMem<WCHAR> cachePath(path::GetDir(path));
+    if (!dir::Create(cachePath))
+        return;
+    size_t len;
+    ScopedMem<char> data(enc.Finish(&len));
+    if (file::WriteAll(path, data, len))
+        CleanUpLayoutCache();
+}
+
+// lays out the page which contained startReparseIdx in the cached layout
+// so that it can be shown right away (the page belongs to the caller)
+HtmlPage *EbookController::FormatCachedStartPage(HtmlFormatterArgs *args)
+{
+    size_t pageNo = cachedPageStarts.Count();
+    while (pageNo > 0 && cachedPageStarts.At(pageNo - 1) > startReparseIdx) {
+        pageNo--;
+    }
+    if (0 == pageNo)
+        return NULL;
+    args->reparseIdx = cachedPageStarts.At(pageNo - 1);
+    HtmlFormatter *formatter = CreateFormatter(doc, args);
+    HtmlPage *pd = formatter->Next();
+    delete formatter;
+    args->reparseIdx = 0;
+    if (pd && pd->reparseIdx != cachedPageStarts.At(pageNo - 1)) {
+        delete pd;
+        return NULL;
+    }
+    return pd;
 }
 
 void EbookController::DeletePages(Vec<HtmlPage*>** pages)
@@ -285,6 +812,7 @@ void EbookController::DeletePages(Vec<HtmlPage*>** pages)
     if (!*pages)
         return;
 
+    DiscardRenderedPages();
     DeleteVecMembers(**pages);
     delete *pages;
     *pages = NULL;
@@ -344,6 +872,13 @@ void EbookController::UpdateCurrPageNoForPage(HtmlPage *pd)
         }
     }
     currPageNo = PageForReparsePoint(GetPagesFromBeginning(), pd->reparseIdx);
+    if (0 == currPageNo && FormattingInProgress()) {
+        // fall back to the page number from the cached layout
+        for (size_t i = cachedPageStarts.Count(); i > 0 && 0 == currPageNo; i--) {
+            if (cachedPageStarts.At(i - 1) <= pd->reparseIdx)
+                currPageNo = (int)i;
+        }
+    }
 }
 
 void EbookController::ShowPage(HtmlPage *pd, bool deleteWhenDone)
@@ -351,10 +886,11 @@ void EbookController::ShowPage(HtmlPage *pd, bool deleteWhenDone)
     DeletePageShown();
     pageShown = pd;
     deletePageShown = deleteWhenDone;
-    ctrls->pagesLayout->GetPage1()->SetPage(pageShown);
+    ctrls->pagesLayout->GetPage1()->SetPage(pageShown, GetRenderedPage(pageShown));
 
     UpdateCurrPageNoForPage(pageShown);
     UpdateStatus();
+    PrerenderPages();
 #if 0
     if (pd) {
         char s[64] = { 0 };
@@ -444,6 +980,7 @@ void EbookController::HandleMobiLayoutDone(EbookFormattingTask *ld)
         CrashIf(pagesFromBeginning || pagesFromPage);
         pagesFromBeginning = new Vec<HtmlPage *>(formattingTemp.pagesFromBeginning);
         formattingTemp.pagesFromBeginning.Reset();
+        SaveLayoutCache(pagesFromBeginning);
 
         size_t pageCount = formattingTemp.pagesFromPage.Count();
         if (pageCount > 0) {
@@ -463,9 +1000,10 @@ HtmlPage *EbookController::PreserveTempPageShown()
     if (!pageShown)
         return NULL;
     if (deletePageShown) {
-        // TODO: this can happen due to a race condition
+        // this is expected for a page laid out from the cached layout
+        // TODO: otherwise this can happen due to a race condition
         //       (if there are too many WM_PAINT messages?)
-        CrashIf(true); // not sure if this should ever happen
+        CrashIf(0 == cachedPageStarts.Count()); // not sure if this should ever happen
         deletePageShown = false;
         return pageShown;
     }
@@ -523,8 +1061,19 @@ void EbookController::TriggerBookFormatting()
     CrashIf(formattingTemp.reparseIdx < 0);
     CrashIf(formattingTemp.reparseIdx > (int)doc.GetHtmlDataSize());
 
+    LoadLayoutCache();
+    // if we're not showing a page from a previous layout pass, none of
+    // them is in use anymore
+    if (!newPage)
+        DeleteVecMembers(textAllocators);
+    textAllocators.Append(new PoolAllocator());
+    HtmlFormatterArgs *args = CreateFormatterArgsDoc2(doc, size.dx, size.dy, textAllocators.Last());
+    if (!newPage && -1 != startReparseIdx && cachedPageStarts.Count() > 0) {
+        // show the page from the previous session without waiting
+        // for the layout to reach it
+        newPage = FormatCachedStartPage(args);
+    }
     ShowPage(newPage, newPage != NULL);
-    HtmlFormatterArgs *args = CreateFormatterArgsDoc2(doc, size.dx, size.dy, &textAllocator);
     formattingThread = new EbookFormattingThread(doc, args, this, formattingTemp.reparseIdx);
     formattingThreadNo = formattingThread->GetNo();
     formattingThread->Start();
@@ -587,6 +1136,8 @@ size_t EbookController::GetMaxPageCount()
         n = pages1->Count();
     if (pages2 && pages2->Count() > n)
         n = pages2->Count();
+    if (FormattingInProgress() && cachedPageStarts.Count() > n)
+        n = cachedPageStarts.Count();
     return n;
 }
 
@@ -603,7 +1154,7 @@ void EbookController::UpdateStatus()
         return;
     }
 
-    if (FormattingInProgress()) {
+    if (FormattingInProgress() && 0 == cachedPageStarts.Count()) {
         ScopedMem<WCHAR> s(str::Format(_TR("Formatting the book... %d pages"), pageCount));
         ctrls->status->SetText(s);
         ctrls->progress->SetFilled(0.f);
@@ -612,7 +1163,9 @@ void EbookController::UpdateStatus()
 
     ScopedMem<WCHAR> s(str::Format(L"%s %d / %d", _TR("Page:"), currPageNo, pageCount));
     ctrls->status->SetText(s);
-    if (GetPagesFromBeginning())
+    if (FormattingInProgress())
+        ctrls->progress->SetFilled(PercFromInt((int)pageCount, currPageNo));
+    else if (GetPagesFromBeginning())
         ctrls->progress->SetFilled(PercFromInt((int)GetPagesFromBeginning()->Count(), currPageNo));
     else
         ctrls->progress->SetFilled(0.f);
@@ -12,6 +12,8 @@ struct  EbookControls;
 class   HtmlPage;
 class   EbookFormattingThread;
 class   EbookFormattingTask;
+class   EbookPageRenderThread;
+class   EbookPageRenderedTask;
 class   HtmlFormatterArgs;
 namespace mui { class Control; }
 using namespace mui;
@@ -39,9 +41,10 @@ class EbookController : public sigslot::has_slots
     // only set while we load the file on a background thread, used in UpdateStatus()
     WCHAR *         fileBeingLoaded;
 
-    // TODO: this should be recycled along with pages so that its
-    // memory use doesn't grow without bounds
-    PoolAllocator   textAllocator;
+    // text of the pages of each layout pass is allocated from that pass's
+    // allocator (the last one). Older allocators can only still be in use
+    // by pageShown (when it's deleted, they're freed along with it)
+    Vec<PoolAllocator *> textAllocators;
 
     // we're in one of 3 states:
     // 1. showing pages as laid out from the beginning
@@ -78,11 +81,36 @@ class EbookController : public sigslot::has_slots
     // show after loading. -1 indicates no action needed
     int               startReparseIdx;
 
+    // hex digest of the document's html data (cf. GetLayoutCachePath)
+    ScopedMem<char>   docDigest;
+    // reparse points of all pages as laid out from the beginning at pageSize
+    // during a previous session. As long as the current layout hasn't
+    // finished, page numbers and the page count are taken from these
+    Vec<int>          cachedPageStarts;
+
+    struct RenderedPage {
+        HtmlPage *      page;
+        Gdiplus::Bitmap *bmp;
+    };
+    // bitmaps of pageShown and the pages before and after it, rendered
+    // ahead of time on renderThread so that flipping pages only has to
+    // blit them. The thread must be stopped before any page is deleted
+    Vec<RenderedPage> renderedPages;
+    EbookPageRenderThread *renderThread;
+    // incremented whenever renderedPages are discarded, so that bitmaps
+    // of pages which might have been deleted in the meantime are ignored
+    int               renderGeneration;
+
     Vec<HtmlPage*> *GetPagesFromBeginning();
     HtmlPage*   PreserveTempPageShown();
     void        UpdateStatus();
     void        DeletePages(Vec<HtmlPage*>** pages);
     void        DeletePageShown();
+    void        FreeOldTextAllocators();
+    Gdiplus::Bitmap *GetRenderedPage(HtmlPage *pd);
+    void        PrerenderPages();
+    void        StopRenderThread();
+    void        DiscardRenderedPages();
     void        ShowPage(HtmlPage *pd, bool deleteWhenDone);
     void        UpdateCurrPageNoForPage(HtmlPage *pd);
     void        TriggerBookFormatting();
@@ -91,6 +119,10 @@ class EbookController : public sigslot::has_slots
     void        GoOnePageForward();
     void        StopFormattingThread();
     void        CloseCurrentDocument();
+    WCHAR *     GetLayoutCachePath();
+    void        LoadLayoutCache();
+    void        SaveLayoutCache(Vec<HtmlPage*> *pages);
+    HtmlPage *  FormatCachedStartPage(HtmlFormatterArgs *args);
 
     // event handlers
     void        ClickedNext(Control *c, int x, int y);
@@ -104,6 +136,7 @@ public:
 
     void SetDoc(Doc newDoc, int startReparseIdxArg = -1);
     void HandleMobiLayoutDone(EbookFormattingTask *mobiLayout);
+    void HandlePageRendered(EbookPageRenderedTask *rendered);
     void OnLayoutTimer();
     void AdvancePage(int dist);
     int  GetCurrentPageNo() const { return currPageNo; }
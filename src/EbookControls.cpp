@@ -24,14 +24,15 @@ static Rect RectForCircle(int x, int y, int r)
 }
 #endif
 
-PageControl::PageControl() : page(NULL), cursorX(-1), cursorY(-1)
+PageControl::PageControl() : page(NULL), pageBmp(NULL), cursorX(-1), cursorY(-1)
 {
     bit::Set(wantedInputBits, WantsMouseMoveBit);
 }
 
-void PageControl::SetPage(HtmlPage *newPage)
+void PageControl::SetPage(HtmlPage *newPage, Bitmap *newPageBmp)
 {
     page = newPage;
+    pageBmp = newPageBmp;
     RequestRepaint(this);
 }
 
@@ -94,13 +95,55 @@ void PageControl::Paint(Graphics *gfx, int offX, int offY)
     r.Inflate(1,0);
     gfx->SetClip(r, CombineModeReplace);
 
+    // blitting a pre-rendered page is much faster than drawing it
+    // (which DrawHtmlPage mostly does through Graphics::DrawString)
+    if (pageBmp && pageBmp->GetWidth() == (UINT)r.Width && pageBmp->GetHeight() == (UINT)r.Height)
+        gfx->DrawImage(pageBmp, r.X, r.Y, 0, 0, r.Width, r.Height, UnitPixel);
+    else
+        DrawHtmlPage(gfx, page, (REAL)r.X, (REAL)r.Y, IsDebugPaint(), GetTextColor());
+    gfx->SetClip(&origClipRegion, CombineModeReplace);
+}
+
+Color PageControl::GetTextColor()
+{
     Color textColor;
     if (gGlobalPrefs->useSysColors)
         textColor.SetFromCOLORREF(GetSysColor(COLOR_WINDOWTEXT));
     else
         textColor.SetFromCOLORREF(gGlobalPrefs->ebookUI.textColor);
-    DrawHtmlPage(gfx, &page->instructions, (REAL)r.X, (REAL)r.Y, IsDebugPaint(), textColor);
-    gfx->SetClip(&origClipRegion, CombineModeReplace);
+    return textColor;
+}
+
+Bitmap *PageControl::RenderPage(HtmlPage *pageToRender, Size size)
+{
+    if (size.Width <= 0 || size.Height <= 0)
+        return NULL;
+    // Paint allows the page to overlap the padding by 1 pixel on either side
+    Bitmap *bmp = ::new Bitmap(size.Width + 2, size.Height, PixelFormat32bppPARGB);
+    if (!bmp || bmp->GetLastStatus() != Ok) {
+        ::delete bmp;
+        return NULL;
+    }
+
+    Graphics g(bmp);
+    InitGraphicsMode(&g);
+    // the cached brushes can't be shared with the ui thread, so the
+    // background is painted with a brush of its own (at the same
+    // position relative to the page as in Paint)
+    Padding pad = cachedStyle->padding;
+    RectF r((REAL)(1 - pad.left), (REAL)-pad.top, (REAL)(size.Width + pad.left + pad.right),
+            (REAL)(size.Height + pad.top + pad.bottom));
+    ColorData *bgColor = cachedStyle->bgColor;
+    if (ColorGradientLinear == bgColor->type) {
+        ColorDataGradientLinear *d = &bgColor->gradientLinear;
+        LinearGradientBrush br(r, d->startColor, d->endColor, d->mode);
+        g.FillRectangle(&br, r);
+    } else {
+        SolidBrush br(ColorSolid == bgColor->type ? Color(bgColor->solid.color) : Color());
+        g.FillRectangle(&br, r);
+    }
+    DrawHtmlPage(&g, pageToRender, 0.f, 0.f, IsDebugPaint(), GetTextColor());
+    return bmp;
 }
 
 Control *CreatePageControl(TxtNode *structDef)
@@ -35,16 +35,24 @@ class HtmlPage;
 class PageControl : public Control
 {
     HtmlPage *  page;
+    // page as rendered by RenderPage (not owned, can be NULL)
+    Bitmap *    pageBmp;
     int         cursorX, cursorY;
 
+    Color     GetTextColor();
+
 public:
     PageControl();
 
-    void      SetPage(HtmlPage *newPage);
+    void      SetPage(HtmlPage *newPage, Bitmap *newPageBmp=NULL);
     HtmlPage* GetPage() const { return page; }
 
     Size GetDrawableSize();
 
+    // renders a page (including background) the way Paint would draw it
+    // at the given drawable size. Can be called from any thread
+    Bitmap *  RenderPage(HtmlPage *pageToRender, Size size);
+
     virtual void Paint(Graphics *gfx, int offX, int offY);
 
     virtual void NotifyMouseMove(int x, int y);
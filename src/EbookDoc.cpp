@@ -4,6 +4,7 @@
 #include "BaseUtil.h"
 #include "EbookDoc.h"
 
+#include "Dict.h"
 #include "FileUtil.h"
 #include "HtmlPullParser.h"
 #include "MobiDoc.h"
@@ -200,11 +201,17 @@ const char *EPUB_ENC_NS = "http://www.w3.org/2001/04/xmlenc#";
 
 EpubDoc::EpubDoc(const WCHAR *fileName) :
     zip(fileName, Zip_Deflate), fileName(str::Dup(fileName)),
-    isNcxToc(false), isRtlDoc(false) { }
+    spineLoaded(0), isNcxToc(false), isRtlDoc(false)
+{
+    InitializeCriticalSection(&imagesAccess);
+}
 
 EpubDoc::EpubDoc(IStream *stream) :
     zip(stream, Zip_Deflate), fileName(NULL),
-    isNcxToc(false), isRtlDoc(false) { }
+    spineLoaded(0), isNcxToc(false), isRtlDoc(false)
+{
+    InitializeCriticalSection(&imagesAccess);
+}
 
 EpubDoc::~EpubDoc()
 {
@@ -212,6 +219,12 @@ EpubDoc::~EpubDoc()
         free(images.At(i).base.data);
         free(images.At(i).id);
     }
+    for (size_t i = 0; i < unlistedImages.Count(); i++) {
+        free(unlistedImages.At(i)->base.data);
+        free(unlistedImages.At(i)->id);
+    }
+    FreeVecMembers(unlistedImages);
+    DeleteCriticalSection(&imagesAccess);
     for (size_t i = 0; i < props.Count(); i++) {
         free(props.At(i).value);
     }
@@ -235,15 +248,17 @@ bool EpubDoc::Load()
         return false;
 
     // encrypted files will be ignored (TODO: support decryption)
-    WStrList encList;
+    // (manifests and spines can hold many thousands of entries,
+    // so files are looked up through hash tables instead of lists)
+    dict::MapWStrToInt encSet;
     ScopedMem<char> encryption(zip.GetFileDataByName(L"META-INF/encryption.xml"));
     if (encryption) {
         HtmlElement *encRoot = parser.ParseInPlace(encryption);
         HtmlElement *cr = parser.FindElementByNameNS("CipherReference", EPUB_ENC_NS);
         while (cr) {
-            WCHAR *uri = cr->GetAttribute("URI");
+            ScopedMem<WCHAR> uri(cr->GetAttribute("URI"));
             if (uri)
-                encList.Append(uri);
+                encSet.Insert(uri, 0, NULL);
             cr = parser.FindElementByNameNS("CipherReference", EPUB_ENC_NS, cr);
         }
     }
@@ -267,7 +282,9 @@ bool EpubDoc::Load()
     else
         *contentPath = '\0';
 
-    WStrList idList, pathList;
+    dict::MapWStrToInt idToPath;
+    WStrList pathList;
+    int ix;
 
     for (node = node->down; node; node = node->next) {
         ScopedMem<WCHAR> mediatype(node->GetAttribute("media-type"));
@@ -278,7 +295,7 @@ bool EpubDoc::Load()
             if (!imgPath)
                 continue;
             imgPath.Set(str::Join(contentPath, imgPath));
-            if (encList.Contains(imgPath))
+            if (encSet.Get(imgPath, &ix))
                 continue;
             // load the image lazily
             ImageData2 data = { 0 };
@@ -300,12 +317,11 @@ bool EpubDoc::Load()
                 tocPath.Set(str::Join(contentPath, htmlPath));
                 str::UrlDecodeInPlace(tocPath);
             }
-            if (htmlPath && encList.Count() > 0 && encList.Contains(ScopedMem<WCHAR>(str::Join(contentPath, htmlPath))))
+            if (htmlPath && encSet.Count() > 0 && encSet.Get(ScopedMem<WCHAR>(str::Join(contentPath, htmlPath)), &ix))
                 continue;
-            if (htmlPath && htmlId) {
-                idList.Append(htmlId.StealData());
+            // the first item with a given id wins
+            if (htmlPath && htmlId && idToPath.Insert(htmlId, (int)pathList.Count(), NULL))
                 pathList.Append(htmlPath.StealData());
-            }
         }
     }
 
@@ -314,8 +330,8 @@ bool EpubDoc::Load()
         return false;
     // EPUB 2 ToC
     ScopedMem<WCHAR> tocId(node->GetAttribute("toc"));
-    if (tocId && !tocPath && idList.Contains(tocId)) {
-        tocPath.Set(str::Join(contentPath, pathList.At(idList.Find(tocId))));
+    if (tocId && !tocPath && idToPath.Get(tocId, &ix)) {
+        tocPath.Set(str::Join(contentPath, pathList.At(ix)));
         str::UrlDecodeInPlace(tocPath);
         isNcxToc = true;
     }
@@ -327,27 +343,42 @@ bool EpubDoc::Load()
         if (!node->NameIsNS("itemref", EPUB_OPF_NS))
             continue;
         ScopedMem<WCHAR> idref(node->GetAttribute("idref"));
-        if (!idref || !idList.Contains(idref))
+        if (!idref || !idToPath.Get(idref, &ix))
             continue;
 
-        ScopedMem<WCHAR> fullPath(str::Join(contentPath, pathList.At(idList.Find(idref))));
-        ScopedMem<char> utf8_path(str::conv::ToUtf8(fullPath));
-        str::UrlDecodeInPlace(fullPath);
-        ScopedMem<char> html(zip.GetFileDataByName(fullPath));
-        if (!html)
-            continue;
-        html.Set(DecodeTextToUtf8(html, true));
-        if (!html)
-            continue;
-        // insert explicit page-breaks between sections including
-        // an anchor with the file name at the top (for internal links)
-        htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", utf8_path);
-        htmlData.Append(html);
+        spinePaths.Append(str::Join(contentPath, pathList.At(ix)));
     }
 
+    // only the first readable file is loaded right away, all others aren't
+    // decompressed before the document's text is needed (cf. GetTextData)
+    for (; spineLoaded < spinePaths.Count() && 0 == htmlData.Count(); spineLoaded++) {
+        LoadSpineFile(spineLoaded);
+    }
     return htmlData.Count() > 0;
 }
 
+bool EpubDoc::LoadSpineFile(size_t idx)
+{
+    ScopedMem<char> html(GetSpineFileData(idx, NULL));
+    if (!html)
+        return false;
+    ScopedMem<char> utf8_path(str::conv::ToUtf8(spinePaths.At(idx)));
+    // insert explicit page-breaks between sections including
+    // an anchor with the file name at the top (for internal links)
+    htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", utf8_path);
+    htmlData.Append(html);
+    return true;
+}
+
+void EpubDoc::LoadRemainingSpine()
+{
+    // zip is also used by GetImageData
+    ScopedCritSec scope(&imagesAccess);
+    for (; spineLoaded < spinePaths.Count(); spineLoaded++) {
+        LoadSpineFile(spineLoaded);
+    }
+}
+
 void EpubDoc::ParseMetadata(const char *content)
 {
     Metadata metadataMap[] = {
@@ -392,17 +423,48 @@ void EpubDoc::ParseMetadata(const char *content)
 
 const char *EpubDoc::GetTextData(size_t *lenOut)
 {
+    LoadRemainingSpine();
     *lenOut = htmlData.Size();
     return htmlData.Get();
 }
 
 size_t EpubDoc::GetTextDataSize()
 {
+    LoadRemainingSpine();
     return htmlData.Size();
 }
 
+size_t EpubDoc::GetSpineCount() const
+{
+    return spinePaths.Count();
+}
+
+// returns the UTF-8 converted content of a single spine file without
+// appending it to htmlData (so that e.g. CEpubFilter can extract the
+// text one file at a time instead of holding the entire book in memory)
+char *EpubDoc::GetSpineFileData(size_t idx, size_t *lenOut)
+{
+    CrashIf(idx >= spinePaths.Count());
+    ScopedMem<WCHAR> fullPath(str::Dup(spinePaths.At(idx)));
+    str::UrlDecodeInPlace(fullPath);
+    ScopedMem<char> html;
+    {
+        // zip is also used by GetImageData
+        ScopedCritSec scope(&imagesAccess);
+        html.Set(zip.GetFileDataByName(fullPath));
+    }
+    if (!html)
+        return NULL;
+    char *utf8 = DecodeTextToUtf8(html, true);
+    if (utf8 && lenOut)
+        *lenOut = str::Len(utf8);
+    return utf8;
+}
+
 ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
 {
+    ScopedCritSec scope(&imagesAccess);
+
     if (!pagePath) {
         // if we're reparsing, we might not have pagePath, which is needed to
         // build the exact url so try to find a partial match
@@ -420,6 +482,10 @@ ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
                     return &img->base;
             }
         }
+        for (size_t i = 0; i < unlistedImages.Count(); i++) {
+            if (str::EndsWithI(unlistedImages.At(i)->id, id))
+                return &unlistedImages.At(i)->base;
+        }
         return NULL;
     }
 
@@ -438,6 +504,10 @@ ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
     }
 
     // try to also load images which aren't registered in the manifest
+    for (size_t i = 0; i < unlistedImages.Count(); i++) {
+        if (str::Eq(unlistedImages.At(i)->id, url))
+            return &unlistedImages.At(i)->base;
+    }
     ImageData2 data = { 0 };
     ScopedMem<WCHAR> imgPath(str::conv::FromUtf8(url));
     str::UrlDecodeInPlace(imgPath);
@@ -446,8 +516,8 @@ ImageData *EpubDoc::GetImageData(const char *id, const char *pagePath)
         data.base.data = zip.GetFileDataByIdx(data.idx, &data.base.len);
         if (data.base.data) {
             data.id = str::Dup(url);
-            images.Append(data);
-            return &images.Last().base;
+            unlistedImages.Append((ImageData2 *)memdup(&data, sizeof(data)));
+            return &unlistedImages.Last()->base;
         }
     }
 
@@ -647,19 +717,23 @@ EpubDoc *EpubDoc::CreateFromStream(IStream *stream)
 /* ********** FictionBook ********** */
 
 Fb2Doc::Fb2Doc(const WCHAR *fileName) : fileName(str::Dup(fileName)),
-    stream(NULL), isZipped(false), hasToc(false) { }
+    stream(NULL), isZipped(false), hasToc(false) {
+    InitializeCriticalSection(&imagesAccess);
+}
 
 Fb2Doc::Fb2Doc(IStream *stream) : fileName(NULL),
     stream(stream), isZipped(false), hasToc(false) {
     stream->AddRef();
+    InitializeCriticalSection(&imagesAccess);
 }
 
 Fb2Doc::~Fb2Doc()
 {
     for (size_t i = 0; i < images.Count(); i++) {
-        free(images.At(i).base.data);
-        free(images.At(i).id);
+        free(images.At(i).img.base.data);
+        free(images.At(i).img.id);
     }
+    DeleteCriticalSection(&imagesAccess);
     if (stream)
         stream->Release();
 }
@@ -762,13 +836,15 @@ void Fb2Doc::ExtractImage(HtmlPullParser *parser, HtmlToken *tok)
     if (!tok || !tok->IsText())
         return;
 
-    ImageData2 data = { 0 };
-    data.base.data = Base64Decode(tok->s, tok->sLen, &data.base.len);
-    if (!data.base.data)
-        return;
-    data.id = str::Join("#", id);
-    data.idx = images.Count();
-    images.Append(data);
+    // decoding is deferred to GetImageData, as most images are
+    // only needed once the page containing them is laid out
+    Base64Image image = { 0 };
+    image.img.id = str::Join("#", id);
+    image.img.idx = images.Count();
+    image.offset = base64Data.Size();
+    image.len = tok->sLen;
+    base64Data.Append(tok->s, tok->sLen);
+    images.Append(image);
 }
 
 const char *Fb2Doc::GetTextData(size_t *lenOut)
@@ -784,9 +860,18 @@ size_t Fb2Doc::GetTextDataSize()
 
 ImageData *Fb2Doc::GetImageData(const char *id)
 {
+    ScopedCritSec scope(&imagesAccess);
+
     for (size_t i = 0; i < images.Count(); i++) {
-        if (str::Eq(images.At(i).id, id))
-            return &images.At(i).base;
+        Base64Image& image = images.At(i);
+        if (!str::Eq(image.img.id, id))
+            continue;
+        if (!image.img.base.data && image.len > 0) {
+            image.img.base.data = Base64Decode(base64Data.Get() + image.offset, image.len, &image.img.base.len);
+            // don't try to decode invalid data again
+            image.len = 0;
+        }
+        return image.img.base.data ? &image.img.base : NULL;
     }
     return NULL;
 }
@@ -1476,3 +1561,118 @@ TxtDoc *TxtDoc::CreateFromFile(const WCHAR *fileName)
     }
     return doc;
 }
+
+/* ********** Large Plain Text ********** */
+
+// files larger than this are converted and laid out lazily
+#define LARGE_TXT_FILE_SIZE     (16 * 1024 * 1024)
+// the encoding is guessed from that many bytes at the start of the file
+#define ENCODING_SAMPLE_SIZE    (64 * 1024)
+
+LargeTxtDoc::LargeTxtDoc(const WCHAR *fileName) : fileName(str::Dup(fileName)),
+    hMap(NULL), data(NULL), dataSize(0), codePage(CP_UTF8) { }
+
+LargeTxtDoc::~LargeTxtDoc()
+{
+    if (data)
+        UnmapViewOfFile(data);
+    if (hMap)
+        CloseHandle(hMap);
+}
+
+// cf. PdbReader::MapFile
+bool LargeTxtDoc::Load(int linesPerChunk)
+{
+    ScopedHandle hFile(CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (INVALID_HANDLE_VALUE == hFile)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0 || (uint64_t)size.QuadPart > SIZE_MAX)
+        return false;
+    hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap)
+        data = (const char *)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+        return false;
+    dataSize = (size_t)size.QuadPart;
+
+    size_t start = 0;
+    if (dataSize >= 2 && (str::StartsWith(data, UTF16_BOM) || str::StartsWith(data, UTF16BE_BOM))) {
+        // UTF-16 text can't be split at '\n' bytes
+        return false;
+    }
+    if (dataSize >= 3 && str::StartsWith(data, UTF8_BOM)) {
+        start = 3;
+    }
+    else {
+        // guess the encoding from the first few complete lines
+        size_t sampleLen = min(dataSize, (size_t)ENCODING_SAMPLE_SIZE);
+        for (size_t i = sampleLen; i > 0 && sampleLen < dataSize; i--) {
+            if ('\n' == data[i - 1]) {
+                sampleLen = i;
+                break;
+            }
+        }
+        ScopedMem<char> sample(str::DupN(data, sampleLen));
+        if (!IsValidUtf8(sample))
+            codePage = GuessTextCodepage(sample, str::Len(sample), CP_ACP);
+    }
+
+    // a single pass over the data, so that no line has to be kept
+    chunkStarts.Append(start);
+    const char *end = data + dataSize;
+    int lines = 0;
+    for (const char *c = data + start; (c = (const char *)memchr(c, '\n', end - c)) != NULL; ) {
+        c++;
+        if (++lines == linesPerChunk && c < end) {
+            chunkStarts.Append(c - data);
+            lines = 0;
+        }
+    }
+    chunkStarts.Append(dataSize);
+
+    return true;
+}
+
+char *LargeTxtDoc::GetChunkHtml(int idx, size_t *lenOut) const
+{
+    CrashIf(idx < 0 || idx >= ChunkCount());
+    size_t start = chunkStarts.At(idx);
+    ScopedMem<char> text(str::DupN(data + start, chunkStarts.At(idx + 1) - start));
+    if (text && codePage != CP_UTF8)
+        text.Set(str::ToMultiByte(text, codePage, CP_UTF8));
+    if (!text)
+        return NULL;
+
+    str::Str<char> htmlData(str::Len(text) + 16);
+    htmlData.Append("<pre>");
+    for (const char *c = text; *c; c++) {
+        AppendChar(htmlData, *c);
+    }
+    htmlData.Append("</pre>");
+
+    *lenOut = htmlData.Size();
+    return htmlData.StealData();
+}
+
+const WCHAR *LargeTxtDoc::GetFileName() const
+{
+    return fileName;
+}
+
+bool LargeTxtDoc::IsLargeFile(const WCHAR *fileName)
+{
+    return file::GetSize(fileName) > LARGE_TXT_FILE_SIZE;
+}
+
+LargeTxtDoc *LargeTxtDoc::CreateFromFile(const WCHAR *fileName, int linesPerChunk)
+{
+    CrashIf(linesPerChunk < 1);
+    LargeTxtDoc *doc = new LargeTxtDoc(fileName);
+    if (!doc || !doc->Load(linesPerChunk)) {
+        delete doc;
+        return NULL;
+    }
+    return doc;
+}
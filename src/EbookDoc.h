@@ -25,7 +25,15 @@ class EpubDoc {
 
     ZipFile zip;
     str::Str<char> htmlData;
+    // paths of the spine's HTML files (in reading order)
+    WStrVec spinePaths;
+    // spine files up to this one have been appended to htmlData
+    size_t spineLoaded;
     Vec<ImageData2> images;
+    // images not listed in the manifest (allocated individually, as images
+    // is accessed from several threads while the book is being laid out)
+    Vec<ImageData2 *> unlistedImages;
+    CRITICAL_SECTION imagesAccess;
     Vec<Metadata> props;
     ScopedMem<WCHAR> tocPath;
     ScopedMem<WCHAR> fileName;
@@ -33,6 +41,8 @@ class EpubDoc {
     bool isRtlDoc;
 
     bool Load();
+    bool LoadSpineFile(size_t idx);
+    void LoadRemainingSpine();
     void ParseMetadata(const char *content);
     bool ParseNavToc(const char *data, size_t dataLen, const char *pagePath, EbookTocVisitor *visitor);
     bool ParseNcxToc(const char *data, size_t dataLen, const char *pagePath, EbookTocVisitor *visitor);
@@ -44,6 +54,8 @@ public:
 
     const char *GetTextData(size_t *lenOut);
     size_t GetTextDataSize();
+    size_t GetSpineCount() const;
+    char *GetSpineFileData(size_t idx, size_t *lenOut);
     ImageData *GetImageData(const char *id, const char *pagePath);
     char *GetFileData(const char *relPath, const char *pagePath, size_t *lenOut);
 
@@ -69,7 +81,15 @@ class Fb2Doc {
     IStream *stream;
 
     str::Str<char> xmlData;
-    Vec<ImageData2> images;
+    // images are only base64 decoded when they're first requested
+    struct Base64Image {
+        ImageData2 img;
+        // encoded data is at base64Data.Get() + offset and len bytes long
+        size_t offset, len;
+    };
+    Vec<Base64Image> images;
+    str::Str<char> base64Data;
+    CRITICAL_SECTION imagesAccess;
     ScopedMem<WCHAR> docTitle;
     ScopedMem<WCHAR> docAuthor;
     ScopedMem<char> coverImage;
@@ -204,4 +224,34 @@ public:
     static TxtDoc *CreateFromFile(const WCHAR *fileName);
 };
 
+/* ********** Large Plain Text ********** */
+
+// for text files too large for TxtDoc (e.g. log files): the file is mapped into
+// memory and only converted to HTML one chunk of consecutive lines at a time
+class LargeTxtDoc {
+    ScopedMem<WCHAR> fileName;
+    HANDLE hMap;
+    const char *data;
+    size_t dataSize;
+    UINT codePage;
+    // offsets of the first line of every chunk (followed by dataSize)
+    Vec<size_t> chunkStarts;
+
+    bool Load(int linesPerChunk);
+
+public:
+    LargeTxtDoc(const WCHAR *fileName);
+    ~LargeTxtDoc();
+
+    int ChunkCount() const { return (int)chunkStarts.Count() - 1; }
+    // caller must free() the result
+    char *GetChunkHtml(int idx, size_t *lenOut) const;
+
+    const WCHAR *GetFileName() const;
+
+    // whether a file should rather be loaded as LargeTxtDoc than as TxtDoc
+    static bool IsLargeFile(const WCHAR *fileName);
+    static LargeTxtDoc *CreateFromFile(const WCHAR *fileName, int linesPerChunk);
+};
+
 #endif
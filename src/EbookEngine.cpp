@@ -7,6 +7,7 @@
 #include "BaseUtil.h"
 #include "EbookEngine.h"
 
+#include "Dict.h"
 #include "EbookDoc.h"
 #include "EbookFormatter.h"
 #include "FileUtil.h"
@@ -94,6 +95,8 @@ public:
     }
     virtual WCHAR * ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_out=NULL,
                                     RenderTarget target=Target_View);
+    virtual bool ExtractTextRange(int startPage, int endPage, WCHAR *lineSep, TextExtractionSink *sink,
+                                  bool withCoords=false, RenderTarget target=Target_View);
     // make RenderCache request larger tiles than per default
     virtual bool HasClipOptimizations(int pageNo) { return false; }
     virtual PageLayoutType PreferredLayout() { return Layout_Book; }
@@ -106,6 +109,19 @@ public:
 
     virtual PageDestination *GetNamedDest(const WCHAR *name);
 
+    // only counts the laid out pages (and not the document's own data)
+    virtual size_t GetMemoryUsage() {
+        ScopedCritSec scope(&pagesAccess);
+        size_t mem = 0;
+        for (size_t i = 0; pages && i < pages->Count(); i++) {
+            if (!pages->At(i))
+                continue;
+            mem += sizeof(HtmlPage) + pages->At(i)->instructions.Count() * sizeof(DrawInstr);
+            mem += pages->At(i)->text.Count() * sizeof(WCHAR);
+        }
+        return mem;
+    }
+
     virtual bool BenchLoadPage(int pageNo) { return true; }
 
 protected:
@@ -132,15 +148,20 @@ protected:
     }
     bool ExtractPageAnchors();
     void FixFontSizeForResolution(HDC hDC);
+    void ScaleFonts(HtmlPage *page, float dpiFactor, Graphics *g);
     WCHAR *ExtractFontList();
 
     virtual PageElement *CreatePageLink(DrawInstr *link, RectI rect, int pageNo);
+    // pages are usually laid out at load, engines laying them out lazily
+    // must do so here (the caller is expected to hold pagesAccess)
+    virtual HtmlPage *GetPage(int pageNo) { return pages->At(pageNo - 1); }
 
     Vec<DrawInstr> *GetHtmlPage(int pageNo) {
         CrashIf(pageNo < 1 || PageCount() < pageNo);
         if (pageNo < 1 || PageCount() < pageNo)
             return NULL;
-        return &pages->At(pageNo - 1)->instructions;
+        HtmlPage *page = GetPage(pageNo);
+        return page ? &page->instructions : NULL;
     }
 };
 
@@ -312,6 +333,21 @@ RenderedBitmap *EbookEngine::RenderBitmap(int pageNo, float zoom, int rotation,
     return new RenderedBitmap(hbmp, screen.Size());
 }
 
+void EbookEngine::ScaleFonts(HtmlPage *page, float dpiFactor, Graphics *g)
+{
+    LOGFONTW lfw;
+    for (DrawInstr *i = page->instructions.IterStart(); i; i = page->instructions.IterNext()) {
+        if (InstrSetFont == i->type) {
+            Status ok = i->font->GetLogFontW(g, &lfw);
+            if (Ok == ok) {
+                REAL newSize = i->font->GetSize() * dpiFactor;
+                FontStyle newStyle = (FontStyle)i->font->GetStyle();
+                i->font = mui::GetCachedFont(lfw.lfFaceName, newSize, newStyle);
+            }
+        }
+    }
+}
+
 void EbookEngine::FixFontSizeForResolution(HDC hDC)
 {
     int dpi = GetDeviceCaps(hDC, LOGPIXELSY);
@@ -322,20 +358,11 @@ void EbookEngine::FixFontSizeForResolution(HDC hDC)
 
     float dpiFactor = 1.0f * currFontDpi / dpi;
     Graphics g(hDC);
-    LOGFONTW lfw;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
-        for (DrawInstr *i = pageInstrs->IterStart(); i; i = pageInstrs->IterNext()) {
-            if (InstrSetFont == i->type) {
-                Status ok = i->font->GetLogFontW(&g, &lfw);
-                if (Ok == ok) {
-                    REAL newSize = i->font->GetSize() * dpiFactor;
-                    FontStyle newStyle = (FontStyle)i->font->GetStyle();
-                    i->font = mui::GetCachedFont(lfw.lfFaceName, newSize, newStyle);
-                }
-            }
-        }
+    // pages which haven't been laid out yet (cf. GetPage) are scaled once they are
+    for (size_t i = 0; i < pages->Count(); i++) {
+        if (pages->At(i))
+            ScaleFonts(pages->At(i), dpiFactor, &g);
     }
     currFontDpi = dpi;
 }
@@ -434,7 +461,10 @@ bool EbookEngine::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom,
 
     ScopedCritSec scope(&pagesAccess);
     FixFontSizeForResolution(hDC);
-    DrawHtmlPage(&g, GetHtmlPage(pageNo), pageBorder, pageBorder, false, Color((ARGB)Color::Black), cookie ? &cookie->abort : NULL);
+    HtmlPage *page = GetPage(pageNo);
+    if (!page)
+        return false;
+    DrawHtmlPage(&g, page, pageBorder, pageBorder, false, Color((ARGB)Color::Black), cookie ? &cookie->abort : NULL);
     DrawAnnotations(g, userAnnots, pageNo);
     return !(cookie && cookie->abort);
 }
@@ -452,11 +482,24 @@ WCHAR *EbookEngine::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_o
 
     str::Str<WCHAR> content;
     Vec<RectI> coords;
+    // pages don't contain spaces, so there's a space wherever
+    // two consecutive strings on the same line don't touch
+    RectF prevStrBbox;
     bool insertSpace = false;
 
     Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
+    if (!pageInstrs)
+        return NULL;
+    // cf. HtmlPage::ConvertText
+    const WCHAR *text = GetPage(pageNo)->text.Get();
     for (DrawInstr *i = pageInstrs->IterStart(); i; i = pageInstrs->IterNext()) {
         RectI bbox = GetInstrBbox(i, pageBorder);
+        if (InstrString == i->type)
+            insertSpace = i->bbox.X - (prevStrBbox.X + prevStrBbox.Width) > 0.5f;
+        else if (InstrRtlString == i->type)
+            insertSpace = prevStrBbox.X - (i->bbox.X + i->bbox.Width) > 0.5f;
+        if (InstrString == i->type || InstrRtlString == i->type)
+            prevStrBbox = i->bbox;
         switch (i->type) {
         case InstrString:
             if (coords.Count() > 0 && (bbox.x < coords.Last().BR().x ||
@@ -472,11 +515,10 @@ WCHAR *EbookEngine::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_o
                     coords.Append(RectI(bbox.x - swidth, bbox.y, swidth, bbox.dy));
                 }
             }
-            insertSpace = false;
             {
-                ScopedMem<WCHAR> s(str::conv::FromHtmlUtf8(i->str.s, i->str.len));
-                content.Append(s);
-                size_t len = str::Len(s);
+                size_t len = str::Len(text);
+                content.Append(text, len);
+                text += len + 1;
                 double cwidth = 1.0 * bbox.dx / len;
                 for (size_t k = 0; k < len; k++)
                     coords.Append(RectI((int)(bbox.x + k * cwidth), bbox.y, (int)cwidth, bbox.dy));
@@ -496,20 +538,15 @@ WCHAR *EbookEngine::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_o
                     coords.Append(RectI(bbox.BR().x, bbox.y, swidth, bbox.dy));
                 }
             }
-            insertSpace = false;
             {
-                ScopedMem<WCHAR> s(str::conv::FromHtmlUtf8(i->str.s, i->str.len));
-                content.Append(s);
-                size_t len = str::Len(s);
+                size_t len = str::Len(text);
+                content.Append(text, len);
+                text += len + 1;
                 double cwidth = 1.0 * bbox.dx / len;
                 for (size_t k = 0; k < len; k++)
                     coords.Append(RectI((int)(bbox.x + (len - k - 1) * cwidth), bbox.y, (int)cwidth, bbox.dy));
             }
             break;
-        case InstrElasticSpace:
-        case InstrFixedSpace:
-            insertSpace = true;
-            break;
         }
     }
     if (content.Count() > 0 && !str::EndsWith(content.Get(), lineSep)) {
@@ -524,6 +561,13 @@ WCHAR *EbookEngine::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_o
     return content.StealData();
 }
 
+bool EbookEngine::ExtractTextRange(int startPage, int endPage, WCHAR *lineSep, TextExtractionSink *sink, bool withCoords, RenderTarget target)
+{
+    // all pages have already been laid out, so they can be walked in one go
+    ScopedCritSec scope(&pagesAccess);
+    return BaseEngine::ExtractTextRange(startPage, endPage, lineSep, sink, withCoords, target);
+}
+
 void EbookEngine::UpdateUserAnnotations(Vec<PageAnnotation> *list)
 {
     ScopedCritSec scope(&pagesAccess);
@@ -555,9 +599,12 @@ PageElement *EbookEngine::CreatePageLink(DrawInstr *link, RectI rect, int pageNo
 
 Vec<PageElement *> *EbookEngine::GetElements(int pageNo)
 {
+    ScopedCritSec scope(&pagesAccess);
     Vec<PageElement *> *els = new Vec<PageElement *>();
 
     Vec<DrawInstr> *pageInstrs = GetHtmlPage(pageNo);
+    if (!pageInstrs)
+        return els;
     // CreatePageLink -> GetNamedDest might use pageInstrs->IterStart()
     for (size_t k = 0; k < pageInstrs->Count(); k++) {
         DrawInstr *i = &pageInstrs->At(k);
@@ -1326,7 +1373,7 @@ void ChmFormatter::HandleTagPagebreak(HtmlToken *t)
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::DupN(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        ResetStyleRules();
     }
 }
 
@@ -1437,7 +1484,9 @@ static UINT ExtractHttpCharset(const char *html, size_t htmlLen)
 
 class ChmHtmlCollector : public EbookTocVisitor {
     ChmDoc *doc;
-    WStrList added;
+    // lower-cased URLs of all pages added so far (large CHM references
+    // contain many thousands of pages which are mostly linked repeatedly)
+    dict::MapWStrToInt added;
     str::Str<char> html;
 
 public:
@@ -1473,7 +1522,10 @@ public:
         if (!url || IsAbsoluteUrl(url))
             return;
         ScopedMem<WCHAR> plainUrl(str::ToPlainUrl(url));
-        if (added.FindI(plainUrl) != -1)
+        ScopedMem<WCHAR> key(str::Dup(plainUrl));
+        str::ToLower(key);
+        int prevVal;
+        if (!added.Insert(key, 1, &prevVal))
             return;
         ScopedMem<char> urlUtf8(str::conv::ToUtf8(plainUrl));
         size_t pageHtmlLen;
@@ -1482,7 +1534,6 @@ public:
             return;
         html.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", urlUtf8);
         html.AppendAndFree(doc->ToUtf8(pageHtml, ExtractHttpCharset((const char *)pageHtml.Get(), pageHtmlLen)));
-        added.Append(plainUrl.StealData());
     }
 };
 
@@ -1749,20 +1800,25 @@ HtmlEngine *HtmlEngine::CreateFromFile(const WCHAR *fileName)
 
 /* BaseEngine for handling TXT documents */
 
+// only that many lazily laid out pages of a LargeTxtDoc are kept
+#define MAX_LAID_OUT_TXT_PAGES  32
+
 class TxtEngineImpl : public EbookEngine, public TxtEngine {
     friend TxtEngine;
 
 public:
-    TxtEngineImpl() : EbookEngine(), doc(NULL) {
+    TxtEngineImpl() : EbookEngine(), doc(NULL), largeDoc(NULL) {
         // ISO 216 A4 (210mm x 297mm)
         pageRect = RectD(0, 0, 8.27 * GetFileDPI(), 11.693 * GetFileDPI());
     }
-    virtual ~TxtEngineImpl() { delete doc; }
+    virtual ~TxtEngineImpl();
     virtual TxtEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : NULL;
     }
 
     virtual WCHAR *GetProperty(DocumentProperty prop) {
+        if (largeDoc)
+            return Prop_FontList == prop ? str::Dup(GetDefaultFontName()) : NULL;
         return prop != Prop_FontList ? doc->GetProperty(prop) : ExtractFontList();
     }
     virtual const WCHAR *GetDefaultFileExt() const {
@@ -1770,19 +1826,138 @@ public:
     }
     virtual PageLayoutType PreferredLayout() { return Layout_Single; }
 
-    virtual bool HasTocTree() const { return doc->HasToc(); }
+    virtual bool HasTocTree() const { return doc && doc->HasToc(); }
     virtual DocTocItem *GetTocTree();
 
 protected:
     TxtDoc *doc;
+    // set instead of doc for files too large to be laid out at once
+    LargeTxtDoc *largeDoc;
+
+    // the pages of largeDoc which are currently laid out (most recently used first)
+    struct LaidOutPage {
+        int pageNo;
+        // the HTML and allocator the page's instructions point into
+        char *html;
+        PoolAllocator *allocator;
+    };
+    Vec<LaidOutPage> laidOut;
+
+    virtual HtmlPage *GetPage(int pageNo);
+    HtmlPage *LayoutLargePage(int pageNo, LaidOutPage& lop);
+    void FreeLaidOutPage(LaidOutPage& lop);
 
     bool Load(const WCHAR *fileName);
+    bool LoadLarge(const WCHAR *fileName);
 };
 
+TxtEngineImpl::~TxtEngineImpl()
+{
+    EnterCriticalSection(&pagesAccess);
+    for (size_t i = 0; i < laidOut.Count(); i++) {
+        FreeLaidOutPage(laidOut.At(i));
+    }
+    LeaveCriticalSection(&pagesAccess);
+    delete doc;
+    delete largeDoc;
+}
+
+void TxtEngineImpl::FreeLaidOutPage(LaidOutPage& lop)
+{
+    delete pages->At(lop.pageNo - 1);
+    pages->At(lop.pageNo - 1) = NULL;
+    free(lop.html);
+    delete lop.allocator;
+}
+
+HtmlPage *TxtEngineImpl::LayoutLargePage(int pageNo, LaidOutPage& lop)
+{
+    size_t len;
+    lop.pageNo = pageNo;
+    lop.html = largeDoc->GetChunkHtml(pageNo - 1, &len);
+    lop.allocator = new PoolAllocator();
+    if (!lop.html)
+        return NULL;
+
+    HtmlFormatterArgs args;
+    args.htmlStr = lop.html;
+    args.htmlStrLen = len;
+    // long lines are cut off at the page's border instead of being wrapped,
+    // so that every chunk of lines fits on exactly one page (the bottom
+    // border leaves room for rounding errors in LoadLarge's line count)
+    args.pageDx = (float)pageRect.dx * 1000;
+    args.pageDy = (float)pageRect.dy - pageBorder;
+    args.SetFontName(GetDefaultFontName());
+    args.fontSize = gDefaultFontSize;
+    args.textAllocator = lop.allocator;
+
+    HtmlPage *page = TxtFormatter(&args).Next(false);
+    if (page && currFontDpi != 96) {
+        // cf. FixFontSizeForResolution
+        Graphics *g = mui::AllocGraphicsForMeasureText();
+        ScaleFonts(page, 96.0f / currFontDpi, g);
+        mui::FreeGraphicsForMeasureText(g);
+    }
+    return page;
+}
+
+HtmlPage *TxtEngineImpl::GetPage(int pageNo)
+{
+    if (!largeDoc)
+        return EbookEngine::GetPage(pageNo);
+
+    ScopedCritSec scope(&pagesAccess);
+    for (size_t i = 0; i < laidOut.Count(); i++) {
+        if (laidOut.At(i).pageNo == pageNo) {
+            LaidOutPage lop = laidOut.At(i);
+            laidOut.RemoveAt(i);
+            laidOut.InsertAt(0, lop);
+            return pages->At(pageNo - 1);
+        }
+    }
+
+    if (laidOut.Count() >= MAX_LAID_OUT_TXT_PAGES) {
+        FreeLaidOutPage(laidOut.Last());
+        laidOut.Pop();
+    }
+    LaidOutPage lop;
+    HtmlPage *page = LayoutLargePage(pageNo, lop);
+    if (!page)
+        page = new HtmlPage();
+    pages->At(pageNo - 1) = page;
+    laidOut.InsertAt(0, lop);
+    return page;
+}
+
+bool TxtEngineImpl::LoadLarge(const WCHAR *fileName)
+{
+    // as many lines as the formatter fits on a page (cf. HtmlFormatter::lineSpacing)
+    Graphics *g = mui::AllocGraphicsForMeasureText();
+    float lineDy = mui::GetCachedFont(GetDefaultFontName(), gDefaultFontSize, FontStyleRegular)->GetHeight(g);
+    mui::FreeGraphicsForMeasureText(g);
+    int linesPerPage = max((int)(((float)pageRect.dy - 2 * pageBorder) / lineDy), 1);
+
+    largeDoc = LargeTxtDoc::CreateFromFile(fileName, linesPerPage);
+    if (!largeDoc)
+        return false;
+
+    pages = new Vec<HtmlPage *>(largeDoc->ChunkCount());
+    for (int i = 0; i < largeDoc->ChunkCount(); i++) {
+        pages->Append(NULL);
+        baseAnchors.Append(NULL);
+    }
+    return pages->Count() > 0;
+}
+
 bool TxtEngineImpl::Load(const WCHAR *fileName)
 {
     this->fileName = str::Dup(fileName);
 
+    // large files (e.g. logs) are neither linkified nor split at
+    // form feeds, so that they can be laid out a page at a time
+    if (LargeTxtDoc::IsLargeFile(fileName) && LoadLarge(fileName))
+        return true;
+
     doc = TxtDoc::CreateFromFile(fileName);
     if (!doc)
         return false;
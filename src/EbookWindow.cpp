@@ -150,7 +150,8 @@ static void CloseEbookWindow(EbookWindow *win, bool quitIfLast, bool forceClose)
     if (quitIfLast) {
         // TODO: the way we call prefs::Save() is all over the place. More principled approach would be better
         prefs::Save();
-        PostQuitMessage(0);
+        if (!StayResidentInTray())
+            PostQuitMessage(0);
         return;
     }
     WindowInfo *w = CreateAndShowWindowInfo();
@@ -577,7 +578,7 @@ RenderedBitmap *RenderFirstDocPageToBitmap(Doc doc, SizeI pageSize, SizeI bmpSiz
     SolidBrush br(Color(255, 255, 255));
     g.FillRectangle(&br, r);
 
-    DrawHtmlPage(&g, &pd->instructions, (REAL)border, (REAL)border, false, Color((ARGB)Color::Black));
+    DrawHtmlPage(&g, pd, (REAL)border, (REAL)border, false, Color((ARGB)Color::Black));
     delete pd;
 
     Bitmap res(bmpSize.dx, bmpSize.dy, PixelFormat24bppRGB);
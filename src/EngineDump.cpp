@@ -12,6 +12,8 @@ using namespace Gdiplus;
 #include "GdiPlusUtil.h"
 #include "PdfEngine.h"
 #include "TgaReader.h"
+#include "ThreadUtil.h"
+#include "Timer.h"
 #include "WinUtil.h"
 
 #define Out(msg, ...) printf(msg, __VA_ARGS__)
@@ -311,35 +313,188 @@ void DumpData(BaseEngine *engine, bool fullDump)
     Out("</EngineDump>\n");
 }
 
+void SaveRenderedPage(RenderedBitmap *bmp, const WCHAR *renderPath, int pageNo)
+{
+    ScopedMem<WCHAR> pageBmpPath(str::Format(renderPath, pageNo));
+    if (str::EndsWithI(pageBmpPath, L".png")) {
+        Bitmap gbmp(bmp->GetBitmap(), NULL);
+        CLSID pngEncId = GetEncoderClsid(L"image/png");
+        gbmp.Save(pageBmpPath, &pngEncId);
+    }
+    else if (str::EndsWithI(pageBmpPath, L".bmp")) {
+        size_t bmpDataLen;
+        ScopedMem<char> bmpData((char *)SerializeBitmap(bmp->GetBitmap(), &bmpDataLen));
+        if (bmpData)
+            file::WriteAll(pageBmpPath, bmpData, bmpDataLen);
+    }
+    else { // render as TGA for all other file extensions
+        size_t tgaDataLen;
+        ScopedMem<unsigned char> tgaData(tga::SerializeBitmap(bmp->GetBitmap(), &tgaDataLen));
+        if (tgaData)
+            file::WriteAll(pageBmpPath, tgaData, tgaDataLen);
+    }
+}
+
 void RenderDocument(BaseEngine *engine, const WCHAR *renderPath, float zoom=1.f, bool silent=false)
 {
     for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        Timer t(true);
         RenderedBitmap *bmp = engine->RenderBitmap(pageNo, zoom, 0);
-        if (!bmp || silent) {
-            delete bmp;
-            continue;
+        // same format as for ParallelRenderer (parsed by scripts/reftest.py)
+        fprintf(stderr, "Rendered page %d in %.2f ms%s\n", pageNo, t.GetTimeInMs(), bmp ? "" : " (failed)");
+        if (bmp && !silent)
+            SaveRenderedPage(bmp, renderPath, pageNo);
+        delete bmp;
+    }
+}
+
+// maximum number of rendered pages waiting to be saved per render thread
+// (so that memory usage remains bounded when saving is slower than rendering)
+#define MAX_QUEUED_PAGES_PER_THREAD 2
+
+// renders pages on several threads (each using its own engine clone)
+// while a separate thread saves the rendered pages to disk
+class ParallelRenderer {
+    struct RenderedPage {
+        int pageNo;
+        RenderedBitmap *bmp;
+    };
+
+    class RenderThread;
+    class SaveThread;
+    friend class RenderThread;
+    friend class SaveThread;
+
+    class RenderThread : public ThreadBase {
+        ParallelRenderer *renderer;
+        BaseEngine *engine;
+    public:
+        RenderThread(ParallelRenderer *renderer, BaseEngine *engine) :
+            ThreadBase("RenderThread"), renderer(renderer), engine(engine) { }
+        virtual void Run() { renderer->RenderPages(engine); }
+    };
+
+    class SaveThread : public ThreadBase {
+        ParallelRenderer *renderer;
+    public:
+        SaveThread(ParallelRenderer *renderer) : ThreadBase("SaveThread"), renderer(renderer) { }
+        virtual void Run() { renderer->SavePages(); }
+    };
+
+    const WCHAR *renderPath;
+    float zoom;
+    bool silent;
+    int pageCount;
+
+    LONG nextPageNo;
+    LONG activeRenderThreads;
+
+    CRITICAL_SECTION queueAccess;
+    Vec<RenderedPage> queue;
+    // signaled whenever a page has been queued or rendering has finished
+    HANDLE hQueued;
+    // counts the free slots in queue
+    HANDLE hFreeSlots;
+
+    void RenderPages(BaseEngine *engine) {
+        LONG pageNo;
+        while ((pageNo = InterlockedIncrement(&nextPageNo)) <= pageCount) {
+            Timer t(true);
+            RenderedBitmap *bmp = engine->RenderBitmap(pageNo, zoom, 0);
+            double renderMs = t.GetTimeInMs();
+            fprintf(stderr, "Rendered page %d in %.2f ms%s\n", pageNo, renderMs, bmp ? "" : " (failed)");
+            if (!bmp || silent) {
+                delete bmp;
+                continue;
+            }
+            WaitForSingleObject(hFreeSlots, INFINITE);
+            RenderedPage page = { pageNo, bmp };
+            ScopedCritSec scope(&queueAccess);
+            queue.Append(page);
+            SetEvent(hQueued);
         }
-        ScopedMem<WCHAR> pageBmpPath(str::Format(renderPath, pageNo));
-        if (str::EndsWithI(pageBmpPath, L".png")) {
-            Bitmap gbmp(bmp->GetBitmap(), NULL);
-            CLSID pngEncId = GetEncoderClsid(L"image/png");
-            gbmp.Save(pageBmpPath, &pngEncId);
+        InterlockedDecrement(&activeRenderThreads);
+        SetEvent(hQueued);
+    }
+
+    void SavePages() {
+        for (;;) {
+            RenderedPage page = { 0 };
+            bool done = false;
+            {
+                ScopedCritSec scope(&queueAccess);
+                if (queue.Count() > 0) {
+                    page = queue.At(0);
+                    queue.RemoveAt(0);
+                }
+                else {
+                    done = 0 == activeRenderThreads;
+                }
+            }
+            if (!page.bmp) {
+                if (done)
+                    break;
+                WaitForSingleObject(hQueued, INFINITE);
+                continue;
+            }
+            ReleaseSemaphore(hFreeSlots, 1, NULL);
+            SaveRenderedPage(page.bmp, renderPath, page.pageNo);
+            delete page.bmp;
         }
-        else if (str::EndsWithI(pageBmpPath, L".bmp")) {
-            size_t bmpDataLen;
-            ScopedMem<char> bmpData((char *)SerializeBitmap(bmp->GetBitmap(), &bmpDataLen));
-            if (bmpData)
-                file::WriteAll(pageBmpPath, bmpData, bmpDataLen);
+    }
+
+public:
+    ParallelRenderer(const WCHAR *renderPath, float zoom, bool silent) :
+        renderPath(renderPath), zoom(zoom), silent(silent), pageCount(0),
+        nextPageNo(0), activeRenderThreads(0), hFreeSlots(NULL) {
+        InitializeCriticalSection(&queueAccess);
+        hQueued = CreateEvent(NULL, FALSE, FALSE, NULL);
+    }
+    ~ParallelRenderer() {
+        CloseHandle(hQueued);
+        CloseHandle(hFreeSlots);
+        DeleteCriticalSection(&queueAccess);
+    }
+
+    void Render(BaseEngine *engine, int threadCount) {
+        Vec<BaseEngine *> engines;
+        engines.Append(engine);
+        // cloning might fail for some documents; then just render on fewer threads
+        for (int i = 1; i < threadCount && engine->SupportsConcurrentRendering(); i++) {
+            BaseEngine *clone = engine->Clone();
+            if (!clone)
+                break;
+            engines.Append(clone);
         }
-        else { // render as TGA for all other file extensions
-            size_t tgaDataLen;
-            ScopedMem<unsigned char> tgaData(tga::SerializeBitmap(bmp->GetBitmap(), &tgaDataLen));
-            if (tgaData)
-                file::WriteAll(pageBmpPath, tgaData, tgaDataLen);
+        if ((int)engines.Count() < threadCount)
+            fprintf(stderr, "Warning: Rendering on %d thread(s) only\n", (int)engines.Count());
+
+        pageCount = engine->PageCount();
+        nextPageNo = 0;
+        activeRenderThreads = (LONG)engines.Count();
+        LONG maxQueued = MAX_QUEUED_PAGES_PER_THREAD * activeRenderThreads;
+        hFreeSlots = CreateSemaphore(NULL, maxQueued, maxQueued, NULL);
+
+        Timer t(true);
+        SaveThread saveThread(this);
+        saveThread.Start();
+        Vec<RenderThread *> threads;
+        for (size_t i = 0; i < engines.Count(); i++) {
+            threads.Append(new RenderThread(this, engines.At(i)));
+            threads.Last()->Start();
+        }
+        for (size_t i = 0; i < threads.Count(); i++) {
+            threads.At(i)->Join();
+            delete threads.At(i);
+        }
+        saveThread.Join();
+        fprintf(stderr, "Rendered %d page(s) on %d thread(s) in %.2f ms\n", pageCount, (int)engines.Count(), t.GetTimeInMs());
+
+        for (size_t i = 1; i < engines.Count(); i++) {
+            delete engines.At(i);
         }
-        delete bmp;
     }
-}
+};
 
 class PasswordHolder : public PasswordUI {
     const WCHAR *password;
@@ -362,7 +517,7 @@ int main(int argc, char **argv)
     ParseCmdLine(GetCommandLine(), argList);
     if (argList.Count() < 2) {
 Usage:
-        ErrOut("%s <filename> [-pwd <password>][-full][-render <path-%%d.tga>]\n",
+        ErrOut("%s <filename> [-pwd <password>][-full][-render <path-%%d.tga>][-threads <count>]\n",
             path::GetBaseName(argList.At(0)));
         return 2;
     }
@@ -387,6 +542,7 @@ Usage:
     float renderZoom = 1.f;
     bool useAlternateHandlers = false;
     bool loadOnly = false, silent = false;
+    int renderThreads = 0;
     int breakAlloc = 0;
 
     for (size_t i = 2; i < argList.Count(); i++) {
@@ -403,6 +559,12 @@ Usage:
             }
             renderPath = argList.At(++i);
         }
+        // -threads renders on several threads and prints per-page timings to stderr
+        else if (str::Eq(argList.At(i), L"-threads") && i + 1 < argList.Count()) {
+            renderThreads = _wtoi(argList.At(++i));
+            if (renderThreads < 1)
+                goto Usage;
+        }
         // -alt is for debugging alternate rendering methods
         else if (str::Eq(argList.At(i), L"-alt"))
             useAlternateHandlers = true;
@@ -449,7 +611,11 @@ Usage:
     delete userAnnots;
     if (!loadOnly)
         DumpData(engine, fullDump);
-    if (renderPath)
+    if (renderPath && renderThreads > 0) {
+        ParallelRenderer renderer(renderPath, renderZoom, silent);
+        renderer.Render(engine, renderThreads);
+    }
+    else if (renderPath)
         RenderDocument(engine, renderPath, renderZoom, silent);
     delete engine;
 
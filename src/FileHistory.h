@@ -45,6 +45,42 @@ etc...
 class FileHistory {
     // owned by gGlobalPrefs->fileStates
     Vec<DisplayState *> *states;
+    // open-addressing hash table of states by (case-insensitive) file path,
+    // so that looking up files doesn't depend on the length of the history
+    // (rebuilt from states on use after states have been removed)
+    Vec<DisplayState *> index;
+    bool indexIsStale;
+
+    static uint32_t HashPath(const WCHAR *filePath) {
+        // consistent with str::EqI
+        uint32_t hash = 2166136261U;
+        for (const WCHAR *s = filePath; *s; s++) {
+            hash = (hash ^ towlower(*s)) * 16777619U;
+        }
+        return hash;
+    }
+
+    void IndexState(DisplayState *state) {
+        size_t mask = index.Count() - 1;
+        size_t slot = HashPath(state->filePath) & mask;
+        for (; index.At(slot); slot = (slot + 1) & mask) {
+            // only the first state for a path can be found
+            if (str::EqI(index.At(slot)->filePath, state->filePath))
+                return;
+        }
+        index.At(slot) = state;
+    }
+
+    void UpdateIndex() {
+        if (!indexIsStale && index.Count() >= states->Count() * 2)
+            return;
+        index.Reset();
+        index.AppendBlanks(RoundToPowerOf2(max(states->Count() * 4, (size_t)64)));
+        for (size_t i = 0; i < states->Count(); i++) {
+            IndexState(states->At(i));
+        }
+        indexIsStale = false;
+    }
 
     // sorts the most often used files first
     static int cmpOpenCount(const void *a, const void *b) {
@@ -64,7 +100,7 @@ class FileHistory {
     }
 
 public:
-    FileHistory() : states(NULL) { }
+    FileHistory() : states(NULL), indexIsStale(true) { }
     ~FileHistory() { }
 
     void Clear(bool keepFavorites) {
@@ -76,10 +112,27 @@ public:
             DeleteDisplayState(states->At(i));
         }
         states->Reset();
+        indexIsStale = true;
     }
 
-    void Append(DisplayState *state) { states->Append(state); }
-    void Remove(DisplayState *state) { states->Remove(state); }
+    void Append(DisplayState *state) {
+        states->Append(state);
+        if (!indexIsStale && index.Count() >= states->Count() * 2)
+            IndexState(state);
+        else
+            indexIsStale = true;
+    }
+    void Remove(DisplayState *state) {
+        states->Remove(state);
+        indexIsStale = true;
+    }
+
+    // a state's file path may only be changed through this method
+    // (or to a path only differing in case)
+    void SetFilePath(DisplayState *state, const WCHAR *filePath) {
+        str::ReplacePtr(&state->filePath, filePath);
+        indexIsStale = true;
+    }
 
     DisplayState *Get(size_t index) const {
         if (index < states->Count())
@@ -87,12 +140,15 @@ public:
         return NULL;
     }
 
-    DisplayState *Find(const WCHAR *filePath, size_t *idxOut=NULL) const {
-        for (size_t i = 0; i < states->Count(); i++) {
-            if (str::EqI(states->At(i)->filePath, filePath)) {
+    DisplayState *Find(const WCHAR *filePath, size_t *idxOut=NULL) {
+        UpdateIndex();
+        size_t mask = index.Count() - 1;
+        for (size_t slot = HashPath(filePath) & mask; index.At(slot); slot = (slot + 1) & mask) {
+            DisplayState *state = index.At(slot);
+            if (str::EqI(state->filePath, filePath)) {
                 if (idxOut)
-                    *idxOut = i;
-                return states->At(i);
+                    *idxOut = states->Find(state);
+                return state;
             }
         }
         return NULL;
@@ -107,6 +163,10 @@ public:
         if (!state) {
             state = NewDisplayState(filePath);
             state->useDefaultState = true;
+            if (!indexIsStale && index.Count() >= (states->Count() + 1) * 2)
+                IndexState(state);
+            else
+                indexIsStale = true;
         }
         else {
             states->Remove(state);
@@ -174,29 +234,40 @@ public:
                 minOpenCount = frequencyList.At(FILE_HISTORY_MAX_FREQUENT)->openCount / 2;
         }
 
-        for (size_t j = states->Count(); j > 0; j--) {
+        // the states to keep are compacted in a single pass (instead of
+        // removing states one by one), as there might be many to remove
+        size_t kept = 0;
+        for (size_t j = 1; j <= states->Count(); j++) {
             DisplayState *state = states->At(j - 1);
+            bool forget = false;
             // never forget pinned documents, documents we've remembered a password for and
             // documents for which there are favorites
             if (state->isPinned || state->decryptionKey != NULL || state->favorites->Count() > 0)
-                continue;
+                forget = false;
             // forget about missing documents without valuable state
-            if (state->isMissing && (alwaysUseDefaultState || state->useDefaultState))
-                states->RemoveAt(j - 1);
+            else if (state->isMissing && (alwaysUseDefaultState || state->useDefaultState))
+                forget = true;
             // forget about files last opened longer ago than the last FILE_HISTORY_MAX_FILES ones
             else if (j > FILE_HISTORY_MAX_FILES)
-                states->RemoveAt(j - 1);
+                forget = true;
             // forget about files that were hardly used (and without valuable state)
             else if (alwaysUseDefaultState && state->openCount < minOpenCount && j > FILE_HISTORY_MAX_RECENT)
-                states->RemoveAt(j - 1);
+                forget = true;
+            if (forget)
+                DeleteDisplayState(state);
             else
-                continue;
-            DeleteDisplayState(state);
+                states->At(kept++) = state;
+        }
+        if (kept < states->Count()) {
+            states->RemoveAt(kept, states->Count() - kept);
+            indexIsStale = true;
         }
     }
 
     void UpdateStatesSource(Vec<DisplayState *> *states) {
         this->states = states;
+        index.Reset();
+        indexIsStale = true;
     }
 };
 
@@ -9,6 +9,8 @@ using namespace Gdiplus;
 #include "GdiPlusUtil.h"
 #include "HtmlPullParser.h"
 #include "Mui.h"
+#include "Timer.h"
+#include "Trace.h"
 
 #include "DebugLog.h"
 
@@ -75,6 +77,29 @@ DrawInstr DrawInstr::Str(const char *s, size_t len, RectF bbox, bool rtl)
     return di;
 }
 
+void HtmlPage::ConvertText()
+{
+    // a string's UTF-16 version is never longer than its UTF-8 version,
+    // so that all strings fit into a single allocation
+    size_t maxLen = 0;
+    for (DrawInstr *i = instructions.IterStart(); i; i = instructions.IterNext()) {
+        if (InstrString == i->type || InstrRtlString == i->type)
+            maxLen += i->str.len + 1;
+    }
+    text.Reset();
+    WCHAR *dst = text.AppendBlanks(maxLen);
+    for (DrawInstr *i = instructions.IterStart(); i; i = instructions.IterNext()) {
+        if (InstrString != i->type && InstrRtlString != i->type)
+            continue;
+        int cchConverted = 0;
+        if (i->str.len > 0)
+            cchConverted = MultiByteToWideChar(CP_UTF8, 0, i->str.s, (int)i->str.len, dst, (int)i->str.len);
+        dst[cchConverted] = '\0';
+        dst += cchConverted + 1;
+    }
+    text.RemoveAt(dst - text.Get(), text.Count() - (dst - text.Get()));
+}
+
 DrawInstr DrawInstr::SetFont(Font *font)
 {
     DrawInstr di(InstrSetFont);
@@ -172,7 +197,7 @@ HtmlFormatter::HtmlFormatter(HtmlFormatterArgs *args) :
     currX(0), currY(0), currLineTopPadding(0), currLinkIdx(0),
     listDepth(0), preFormatted(false), dirRtl(false), currPage(NULL),
     finishedParsing(false), pageCount(0), measureAlgo(args->measureAlgo),
-    keepTagNesting(false)
+    stats(args->stats), keepTagNesting(false)
 {
     currReparseIdx = args->reparseIdx;
     htmlParser = new HtmlPullParser(args->htmlStr, args->htmlStrLen);
@@ -546,7 +571,7 @@ bool HtmlFormatter::FlushCurrLine(bool isParagraphBreak)
         // TODO: this occasionally leads to empty links
         AppendInstr(DrawInstr(InstrLinkEnd));
     }
-    currPage->instructions.Append(currLineInstr.LendData(), currLineInstr.Count());
+    AppendLineToPage();
     currLineInstr.Reset();
     currLineReparseIdx = -1; // mark as not set
     currLineTopPadding = 0;
@@ -559,6 +584,22 @@ bool HtmlFormatter::FlushCurrLine(bool isParagraphBreak)
     return createdPage;
 }
 
+// spaces are only needed for laying out a line, so they're not kept
+// in the page (which saves about half of most pages' instructions)
+void HtmlFormatter::AppendLineToPage()
+{
+    Vec<DrawInstr>& instrs = currPage->instructions;
+    for (DrawInstr *i = currLineInstr.IterStart(); i; i = currLineInstr.IterNext()) {
+        if (InstrElasticSpace == i->type || InstrFixedSpace == i->type)
+            continue;
+        // a font change immediately followed by another one is redundant
+        if (InstrSetFont == i->type && instrs.Count() > 0 && InstrSetFont == instrs.Last().type)
+            instrs.Last() = *i;
+        else
+            instrs.Append(*i);
+    }
+}
+
 void HtmlFormatter::EmitNewPage()
 {
     CrashIf(currReparseIdx > INT_MAX);
@@ -704,6 +745,69 @@ void HtmlFormatter::EmitElasticSpace()
 }
 
 // a text run is a string of consecutive text with uniform style
+// most words occur many times in a book, so remembering their sizes saves a lot
+// of (otherwise dominant) measuring when laying out a book (again)
+#define TEXT_SIZE_CACHE_SIZE    4096
+#define MAX_CACHED_TEXT_LEN     24
+
+struct CachedTextSize {
+    Font *                  font;
+    TextMeasureAlgorithm    algo;
+    size_t                  len;
+    WCHAR                   s[MAX_CACHED_TEXT_LEN];
+    RectF                   bbox;
+};
+
+// entries are replaced on collisions
+static CachedTextSize gTextSizeCache[TEXT_SIZE_CACHE_SIZE];
+
+// books can be laid out (and drawn) on several threads at once
+class CacheLock {
+public:
+    CRITICAL_SECTION cs;
+    CacheLock() { InitializeCriticalSection(&cs); }
+    ~CacheLock() { DeleteCriticalSection(&cs); }
+};
+static CacheLock gTextSizeCacheLock;
+
+// adds the time spent in a scope to a HtmlFormatterStats field
+class StatsScope {
+    double *ms;
+    Timer t;
+public:
+    explicit StatsScope(double *ms) : ms(ms), t(ms != NULL) { }
+    ~StatsScope() { if (ms) *ms += t.GetTimeInMs(); }
+};
+
+#define STATS_SCOPE(field) StatsScope _statsScope(stats ? &stats->field : NULL)
+
+// fonts are cached by mui until exit, so that Font pointers can serve as keys
+static RectF MeasureTextCached(Graphics *g, Font *f, const WCHAR *s, size_t len, TextMeasureAlgorithm algo)
+{
+    if (len > MAX_CACHED_TEXT_LEN)
+        return MeasureText(g, f, s, len, algo);
+
+    uint32_t hash = MurmurHash2(s, len * sizeof(WCHAR)) ^ (uint32_t)(uintptr_t)f;
+    CachedTextSize *entry = &gTextSizeCache[hash % TEXT_SIZE_CACHE_SIZE];
+    {
+        ScopedCritSec scope(&gTextSizeCacheLock.cs);
+        if (entry->font == f && entry->algo == algo && entry->len == len &&
+            memeq(entry->s, s, len * sizeof(WCHAR))) {
+            return entry->bbox;
+        }
+    }
+
+    RectF bbox = MeasureText(g, f, s, len, algo);
+
+    ScopedCritSec scope(&gTextSizeCacheLock.cs);
+    entry->font = f;
+    entry->algo = algo;
+    entry->len = len;
+    memcpy(entry->s, s, len * sizeof(WCHAR));
+    entry->bbox = bbox;
+    return bbox;
+}
+
 void HtmlFormatter::EmitTextRun(const char *s, const char *end)
 {
     currReparseIdx = s - htmlParser->Start();
@@ -722,7 +826,11 @@ void HtmlFormatter::EmitTextRun(const char *s, const char *end)
             currReparseIdx = s - htmlParser->Start();
 
         size_t strLen = str::Utf8ToWcharBuf(s, end - s, buf, dimof(buf));
-        RectF bbox = MeasureText(gfx, CurrFont(), buf, strLen, measureAlgo);
+        RectF bbox;
+        {
+            STATS_SCOPE(measureMs);
+            bbox = MeasureTextCached(gfx, CurrFont(), buf, strLen, measureAlgo);
+        }
         EnsureDx(bbox.Width);
         if (bbox.Width <= pageDx - currX) {
             AppendInstr(DrawInstr::Str(s, end - s, bbox, dirRtl));
@@ -730,6 +838,7 @@ void HtmlFormatter::EmitTextRun(const char *s, const char *end)
             break;
         }
 
+        STATS_SCOPE(measureMs);
         size_t lenThatFits = StringLenForWidth(gfx, CurrFont(), buf, strLen, pageDx - NewLineX(), measureAlgo);
         // try to prevent a break in the middle of a word
         if (iswalnum(buf[lenThatFits])) {
@@ -943,19 +1052,66 @@ void HtmlFormatter::HandleTagPre(HtmlToken *t)
     }
 }
 
-StyleRule *HtmlFormatter::FindStyleRule(HtmlTag tag, const char *clazz, size_t clazzLen)
+// publishers' stylesheets can contain thousands of rules, so they're indexed
+// instead of being compared to every element (cf. styleRulesIndex)
+static size_t StyleRuleSlot(HtmlTag tag, uint32_t classHash, size_t indexSize)
 {
-    uint32_t classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
-    for (size_t i = 0; i < styleRules.Count(); i++) {
-        StyleRule& rule = styleRules.At(i);
+    return (((uint32_t)tag * 0x9E3779B1) ^ classHash) & (indexSize - 1);
+}
+
+StyleRule *HtmlFormatter::FindStyleRule(HtmlTag tag, uint32_t classHash)
+{
+    size_t indexSize = styleRulesIndex.Count();
+    if (0 == indexSize)
+        return NULL;
+    for (size_t slot = StyleRuleSlot(tag, classHash, indexSize); styleRulesIndex.At(slot) != 0; slot = (slot + 1) & (indexSize - 1)) {
+        StyleRule& rule = styleRules.At(styleRulesIndex.At(slot) - 1);
         if (tag == rule.tag && classHash == rule.classHash)
             return &rule;
     }
     return NULL;
 }
 
+StyleRule *HtmlFormatter::FindStyleRule(HtmlTag tag, const char *clazz, size_t clazzLen)
+{
+    uint32_t classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
+    return FindStyleRule(tag, classHash);
+}
+
+void HtmlFormatter::AddStyleRule(StyleRule& rule)
+{
+    styleRules.Append(rule);
+    // keep the index at most half full
+    size_t indexSize = styleRulesIndex.Count();
+    if (styleRules.Count() * 2 > indexSize) {
+        indexSize = max(indexSize * 2, (size_t)64);
+        styleRulesIndex.Reset();
+        styleRulesIndex.AppendBlanks(indexSize);
+        for (size_t i = 0; i < styleRules.Count(); i++) {
+            size_t slot = StyleRuleSlot(styleRules.At(i).tag, styleRules.At(i).classHash, indexSize);
+            while (styleRulesIndex.At(slot) != 0) {
+                slot = (slot + 1) & (indexSize - 1);
+            }
+            styleRulesIndex.At(slot) = i + 1;
+        }
+        return;
+    }
+    size_t slot = StyleRuleSlot(rule.tag, rule.classHash, indexSize);
+    while (styleRulesIndex.At(slot) != 0) {
+        slot = (slot + 1) & (indexSize - 1);
+    }
+    styleRulesIndex.At(slot) = styleRules.Count();
+}
+
+void HtmlFormatter::ResetStyleRules()
+{
+    styleRules.Reset();
+    styleRulesIndex.Reset();
+}
+
 StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken *t)
 {
+    STATS_SCOPE(cssMs);
     StyleRule rule;
     // get style rules ordered by specificity
     StyleRule *prevRule = FindStyleRule(Tag_Body, NULL, 0);
@@ -982,6 +1138,7 @@ StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken *t)
 
 void HtmlFormatter::ParseStyleSheet(const char *data, size_t len)
 {
+    STATS_SCOPE(cssMs);
     CssPullParser parser(data, len);
     while (parser.NextRule()) {
         StyleRule rule = StyleRule::Parse(&parser);
@@ -989,14 +1146,15 @@ void HtmlFormatter::ParseStyleSheet(const char *data, size_t len)
         while ((sel = parser.NextSelector()) != NULL) {
             if (Tag_NotFound == sel->tag)
                 continue;
-            StyleRule *prevRule = FindStyleRule(sel->tag, sel->clazz, sel->clazzLen);
+            uint32_t classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
+            StyleRule *prevRule = FindStyleRule(sel->tag, classHash);
             if (prevRule) {
                 prevRule->Merge(rule);
             }
             else {
                 rule.tag = sel->tag;
-                rule.classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
-                styleRules.Append(rule);
+                rule.classHash = classHash;
+                AddStyleRule(rule);
             }
         }
     }
@@ -1011,8 +1169,11 @@ void HtmlFormatter::HandleTagStyle(HtmlToken *t)
         return;
 
     const char *start = t->s + t->sLen + 1;
-    while (t && !t->IsError() && (!t->IsEndTag() || t->tag != Tag_Style)) {
-        t = htmlParser->Next();
+    {
+        STATS_SCOPE(parseMs);
+        while (t && !t->IsError() && (!t->IsEndTag() || t->tag != Tag_Style)) {
+            t = htmlParser->Next();
+        }
     }
     if (!t || !t->IsEndTag() || Tag_Style != t->tag)
         return;
@@ -1283,6 +1444,7 @@ static bool IsEmptyPage(HtmlPage *p)
 // if we detect accumulated pages.
 HtmlPage *HtmlFormatter::Next(bool skipEmptyPages)
 {
+    TRACE_SCOPE("HtmlFormatter::Next");
     for (;;)
     {
         // send out all pages accumulated so far
@@ -1290,17 +1452,23 @@ HtmlPage *HtmlFormatter::Next(bool skipEmptyPages)
             HtmlPage *ret = pagesToSend.At(0);
             pagesToSend.RemoveAt(0);
             pageCount++;
-            if (skipEmptyPages && IsEmptyPage(ret))
+            if (skipEmptyPages && IsEmptyPage(ret)) {
                 delete ret;
-            else
-                return ret;
+                continue;
+            }
+            ret->ConvertText();
+            return ret;
         }
         // we can call ourselves recursively to send outstanding
         // pages after parsing has finished so this is to detect
         // that case and really end parsing
         if (finishedParsing)
             return NULL;
-        HtmlToken *t = htmlParser->Next();
+        HtmlToken *t;
+        {
+            STATS_SCOPE(parseMs);
+            t = htmlParser->Next();
+        }
         if (!t || t->IsError())
             break;
 
@@ -1333,20 +1501,120 @@ Vec<HtmlPage*> *HtmlFormatter::FormatAllPages(bool skipEmptyPages)
     return pages;
 }
 
+// decoding an image takes a lot longer than drawing it, so the most recently
+// drawn images are kept decoded (up to a total of this many pixels)
+#define MAX_DECODED_IMAGE_PIXELS (8 * 1024 * 1024)
+
+struct DecodedImage {
+    // images are identified by their data's length and a hash of its beginning
+    // and end, as the data of a closed document might be reallocated for another one
+    size_t      len;
+    uint32_t    hash;
+    Bitmap *    bmp;
+    size_t      pixels;
+};
+
+// ordered from most to least recently drawn
+// note: the bitmaps are deliberately leaked at exit (after GDI+ has been shut down)
+static Vec<DecodedImage> gDecodedImages;
+static size_t gDecodedImagePixels = 0;
+static CacheLock gDecodedImagesLock;
+
+static uint32_t HashImageData(const char *data, size_t len)
+{
+    size_t hashLen = min(len, (size_t)256);
+    return MurmurHash2(data, hashLen) ^ (MurmurHash2(data + len - hashLen, hashLen) * 31);
+}
+
+static void DrawImageCached(Graphics *g, char *data, size_t len, RectF bbox)
+{
+    if (!data || 0 == len)
+        return;
+    uint32_t hash = HashImageData(data, len);
+    {
+        // GDI+ objects can't be used by several threads at once, so
+        // the lock is held while drawing
+        ScopedCritSec scope(&gDecodedImagesLock.cs);
+        for (size_t i = 0; i < gDecodedImages.Count(); i++) {
+            DecodedImage img = gDecodedImages.At(i);
+            if (img.len == len && img.hash == hash) {
+                gDecodedImages.RemoveAt(i);
+                gDecodedImages.InsertAt(0, img);
+                g->DrawImage(img.bmp, bbox, 0, 0, (REAL)img.bmp->GetWidth(), (REAL)img.bmp->GetHeight(), UnitPixel);
+                return;
+            }
+        }
+    }
+
+    Bitmap *bmp = BitmapFromData(data, len);
+    if (!bmp)
+        return;
+    g->DrawImage(bmp, bbox, 0, 0, (REAL)bmp->GetWidth(), (REAL)bmp->GetHeight(), UnitPixel);
+    DecodedImage img = { len, hash, bmp, (size_t)bmp->GetWidth() * bmp->GetHeight() };
+    if (img.pixels > MAX_DECODED_IMAGE_PIXELS / 2) {
+        delete bmp;
+        return;
+    }
+
+    ScopedCritSec scope(&gDecodedImagesLock.cs);
+    gDecodedImages.InsertAt(0, img);
+    gDecodedImagePixels += img.pixels;
+    // also removes the image if another thread has cached it in the meantime
+    for (size_t i = gDecodedImages.Count(); i > 1; i--) {
+        DecodedImage& old = gDecodedImages.At(i - 1);
+        bool duplicate = old.len == len && old.hash == hash;
+        if (!duplicate && gDecodedImagePixels <= MAX_DECODED_IMAGE_PIXELS)
+            continue;
+        gDecodedImagePixels -= old.pixels;
+        delete old.bmp;
+        gDecodedImages.RemoveAt(i - 1);
+    }
+}
+
+// DrawDriverString neither shapes text nor falls back to other fonts for missing
+// glyphs, so it's only used for text from scripts which don't need either
+static bool CanDrawAsGlyphRun(const WCHAR *s, int len)
+{
+    for (int i = 0; i < len; i++) {
+        // Latin (without combining marks) and general punctuation
+        if (s[i] >= 0x250 && (s[i] < 0x2000 || s[i] > 0x206F))
+            return false;
+    }
+    return true;
+}
+
+// distance from the top of a line to its baseline (DrawString positions
+// text by its top while DrawDriverString positions it by its baseline)
+static REAL GetBaselineOffset(Graphics *g, Font *font)
+{
+    FontFamily family;
+    if (!font || font->GetFamily(&family) != Ok)
+        return 0.f;
+    INT style = font->GetStyle();
+    UINT16 lineSpacing = family.GetLineSpacing(style);
+    if (0 == lineSpacing)
+        return 0.f;
+    return font->GetHeight(g) * family.GetCellAscent(style) / lineSpacing;
+}
+
 // TODO: draw link in the appropriate format (blue text, underlined, should show hand cursor when
 // mouse is over a link. There's a slight complication here: we only get explicit information about
 // strings, not about the whitespace and we should underline the whitespace as well. Also the text
 // should be underlined at a baseline
-void DrawHtmlPage(Graphics *g, Vec<DrawInstr> *drawInstructions, REAL offX, REAL offY, bool showBbox, Color textColor, bool *abortCookie)
+void DrawHtmlPage(Graphics *g, HtmlPage *page, REAL offX, REAL offY, bool showBbox, Color textColor, bool *abortCookie)
 {
     SolidBrush brText(textColor);
     Pen debugPen(Color(255, 0, 0), 1);
     //Pen linePen(Color(0, 0, 0), 2.f);
     Pen linePen(Color(0x5F, 0x4B, 0x32), 2.f);
     Font *font = NULL;
+    REAL baselineOffset = 0.f;
 
-    WCHAR buf[512];
+    // cf. HtmlPage::ConvertText
+    const WCHAR *text = page->text.Get();
+    const WCHAR *textEnd = text + page->text.Count();
     PointF pos;
+    Vec<DrawInstr> *drawInstructions = &page->instructions;
     DrawInstr *i;
     for (i = drawInstructions->IterStart(); i; i = drawInstructions->IterNext()) {
         RectF bbox = i->bbox;
@@ -1361,23 +1629,32 @@ void DrawHtmlPage(Graphics *g, Vec<DrawInstr> *drawInstructions, REAL offX, REAL
                 g->DrawRectangle(&debugPen, bbox);
             g->DrawLine(&linePen, p1, p2);
         } else if (InstrString == i->type) {
-            int strLen = (int)str::Utf8ToWcharBuf(i->str.s, i->str.len, buf, dimof(buf));
+            CrashIf(text >= textEnd);
+            const WCHAR *buf = text;
+            int strLen = (int)str::Len(buf);
+            text += strLen + 1;
             bbox.GetLocation(&pos);
             if (showBbox)
                 g->DrawRectangle(&debugPen, bbox);
-            g->DrawString(buf, strLen, font, pos, NULL, &brText);
+            // drawing the glyphs directly skips DrawString's expensive text layout
+            // (and places them exactly where MeasureTextAccurate measured them)
+            bool drawn = false;
+            if (font && strLen > 0 && CanDrawAsGlyphRun(buf, strLen)) {
+                PointF origin(pos.X, pos.Y + baselineOffset);
+                drawn = Ok == g->DrawDriverString((const UINT16 *)buf, strLen, font, &brText, &origin,
+                    DriverStringOptionsCmapLookup | DriverStringOptionsRealizedAdvance, NULL);
+            }
+            if (!drawn)
+                g->DrawString(buf, strLen, font, pos, NULL, &brText);
         } else if (InstrSetFont == i->type) {
             font = i->font;
+            baselineOffset = GetBaselineOffset(g, font);
         } else if ((InstrElasticSpace == i->type) ||
             (InstrFixedSpace == i->type) ||
             (InstrAnchor == i->type)) {
             // ignore
         } else if (InstrImage == i->type) {
-            // TODO: cache the bitmap somewhere (?)
-            Bitmap *bmp = BitmapFromData(i->img.data, i->img.len);
-            if (bmp)
-                g->DrawImage(bmp, bbox, 0, 0, (REAL)bmp->GetWidth(), (REAL)bmp->GetHeight(), UnitPixel);
-            delete bmp;
+            DrawImageCached(g, i->img.data, i->img.len, bbox);
         } else if (InstrLinkStart == i->type) {
             // TODO: set text color to blue
             REAL y = floorf(bbox.Y + bbox.Height + 0.5f);
@@ -1388,7 +1665,10 @@ void DrawHtmlPage(Graphics *g, Vec<DrawInstr> *drawInstructions, REAL offX, REAL
         } else if (InstrLinkEnd == i->type) {
             // TODO: set text color back again
         } else if (InstrRtlString == i->type) {
-            int strLen = (int)str::Utf8ToWcharBuf(i->str.s, i->str.len, buf, dimof(buf));
+            CrashIf(text >= textEnd);
+            const WCHAR *buf = text;
+            int strLen = (int)str::Len(buf);
+            text += strLen + 1;
             bbox.GetLocation(&pos);
             if (showBbox)
                 g->DrawRectangle(&debugPen, bbox);
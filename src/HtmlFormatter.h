@@ -16,6 +16,8 @@ enum DrawInstrType {
     InstrString = 0,
     // elastic space takes at least spaceDx pixels but can take more
     // if a line is justified
+    // note: spaces are only used while laying out a line, HtmlPage
+    // doesn't contain them (strings just don't touch where they were)
     InstrElasticSpace,
     // a fixed space takes a fixed amount of pixels. It's used e.g.
     // to implement paragraph indentation
@@ -99,6 +101,23 @@ public:
     // TODO: reparsing from reparseIdx can lead to different styling
     // due to internal state of HtmlFormatter not being properly set
     int             reparseIdx;
+    // the UTF-16 versions of the strings of all InstrString and InstrRtlString
+    // instructions (zero-terminated and in the order of the instructions),
+    // converted at once when the page is finished, so that drawing the page
+    // and extracting its text don't have to convert them again and again
+    str::Str<WCHAR> text;
+
+    void ConvertText();
+};
+
+// time spent by HtmlFormatter in its various stages (for benchmarking)
+struct HtmlFormatterStats {
+    // in HtmlPullParser
+    double parseMs;
+    // parsing style sheets and computing the style rules of tags
+    double cssMs;
+    // measuring text
+    double measureMs;
 };
 
 // just to pack args to HtmlFormatter
@@ -107,7 +126,7 @@ public:
     HtmlFormatterArgs() :
       pageDx(0), pageDy(0), fontName(NULL), fontSize(0),
       textAllocator(NULL), htmlStr(0), htmlStrLen(0),
-      reparseIdx(0), measureAlgo(NULL)
+      reparseIdx(0), measureAlgo(NULL), stats(NULL)
     { }
 
     ~HtmlFormatterArgs() {
@@ -141,6 +160,10 @@ public:
     // we start parsing from htmlStr + reparseIdx
     int             reparseIdx;
 
+    // if set, the time spent in the various stages is added to it
+    // (this adds overhead, so it's only meant for benchmarking)
+    HtmlFormatterStats *stats;
+
 private:
     WCHAR *         fontName;
 };
@@ -190,6 +213,7 @@ protected:
     void  EmitParagraph(float indent);
     void  EmitEmptyLine(float lineDy);
     void  EmitNewPage();
+    void  AppendLineToPage();
     void  ForceNewPage();
     bool  EnsureDx(float dx);
 
@@ -203,6 +227,9 @@ protected:
 
     void  ParseStyleSheet(const char *data, size_t len);
     StyleRule *FindStyleRule(HtmlTag tag, const char *clazz, size_t clazzLen);
+    StyleRule *FindStyleRule(HtmlTag tag, uint32_t classHash);
+    void  AddStyleRule(StyleRule& rule);
+    void  ResetStyleRules();
     StyleRule ComputeStyleRule(HtmlToken *t);
 
     void  AppendInstr(DrawInstr di);
@@ -221,6 +248,7 @@ protected:
     float               defaultFontSize;
     Allocator *         textAllocator;
     RectF            (* measureAlgo)(Graphics *g, Font *f, const WCHAR *s, int len);
+    HtmlFormatterStats *stats;
 
     // style stack of the current line
     Vec<DrawStyle>      styleStack;
@@ -242,6 +270,9 @@ protected:
     bool                keepTagNesting;
     // set from CSS and to be checked by the individual tag handlers
     Vec<StyleRule>      styleRules;
+    // hash table (with open addressing) of the indices into styleRules
+    // (plus 1, so that 0 marks an empty slot) by tag and classHash
+    Vec<size_t>         styleRulesIndex;
 
     // isntructions for the current line
     Vec<DrawInstr>      currLineInstr;
@@ -275,6 +306,6 @@ public:
     Vec<HtmlPage*> *FormatAllPages(bool skipEmptyPages=true);
 };
 
-void DrawHtmlPage(Graphics *g, Vec<DrawInstr> *drawInstructions, REAL offX, REAL offY, bool showBbox, Color textColor, bool *abortCookie=NULL);
+void DrawHtmlPage(Graphics *g, HtmlPage *page, REAL offX, REAL offY, bool showBbox, Color textColor, bool *abortCookie=NULL);
 
 #endif
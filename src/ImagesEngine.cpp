@@ -9,6 +9,7 @@ using namespace Gdiplus;
 #include "GdiPlusUtil.h"
 #include "HtmlPullParser.h"
 #include "JsonParser.h"
+#include "ThreadUtil.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
 
@@ -61,9 +62,27 @@ public:
     virtual Vec<PageElement *> *GetElements(int pageNo);
     virtual PageElement *GetElementAtPos(int pageNo, PointD pt);
 
-    virtual bool BenchLoadPage(int pageNo) { return LoadImage(pageNo) != NULL; }
+    // counts all currently decoded images at 32 bits per pixel
+    virtual size_t GetMemoryUsage() {
+        size_t mem = 0;
+        for (size_t i = 0; i < pages.Count(); i++) {
+            Bitmap *bmp = pages.At(i);
+            if (bmp)
+                mem += (size_t)bmp->GetWidth() * bmp->GetHeight() * 4;
+        }
+        return mem;
+    }
+
+    virtual bool BenchLoadPage(int pageNo) {
+        Bitmap *bmp = LoadImage(pageNo);
+        if (bmp)
+            DropImage(pageNo);
+        return bmp != NULL;
+    }
 
 protected:
+    friend class ImageElement;
+
     WCHAR *fileName;
     const WCHAR *fileExt;
     ScopedComPtr<IStream> fileStream;
@@ -77,6 +96,12 @@ protected:
         assert(1 <= pageNo && pageNo <= PageCount());
         return pages.At(pageNo - 1);
     }
+    // returns an image at least scale times the original size (or the original
+    // image), so that engines can keep downscaled images for display
+    virtual Bitmap *LoadScaledImage(int pageNo, float scale) { return LoadImage(pageNo); }
+    // must be called for every successful LoadImage call once the image
+    // isn't needed anymore (so that engines may discard decoded images)
+    virtual void DropImage(int pageNo) { }
 };
 
 RenderedBitmap *ImagesEngine::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
@@ -103,7 +128,7 @@ RenderedBitmap *ImagesEngine::RenderBitmap(int pageNo, float zoom, int rotation,
 
 bool ImagesEngine::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
 {
-    Bitmap *bmp = LoadImage(pageNo);
+    Bitmap *bmp = LoadScaledImage(pageNo, zoom);
     if (!bmp)
         return false;
 
@@ -129,7 +154,9 @@ bool ImagesEngine::RenderPage(HDC hDC, RectI screenRect, int pageNo, float zoom,
     RectI pageRcI = PageMediabox(pageNo).Round();
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
-    Status ok = g.DrawImage(bmp, pageRcI.ToGdipRect(), 0, 0, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+    // the image might have been decoded at a smaller size than the page's
+    Status ok = g.DrawImage(bmp, pageRcI.ToGdipRect(), 0, 0, bmp->GetWidth(), bmp->GetHeight(), UnitPixel, &imgAttrs);
+    DropImage(pageNo);
     return ok == Ok;
 }
 
@@ -163,23 +190,32 @@ RectD ImagesEngine::Transform(RectD rect, int pageNo, float zoom, int rotation,
     return rect;
 }
 
+// the image is only loaded when needed, as the engine might discard it in the meantime
 class ImageElement : public PageElement {
-    Bitmap *bmp;
+    ImagesEngine *engine;
     int pageNo;
+    RectD rect;
 
 public:
-    ImageElement(int pageNo, Bitmap *bmp) : pageNo(pageNo), bmp(bmp) { }
+    ImageElement(ImagesEngine *engine, int pageNo) : engine(engine), pageNo(pageNo),
+        rect(engine->PageMediabox(pageNo)) { }
 
     virtual PageElementType GetType() const { return Element_Image; }
     virtual int GetPageNo() const { return pageNo; }
-    virtual RectD GetRect() const { return RectD(0, 0, bmp->GetWidth(), bmp->GetHeight()); }
+    virtual RectD GetRect() const { return rect; }
     virtual WCHAR *GetValue() const { return NULL; }
 
     virtual RenderedBitmap *GetImage() {
+        Bitmap *bmp = engine->LoadImage(pageNo);
+        if (!bmp)
+            return NULL;
         HBITMAP hbmp;
-        if (bmp->GetHBITMAP((ARGB)Color::White, &hbmp) != Ok)
+        Status ok = bmp->GetHBITMAP((ARGB)Color::White, &hbmp);
+        SizeI size(bmp->GetWidth(), bmp->GetHeight());
+        engine->DropImage(pageNo);
+        if (ok != Ok)
             return NULL;
-        return new RenderedBitmap(hbmp, SizeI(bmp->GetWidth(), bmp->GetHeight()));
+        return new RenderedBitmap(hbmp, size);
     }
 };
 
@@ -188,9 +224,10 @@ Vec<PageElement *> *ImagesEngine::GetElements(int pageNo)
     Bitmap *bmp = LoadImage(pageNo);
     if (!bmp)
         return NULL;
+    DropImage(pageNo);
 
     Vec<PageElement *> *els = new Vec<PageElement *>();
-    els->Append(new ImageElement(pageNo, bmp));
+    els->Append(new ImageElement(this, pageNo));
     return els;
 }
 
@@ -201,7 +238,8 @@ PageElement *ImagesEngine::GetElementAtPos(int pageNo, PointD pt)
     Bitmap *bmp = LoadImage(pageNo);
     if (!bmp)
         return NULL;
-    return new ImageElement(pageNo, bmp);
+    DropImage(pageNo);
+    return new ImageElement(this, pageNo);
 }
 
 unsigned char *ImagesEngine::GetFileData(size_t *cbCount)
@@ -426,10 +464,20 @@ class ImageDirEngineImpl : public ImagesEngine, public ImageDirEngine {
     friend ImageDirEngine;
 
 public:
+    ImageDirEngineImpl() : mediaboxesLoaded(0) {
+        InitializeCriticalSection(&mediaboxesAccess);
+    }
+    virtual ~ImageDirEngineImpl() {
+        DeleteCriticalSection(&mediaboxesAccess);
+    }
     virtual ImageDirEngine *Clone() {
         return fileName ? CreateFromFile(fileName) : NULL;
     }
     virtual RectD PageMediabox(int pageNo);
+    virtual RectD PageMediaboxEstimate(int pageNo, bool *isExact);
+    // determining an image's size requires reading its file, which is
+    // too slow for directories containing more than a few hundred images
+    virtual bool PrefersPageSizeEstimates() const { return mediaboxesLoaded < mediaboxes.Count(); }
 
     virtual unsigned char *GetFileData(size_t *cbCount) { return NULL; }
     virtual bool SaveFileAs(const WCHAR *copyFileName);
@@ -455,6 +503,11 @@ protected:
     virtual Bitmap *LoadImage(int pageNo);
 
     Vec<RectD> mediaboxes;
+    // number of mediaboxes which have been determined
+    size_t mediaboxesLoaded;
+    // mediaboxes are determined both on the UI thread and
+    // on DisplayModel's PageSizesThread
+    CRITICAL_SECTION mediaboxesAccess;
     WStrVec pageFileNames;
 };
 
@@ -491,21 +544,64 @@ bool ImageDirEngineImpl::LoadImageDir(const WCHAR *dirName)
     return true;
 }
 
+// the size of most images can be determined from their first few KB
+#define IMAGE_SIZE_PREFIX_LEN (64 * 1024)
+
+static Size ImageSizeFromFile(const WCHAR *filePath)
+{
+    int64 fileSize = file::GetSize(filePath);
+    if (fileSize <= 0)
+        return Size();
+    if (fileSize > IMAGE_SIZE_PREFIX_LEN) {
+        ScopedMem<char> prefix(AllocArray<char>(IMAGE_SIZE_PREFIX_LEN));
+        if (prefix && file::ReadAll(filePath, prefix, IMAGE_SIZE_PREFIX_LEN)) {
+            Size size = BitmapSizeFromData(prefix, IMAGE_SIZE_PREFIX_LEN);
+            if (!size.Empty())
+                return size;
+        }
+    }
+    // e.g. JPEG images with large metadata blocks
+    size_t len;
+    ScopedMem<char> bmpData(file::ReadAll(filePath, &len));
+    if (!bmpData)
+        return Size();
+    return BitmapSizeFromData(bmpData, len);
+}
+
 RectD ImageDirEngineImpl::PageMediabox(int pageNo)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
+    ScopedCritSec scope(&mediaboxesAccess);
     if (!mediaboxes.At(pageNo - 1).IsEmpty())
         return mediaboxes.At(pageNo - 1);
 
-    size_t len;
-    ScopedMem<char> bmpData(file::ReadAll(pageFileNames.At(pageNo - 1), &len));
-    if (bmpData) {
-        Size size = BitmapSizeFromData(bmpData, len);
+    // don't block other threads while reading the file
+    Bitmap *bmp = pages.At(pageNo - 1);
+    Size size;
+    if (bmp) {
+        size = Size(bmp->GetWidth(), bmp->GetHeight());
+    }
+    else {
+        LeaveCriticalSection(&mediaboxesAccess);
+        size = ImageSizeFromFile(pageFileNames.At(pageNo - 1));
+        EnterCriticalSection(&mediaboxesAccess);
+    }
+    if (!size.Empty() && mediaboxes.At(pageNo - 1).IsEmpty()) {
         mediaboxes.At(pageNo - 1) = RectD(0, 0, size.Width, size.Height);
+        mediaboxesLoaded++;
     }
     return mediaboxes.At(pageNo - 1);
 }
 
+// the images of a directory usually all have about the same size
+RectD ImageDirEngineImpl::PageMediaboxEstimate(int pageNo, bool *isExact)
+{
+    assert(1 <= pageNo && pageNo <= PageCount());
+    ScopedCritSec scope(&mediaboxesAccess);
+    *isExact = !mediaboxes.At(pageNo - 1).IsEmpty() || 1 == pageNo;
+    return PageMediabox(*isExact ? pageNo : 1);
+}
+
 WCHAR *ImageDirEngineImpl::GetPageLabel(int pageNo) const
 {
     if (pageNo < 1 || PageCount() < pageNo)
@@ -594,12 +690,32 @@ ImageDirEngine *ImageDirEngine::CreateFromFile(const WCHAR *fileName)
 
 ///// CbxEngine handles comic book files (either .cbz or .cbr) /////
 
+// decoded page images are discarded (least recently used first) once they take
+// up more memory than this, except for the images of CBX_MIN_DECODED_PAGES pages
+#define CBX_MAX_DECODED_MEMORY  (192 * 1024 * 1024)
+#define CBX_MIN_DECODED_PAGES   4
+// number of pages following a loaded page to decode ahead of time
+#define CBX_LOOKAHEAD_PAGES     3
+#define CBX_DECODE_THREADS      2
+
+// size of an image of the given size when decoded at scale (images aren't scaled up)
+static Size ScaledImageSize(RectD size, float scale)
+{
+    if (scale >= 1.0f)
+        return Size((INT)size.dx, (INT)size.dy);
+    return Size((INT)ceil(size.dx * scale), (INT)ceil(size.dy * scale));
+}
+
+class CbxDecodeThread;
+
 class CbxEngineImpl : public ImagesEngine, public CbxEngine, public json::ValueVisitor {
     friend CbxEngine;
+    friend CbxDecodeThread;
 
 public:
-    CbxEngineImpl() : cbzFile(NULL) {
-        InitializeCriticalSection(&fileAccess);
+    CbxEngineImpl() : cbzFile(NULL), lookaheadFrom(0), lookaheadScale(1.0f) {
+        InitializeCriticalSection(&pagesAccess);
+        decodeSemaphore = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
     }
     virtual ~CbxEngineImpl();
 
@@ -623,6 +739,17 @@ public:
     // TODO: return win::GetHwndDpi(HWND_DESKTOP) instead?
     virtual float GetFileDPI() const { return 96.0f; }
 
+    virtual size_t GetMemoryUsage() {
+        ScopedCritSec scope(&pagesAccess);
+        size_t mem = ImagesEngine::GetMemoryUsage();
+        for (size_t i = 0; i < cbrPageLens.Count(); i++) {
+            if (cbrPageData.At(i))
+                mem += cbrPageLens.At(i);
+        }
+        return mem;
+    }
+    virtual void CompactMemory();
+
     // json::ValueVisitor
     virtual bool Visit(const char *path, const char *value, json::DataType type);
 
@@ -633,8 +760,16 @@ protected:
     void ParseComicInfoXml(const char *xmlData);
     bool LoadCbrFile(const WCHAR *fileName);
 
-    virtual Bitmap *LoadImage(int pageNo);
+    virtual Bitmap *LoadImage(int pageNo) { return LoadScaledImage(pageNo, 1.0f); }
+    virtual Bitmap *LoadScaledImage(int pageNo, float scale);
+    virtual void DropImage(int pageNo);
     char *GetImageData(int pageNo, size_t& len);
+    Bitmap *AcquireImage(int pageNo, float scale, bool decodeNow);
+    bool IsDecodedAt(int pageNo, float scale);
+    void MarkRecentlyUsed(int pageNo);
+    void DiscardImages();
+    void QueueLookahead(int pageNo, float scale);
+    void DecodeAhead();
 
     Vec<RectD> mediaboxes;
 
@@ -648,17 +783,64 @@ protected:
     // temporary state needed for extracting metadata
     ScopedMem<WCHAR> propAuthorTmp;
 
-    // used for lazily loading page images (only supported for .cbz files)
-    CRITICAL_SECTION fileAccess;
+    // used for lazily loading page images
     ZipFile *cbzFile;
     Vec<size_t> fileIdxs;
+    // UnRAR can only extract files in archive order (and for solid archives,
+    // that means decompressing all preceding files), so .cbr files are
+    // extracted in a single pass and their (still compressed) images kept
+    Vec<char *> cbrPageData;
+    Vec<size_t> cbrPageLens;
+
+    // guards pages and the following (pages only contains the most
+    // recently used images, which are discarded as needed)
+    CRITICAL_SECTION pagesAccess;
+    // number of LoadImage calls per page not yet followed by DropImage
+    Vec<int> pageRefs;
+    // pages with a decoded image, ordered most recently used first
+    // (images are decoded at the size they're displayed at, so that
+    // they take up less memory, and only re-decoded when zooming in)
+    Vec<int> recentPages;
+    // pages to be decoded by decodeThreads at lookaheadScale, in order of priority
+    Vec<int> lookahead;
+    int lookaheadFrom;
+    float lookaheadScale;
+    HANDLE decodeSemaphore;
+    Vec<CbxDecodeThread *> decodeThreads;
+};
+
+class CbxDecodeThread : public ThreadBase {
+    CbxEngineImpl *engine;
+
+public:
+    CbxDecodeThread(CbxEngineImpl *engine) : ThreadBase("CbxDecodeThread"), engine(engine) { }
+
+    virtual void Run() {
+        while (!WasCancelRequested()) {
+            WaitForSingleObject(engine->decodeSemaphore, INFINITE);
+            if (!WasCancelRequested())
+                engine->DecodeAhead();
+        }
+    }
 };
 
 CbxEngineImpl::~CbxEngineImpl()
 {
+    for (size_t i = 0; i < decodeThreads.Count(); i++) {
+        decodeThreads.At(i)->RequestCancel();
+    }
+    if (decodeThreads.Count() > 0)
+        ReleaseSemaphore(decodeSemaphore, (LONG)decodeThreads.Count(), NULL);
+    for (size_t i = 0; i < decodeThreads.Count(); i++) {
+        decodeThreads.At(i)->Join();
+        delete decodeThreads.At(i);
+    }
+    CloseHandle(decodeSemaphore);
+
     delete cbzFile;
+    FreeVecMembers(cbrPageData);
 
-    DeleteCriticalSection(&fileAccess);
+    DeleteCriticalSection(&pagesAccess);
 }
 
 RectD CbxEngineImpl::PageMediabox(int pageNo)
@@ -667,35 +849,190 @@ RectD CbxEngineImpl::PageMediabox(int pageNo)
     if (!mediaboxes.At(pageNo - 1).IsEmpty())
         return mediaboxes.At(pageNo - 1);
 
-    if (pages.At(pageNo - 1)) {
-        Bitmap *bmp = pages.At(pageNo - 1);
-        mediaboxes.At(pageNo - 1) = RectD(0, 0, bmp->GetWidth(), bmp->GetHeight());
-        return mediaboxes.At(pageNo - 1);
+    // decoded images can't be used, as they might have been scaled down
+    Size size;
+    if (cbzFile) {
+        size_t len;
+        ScopedMem<char> bmpData(GetImageData(pageNo, len));
+        if (bmpData)
+            size = BitmapSizeFromData(bmpData, len);
     }
-
-    size_t len;
-    ScopedMem<char> bmpData(GetImageData(pageNo, len));
-    if (bmpData) {
-        Size size = BitmapSizeFromData(bmpData, len);
-        mediaboxes.At(pageNo - 1) = RectD(0, 0, size.Width, size.Height);
+    else {
+        size = BitmapSizeFromData(cbrPageData.At(pageNo - 1), cbrPageLens.At(pageNo - 1));
     }
+    mediaboxes.At(pageNo - 1) = RectD(0, 0, size.Width, size.Height);
     return mediaboxes.At(pageNo - 1);
 }
 
-Bitmap *CbxEngineImpl::LoadImage(int pageNo)
+Bitmap *CbxEngineImpl::LoadScaledImage(int pageNo, float scale)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
-    if (pages.At(pageNo - 1))
-        return pages.At(pageNo - 1);
+    Bitmap *bmp = AcquireImage(pageNo, scale, false);
+    QueueLookahead(pageNo, scale);
+    return bmp;
+}
+
+void CbxEngineImpl::DropImage(int pageNo)
+{
+    ScopedCritSec scope(&pagesAccess);
+    CrashIf(pageRefs.At(pageNo - 1) <= 0);
+    pageRefs.At(pageNo - 1)--;
+    DiscardImages();
+}
+
+// must be called within pagesAccess
+bool CbxEngineImpl::IsDecodedAt(int pageNo, float scale)
+{
+    Bitmap *bmp = pages.At(pageNo - 1);
+    if (!bmp)
+        return false;
+    Size size = ScaledImageSize(mediaboxes.At(pageNo - 1), scale);
+    return (INT)bmp->GetWidth() >= size.Width && (INT)bmp->GetHeight() >= size.Height;
+}
+
+// returns a page's image decoded at scale or larger (which must be released with DropImage)
+Bitmap *CbxEngineImpl::AcquireImage(int pageNo, float scale, bool decodeNow)
+{
+    {
+        ScopedCritSec scope(&pagesAccess);
+        // an image still in use can't be replaced with a larger one
+        if (IsDecodedAt(pageNo, scale) || (pages.At(pageNo - 1) && pageRefs.At(pageNo - 1) > 0)) {
+            pageRefs.At(pageNo - 1)++;
+            MarkRecentlyUsed(pageNo);
+            return pages.At(pageNo - 1);
+        }
+    }
 
+    // decompress and decode without holding pagesAccess,
+    // so that other pages remain available meanwhile
     size_t len;
     ScopedMem<char> bmpData(GetImageData(pageNo, len));
-    if (bmpData)
-        pages.At(pageNo - 1) = BitmapFromData(bmpData, len);
+    if (!bmpData)
+        return NULL;
+    Size size = BitmapSizeFromData(bmpData, len);
+    Bitmap *bmp = NULL;
+    if (scale < 1.0f && size.Width > 0 && size.Height > 0)
+        bmp = ScaledBitmapFromData(bmpData, len, ScaledImageSize(RectD(0, 0, size.Width, size.Height), scale));
+    if (!bmp)
+        bmp = BitmapFromData(bmpData, len);
+    if (!bmp)
+        return NULL;
+    if (decodeNow) {
+        // GDI+ usually only decodes an image when it's drawn for the first time
+        Rect rc(0, 0, bmp->GetWidth(), bmp->GetHeight());
+        BitmapData data;
+        if (bmp->LockBits(&rc, ImageLockModeRead, bmp->GetPixelFormat(), &data) == Ok)
+            bmp->UnlockBits(&data);
+    }
 
+    ScopedCritSec scope(&pagesAccess);
+    Bitmap *prevBmp = pages.At(pageNo - 1);
+    if (prevBmp && (pageRefs.At(pageNo - 1) > 0 || prevBmp->GetWidth() >= bmp->GetWidth())) {
+        // another thread has been quicker
+        delete bmp;
+    }
+    else {
+        delete prevBmp;
+        pages.At(pageNo - 1) = bmp;
+        if (size.Width > 0 && size.Height > 0)
+            mediaboxes.At(pageNo - 1) = RectD(0, 0, size.Width, size.Height);
+        else
+            mediaboxes.At(pageNo - 1) = RectD(0, 0, bmp->GetWidth(), bmp->GetHeight());
+    }
+    pageRefs.At(pageNo - 1)++;
+    MarkRecentlyUsed(pageNo);
+    DiscardImages();
     return pages.At(pageNo - 1);
 }
 
+// discards all decoded images which aren't currently in use
+void CbxEngineImpl::CompactMemory()
+{
+    ScopedCritSec scope(&pagesAccess);
+    lookahead.Reset();
+    lookaheadFrom = 0;
+    for (size_t i = 0; i < recentPages.Count(); i++) {
+        int pageNo = recentPages.At(i);
+        if (pageRefs.At(pageNo - 1) > 0)
+            continue;
+        delete pages.At(pageNo - 1);
+        pages.At(pageNo - 1) = NULL;
+        recentPages.RemoveAt(i--);
+    }
+}
+
+void CbxEngineImpl::MarkRecentlyUsed(int pageNo)
+{
+    recentPages.Remove(pageNo);
+    recentPages.InsertAt(0, pageNo);
+}
+
+// must be called within pagesAccess
+void CbxEngineImpl::DiscardImages()
+{
+    size_t memory = 0;
+    for (size_t i = 0; i < recentPages.Count(); i++) {
+        int pageNo = recentPages.At(i);
+        Bitmap *bmp = pages.At(pageNo - 1);
+        size_t size = (size_t)bmp->GetWidth() * bmp->GetHeight() * 4;
+        if (i < CBX_MIN_DECODED_PAGES || memory + size <= CBX_MAX_DECODED_MEMORY || pageRefs.At(pageNo - 1) > 0) {
+            memory += size;
+            continue;
+        }
+        delete bmp;
+        pages.At(pageNo - 1) = NULL;
+        recentPages.RemoveAt(i--);
+    }
+}
+
+// decodes the following pages (and the previous one) in the background,
+// so that paging through a comic book doesn't have to wait for decoding
+void CbxEngineImpl::QueueLookahead(int pageNo, float scale)
+{
+    ScopedCritSec scope(&pagesAccess);
+    // RenderCache loads the same page repeatedly while it's displayed
+    if (pageNo == lookaheadFrom && scale == lookaheadScale)
+        return;
+    lookaheadFrom = pageNo;
+    lookaheadScale = scale;
+
+    lookahead.Reset();
+    for (int i = 1; i <= CBX_LOOKAHEAD_PAGES && pageNo + i <= PageCount(); i++) {
+        if (!IsDecodedAt(pageNo + i, scale))
+            lookahead.Append(pageNo + i);
+    }
+    if (pageNo > 1 && !IsDecodedAt(pageNo - 1, scale))
+        lookahead.Append(pageNo - 1);
+    if (lookahead.Count() == 0)
+        return;
+
+    for (size_t i = decodeThreads.Count(); i < CBX_DECODE_THREADS; i++) {
+        CbxDecodeThread *thread = new CbxDecodeThread(this);
+        decodeThreads.Append(thread);
+        thread->Start();
+    }
+    ReleaseSemaphore(decodeSemaphore, (LONG)lookahead.Count(), NULL);
+}
+
+// called by one of the decodeThreads
+void CbxEngineImpl::DecodeAhead()
+{
+    int pageNo;
+    float scale;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (lookahead.Count() == 0)
+            return;
+        pageNo = lookahead.At(0);
+        lookahead.RemoveAt(0);
+        scale = lookaheadScale;
+        if (IsDecodedAt(pageNo, scale))
+            return;
+    }
+    if (AcquireImage(pageNo, scale, true))
+        DropImage(pageNo);
+}
+
 bool CbxEngineImpl::LoadCbzFile(const WCHAR *file)
 {
     if (!file)
@@ -768,6 +1105,7 @@ bool CbxEngineImpl::FinishLoadingCbz()
 
     pages.AppendBlanks(fileIdxs.Count());
     mediaboxes.AppendBlanks(fileIdxs.Count());
+    pageRefs.AppendBlanks(fileIdxs.Count());
 
     return true;
 }
@@ -885,11 +1223,12 @@ WCHAR *CbxEngineImpl::GetProperty(DocumentProperty prop)
 class ImagesPage {
 public:
     ScopedMem<WCHAR>fileName; // for sorting image files
-    Bitmap *        bmp;
+    char *          data;
+    size_t          len;
 
-    ImagesPage(const WCHAR *fileName, Bitmap *bmp) : bmp(bmp),
+    ImagesPage(const WCHAR *fileName, char *data, size_t len) : data(data), len(len),
         fileName(str::Dup(fileName)) { }
-    ~ImagesPage() { delete bmp; }
+    ~ImagesPage() { free(data); }
 
     static int cmpPageByName(const void *o1, const void *o2) {
         ImagesPage *p1 = *(ImagesPage **)o1;
@@ -951,15 +1290,16 @@ static char *LoadCurrentCbrFile(HANDLE hArc, RARHeaderDataEx& rarHeader, size_t
 static ImagesPage *LoadCurrentCbrPage(HANDLE hArc, RARHeaderDataEx& rarHeader)
 {
     size_t bmpDataSize;
-    ScopedMem<char> bmpData(LoadCurrentCbrFile(hArc, rarHeader, &bmpDataSize));
+    char *bmpData = LoadCurrentCbrFile(hArc, rarHeader, &bmpDataSize);
     if (!bmpData)
         return NULL;
-
-    Bitmap *bmp = BitmapFromData(bmpData, bmpDataSize);
-    if (!bmp)
+    // images are only decoded when needed (cf. CbxEngineImpl::AcquireImage)
+    if (!GfxFileExtFromData(bmpData, bmpDataSize)) {
+        free(bmpData);
         return NULL;
+    }
 
-    return new ImagesPage(rarHeader.FileNameW, bmp);
+    return new ImagesPage(rarHeader.FileNameW, bmpData, bmpDataSize);
 }
 
 bool CbxEngineImpl::LoadCbrFile(const WCHAR *file)
@@ -978,7 +1318,7 @@ bool CbxEngineImpl::LoadCbrFile(const WCHAR *file)
         return false;
 
     // UnRAR does not seem to support extracting a single file by name,
-    // so lazy image loading doesn't seem possible
+    // so all images are extracted at once (but only decoded when needed)
 
     Vec<ImagesPage *> found;
     for (;;) {
@@ -1009,10 +1349,13 @@ bool CbxEngineImpl::LoadCbrFile(const WCHAR *file)
     found.Sort(ImagesPage::cmpPageByName);
 
     for (size_t i = 0; i < found.Count(); i++) {
-        pages.Append(found.At(i)->bmp);
-        found.At(i)->bmp = NULL;
+        cbrPageData.Append(found.At(i)->data);
+        cbrPageLens.Append(found.At(i)->len);
+        found.At(i)->data = NULL;
     }
-    mediaboxes.AppendBlanks(pages.Count());
+    pages.AppendBlanks(found.Count());
+    mediaboxes.AppendBlanks(found.Count());
+    pageRefs.AppendBlanks(found.Count());
 
     DeleteVecMembers(found);
     return true;
@@ -1020,9 +1363,12 @@ bool CbxEngineImpl::LoadCbrFile(const WCHAR *file)
 
 char *CbxEngineImpl::GetImageData(int pageNo, size_t& len)
 {
-    if (cbzFile) {
-        ScopedCritSec scope(&fileAccess);
+    // ZipFile allows several decodeThreads to extract images at once
+    if (cbzFile)
         return cbzFile->GetFileDataByIdx(fileIdxs.At(pageNo - 1), &len);
+    if (pageNo <= (int)cbrPageData.Count()) {
+        len = cbrPageLens.At(pageNo - 1);
+        return (char *)memdup(cbrPageData.At(pageNo - 1), len);
     }
     return NULL;
 }
@@ -178,6 +178,7 @@ static MenuDef menuDefHelp[] = {
 static MenuDef menuDefDebug[] = {
     { "Highlight links",                    IDM_DEBUG_SHOW_LINKS,       MF_NO_TRANSLATE },
     { "Toggle PDF/XPS renderer",            IDM_DEBUG_GDI_RENDERER,     MF_NO_TRANSLATE },
+    { "Show render statistics",             IDM_DEBUG_RENDER_STATS,     MF_NO_TRANSLATE },
     { "Toggle ebook UI",                    IDM_DEBUG_EBOOK_UI,         MF_NO_TRANSLATE },
     { "Mui debug paint",                    IDM_DEBUG_MUI,              MF_NO_TRANSLATE },
     { "Annotation from Selection",          IDM_DEBUG_ANNOTATION,       MF_NO_TRANSLATE },
@@ -214,6 +215,13 @@ static MenuDef menuDefContextStart[] = {
     { _TRN("&Remove Document"),             IDM_FORGET_SELECTED_DOCUMENT, MF_REQ_DISK_ACCESS | MF_REQ_PREF_ACCESS },
 };
 
+// menu of the notification area icon of a resident instance
+static MenuDef menuDefTray[] = {
+    { _TRN("&Open..."),                     IDM_OPEN,                   MF_REQ_DISK_ACCESS },
+    { SEP_ITEM,                             0,                          MF_REQ_DISK_ACCESS },
+    { _TRN("E&xit"),                        IDM_EXIT,                   0 },
+};
+
 HMENU BuildMenuFromMenuDef(MenuDef menuDefs[], int menuLen, HMENU menu, int flagFilter)
 {
     assert(menu);
@@ -489,6 +497,7 @@ void MenuUpdateStateForWindow(WindowInfo* win)
 #ifdef SHOW_DEBUG_MENU_ITEMS
     win::menu::SetChecked(win->menu, IDM_DEBUG_SHOW_LINKS, gDebugShowLinks);
     win::menu::SetChecked(win->menu, IDM_DEBUG_GDI_RENDERER, gUseGdiRenderer);
+    win::menu::SetChecked(win->menu, IDM_DEBUG_RENDER_STATS, gDebugShowRenderStats);
     win::menu::SetChecked(win->menu, IDM_DEBUG_EBOOK_UI, gGlobalPrefs->ebookUI.useFixedPageUI);
 #endif
 }
@@ -602,6 +611,24 @@ void OnContextMenu(WindowInfo* win, int x, int y)
     delete pageEl;
 }
 
+void OnTrayIconContextMenu(WindowInfo *win)
+{
+    HMENU popup = BuildMenuFromMenuDef(menuDefTray, dimof(menuDefTray), CreatePopupMenu());
+    AppendRecentFilesToMenu(popup);
+
+    POINT pt;
+    GetCursorPos(&pt);
+    // required for the menu to be dismissed when clicking elsewhere
+    SetForegroundWindow(win->hwndFrame);
+    INT cmd = TrackPopupMenu(popup, TPM_RETURNCMD | TPM_RIGHTBUTTON,
+                             pt.x, pt.y, 0, win->hwndFrame, NULL);
+    PostMessage(win->hwndFrame, WM_NULL, 0, 0);
+    if (cmd)
+        PostMessage(win->hwndFrame, WM_COMMAND, cmd, 0);
+
+    DestroyMenu(popup);
+}
+
 /* Zoom document in window 'hwnd' to zoom level 'zoom'.
    'zoom' is given as a floating-point number, 1.0 is 100%, 2.0 is 200% etc.
 */
@@ -661,8 +688,10 @@ HMENU BuildMenu(WindowInfo *win)
     if (!win->IsCbx())
         filter |= MF_CBX_ONLY;
 
-    HMENU m = CreateMenu();
-    RebuildFileMenu(win, m);
+    // the recently opened files and the external viewers are only added
+    // once the menu is opened (cf. UpdateMenu), so that creating and
+    // updating windows isn't delayed by checking all these files
+    HMENU m = BuildMenuFromMenuDef(menuDefFile, dimof(menuDefFile), CreateMenu(), win->IsChm() ? MF_NOT_FOR_CHM : 0);
     AppendMenu(mainMenu, MF_POPUP | MF_STRING, (UINT_PTR)m, _TR("&File"));
     m = BuildMenuFromMenuDef(menuDefView, dimof(menuDefView), CreateMenu(), filter);
     AppendMenu(mainMenu, MF_POPUP | MF_STRING, (UINT_PTR)m, _TR("&View"));
@@ -674,8 +703,9 @@ HMENU BuildMenu(WindowInfo *win)
     if (HasPermission(Perm_SavePreferences)) {
         // I think it makes sense to disable favorites in restricted mode
         // because they wouldn't be persisted, anyway
+        // the favorites themselves are only added once the menu
+        // is opened (cf. UpdateMenu), so that startup isn't delayed
         m = BuildMenuFromMenuDef(menuDefFavorites, dimof(menuDefFavorites), CreateMenu());
-        RebuildFavMenu(win, m);
         AppendMenu(mainMenu, MF_POPUP | MF_STRING, (UINT_PTR)m, _TR("F&avorites"));
     }
     m = BuildMenuFromMenuDef(menuDefSettings, dimof(menuDefSettings), CreateMenu(), filter);
@@ -703,8 +733,8 @@ HMENU BuildMenu(EbookWindow *win)
     HMENU mainMenu = CreateMenu();
     int filter = MF_NOT_FOR_EBOOK_UI;
 
-    HMENU m = CreateMenu();
-    RebuildFileMenuForEbookUI(m, win);
+    // completed once the menu is opened (cf. UpdateMenu)
+    HMENU m = BuildMenuFromMenuDef(menuDefFile, dimof(menuDefFile), CreateMenu(), filter);
     AppendMenu(mainMenu, MF_POPUP | MF_STRING, (UINT_PTR)m, _TR("&File"));
 
     m = BuildMenuFromMenuDef(menuDefViewEbook, dimof(menuDefViewEbook), CreateMenu(), filter);
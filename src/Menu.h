@@ -33,6 +33,7 @@ HMENU BuildMenu(WindowInfo *win);
 HMENU BuildMenu(EbookWindow *win);
 void  OnContextMenu(WindowInfo* win, int x, int y);
 void  OnAboutContextMenu(WindowInfo* win, int x, int y);
+void  OnTrayIconContextMenu(WindowInfo *win);
 void  OnMenuZoom(WindowInfo* win, UINT menuId);
 void  OnMenuCustomZoom(WindowInfo* win);
 UINT  MenuIdFromVirtualZoom(float virtualZoom);
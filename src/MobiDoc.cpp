@@ -10,6 +10,7 @@
 using namespace Gdiplus;
 #include "GdiPlusUtil.h"
 #include "PalmDbReader.h"
+#include "ThreadUtil.h"
 #include "DebugLog.h"
 
 // Parse mobi format http://wiki.mobileread.com/wiki/MOBI
@@ -201,6 +202,13 @@ class HuffDicDecompressor
 
     Vec<uint32> recursionGuard;
 
+    // dictionary entries which refer to other entries are only expanded once:
+    // the expanded text of entry i is at expanded.Get() + expandedStart.At(i) - 1
+    // with length expandedLen.At(i) (if expandedStart.At(i) is not 0)
+    Vec<uint32>     expandedStart;
+    Vec<uint32>     expandedLen;
+    str::Str<char>  expanded;
+
 public:
     HuffDicDecompressor();
 
@@ -234,14 +242,29 @@ bool HuffDicDecompressor::DecodeOne(uint32 code, str::Str<char>& dst)
     }
 
     if (!(symLen & 0x8000)) {
+        uint32 entry = ((uint32)dict << codeLength) | code;
+        if (0 == expandedStart.Count())
+            expandedStart.AppendBlanks(dictsCount << codeLength);
+        if (expandedStart.At(entry) != 0) {
+            dst.Append(expanded.Get() + expandedStart.At(entry) - 1, expandedLen.At(entry));
+            return true;
+        }
         if (recursionGuard.Contains(code)) {
             lf("infinite recursion");
             return false;
         }
         recursionGuard.Push(code);
+        size_t start = dst.Size();
         if (!Decompress(p, symLen, dst))
             return false;
         recursionGuard.Pop();
+        if (expandedStart.At(entry) == 0 && expanded.Size() < UINT32_MAX / 2) {
+            if (0 == expandedLen.Count())
+                expandedLen.AppendBlanks(dictsCount << codeLength);
+            expandedStart.At(entry) = (uint32)expanded.Size() + 1;
+            expandedLen.At(entry) = (uint32)(dst.Size() - start);
+            expanded.Append(dst.Get() + start, dst.Size() - start);
+        }
     } else {
         symLen &= 0x7fff;
         if (symLen > 127) {
@@ -339,12 +362,8 @@ bool HuffDicDecompressor::SetHuffData(uint8 *huffData, size_t huffDataLen)
     if (huffHdr.baseTableOffset != huffHdr.cacheOffset + kCacheDataLen)
         return false;
     // we conservatively use the big-endian version of the data,
-    for (int i = 0; i < kCacheItemCount; i++) {
-        cacheTable[i] = d.UInt32();
-    }
-    for (int i = 0; i < kBaseTableItemCount; i++) {
-        baseTable[i] = d.UInt32();
-    }
+    d.UInt32Array(cacheTable, kCacheItemCount);
+    d.UInt32Array(baseTable, kBaseTableItemCount);
     CrashIf(d.Offset() != kHuffRecordMinLen);
     return true;
 }
@@ -458,7 +477,7 @@ static bool IsValidCompression(int comprType)
 
 MobiDoc::MobiDoc(const WCHAR *filePath) :
     fileName(str::Dup(filePath)), pdbReader(NULL),
-    docType(Pdb_Unknown), docRecCount(0), compressionType(0), docUncompressedSize(0),
+    docType(Pdb_Unknown), docRecCount(0), docRecSize(0), compressionType(0), docUncompressedSize(0),
     doc(NULL), multibyte(false), trailersCount(0), imageFirstRec(0), coverImageRec(0),
     imagesCount(0), images(NULL), huffDic(NULL), textEncoding(CP_UTF8)
 {
@@ -511,6 +530,7 @@ bool MobiDoc::ParseHeader()
         }
     }
     docRecCount = palmDocHdr.recordsCount;
+    docRecSize = palmDocHdr.maxRecSize;
     docUncompressedSize = palmDocHdr.uncompressedDocSize;
 
     if (kPalmDocHeaderLen == recSize) {
@@ -763,8 +783,9 @@ static size_t GetRealRecordSize(uint8 *recData, size_t recLen, size_t trailersCo
 }
 
 // Load a given record of a document into strOut, uncompressing if necessary.
+// decompressor is the HuffDicDecompressor to use (which isn't thread-safe).
 // Returns false if error.
-bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut)
+bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut, HuffDicDecompressor *decompressor)
 {
     size_t recSize;
     const char *recData = pdbReader->GetRecord(recNo, &recSize);
@@ -784,8 +805,8 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut)
             lf("PalmDoc decompression failed");
         return ok;
     }
-    if (COMPRESSION_HUFF == compressionType && huffDic) {
-        bool ok = huffDic->Decompress((uint8*)recData, recSize, strOut);
+    if (COMPRESSION_HUFF == compressionType && decompressor) {
+        bool ok = decompressor->Decompress((uint8*)recData, recSize, strOut);
         if (!ok)
             lf("HuffDic decompression failed");
         return ok;
@@ -795,6 +816,79 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut)
     return false;
 }
 
+// decompressing the text takes most of the time when loading a large book
+// and each record can be decompressed independently of all others
+#define MIN_RECORDS_PER_THREAD  64
+#define MAX_DECODE_THREADS      4
+
+class MobiDecodeTask : public ThreadPoolTask {
+    MobiDoc *           mb;
+    size_t              startRec, endRec;
+    // each thread needs a decompressor of its own
+    HuffDicDecompressor *huffDic;
+
+public:
+    str::Str<char>      out;
+    bool                ok;
+
+    // the output is preallocated for the records' usual uncompressed size
+    MobiDecodeTask(MobiDoc *mb, size_t startRec, size_t endRec) :
+        mb(mb), startRec(startRec), endRec(endRec),
+        out((endRec - startRec) * mb->docRecSize), ok(false) {
+        huffDic = mb->huffDic ? new HuffDicDecompressor(*mb->huffDic) : NULL;
+    }
+    virtual ~MobiDecodeTask() { delete huffDic; }
+
+    virtual void Run() {
+        for (size_t i = startRec; i < endRec; i++) {
+            if (WasCancelRequested() || !mb->LoadDocRecordIntoBuffer(i, out, huffDic))
+                return;
+        }
+        ok = true;
+    }
+};
+
+// decompresses all records into doc using the thread pool.
+// Returns false if that isn't worth it or if it failed
+bool MobiDoc::LoadDocRecordsConcurrently()
+{
+    if (COMPRESSION_NONE == compressionType)
+        return false;
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    size_t threads = limitValue((size_t)si.dwNumberOfProcessors, (size_t)1, (size_t)MAX_DECODE_THREADS);
+    threads = min(threads, docRecCount / MIN_RECORDS_PER_THREAD);
+    if (threads < 2)
+        return false;
+
+    // the first range is decompressed on this thread straight into doc
+    Vec<MobiDecodeTask *> decoders;
+    TaskGroup decodeTasks;
+    for (size_t i = 1; i < threads; i++) {
+        size_t startRec = 1 + docRecCount * i / threads;
+        size_t endRec = 1 + docRecCount * (i + 1) / threads;
+        MobiDecodeTask *decoder = new MobiDecodeTask(this, startRec, endRec);
+        decoders.Append(decoder);
+        decodeTasks.Queue(decoder);
+    }
+    bool ok = true;
+    size_t firstEndRec = 1 + docRecCount / threads;
+    for (size_t i = 1; i < firstEndRec && ok; i++) {
+        ok = LoadDocRecordIntoBuffer(i, *doc, huffDic);
+    }
+    if (!ok)
+        decodeTasks.RequestCancel();
+    decodeTasks.Wait();
+    for (size_t i = 0; i < decoders.Count(); i++) {
+        ok = ok && decoders.At(i)->ok;
+    }
+    for (size_t i = 0; i < decoders.Count() && ok; i++) {
+        doc->Append(decoders.At(i)->out.Get(), decoders.At(i)->out.Size());
+    }
+    DeleteVecMembers(decoders);
+    return ok;
+}
+
 bool MobiDoc::LoadDocument()
 {
     if (!ParseHeader())
@@ -802,9 +896,14 @@ bool MobiDoc::LoadDocument()
 
     assert(!doc);
     doc = new str::Str<char>(docUncompressedSize);
-    for (size_t i = 1; i <= docRecCount; i++) {
-        if (!LoadDocRecordIntoBuffer(i, *doc))
-            return false;
+    // if decompressing failed (e.g. because a record refers to data decompressed
+    // from a previous record), give decompressing all records sequentially a try
+    if (!LoadDocRecordsConcurrently()) {
+        doc->Reset();
+        for (size_t i = 1; i <= docRecCount; i++) {
+            if (!LoadDocRecordIntoBuffer(i, *doc, huffDic))
+                return false;
+        }
     }
     if (textEncoding != CP_UTF8) {
         char *docUtf8 = str::ToMultiByte(doc->Get(), textEncoding, CP_UTF8);
@@ -14,12 +14,16 @@ enum PdbDocType { Pdb_Unknown, Pdb_Mobipocket, Pdb_PalmDoc, Pdb_TealDoc };
 
 class MobiDoc
 {
+    friend class MobiDecodeThread;
+
     WCHAR *             fileName;
 
     PdbReader *         pdbReader;
 
     PdbDocType          docType;
     size_t              docRecCount;
+    // maximum uncompressed size of a record
+    size_t              docRecSize;
     int                 compressionType;
     size_t              docUncompressedSize;
     int                 textEncoding;
@@ -42,7 +46,8 @@ class MobiDoc
     MobiDoc(const WCHAR *filePath);
 
     bool    ParseHeader();
-    bool    LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut);
+    bool    LoadDocRecordIntoBuffer(size_t recNo, str::Str<char>& strOut, HuffDicDecompressor *decompressor);
+    bool    LoadDocRecordsConcurrently();
     void    LoadImages();
     bool    LoadImage(size_t imageNo);
     bool    LoadDocument();
@@ -12,6 +12,7 @@ class NotificationWnd;
 enum NotificationGroup {
     NG_RESPONSE_TO_ACTION = 1,
     NG_FIND_PROGRESS,
+    NG_FIND_MATCH_COUNT,
     NG_PRINT_PROGRESS,
     NG_PAGE_INFO_HELPER,
     NG_STRESS_TEST_BENCHMARK,
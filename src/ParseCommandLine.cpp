@@ -160,6 +160,9 @@ void CommandLineInfo::ParseCommandLine(WCHAR *cmdLine)
             // in another process
             reuseInstance = (FindWindow(FRAME_CLASS_NAME, 0) != NULL);
         }
+        else if (is_arg("-resident")) {
+            resident = true;
+        }
         else if (is_arg_with_param("-nameddest") || is_arg_with_param("-named-dest")) {
             // -nameddest is for backwards compat (was used pre-1.3)
             // -named-dest is for consistency
@@ -206,6 +209,10 @@ void CommandLineInfo::ParseCommandLine(WCHAR *cmdLine)
             // (used e.g. for embedding it into a browser plugin)
             hwndPluginParent = (HWND)_wtol(argList.At(++n));
         }
+        else if (is_arg_with_param("-plugin-size")) {
+            // -plugin-size <bytes> (for a document that is still being downloaded)
+            pluginFileSize = _wtoi64(argList.At(++n));
+        }
         else if (is_arg_with_param("-stress-test")) {
             // -stress-test <file or dir path> [<file filter>] [<page/file range(s)>] [<cycle count>x]
             // e.g. -stress-test file.pdf 25x  for rendering file.pdf 25 times
@@ -243,6 +250,38 @@ void CommandLineInfo::ParseCommandLine(WCHAR *cmdLine)
             }
             pathsToBenchmark.Push(s);
             exitImmediately = true;
+        }
+        else if (is_arg_with_param("-trace")) {
+            str::ReplacePtr(&tracePath, argList.At(++n));
+        }
+        else if (is_arg_with_param("-bench-output")) {
+            str::ReplacePtr(&benchOutputPath, argList.At(++n));
+        }
+        else if (is_arg_with_param("-bench-suite")) {
+            // -bench-suite <manifest> [<iteration count>x]
+            str::ReplacePtr(&benchSuitePath, argList.At(++n));
+            int num;
+            if (has_additional_param() && str::Parse(additional_param(), L"%dx%$", &num) && num > 0) {
+                benchSuiteIterations = num;
+                n++;
+            }
+            exitImmediately = true;
+        }
+        else if (is_arg("-bench-compare") && argCount > n + 2) {
+            // -bench-compare <old results> <new results>
+            str::ReplacePtr(&benchCompareOld, argList.At(++n));
+            str::ReplacePtr(&benchCompareNew, argList.At(++n));
+            exitImmediately = true;
+        }
+        else if (is_arg_with_param("-stress-concurrent")) {
+            // -stress-concurrent <file or dir> [<seconds>s]
+            str::ReplacePtr(&concurrentStressPath, argList.At(++n));
+            int num;
+            if (has_additional_param() && str::Parse(additional_param(), L"%ds%$", &num) && num > 0) {
+                concurrentStressSecs = num;
+                n++;
+            }
+            exitImmediately = true;
         } else if (is_arg("-crash-on-open")) {
             // to make testing of crash reporting system in pre-release/release
             // builds possible
@@ -15,6 +15,22 @@ public:
     //   to benchmark. It can also be a string "loadonly" which means we'll
     //   only benchmark loading of the catalog
     WStrVec     pathsToBenchmark;
+    // optional file to which to write the benchmark results in a
+    // machine-readable format (CSV for .csv files, JSON otherwise)
+    WCHAR *     benchOutputPath;
+    // manifest of files for -bench-suite and how often to run them
+    WCHAR *     benchSuitePath;
+    int         benchSuiteIterations;
+    // two -bench-suite result files to compare
+    WCHAR *     benchCompareOld;
+    WCHAR *     benchCompareNew;
+    // document(s) to render, search, etc. from several threads at once
+    // for -stress-concurrent and for how many seconds to do so
+    WCHAR *     concurrentStressPath;
+    int         concurrentStressSecs;
+    // file to which to save the timings of hot code paths
+    // (in Chrome's trace event format)
+    WCHAR *     tracePath;
     bool        makeDefault;
     bool        exitWhenDone;
     bool        printDialog;
@@ -27,6 +43,9 @@ public:
     ForwardSearch forwardSearch;
     bool        escToExit;
     bool        reuseInstance;
+    // start in the notification area and stay there
+    // after the last window has been closed (cf. ResidentMode)
+    bool        resident;
     char *      lang;
     WCHAR *     destName;
     int         pageNumber;
@@ -41,6 +60,9 @@ public:
     bool        showConsole;
     HWND        hwndPluginParent;
     WCHAR *     pluginURL;
+    // size of the plugin's document once it's completely downloaded
+    // (only passed while it's still being downloaded)
+    int64       pluginFileSize;
     bool        exitImmediately;
     bool        silent;
     bool        cbxMangaMode;
@@ -55,11 +77,13 @@ public:
 
     bool        crashOnOpen;
 
-    CommandLineInfo() : makeDefault(false), exitWhenDone(false), printDialog(false),
+    CommandLineInfo() : benchOutputPath(NULL), benchSuitePath(NULL), benchSuiteIterations(3),
+        benchCompareOld(NULL), benchCompareNew(NULL), concurrentStressPath(NULL),
+        concurrentStressSecs(10), tracePath(NULL), makeDefault(false), exitWhenDone(false), printDialog(false),
         printerName(NULL), printSettings(NULL), bgColor((COLORREF)-1),
-        escToExit(false), reuseInstance(false), lang(NULL),
+        escToExit(false), reuseInstance(false), resident(false), lang(NULL),
         destName(NULL), pageNumber(-1), inverseSearchCmdLine(NULL),
-        restrictedUse(false), pluginURL(NULL),
+        restrictedUse(false), pluginURL(NULL), pluginFileSize(0),
         enterPresentation(false), enterFullScreen(false), hwndPluginParent(NULL),
         startView(DM_AUTOMATIC), startZoom(INVALID_ZOOM), startScroll(PointI(-1, -1)),
         showConsole(false), exitImmediately(false), silent(false), cbxMangaMode(false),
@@ -78,6 +102,12 @@ public:
     }
 
     ~CommandLineInfo() {
+        free(benchOutputPath);
+        free(benchSuitePath);
+        free(benchCompareOld);
+        free(benchCompareNew);
+        free(concurrentStressPath);
+        free(tracePath);
         free(printerName);
         free(printSettings);
         free(inverseSearchCmdLine);
@@ -10,6 +10,9 @@ extern "C" {
 
 #include "FileUtil.h"
 #include "HtmlPullParser.h"
+#include "RectIndex.h"
+#include "ThreadUtil.h"
+#include "Trace.h"
 #include "TrivialHtmlParser.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
@@ -21,14 +24,63 @@ extern "C" {
 // and displayed; larger files will be kept open while they're displayed
 // so that their content can be loaded on demand in order to preserve memory
 #define MAX_MEMORY_FILE_SIZE (10 * 1024 * 1024)
-
-// number of page content trees to cache for quicker rendering
-#define MAX_PAGE_RUN_CACHE  8
-// maximum estimated memory requirement allowed for the run cache of one document
+// files on slow drives (e.g. network shares) of at least this size are loaded
+// in the background so that the first page can be displayed as soon as possible
+// (the whole file is still loaded into memory, so its size is also limited)
+#define MIN_PROGRESSIVE_FILE_SIZE (1024 * 1024)
+#define MAX_PROGRESSIVE_FILE_SIZE (256 * 1024 * 1024)
+// amount of data to read at once (determines how often the loaded data is updated)
+#define PROGRESSIVE_CHUNK_SIZE (64 * 1024)
+// how long to wait for more data when opening a document that's being loaded
+#define PROGRESSIVE_WAIT_MS 50
+// how long to wait for a file that's still being written to before giving up
+#define GROWING_FILE_TIMEOUT_MS (30 * 1000)
+
+// maximum number of page content trees to cache for quicker rendering
+// (usually, the memory limit below is reached first)
+#define MAX_PAGE_RUN_CACHE  32
+// default for the maximum estimated memory requirement allowed
+// for the run cache of one document (cf. SetDisplayListCacheSize)
 #define MAX_PAGE_RUN_MEMORY (40 * 1024 * 1024)
+// approximate size of a single fz_display_node (for ListInspectionData::mem_estimate)
+#define DISPLAY_NODE_SIZE_EST 200
 
 // maximum amount of memory that MuPDF should use per fz_context store
+// (until StoreBudgets has determined the store's actual budget)
 #define MAX_CONTEXT_MEMORY  (256 * 1024 * 1024)
+// default for the maximum amount of memory that the stores
+// of all open documents may use together (cf. StoreBudgets)
+#define MAX_TOTAL_STORE_MEMORY (512 * 1024 * 1024)
+// minimum budget for the store of a document (however long it's been unused)
+#define MIN_STORE_MEMORY    (4 * 1024 * 1024)
+// fixed store size for documents opened for a thumbnail (cf. CreateThumbnailEngine)
+// which isn't managed by StoreBudgets, as many of these might be open at once
+#define THUMBNAIL_STORE_MEMORY (16 * 1024 * 1024)
+// rendering a thumbnail is aborted if it takes longer than this
+#define THUMBNAIL_RENDER_TIMEOUT_MS 5000
+// fixed store size for the context shared by all documents opened for text
+// extraction (cf. CreateTextEngine)
+#define TEXT_STORE_MEMORY   (32 * 1024 * 1024)
+// default for the maximum amount of memory for rasterized glyphs per document
+// (MuPDF's own default of 1 MB is too small for text heavy pages at high zoom)
+#define MAX_GLYPH_CACHE_MEMORY (8 * 1024 * 1024)
+
+// bitmaps of at least this many pixels are rasterized in horizontal bands
+// by several threads at once (cf. PdfEngineImpl::RenderPageRun)
+#define MIN_BANDING_PIXELS  (1024 * 1024)
+// bands are at least this many pixels high
+#define MIN_BAND_HEIGHT     128
+// maximum number of threads to rasterize a single bitmap with
+#define MAX_RENDER_BANDS    8
+
+// images which have to be composited with the page for copying them
+// are rendered at most at this size (cf. PdfEngineImpl::GetPageImage)
+#define MAX_IMAGE_PIXELS    (16 * 1024 * 1024)
+
+// content boxes are cached per page and RenderTarget (as running a page
+// through a bbox device is about as expensive as rendering it)
+#define CONTENT_BOX_TARGETS (Target_Export + 1)
+#define CONTENT_BOX_IX(pageNo, target) (((pageNo) - 1) * CONTENT_BOX_TARGETS + (target))
 
 // when set, always uses GDI+ for rendering (else GDI+ is only used for
 // zoom levels above 4000% and for rendering directly into an HDC)
@@ -39,6 +91,20 @@ void DebugGdiPlusDevice(bool enable)
     gDebugGdiPlusDevice = enable;
 }
 
+static size_t gMaxPageRunMemory = MAX_PAGE_RUN_MEMORY;
+
+void SetDisplayListCacheSize(int maxMemoryMB)
+{
+    gMaxPageRunMemory = maxMemoryMB > 0 ? (size_t)maxMemoryMB * 1024 * 1024 : MAX_PAGE_RUN_MEMORY;
+}
+
+static int gMaxGlyphCacheMemory = MAX_GLYPH_CACHE_MEMORY;
+
+void SetGlyphCacheSize(int maxMemoryMB)
+{
+    gMaxGlyphCacheMemory = 0 < maxMemoryMB && maxMemoryMB < 1024 ? maxMemoryMB * 1024 * 1024 : MAX_GLYPH_CACHE_MEMORY;
+}
+
 void CalcMD5Digest(const unsigned char *data, size_t byteCount, unsigned char digest[16])
 {
     fz_md5 md5;
@@ -51,6 +117,56 @@ void CalcMD5Digest(const unsigned char *data, size_t byteCount, unsigned char di
     fz_md5_final(&md5, digest);
 }
 
+#define FILE_FINGERPRINT_RANGE (64 * 1024)
+
+bool CalcFileFingerprint(const WCHAR *filePath, unsigned char digest[16])
+{
+    ScopedHandle h(CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (INVALID_HANDLE_VALUE == h)
+        return false;
+    LARGE_INTEGER size;
+    FILETIME modified;
+    if (!GetFileSizeEx(h, &size) || !GetFileTime(h, NULL, NULL, &modified))
+        return false;
+    ScopedMem<unsigned char> buf((unsigned char *)malloc(FILE_FINGERPRINT_RANGE));
+    if (!buf)
+        return false;
+
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    fz_md5_update(&md5, (unsigned char *)&size, sizeof(size));
+    fz_md5_update(&md5, (unsigned char *)&modified, sizeof(modified));
+    int64 ranges[2][2] = {
+        { 0, min(size.QuadPart, FILE_FINGERPRINT_RANGE) },
+        { max(FILE_FINGERPRINT_RANGE, size.QuadPart - FILE_FINGERPRINT_RANGE), size.QuadPart }
+    };
+    for (size_t i = 0; i < dimof(ranges); i++) {
+        DWORD len = ranges[i][1] > ranges[i][0] ? (DWORD)(ranges[i][1] - ranges[i][0]) : 0;
+        if (0 == len)
+            continue;
+        LARGE_INTEGER start;
+        start.QuadPart = ranges[i][0];
+        DWORD read;
+        if (!SetFilePointerEx(h, start, NULL, FILE_BEGIN) || !ReadFile(h, buf, len, &read, NULL) || read != len)
+            return false;
+        fz_md5_update(&md5, buf, len);
+    }
+    fz_md5_final(&md5, digest);
+    return true;
+}
+
+// Windows keeps track of how often threads had to wait for a critical section
+// (for BenchLockContention), however not on Windows 8 and later (by default)
+static bool GetContentionCount(CRITICAL_SECTION *cs, int *waits)
+{
+    RTL_CRITICAL_SECTION_DEBUG *info = cs->DebugInfo;
+    if (!info || (RTL_CRITICAL_SECTION_DEBUG *)-1 == info)
+        return false;
+    *waits = (int)info->ContentionCount;
+    return true;
+}
+
 ///// extensions to Fitz that are usable for both PDF and XPS /////
 
 inline RectD fz_rect_to_RectD(fz_rect rect)
@@ -78,6 +194,38 @@ inline float fz_calc_overlap(fz_rect r1, fz_rect r2)
     return (isect.x1 - isect.x0) * (isect.y1 - isect.y0) / ((r1.x1 - r1.x0) * (r1.y1 - r1.y0));
 }
 
+// pixmaps for rendering into should be created with fz_new_gdi_pixmap so that
+// new_rendered_fz_pixmap can take over their samples without copying them
+static fz_pixmap *fz_new_gdi_pixmap(fz_context *ctx, const fz_irect *bbox)
+{
+    size_t w = bbox->x1 - bbox->x0, h = bbox->y1 - bbox->y0;
+    unsigned char *samples = NULL;
+    if (w < INT_MAX / 4 && h < INT_MAX / 4 / max(w, (size_t)1))
+        samples = (unsigned char *)malloc(w * h * 4);
+    if (!samples)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "OOM in fz_new_gdi_pixmap");
+    fz_pixmap *pixmap = NULL;
+    fz_try(ctx) {
+        pixmap = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), bbox, samples);
+    }
+    fz_catch(ctx) {
+        free(samples);
+        fz_rethrow(ctx);
+    }
+    return pixmap;
+}
+
+static void fz_drop_gdi_pixmap(fz_context *ctx, fz_pixmap *pixmap)
+{
+    if (!pixmap)
+        return;
+    // the samples are NULL if they've been taken over by a RenderedBitmap
+    unsigned char *samples = pixmap->samples;
+    fz_drop_pixmap(ctx, pixmap);
+    free(samples);
+}
+
+// note: takes over the samples of pixmaps created with fz_new_gdi_pixmap
 static RenderedBitmap *new_rendered_fz_pixmap(fz_context *ctx, fz_pixmap *pixmap)
 {
     int paletteSize = 0;
@@ -86,8 +234,12 @@ static RenderedBitmap *new_rendered_fz_pixmap(fz_context *ctx, fz_pixmap *pixmap
     int w = pixmap->w;
     int h = pixmap->h;
     int rows8 = ((w + 3) / 4) * 4;
+    bool isBgr = pixmap->colorspace == fz_device_bgr(ctx);
+    bool isGdiPixmap = isBgr && !pixmap->free_samples;
 
     BITMAPINFO *bmi = (BITMAPINFO *)calloc(1, sizeof(BITMAPINFOHEADER) + 256 * sizeof(RGBQUAD));
+    if (!bmi)
+        return NULL;
 
     // always try to produce an 8-bit palette for saving some memory
     unsigned char *bmpData = (unsigned char *)calloc(rows8, h);
@@ -95,9 +247,8 @@ static RenderedBitmap *new_rendered_fz_pixmap(fz_context *ctx, fz_pixmap *pixmap
         free(bmi);
         return NULL;
     }
-    fz_pixmap *bgrPixmap = NULL;
     if (bmpData && pixmap->n == 4 &&
-        pixmap->colorspace == fz_device_rgb(ctx)) {
+        (pixmap->colorspace == fz_device_rgb(ctx) || isBgr)) {
         unsigned char *dest = bmpData;
         unsigned char *source = pixmap->samples;
 
@@ -105,10 +256,10 @@ static RenderedBitmap *new_rendered_fz_pixmap(fz_context *ctx, fz_pixmap *pixmap
             for (int i = 0; i < w; i++) {
                 RGBQUAD c = { 0 };
 
-                c.rgbRed = *source++;
-                c.rgbGreen = *source++;
-                c.rgbBlue = *source++;
-                source++;
+                c.rgbRed = source[isBgr ? 2 : 0];
+                c.rgbGreen = source[1];
+                c.rgbBlue = source[isBgr ? 0 : 2];
+                source += 4;
 
                 /* find this color in the palette */
                 int k;
@@ -133,18 +284,32 @@ ProducingPaletteDone:
     if (!hasPalette) {
         free(bmpData);
         /* BGRA is a GDI compatible format */
-        fz_try(ctx) {
-            fz_irect bbox;
-            fz_colorspace *colorspace = fz_device_bgr(ctx);
-            bgrPixmap = fz_new_pixmap_with_bbox(ctx, colorspace, fz_pixmap_bbox(ctx, pixmap, &bbox));
-            fz_convert_pixmap(ctx, bgrPixmap, pixmap);
+        if (isGdiPixmap) {
+            bmpData = pixmap->samples;
+            pixmap->samples = NULL;
         }
-        fz_catch(ctx) {
-            free(bmi);
-            return NULL;
+        else {
+            bmpData = (unsigned char *)malloc(w * h * 4);
+            fz_pixmap *bgrPixmap = NULL;
+            fz_var(bgrPixmap);
+            fz_try(ctx) {
+                if (!bmpData)
+                    fz_throw(ctx, FZ_ERROR_GENERIC, "OOM in new_rendered_fz_pixmap");
+                fz_irect bbox;
+                bgrPixmap = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), fz_pixmap_bbox(ctx, pixmap, &bbox), bmpData);
+                fz_convert_pixmap(ctx, bgrPixmap, pixmap);
+            }
+            fz_catch(ctx) {
+                free(bmpData);
+                bmpData = NULL;
+            }
+            fz_drop_pixmap(ctx, bgrPixmap);
+            if (!bmpData) {
+                free(bmi);
+                return NULL;
+            }
         }
     }
-    AssertCrash(hasPalette || bgrPixmap);
 
     bmi->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
     bmi->bmiHeader.biWidth = w;
@@ -155,20 +320,121 @@ ProducingPaletteDone:
     bmi->bmiHeader.biSizeImage = h * (hasPalette ? rows8 : w * 4);
     bmi->bmiHeader.biClrUsed = hasPalette ? paletteSize : 0;
 
-    HDC hDC = GetDC(NULL);
-    HBITMAP hbmp = CreateDIBitmap(hDC, &bmi->bmiHeader, CBM_INIT,
-        hasPalette ? bmpData : bgrPixmap->samples, bmi, DIB_RGB_COLORS);
-    ReleaseDC(NULL, hDC);
+    // the HBITMAP is only created if it's actually needed
+    return new RenderedBitmap(bmi, bmpData, SizeI(w, h));
+}
 
-    if (hasPalette)
-        free(bmpData);
-    else
-        fz_drop_pixmap(ctx, bgrPixmap);
-    free(bmi);
+// a read-only view of a file which is shared by all streams
+// opened for it (i.e. also by the streams of all engine clones)
+struct MappedFile {
+    LONG refs;
+    HANDLE hMap;
+    unsigned char *data;
+    int len;
+};
+
+extern "C" static int read_mapped(fz_stream *stm, unsigned char *buf, int len)
+{
+    // all data is always available between stm->bp and stm->ep
+    return 0;
+}
+
+// cf. seek_buffer in stream-open.c
+extern "C" static void seek_mapped(fz_stream *stm, int offset, int whence)
+{
+    if (0 == whence)
+        stm->rp = stm->bp + offset;
+    else if (1 == whence)
+        stm->rp += offset;
+    else if (2 == whence)
+        stm->rp = stm->ep - offset;
+    stm->rp = (unsigned char *)fz_clampp(stm->rp, stm->bp, stm->ep);
+    stm->wp = stm->ep;
+}
+
+extern "C" static void close_mapped(fz_context *ctx, void *state)
+{
+    MappedFile *mf = (MappedFile *)state;
+    if (InterlockedDecrement(&mf->refs) > 0)
+        return;
+    UnmapViewOfFile(mf->data);
+    CloseHandle(mf->hMap);
+    free(mf);
+}
+
+static fz_stream *fz_open_mapped(fz_context *ctx, MappedFile *mf);
+
+extern "C" static fz_stream *reopen_mapped(fz_context *ctx, fz_stream *stm)
+{
+    return fz_open_mapped(ctx, (MappedFile *)stm->state);
+}
+
+static bool fz_is_mapped_stream(fz_stream *stm)
+{
+    return stm->reopen == reopen_mapped;
+}
+
+static fz_stream *fz_open_mapped(fz_context *ctx, MappedFile *mf)
+{
+    fz_stream *stm = fz_new_stream(ctx, mf, read_mapped, close_mapped, NULL);
+    InterlockedIncrement(&mf->refs);
+    stm->seek = seek_mapped;
+    stm->reopen = reopen_mapped;
+
+    stm->bp = stm->rp = mf->data;
+    stm->wp = stm->ep = mf->data + mf->len;
+    stm->pos = mf->len;
+
+    return stm;
+}
+
+// memory maps a file, so that reading from it requires neither system calls
+// nor copying into the stream's buffer (returns NULL if mapping fails, e.g.
+// due to a lack of address space)
+static fz_stream *fz_open_file_mapped(fz_context *ctx, const WCHAR *filePath)
+{
+    // allow other programs to still modify and delete the file
+    ScopedHandle hFile(CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (INVALID_HANDLE_VALUE == hFile)
+        return NULL;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0 || size.QuadPart > INT_MAX)
+        return NULL;
+
+    // the mapping keeps the file open as long as it's needed
+    MappedFile *mf = AllocStruct<MappedFile>();
+    if (!mf)
+        return NULL;
+    mf->len = (int)size.QuadPart;
+    mf->hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mf->hMap)
+        mf->data = (unsigned char *)MapViewOfFile(mf->hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!mf->data) {
+        if (mf->hMap)
+            CloseHandle(mf->hMap);
+        free(mf);
+        return NULL;
+    }
 
-    if (!hbmp)
+    fz_stream *stm = NULL;
+    fz_try(ctx) {
+        stm = fz_open_mapped(ctx, mf);
+    }
+    fz_catch(ctx) {
+        UnmapViewOfFile(mf->data);
+        CloseHandle(mf->hMap);
+        free(mf);
         return NULL;
-    return new RenderedBitmap(hbmp, SizeI(pixmap->w, pixmap->h));
+    }
+    return stm;
+}
+
+static bool gMemoryMapLargeFiles = false;
+
+void SetMemoryMapLargeFiles(bool enable)
+{
+    gMemoryMapLargeFiles = enable;
 }
 
 fz_stream *fz_open_file2(fz_context *ctx, const WCHAR *filePath)
@@ -192,6 +458,15 @@ fz_stream *fz_open_file2(fz_context *ctx, const WCHAR *filePath)
         if (file)
             return file;
     }
+    // if requested, larger local files are memory mapped, as they're usually read in many
+    // small pieces (files on network shares aren't, as reading them could fail at any time);
+    // this is opt-in because mapped files can't be overwritten by other programs (e.g.
+    // pdflatex) while they're open, which would break reloading modified documents
+    if (gMemoryMapLargeFiles && path::IsOnFixedDrive(filePath)) {
+        file = fz_open_file_mapped(ctx, filePath);
+        if (file)
+            return file;
+    }
 
     fz_try(ctx) {
         file = fz_open_file_w(ctx, filePath);
@@ -202,6 +477,84 @@ fz_stream *fz_open_file2(fz_context *ctx, const WCHAR *filePath)
     return file;
 }
 
+// path of the file most recently loaded completely by a ProgressiveFileLoader:
+// that document is usually reloaded right afterwards (cf. BaseEngine::IsStillLoading)
+// which doesn't have to happen progressively again, as the file's content is then
+// most likely in the system's file cache
+static WCHAR *gLastProgressiveFile = NULL;
+// a file that's still being written to (cf. PdfEngine::SetFileStillGrowing)
+static WCHAR *gGrowingFilePath = NULL;
+static int64 gGrowingFileSize = 0;
+
+// reads a file into memory in the background, so that linearized documents can
+// already be parsed and displayed while the remainder is still loading
+// (cf. fz_open_buffer_progressive)
+class ProgressiveFileLoader : public ThreadBase {
+    ScopedMem<WCHAR> filePath;
+    // the data buffer is owned by the engine and the stream reading from it
+    unsigned char *data;
+    int length;
+    // the file is still being written to (and is shorter than length)
+    bool growing;
+
+    // the completed file is reloaded the usual way, which fails
+    // for as long as the writer still has the file open
+    void WaitForWriter() {
+        for (DWORD start = GetTickCount(); GetTickCount() - start < GROWING_FILE_TIMEOUT_MS && !WasCancelRequested(); ) {
+            ScopedHandle h(file::OpenReadOnly(filePath));
+            if (h != INVALID_HANDLE_VALUE)
+                break;
+            Sleep(PROGRESSIVE_WAIT_MS);
+        }
+    }
+
+public:
+    // number of bytes read so far or -1 after a read error
+    LONG available;
+
+    ProgressiveFileLoader(const WCHAR *filePath, fz_buffer *buf, bool growing=false) :
+        ThreadBase("ProgressiveFileLoader"), filePath(str::Dup(filePath)),
+        data(buf->data), length(buf->len), growing(growing), available(0) { }
+
+    bool IsComplete() const { return available == length; }
+    bool HasFailed() const { return available < 0; }
+
+    virtual void Run() {
+        // a file that's being written to can't be opened with file::OpenReadOnly
+        ScopedHandle h(CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | (growing ? FILE_SHARE_WRITE : 0),
+                                  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+        bool ok = h != INVALID_HANDLE_VALUE;
+        DWORD lastReadTime = GetTickCount();
+        for (int offset = 0; ok && offset < length && !WasCancelRequested(); ) {
+            DWORD read = 0;
+            DWORD toRead = (DWORD)min(length - offset, PROGRESSIVE_CHUNK_SIZE);
+            ok = ReadFile(h, data + offset, toRead, &read, NULL);
+            if (ok && 0 == read && growing) {
+                // wait for more data to be written (unless the writer has given up)
+                ok = GetTickCount() - lastReadTime < GROWING_FILE_TIMEOUT_MS;
+                Sleep(PROGRESSIVE_WAIT_MS);
+                continue;
+            }
+            ok = ok && read > 0;
+            if (ok) {
+                offset += read;
+                lastReadTime = GetTickCount();
+                if (growing && offset == length)
+                    WaitForWriter();
+                InterlockedExchange(&available, offset);
+            }
+        }
+        if (!ok)
+            InterlockedExchange(&available, -1);
+        // after a read error, the document is to be reloaded the usual way as well
+        if (!WasCancelRequested())
+            free(InterlockedExchangePointer((void **)&gLastProgressiveFile, str::Dup(filePath)));
+    }
+};
+
+// size of the chunks fz_copy_stream_to_file reads and writes at a time
+#define STREAM_COPY_CHUNK_SIZE (1 << 20)
+
 unsigned char *fz_extract_stream_data(fz_stream *stream, size_t *cbCount)
 {
     fz_seek(stream, 0, 2);
@@ -222,6 +575,63 @@ unsigned char *fz_extract_stream_data(fz_stream *stream, size_t *cbCount)
     return data;
 }
 
+// same as fz_extract_stream_data followed by file::WriteAll, except that
+// the data is copied in chunks instead of being loaded into memory at once
+bool fz_copy_stream_to_file(fz_stream *stream, const WCHAR *filePath)
+{
+    ScopedHandle h(CreateFile(filePath, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (INVALID_HANDLE_VALUE == h)
+        return false;
+
+    ScopedMem<unsigned char> buf((unsigned char *)malloc(STREAM_COPY_CHUNK_SIZE));
+    if (!buf)
+        return false;
+
+    bool ok = true;
+    fz_try(stream->ctx) {
+        fz_seek(stream, 0, 0);
+        for (;;) {
+            int read = fz_read(stream, buf, STREAM_COPY_CHUNK_SIZE);
+            if (read <= 0)
+                break;
+            DWORD written;
+            if (!WriteFile(h, buf, read, &written, NULL) || written != (DWORD)read) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    fz_catch(stream->ctx) {
+        ok = false;
+    }
+    return ok;
+}
+
+// same as fz_copy_stream_to_file, except that filePath may also be the file
+// that the stream reads from (srcFilePath), which mustn't be truncated before
+// all of it has been read (e.g. when saving annotations into the document)
+static bool fz_copy_stream_to_file_safe(fz_stream *stream, const WCHAR *filePath, const WCHAR *srcFilePath)
+{
+    if (!srcFilePath || !path::IsSame(srcFilePath, filePath))
+        return fz_copy_stream_to_file(stream, filePath);
+
+    ScopedMem<WCHAR> tmpPath(path::GetTempPath(L"sum"));
+    if (!tmpPath)
+        return false;
+    if (!fz_copy_stream_to_file(stream, tmpPath)) {
+        file::Delete(tmpPath);
+        return false;
+    }
+    // replacing the document fails while it's open without FILE_SHARE_DELETE,
+    // in which case it's overwritten in place (which is safe now that it's been copied)
+    if (MoveFileEx(tmpPath, filePath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED))
+        return true;
+    bool ok = CopyFile(tmpPath, filePath, FALSE);
+    file::Delete(tmpPath);
+    return ok;
+}
+
 void fz_stream_fingerprint(fz_stream *file, unsigned char digest[16])
 {
     int fileLen = -1;
@@ -246,6 +656,28 @@ void fz_stream_fingerprint(fz_stream *file, unsigned char digest[16])
     fz_drop_buffer(file->ctx, buffer);
 }
 
+// same as fz_text_char_bbox, except that the ascender and descender vectors
+// (which are the same for all characters of a span) are only transformed once
+static RectI fz_text_char_bbox_fast(fz_text_span *span, fz_text_char *c, const fz_point& asc, const fz_point& desc)
+{
+    const fz_point& max = c + 1 < span->text + span->len ? c[1].p : span->max;
+    fz_point pts[3] = {
+        { max.x + asc.x, max.y + asc.y },
+        { c->p.x + desc.x, c->p.y + desc.y },
+        { max.x + desc.x, max.y + desc.y },
+    };
+    fz_rect bbox;
+    bbox.x0 = bbox.x1 = c->p.x + asc.x;
+    bbox.y0 = bbox.y1 = c->p.y + asc.y;
+    for (size_t i = 0; i < dimof(pts); i++) {
+        bbox.x0 = min(bbox.x0, pts[i].x);
+        bbox.x1 = max(bbox.x1, pts[i].x);
+        bbox.y0 = min(bbox.y0, pts[i].y);
+        bbox.y1 = max(bbox.y1, pts[i].y);
+    }
+    return fz_rect_to_RectD(bbox).Round();
+}
+
 WCHAR *fz_text_page_to_str(fz_text_page *text, WCHAR *lineSep, RectI **coords_out=NULL)
 {
     size_t lineSepLen = str::Len(lineSep);
@@ -280,6 +712,9 @@ WCHAR *fz_text_page_to_str(fz_text_page *text, WCHAR *lineSep, RectI **coords_ou
             continue;
         for (fz_text_line *line = block->u.text->lines; line < block->u.text->lines + block->u.text->len; line++) {
             for (fz_text_span *span = line->first_span; span; span = span->next) {
+                fz_point asc = { 0, span->ascender_max }, desc = { 0, span->descender_min };
+                fz_transform_vector(&asc, &span->transform);
+                fz_transform_vector(&desc, &span->transform);
                 for (fz_text_char *c = span->text; c < span->text + span->len; c++) {
                     *dest = c->c;
                     if (*dest <= 32) {
@@ -292,11 +727,8 @@ WCHAR *fz_text_page_to_str(fz_text_page *text, WCHAR *lineSep, RectI **coords_ou
                             continue;
                     }
                     dest++;
-                    if (destRect) {
-                        fz_rect bbox;
-                        fz_text_char_bbox(&bbox, span, c - span->text);
-                        *destRect++ = fz_rect_to_RectD(bbox).Round();
-                    }
+                    if (destRect)
+                        *destRect++ = fz_text_char_bbox_fast(span, c, asc, desc);
                 }
                 if (span->len > 0 && span->next && dest > content && *dest != ' ') {
                     // TODO: use a Tab instead? (this might be a table)
@@ -599,9 +1031,10 @@ public:
 struct FitzImagePos {
     fz_image *image;
     fz_rect rect;
+    float alpha;
 
-    FitzImagePos(fz_image *image=NULL, fz_rect rect=fz_unit_rect) :
-        image(image), rect(rect) { }
+    FitzImagePos(fz_image *image=NULL, fz_rect rect=fz_unit_rect, float alpha=1.0f) :
+        image(image), rect(rect), alpha(alpha) { }
 };
 
 struct ListInspectionData {
@@ -631,18 +1064,28 @@ static void fz_inspection_handle_path(fz_device *dev, fz_path *path, bool clippi
         data->path_len += path->cmd_len + path->coord_len;
     else
         data->clip_path_len += path->cmd_len + path->coord_len;
-    data->mem_estimate += sizeof(fz_path) + path->cmd_cap + path->coord_cap * sizeof(float);
+    data->mem_estimate += DISPLAY_NODE_SIZE_EST + sizeof(fz_path) + path->cmd_cap + path->coord_cap * sizeof(float);
 }
 
 static void fz_inspection_handle_text(fz_device *dev, fz_text *text)
 {
-    ((ListInspectionData *)dev->user)->req_t3_fonts = text->font->t3procs != NULL;
+    ListInspectionData *data = (ListInspectionData *)dev->user;
+    if (text->font->t3procs)
+        data->req_t3_fonts = true;
+    data->mem_estimate += DISPLAY_NODE_SIZE_EST + sizeof(fz_text) + text->cap * sizeof(fz_text_item);
+}
+
+static size_t fz_compressed_buffer_size(fz_compressed_buffer *buffer)
+{
+    return buffer && buffer->buffer ? buffer->buffer->cap : 0;
 }
 
 static void fz_inspection_handle_image(fz_device *dev, fz_image *image)
 {
+    // the decoded image will also be kept in the store while the page is rendered
     int n = image->colorspace ? image->colorspace->n + 1 : 1;
-    ((ListInspectionData *)dev->user)->mem_estimate += sizeof(fz_image) + image->w * image->h * n;
+    ((ListInspectionData *)dev->user)->mem_estimate += DISPLAY_NODE_SIZE_EST + sizeof(fz_image) +
+        fz_compressed_buffer_size(image->buffer) + image->w * image->h * n;
 }
 
 extern "C" static void
@@ -696,7 +1139,8 @@ fz_inspection_clip_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *s
 extern "C" static void
 fz_inspection_fill_shade(fz_device *dev, fz_shade *shade, const fz_matrix *ctm, float alpha)
 {
-    ((ListInspectionData *)dev->user)->mem_estimate += sizeof(fz_shade);
+    ((ListInspectionData *)dev->user)->mem_estimate += DISPLAY_NODE_SIZE_EST + sizeof(fz_shade) +
+        fz_compressed_buffer_size(shade->buffer);
 }
 
 extern "C" static void
@@ -710,7 +1154,7 @@ fz_inspection_fill_image(fz_device *dev, fz_image *image, const fz_matrix *ctm,
     fz_rect rect = fz_unit_rect;
     fz_transform_rect(&rect, ctm);
     if (!fz_is_empty_rect(&rect))
-        ((ListInspectionData *)dev->user)->images->Append(FitzImagePos(image, rect));
+        ((ListInspectionData *)dev->user)->images->Append(FitzImagePos(image, rect, alpha));
 }
 
 extern "C" static void
@@ -748,6 +1192,31 @@ static fz_device *fz_new_inspection_device(fz_context *ctx, ListInspectionData *
     return dev;
 }
 
+// returns the index of the page run to drop in order to remain within the
+// cache's limits (or -1): the larger and the less recently used a run,
+// the sooner it's dropped (the most recently used one is always kept)
+template <typename PageRun>
+static int GetPageRunToDrop(Vec<PageRun *>& runCache)
+{
+    size_t mem = 0;
+    for (size_t i = 0; i < runCache.Count(); i++) {
+        mem += runCache.At(i)->size_est;
+    }
+    if (runCache.Count() <= MAX_PAGE_RUN_CACHE && mem <= gMaxPageRunMemory)
+        return -1;
+
+    int dropIdx = -1;
+    double maxScore = 0;
+    for (size_t i = 1; i < runCache.Count(); i++) {
+        double score = (double)(runCache.At(i)->size_est + 1) * (i + 1);
+        if (score > maxScore) {
+            dropIdx = (int)i;
+            maxScore = score;
+        }
+    }
+    return dropIdx;
+}
+
 class FitzAbortCookie : public AbortCookie {
 public:
     fz_cookie cookie;
@@ -778,13 +1247,15 @@ fz_unlock_context_cs(void *user, int lock)
     LeaveCriticalSection(cs);
 }
 
-static Vec<PageAnnotation> fz_get_user_page_annots(Vec<PageAnnotation>& userAnnots, int pageNo)
+static Vec<PageAnnotation> fz_get_user_page_annots(Vec<PageAnnotation>& userAnnots, int pageNo, bool skipHighlights=false)
 {
     Vec<PageAnnotation> result;
     for (size_t i = 0; i < userAnnots.Count(); i++) {
         PageAnnotation& annot = userAnnots.At(i);
         if (annot.pageNo != pageNo)
             continue;
+        if (skipHighlights && Annot_Highlight == annot.type)
+            continue;
         // include all annotations for pageNo that can be rendered by fz_run_user_annots
         switch (annot.type) {
         case Annot_Highlight: case Annot_Underline: case Annot_StrikeOut: case Annot_Squiggly:
@@ -999,58 +1470,150 @@ void BuildPageLabelRec(pdf_obj *node, int pageCount, Vec<PageLabelInfo>& data)
     }
 }
 
-WStrVec *BuildPageLabelVec(pdf_obj *root, int pageCount)
-{
-    Vec<PageLabelInfo> data;
-    BuildPageLabelRec(root, pageCount, data);
-    data.Sort(CmpPageLabelInfo);
+/* Page labels are kept as the PDF's ranges and formatted when needed, so that
+   documents with many pages don't need a string per page. The few labels which
+   have to be made unique are stored explicitly and a hash table from labels to
+   page numbers allows for fast reverse lookups. */
+class PdfPageLabels {
+    struct Range {
+        int startAt, countFrom;
+        char *type;
+        WCHAR *prefix;
+    };
+    struct UniqueLabel {
+        int pageNo;
+        WCHAR *label;
+    };
 
-    if (data.Count() == 0)
-        return NULL;
+    // sorted by startAt
+    Vec<Range> ranges;
+    // sorted by pageNo
+    Vec<UniqueLabel> uniqueLabels;
+    // open addressing hash table of page numbers (0 for empty slots)
+    Vec<int> index;
+    int pageCount;
+
+    PdfPageLabels(int pageCount) : pageCount(pageCount) { }
+
+    // the label as described by the PDF document (which might not be unique)
+    WCHAR *FormatLabel(int pageNo) const {
+        size_t lo = 0, hi = ranges.Count();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (ranges.At(mid).startAt <= pageNo)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (0 == lo)
+            return str::Dup(L"");
+        const Range& range = ranges.At(lo - 1);
+        return FormatPageLabel(range.type, range.countFrom + pageNo - range.startAt, range.prefix);
+    }
 
-    if (data.Count() == 1 && data.At(0).startAt == 1 && data.At(0).countFrom == 1 &&
-        !data.At(0).prefix && str::Eq(data.At(0).type, "D")) {
-        // this is the default case, no need for special treatment
-        return NULL;
+    static uint32_t Hash(const WCHAR *label) {
+        return MurmurHash2(label, str::Len(label) * sizeof(WCHAR));
     }
 
-    WStrVec *labels = new WStrVec();
-    labels->AppendBlanks(pageCount);
+    // returns the index slot for label (either containing its page or empty)
+    size_t FindSlot(const WCHAR *label) const {
+        size_t mask = index.Count() - 1;
+        for (size_t slot = Hash(label) & mask; ; slot = (slot + 1) & mask) {
+            if (!index.At(slot))
+                return slot;
+            ScopedMem<WCHAR> other(GetLabel(index.At(slot)));
+            if (str::Eq(other, label))
+                return slot;
+        }
+    }
 
-    for (size_t i = 0; i < data.Count() && data.At(i).startAt <= pageCount; i++) {
-        int secLen = pageCount + 1 - data.At(i).startAt;
-        if (i < data.Count() - 1 && data.At(i + 1).startAt <= pageCount)
-            secLen = data.At(i + 1).startAt - data.At(i).startAt;
-        ScopedMem<WCHAR> prefix(str::conv::FromPdf(data.At(i).prefix));
-        for (int j = 0; j < secLen; j++) {
-            free(labels->At(data.At(i).startAt + j - 1));
-            labels->At(data.At(i).startAt + j - 1) =
-                FormatPageLabel(data.At(i).type, data.At(i).countFrom + j, prefix);
+public:
+    ~PdfPageLabels() {
+        for (size_t i = 0; i < ranges.Count(); i++) {
+            free(ranges.At(i).type);
+            free(ranges.At(i).prefix);
+        }
+        for (size_t i = 0; i < uniqueLabels.Count(); i++) {
+            free(uniqueLabels.At(i).label);
         }
     }
 
-    for (int ix = 0; (ix = labels->Find(NULL, ix)) != -1; ix++)
-        labels->At(ix) = str::Dup(L"");
+    // returns NULL if the page labels are the same as the page numbers
+    static PdfPageLabels *Create(pdf_obj *root, int pageCount) {
+        Vec<PageLabelInfo> data;
+        BuildPageLabelRec(root, pageCount, data);
+        data.Sort(CmpPageLabelInfo);
 
-    // ensure that all page labels are unique (by appending a number to duplicates)
-    WStrVec dups(*labels);
-    dups.Sort();
-    for (size_t i = 1; i < dups.Count(); i++) {
-        if (!str::Eq(dups.At(i), dups.At(i - 1)))
-            continue;
-        int ix = labels->Find(dups.At(i)), counter = 0;
-        while ((ix = labels->Find(dups.At(i), ix + 1)) != -1) {
-            ScopedMem<WCHAR> unique;
-            do {
-                unique.Set(str::Format(L"%s.%d", dups.At(i), ++counter));
-            } while (labels->Contains(unique));
-            str::ReplacePtr(&labels->At(ix), unique);
+        if (data.Count() == 0)
+            return NULL;
+
+        if (data.Count() == 1 && data.At(0).startAt == 1 && data.At(0).countFrom == 1 &&
+            !data.At(0).prefix && str::Eq(data.At(0).type, "D")) {
+            // this is the default case, no need for special treatment
+            return NULL;
+        }
+
+        PdfPageLabels *labels = new PdfPageLabels(pageCount);
+        for (size_t i = 0; i < data.Count() && data.At(i).startAt <= pageCount; i++) {
+            Range range = { data.At(i).startAt, data.At(i).countFrom, str::Dup(data.At(i).type),
+                            str::conv::FromPdf(data.At(i).prefix) };
+            if (!range.prefix)
+                range.prefix = str::Dup(L"");
+            labels->ranges.Append(range);
         }
-        for (; i + 1 < dups.Count() && str::Eq(dups.At(i), dups.At(i + 1)); i++);
+
+        size_t indexSize = 16;
+        while (indexSize < 2 * (size_t)pageCount)
+            indexSize *= 2;
+        labels->index.AppendBlanks(indexSize);
+
+        // ensure that all page labels are unique (by appending a number to duplicates)
+        Vec<int> dups;
+        for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+            ScopedMem<WCHAR> label(labels->FormatLabel(pageNo));
+            size_t slot = labels->FindSlot(label);
+            if (labels->index.At(slot))
+                dups.Append(pageNo);
+            else
+                labels->index.At(slot) = pageNo;
+        }
+        for (size_t i = 0; i < dups.Count(); i++) {
+            ScopedMem<WCHAR> label(labels->FormatLabel(dups.At(i)));
+            UniqueLabel unique = { dups.At(i), NULL };
+            size_t slot;
+            for (int counter = 1; ; counter++) {
+                free(unique.label);
+                unique.label = str::Format(L"%s.%d", label, counter);
+                slot = labels->FindSlot(unique.label);
+                if (!labels->index.At(slot))
+                    break;
+            }
+            labels->uniqueLabels.Append(unique);
+            labels->index.At(slot) = unique.pageNo;
+        }
+
+        return labels;
     }
 
-    return labels;
-}
+    WCHAR *GetLabel(int pageNo) const {
+        size_t lo = 0, hi = uniqueLabels.Count();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (uniqueLabels.At(mid).pageNo < pageNo)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < uniqueLabels.Count() && uniqueLabels.At(lo).pageNo == pageNo)
+            return str::Dup(uniqueLabels.At(lo).label);
+        return FormatLabel(pageNo);
+    }
+
+    // returns 0 if no page has this label
+    int GetPageNo(const WCHAR *label) const {
+        return index.At(FindSlot(label));
+    }
+};
 
 struct PageTreeStackItem {
     pdf_obj *kids;
@@ -1132,19 +1695,323 @@ struct PdfPageRun {
         path_len(data.path_len), clip_path_len(data.clip_path_len), refs(1) { }
 };
 
+extern "C" static void
+fz_lock_shared_cs(void *user, int lock)
+{
+    EnterCriticalSection(&((CRITICAL_SECTION *)user)[lock]);
+}
+
+extern "C" static void
+fz_unlock_shared_cs(void *user, int lock)
+{
+    LeaveCriticalSection(&((CRITICAL_SECTION *)user)[lock]);
+}
+
+/* Distributes a process wide memory budget among the fz_stores (cached images,
+   fonts, etc.) of all open documents by how recently they've been used: the
+   most recently used document may use half the budget, the one used before
+   half of what remains and so on, so that documents in background tabs can't
+   exhaust the address space. Stores are shrunk immediately when their budget
+   decreases (only items that are currently unused can be evicted, though).
+
+   Note: StoreBudgets acquires the ctxAccess of the registered XPS engines,
+   so never call into it while holding any XpsEngineImpl's ctxAccess. */
+class StoreBudgets {
+    struct Client {
+        fz_context *ctx;
+        // the critical section ctx's locks require to be held (if any)
+        CRITICAL_SECTION *ctxAccess;
+        int lastUse;
+        size_t budget;
+    };
+
+    CRITICAL_SECTION access;
+    Vec<Client> clients;
+    size_t maxMemory;
+    int useCount;
+    fz_context *lastUsed;
+
+    static int cmpByLastUse(const void *a, const void *b) {
+        // the most recently used document comes first
+        return ((Client *)b)->lastUse - ((Client *)a)->lastUse;
+    }
+
+    Client *Find(fz_context *ctx) {
+        for (Client *c = clients.IterStart(); c; c = clients.IterNext()) {
+            if (c->ctx == ctx)
+                return c;
+        }
+        return NULL;
+    }
+
+    void Rebalance() {
+        clients.Sort(cmpByLastUse);
+        size_t left = maxMemory;
+        for (Client *c = clients.IterStart(); c; c = clients.IterNext()) {
+            size_t budget = max(left / 2, (size_t)MIN_STORE_MEMORY);
+            left -= min(budget, left);
+            if (budget == c->budget)
+                continue;
+            c->budget = budget;
+            if (c->ctxAccess)
+                EnterCriticalSection(c->ctxAccess);
+            fz_set_store_limit(c->ctx, (unsigned int)min(budget, (size_t)UINT_MAX));
+            if (c->ctxAccess)
+                LeaveCriticalSection(c->ctxAccess);
+        }
+    }
+
+public:
+    StoreBudgets() : maxMemory(MAX_TOTAL_STORE_MEMORY), useCount(0), lastUsed(NULL) {
+        InitializeCriticalSection(&access);
+    }
+    ~StoreBudgets() {
+        DeleteCriticalSection(&access);
+    }
+
+    // ctx must be a base context (and its store not be shared with any other client)
+    void Register(fz_context *ctx, CRITICAL_SECTION *ctxAccess=NULL) {
+        ScopedCritSec scope(&access);
+        Client client = { ctx, ctxAccess, ++useCount, 0 };
+        clients.Append(client);
+        lastUsed = ctx;
+        Rebalance();
+    }
+    void Unregister(fz_context *ctx) {
+        ScopedCritSec scope(&access);
+        Client *c = Find(ctx);
+        if (!c)
+            return;
+        clients.RemoveAt(c - clients.LendData());
+        if (lastUsed == ctx)
+            lastUsed = NULL;
+        Rebalance();
+    }
+
+    // to be called whenever a document is about to be rendered
+    void Touch(fz_context *ctx) {
+        ScopedCritSec scope(&access);
+        Client *c = Find(ctx);
+        if (!c)
+            return;
+        c->lastUse = ++useCount;
+        // the budgets only change when another document is used
+        if (lastUsed != ctx) {
+            lastUsed = ctx;
+            Rebalance();
+        }
+    }
+
+    void SetMaxMemory(size_t maxMemory) {
+        ScopedCritSec scope(&access);
+        this->maxMemory = maxMemory;
+        Rebalance();
+    }
+
+    bool GetUsage(fz_context *ctx, size_t *used, size_t *budget) {
+        ScopedCritSec scope(&access);
+        Client *c = Find(ctx);
+        if (!c)
+            return false;
+        if (c->ctxAccess)
+            EnterCriticalSection(c->ctxAccess);
+        *used = fz_store_size(ctx);
+        if (c->ctxAccess)
+            LeaveCriticalSection(c->ctxAccess);
+        *budget = c->budget;
+        return true;
+    }
+};
+
+static StoreBudgets gStoreBudgets;
+
+void SetResourceCacheSize(int maxMemoryMB)
+{
+    gStoreBudgets.SetMaxMemory(maxMemoryMB > 0 ? (size_t)maxMemoryMB * 1024 * 1024 : MAX_TOTAL_STORE_MEMORY);
+}
+
+/* A PdfEngineImpl and all its clones use fz_contexts cloned from the same
+   base context so that they can share resources and display lists (the
+   lists of a page are identified by the page's object number). Lists are
+   refcounted and dropped as soon as no engine's runCache contains them anymore. */
+class PdfSharedContext {
+    struct SharedList {
+        int pageObjNum;
+        fz_display_list *list;
+        int refs;
+    };
+
+    // fz_context locks (guarding the shared allocator, store, glyph cache, etc.)
+    CRITICAL_SECTION fzLocks[FZ_LOCK_MAX];
+    fz_locks_context fz_locks_ctx;
+    // make sure to never ask for any engine's pagesAccess or ctxAccess
+    // in a listsAccess protected critical section
+    CRITICAL_SECTION listsAccess;
+    Vec<SharedList> lists;
+    // fonts kept loaded so that FreeType stays initialized (cf. PreloadFonts)
+    Vec<fz_font *> fonts;
+    LONG refs;
+
+    ~PdfSharedContext() {
+        CrashIf(lists.Count() > 0);
+        for (size_t i = 0; i < fonts.Count(); i++) {
+            fz_drop_font(ctx, fonts.At(i));
+        }
+        gStoreBudgets.Unregister(ctx);
+        fz_free_context(ctx);
+        DeleteCriticalSection(&listsAccess);
+        for (int i = 0; i < FZ_LOCK_MAX; i++) {
+            DeleteCriticalSection(&fzLocks[i]);
+        }
+    }
+
+public:
+    // base context from which the engines clone their own contexts
+    // (it isn't used for anything else and thus needs no further protection)
+    fz_context *ctx;
+
+    // contexts with a fixedStoreSize aren't managed by StoreBudgets
+    PdfSharedContext(size_t fixedStoreSize=0) : refs(1) {
+        for (int i = 0; i < FZ_LOCK_MAX; i++) {
+            InitializeCriticalSection(&fzLocks[i]);
+        }
+        InitializeCriticalSection(&listsAccess);
+        fz_locks_ctx.user = fzLocks;
+        fz_locks_ctx.lock = fz_lock_shared_cs;
+        fz_locks_ctx.unlock = fz_unlock_shared_cs;
+        ctx = fz_new_context(NULL, &fz_locks_ctx, fixedStoreSize ? fixedStoreSize : MAX_CONTEXT_MEMORY);
+        // the glyph cache and the store are shared by all contexts cloned from ctx
+        if (ctx) {
+            fz_set_glyph_cache_size(ctx, gMaxGlyphCacheMemory);
+            if (!fixedStoreSize)
+                gStoreBudgets.Register(ctx);
+        }
+    }
+
+    void AddRef() { InterlockedIncrement(&refs); }
+    void Release() {
+        if (0 == InterlockedDecrement(&refs))
+            delete this;
+    }
+
+    // loads the builtin base 14 fonts and builds the list of system fonts
+    // (which requires parsing all of them), so that the first document
+    // using this context doesn't have to wait for either
+    void PreloadFonts() {
+        static const char *builtinFonts[] = {
+            "Times-Roman", "Times-Bold", "Times-Italic", "Times-BoldItalic",
+            "Helvetica", "Helvetica-Bold", "Helvetica-Oblique", "Helvetica-BoldOblique",
+            "Courier", "Courier-Bold", "Courier-Oblique", "Courier-BoldOblique",
+            "Symbol", "ZapfDingbats",
+        };
+        for (size_t i = 0; i < dimof(builtinFonts); i++) {
+            unsigned int len;
+            unsigned char *data = pdf_lookup_builtin_font(builtinFonts[i], &len);
+            if (!data)
+                continue;
+            fz_try(ctx) {
+                fonts.Append(fz_new_font_from_memory(ctx, builtinFonts[i], data, len, 0, 1));
+            }
+            fz_catch(ctx) { }
+        }
+        pdf_install_load_system_font_funcs(ctx);
+        fz_font *font = fz_load_system_font(ctx, "Arial", 1);
+        if (font)
+            fonts.Append(font);
+    }
+
+    // returns a list previously added by any engine (to be dropped with DropList)
+    fz_display_list *FindList(int pageObjNum) {
+        ScopedCritSec scope(&listsAccess);
+        for (size_t i = 0; i < lists.Count(); i++) {
+            if (lists.At(i).pageObjNum == pageObjNum) {
+                lists.At(i).refs++;
+                return lists.At(i).list;
+            }
+        }
+        return NULL;
+    }
+    // takes over list (unless another engine added one for the same page meanwhile)
+    void AddList(int pageObjNum, fz_display_list *list) {
+        ScopedCritSec scope(&listsAccess);
+        for (size_t i = 0; i < lists.Count(); i++) {
+            if (lists.At(i).pageObjNum == pageObjNum)
+                return;
+        }
+        SharedList shared = { pageObjNum, list, 1 };
+        lists.Append(shared);
+    }
+    // ctx must be the calling engine's (locked) context
+    void DropList(fz_context *ctx, fz_display_list *list) {
+        ScopedCritSec scope(&listsAccess);
+        for (size_t i = 0; i < lists.Count(); i++) {
+            if (lists.At(i).list == list) {
+                if (--lists.At(i).refs > 0)
+                    return;
+                lists.RemoveAt(i);
+                break;
+            }
+        }
+        fz_drop_display_list(ctx, list);
+    }
+};
+
+// a base context prepared ahead of time by PreloadPdfEngineResources
+static PdfSharedContext *gPreloadedContext = NULL;
+
+static PdfSharedContext *TakePreloadedContext()
+{
+    PdfSharedContext *shared = (PdfSharedContext *)InterlockedExchangePointer((void **)&gPreloadedContext, NULL);
+    if (!shared)
+        shared = new PdfSharedContext();
+    return shared;
+}
+
+void PreloadPdfEngineResources()
+{
+    if (gPreloadedContext)
+        return;
+    PdfSharedContext *shared = new PdfSharedContext();
+    if (!shared->ctx) {
+        shared->Release();
+        return;
+    }
+    shared->PreloadFonts();
+    if (InterlockedCompareExchangePointer((void **)&gPreloadedContext, shared, NULL) != NULL)
+        shared->Release();
+}
+
+void FreePreloadedPdfEngineResources()
+{
+    PdfSharedContext *shared = (PdfSharedContext *)InterlockedExchangePointer((void **)&gPreloadedContext, NULL);
+    if (shared)
+        shared->Release();
+}
+
 class PdfTocItem;
 class PdfLink;
 class PdfImage;
 
+// which parts of a document are loaded up front
+enum PdfLoadMode {
+    Load_Everything,
+    // only what's needed for rendering page 1 (cf. PdfEngine::CreateThumbnailEngine)
+    Load_Thumbnail,
+    // only the properties and the pages' text (cf. PdfEngine::CreateTextEngine)
+    Load_Text,
+};
+
 class PdfEngineImpl : public PdfEngine {
     friend PdfEngine;
     friend PdfLink;
     friend PdfImage;
 
 public:
-    PdfEngineImpl();
+    PdfEngineImpl(PdfSharedContext *shared=NULL, PdfLoadMode loadMode=Load_Everything);
     virtual ~PdfEngineImpl();
     virtual PdfEngineImpl *Clone();
+    // clones use their own fz_context and are rendered independently
+    virtual bool SupportsConcurrentRendering() const { return true; }
 
     virtual const WCHAR *FileName() const { return _fileName; };
     virtual int PageCount() const {
@@ -1155,6 +2022,7 @@ public:
 
     virtual RectD PageMediabox(int pageNo);
     virtual RectD PageContentBox(int pageNo, RenderTarget target=Target_View);
+    virtual RectD PageMediaboxEstimate(int pageNo, bool *isExact);
 
     virtual RenderedBitmap *RenderBitmap(int pageNo, float zoom, int rotation,
                          RectD *pageRect=NULL, /* if NULL: defaults to the page's mediabox */
@@ -1163,6 +2031,11 @@ public:
                          RectD *pageRect=NULL, RenderTarget target=Target_View, AbortCookie **cookie_out=NULL) {
         return RenderPage(hDC, GetPdfPage(pageNo), screenRect, NULL, zoom, rotation, pageRect, target, cookie_out);
     }
+    virtual RenderedBitmap *RenderPreviewBitmap(int pageNo, float zoom, int rotation,
+                         RectD *pageRect=NULL, AbortCookie **cookie_out=NULL) {
+        // rendering without anti-aliasing is considerably faster for complex pages
+        return RenderBitmap(pageNo, zoom, rotation, pageRect, Target_View, cookie_out, 0);
+    }
 
     virtual PointD Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse=false);
     virtual RectD Transform(RectD rect, int pageNo, float zoom, int rotation, bool inverse=false);
@@ -1171,12 +2044,19 @@ public:
     virtual bool SaveFileAs(const WCHAR *copyFileName);
     virtual WCHAR * ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_out=NULL,
                                     RenderTarget target=Target_View);
+    virtual bool ExtractTextRange(int startPage, int endPage, WCHAR *lineSep, TextExtractionSink *sink,
+                                  bool withCoords=false, RenderTarget target=Target_View);
     virtual bool HasClipOptimizations(int pageNo);
     virtual PageLayoutType PreferredLayout();
     virtual WCHAR *GetProperty(DocumentProperty prop);
 
     virtual bool SupportsAnnotation(bool forSaving=false) const;
     virtual void UpdateUserAnnotations(Vec<PageAnnotation> *list);
+    virtual bool SetHighlightOverlay(bool enable) {
+        ScopedCritSec scope(&ctxAccess);
+        overlayHighlights = enable;
+        return true;
+    }
 
     virtual bool AllowsPrinting() const {
         return pdf_has_permission(_doc, PDF_PERM_PRINT);
@@ -1189,13 +2069,30 @@ public:
     virtual const WCHAR *GetDefaultFileExt() const { return L".pdf"; }
 
     virtual bool BenchLoadPage(int pageNo) { return GetPdfPage(pageNo) != NULL; }
+    virtual bool BenchCacheStats(int *hits, int *misses) {
+        ScopedCritSec scope(&pagesAccess);
+        *hits = runCacheHits;
+        *misses = runCacheMisses;
+        return true;
+    }
+    virtual bool BenchGlyphCacheStats(int *hits, int *misses) {
+        ScopedCritSec scope(&ctxAccess);
+        fz_glyph_cache_stats(ctx, hits, misses);
+        return true;
+    }
+    virtual bool BenchResourceCacheStats(size_t *used, size_t *budget) {
+        return gStoreBudgets.GetUsage(shared->ctx, used, budget);
+    }
+    virtual bool BenchLockContention(int *ctxWaits, int *pagesWaits) {
+        return GetContentionCount(&ctxAccess, ctxWaits) && GetContentionCount(&pagesAccess, pagesWaits);
+    }
 
     virtual Vec<PageElement *> *GetElements(int pageNo);
     virtual PageElement *GetElementAtPos(int pageNo, PointD pt);
 
     virtual PageDestination *GetNamedDest(const WCHAR *name);
     virtual bool HasTocTree() const {
-        return outline != NULL || attachments != NULL;
+        return hasOutline || attachments != NULL;
     }
     virtual DocTocItem *GetTocTree();
 
@@ -1206,28 +2103,43 @@ public:
     virtual bool IsPasswordProtected() const { return isProtected; }
     virtual char *GetDecryptionKey() const;
 
+    virtual bool IsStillLoading() const {
+        return loader && !loader->IsComplete() && !loader->HasFailed();
+    }
+    virtual size_t GetMemoryUsage();
+    virtual void CompactMemory();
+    virtual bool GetPageDigest(int pageNo, unsigned char digest[16]);
+
 protected:
     WCHAR *_fileName;
     char *_decryptionKey;
     bool isProtected;
+    PdfLoadMode loadMode;
+
+    // set for documents loaded from slow drives (cf. OpenProgressively)
+    ProgressiveFileLoader *loader;
+    fz_buffer *     loaderData;
 
     // make sure to never ask for pagesAccess in an ctxAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION ctxAccess;
     fz_context *    ctx;
-    fz_locks_context fz_locks_ctx;
+    // shared with all clones of this engine
+    PdfSharedContext *shared;
     pdf_document *  _doc;
 
     CRITICAL_SECTION pagesAccess;
     pdf_page **     _pages;
     pdf_obj **      _pageObjs;
 
-    bool            Load(const WCHAR *fileName, PasswordUI *pwdUI=NULL);
+    bool            Load(const WCHAR *fileName, PasswordUI *pwdUI=NULL, bool progressive=false);
     bool            Load(IStream *stream, PasswordUI *pwdUI=NULL);
     bool            Load(fz_stream *stm, PasswordUI *pwdUI=NULL);
-    bool            LoadFromStream(fz_stream *stm, PasswordUI *pwdUI=NULL);
+    bool            LoadFromStream(fz_stream *stm, PasswordUI *pwdUI=NULL, fz_buffer *repairedXref=NULL, int repairedLen=0);
     bool            FinishLoading();
+    fz_stream     * OpenProgressively(const WCHAR *filePath);
 
+    pdf_obj       * GetPageObj(int pageNo);
     pdf_page      * GetPdfPage(int pageNo, bool failIfBusy=false);
     int             GetPageNo(pdf_page *page);
     fz_matrix       viewctm(int pageNo, float zoom, int rotation) {
@@ -1243,20 +2155,29 @@ protected:
                                RectD *pageRect, RenderTarget target, AbortCookie **cookie_out);
     bool            PreferGdiPlusDevice(pdf_page *page, float zoom, fz_rect clip);
     WCHAR         * ExtractPageText(pdf_page *page, WCHAR *lineSep, RectI **coords_out=NULL,
-                                    RenderTarget target=Target_View, bool cacheRun=false);
+                                    RenderTarget target=Target_View, bool cacheRun=false,
+                                    fz_text_sheet *sheet=NULL);
+    WCHAR         * ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_out,
+                                    RenderTarget target, fz_text_sheet *sheet);
 
     Vec<PdfPageRun*>runCache; // ordered most recently used first
+    int             runCacheHits, runCacheMisses; // protected by pagesAccess
     PdfPageRun    * CreatePageRun(pdf_page *page, fz_display_list *list);
     PdfPageRun    * GetPageRun(pdf_page *page, bool tryOnly=false);
     bool            RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm,
                             RenderTarget target=Target_View,
                             const fz_rect *cliprect=NULL, bool cacheRun=true,
-                            FitzAbortCookie *cookie=NULL);
+                            FitzAbortCookie *cookie=NULL, int aaLevel=-1);
+    RenderedBitmap *RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect,
+                                 RenderTarget target, AbortCookie **cookie_out, int aaLevel);
+    RenderedBitmap *RenderPageRun(pdf_page *page, PdfPageRun *run, const fz_matrix *ctm,
+                                  const fz_irect *bbox, AbortCookie **cookie_out, int aaLevel);
     void            DropPageRun(PdfPageRun *run, bool forceRemove=false);
 
     PdfTocItem    * BuildTocTree(fz_outline *entry, int& idCounter);
     void            LinkifyPageText(pdf_page *page);
     pdf_annot    ** ProcessPageAnnotations(pdf_page *page);
+    void            BuildElementIndex(pdf_page *page, int pageNo);
     RenderedBitmap *GetPageImage(int pageNo, RectD rect, size_t imageIx);
     WCHAR         * ExtractFontList();
     bool            IsLinearizedFile();
@@ -1265,14 +2186,29 @@ protected:
     bool            SaveUserAnnots(const WCHAR *fileName);
 
     RectD         * _mediaboxes;
+    // cf. CONTENT_BOX_IX (access is protected by pagesAccess)
+    RectD         * _contentBoxes;
+    // size of pages inheriting their MediaBox from the page tree's root
+    RectD           _mediaboxEstimate;
+    // outline is NULL until it's been loaded (cf. GetTocTree)
     fz_outline    * outline;
+    bool            hasOutline;
+    bool            outlineLoaded;
     fz_outline    * attachments;
     pdf_obj       * _info;
-    WStrVec       * _pagelabels;
+    PdfPageLabels * _pagelabels;
     pdf_annot   *** pageAnnots;
     fz_rect      ** imageRects;
+    // spatial indices for GetElementAtPos (links index an fz_link * each,
+    // annotations and images the position in pageAnnots and imageRects)
+    RectIndex    ** linkIndex;
+    RectIndex    ** annotIndex;
+    RectIndex    ** imageIndex;
 
     Vec<PageAnnotation> userAnnots;
+    // whether highlights are left out of userAnnots for Target_View
+    // (access is protected by ctxAccess, same as for userAnnots)
+    bool            overlayHighlights;
 };
 
 class PdfLink : public PageElement, public PageDestination {
@@ -1350,19 +2286,21 @@ public:
     }
 };
 
-PdfEngineImpl::PdfEngineImpl() : _fileName(NULL), _doc(NULL),
-    _pages(NULL), _pageObjs(NULL), _mediaboxes(NULL), _info(NULL),
-    outline(NULL), attachments(NULL), _pagelabels(NULL),
-    _decryptionKey(NULL), isProtected(false),
-    pageAnnots(NULL), imageRects(NULL)
+PdfEngineImpl::PdfEngineImpl(PdfSharedContext *shared, PdfLoadMode loadMode) : _fileName(NULL), _doc(NULL),
+    _pages(NULL), _pageObjs(NULL), _mediaboxes(NULL), _contentBoxes(NULL), _info(NULL),
+    outline(NULL), hasOutline(false), outlineLoaded(false), attachments(NULL), _pagelabels(NULL),
+    _decryptionKey(NULL), isProtected(false), loadMode(loadMode), loader(NULL), loaderData(NULL),
+    pageAnnots(NULL), imageRects(NULL), linkIndex(NULL), annotIndex(NULL),
+    imageIndex(NULL), shared(shared), runCacheHits(0), runCacheMisses(0), overlayHighlights(false)
 {
     InitializeCriticalSection(&pagesAccess);
     InitializeCriticalSection(&ctxAccess);
 
-    fz_locks_ctx.user = &ctxAccess;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(NULL, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
+    if (shared)
+        shared->AddRef();
+    else
+        this->shared = TakePreloadedContext();
+    ctx = fz_clone_context(this->shared->ctx);
 
     pdf_install_load_system_font_funcs(ctx);
 
@@ -1371,6 +2309,11 @@ PdfEngineImpl::PdfEngineImpl() : _fileName(NULL), _doc(NULL),
 
 PdfEngineImpl::~PdfEngineImpl()
 {
+    if (loader) {
+        loader->RequestCancel();
+        loader->Join();
+    }
+
     EnterCriticalSection(&pagesAccess);
     EnterCriticalSection(&ctxAccess);
 
@@ -1403,6 +2346,16 @@ PdfEngineImpl::~PdfEngineImpl()
         }
         free(imageRects);
     }
+    if (linkIndex && annotIndex && imageIndex) {
+        for (int i = 0; i < PageCount(); i++) {
+            delete linkIndex[i];
+            delete annotIndex[i];
+            delete imageIndex[i];
+        }
+    }
+    free(linkIndex);
+    free(annotIndex);
+    free(imageIndex);
 
     while (runCache.Count() > 0) {
         assert(runCache.Last()->refs == 1);
@@ -1411,10 +2364,14 @@ PdfEngineImpl::~PdfEngineImpl()
 
     pdf_close_document(_doc);
     _doc = NULL;
+    delete loader;
+    fz_drop_buffer(ctx, loaderData);
     fz_free_context(ctx);
     ctx = NULL;
+    shared->Release();
 
     free(_mediaboxes);
+    free(_contentBoxes);
     delete _pagelabels;
     free(_fileName);
     free(_decryptionKey);
@@ -1448,13 +2405,20 @@ PdfEngineImpl *PdfEngineImpl::Clone()
     if (pdf_crypt_key(_doc))
         pwdUI = new PasswordCloner(pdf_crypt_key(_doc));
 
-    PdfEngineImpl *clone = new PdfEngineImpl();
-    if (!clone || !(_fileName ? clone->Load(_fileName, pwdUI) : clone->Load(_doc->file, pwdUI))) {
+    // the clone shares display lists with this engine (and all its other clones)
+    PdfEngineImpl *clone = new PdfEngineImpl(shared, loadMode);
+    // progressively loaded documents are cloned from memory once they're complete
+    // (fz_clone_stream fails before then) instead of being loaded all over again
+    // and memory mapped files are cloned so that all clones share the same view
+    bool fromStream = !_fileName || loader || fz_is_mapped_stream(_doc->file);
+    if (!clone || !(fromStream ? clone->Load(_doc->file, pwdUI) : clone->Load(_fileName, pwdUI))) {
         delete clone;
         delete pwdUI;
         return NULL;
     }
     delete pwdUI;
+    if (!clone->_fileName)
+        clone->_fileName = str::Dup(_fileName);
 
     if (!_decryptionKey && _doc->crypt) {
         delete clone->_decryptionKey;
@@ -1485,7 +2449,194 @@ static const WCHAR *findEmbedMarks(const WCHAR *fileName)
     return embedMarks;
 }
 
-bool PdfEngineImpl::Load(const WCHAR *fileName, PasswordUI *pwdUI)
+/* The xref tables of broken documents have to be reconstructed by scanning the
+   entire file (cf. pdf_repair_xref). The result is cached so that reopening such
+   a document is as quick as opening an intact one. A cache file consists of a
+   RepairedXrefHeader identifying the document's version followed by the data
+   returned by pdf_save_repaired_xref. */
+
+#define REPAIRED_XREF_MAGIC     'SXrf'
+#define REPAIRED_XREF_VERSION   1
+#define REPAIRED_XREF_EXT       L".xref"
+// the least recently saved cache files are deleted beyond this number
+#define MAX_REPAIRED_XREF_FILES 32
+// number of bytes at the file's start and end included in the digest
+#define REPAIRED_XREF_DIGEST_RANGE (64 * 1024)
+
+struct RepairedXrefHeader {
+    uint32          magic;
+    uint32          version;
+    int64           fileSize;
+    FILETIME        modified;
+    unsigned char   digest[16];
+};
+
+static WCHAR *gRepairedXrefDir = NULL;
+
+void SetRepairedXrefCacheDir(const WCHAR *dir)
+{
+    str::ReplacePtr(&gRepairedXrefDir, dir);
+}
+
+static WCHAR *GetRepairedXrefPath(const WCHAR *filePath)
+{
+    if (!gRepairedXrefDir)
+        return NULL;
+    ScopedMem<WCHAR> pathLower(str::Dup(filePath));
+    str::ToLower(pathLower);
+    ScopedMem<char> pathU(str::conv::ToUtf8(pathLower));
+    if (!pathU)
+        return NULL;
+    unsigned char digest[16];
+    CalcMD5Digest((unsigned char *)pathU.Get(), str::Len(pathU), digest);
+    ScopedMem<char> fingerPrint(str::MemToHex(digest, 16));
+    ScopedMem<WCHAR> fname(str::conv::FromAnsi(fingerPrint));
+    return str::Format(L"%s\\%s%s", gRepairedXrefDir, fname, REPAIRED_XREF_EXT);
+}
+
+// hashing the entire file would take almost as long as repairing it, so the
+// digest only covers the file's start and end (where the header, the trailer
+// and any xref sections usually are) in addition to size and modification time
+static bool GetRepairedXrefDigest(fz_stream *stm, int size, unsigned char digest[16])
+{
+    int ranges[2][2] = {
+        { 0, min(size, REPAIRED_XREF_DIGEST_RANGE) },
+        { max(REPAIRED_XREF_DIGEST_RANGE, size - REPAIRED_XREF_DIGEST_RANGE), size }
+    };
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    fz_try(stm->ctx) {
+        unsigned char buf[4096];
+        for (size_t i = 0; i < dimof(ranges); i++) {
+            fz_seek(stm, ranges[i][0], 0);
+            for (int left = ranges[i][1] - ranges[i][0]; left > 0; ) {
+                int read = fz_read(stm, buf, min(left, (int)sizeof(buf)));
+                if (read <= 0)
+                    fz_throw(stm->ctx, FZ_ERROR_GENERIC, "unexpected end of file");
+                fz_md5_update(&md5, buf, read);
+                left -= read;
+            }
+        }
+        fz_seek(stm, 0, 0);
+    }
+    fz_catch(stm->ctx) {
+        return false;
+    }
+    fz_md5_final(&md5, digest);
+    return true;
+}
+
+static bool GetRepairedXrefHeader(fz_stream *stm, const WCHAR *filePath, RepairedXrefHeader *hdr)
+{
+    ZeroMemory(hdr, sizeof(*hdr));
+    hdr->magic = REPAIRED_XREF_MAGIC;
+    hdr->version = REPAIRED_XREF_VERSION;
+    hdr->fileSize = file::GetSize(filePath);
+    hdr->modified = file::GetModificationTime(filePath);
+    if (hdr->fileSize <= 0 || hdr->fileSize > INT_MAX)
+        return false;
+    return GetRepairedXrefDigest(stm, (int)hdr->fileSize, hdr->digest);
+}
+
+// sets prefixLen to the length of the file the xref has been saved for,
+// if that file has been updated incrementally since (and to 0 otherwise)
+static fz_buffer *LoadRepairedXref(fz_stream *stm, const WCHAR *filePath, int *prefixLen)
+{
+    *prefixLen = 0;
+    ScopedMem<WCHAR> xrefPath(GetRepairedXrefPath(filePath));
+    if (!xrefPath || !file::Exists(xrefPath))
+        return NULL;
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(xrefPath, &len));
+    RepairedXrefHeader hdr;
+    if (!data || len <= sizeof(hdr) || len - sizeof(hdr) > INT_MAX ||
+        !GetRepairedXrefHeader(stm, filePath, &hdr)) {
+        return NULL;
+    }
+    if (memcmp(data, &hdr, sizeof(hdr)) != 0) {
+        // incremental updates (e.g. saved annotations or form fields) leave the
+        // original file untouched, so the saved xref remains valid for it
+        RepairedXrefHeader saved;
+        memcpy(&saved, data, sizeof(saved));
+        unsigned char digest[16];
+        if (saved.magic != hdr.magic || saved.version != hdr.version ||
+            saved.fileSize <= 0 || saved.fileSize >= hdr.fileSize ||
+            !GetRepairedXrefDigest(stm, (int)saved.fileSize, digest) ||
+            !memeq(digest, saved.digest, sizeof(digest))) {
+            return NULL;
+        }
+        *prefixLen = (int)saved.fileSize;
+    }
+
+    fz_buffer *buf = NULL;
+    fz_try(stm->ctx) {
+        buf = fz_new_buffer(stm->ctx, (int)(len - sizeof(hdr)));
+        fz_write_buffer(stm->ctx, buf, data + sizeof(hdr), (int)(len - sizeof(hdr)));
+    }
+    fz_catch(stm->ctx) {
+        fz_drop_buffer(stm->ctx, buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static void PurgeRepairedXrefs()
+{
+    ScopedMem<WCHAR> pattern(str::Format(L"%s\\*%s", gRepairedXrefDir, REPAIRED_XREF_EXT));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind)
+        return;
+    int count = 0;
+    ScopedMem<WCHAR> oldest;
+    FILETIME oldestTime = { 0 };
+    do {
+        if ((fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            continue;
+        if (!oldest || CompareFileTime(&fdata.ftLastWriteTime, &oldestTime) < 0) {
+            oldest.Set(str::Dup(fdata.cFileName));
+            oldestTime = fdata.ftLastWriteTime;
+        }
+        count++;
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    // one file is added at a time, so removing one at a time suffices
+    if (count > MAX_REPAIRED_XREF_FILES) {
+        ScopedMem<WCHAR> oldestPath(path::Join(gRepairedXrefDir, oldest));
+        file::Delete(oldestPath);
+    }
+}
+
+static void SaveRepairedXref(pdf_document *doc, const WCHAR *filePath)
+{
+    ScopedMem<WCHAR> xrefPath(GetRepairedXrefPath(filePath));
+    RepairedXrefHeader hdr;
+    if (!xrefPath || !GetRepairedXrefHeader(doc->file, filePath, &hdr))
+        return;
+
+    fz_buffer *buf = NULL;
+    fz_try(doc->ctx) {
+        buf = pdf_save_repaired_xref(doc);
+    }
+    fz_catch(doc->ctx) {
+        buf = NULL;
+    }
+    if (!buf)
+        return;
+
+    ScopedMem<char> data((char *)malloc(sizeof(hdr) + buf->len));
+    if (data) {
+        memcpy(data, &hdr, sizeof(hdr));
+        memcpy(data + sizeof(hdr), buf->data, buf->len);
+        dir::CreateAll(gRepairedXrefDir);
+        if (file::WriteAll(xrefPath, data, sizeof(hdr) + buf->len))
+            PurgeRepairedXrefs();
+    }
+    fz_drop_buffer(doc->ctx, buf);
+}
+
+bool PdfEngineImpl::Load(const WCHAR *fileName, PasswordUI *pwdUI, bool progressive)
 {
     assert(!_fileName && !_doc && ctx);
     _fileName = str::Dup(fileName);
@@ -1498,21 +2649,40 @@ bool PdfEngineImpl::Load(const WCHAR *fileName, PasswordUI *pwdUI)
     WCHAR *embedMarks = (WCHAR *)findEmbedMarks(_fileName);
     if (embedMarks)
         *embedMarks = '\0';
+    else if (progressive)
+        file = OpenProgressively(_fileName);
     fz_try(ctx) {
-        file = fz_open_file2(ctx, _fileName);
+        if (!file)
+            file = fz_open_file2(ctx, _fileName);
     }
     fz_catch(ctx) {
         file = NULL;
     }
+    // documents that had to be repaired before needn't be repaired again
+    fz_buffer *repairedXref = NULL;
+    int repairedLen = 0;
+    if (file && !embedMarks && !loader)
+        repairedXref = LoadRepairedXref(file, _fileName, &repairedLen);
+    bool saveRepairedXref = !repairedXref && !embedMarks && !loader;
     if (embedMarks)
         *embedMarks = ':';
 
 OpenEmbeddedFile:
-    if (!LoadFromStream(file, pwdUI))
+    bool ok = LoadFromStream(file, pwdUI, repairedXref, repairedLen);
+    if (repairedXref) {
+        fz_drop_buffer(ctx, repairedXref);
+        repairedXref = NULL;
+    }
+    if (!ok)
         return false;
 
-    if (str::IsEmpty(embedMarks))
-        return FinishLoading();
+    if (str::IsEmpty(embedMarks)) {
+        if (!FinishLoading())
+            return false;
+        if (saveRepairedXref && _doc->repair_attempted)
+            SaveRepairedXref(_doc, _fileName);
+        return true;
+    }
 
     int num, gen;
     embedMarks = (WCHAR *)str::Parse(embedMarks, L":%d:%d", &num, &gen);
@@ -1574,20 +2744,66 @@ bool PdfEngineImpl::Load(fz_stream *stm, PasswordUI *pwdUI)
     return FinishLoading();
 }
 
-bool PdfEngineImpl::LoadFromStream(fz_stream *stm, PasswordUI *pwdUI)
+// documents on slow drives (e.g. network shares) are loaded into memory in the
+// background and are displayed as soon as the first page is available (provided
+// that they're linearized); returns NULL if this isn't worth it
+fz_stream *PdfEngineImpl::OpenProgressively(const WCHAR *filePath)
 {
-    if (!stm)
-        return false;
+    ScopedMem<WCHAR> lastFile((WCHAR *)InterlockedExchangePointer((void **)&gLastProgressiveFile, NULL));
+    if (str::EqI(lastFile, filePath))
+        return NULL;
+    // files that are still being written to are always loaded progressively
+    bool growing = str::EqI(gGrowingFilePath, filePath);
+    int64 fileSize = growing ? gGrowingFileSize : file::GetSize(filePath);
+    if (growing && fileSize > MAX_PROGRESSIVE_FILE_SIZE)
+        return NULL;
+    if (!growing && (fileSize < MIN_PROGRESSIVE_FILE_SIZE || fileSize > MAX_PROGRESSIVE_FILE_SIZE ||
+                     path::IsOnFixedDrive(filePath))) {
+        return NULL;
+    }
 
+    fz_stream *stm = NULL;
     fz_try(ctx) {
-        _doc = pdf_open_document_with_stream(ctx, stm);
-    }
-    fz_always(ctx) {
-        fz_close(stm);
+        loaderData = fz_new_buffer(ctx, (int)fileSize);
+        loaderData->len = (int)fileSize;
+        loader = new ProgressiveFileLoader(filePath, loaderData, growing);
+        stm = fz_open_buffer_progressive(ctx, loaderData, (volatile int *)&loader->available);
     }
     fz_catch(ctx) {
-        return false;
+        delete loader;
+        loader = NULL;
+        return NULL;
     }
+    loader->Start();
+    return stm;
+}
+
+bool PdfEngineImpl::LoadFromStream(fz_stream *stm, PasswordUI *pwdUI, fz_buffer *repairedXref, int repairedLen)
+{
+    if (!stm)
+        return false;
+
+    bool tryLater;
+    do {
+        tryLater = false;
+        fz_try(ctx) {
+            _doc = pdf_open_document_with_stream_and_xref(ctx, stm, repairedXref, repairedLen);
+        }
+        fz_catch(ctx) {
+            // wait until the first page's objects (resp. the entire
+            // file for non-linearized documents) have been loaded
+            tryLater = fz_caught(ctx) == FZ_ERROR_TRYLATER && loader && !loader->HasFailed();
+        }
+        if (tryLater)
+            Sleep(PROGRESSIVE_WAIT_MS);
+    } while (tryLater);
+    fz_close(stm);
+    if (!_doc)
+        return false;
+    // all clones load the same file and thus can share decoded images
+    // (which doesn't hold for the context shared by text extraction)
+    if (loadMode != Load_Text)
+        _doc->image_store_id = shared;
 
     isProtected = pdf_needs_password(_doc);
     if (!isProtected)
@@ -1596,6 +2812,10 @@ bool PdfEngineImpl::LoadFromStream(fz_stream *stm, PasswordUI *pwdUI)
     if (!pwdUI)
         return false;
 
+    // the fingerprint (and authentication) requires the complete file
+    if (loader)
+        loader->Join();
+
     unsigned char digest[16 + 32] = { 0 };
     fz_stream_fingerprint(_doc->file, digest);
 
@@ -1656,35 +2876,56 @@ bool PdfEngineImpl::FinishLoading()
     _pages = AllocArray<pdf_page *>(PageCount());
     _pageObjs = AllocArray<pdf_obj *>(PageCount());
     _mediaboxes = AllocArray<RectD>(PageCount());
+    _contentBoxes = AllocArray<RectD>(PageCount() * CONTENT_BOX_TARGETS);
     pageAnnots = AllocArray<pdf_annot **>(PageCount());
     imageRects = AllocArray<fz_rect *>(PageCount());
+    linkIndex = AllocArray<RectIndex *>(PageCount());
+    annotIndex = AllocArray<RectIndex *>(PageCount());
+    imageIndex = AllocArray<RectIndex *>(PageCount());
 
-    if (!_pages || !_pageObjs || !_mediaboxes || !pageAnnots || !imageRects)
+    if (!_pages || !_pageObjs || !_mediaboxes || !_contentBoxes || !pageAnnots || !imageRects ||
+        !linkIndex || !annotIndex || !imageIndex)
         return false;
 
     ScopedCritSec scope(&ctxAccess);
 
-    fz_try(ctx) {
-        pdf_load_page_objs(_doc, _pageObjs);
-    }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load all page objects");
-    }
-    fz_try(ctx) {
-        outline = pdf_load_outline(_doc);
+    if (loadMode != Load_Everything) {
+        // page objects are looked up as they're needed (cf. GetPageObj)
+        // and neither the outline nor the page labels are loaded
+        if (Load_Thumbnail == loadMode)
+            return true;
     }
-    fz_catch(ctx) {
-        // ignore errors from pdf_load_outline()
-        // this information is not critical and checking the
-        // error might prevent loading some pdfs that would
-        // otherwise get displayed
-        fz_warn(ctx, "Couldn't load outline");
+    else if (IsStillLoading()) {
+        // page objects are retrieved as they become available (cf. GetPageObj)
+        // and the outline, etc. only once the document has been reloaded
+        GetPageObj(1);
     }
-    fz_try(ctx) {
-        attachments = pdf_loadattachments(_doc);
+    else {
+        fz_try(ctx) {
+            // make sure that a linearized document's entire xref has been read
+            if (_doc->file_reading_linearly)
+                pdf_progressive_advance(_doc, PageCount() - 1);
+        }
+        fz_catch(ctx) { }
+        fz_try(ctx) {
+            pdf_load_page_objs(_doc, _pageObjs);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load all page objects");
+        }
     }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load attachments");
+    if (Load_Everything == loadMode) {
+        // the outline itself is only loaded once it's needed (cf. GetTocTree)
+        fz_try(ctx) {
+            hasOutline = pdf_dict_getp(pdf_trailer(_doc), "Root/Outlines/First") != NULL;
+        }
+        fz_catch(ctx) { }
+        fz_try(ctx) {
+            attachments = pdf_loadattachments(_doc);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load attachments");
+        }
     }
     fz_try(ctx) {
         // keep a copy of the Info dictionary, as accessing the original
@@ -1719,10 +2960,12 @@ bool PdfEngineImpl::FinishLoading()
         pdf_drop_obj(_info);
         _info = NULL;
     }
+    if (loadMode != Load_Everything)
+        return true;
     fz_try(ctx) {
         pdf_obj *pagelabels = pdf_dict_getp(pdf_trailer(_doc), "Root/PageLabels");
         if (pagelabels)
-            _pagelabels = BuildPageLabelVec(pagelabels, PageCount());
+            _pagelabels = PdfPageLabels::Create(pagelabels, PageCount());
     }
     fz_catch(ctx) {
         fz_warn(ctx, "Couldn't load page labels");
@@ -1760,6 +3003,25 @@ DocTocItem *PdfEngineImpl::GetTocTree()
     PdfTocItem *node = NULL;
     int idCounter = 0;
 
+    // resolving all of a huge outline's destinations takes a while,
+    // so it's done only once the ToC is actually displayed
+    if (hasOutline && !outlineLoaded) {
+        ScopedCritSec scope(&ctxAccess);
+        fz_try(ctx) {
+            outline = pdf_load_outline(_doc);
+            outlineLoaded = true;
+        }
+        fz_catch(ctx) {
+            // ignore errors from pdf_load_outline()
+            // this information is not critical and checking the
+            // error might prevent loading some pdfs that would
+            // otherwise get displayed
+            fz_warn(ctx, "Couldn't load outline");
+            // try again once a progressively loaded document is complete
+            outlineLoaded = !IsStillLoading();
+        }
+    }
+
     if (outline) {
         node = BuildTocTree(outline, idCounter);
         if (attachments)
@@ -1805,6 +3067,39 @@ PageDestination *PdfEngineImpl::GetNamedDest(const WCHAR *name)
     return pageDest;
 }
 
+// page objects of documents which are still loading become available one
+// after the other, so they're only retrieved when they're first needed
+pdf_obj *PdfEngineImpl::GetPageObj(int pageNo)
+{
+    pdf_obj *obj = _pageObjs[pageNo-1];
+    if (obj || !loader && Load_Everything == loadMode)
+        return obj;
+
+    ScopedCritSec scope(&ctxAccess);
+    if (!loader) {
+        // cf. FinishLoading (which doesn't load all page objects up front for this mode)
+        fz_try(ctx) {
+            obj = pdf_lookup_page_obj(_doc, pageNo - 1);
+        }
+        fz_catch(ctx) {
+            obj = NULL;
+        }
+    }
+    else {
+        if (!_doc->file_reading_linearly)
+            return NULL;
+        fz_try(ctx) {
+            obj = pdf_progressive_advance(_doc, pageNo - 1);
+        }
+        fz_catch(ctx) {
+            obj = NULL;
+        }
+    }
+    if (obj && !_pageObjs[pageNo-1])
+        _pageObjs[pageNo-1] = pdf_keep_obj(obj);
+    return _pageObjs[pageNo-1];
+}
+
 pdf_page *PdfEngineImpl::GetPdfPage(int pageNo, bool failIfBusy)
 {
     if (!_pages)
@@ -1812,17 +3107,26 @@ pdf_page *PdfEngineImpl::GetPdfPage(int pageNo, bool failIfBusy)
     if (failIfBusy)
         return _pages[pageNo-1];
 
+    TRACE_SCOPE_N("GetPdfPage", pageNo);
     ScopedCritSec scope(&pagesAccess);
 
     pdf_page *page = _pages[pageNo-1];
     if (!page) {
         ScopedCritSec ctxScope(&ctxAccess);
+        // the page might not have been loaded yet
+        pdf_obj *pageObj = GetPageObj(pageNo);
+        if (!pageObj && IsStillLoading())
+            return NULL;
         fz_var(page);
         fz_try(ctx) {
-            page = pdf_load_page_by_obj(_doc, pageNo - 1, _pageObjs[pageNo-1]);
+            page = pdf_load_page_by_obj(_doc, pageNo - 1, pageObj);
             _pages[pageNo-1] = page;
-            LinkifyPageText(page);
-            pageAnnots[pageNo-1] = ProcessPageAnnotations(page);
+            // links, annotations and images aren't interacted with in thumbnails
+            if (Load_Everything == loadMode) {
+                LinkifyPageText(page);
+                pageAnnots[pageNo-1] = ProcessPageAnnotations(page);
+                BuildElementIndex(page, pageNo);
+            }
         }
         fz_catch(ctx) { }
     }
@@ -1858,9 +3162,15 @@ PdfPageRun *PdfEngineImpl::CreatePageRun(pdf_page *page, fz_display_list *list)
         // the list of page image rectangles is terminated with a null-rectangle
         fz_rect *rects = AllocArray<fz_rect>(positions.Count() + 1);
         if (rects) {
+            RectIndex *index = new RectIndex();
             for (size_t i = 0; i < positions.Count(); i++) {
                 rects[i] = positions.At(i).rect;
             }
+            for (size_t i = 0; !fz_is_empty_rect(&rects[i]); i++) {
+                index->Append(fz_rect_to_RectD(rects[i]));
+            }
+            index->Build();
+            imageIndex[pageNo-1] = index;
             imageRects[pageNo-1] = rects;
         }
     }
@@ -1868,6 +3178,130 @@ PdfPageRun *PdfEngineImpl::CreatePageRun(pdf_page *page, fz_display_list *list)
     return new PdfPageRun(page, list, data);
 }
 
+// note: the fitz store is shared with all clones of the engine
+size_t PdfEngineImpl::GetMemoryUsage()
+{
+    size_t mem = 0, budget;
+    if (!gStoreBudgets.GetUsage(shared->ctx, &mem, &budget))
+        mem = 0;
+
+    ScopedCritSec scope(&pagesAccess);
+    for (size_t i = 0; i < runCache.Count(); i++) {
+        mem += runCache.At(i)->size_est;
+    }
+    for (int i = 0; _pages && i < PageCount(); i++) {
+        if (_pages[i])
+            mem += sizeof(pdf_page);
+    }
+    return mem;
+}
+
+// hashes obj and everything it references (the content of referenced objects
+// instead of their object numbers, which usually change when a document is
+// regenerated), except for references leading to other pages
+static void HashPdfObj(fz_context *ctx, pdf_document *doc, pdf_obj *obj, fz_md5 *md5, int depth=0)
+{
+    if (depth > 32)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "too deeply nested object");
+
+    if (pdf_is_indirect(obj)) {
+        // prevent infinite recursion for cyclic references
+        if (pdf_mark_obj(obj)) {
+            fz_md5_update(md5, (const unsigned char *)"R", 1);
+            return;
+        }
+        fz_try(ctx) {
+            int num = pdf_to_num(obj), gen = pdf_to_gen(obj);
+            if (pdf_is_stream(doc, num, gen)) {
+                fz_buffer *buf = pdf_load_raw_stream(doc, num, gen);
+                fz_md5_update(md5, buf->data, buf->len);
+                fz_drop_buffer(ctx, buf);
+            }
+            HashPdfObj(ctx, doc, pdf_resolve_indirect(obj), md5, depth + 1);
+        }
+        fz_always(ctx) {
+            pdf_unmark_obj(obj);
+        }
+        fz_catch(ctx) {
+            fz_rethrow(ctx);
+        }
+        return;
+    }
+
+    if (pdf_is_dict(obj)) {
+        fz_md5_update(md5, (const unsigned char *)"<<", 2);
+        for (int i = 0; i < pdf_dict_len(obj); i++) {
+            const char *key = pdf_to_name(pdf_dict_get_key(obj, i));
+            // skip the page tree and links to other pages and annotations
+            if (str::Eq(key, "Parent") || str::Eq(key, "P") || str::Eq(key, "Dest") ||
+                str::Eq(key, "A") || str::Eq(key, "B") || str::Eq(key, "Thumb")) {
+                continue;
+            }
+            fz_md5_update(md5, (const unsigned char *)key, (unsigned int)str::Len(key) + 1);
+            HashPdfObj(ctx, doc, pdf_dict_get_val(obj, i), md5, depth + 1);
+        }
+    }
+    else if (pdf_is_array(obj)) {
+        fz_md5_update(md5, (const unsigned char *)"[", 1);
+        for (int i = 0; i < pdf_array_len(obj); i++) {
+            HashPdfObj(ctx, doc, pdf_array_get(obj, i), md5, depth + 1);
+        }
+    }
+    else if (pdf_is_string(obj)) {
+        fz_md5_update(md5, (const unsigned char *)pdf_to_str_buf(obj), pdf_to_str_len(obj));
+    }
+    else if (pdf_is_name(obj)) {
+        const char *name = pdf_to_name(obj);
+        fz_md5_update(md5, (const unsigned char *)name, (unsigned int)str::Len(name) + 1);
+    }
+    else if (pdf_is_real(obj)) {
+        float value = pdf_to_real(obj);
+        fz_md5_update(md5, (const unsigned char *)&value, sizeof(value));
+    }
+    else {
+        int value = pdf_is_null(obj) ? INT_MIN : pdf_to_int(obj);
+        fz_md5_update(md5, (const unsigned char *)&value, sizeof(value));
+    }
+}
+
+bool PdfEngineImpl::GetPageDigest(int pageNo, unsigned char digest[16])
+{
+    pdf_obj *pageObj = GetPageObj(pageNo);
+    if (!pageObj)
+        return false;
+
+    ScopedCritSec scope(&ctxAccess);
+
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    fz_try(ctx) {
+        // attributes which might be inherited from the page tree
+        static const char *inheritable[] = { "MediaBox", "CropBox", "Rotate", "Resources" };
+        for (int i = 0; i < dimof(inheritable); i++) {
+            if (!pdf_dict_gets(pageObj, inheritable[i]))
+                HashPdfObj(ctx, _doc, pdf_lookup_inherited_page_item(_doc, pageObj, inheritable[i]), &md5);
+        }
+        HashPdfObj(ctx, _doc, pageObj, &md5);
+    }
+    fz_catch(ctx) {
+        return false;
+    }
+    fz_md5_final(&md5, digest);
+    return true;
+}
+
+// note: parsed pages are kept, as page elements (e.g. links) point into them
+void PdfEngineImpl::CompactMemory()
+{
+    ScopedCritSec scope(&pagesAccess);
+    // display lists still in use are deleted once they're no longer needed
+    while (runCache.Count() > 0) {
+        DropPageRun(runCache.Last(), true);
+    }
+    ScopedCritSec ctxScope(&ctxAccess);
+    fz_empty_store(ctx);
+}
+
 PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
 {
     PdfPageRun *result = NULL;
@@ -1880,41 +3314,48 @@ PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
             break;
         }
     }
+    if (result)
+        runCacheHits++;
     if (!result && !tryOnly) {
-        size_t mem = 0;
-        for (size_t i = 0; i < runCache.Count(); i++) {
-            // drop page runs that take up too much memory due to huge images
-            // (except for the very recently used ones)
-            if (i >= 2 && mem + runCache.At(i)->size_est >= MAX_PAGE_RUN_MEMORY)
-                DropPageRun(runCache.At(i--), true);
-            else
-                mem += runCache.At(i)->size_est;
-        }
-        if (runCache.Count() >= MAX_PAGE_RUN_CACHE) {
-            assert(runCache.Count() == MAX_PAGE_RUN_CACHE);
-            DropPageRun(runCache.Last(), true);
-        }
+        // reuse the display list if a clone has already created one
+        int pageObjNum = pdf_to_num(_pageObjs[GetPageNo(page) - 1]);
+        fz_display_list *list = pageObjNum ? shared->FindList(pageObjNum) : NULL;
+        bool isShared = list != NULL;
 
         ScopedCritSec scope2(&ctxAccess);
 
-        fz_display_list *list = NULL;
         fz_device *dev = NULL;
         fz_var(list);
         fz_var(dev);
-        fz_try(ctx) {
-            list = fz_new_display_list(ctx);
-            dev = fz_new_list_device(ctx, list);
-            pdf_run_page(_doc, page, dev, &fz_identity, NULL);
-        }
-        fz_catch(ctx) {
-            fz_drop_display_list(ctx, list);
-            list = NULL;
+        if (!list) {
+            fz_try(ctx) {
+                list = fz_new_display_list(ctx);
+                dev = fz_new_list_device(ctx, list);
+                pdf_run_page(_doc, page, dev, &fz_identity, NULL);
+            }
+            fz_catch(ctx) {
+                fz_drop_display_list(ctx, list);
+                list = NULL;
+            }
+            fz_free_device(dev);
         }
-        fz_free_device(dev);
+
+        if (isShared)
+            runCacheHits++;
+        else
+            runCacheMisses++;
 
         if (list) {
             result = CreatePageRun(page, list);
             runCache.InsertAt(0, result);
+            // Type 3 fonts are rendered with the document they've been loaded
+            // from, so such lists can't be used by other engines
+            if (!isShared && pageObjNum && !result->req_t3_fonts)
+                shared->AddList(pageObjNum, list);
+            // drop page runs that take up too much memory (e.g. due to huge images)
+            for (int idx; (idx = GetPageRunToDrop(runCache)) != -1; ) {
+                DropPageRun(runCache.At(idx), true);
+            }
         }
     }
     else if (result && result != runCache.At(0)) {
@@ -1928,14 +3369,18 @@ PdfPageRun *PdfEngineImpl::GetPageRun(pdf_page *page, bool tryOnly)
     return result;
 }
 
-bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm, RenderTarget target, const fz_rect *cliprect, bool cacheRun, FitzAbortCookie *cookie)
+bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm, RenderTarget target, const fz_rect *cliprect, bool cacheRun, FitzAbortCookie *cookie, int aaLevel)
 {
+    TRACE_SCOPE("RunPage");
     bool ok = true;
 
     PdfPageRun *run;
     if (Target_View == target && (run = GetPageRun(page, !cacheRun)) != NULL) {
         EnterCriticalSection(&ctxAccess);
-        Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
+        int prevAaLevel = fz_aa_level(ctx);
+        if (aaLevel >= 0)
+            fz_set_aa_level(ctx, aaLevel);
+        Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page), Target_View == target && overlayHighlights);
         fz_try(ctx) {
             fz_rect pagerect;
             fz_begin_page(dev, pdf_bound_page(_doc, page, &pagerect), ctm);
@@ -1948,6 +3393,7 @@ bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm
         fz_catch(ctx) {
             ok = false;
         }
+        fz_set_aa_level(ctx, prevAaLevel);
         LeaveCriticalSection(&ctxAccess);
         DropPageRun(run);
     }
@@ -1955,7 +3401,10 @@ bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm
         ScopedCritSec scope(&ctxAccess);
         char *targetName = target == Target_Print ? "Print" :
                            target == Target_Export ? "Export" : "View";
-        Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page));
+        int prevAaLevel = fz_aa_level(ctx);
+        if (aaLevel >= 0)
+            fz_set_aa_level(ctx, aaLevel);
+        Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page), Target_View == target && overlayHighlights);
         fz_try(ctx) {
             fz_rect pagerect;
             fz_begin_page(dev, pdf_bound_page(_doc, page, &pagerect), ctm);
@@ -1968,6 +3417,7 @@ bool PdfEngineImpl::RunPage(pdf_page *page, fz_device *dev, const fz_matrix *ctm
         fz_catch(ctx) {
             ok = false;
         }
+        fz_set_aa_level(ctx, prevAaLevel);
     }
 
     EnterCriticalSection(&ctxAccess);
@@ -1986,7 +3436,7 @@ void PdfEngineImpl::DropPageRun(PdfPageRun *run, bool forceRemove)
         runCache.Remove(run);
         if (0 == run->refs) {
             EnterCriticalSection(&ctxAccess);
-            fz_drop_display_list(ctx, run->list);
+            shared->DropList(ctx, run->list);
             LeaveCriticalSection(&ctxAccess);
             delete run;
         }
@@ -2001,7 +3451,12 @@ RectD PdfEngineImpl::PageMediabox(int pageNo)
     if (!_mediaboxes[pageNo-1].IsEmpty())
         return _mediaboxes[pageNo-1];
 
-    pdf_obj *page = _pageObjs[pageNo - 1];
+    pdf_obj *page = GetPageObj(pageNo);
+    if (!page && IsStillLoading()) {
+        // use the first page's size until the document has been reloaded
+        // (note: the result mustn't be cached in _mediaboxes)
+        return pageNo > 1 ? PageMediabox(1) : RectD(0, 0, 612, 792);
+    }
     if (!page)
         return RectD();
 
@@ -2041,9 +3496,53 @@ RectD PdfEngineImpl::PageMediabox(int pageNo)
     return _mediaboxes[pageNo-1];
 }
 
+RectD PdfEngineImpl::PageMediaboxEstimate(int pageNo, bool *isExact)
+{
+    assert(1 <= pageNo && pageNo <= PageCount());
+    *isExact = !_mediaboxes[pageNo-1].IsEmpty();
+    if (*isExact)
+        return _mediaboxes[pageNo-1];
+
+    ScopedCritSec scope(&ctxAccess);
+    if (!_mediaboxEstimate.IsEmpty())
+        return _mediaboxEstimate;
+
+    // most documents only define a single MediaBox at the root of the page tree
+    fz_rect mbox = fz_empty_rect, cbox = fz_empty_rect;
+    int rotate = 0;
+    fz_try(ctx) {
+        pdf_obj *pages = pdf_dict_getp(pdf_trailer(_doc), "Root/Pages");
+        pdf_to_rect(ctx, pdf_dict_gets(pages, "MediaBox"), &mbox);
+        pdf_to_rect(ctx, pdf_dict_gets(pages, "CropBox"), &cbox);
+        rotate = pdf_to_int(pdf_dict_gets(pages, "Rotate"));
+    }
+    fz_catch(ctx) { }
+    if (!fz_is_empty_rect(&cbox))
+        fz_intersect_rect(&mbox, &cbox);
+    if (fz_is_empty_rect(&mbox)) {
+        // pages define their own MediaBox, so take the first page as reference
+        _mediaboxEstimate = PageMediabox(1);
+        *isExact = 1 == pageNo;
+        return _mediaboxEstimate;
+    }
+    if ((rotate % 90) != 0)
+        rotate = 0;
+    fz_matrix ctm;
+    fz_transform_rect(&mbox, fz_rotate(&ctm, (float)rotate));
+
+    _mediaboxEstimate = RectD(0, 0, mbox.x1 - mbox.x0, mbox.y1 - mbox.y0);
+    return _mediaboxEstimate;
+}
+
 RectD PdfEngineImpl::PageContentBox(int pageNo, RenderTarget target)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
+    EnterCriticalSection(&pagesAccess);
+    RectD cbox = _contentBoxes[CONTENT_BOX_IX(pageNo, target)];
+    LeaveCriticalSection(&pagesAccess);
+    if (!cbox.IsEmpty())
+        return cbox;
+
     pdf_page *page = GetPdfPage(pageNo);
     if (!page)
         return RectD();
@@ -2066,10 +3565,14 @@ RectD PdfEngineImpl::PageContentBox(int pageNo, RenderTarget target)
     if (!ok)
         return PageMediabox(pageNo);
     if (fz_is_infinite_rect(&rect))
-        return PageMediabox(pageNo);
+        cbox = PageMediabox(pageNo);
+    else
+        cbox = fz_rect_to_RectD(rect).Intersect(PageMediabox(pageNo));
 
-    RectD rect2 = fz_rect_to_RectD(rect);
-    return rect2.Intersect(PageMediabox(pageNo));
+    EnterCriticalSection(&pagesAccess);
+    _contentBoxes[CONTENT_BOX_IX(pageNo, target)] = cbox;
+    LeaveCriticalSection(&pagesAccess);
+    return cbox;
 }
 
 PointD PdfEngineImpl::Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse)
@@ -2173,8 +3676,38 @@ bool PdfEngineImpl::PreferGdiPlusDevice(pdf_page *page, float zoom, fz_rect clip
     return result;
 }
 
+// aborts rendering once the cookie (if it's been set) shows up
+static VOID CALLBACK AbortRenderingTimer(PVOID data, BOOLEAN fired)
+{
+    AbortCookie *cookie = *(AbortCookie * volatile *)data;
+    if (cookie)
+        cookie->Abort();
+}
+
 RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
 {
+    if (loadMode != Load_Thumbnail || cookie_out)
+        return RenderBitmap(pageNo, zoom, rotation, pageRect, target, cookie_out, -1);
+
+    // don't let a single complex page hold up loading thumbnails for a whole folder
+    AbortCookie *cookie = NULL;
+    HANDLE timer = NULL;
+    if (!CreateTimerQueueTimer(&timer, NULL, AbortRenderingTimer, &cookie,
+                               THUMBNAIL_RENDER_TIMEOUT_MS, 100, WT_EXECUTEDEFAULT))
+        timer = NULL;
+    RenderedBitmap *bmp = RenderBitmap(pageNo, zoom, rotation, pageRect, target, &cookie, -1);
+    // wait for a currently running callback to complete
+    if (timer)
+        DeleteTimerQueueTimer(NULL, timer, INVALID_HANDLE_VALUE);
+    delete cookie;
+    return bmp;
+}
+
+// aaLevel is the anti-aliasing level to temporarily use (-1 for the current one)
+RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out, int aaLevel)
+{
+    TRACE_SCOPE_N("RenderBitmap", pageNo);
+    gStoreBudgets.Touch(shared->ctx);
     pdf_page* page = GetPdfPage(pageNo);
     if (!page)
         return NULL;
@@ -2212,14 +3745,24 @@ RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         return new RenderedBitmap(hbmp, SizeI(w, h));
     }
 
+    PdfPageRun *run = Target_View == target ? GetPageRun(page) : NULL;
+    if (run && !run->req_t3_fonts) {
+        RenderedBitmap *bitmap = RenderPageRun(page, run, &ctm, &bbox, cookie_out, aaLevel);
+        DropPageRun(run);
+        return bitmap;
+    }
+    if (run)
+        DropPageRun(run);
+
     fz_pixmap *image = NULL;
+    fz_var(image);
     EnterCriticalSection(&ctxAccess);
     fz_try(ctx) {
-        fz_colorspace *colorspace = fz_device_rgb(ctx);
-        image = fz_new_pixmap_with_bbox(ctx, colorspace, &bbox);
+        image = fz_new_gdi_pixmap(ctx, &bbox);
         fz_clear_pixmap_with_value(ctx, image, 0xFF); // initialize white background
     }
     fz_catch(ctx) {
+        fz_drop_gdi_pixmap(ctx, image);
         LeaveCriticalSection(&ctxAccess);
         return NULL;
     }
@@ -2229,7 +3772,7 @@ RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         dev = fz_new_draw_device(ctx, image);
     }
     fz_catch(ctx) {
-        fz_drop_pixmap(ctx, image);
+        fz_drop_gdi_pixmap(ctx, image);
         LeaveCriticalSection(&ctxAccess);
         return NULL;
     }
@@ -2239,14 +3782,165 @@ RenderedBitmap *PdfEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
     if (cookie_out)
         *cookie_out = cookie = new FitzAbortCookie();
     fz_rect cliprect;
-    bool ok = RunPage(page, dev, &ctm, target, fz_rect_from_irect(&cliprect, &bbox), true, cookie);
+    bool ok = RunPage(page, dev, &ctm, target, fz_rect_from_irect(&cliprect, &bbox), true, cookie, aaLevel);
 
     ScopedCritSec scope(&ctxAccess);
 
     RenderedBitmap *bitmap = NULL;
     if (ok)
         bitmap = new_rendered_fz_pixmap(ctx, image);
-    fz_drop_pixmap(ctx, image);
+    fz_drop_gdi_pixmap(ctx, image);
+    return bitmap;
+}
+
+// what's needed for rasterizing a page's display list (shared by all bands)
+struct PageRunJob {
+    fz_display_list *list;
+    const fz_matrix *ctm;
+    const fz_rect *pagerect;
+    bool transparency;
+    Vec<PageAnnotation>& pageAnnots;
+    fz_cookie *cookie;
+
+    PageRunJob(fz_display_list *list, const fz_matrix *ctm, const fz_rect *pagerect, bool transparency,
+               Vec<PageAnnotation>& pageAnnots, fz_cookie *cookie) : list(list), ctm(ctm),
+        pagerect(pagerect), transparency(transparency), pageAnnots(pageAnnots), cookie(cookie) { }
+};
+
+// rasterizes the rows of band into image (which has been created by
+// fz_new_gdi_pixmap) through a pixmap sharing image's samples
+static bool fz_run_page_band(fz_context *ctx, PageRunJob *job, fz_pixmap *image, const fz_irect *band)
+{
+    fz_pixmap *pixmap = NULL;
+    fz_device *dev = NULL;
+    fz_var(pixmap);
+    fz_var(dev);
+    bool ok = false;
+    fz_try(ctx) {
+        unsigned char *samples = image->samples + (band->y0 - image->y) * image->w * image->n;
+        pixmap = fz_new_pixmap_with_bbox_and_data(ctx, fz_device_bgr(ctx), band, samples);
+        dev = fz_new_draw_device(ctx, pixmap);
+
+        fz_rect cliprect;
+        fz_rect_from_irect(&cliprect, band);
+        fz_begin_page(dev, job->pagerect, job->ctm);
+        fz_run_page_transparency(job->pageAnnots, dev, &cliprect, false, job->transparency);
+        fz_run_display_list(job->list, dev, job->ctm, &cliprect, job->cookie);
+        fz_run_page_transparency(job->pageAnnots, dev, &cliprect, true, job->transparency);
+        fz_run_user_page_annots(job->pageAnnots, dev, job->ctm, &cliprect, job->cookie);
+        fz_end_page(dev);
+        ok = true;
+    }
+    fz_catch(ctx) { }
+    fz_free_device(dev);
+    // the samples still belong to image
+    fz_drop_pixmap(ctx, pixmap);
+    return ok;
+}
+
+class PageRunBandTask : public ThreadPoolTask {
+    fz_context *ctx;
+    PageRunJob *job;
+    fz_pixmap *image;
+    fz_irect band;
+
+public:
+    bool ok;
+
+    // takes ownership of ctx
+    PageRunBandTask(fz_context *ctx, PageRunJob *job, fz_pixmap *image, const fz_irect *band) :
+        ctx(ctx), job(job), image(image), band(*band), ok(false) { }
+    virtual ~PageRunBandTask() { fz_free_context(ctx); }
+
+    virtual void Run() { ok = fz_run_page_band(ctx, job, image, &band); }
+};
+
+// rasterizing a single large bitmap is spread over the thread pool,
+// as a single tile covers the whole screen at default settings
+static int GetRenderBandCount(const fz_irect *bbox)
+{
+    int dx = bbox->x1 - bbox->x0, dy = bbox->y1 - bbox->y0;
+    if ((int64)dx * dy < MIN_BANDING_PIXELS)
+        return 1;
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int count = min((int)si.dwNumberOfProcessors, dy / MIN_BAND_HEIGHT);
+    return limitValue(count, 1, MAX_RENDER_BANDS);
+}
+
+// renders a page from its cached display list in a context of its own, so that
+// other threads don't have to wait for ctxAccess in the meantime (display lists
+// don't reference the document, except for Type 3 fonts' glyph procedures)
+RenderedBitmap *PdfEngineImpl::RenderPageRun(pdf_page *page, PdfPageRun *run, const fz_matrix *ctm,
+                                             const fz_irect *bbox, AbortCookie **cookie_out, int aaLevel)
+{
+    EnterCriticalSection(&ctxAccess);
+    fz_context *renderCtx = fz_clone_context(ctx);
+    // page runs are only rendered for Target_View
+    Vec<PageAnnotation> pageAnnots = fz_get_user_page_annots(userAnnots, GetPageNo(page), overlayHighlights);
+    fz_rect pagerect;
+    pdf_bound_page(_doc, page, &pagerect);
+    LeaveCriticalSection(&ctxAccess);
+    if (!renderCtx)
+        return NULL;
+    if (aaLevel >= 0)
+        fz_set_aa_level(renderCtx, aaLevel);
+
+    FitzAbortCookie *cookie = NULL;
+    if (cookie_out)
+        *cookie_out = cookie = new FitzAbortCookie();
+
+    PageRunJob job(run->list, ctm, &pagerect, page->transparency, pageAnnots, cookie ? &cookie->cookie : NULL);
+    fz_pixmap *image = NULL;
+    RenderedBitmap *bitmap = NULL;
+    fz_var(image);
+    fz_try(renderCtx) {
+        image = fz_new_gdi_pixmap(renderCtx, bbox);
+        fz_clear_pixmap_with_value(renderCtx, image, 0xFF); // initialize white background
+    }
+    fz_catch(renderCtx) {
+        fz_free_context(renderCtx);
+        return NULL;
+    }
+
+    // all bands but the first one are rasterized by the thread pool
+    // (into the same pixmap, each with a clone of renderCtx)
+    int bandCount = GetRenderBandCount(bbox);
+    int bandDy = (bbox->y1 - bbox->y0 + bandCount - 1) / bandCount;
+    Vec<PageRunBandTask *> tasks;
+    TaskGroup bandTasks;
+    for (int i = 1; i < bandCount; i++) {
+        fz_irect band = *bbox;
+        band.y0 = bbox->y0 + i * bandDy;
+        band.y1 = min(band.y0 + bandDy, bbox->y1);
+        fz_context *bandCtx = fz_clone_context(renderCtx);
+        if (!bandCtx)
+            break;
+        PageRunBandTask *task = new PageRunBandTask(bandCtx, &job, image, &band);
+        tasks.Append(task);
+        bandTasks.Queue(task, TaskPriorityHigh);
+    }
+    // if cloning failed for some bands, the calling thread rasterizes these as well
+    fz_irect band = *bbox;
+    if (tasks.Count() > 0)
+        band.y1 = bbox->y0 + bandDy;
+    bool ok = fz_run_page_band(renderCtx, &job, image, &band);
+    if (tasks.Count() > 0 && tasks.Count() + 1 < (size_t)bandCount) {
+        band.y0 = bbox->y0 + (int)(tasks.Count() + 1) * bandDy;
+        band.y1 = bbox->y1;
+        ok = fz_run_page_band(renderCtx, &job, image, &band) && ok;
+    }
+    bandTasks.Wait();
+    for (size_t i = 0; i < tasks.Count(); i++) {
+        ok = ok && tasks.At(i)->ok;
+    }
+    DeleteVecMembers(tasks);
+
+    if (ok && !(cookie && cookie->cookie.abort))
+        bitmap = new_rendered_fz_pixmap(renderCtx, image);
+    fz_drop_gdi_pixmap(renderCtx, image);
+    fz_free_context(renderCtx);
+
     return bitmap;
 }
 
@@ -2257,30 +3951,25 @@ PageElement *PdfEngineImpl::GetElementAtPos(int pageNo, PointD pt)
         return NULL;
 
     fz_point p = { (float)pt.x, (float)pt.y };
-    for (fz_link *link = page->links; link; link = link->next) {
-        if (link->dest.kind != FZ_LINK_NONE && fz_is_pt_in_rect(link->rect, p))
-            return new PdfLink(this, &link->dest, link->rect, pageNo, &p);
+    PointD ptf(p.x, p.y);
+    int ix = linkIndex[pageNo-1] ? linkIndex[pageNo-1]->Find(ptf) : -1;
+    if (ix != -1) {
+        fz_link *link = (fz_link *)linkIndex[pageNo-1]->DataAt(ix);
+        return new PdfLink(this, &link->dest, link->rect, pageNo, &p);
     }
 
-    if (pageAnnots[pageNo-1]) {
-        for (size_t i = 0; pageAnnots[pageNo-1][i]; i++) {
-            pdf_annot *annot = pageAnnots[pageNo-1][i];
-            fz_rect rect = annot->rect;
-            fz_transform_rect(&rect, &page->ctm);
-            if (fz_is_pt_in_rect(rect, p)) {
-                ScopedCritSec scope(&ctxAccess);
+    ix = annotIndex[pageNo-1] ? annotIndex[pageNo-1]->Find(ptf) : -1;
+    if (ix != -1) {
+        pdf_annot *annot = pageAnnots[pageNo-1][ix];
+        ScopedCritSec scope(&ctxAccess);
 
-                ScopedMem<WCHAR> contents(str::conv::FromPdf(pdf_dict_gets(annot->obj, "Contents")));
-                return new PdfComment(contents, fz_rect_to_RectD(rect), pageNo);
-            }
-        }
+        ScopedMem<WCHAR> contents(str::conv::FromPdf(pdf_dict_gets(annot->obj, "Contents")));
+        return new PdfComment(contents, annotIndex[pageNo-1]->RectAt(ix), pageNo);
     }
 
-    if (imageRects[pageNo-1]) {
-        for (size_t i = 0; !fz_is_empty_rect(&imageRects[pageNo-1][i]); i++)
-            if (fz_is_pt_in_rect(imageRects[pageNo-1][i], p))
-                return new PdfImage(this, pageNo, imageRects[pageNo-1][i], i);
-    }
+    ix = imageIndex[pageNo-1] ? imageIndex[pageNo-1]->Find(ptf) : -1;
+    if (ix != -1)
+        return new PdfImage(this, pageNo, imageRects[pageNo-1][ix], ix);
 
     return NULL;
 }
@@ -2355,6 +4044,30 @@ void PdfEngineImpl::LinkifyPageText(pdf_page *page)
     free(coords);
 }
 
+// pages with many links (e.g. indexes) would make hit testing slow
+// in GetElementAtPos, so index all hoverable elements once
+void PdfEngineImpl::BuildElementIndex(pdf_page *page, int pageNo)
+{
+    RectIndex *index = new RectIndex();
+    for (fz_link *link = page->links; link; link = link->next) {
+        if (link->dest.kind != FZ_LINK_NONE)
+            index->Append(fz_rect_to_RectD(link->rect), link);
+    }
+    index->Build();
+    linkIndex[pageNo-1] = index;
+
+    if (!pageAnnots[pageNo-1])
+        return;
+    index = new RectIndex();
+    for (size_t i = 0; pageAnnots[pageNo-1][i]; i++) {
+        fz_rect rect = pageAnnots[pageNo-1][i]->rect;
+        fz_transform_rect(&rect, &page->ctm);
+        index->Append(fz_rect_to_RectD(rect));
+    }
+    index->Build();
+    annotIndex[pageNo-1] = index;
+}
+
 pdf_annot **PdfEngineImpl::ProcessPageAnnotations(pdf_page *page)
 {
     Vec<pdf_annot *> annots;
@@ -2426,11 +4139,22 @@ RenderedBitmap *PdfEngineImpl::GetPageImage(int pageNo, RectD rect, size_t image
         return NULL;
     }
 
+    // translucent images and images with a soft mask only look as expected
+    // when composited with the page, so render the image's area of the page
+    // at (about) the image's resolution instead of decoding it directly
+    fz_image *image = positions.At(imageIx).image;
+    if (image->mask || positions.At(imageIx).alpha < 1.0f) {
+        float zoom = max(image->w / (float)rect.dx, image->h / (float)rect.dy);
+        // limit the size of the rendered bitmap to MAX_IMAGE_PIXELS
+        if (zoom * zoom * rect.dx * rect.dy > MAX_IMAGE_PIXELS)
+            zoom = (float)sqrt(MAX_IMAGE_PIXELS / (rect.dx * rect.dy));
+        return RenderBitmap(pageNo, zoom, 0, &rect, Target_Export);
+    }
+
     ScopedCritSec scope(&ctxAccess);
 
     fz_pixmap *pixmap = NULL;
     fz_try(ctx) {
-        fz_image *image = positions.At(imageIx).image;
         pixmap = fz_new_pixmap_from_image(ctx, image, image->w, image->h);
     }
     fz_catch(ctx) {
@@ -2442,26 +4166,29 @@ RenderedBitmap *PdfEngineImpl::GetPageImage(int pageNo, RectD rect, size_t image
     return bmp;
 }
 
-WCHAR *PdfEngineImpl::ExtractPageText(pdf_page *page, WCHAR *lineSep, RectI **coords_out, RenderTarget target, bool cacheRun)
+// if sheet is NULL, a text sheet is created for just this page
+WCHAR *PdfEngineImpl::ExtractPageText(pdf_page *page, WCHAR *lineSep, RectI **coords_out, RenderTarget target, bool cacheRun, fz_text_sheet *sheet)
 {
     if (!page)
         return NULL;
+    TRACE_SCOPE("ExtractPageText");
 
-    fz_text_sheet *sheet = NULL;
+    fz_text_sheet *ownSheet = NULL;
     fz_text_page *text = NULL;
     fz_device *dev = NULL;
-    fz_var(sheet);
+    fz_var(ownSheet);
     fz_var(text);
 
     EnterCriticalSection(&ctxAccess);
     fz_try(ctx) {
-        sheet = fz_new_text_sheet(ctx);
+        if (!sheet)
+            sheet = ownSheet = fz_new_text_sheet(ctx);
         text = fz_new_text_page(ctx);
         dev = fz_new_text_device(ctx, sheet, text);
     }
     fz_catch(ctx) {
         fz_free_text_page(ctx, text);
-        fz_free_text_sheet(ctx, sheet);
+        fz_free_text_sheet(ctx, ownSheet);
         LeaveCriticalSection(&ctxAccess);
         return NULL;
     }
@@ -2478,20 +4205,30 @@ WCHAR *PdfEngineImpl::ExtractPageText(pdf_page *page, WCHAR *lineSep, RectI **co
     if (ok)
         content = fz_text_page_to_str(text, lineSep, coords_out);
     fz_free_text_page(ctx, text);
-    fz_free_text_sheet(ctx, sheet);
+    fz_free_text_sheet(ctx, ownSheet);
 
     return content;
 }
 
 WCHAR *PdfEngineImpl::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_out, RenderTarget target)
+{
+    return ExtractPageText(pageNo, lineSep, coords_out, target, NULL);
+}
+
+WCHAR *PdfEngineImpl::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords_out, RenderTarget target, fz_text_sheet *sheet)
 {
     pdf_page *page = GetPdfPage(pageNo, true);
     if (page)
-        return ExtractPageText(page, lineSep, coords_out, target);
+        return ExtractPageText(page, lineSep, coords_out, target, false, sheet);
 
     EnterCriticalSection(&ctxAccess);
+    pdf_obj *pageObj = GetPageObj(pageNo);
+    if (!pageObj && IsStillLoading()) {
+        LeaveCriticalSection(&ctxAccess);
+        return NULL;
+    }
     fz_try(ctx) {
-        page = pdf_load_page_by_obj(_doc, pageNo - 1, _pageObjs[pageNo-1]);
+        page = pdf_load_page_by_obj(_doc, pageNo - 1, pageObj);
     }
     fz_catch(ctx) {
         LeaveCriticalSection(&ctxAccess);
@@ -2499,7 +4236,7 @@ WCHAR *PdfEngineImpl::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords
     }
     LeaveCriticalSection(&ctxAccess);
 
-    WCHAR *result = ExtractPageText(page, lineSep, coords_out, target);
+    WCHAR *result = ExtractPageText(page, lineSep, coords_out, target, false, sheet);
 
     EnterCriticalSection(&ctxAccess);
     pdf_free_page(_doc, page);
@@ -2508,6 +4245,34 @@ WCHAR *PdfEngineImpl::ExtractPageText(int pageNo, WCHAR *lineSep, RectI **coords
     return result;
 }
 
+bool PdfEngineImpl::ExtractTextRange(int startPage, int endPage, WCHAR *lineSep, TextExtractionSink *sink, bool withCoords, RenderTarget target)
+{
+    // all pages share a single text sheet, so that every font and size
+    // is only turned into a text style once
+    fz_text_sheet *sheet = NULL;
+    EnterCriticalSection(&ctxAccess);
+    fz_try(ctx) {
+        sheet = fz_new_text_sheet(ctx);
+    }
+    fz_catch(ctx) {
+        sheet = NULL;
+    }
+    LeaveCriticalSection(&ctxAccess);
+    if (!sheet)
+        return BaseEngine::ExtractTextRange(startPage, endPage, lineSep, sink, withCoords, target);
+
+    bool completed = true;
+    for (int pageNo = startPage; pageNo <= endPage && completed; pageNo++) {
+        RectI *coords = NULL;
+        WCHAR *text = ExtractPageText(pageNo, lineSep, withCoords ? &coords : NULL, target, sheet);
+        completed = sink->PageTextExtracted(pageNo, text, coords);
+    }
+
+    ScopedCritSec scope(&ctxAccess);
+    fz_free_text_sheet(ctx, sheet);
+    return completed;
+}
+
 bool PdfEngineImpl::IsLinearizedFile()
 {
     ScopedCritSec scope(&ctxAccess);
@@ -2728,12 +4493,17 @@ bool PdfEngineImpl::SupportsAnnotation(bool forSaving) const
 
 void PdfEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation> *list)
 {
-    // TODO: use a new critical section to avoid blocking the UI thread
-    ScopedCritSec scope(&ctxAccess);
-    if (list)
-        userAnnots = *list;
-    else
-        userAnnots.Reset();
+    {
+        // TODO: use a new critical section to avoid blocking the UI thread
+        ScopedCritSec scope(&ctxAccess);
+        if (list)
+            userAnnots = *list;
+        else
+            userAnnots.Reset();
+    }
+    // annotations are part of a page's content
+    ScopedCritSec scope(&pagesAccess);
+    ZeroMemory(_contentBoxes, PageCount() * CONTENT_BOX_TARGETS * sizeof(RectD));
 }
 
 char *PdfEngineImpl::GetDecryptionKey() const
@@ -2791,16 +4561,19 @@ unsigned char *PdfEngineImpl::GetFileData(size_t *cbCount)
 
 bool PdfEngineImpl::SaveFileAs(const WCHAR *copyFileName)
 {
-    size_t dataLen;
-    ScopedMem<unsigned char> data(GetFileData(&dataLen));
-    if (data) {
-        bool ok = file::WriteAll(copyFileName, data.Get(), dataLen);
-        if (ok)
-            return SaveUserAnnots(copyFileName);
+    // copy the data mupdf has actually loaded (which might differ from what's
+    // on disk), so that the incremental update matches the copied document
+    bool ok;
+    {
+        ScopedCritSec scope(&ctxAccess);
+        ok = fz_copy_stream_to_file_safe(_doc->file, copyFileName, _fileName);
     }
-    if (!_fileName)
+    if (ok)
+        return SaveUserAnnots(copyFileName);
+    // copying a file onto itself fails (and isn't needed)
+    if (!_fileName || path::IsSame(_fileName, copyFileName))
         return false;
-    bool ok = CopyFile(_fileName, copyFileName, FALSE);
+    ok = CopyFile(_fileName, copyFileName, FALSE);
     if (!ok)
         return false;
     // TODO: try to recover when SaveUserAnnots fails?
@@ -2983,6 +4756,38 @@ bool PdfEngineImpl::SaveEmbedded(LinkSaverUI& saveUI, int num, int gen)
 {
     ScopedCritSec scope(&ctxAccess);
 
+    // the decoded size is optional (cf. PDF Reference, 7.11.4 Embedded File Streams)
+    size_t totalSize = 0;
+    fz_try(ctx) {
+        pdf_obj *obj = pdf_load_object(_doc, num, gen);
+        totalSize = (size_t)max(pdf_to_int(pdf_dict_getp(obj, "Params/Size")), 0);
+        pdf_drop_obj(obj);
+    }
+    fz_catch(ctx) { }
+
+    // write the decoded data in chunks so that memory use doesn't depend on the file's size
+    if (saveUI.StartSaveEmbedded(totalSize)) {
+        ScopedMem<unsigned char> buf((unsigned char *)malloc(STREAM_COPY_CHUNK_SIZE));
+        bool ok = buf != NULL;
+        fz_stream *stm = NULL;
+        fz_var(stm);
+        fz_var(ok);
+        fz_try(ctx) {
+            stm = pdf_open_stream(_doc, num, gen);
+            int read;
+            while (ok && (read = fz_read(stm, buf, STREAM_COPY_CHUNK_SIZE)) > 0) {
+                ok = saveUI.SaveEmbeddedChunk(buf, read);
+            }
+        }
+        fz_always(ctx) {
+            fz_close(stm);
+        }
+        fz_catch(ctx) {
+            ok = false;
+        }
+        return saveUI.FinishSaveEmbedded(ok);
+    }
+
     fz_buffer *data = NULL;
     fz_try(ctx) {
         data = pdf_load_stream(_doc, num, gen);
@@ -3016,12 +4821,12 @@ WCHAR *PdfEngineImpl::GetPageLabel(int pageNo) const
     if (!_pagelabels || pageNo < 1 || PageCount() < pageNo)
         return BaseEngine::GetPageLabel(pageNo);
 
-    return str::Dup(_pagelabels->At(pageNo - 1));
+    return _pagelabels->GetLabel(pageNo);
 }
 
 int PdfEngineImpl::GetPageByLabel(const WCHAR *label) const
 {
-    int pageNo = _pagelabels ? _pagelabels->Find(label) + 1 : 0;
+    int pageNo = _pagelabels ? _pagelabels->GetPageNo(label) : 0;
     if (!pageNo)
         return BaseEngine::GetPageByLabel(label);
 
@@ -3229,13 +5034,19 @@ bool PdfEngine::IsSupportedFile(const WCHAR *fileName, bool sniff)
 PdfEngine *PdfEngine::CreateFromFile(const WCHAR *fileName, PasswordUI *pwdUI)
 {
     PdfEngineImpl *engine = new PdfEngineImpl();
-    if (!engine || !fileName || !engine->Load(fileName, pwdUI)) {
+    if (!engine || !fileName || !engine->Load(fileName, pwdUI, true)) {
         delete engine;
         return NULL;
     }
     return engine;
 }
 
+void PdfEngine::SetFileStillGrowing(const WCHAR *filePath, int64 finalSize)
+{
+    str::ReplacePtr(&gGrowingFilePath, filePath);
+    gGrowingFileSize = finalSize;
+}
+
 PdfEngine *PdfEngine::CreateFromStream(IStream *stream, PasswordUI *pwdUI)
 {
     PdfEngineImpl *engine = new PdfEngineImpl();
@@ -3246,6 +5057,46 @@ PdfEngine *PdfEngine::CreateFromStream(IStream *stream, PasswordUI *pwdUI)
     return engine;
 }
 
+PdfEngine *PdfEngine::CreateThumbnailEngine(IStream *stream)
+{
+    // neither share the preloaded context nor compete for StoreBudgets
+    // (when Explorer requests thumbnails for all files of a folder at once)
+    PdfSharedContext *shared = new PdfSharedContext(THUMBNAIL_STORE_MEMORY);
+    PdfEngineImpl *engine = NULL;
+    if (shared->ctx) {
+        engine = new PdfEngineImpl(shared, Load_Thumbnail);
+        if (!engine->Load(stream)) {
+            delete engine;
+            engine = NULL;
+        }
+    }
+    shared->Release();
+    return engine;
+}
+
+// created by the first call to CreateTextEngine and kept for the lifetime of the process
+static PdfSharedContext *gTextContext = NULL;
+
+PdfEngine *PdfEngine::CreateTextEngine(IStream *stream)
+{
+    // search indexers extract the text of many documents after one another,
+    // so all documents share a single context (and thus the font cache)
+    if (!gTextContext) {
+        PdfSharedContext *shared = new PdfSharedContext(TEXT_STORE_MEMORY);
+        if (InterlockedCompareExchangePointer((void **)&gTextContext, shared, NULL) != NULL)
+            shared->Release();
+    }
+    if (!gTextContext->ctx)
+        return NULL;
+
+    PdfEngineImpl *engine = new PdfEngineImpl(gTextContext, Load_Text);
+    if (!engine->Load(stream)) {
+        delete engine;
+        return NULL;
+    }
+    return engine;
+}
+
 ///// XPS-specific extensions to Fitz/MuXPS /////
 
 extern "C" {
@@ -3422,6 +5273,8 @@ public:
     XpsEngineImpl();
     virtual ~XpsEngineImpl();
     virtual XpsEngineImpl *Clone();
+    // clones use their own fz_context and are rendered independently
+    virtual bool SupportsConcurrentRendering() const { return true; }
 
     virtual const WCHAR *FileName() const { return _fileName; };
     virtual int PageCount() const {
@@ -3456,8 +5309,27 @@ public:
 
     virtual float GetFileDPI() const { return 72.0f; }
     virtual const WCHAR *GetDefaultFileExt() const { return L".xps"; }
+    virtual size_t GetMemoryUsage();
+    virtual void CompactMemory();
 
     virtual bool BenchLoadPage(int pageNo) { return GetXpsPage(pageNo) != NULL; }
+    virtual bool BenchCacheStats(int *hits, int *misses) {
+        ScopedCritSec scope(&_pagesAccess);
+        *hits = runCacheHits;
+        *misses = runCacheMisses;
+        return true;
+    }
+    virtual bool BenchGlyphCacheStats(int *hits, int *misses) {
+        ScopedCritSec scope(&ctxAccess);
+        fz_glyph_cache_stats(ctx, hits, misses);
+        return true;
+    }
+    virtual bool BenchResourceCacheStats(size_t *used, size_t *budget) {
+        return gStoreBudgets.GetUsage(ctx, used, budget);
+    }
+    virtual bool BenchLockContention(int *ctxWaits, int *pagesWaits) {
+        return GetContentionCount(&ctxAccess, ctxWaits) && GetContentionCount(&_pagesAccess, pagesWaits);
+    }
 
     virtual Vec<PageElement *> *GetElements(int pageNo);
     virtual PageElement *GetElementAtPos(int pageNo, PointD pt);
@@ -3503,6 +5375,7 @@ protected:
                                     RectI **coords_out=NULL, bool cacheRun=false);
 
     Vec<XpsPageRun*>runCache; // ordered most recently used first
+    int             runCacheHits, runCacheMisses; // protected by _pagesAccess
     XpsPageRun    * CreatePageRun(xps_page *page, fz_display_list *list);
     XpsPageRun    * GetPageRun(xps_page *page, bool tryOnly=false);
     bool            RunPage(xps_page *page, fz_device *dev, const fz_matrix *ctm,
@@ -3516,6 +5389,8 @@ protected:
     WCHAR         * ExtractFontList();
 
     RectD         * _mediaboxes;
+    // cf. CONTENT_BOX_IX (access is protected by _pagesAccess)
+    RectD         * _contentBoxes;
     fz_outline    * _outline;
     xps_doc_props * _info;
     fz_rect      ** imageRects;
@@ -3596,7 +5471,7 @@ public:
 };
 
 XpsEngineImpl::XpsEngineImpl() : _fileName(NULL), _doc(NULL), _pages(NULL), _mediaboxes(NULL),
-    _outline(NULL), _info(NULL), imageRects(NULL)
+    _contentBoxes(NULL), _outline(NULL), _info(NULL), imageRects(NULL), runCacheHits(0), runCacheMisses(0)
 {
     InitializeCriticalSection(&_pagesAccess);
     InitializeCriticalSection(&ctxAccess);
@@ -3605,10 +5480,18 @@ XpsEngineImpl::XpsEngineImpl() : _fileName(NULL), _doc(NULL), _pages(NULL), _med
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
     ctx = fz_new_context(NULL, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
+    if (ctx) {
+        EnterCriticalSection(&ctxAccess);
+        fz_set_glyph_cache_size(ctx, gMaxGlyphCacheMemory);
+        LeaveCriticalSection(&ctxAccess);
+        gStoreBudgets.Register(ctx, &ctxAccess);
+    }
 }
 
 XpsEngineImpl::~XpsEngineImpl()
 {
+    if (ctx)
+        gStoreBudgets.Unregister(ctx);
     EnterCriticalSection(&_pagesAccess);
     EnterCriticalSection(&ctxAccess);
 
@@ -3638,6 +5521,7 @@ XpsEngineImpl::~XpsEngineImpl()
     ctx = NULL;
 
     free(_mediaboxes);
+    free(_contentBoxes);
     free(_fileName);
 
     LeaveCriticalSection(&ctxAccess);
@@ -3648,16 +5532,24 @@ XpsEngineImpl::~XpsEngineImpl()
 
 XpsEngineImpl *XpsEngineImpl::Clone()
 {
-    ScopedCritSec scope(&ctxAccess);
-
+    // the clone must be created and deleted outside of ctxAccess (cf. StoreBudgets)
     XpsEngineImpl *clone = new XpsEngineImpl();
-    if (!clone || !(_fileName ? clone->Load(_fileName) : clone->Load(_doc->file))) {
+    bool ok;
+    {
+        ScopedCritSec scope(&ctxAccess);
+        // memory mapped files are cloned so that all clones share the same view
+        bool fromStream = !_fileName || fz_is_mapped_stream(_doc->file);
+        ok = fromStream ? clone->Load(_doc->file) : clone->Load(_fileName);
+        if (ok && !clone->_fileName)
+            clone->_fileName = str::Dup(_fileName);
+        if (ok)
+            clone->UpdateUserAnnotations(&userAnnots);
+    }
+    if (!ok) {
         delete clone;
         return NULL;
     }
 
-    clone->UpdateUserAnnotations(&userAnnots);
-
     return clone;
 }
 
@@ -3739,9 +5631,10 @@ bool XpsEngineImpl::LoadFromStream(fz_stream *stm)
 
     _pages = AllocArray<xps_page *>(PageCount());
     _mediaboxes = AllocArray<RectD>(PageCount());
+    _contentBoxes = AllocArray<RectD>(PageCount() * CONTENT_BOX_TARGETS);
     imageRects = AllocArray<fz_rect *>(PageCount());
 
-    if (!_pages || !_mediaboxes || !imageRects)
+    if (!_pages || !_mediaboxes || !_contentBoxes || !imageRects)
         return false;
 
     fz_try(ctx) {
@@ -3767,6 +5660,7 @@ xps_page *XpsEngineImpl::GetXpsPage(int pageNo, bool failIfBusy)
     if (failIfBusy)
         return _pages[pageNo-1];
 
+    TRACE_SCOPE_N("GetXpsPage", pageNo);
     ScopedCritSec scope(&_pagesAccess);
 
     xps_page *page = _pages[pageNo-1];
@@ -3825,6 +5719,33 @@ XpsPageRun *XpsEngineImpl::CreatePageRun(xps_page *page, fz_display_list *list)
     return new XpsPageRun(page, list, data);
 }
 
+size_t XpsEngineImpl::GetMemoryUsage()
+{
+    size_t mem = 0, budget;
+    if (!gStoreBudgets.GetUsage(ctx, &mem, &budget))
+        mem = 0;
+
+    ScopedCritSec scope(&_pagesAccess);
+    for (size_t i = 0; i < runCache.Count(); i++) {
+        mem += runCache.At(i)->size_est;
+    }
+    for (int i = 0; _pages && i < PageCount(); i++) {
+        if (_pages[i])
+            mem += sizeof(xps_page);
+    }
+    return mem;
+}
+
+void XpsEngineImpl::CompactMemory()
+{
+    ScopedCritSec scope(&_pagesAccess);
+    while (runCache.Count() > 0) {
+        DropPageRun(runCache.Last(), true);
+    }
+    ScopedCritSec ctxScope(&ctxAccess);
+    fz_empty_store(ctx);
+}
+
 XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
 {
     ScopedCritSec scope(&_pagesAccess);
@@ -3837,20 +5758,10 @@ XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
             break;
         }
     }
+    if (result)
+        runCacheHits++;
     if (!result && !tryOnly) {
-        size_t mem = 0;
-        for (size_t i = 0; i < runCache.Count(); i++) {
-            // drop page runs that take up too much memory due to huge images
-            // (except for the very recently used ones)
-            if (i >= 2 && mem + runCache.At(i)->size_est >= MAX_PAGE_RUN_MEMORY)
-                DropPageRun(runCache.At(i--), true);
-            else
-                mem += runCache.At(i)->size_est;
-        }
-        if (runCache.Count() >= MAX_PAGE_RUN_CACHE) {
-            assert(runCache.Count() == MAX_PAGE_RUN_CACHE);
-            DropPageRun(runCache.Last(), true);
-        }
+        runCacheMisses++;
 
         ScopedCritSec ctxScope(&ctxAccess);
 
@@ -3872,6 +5783,10 @@ XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
         if (list) {
             result = CreatePageRun(page, list);
             runCache.InsertAt(0, result);
+            // drop page runs that take up too much memory (e.g. due to huge images)
+            for (int idx; (idx = GetPageRunToDrop(runCache)) != -1; ) {
+                DropPageRun(runCache.At(idx), true);
+            }
         }
     }
     else if (result && result != runCache.At(0)) {
@@ -3887,6 +5802,7 @@ XpsPageRun *XpsEngineImpl::GetPageRun(xps_page *page, bool tryOnly)
 
 bool XpsEngineImpl::RunPage(xps_page *page, fz_device *dev, const fz_matrix *ctm, const fz_rect *cliprect, bool cacheRun, FitzAbortCookie *cookie)
 {
+    TRACE_SCOPE("RunPage");
     bool ok = true;
 
     XpsPageRun *run = GetPageRun(page, !cacheRun);
@@ -3980,6 +5896,12 @@ RectD XpsEngineImpl::PageMediabox(int pageNo)
 RectD XpsEngineImpl::PageContentBox(int pageNo, RenderTarget target)
 {
     assert(1 <= pageNo && pageNo <= PageCount());
+    EnterCriticalSection(&_pagesAccess);
+    RectD cbox = _contentBoxes[CONTENT_BOX_IX(pageNo, target)];
+    LeaveCriticalSection(&_pagesAccess);
+    if (!cbox.IsEmpty())
+        return cbox;
+
     xps_page *page = GetXpsPage(pageNo);
     if (!page)
         return RectD();
@@ -4002,10 +5924,14 @@ RectD XpsEngineImpl::PageContentBox(int pageNo, RenderTarget target)
     if (!ok)
         return PageMediabox(pageNo);
     if (fz_is_infinite_rect(&rect))
-        return PageMediabox(pageNo);
+        cbox = PageMediabox(pageNo);
+    else
+        cbox = fz_rect_to_RectD(rect).Intersect(PageMediabox(pageNo));
 
-    RectD rect2 = fz_rect_to_RectD(rect);
-    return rect2.Intersect(PageMediabox(pageNo));
+    EnterCriticalSection(&_pagesAccess);
+    _contentBoxes[CONTENT_BOX_IX(pageNo, target)] = cbox;
+    LeaveCriticalSection(&_pagesAccess);
+    return cbox;
 }
 
 PointD XpsEngineImpl::Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse)
@@ -4082,6 +6008,8 @@ bool XpsEngineImpl::RenderPage(HDC hDC, xps_page *page, RectI screenRect, const
 
 RenderedBitmap *XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation, RectD *pageRect, RenderTarget target, AbortCookie **cookie_out)
 {
+    TRACE_SCOPE_N("RenderBitmap", pageNo);
+    gStoreBudgets.Touch(ctx);
     xps_page* page = GetXpsPage(pageNo);
     if (!page)
         return NULL;
@@ -4120,13 +6048,14 @@ RenderedBitmap *XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
     }
 
     fz_pixmap *image = NULL;
+    fz_var(image);
     EnterCriticalSection(&ctxAccess);
     fz_try(ctx) {
-        fz_colorspace *colorspace = fz_device_rgb(ctx);
-        image = fz_new_pixmap_with_bbox(ctx, colorspace, &bbox);
+        image = fz_new_gdi_pixmap(ctx, &bbox);
         fz_clear_pixmap_with_value(ctx, image, 0xFF); // initialize white background
     }
     fz_catch(ctx) {
+        fz_drop_gdi_pixmap(ctx, image);
         LeaveCriticalSection(&ctxAccess);
         return NULL;
     }
@@ -4136,7 +6065,7 @@ RenderedBitmap *XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
         dev = fz_new_draw_device(ctx, image);
     }
     fz_catch(ctx) {
-        fz_drop_pixmap(ctx, image);
+        fz_drop_gdi_pixmap(ctx, image);
         LeaveCriticalSection(&ctxAccess);
         return NULL;
     }
@@ -4153,7 +6082,7 @@ RenderedBitmap *XpsEngineImpl::RenderBitmap(int pageNo, float zoom, int rotation
     RenderedBitmap *bitmap = NULL;
     if (ok)
         bitmap = new_rendered_fz_pixmap(ctx, image);
-    fz_drop_pixmap(ctx, image);
+    fz_drop_gdi_pixmap(ctx, image);
     return bitmap;
 }
 
@@ -4161,6 +6090,7 @@ WCHAR *XpsEngineImpl::ExtractPageText(xps_page *page, WCHAR *lineSep, RectI **co
 {
     if (!page)
         return NULL;
+    TRACE_SCOPE("ExtractPageText");
 
     fz_text_sheet *sheet = NULL;
     fz_text_page *text = NULL;
@@ -4211,14 +6141,14 @@ unsigned char *XpsEngineImpl::GetFileData(size_t *cbCount)
 
 bool XpsEngineImpl::SaveFileAs(const WCHAR *copyFileName)
 {
-    size_t dataLen;
-    ScopedMem<unsigned char> data(GetFileData(&dataLen));
-    if (data) {
-        bool ok = file::WriteAll(copyFileName, data.Get(), dataLen);
-        if (ok)
-            return true;
+    bool ok;
+    {
+        ScopedCritSec scope(&ctxAccess);
+        ok = fz_copy_stream_to_file_safe(_doc->file, copyFileName, _fileName);
     }
-    if (!_fileName)
+    if (ok)
+        return true;
+    if (!_fileName || path::IsSame(_fileName, copyFileName))
         return false;
     return CopyFile(_fileName, copyFileName, FALSE);
 }
@@ -4269,12 +6199,17 @@ bool XpsEngineImpl::SupportsAnnotation(bool forSaving) const
 
 void XpsEngineImpl::UpdateUserAnnotations(Vec<PageAnnotation> *list)
 {
-    // TODO: use a new critical section to avoid blocking the UI thread
-    ScopedCritSec scope(&ctxAccess);
-    if (list)
-        userAnnots = *list;
-    else
-        userAnnots.Reset();
+    {
+        // TODO: use a new critical section to avoid blocking the UI thread
+        ScopedCritSec scope(&ctxAccess);
+        if (list)
+            userAnnots = *list;
+        else
+            userAnnots.Reset();
+    }
+    // annotations are part of a page's content
+    ScopedCritSec scope(&_pagesAccess);
+    ZeroMemory(_contentBoxes, PageCount() * CONTENT_BOX_TARGETS * sizeof(RectD));
 }
 
 PageElement *XpsEngineImpl::GetElementAtPos(int pageNo, PointD pt)
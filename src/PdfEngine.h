@@ -17,6 +17,15 @@ public:
     static bool IsSupportedFile(const WCHAR *fileName, bool sniff=false);
     static PdfEngine *CreateFromFile(const WCHAR *fileName, PasswordUI *pwdUI=NULL);
     static PdfEngine *CreateFromStream(IStream *stream, PasswordUI *pwdUI=NULL);
+    // loads only what's needed for rendering page 1 with limited memory and time
+    // (no outline, properties, page labels, links or annotations are available)
+    static PdfEngine *CreateThumbnailEngine(IStream *stream);
+    // loads only the properties and what's needed for extracting the pages' text
+    // (e.g. for search indexing) into a context shared by all such engines
+    static PdfEngine *CreateTextEngine(IStream *stream);
+    // the file at filePath is still being written to (e.g. downloaded by the
+    // browser plugin) and will be loaded progressively until it has finalSize bytes
+    static void SetFileStillGrowing(const WCHAR *filePath, int64 finalSize);
 };
 
 class XpsEngine : public BaseEngine {
@@ -27,6 +36,28 @@ public:
 };
 
 void CalcMD5Digest(const unsigned char *data, size_t byteCount, unsigned char digest[16]);
+// a digest over a file's size, modification time and its first and last 64 KB,
+// which is cheap enough for identifying cached data derived from large files
+bool CalcFileFingerprint(const WCHAR *filePath, unsigned char digest[16]);
 void DebugGdiPlusDevice(bool enable);
+// maximum amount of memory (in MB) for parsed page content cached per document
+// (if zero or negative, a default value is used)
+void SetDisplayListCacheSize(int maxMemoryMB);
+// maximum amount of memory (in MB) for rasterized glyphs cached per document
+// (if zero or negative, a default value is used)
+void SetGlyphCacheSize(int maxMemoryMB);
+// maximum amount of memory (in MB) for cached images, fonts, etc. of all
+// open documents together (if zero or negative, a default value is used)
+void SetResourceCacheSize(int maxMemoryMB);
+// whether large documents on local drives are memory mapped (which prevents
+// other programs from overwriting them while they're open)
+void SetMemoryMapLargeFiles(bool enable);
+// directory for caching the reconstructed xref tables of broken PDF documents
+// (if NULL, such documents are repaired every time they're loaded)
+void SetRepairedXrefCacheDir(const WCHAR *dir);
+// prepares a context with preloaded fonts for the next PdfEngine to be created
+// (this can be called from any thread and takes a while, so best from a background thread)
+void PreloadPdfEngineResources();
+void FreePreloadedPdfEngineResources();
 
 #endif
@@ -6,6 +6,7 @@
 
 #include "FileUtil.h"
 #include "PdfEngine.h"
+#include "ThreadUtil.h"
 
 #include "synctex_parser.h"
 
@@ -38,12 +39,18 @@ struct PdfsyncPoint {
     UINT page, x, y;
 };
 
+struct PdfsyncSortedLine {
+    size_t file;
+    UINT line;
+    size_t index; // index into lines
+};
+
 // Synchronizer based on .pdfsync file generated with the pdfsync tex package
 class Pdfsync : public Synchronizer
 {
 public:
     Pdfsync(const WCHAR* syncfilename, PdfEngine *engine) :
-        Synchronizer(syncfilename), engine(engine)
+        Synchronizer(syncfilename), engine(engine), parsedLen(0), parsedHash(0), page(1)
     {
         assert(str::EndsWithI(syncfilename, PDFSYNC_EXTENSION));
     }
@@ -53,6 +60,8 @@ public:
 
 private:
     int RebuildIndex();
+    void ParseLines(char *line, char *dataEnd);
+    size_t FindSortedLine(size_t file, UINT line) const;
     UINT SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<size_t>& records);
 
     PdfEngine *engine;          // needed for converting between coordinate systems
@@ -61,6 +70,33 @@ private:
     Vec<PdfsyncPoint> points;   // record-to-point mapping
     Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
     Vec<size_t> sheetIndex;     // start of entries for a sheet in <points>
+    Vec<PdfsyncSortedLine> sortedLines; // <lines> ordered by file and line number
+
+    // TeX appends to the sync file while compiling, so as long as the
+    // file only grows, only the newly added lines have to be parsed
+    size_t parsedLen;           // length of the data parsed so far
+    uint32_t parsedHash;        // hash of the data parsed so far
+    Vec<size_t> filestack;      // files still open at the end of the parsed data
+    UINT page;                  // current sheet at the end of the parsed data
+};
+
+// parses a .synctex(.gz) file in the background (large files
+// take long enough to parse for the UI to noticeably hang)
+class SyncTexParser : public ThreadBase
+{
+    ScopedMem<char> syncfname;
+
+public:
+    synctex_scanner_t scanner;
+
+    explicit SyncTexParser(const char *syncfname) :
+        ThreadBase("SyncTexParser"), syncfname(str::Dup(syncfname)), scanner(NULL) { }
+    virtual ~SyncTexParser() { }
+
+    virtual void Run() {
+        if (syncfname)
+            scanner = synctex_scanner_new_with_output_file(syncfname, NULL, 1);
+    }
 };
 
 // Synchronizer based on .synctex file generated with SyncTex
@@ -68,12 +104,20 @@ class SyncTex : public Synchronizer
 {
 public:
     SyncTex(const WCHAR* syncfilename, PdfEngine *engine) :
-        Synchronizer(syncfilename), engine(engine), scanner(NULL)
+        Synchronizer(syncfilename), engine(engine), scanner(NULL), parser(NULL)
     {
         assert(str::EndsWithI(syncfilename, SYNCTEX_EXTENSION));
+        // a synchronizer is created whenever a document is (re)loaded, so that
+        // the sync file will usually have been parsed by the first search
+        StartParsing();
     }
     virtual ~SyncTex()
     {
+        if (parser) {
+            parser->Join();
+            synctex_scanner_free(parser->scanner);
+            delete parser;
+        }
         synctex_scanner_free(scanner);
     }
 
@@ -81,10 +125,13 @@ public:
     virtual int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT *page, Vec<RectI> &rects);
 
 private:
+    void StartParsing();
     int RebuildIndex();
 
     PdfEngine *engine; // needed for converting between coordinate systems
     synctex_scanner_t scanner;
+    SyncTexParser *parser; // non-NULL while the sync file is being parsed
+    struct _stat parserTimestamp; // time stamp of sync file when parsing started
 };
 
 Synchronizer::Synchronizer(const WCHAR* syncfilepath) :
@@ -199,6 +246,19 @@ static char *Advance0Line(char *line, char *end)
     return line < end ? line : NULL;
 }
 
+static int cmpSortedLines(const void *a, const void *b)
+{
+    const PdfsyncSortedLine *la = (const PdfsyncSortedLine *)a;
+    const PdfsyncSortedLine *lb = (const PdfsyncSortedLine *)b;
+    if (la->file != lb->file)
+        return la->file < lb->file ? -1 : 1;
+    if (la->line != lb->line)
+        return la->line < lb->line ? -1 : 1;
+    if (la->index != lb->index)
+        return la->index < lb->index ? -1 : 1;
+    return 0;
+}
+
 // see http://itexmac.sourceforge.net/pdfsync.html for the specification
 int Pdfsync::RebuildIndex()
 {
@@ -206,41 +266,79 @@ int Pdfsync::RebuildIndex()
     ScopedMem<char> data(file::ReadAll(syncfilepath, &len));
     if (!data)
         return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+
+    // only parse the appended lines if the previously parsed data is unchanged
+    bool append = parsedLen > 0 && len >= parsedLen && MurmurHash2(data, parsedLen) == parsedHash;
+    size_t prevLen = append ? parsedLen : 0;
+    // a last line without line break might not have been completely written yet
+    parsedLen = len > 0 && (data[len - 1] == '\n' || data[len - 1] == '\r') ? len : 0;
+    parsedHash = MurmurHash2(data, parsedLen);
+
     // convert the file data into a list of zero-terminated strings
     str::TransChars(data, "\r\n", "\0\0");
 
-    // parse preamble (jobname and version marker)
     char *line = data;
     char *dataEnd = data + len;
 
-    // replace star by spaces (TeX uses stars instead of spaces in filenames)
-    str::TransChars(line, "*/", " \\");
-    ScopedMem<WCHAR> jobName(str::conv::FromAnsi(line));
-    jobName.Set(str::Join(jobName, L".tex"));
-    jobName.Set(PrependDir(jobName));
+    if (append) {
+        // the character before the appended data is a (converted) line break
+        ParseLines(data + prevLen - 1, dataEnd);
+    }
+    else {
+        // parse preamble (jobname and version marker)
+
+        // replace star by spaces (TeX uses stars instead of spaces in filenames)
+        str::TransChars(line, "*/", " \\");
+        ScopedMem<WCHAR> jobName(str::conv::FromAnsi(line));
+        jobName.Set(str::Join(jobName, L".tex"));
+        jobName.Set(PrependDir(jobName));
+
+        line = Advance0Line(line, dataEnd);
+        UINT versionNumber = 0;
+        if (!line || !str::Parse(line, "version %u", &versionNumber) || versionNumber != 1) {
+            parsedLen = 0;
+            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+        }
 
-    line = Advance0Line(line, dataEnd);
-    UINT versionNumber = 0;
-    if (!line || !str::Parse(line, "version %u", &versionNumber) || versionNumber != 1)
-        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+        // reset synchronizer database
+        srcfiles.Reset();
+        lines.Reset();
+        points.Reset();
+        fileIndex.Reset();
+        sheetIndex.Reset();
+        filestack.Reset();
+
+        page = 1;
+        sheetIndex.Append(0);
+
+        // add the initial tex file to the source file stack
+        filestack.Push(srcfiles.Count());
+        srcfiles.Append(jobName.StealData());
+        PdfsyncFileIndex findex = { 0 };
+        fileIndex.Append(findex);
 
-    // reset synchronizer database
-    srcfiles.Reset();
-    lines.Reset();
-    points.Reset();
-    fileIndex.Reset();
-    sheetIndex.Reset();
+        ParseLines(line, dataEnd);
+    }
+
+    // files not closed yet (while TeX is still compiling) extend to the last line
+    for (size_t i = 0; i < filestack.Count(); i++) {
+        fileIndex.At(filestack.At(i)).end = lines.Count();
+    }
 
-    Vec<size_t> filestack;
-    UINT page = 1;
-    sheetIndex.Append(0);
+    // sort the lines for quickly finding them in SourceToRecord
+    sortedLines.Reset();
+    for (size_t i = 0; i < lines.Count(); i++) {
+        PdfsyncSortedLine sl = { lines.At(i).file, lines.At(i).line, i };
+        sortedLines.Append(sl);
+    }
+    sortedLines.Sort(cmpSortedLines);
 
-    // add the initial tex file to the source file stack
-    filestack.Push(srcfiles.Count());
-    srcfiles.Append(jobName.StealData());
-    PdfsyncFileIndex findex = { 0 };
-    fileIndex.Append(findex);
+    return Synchronizer::RebuildIndex();
+}
 
+void Pdfsync::ParseLines(char *line, char *dataEnd)
+{
+    PdfsyncFileIndex findex;
     PdfsyncLine psline;
     PdfsyncPoint pspoint;
 
@@ -314,11 +412,6 @@ int Pdfsync::RebuildIndex()
             break;
         }
     }
-
-    fileIndex.At(0).end = lines.Count();
-    assert(filestack.Count() == 1);
-
-    return Synchronizer::RebuildIndex();
 }
 
 // convert a coordinate from the sync file into a PDF coordinate
@@ -390,6 +483,21 @@ int Pdfsync::DocToSource(UINT pageNo, PointI pt, ScopedMem<WCHAR>& filename, UIN
     return PDFSYNCERR_SUCCESS;
 }
 
+// returns the index of the first entry in sortedLines at or after the given line
+size_t Pdfsync::FindSortedLine(size_t file, UINT line) const
+{
+    size_t lo = 0, hi = sortedLines.Count();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const PdfsyncSortedLine& sl = sortedLines.At(mid);
+        if (sl.file < file || sl.file == file && sl.line < line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 // Find a record corresponding to the given source file, line number and optionally column number.
 // (at the moment the column parameter is ignored)
 //
@@ -425,22 +533,26 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<
     if (fileIndex.At(isrc).start == fileIndex.At(isrc).end)
         return PDFSYNCERR_NORECORD_IN_SOURCEFILE; // there is not any record declaration for that particular source file
 
-    // look for sections belonging to the specified file
-    // starting with the first section that is declared within the scope of the file.
+    // find the closest lines at or after and before the requested one
+    // (for equally close lines, the one declared first is used)
     UINT min_distance = EPSILON_LINE; // distance to the closest record
     size_t lineIx = (size_t)-1; // closest record-line index
 
-    for (size_t isec = fileIndex.At(isrc).start; isec < fileIndex.At(isrc).end; isec++) {
-        // does this section belong to the desired file?
-        if (lines.At(isec).file != isrc)
-            continue;
-
-        UINT d = abs((int)lines.At(isec).line - (int)line);
+    size_t ix = FindSortedLine(isrc, line);
+    if (ix < sortedLines.Count() && sortedLines.At(ix).file == isrc) {
+        UINT d = sortedLines.At(ix).line - line;
         if (d < min_distance) {
             min_distance = d;
-            lineIx = isec;
-            if (0 == d)
-                break; // We have found a record for the requested line!
+            lineIx = sortedLines.At(ix).index;
+        }
+    }
+    if (ix > 0 && sortedLines.At(ix - 1).file == isrc && min_distance > 0) {
+        // the first declared record for the closest previous line
+        ix = FindSortedLine(isrc, sortedLines.At(ix - 1).line);
+        UINT d = line - sortedLines.At(ix).line;
+        if (d < min_distance || d == min_distance && sortedLines.At(ix).index < lineIx) {
+            min_distance = d;
+            lineIx = sortedLines.At(ix).index;
         }
     }
     if (lineIx == (size_t)-1)
@@ -492,15 +604,40 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT *pa
 
 // SYNCTEX synchronizer
 
+void SyncTex::StartParsing()
+{
+    CrashIf(parser);
+    _wstat(syncfilepath, &parserTimestamp);
+    ScopedMem<char> syncfname(str::conv::ToAnsi(syncfilepath));
+    parser = new SyncTexParser(syncfname);
+    parser->Start();
+}
+
+// note: synctex_parser already indexes all nodes by input line (for
+// synctex_display_query) and by sheet (for synctex_edit_query), so
+// that only parsing the sync file takes any noticeable amount of time
 int SyncTex::RebuildIndex() {
     synctex_scanner_free(this->scanner);
     this->scanner = NULL;
 
-    ScopedMem<char> syncfname(str::conv::ToAnsi(syncfilepath));
-    if (!syncfname)
-        return PDFSYNCERR_OUTOFMEMORY;
+    // reuse the parsing result if the sync file hasn't changed since
+    if (!parser)
+        StartParsing();
+    parser->Join();
+    // TeX might still have been writing the sync file when parsing started
+    struct _stat newstamp;
+    if (_wstat(syncfilepath, &newstamp) == 0 &&
+        difftime(newstamp.st_mtime, parserTimestamp.st_mtime) != 0) {
+        synctex_scanner_free(parser->scanner);
+        delete parser;
+        parser = NULL;
+        StartParsing();
+        parser->Join();
+    }
+    scanner = parser->scanner;
+    delete parser;
+    parser = NULL;
 
-    scanner = synctex_scanner_new_with_output_file(syncfname, NULL, 1);
     if (!scanner)
         return PDFSYNCERR_SYNCFILE_NOTFOUND; // cannot rebuild the index
 
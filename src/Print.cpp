@@ -12,6 +12,7 @@
 #include "Selection.h"
 #include "SumatraDialogs.h"
 #include "SumatraPDF.h"
+#include "ThreadUtil.h"
 #include "Translations.h"
 #include "UITask.h"
 #include "WindowInfo.h"
@@ -100,6 +101,206 @@ static RectD BoundSelectionOnPage(const Vec<SelectionOnPage>& sel, int pageNo)
     return bounds;
 }
 
+// a page (or a selection on a page) to be printed on the given sheet of paper
+struct PrintItem {
+    int sheet;
+    int pageNo;
+    float zoom;
+    int rotation;
+    // the part of the page to print (empty for the whole page)
+    RectD pageRect;
+    // where to print the page's top-left corner in printer DC coordinates
+    PointI offset;
+};
+
+// bitmaps larger than this are rendered in several horizontal bands
+#define MAX_PRINT_BAND_BYTES        (32 * 1024 * 1024)
+// how many bands each thread may render ahead of the one being printed
+#define MAX_QUEUED_BANDS_PER_THREAD 2
+#define MAX_PRINT_THREADS           4
+
+/* When printing as image, pages are rendered in bands (so that even posters
+   only need a few bitmaps of at most MAX_PRINT_BAND_BYTES at a time) on several
+   threads with cloned engines (if the engine supports concurrent rendering),
+   while the printing thread sends the rendered bands to the printer in order. */
+class PrintBandRenderer {
+    struct Band {
+        size_t item;
+        // the part of the page covered by the band
+        RectD pageRect;
+        // where to print the band in printer DC coordinates
+        RectI screen;
+        RenderedBitmap *bmp;
+        bool rendered;
+    };
+
+    class BandThread : public ThreadBase {
+        PrintBandRenderer *renderer;
+        BaseEngine *engine;
+        AbortCookieManager *abortCookie;
+    public:
+        BandThread(PrintBandRenderer *renderer, BaseEngine *engine, AbortCookieManager *abortCookie) :
+            ThreadBase("PrintBandThread"), renderer(renderer), engine(engine), abortCookie(abortCookie) { }
+        virtual void Run() { renderer->RenderBands(engine, abortCookie); }
+    };
+    friend class BandThread;
+
+    const Vec<PrintItem>& items;
+    Vec<Band> bands;
+    // the next band to be claimed resp. printed
+    LONG nextRendered;
+    size_t nextPrinted;
+    // note: only ever changed from false to true
+    bool canceled;
+
+    Vec<BandThread *> threads;
+    Vec<BaseEngine *> clones;
+    Vec<AbortCookieManager *> abortCookies;
+    // the caller's abortCookie (which is aborted when printing is canceled)
+    AbortCookieManager *ownerCookie;
+
+    CRITICAL_SECTION bandsAccess;
+    // signaled whenever a band has been rendered
+    HANDLE hRendered;
+    // counts the bands which may still be rendered ahead
+    HANDLE hFreeSlots;
+
+    void RenderBands(BaseEngine *engine, AbortCookieManager *abortCookie) {
+        for (;;) {
+            WaitForSingleObject(hFreeSlots, INFINITE);
+            LONG ix = InterlockedIncrement(&nextRendered) - 1;
+            if (canceled || ix >= (LONG)bands.Count())
+                break;
+            const Band& band = bands.At(ix);
+            const PrintItem& item = items.At(band.item);
+            RenderedBitmap *bmp = NULL;
+            // retry at lower resolutions in case we've run out of memory
+            for (short shrink = 1; !bmp && shrink < 32 && !canceled; shrink *= 2) {
+                RectD pageRect = band.pageRect;
+                bmp = engine->RenderBitmap(item.pageNo, item.zoom / shrink, item.rotation, &pageRect, Target_Print, &abortCookie->cookie);
+                abortCookie->Clear();
+                if (bmp && !bmp->IsValid()) {
+                    delete bmp;
+                    bmp = NULL;
+                }
+            }
+            ScopedCritSec scope(&bandsAccess);
+            bands.At(ix).bmp = bmp;
+            bands.At(ix).rendered = true;
+            SetEvent(hRendered);
+        }
+    }
+
+    void Cancel() {
+        canceled = true;
+        for (size_t i = 0; i < abortCookies.Count(); i++) {
+            abortCookies.At(i)->Abort();
+        }
+    }
+
+public:
+    PrintBandRenderer(BaseEngine *engine, const Vec<PrintItem>& items, AbortCookieManager *abortCookie) :
+        items(items), nextRendered(0), nextPrinted(0), canceled(false), ownerCookie(abortCookie) {
+        InitializeCriticalSection(&bandsAccess);
+        hRendered = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+        for (size_t i = 0; i < items.Count(); i++) {
+            const PrintItem& item = items.At(i);
+            RectD pageRc = item.pageRect.IsEmpty() ? engine->PageMediabox(item.pageNo) : item.pageRect;
+            RectD full = engine->Transform(pageRc, item.pageNo, item.zoom, item.rotation);
+            RectI screen = full.Round();
+            if (screen.IsEmpty())
+                continue;
+            int bandDy = max(1, (int)(MAX_PRINT_BAND_BYTES / 4 / screen.dx));
+            for (int y = 0; y < screen.dy; y += bandDy) {
+                int dy = min(bandDy, screen.dy - y);
+                Band band = { 0 };
+                band.item = i;
+                band.pageRect = engine->Transform(RectD(full.x, full.y + y, full.dx, dy), item.pageNo, item.zoom, item.rotation, true);
+                band.screen = RectI(item.offset.x, item.offset.y + y, screen.dx, dy);
+                bands.Append(band);
+            }
+        }
+
+        int threadCount = 1;
+        if (engine->SupportsConcurrentRendering()) {
+            SYSTEM_INFO si;
+            GetSystemInfo(&si);
+            threadCount = limitValue((int)si.dwNumberOfProcessors, 1, MAX_PRINT_THREADS);
+        }
+        Vec<BaseEngine *> engines;
+        engines.Append(engine);
+        // cloning might fail for some documents; then just render on fewer threads
+        for (int i = 1; i < threadCount && (size_t)i < bands.Count(); i++) {
+            BaseEngine *clone = engine->Clone();
+            if (!clone)
+                break;
+            clones.Append(clone);
+            engines.Append(clone);
+        }
+
+        LONG maxQueued = MAX_QUEUED_BANDS_PER_THREAD * (LONG)engines.Count();
+        hFreeSlots = CreateSemaphore(NULL, maxQueued, maxQueued + (LONG)engines.Count(), NULL);
+        for (size_t i = 0; i < engines.Count(); i++) {
+            abortCookies.Append(0 == i && abortCookie ? abortCookie : new AbortCookieManager());
+            threads.Append(new BandThread(this, engines.At(i), abortCookies.Last()));
+            threads.Last()->Start();
+        }
+    }
+
+    ~PrintBandRenderer() {
+        if (nextPrinted < bands.Count())
+            Cancel();
+        // wake up all threads waiting for a free slot
+        canceled = true;
+        ReleaseSemaphore(hFreeSlots, (LONG)threads.Count(), NULL);
+        for (size_t i = 0; i < threads.Count(); i++) {
+            threads.At(i)->Join();
+            delete threads.At(i);
+        }
+        for (size_t i = 0; i < abortCookies.Count(); i++) {
+            if (abortCookies.At(i) != ownerCookie)
+                delete abortCookies.At(i);
+        }
+        DeleteVecMembers(clones);
+        for (size_t i = nextPrinted; i < bands.Count(); i++) {
+            delete bands.At(i).bmp;
+        }
+        CloseHandle(hFreeSlots);
+        CloseHandle(hRendered);
+        DeleteCriticalSection(&bandsAccess);
+    }
+
+    // prints all bands of items.At(itemIx) (items must be printed in order);
+    // returns false if a band couldn't be rendered or printing was canceled
+    bool PrintBands(HDC hdc, size_t itemIx, ProgressUpdateUI *progressUI) {
+        bool ok = true;
+        while (nextPrinted < bands.Count() && bands.At(nextPrinted).item == itemIx) {
+            RenderedBitmap *bmp = NULL;
+            for (;;) {
+                {
+                    ScopedCritSec scope(&bandsAccess);
+                    if (bands.At(nextPrinted).rendered) {
+                        bmp = bands.At(nextPrinted).bmp;
+                        bands.At(nextPrinted).bmp = NULL;
+                        break;
+                    }
+                }
+                if (progressUI && progressUI->WasCanceled()) {
+                    Cancel();
+                    return false;
+                }
+                WaitForSingleObject(hRendered, 100);
+            }
+            ok = bmp && bmp->StretchDIBits(hdc, bands.At(nextPrinted).screen) && ok;
+            delete bmp;
+            nextPrinted++;
+            ReleaseSemaphore(hFreeSlots, 1, NULL);
+        }
+        return ok;
+    }
+};
+
 static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI *progressUI=NULL, AbortCookieManager *abortCookie=NULL)
 {
     AssertCrash(pd.engine);
@@ -166,17 +367,15 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI *progressUI=NULL
     if (pd.devMode && (pd.devMode.Get()->dmFields & DM_ORIENTATION))
         bPrintPortrait = DMORIENT_PORTRAIT == pd.devMode.Get()->dmOrientation;
 
+    // determine what to print where on which sheet
+    Vec<PrintItem> items;
+    int sheets = 0;
     if (pd.sel.Count() > 0) {
         for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
             RectD bounds = BoundSelectionOnPage(pd.sel, pageNo);
             if (bounds.IsEmpty())
                 continue;
 
-            if (progressUI)
-                progressUI->UpdateProgress(current, total);
-
-            StartPage(hdc);
-
             geomutil::SizeT<float> bSize = bounds.Size().Convert<float>();
             float zoom = min((float)printable.dx / bSize.dx,
                              (float)printable.dy / bSize.dy);
@@ -191,60 +390,28 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI *progressUI=NULL
                 if (pd.sel.At(i).pageNo != pageNo)
                     continue;
 
-                RectD *clipRegion = &pd.sel.At(i).rect;
-                PointI offset((int)((clipRegion->x - bounds.x) * zoom), (int)((clipRegion->y - bounds.y) * zoom));
+                RectD clipRegion = pd.sel.At(i).rect;
+                PointI offset((int)((clipRegion.x - bounds.x) * zoom), (int)((clipRegion.y - bounds.y) * zoom));
                 if (pd.advData.scale != PrintScaleNone) {
                     // center the selection on the physical paper
                     offset.x += (int)(printable.dx - bSize.dx * zoom) / 2;
                     offset.y += (int)(printable.dy - bSize.dy * zoom) / 2;
                 }
 
-                bool ok = false;
-                if (!pd.advData.asImage) {
-                    RectI rc(offset.x, offset.y, (int)(clipRegion->dx * zoom), (int)(clipRegion->dy * zoom));
-                    ok = engine.RenderPage(hdc, rc, pd.sel.At(i).pageNo, zoom, pd.rotation, clipRegion, Target_Print, abortCookie ? &abortCookie->cookie : NULL);
-                    if (abortCookie)
-                        abortCookie->Clear();
-                }
-                else {
-                    short shrink = 1;
-                    do {
-                        RenderedBitmap *bmp = engine.RenderBitmap(pd.sel.At(i).pageNo, zoom / shrink, pd.rotation, clipRegion, Target_Print, abortCookie ? &abortCookie->cookie : NULL);
-                        if (abortCookie)
-                            abortCookie->Clear();
-                        if (bmp && bmp->GetBitmap()) {
-                            RectI rc(offset.x, offset.y, bmp->Size().dx * shrink, bmp->Size().dy * shrink);
-                            ok = bmp->StretchDIBits(hdc, rc);
-                        }
-                        delete bmp;
-                        shrink *= 2;
-                    } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
-                }
-            }
-            // TODO: abort if !ok?
-
-            if (EndPage(hdc) <= 0 || progressUI && progressUI->WasCanceled()) {
-                AbortDoc(hdc);
-                return false;
+                PrintItem item = { sheets, pageNo, zoom, pd.rotation, clipRegion, offset };
+                items.Append(item);
             }
-            current++;
+            sheets++;
         }
-
-        EndDoc(hdc);
-        return false;
     }
 
     // print all the pages the user requested
-    for (size_t i = 0; i < pd.ranges.Count(); i++) {
+    for (size_t i = 0; i < pd.ranges.Count() && pd.sel.Count() == 0; i++) {
         int dir = pd.ranges.At(i).nFromPage > pd.ranges.At(i).nToPage ? -1 : 1;
         for (DWORD pageNo = pd.ranges.At(i).nFromPage; pageNo != pd.ranges.At(i).nToPage + dir; pageNo += dir) {
             if ((PrintRangeEven == pd.advData.range && pageNo % 2 != 0) ||
                 (PrintRangeOdd == pd.advData.range && pageNo % 2 == 0))
                 continue;
-            if (progressUI)
-                progressUI->UpdateProgress(current, total);
-
-            StartPage(hdc);
 
             geomutil::SizeT<float> pSize = engine.PageMediabox(pageNo).Size().Convert<float>();
             int rotation = 0;
@@ -302,34 +469,40 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI *progressUI=NULL
                     offset.y -= (int)(onPaper.BR().y - printable.BR().y);
             }
 
+            PrintItem item = { sheets, (int)pageNo, zoom, rotation, RectD(), offset };
+            items.Append(item);
+            sheets++;
+        }
+    }
+
+    ScopedPtr<PrintBandRenderer> bandRenderer(pd.advData.asImage ? new PrintBandRenderer(&engine, items, abortCookie) : NULL);
+
+    for (size_t i = 0; i < items.Count(); current++) {
+        if (progressUI)
+            progressUI->UpdateProgress(current, total);
+
+        StartPage(hdc);
+
+        for (int sheet = items.At(i).sheet; i < items.Count() && items.At(i).sheet == sheet; i++) {
+            PrintItem& item = items.At(i);
             bool ok = false;
             if (!pd.advData.asImage) {
-                RectI rc = RectI::FromXY(offset.x, offset.y, paperSize.dx, paperSize.dy);
-                ok = engine.RenderPage(hdc, rc, pageNo, zoom, rotation, NULL, Target_Print, abortCookie ? &abortCookie->cookie : NULL);
+                RectD *clipRegion = item.pageRect.IsEmpty() ? NULL : &item.pageRect;
+                RectI rc = clipRegion ? RectI(item.offset.x, item.offset.y, (int)(clipRegion->dx * item.zoom), (int)(clipRegion->dy * item.zoom))
+                                      : RectI::FromXY(item.offset.x, item.offset.y, paperSize.dx, paperSize.dy);
+                ok = engine.RenderPage(hdc, rc, item.pageNo, item.zoom, item.rotation, clipRegion, Target_Print, abortCookie ? &abortCookie->cookie : NULL);
                 if (abortCookie)
                     abortCookie->Clear();
             }
             else {
-                short shrink = 1;
-                do {
-                    RenderedBitmap *bmp = engine.RenderBitmap(pageNo, zoom / shrink, rotation, NULL, Target_Print, abortCookie ? &abortCookie->cookie : NULL);
-                    if (abortCookie)
-                        abortCookie->Clear();
-                    if (bmp && bmp->GetBitmap()) {
-                        RectI rc(offset.x, offset.y, bmp->Size().dx * shrink, bmp->Size().dy * shrink);
-                        ok = bmp->StretchDIBits(hdc, rc);
-                    }
-                    delete bmp;
-                    shrink *= 2;
-                } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
+                ok = bandRenderer->PrintBands(hdc, i, progressUI);
             }
             // TODO: abort if !ok?
+        }
 
-            if (EndPage(hdc) <= 0 || progressUI && progressUI->WasCanceled()) {
-                AbortDoc(hdc);
-                return false;
-            }
-            current++;
+        if (EndPage(hdc) <= 0 || progressUI && progressUI->WasCanceled()) {
+            AbortDoc(hdc);
+            return false;
         }
     }
 
@@ -119,7 +119,7 @@ static RectI ExtractDSCPageSize(const WCHAR *fileName)
     return RectI();
 }
 
-static PdfEngine *ps2pdf(const WCHAR *fileName)
+static char *ps2pdf(const WCHAR *fileName, size_t *lenOut)
 {
     // TODO: read from gswin32c's stdout instead of using a TEMP file
     ScopedMem<WCHAR> shortPath(path::ShortPath(fileName));
@@ -159,19 +159,10 @@ static PdfEngine *ps2pdf(const WCHAR *fileName)
     if (exitCode != EXIT_SUCCESS)
         return NULL;
 
-    size_t len;
-    ScopedMem<char> pdfData(file::ReadAll(tmpFile, &len));
-    if (!pdfData)
-        return NULL;
-
-    ScopedComPtr<IStream> stream(CreateStreamFromData(pdfData, len));
-    if (!stream)
-        return NULL;
-
-    return PdfEngine::CreateFromStream(stream);
+    return file::ReadAll(tmpFile, lenOut);
 }
 
-static PdfEngine *psgz2pdf(const WCHAR *fileName)
+static char *psgz2pdf(const WCHAR *fileName, size_t *lenOut)
 {
     ScopedMem<WCHAR> tmpFile(path::GetTempPath(L"PsE"));
     ScopedFile tmpFileScope(tmpFile);
@@ -198,7 +189,146 @@ static PdfEngine *psgz2pdf(const WCHAR *fileName)
     fclose(outFile);
     gzclose(inFile);
 
-    return ps2pdf(tmpFile);
+    return ps2pdf(tmpFile, lenOut);
+}
+
+/* Converting a document with Ghostscript takes at least several seconds, so
+   the resulting PDF document is cached. A cache file consists of a
+   ConvertedPsHeader identifying the original document's version followed by
+   the converted PDF data. */
+
+#define CONVERTED_PS_MAGIC      'SPsP'
+#define CONVERTED_PS_VERSION    2
+#define CONVERTED_PS_EXT        L".ps.pdf"
+// the least recently saved cache files are deleted beyond this number
+#define MAX_CONVERTED_PS_FILES  16
+
+struct ConvertedPsHeader {
+    uint32          magic;
+    uint32          version;
+    int64           fileSize;
+    FILETIME        modified;
+    unsigned char   digest[16];
+};
+
+static WCHAR *gConvertedPsDir = NULL;
+
+void SetConvertedPsCacheDir(const WCHAR *dir)
+{
+    str::ReplacePtr(&gConvertedPsDir, dir);
+}
+
+static WCHAR *GetConvertedPsPath(const WCHAR *filePath)
+{
+    if (!gConvertedPsDir)
+        return NULL;
+    ScopedMem<WCHAR> pathLower(str::Dup(filePath));
+    str::ToLower(pathLower);
+    ScopedMem<char> pathU(str::conv::ToUtf8(pathLower));
+    if (!pathU)
+        return NULL;
+    unsigned char digest[16];
+    CalcMD5Digest((unsigned char *)pathU.Get(), str::Len(pathU), digest);
+    ScopedMem<char> fingerPrint(str::MemToHex(digest, 16));
+    ScopedMem<WCHAR> fname(str::Format(L"%S%s", fingerPrint, CONVERTED_PS_EXT));
+    return path::Join(gConvertedPsDir, fname);
+}
+
+// as for repaired PDF xref tables, the digest only covers the file's start
+// and end (in addition to size and modification time), so that checking
+// the cache doesn't require reading large documents entirely
+static bool GetConvertedPsHeader(const WCHAR *filePath, ConvertedPsHeader *hdr)
+{
+    ZeroMemory(hdr, sizeof(*hdr));
+    hdr->magic = CONVERTED_PS_MAGIC;
+    hdr->version = CONVERTED_PS_VERSION;
+    hdr->fileSize = file::GetSize(filePath);
+    hdr->modified = file::GetModificationTime(filePath);
+    if (hdr->fileSize <= 0 || hdr->fileSize > INT_MAX)
+        return false;
+    return CalcFileFingerprint(filePath, hdr->digest);
+}
+
+static char *LoadConvertedPs(const WCHAR *filePath, ConvertedPsHeader *hdr, size_t *lenOut)
+{
+    ScopedMem<WCHAR> cachePath(GetConvertedPsPath(filePath));
+    if (!cachePath || !file::Exists(cachePath))
+        return NULL;
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(cachePath, &len));
+    if (!data || len <= sizeof(*hdr) || memcmp(data, hdr, sizeof(*hdr)) != 0)
+        return NULL;
+    *lenOut = len - sizeof(*hdr);
+    return (char *)memdup(data + sizeof(*hdr), *lenOut);
+}
+
+static void PurgeConvertedPs()
+{
+    ScopedMem<WCHAR> pattern(path::Join(gConvertedPsDir, L"*" CONVERTED_PS_EXT));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind)
+        return;
+    int count = 0;
+    ScopedMem<WCHAR> oldest;
+    FILETIME oldestTime = { 0 };
+    do {
+        if ((fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            continue;
+        if (!oldest || CompareFileTime(&fdata.ftLastWriteTime, &oldestTime) < 0) {
+            oldest.Set(str::Dup(fdata.cFileName));
+            oldestTime = fdata.ftLastWriteTime;
+        }
+        count++;
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    // one file is added at a time, so removing one at a time suffices
+    if (count > MAX_CONVERTED_PS_FILES) {
+        ScopedMem<WCHAR> oldestPath(path::Join(gConvertedPsDir, oldest));
+        file::Delete(oldestPath);
+    }
+}
+
+static void SaveConvertedPs(const WCHAR *filePath, ConvertedPsHeader *hdr, const char *pdfData, size_t len)
+{
+    ScopedMem<WCHAR> cachePath(GetConvertedPsPath(filePath));
+    if (!cachePath)
+        return;
+    ScopedMem<char> data((char *)malloc(sizeof(*hdr) + len));
+    if (!data)
+        return;
+    memcpy(data, hdr, sizeof(*hdr));
+    memcpy(data + sizeof(*hdr), pdfData, len);
+    dir::CreateAll(gConvertedPsDir);
+    if (file::WriteAll(cachePath, data, sizeof(*hdr) + len))
+        PurgeConvertedPs();
+}
+
+static PdfEngine *ConvertPsToPdf(const WCHAR *fileName)
+{
+    ConvertedPsHeader hdr;
+    bool canCache = gConvertedPsDir && GetConvertedPsHeader(fileName, &hdr);
+
+    size_t len = 0;
+    ScopedMem<char> pdfData;
+    if (canCache)
+        pdfData.Set(LoadConvertedPs(fileName, &hdr, &len));
+    bool isCached = pdfData != NULL;
+    if (!pdfData && file::StartsWith(fileName, "\x1F\x8B"))
+        pdfData.Set(psgz2pdf(fileName, &len));
+    else if (!pdfData)
+        pdfData.Set(ps2pdf(fileName, &len));
+    if (!pdfData)
+        return NULL;
+
+    ScopedComPtr<IStream> stream(CreateStreamFromData(pdfData, len));
+    if (!stream)
+        return NULL;
+    PdfEngine *engine = PdfEngine::CreateFromStream(stream);
+    if (engine && canCache && !isCached)
+        SaveConvertedPs(fileName, &hdr, pdfData, len);
+    return engine;
 }
 
 // PsEngineImpl is mostly a proxy for a PdfEngine that's fed whatever
@@ -221,6 +351,9 @@ public:
         clone->pdfEngine = newEngine;
         return clone;
     }
+    virtual bool SupportsConcurrentRendering() const {
+        return pdfEngine && pdfEngine->SupportsConcurrentRendering();
+    }
 
     virtual const WCHAR *FileName() const { return fileName; };
     virtual int PageCount() const {
@@ -233,6 +366,10 @@ public:
     virtual RectD PageContentBox(int pageNo, RenderTarget target=Target_View) {
         return pdfEngine ? pdfEngine->PageContentBox(pageNo, target) : RectD();
     }
+    virtual RectD PageMediaboxEstimate(int pageNo, bool *isExact) {
+        *isExact = true;
+        return pdfEngine ? pdfEngine->PageMediaboxEstimate(pageNo, isExact) : RectD();
+    }
 
     virtual RenderedBitmap *RenderBitmap(int pageNo, float zoom, int rotation,
                          RectD *pageRect=NULL, /* if NULL: defaults to the page's mediabox */
@@ -243,6 +380,10 @@ public:
                          RectD *pageRect=NULL, RenderTarget target=Target_View, AbortCookie **cookie_out=NULL) {
         return pdfEngine ? pdfEngine->RenderPage(hDC, screenRect, pageNo, zoom, rotation, pageRect, target, cookie_out) : false;
     }
+    virtual RenderedBitmap *RenderPreviewBitmap(int pageNo, float zoom, int rotation,
+                         RectD *pageRect=NULL, AbortCookie **cookie_out=NULL) {
+        return pdfEngine ? pdfEngine->RenderPreviewBitmap(pageNo, zoom, rotation, pageRect, cookie_out) : NULL;
+    }
 
     virtual PointD Transform(PointD pt, int pageNo, float zoom, int rotation, bool inverse=false) {
         return pdfEngine ? pdfEngine->Transform(pt, pageNo, zoom, rotation, inverse) : pt;
@@ -261,6 +402,12 @@ public:
                                     RenderTarget target=Target_View) {
         return pdfEngine ? pdfEngine->ExtractPageText(pageNo, lineSep, coords_out, target) : NULL;
     }
+    virtual bool ExtractTextRange(int startPage, int endPage, WCHAR *lineSep, TextExtractionSink *sink,
+                                  bool withCoords=false, RenderTarget target=Target_View) {
+        if (!pdfEngine)
+            return BaseEngine::ExtractTextRange(startPage, endPage, lineSep, sink, withCoords, target);
+        return pdfEngine->ExtractTextRange(startPage, endPage, lineSep, sink, withCoords, target);
+    }
     virtual bool HasClipOptimizations(int pageNo) {
         return pdfEngine ? pdfEngine->HasClipOptimizations(pageNo) : true;
     }
@@ -282,6 +429,9 @@ public:
     virtual void UpdateUserAnnotations(Vec<PageAnnotation> *list) {
         if (pdfEngine) pdfEngine->UpdateUserAnnotations(list);
     }
+    virtual bool SetHighlightOverlay(bool enable) {
+        return pdfEngine && pdfEngine->SetHighlightOverlay(enable);
+    }
 
     virtual bool AllowsPrinting() const {
         return pdfEngine ? pdfEngine->AllowsPrinting() : true;
@@ -297,9 +447,32 @@ public:
         return !fileName || !str::EndsWithI(fileName, L".eps") ? L".ps" : L".eps";
     }
 
+    virtual size_t GetMemoryUsage() {
+        return pdfEngine ? pdfEngine->GetMemoryUsage() : 0;
+    }
+    virtual void CompactMemory() {
+        if (pdfEngine)
+            pdfEngine->CompactMemory();
+    }
+    virtual bool GetPageDigest(int pageNo, unsigned char digest[16]) {
+        return pdfEngine ? pdfEngine->GetPageDigest(pageNo, digest) : false;
+    }
+
     virtual bool BenchLoadPage(int pageNo) {
         return pdfEngine ? pdfEngine->BenchLoadPage(pageNo) : false;
     }
+    virtual bool BenchCacheStats(int *hits, int *misses) {
+        return pdfEngine ? pdfEngine->BenchCacheStats(hits, misses) : false;
+    }
+    virtual bool BenchGlyphCacheStats(int *hits, int *misses) {
+        return pdfEngine ? pdfEngine->BenchGlyphCacheStats(hits, misses) : false;
+    }
+    virtual bool BenchResourceCacheStats(size_t *used, size_t *budget) {
+        return pdfEngine ? pdfEngine->BenchResourceCacheStats(used, budget) : false;
+    }
+    virtual bool BenchLockContention(int *ctxWaits, int *pagesWaits) {
+        return pdfEngine ? pdfEngine->BenchLockContention(ctxWaits, pagesWaits) : false;
+    }
 
     virtual Vec<PageElement *> *GetElements(int pageNo) {
         return pdfEngine ? pdfEngine->GetElements(pageNo) : NULL;
@@ -335,10 +508,7 @@ protected:
         if (!fileName)
             return false;
         this->fileName = str::Dup(fileName);
-        if (file::StartsWith(fileName, "\x1F\x8B"))
-            pdfEngine = psgz2pdf(fileName);
-        else
-            pdfEngine = ps2pdf(fileName);
+        pdfEngine = ConvertPsToPdf(fileName);
         return pdfEngine != NULL;
     }
 };
@@ -16,4 +16,8 @@ public:
     static PsEngine *CreateFromFile(const WCHAR *fileName);
 };
 
+// directory for caching the PDF documents converted by Ghostscript
+// (if NULL, documents are converted every time they're loaded)
+void SetConvertedPsCacheDir(const WCHAR *dir);
+
 #endif
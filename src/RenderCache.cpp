@@ -4,6 +4,8 @@
 #include "BaseUtil.h"
 #include "RenderCache.h"
 #include "TextSelection.h"
+#include "Timer.h"
+#include "Trace.h"
 #include "WinUtil.h"
 
 /* Define if you want to conserve memory by always freeing cached bitmaps
@@ -14,20 +16,43 @@
 // define to view the tile boundaries
 #undef SHOW_TILE_LAYOUT
 
+// use one render thread per processor (engines that don't support
+// concurrent rendering are still only rendered by a single thread at a time)
+static int GetRenderThreadCount()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return limitValue((int)si.dwNumberOfProcessors, 1, MAX_RENDER_THREADS);
+}
+
 RenderCache::RenderCache()
-    : cacheCount(0), requestCount(0),
+    : cacheCount(0), cacheMemory(0), requests(MAX_PAGE_REQUESTS), renderThreadCount(0),
       maxTileSize(GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)),
       isRemoteSession(GetSystemMetrics(SM_REMOTESESSION))
 {
     textColor = WIN_COL_BLACK;
     backgroundColor = WIN_COL_WHITE;
+    maxMemoryMB = 0;
 
     InitializeCriticalSection(&cacheAccess);
     InitializeCriticalSection(&requestAccess);
+    InitializeCriticalSection(&statsAccess);
+
+    ZeroMemory(curReqs, sizeof(curReqs));
+    ZeroMemory(renderThreads, sizeof(renderThreads));
 
     startRendering = CreateEvent(NULL, FALSE, FALSE, NULL);
-    renderThread = CreateThread(NULL, 0, RenderCacheThread, this, 0, 0);
-    assert(NULL != renderThread);
+    int count = GetRenderThreadCount();
+    for (int i = 0; i < count; i++) {
+        threadData[i].cache = this;
+        threadData[i].threadNo = i;
+        renderThreads[i] = CreateThread(NULL, 0, RenderCacheThread, &threadData[i], 0, 0);
+        assert(NULL != renderThreads[i]);
+        if (!renderThreads[i])
+            break;
+        renderThreadCount++;
+    }
+    CrashIf(0 == renderThreadCount);
 }
 
 RenderCache::~RenderCache()
@@ -35,14 +60,18 @@ RenderCache::~RenderCache()
     EnterCriticalSection(&requestAccess);
     EnterCriticalSection(&cacheAccess);
 
-    CloseHandle(renderThread);
+    for (int i = 0; i < renderThreadCount; i++) {
+        CloseHandle(renderThreads[i]);
+        assert(!curReqs[i]);
+    }
     CloseHandle(startRendering);
-    assert(!curReq && 0 == requestCount && 0 == cacheCount);
+    assert(0 == requests.Count() && 0 == cacheCount && 0 == engineClones.Count());
 
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
     LeaveCriticalSection(&requestAccess);
     DeleteCriticalSection(&requestAccess);
+    DeleteCriticalSection(&statsAccess);
 }
 
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
@@ -57,6 +86,7 @@ BitmapCacheEntry *RenderCache::Find(DisplayModel *dm, int pageNo, int rotation,
         if ((dm == entry->dm) && (pageNo == entry->pageNo) && (rotation == entry->rotation) &&
             (INVALID_ZOOM == zoom || zoom == entry->zoom) && (!tile || entry->tile == *tile)) {
             entry->refs++;
+            entry->lastUsed = GetTickCount();
             return entry;
         }
     }
@@ -81,7 +111,91 @@ void RenderCache::DropCacheEntry(BitmapCacheEntry *entry)
     }
 }
 
-void RenderCache::Add(PageRenderRequest &req, RenderedBitmap *bitmap)
+// removes a bitmap from the cache (it's deleted once no longer in use)
+void RenderCache::RemoveCacheEntryAt(int idx)
+{
+    ScopedCritSec scope(&cacheAccess);
+    CrashIf(idx < 0 || idx >= cacheCount);
+    cacheMemory -= cache[idx]->memSize;
+    DropCacheEntry(cache[idx]);
+    cacheCount--;
+    memmove(&cache[idx], &cache[idx + 1], (cacheCount - idx) * sizeof(cache[0]));
+}
+
+#define MIN_CACHE_MEMORY (32 * 1024 * 1024)
+#ifdef _WIN64
+#define MAX_CACHE_MEMORY (2048 * 1024 * 1024ULL)
+#else
+#define MAX_CACHE_MEMORY (512 * 1024 * 1024ULL)
+#endif
+
+size_t RenderCache::GetMaxCacheMemory() const
+{
+    if (maxMemoryMB > 0)
+        return (size_t)maxMemoryMB * 1024 * 1024;
+
+    MEMORYSTATUSEX ms = { 0 };
+    ms.dwLength = sizeof(ms);
+    if (!GlobalMemoryStatusEx(&ms))
+        return MIN_CACHE_MEMORY;
+    // use up to an eighth of the physical memory, as long as enough memory
+    // remains available to other processes and within our address space
+    uint64 maxMemory = ms.ullTotalPhys / 8;
+    maxMemory = min(maxMemory, cacheMemory + ms.ullAvailPhys / 2);
+    maxMemory = min(maxMemory, cacheMemory + ms.ullAvailVirtual / 4);
+    return (size_t)limitValue(maxMemory, (uint64)MIN_CACHE_MEMORY, (uint64)MAX_CACHE_MEMORY);
+}
+
+// default per-process limit for the number of GDI objects
+#define GDI_HANDLE_QUOTA    10000
+// number of GDI handles to leave for the UI (and the renderers)
+#define GDI_HANDLE_RESERVE  1000
+
+static int GetGdiHandleHeadroom()
+{
+    int used = (int)GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS);
+    return GDI_HANDLE_QUOTA - GDI_HANDLE_RESERVE - used;
+}
+
+static size_t GetBitmapMemSize(RenderedBitmap *bmp)
+{
+    if (!bmp)
+        return 0;
+    BITMAPINFO *bmi;
+    if (bmp->GetDIBData(&bmi))
+        return bmi->bmiHeader.biSizeImage;
+    BITMAP info;
+    if (GetObject(bmp->GetBitmap(), sizeof(info), &info))
+        return (size_t)info.bmWidthBytes * info.bmHeight;
+    SizeI size = bmp->Size();
+    return (size_t)size.dx * size.dy * 4;
+}
+
+// returns the index of the cached bitmap that's the cheapest to lose:
+// bitmaps for pages which aren't visible are dropped first, then the ones
+// that are larger, haven't been used for longer and are quicker to rerender
+int RenderCache::GetEvictionCandidate() const
+{
+    DWORD now = GetTickCount();
+    int bestIdx = 0;
+    bool bestVisible = true;
+    double bestScore = -1;
+    for (int i = 0; i < cacheCount; i++) {
+        BitmapCacheEntry *entry = cache[i];
+        bool visible = entry->dm->PageVisibleNearby(entry->pageNo) || entry->dm->PagePrefetched(entry->pageNo);
+        double score = (double)entry->memSize * (now - entry->lastUsed + 1) / (entry->renderTimeMs + 1);
+        if (visible && !bestVisible)
+            continue;
+        if (visible == bestVisible && score <= bestScore)
+            continue;
+        bestIdx = i;
+        bestVisible = visible;
+        bestScore = score;
+    }
+    return bestIdx;
+}
+
+void RenderCache::Add(PageRenderRequest &req, RenderedBitmap *bitmap, double renderTimeMs)
 {
     ScopedCritSec scope(&cacheAccess);
     assert(req.dm);
@@ -89,34 +203,42 @@ void RenderCache::Add(PageRenderRequest &req, RenderedBitmap *bitmap)
     req.rotation = NormalizeRotation(req.rotation);
     assert(cacheCount <= MAX_BITMAPS_CACHED);
 
+    float zoom = req.zoom;
+    if (req.preview) {
+        // a failed preview isn't worth caching and the full quality
+        // rendering (if it's finished first) mustn't be replaced
+        if (!bitmap || Exists(req.dm, req.pageNo, req.rotation, req.zoom, &req.tile)) {
+            delete bitmap;
+            return;
+        }
+        zoom *= PREVIEW_ZOOM_FACTOR;
+    }
+
     /* It's possible there still is a cached bitmap with different zoom/rotation */
     FreePage(req.dm, req.pageNo, &req.tile);
 
-    if (cacheCount >= MAX_BITMAPS_CACHED) {
-        // free an invisible page of the same DisplayModel ...
-        for (int i = 0; i < cacheCount; i++) {
-            if (cache[i]->dm == req.dm && !req.dm->PageVisibleNearby(cache[i]->pageNo)) {
-                DropCacheEntry(cache[i]);
-                cacheCount--;
-                memmove(&cache[i], &cache[i + 1], (cacheCount - i) * sizeof(cache[0]));
-                break;
-            }
-        }
-        // ... or just the oldest cached page
-        if (cacheCount >= MAX_BITMAPS_CACHED) {
-            DropCacheEntry(cache[0]);
-            cacheCount--;
-            memmove(&cache[0], &cache[1], cacheCount * sizeof(cache[0]));
-        }
+    // make room for the new bitmap, both in memory and in GDI handles
+    size_t memSize = GetBitmapMemSize(bitmap);
+    size_t maxMemory = GetMaxCacheMemory();
+    int gdiHeadroom = GetGdiHandleHeadroom();
+    while (cacheCount > 0 && (cacheCount >= MAX_BITMAPS_CACHED ||
+                              cacheMemory + memSize > maxMemory || gdiHeadroom <= 0)) {
+        RemoveCacheEntryAt(GetEvictionCandidate());
+        gdiHeadroom++;
     }
 
     // Copy the PageRenderRequest as it will be reused
-    cache[cacheCount] = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bitmap);
+    cache[cacheCount] = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, zoom, req.tile,
+                                             bitmap, memSize, renderTimeMs);
     CrashIf(!cache[cacheCount]);
     if (!cache[cacheCount])
         delete bitmap;
-    else
+    else {
+        cache[cacheCount]->preview = req.preview;
+        cache[cacheCount]->requestTime = req.timestamp;
+        cacheMemory += memSize;
         cacheCount++;
+    }
 }
 
 static RectD GetTileRect(RectD pagerect, TilePosition tile)
@@ -168,6 +290,22 @@ static bool IsTileVisible(DisplayModel *dm, int pageNo, TilePosition tile, float
     return !tileOnScreen.Intersect(screen).IsEmpty();
 }
 
+static RenderPriority GetRenderPriority(PageRenderRequest& req)
+{
+    if (req.dm->dontRenderFlag)
+        return Priority_Stale;
+    // requests with a callback (e.g. thumbnails) don't depend on the view
+    if (req.renderCb)
+        return Priority_Speculative;
+    if (IsTileVisible(req.dm, req.pageNo, req.tile))
+        return Priority_Visible;
+    if (req.dm->PageVisibleNearby(req.pageNo))
+        return Priority_Nearby;
+    if (req.dm->PagePrefetched(req.pageNo))
+        return Priority_Prefetch;
+    return Priority_Stale;
+}
+
 /* Free all bitmaps in the cache that are of a specific page (or all pages
    of the given DisplayModel, or even all invisible pages). */
 void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
@@ -200,6 +338,7 @@ void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
         }
 
         if (shouldFree) {
+            cacheMemory -= entry->memSize;
             DropCacheEntry(entry);
             cache[i] = NULL;
             cacheCount--;
@@ -214,11 +353,27 @@ void RenderCache::FreePage(DisplayModel *dm, int pageNo, TilePosition *tile)
 
 // keep the cached bitmaps for visible pages to avoid flickering during a reload.
 // mark invisible pages as out-of-date to prevent inconsistencies
-void RenderCache::KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm)
+size_t RenderCache::GetMemoryUsage(DisplayModel *dm)
+{
+    ScopedCritSec scope(&cacheAccess);
+    size_t mem = 0;
+    for (int i = 0; i < cacheCount; i++) {
+        if (cache[i]->dm == dm)
+            mem += cache[i]->memSize;
+    }
+    return mem;
+}
+
+void RenderCache::KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm, Vec<bool> *unchangedPages)
 {
     ScopedCritSec scope(&cacheAccess);
     for (int i = 0; i < cacheCount; i++) {
         if (cache[i]->dm == oldDm) {
+            int pageIx = cache[i]->pageNo - 1;
+            if (unchangedPages && pageIx < (int)unchangedPages->Count() && unchangedPages->At(pageIx)) {
+                cache[i]->dm = newDm;
+                continue;
+            }
             if (oldDm->PageVisible(cache[i]->pageNo))
                 cache[i]->dm = newDm;
             // make sure that the page is rerendered eventually
@@ -234,8 +389,9 @@ void RenderCache::Invalidate(DisplayModel *dm, int pageNo, RectD rect)
     ScopedCritSec scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo)
-        AbortCurrentRequest();
+    AbortCurrentRequests(dm, pageNo);
+    // engine clones don't know about e.g. changed annotations
+    FreeEngineClones(dm, true);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
@@ -265,11 +421,17 @@ USHORT RenderCache::GetTileRes(DisplayModel *dm, int pageNo)
     // use larger tiles when fitting page or width or when a page is smaller
     // than the visible canvas width/height or when rendering pages
     // without clipping optimizations
-    if (dm->ZoomVirtual() == ZOOM_FIT_PAGE || dm->ZoomVirtual() == ZOOM_FIT_WIDTH ||
-        pixelbox.dx <= dm->viewPort.dx || pixelbox.dy < dm->viewPort.dy ||
-        !dm->engine->HasClipOptimizations(pageNo)) {
+    bool largeTiles = dm->ZoomVirtual() == ZOOM_FIT_PAGE || dm->ZoomVirtual() == ZOOM_FIT_WIDTH ||
+                      pixelbox.dx <= dm->viewPort.dx || pixelbox.dy < dm->viewPort.dy;
+    // also adapt the tile size to how expensive the document has been to render so far:
+    // cheap pages are rendered at once, expensive ones in parallel by several threads
+    float msPerMegapixel = dm->renderMsPerMegapixel;
+    if (msPerMegapixel > 0 && msPerMegapixel < CHEAP_RENDER_MS_PER_MEGAPIXEL)
+        largeTiles = true;
+    else if (msPerMegapixel > EXPENSIVE_RENDER_MS_PER_MEGAPIXEL && renderThreadCount > 1)
+        largeTiles = false;
+    if (largeTiles || !dm->engine->HasClipOptimizations(pageNo))
         factorAvg /= 2.0;
-    }
 
     USHORT res = 0;
     if (factorAvg > 1.5)
@@ -309,9 +471,9 @@ bool RenderCache::ReduceTileSize()
     // invalidate all rendered bitmaps and all requests
     while (cacheCount > 0)
         FreeForDisplayModel(cache[0]->dm);
-    while (requestCount > 0)
-        ClearQueueForDisplayModel(requests[0].dm);
-    AbortCurrentRequest();
+    while (requests.Count() > 0)
+        ClearQueueForDisplayModel(requests.At(0).dm);
+    AbortCurrentRequests();
 
     return true;
 }
@@ -323,6 +485,8 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo)
     // rendered tile will actually be used
     if (tile.res > 1)
         return;
+    if (dm->PagePrefetched(pageNo) && !HasPrefetchMemory(dm, pageNo))
+        return;
 
     RequestRendering(dm, pageNo, tile);
     // render both tiles of the first row when splitting a page in four
@@ -331,6 +495,14 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo)
         tile.col = 1;
         RequestRendering(dm, pageNo, tile, false);
     }
+    // slides are always shown entirely, so render the second row as well
+    // for flipping to them without waiting for the missing half
+    if (tile.res == 1 && dm->presentationMode && !IsRenderQueueFull()) {
+        tile.row = 1;
+        RequestRendering(dm, pageNo, tile, false);
+        tile.col = 0;
+        RequestRendering(dm, pageNo, tile, false);
+    }
 }
 
 /* Render a bitmap for page <pageNo> in <dm>. */
@@ -338,46 +510,52 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
 {
     ScopedCritSec scope(&requestAccess);
     assert(dm);
-    if (!dm || dm->dontRenderFlag)
+    if (!dm || dm->dontRenderFlag || dm->deferRendering)
         return;
 
     int rotation = NormalizeRotation(dm->Rotation());
     float zoom = dm->ZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    PageRenderRequest *curReq = GetCurrentRequest(dm, pageNo, tile);
+    if (curReq) {
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
         }
         /* Currently rendered page is for the same page but with different zoom
         or rotation, so abort it */
-        AbortCurrentRequest();
+        if (curReq->abortCookie)
+            curReq->abortCookie->Abort();
+        curReq->abort = true;
     }
 
     // clear requests for tiles of different resolution and invisible tiles
     if (clearQueueForPage)
         ClearQueueForDisplayModel(dm, pageNo, &tile);
 
-    for (int i = 0; i < requestCount; i++) {
-        PageRenderRequest* req = &(requests[i]);
+    // note: a tile might be queued twice (a preview and the full quality rendering)
+    bool isQueued = false;
+    for (size_t i = requests.Count(); i > 0; i--) {
+        PageRenderRequest* req = requests.AtPtr(i - 1);
         if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
             if ((req->zoom == zoom) && (req->rotation == rotation)) {
                 /* Request with exactly the same parameters already queued for
                    rendering. Move it to the top of the queue so that it'll
-                   be rendered faster. */
-                PageRenderRequest tmp;
-                tmp = requests[requestCount-1];
-                requests[requestCount-1] = *req;
-                *req = tmp;
+                   be rendered faster (among requests of the same priority). */
+                PageRenderRequest tmp = *req;
+                requests.RemoveAt(i - 1);
+                requests.Append(tmp);
             } else {
                 /* There was a request queued for the same page but with different
                    zoom or rotation, so only replace this request */
                 req->zoom = zoom;
                 req->rotation = rotation;
             }
-            return;
+            isQueued = true;
         }
     }
+    if (isQueued)
+        return;
 
     if (Exists(dm, pageNo, rotation, zoom, &tile)) {
         /* This page has already been rendered in the correct dimensions
@@ -385,9 +563,69 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
         return;
     }
 
+    if (NeedsPreview(dm, pageNo, rotation, zoom, tile))
+        Render(dm, pageNo, rotation, zoom, &tile, NULL, NULL, true);
     Render(dm, pageNo, rotation, zoom, &tile);
 }
 
+// bitmaps for pages that are pre-rendered ahead of the reader may take up at most
+// half of the cache memory, so that they don't evict recently viewed pages
+bool RenderCache::HasPrefetchMemory(DisplayModel *dm, int pageNo)
+{
+    int rotation = NormalizeRotation(dm->Rotation());
+    RectI pageRect = GetTileRectDevice(dm->engine, pageNo, rotation, dm->ZoomReal(pageNo), TilePosition(0, 0, 0));
+    size_t memSize = (size_t)pageRect.dx * pageRect.dy * 4;
+
+    ScopedCritSec scope(&cacheAccess);
+    for (int i = 0; i < cacheCount; i++) {
+        BitmapCacheEntry *entry = cache[i];
+        if (entry->dm == dm && entry->pageNo != pageNo && dm->PagePrefetched(entry->pageNo))
+            memSize += entry->memSize;
+    }
+    return memSize <= GetMaxCacheMemory() / 2;
+}
+
+// a low resolution preview is rendered first for visible tiles, if nothing usable
+// is to be displayed in the meantime and the full quality rendering is expected
+// to take a while
+bool RenderCache::NeedsPreview(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile)
+{
+    // replacements aren't displayed in remote sessions
+    if (isRemoteSession || !IsTileVisible(dm, pageNo, tile))
+        return false;
+
+    RectI tileRect = GetTileRectDevice(dm->engine, pageNo, rotation, zoom, tile);
+    double tilePixels = (double)tileRect.dx * tileRect.dy;
+
+    ScopedCritSec scope(&cacheAccess);
+    bool needsPreview = true;
+    for (int i = 0; i < cacheCount && needsPreview; i++) {
+        BitmapCacheEntry *entry = cache[i];
+        if (entry->dm != dm || entry->pageNo != pageNo || entry->rotation != rotation)
+            continue;
+        // the preview has already been rendered (the full quality request
+        // might have been dropped from the queue since, though)
+        if (entry->preview) {
+            if (entry->tile == tile && entry->zoom == zoom * PREVIEW_ZOOM_FACTOR)
+                needsPreview = false;
+            continue;
+        }
+        // a replacement of at least the preview's resolution is displayed instead
+        // (out-of-date bitmaps have been rendered at a similar resolution)
+        if (entry->tile == tile && (INVALID_ZOOM == entry->zoom || entry->zoom >= zoom * PREVIEW_ZOOM_FACTOR))
+            needsPreview = false;
+        // estimate the rendering time from how long it took for this page before
+        SizeI size = entry->bitmap ? entry->bitmap->Size() : SizeI();
+        if (!size.IsEmpty() && entry->renderTimeMs * tilePixels / ((double)size.dx * size.dy) < PREVIEW_MIN_RENDER_TIME)
+            needsPreview = false;
+    }
+    // else estimate it from how long it took for the other pages of the document
+    float msPerMegapixel = dm->renderMsPerMegapixel;
+    if (needsPreview && msPerMegapixel > 0 && msPerMegapixel * tilePixels / 1e6 < PREVIEW_MIN_RENDER_TIME)
+        needsPreview = false;
+    return needsPreview;
+}
+
 void RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom, RectD pageRect, RenderingCallback& callback)
 {
     bool ok = Render(dm, pageNo, rotation, zoom, NULL, &pageRect, &callback);
@@ -396,7 +634,8 @@ void RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
 }
 
 bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
-                         TilePosition *tile, RectD *pageRect, RenderingCallback *renderCb)
+                         TilePosition *tile, RectD *pageRect, RenderingCallback *renderCb,
+                         bool preview)
 {
     assert(dm);
     if (!dm || dm->dontRenderFlag)
@@ -405,22 +644,31 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
     assert(tile || pageRect && renderCb);
     if (!tile && !(pageRect && renderCb))
         return false;
+    // previews are only cached (and never handed to a callback)
+    assert(!preview || tile && !renderCb);
 
     ScopedCritSec scope(&requestAccess);
-    PageRenderRequest* newRequest;
 
     /* add request to the queue */
-    if (requestCount == MAX_PAGE_REQUESTS) {
-        /* queue is full -> remove the oldest items on the queue */
-        if (requests[0].renderCb)
-            requests[0].renderCb->Callback();
-        memmove(&(requests[0]), &(requests[1]), sizeof(PageRenderRequest) * (MAX_PAGE_REQUESTS - 1));
-        newRequest = &(requests[MAX_PAGE_REQUESTS-1]);
-    } else {
-        newRequest = &(requests[requestCount]);
-        requestCount++;
-    }
-    assert(requestCount <= MAX_PAGE_REQUESTS);
+    if (IsRenderQueueFull())
+        ClearStaleRequests();
+    if (IsRenderQueueFull()) {
+        /* queue is full -> remove the oldest of the least important requests */
+        size_t dropIdx = 0;
+        RenderPriority dropPrio = GetRenderPriority(requests.At(0));
+        for (size_t i = 1; i < requests.Count(); i++) {
+            RenderPriority prio = GetRenderPriority(requests.At(i));
+            if (prio > dropPrio) {
+                dropIdx = i;
+                dropPrio = prio;
+            }
+        }
+        if (requests.At(dropIdx).renderCb)
+            requests.At(dropIdx).renderCb->Callback();
+        requests.RemoveAt(dropIdx);
+    }
+    PageRenderRequest *newRequest = requests.AppendBlanks(1);
+    assert(requests.Count() <= MAX_PAGE_REQUESTS);
 
     newRequest->dm = dm;
     newRequest->pageNo = pageNo;
@@ -441,6 +689,8 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
     newRequest->abortCookie = NULL;
     newRequest->timestamp = GetTickCount();
     newRequest->renderCb = renderCb;
+    newRequest->engine = NULL;
+    newRequest->preview = preview;
 
     SetEvent(startRendering);
 
@@ -451,43 +701,170 @@ UINT RenderCache::GetRenderDelay(DisplayModel *dm, int pageNo, TilePosition tile
 {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile)
+    PageRenderRequest *curReq = GetCurrentRequest(dm, pageNo, tile);
+    if (curReq)
         return GetTickCount() - curReq->timestamp;
 
-    for (int i = 0; i < requestCount; i++)
-        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile)
-            return GetTickCount() - requests[i].timestamp;
+    for (size_t i = 0; i < requests.Count(); i++) {
+        PageRenderRequest& req = requests.At(i);
+        if (req.pageNo == pageNo && req.dm == dm && req.tile == tile)
+            return GetTickCount() - req.timestamp;
+    }
 
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest *req)
+PageRenderRequest *RenderCache::GetCurrentRequest(DisplayModel *dm, int pageNo, TilePosition tile) const
+{
+    for (int i = 0; i < renderThreadCount; i++) {
+        PageRenderRequest *req = curReqs[i];
+        if (req && req->pageNo == pageNo && req->dm == dm && req->tile == tile)
+            return req;
+    }
+    return NULL;
+}
+
+bool RenderCache::IsRenderingFor(DisplayModel *dm) const
+{
+    for (int i = 0; i < renderThreadCount; i++) {
+        if (curReqs[i] && curReqs[i]->dm == dm)
+            return true;
+    }
+    return false;
+}
+
+// whether another render thread is currently rendering with this engine
+bool RenderCache::IsEngineBusy(BaseEngine *engine) const
+{
+    for (int i = 0; i < renderThreadCount; i++) {
+        if (curReqs[i] && curReqs[i]->engine == engine)
+            return true;
+    }
+    return false;
+}
+
+// returns the clone of dm->engine belonging to render thread threadNo
+// (*needsCloning is set if the clone still has to be created by that thread)
+BaseEngine *RenderCache::GetEngineClone(DisplayModel *dm, int threadNo, bool *needsCloning)
 {
     ScopedCritSec scope(&requestAccess);
+    *needsCloning = false;
+    for (size_t i = 0; i < engineClones.Count(); i++) {
+        RenderEngineClone& clone = engineClones.At(i);
+        if (clone.dm != dm || clone.threadNo != threadNo)
+            continue;
+        if (!clone.outOfDate)
+            return clone.engine;
+        // this thread isn't using the clone, so it can be safely replaced
+        delete clone.engine;
+        engineClones.RemoveAt(i);
+        break;
+    }
+    *needsCloning = true;
+    return NULL;
+}
 
-    if (requestCount == 0)
+// determines the engine the current request of render thread threadNo
+// is rendered with, if another thread is already using dm->engine
+BaseEngine *RenderCache::UseEngineClone(int threadNo)
+{
+    PageRenderRequest *req = curReqs[threadNo];
+    DisplayModel *dm = req->dm;
+    bool needsCloning;
+    BaseEngine *engine = GetEngineClone(dm, threadNo, &needsCloning);
+    if (needsCloning) {
+        // cloning might take a while, so don't block other threads meanwhile
+        engine = dm->engine->Clone();
+        ScopedCritSec scope(&requestAccess);
+        RenderEngineClone clone = { dm, threadNo, engine, false };
+        engineClones.Append(clone);
+    }
+
+    ScopedCritSec scope(&requestAccess);
+    // fall back to the original engine if cloning failed (engines
+    // supporting concurrent rendering are thread-safe, anyway)
+    req->engine = engine ? engine : dm->engine;
+    return req->engine;
+}
+
+// note: clones in use by a render thread are only marked as out-of-date
+void RenderCache::FreeEngineClones(DisplayModel *dm, bool onlyOutOfDate)
+{
+    ScopedCritSec scope(&requestAccess);
+    for (size_t i = engineClones.Count(); i > 0; i--) {
+        RenderEngineClone& clone = engineClones.At(i - 1);
+        if (clone.dm != dm)
+            continue;
+        if (onlyOutOfDate && clone.engine && IsEngineBusy(clone.engine)) {
+            clone.outOfDate = true;
+            continue;
+        }
+        CrashIf(clone.engine && IsEngineBusy(clone.engine));
+        delete clone.engine;
+        engineClones.RemoveAt(i - 1);
+    }
+}
+
+bool RenderCache::GetNextRequest(int threadNo, PageRenderRequest *req)
+{
+    ScopedCritSec scope(&requestAccess);
+    assert(!curReqs[threadNo]);
+
+    // the view might have changed since the requests were queued
+    ClearStaleRequests();
+
+    // pick the most recent request of the highest priority that this thread
+    // is able to render (engines can only be used by one render thread at
+    // a time; for engines supporting concurrent rendering, the other
+    // threads use a clone) - previews go first among requests of the same priority
+    int bestIdx = -1;
+    RenderPriority bestPrio = Priority_Stale;
+    BaseEngine *bestEngine = NULL;
+    for (int i = (int)requests.Count() - 1; i >= 0; i--) {
+        RenderPriority prio = GetRenderPriority(requests.At(i));
+        bool preview = requests.At(i).preview;
+        if (prio > bestPrio || prio == bestPrio && (-1 == bestIdx || !preview || requests.At(bestIdx).preview))
+            continue;
+        BaseEngine *engine = requests.At(i).dm->engine;
+        if (engine && IsEngineBusy(engine)) {
+            if (!engine->SupportsConcurrentRendering())
+                continue;
+            // the clone to use is determined by UseEngineClone
+            engine = NULL;
+        }
+        bestIdx = i;
+        bestPrio = prio;
+        bestEngine = engine;
+        if (Priority_Visible == prio && preview)
+            break;
+    }
+    if (-1 == bestIdx)
         return false;
 
-    assert(requestCount > 0);
-    assert(requestCount <= MAX_PAGE_REQUESTS);
-    requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
-    assert(requestCount >= 0);
+    *req = requests.At(bestIdx);
+    req->engine = bestEngine;
+    requests.RemoveAt(bestIdx);
+    curReqs[threadNo] = req;
     assert(!req->abort);
 
+    // wake another thread for the remaining requests
+    if (requests.Count() > 0)
+        SetEvent(startRendering);
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest()
+void RenderCache::ClearCurrentRequest(int threadNo)
 {
     ScopedCritSec scope(&requestAccess);
-    if (curReq)
-        delete curReq->abortCookie;
-    curReq = NULL;
+    PageRenderRequest *curReq = curReqs[threadNo];
+    if (!curReq)
+        return;
+    delete curReq->abortCookie;
+    curReqs[threadNo] = NULL;
 
-    bool isQueueEmpty = requestCount == 0;
-    return isQueueEmpty;
+    // requests for the engine just used might have been left for this thread
+    if (requests.Count() > 0)
+        SetEvent(startRendering);
 }
 
 /* Wait until rendering of a page beloging to <dm> has finished. */
@@ -499,14 +876,16 @@ void RenderCache::CancelRendering(DisplayModel *dm)
 
     for (;;) {
         EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        if (!IsRenderingFor(dm)) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
+            // the DisplayModel (and thus its engine) might be about to be deleted
+            FreeEngineClones(dm);
             LeaveCriticalSection(&requestAccess);
             return;
         }
 
-        AbortCurrentRequest();
+        AbortCurrentRequests(dm);
         LeaveCriticalSection(&requestAccess);
 
         /* TODO: busy loop is not good, but I don't have a better idea */
@@ -517,49 +896,62 @@ void RenderCache::CancelRendering(DisplayModel *dm)
 void RenderCache::ClearQueueForDisplayModel(DisplayModel *dm, int pageNo, TilePosition *tile)
 {
     ScopedCritSec scope(&requestAccess);
-    int reqCount = requestCount;
-    int curPos = 0;
-    for (int i = 0; i < reqCount; i++) {
-        PageRenderRequest *req = &(requests[i]);
+    for (size_t i = requests.Count(); i > 0; i--) {
+        PageRenderRequest *req = requests.AtPtr(i - 1);
         bool shouldRemove = req->dm == dm && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) &&
             (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
-        if (i != curPos)
-            requests[curPos] = requests[i];
         if (shouldRemove) {
             if (req->renderCb)
                 req->renderCb->Callback();
-            requestCount--;
-        } else
-            curPos++;
+            requests.RemoveAt(i - 1);
+        }
     }
 }
 
-void RenderCache::AbortCurrentRequest()
+// drops requests for pages that have been scrolled out of view
+void RenderCache::ClearStaleRequests()
 {
     ScopedCritSec scope(&requestAccess);
-    if (!curReq)
-        return;
-    if (curReq->abortCookie)
-        curReq->abortCookie->Abort();
-    curReq->abort = true;
+    for (size_t i = requests.Count(); i > 0; i--) {
+        PageRenderRequest *req = requests.AtPtr(i - 1);
+        if (GetRenderPriority(*req) != Priority_Stale)
+            continue;
+        if (req->renderCb)
+            req->renderCb->Callback();
+        requests.RemoveAt(i - 1);
+    }
+}
+
+// aborts all requests currently being rendered (for a given DisplayModel and page)
+void RenderCache::AbortCurrentRequests(DisplayModel *dm, int pageNo)
+{
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < renderThreadCount; i++) {
+        PageRenderRequest *req = curReqs[i];
+        if (!req || dm && req->dm != dm || pageNo != INVALID_PAGE_NO && req->pageNo != pageNo)
+            continue;
+        if (req->abortCookie)
+            req->abortCookie->Abort();
+        req->abort = true;
+    }
 }
 
 DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
 {
-    RenderCache *cache = (RenderCache *)data;
+    RenderCache *cache = ((RenderThreadData *)data)->cache;
+    int threadNo = ((RenderThreadData *)data)->threadNo;
     PageRenderRequest   req;
     RenderedBitmap *    bmp;
 
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
-            DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
-            // Is it not a page render request?
-            if (WAIT_OBJECT_0 != waitResult)
-                continue;
-        }
+        cache->ClearCurrentRequest(threadNo);
 
-        if (!cache->GetNextRequest(&req))
+        if (!cache->GetNextRequest(threadNo, &req)) {
+            TRACE_SCOPE("RenderCache::Wait");
+            WaitForSingleObject(cache->startRendering, INFINITE);
             continue;
+        }
+        TRACE_SCOPE_N("RenderCache::Render", req.pageNo);
         if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb)
             continue;
         if (req.dm->dontRenderFlag) {
@@ -574,8 +966,22 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
         if (!req.dm->textCache->HasData(req.pageNo))
             req.dm->textCache->GetData(req.pageNo);
 
+        BaseEngine *engine = req.engine;
+        if (!engine)
+            engine = cache->UseEngineClone(threadNo);
+
+        if (!req.renderCb) {
+            ScopedCritSec scope(&cache->statsAccess);
+            cache->GetStatsFor(req.dm)->queueWait.Add(GetTickCount() - req.timestamp);
+        }
+
         CrashIf(req.abortCookie != NULL);
-        bmp = req.dm->engine->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, Target_View, &req.abortCookie);
+        Timer renderTime(true);
+        if (req.preview)
+            bmp = engine->RenderPreviewBitmap(req.pageNo, req.zoom * PREVIEW_ZOOM_FACTOR, req.rotation, &req.pageRect, &req.abortCookie);
+        else
+            bmp = engine->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, Target_View, &req.abortCookie);
+        renderTime.Stop();
         if (req.abort) {
             delete bmp;
             if (req.renderCb)
@@ -590,23 +996,124 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
         }
         else {
             // don't replace colors for individual images
-            if (bmp && !req.dm->engine->IsImageCollection())
-                UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
-            cache->Add(req, bmp);
-            req.dm->RepaintDisplay();
+            if (bmp && !req.dm->engine->IsImageCollection()) {
+                BITMAPINFO *bmi;
+                void *data = bmp->GetDIBData(&bmi);
+                if (!data || !UpdateDIBColors(bmi, data, cache->textColor, cache->backgroundColor))
+                    UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
+            }
+            if (bmp) {
+                ScopedCritSec scope(&cache->statsAccess);
+                cache->GetStatsFor(req.dm)->renderTime.Add(renderTime.GetTimeInMs());
+                SizeI size = bmp->Size();
+                if (!req.preview && !size.IsEmpty()) {
+                    float msPerMegapixel = (float)(renderTime.GetTimeInMs() * 1e6 / ((double)size.dx * size.dy));
+                    float avg = req.dm->renderMsPerMegapixel;
+                    req.dm->renderMsPerMegapixel = avg > 0 ? 0.7f * avg + 0.3f * msPerMegapixel : msPerMegapixel;
+                }
+            }
+            cache->Add(req, bmp, renderTime.GetTimeInMs());
+            req.dm->RepaintDisplay(cache->isRemoteSession ? REMOTE_REPAINT_DELAY : 0);
         }
     }
 }
 
+void RenderLatencyHistogram::Add(double ms)
+{
+    int ix = 0;
+    for (double limit = 1; ix < RENDER_LATENCY_BUCKETS - 1 && ms >= limit; limit *= 2) {
+        ix++;
+    }
+    buckets[ix]++;
+    count++;
+    totalMs += ms;
+}
+
+int RenderLatencyHistogram::Percentile(int p) const
+{
+    int needed = (count * p + 99) / 100;
+    int seen = 0;
+    for (int i = 0; i < RENDER_LATENCY_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= needed)
+            return 1 << i;
+    }
+    return 1 << (RENDER_LATENCY_BUCKETS - 1);
+}
+
+RenderStats *RenderCache::GetStatsFor(DisplayModel *dm)
+{
+    for (size_t i = 0; i < stats.Count(); i++) {
+        if (stats.At(i).engineType == dm->engineType)
+            return &stats.At(i);
+    }
+    RenderStats *s = stats.AppendBlanks(1);
+    s->engineType = dm->engineType;
+    str::BufSet(s->fileExt, dimof(s->fileExt), dm->engine ? dm->engine->GetDefaultFileExt() : L"");
+    return s;
+}
+
+static void AppendHistogram(str::Str<WCHAR>& out, const WCHAR *name, const RenderLatencyHistogram& h)
+{
+    if (0 == h.count) {
+        out.AppendFmt(L"  %s: -\r\n", name);
+        return;
+    }
+    out.AppendFmt(L"  %s: %d, avg %.1f ms, p50 < %d ms, p95 < %d ms, p99 < %d ms\r\n", name, h.count,
+                  h.totalMs / h.count, h.Percentile(50), h.Percentile(95), h.Percentile(99));
+    out.Append(L"   ");
+    for (int i = 0; i < RENDER_LATENCY_BUCKETS; i++) {
+        out.AppendFmt(L" %d", h.buckets[i]);
+    }
+    out.Append(L"\r\n");
+}
+
+WCHAR *RenderCache::GetStats()
+{
+    ScopedCritSec scope(&statsAccess);
+    str::Str<WCHAR> out;
+    for (size_t i = 0; i < stats.Count(); i++) {
+        const RenderStats& s = stats.At(i);
+        int lookups = s.cacheHits + s.cacheMisses;
+        out.AppendFmt(L"%s: %d cache hits of %d (%.1f %%)\r\n", *s.fileExt ? s.fileExt : L"?",
+                      s.cacheHits, lookups, lookups ? 100.0 * s.cacheHits / lookups : 0.0);
+        AppendHistogram(out, L"queue wait", s.queueWait);
+        AppendHistogram(out, L"render time", s.renderTime);
+        AppendHistogram(out, L"request to paint", s.requestToPaint);
+    }
+    if (0 == stats.Count())
+        out.Append(L"no rendering statistics yet\r\n");
+    return out.StealData();
+}
+
+void RenderCache::ResetStats()
+{
+    ScopedCritSec scope(&statsAccess);
+    stats.Reset();
+}
+
 // TODO: conceptually, RenderCache is not the right place for code that paints
 //       (this is the only place that knows about Tiles, though)
-UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
+UINT RenderCache::PaintTile(TilePainter& painter, RectI bounds, DisplayModel *dm, int pageNo,
                             TilePosition tile, RectI tileOnScreen, bool renderMissing,
                             bool *renderOutOfDateCue, bool *renderedReplacement)
 {
     BitmapCacheEntry *entry = Find(dm, pageNo, dm->Rotation(), dm->ZoomReal(), &tile);
     UINT renderDelay = 0;
 
+    if (renderMissing) {
+        ScopedCritSec scope(&statsAccess);
+        RenderStats *s = GetStatsFor(dm);
+        if (entry && !entry->outOfDate)
+            s->cacheHits++;
+        else
+            s->cacheMisses++;
+        if (entry && !entry->painted && !entry->preview && entry->bitmap && entry->requestTime) {
+            s->requestToPaint.Add(GetTickCount() - entry->requestTime);
+            entry->painted = true;
+        }
+    }
+
     if (!entry) {
         if (!isRemoteSession) {
             if (renderedReplacement)
@@ -618,9 +1125,8 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
             RequestRendering(dm, pageNo, tile);
     }
     RenderedBitmap *renderedBmp = entry ? entry->bitmap : NULL;
-    HBITMAP hbmp = renderedBmp ? renderedBmp->GetBitmap() : NULL;
 
-    if (!hbmp) {
+    if (!renderedBmp || !renderedBmp->IsValid()) {
         if (entry && !(renderedBmp && ReduceTileSize()))
             renderDelay = RENDER_DELAY_FAILED;
         else if (0 == renderDelay)
@@ -630,31 +1136,16 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
         return renderDelay;
     }
 
-    HDC bmpDC = CreateCompatibleDC(hdc);
-    if (bmpDC) {
-        SizeI bmpSize = renderedBmp->Size();
-        int xSrc = -min(tileOnScreen.x, 0);
-        int ySrc = -min(tileOnScreen.y, 0);
-        float factor = min(1.0f * bmpSize.dx / tileOnScreen.dx, 1.0f * bmpSize.dy / tileOnScreen.dy);
-
-        SelectObject(bmpDC, hbmp);
-        if (factor != 1.0f)
-            StretchBlt(hdc, bounds.x, bounds.y, bounds.dx, bounds.dy,
-                bmpDC, (int)(xSrc * factor), (int)(ySrc * factor),
-                (int)(bounds.dx * factor), (int)(bounds.dy * factor), SRCCOPY);
-        else
-            BitBlt(hdc, bounds.x, bounds.y, bounds.dx, bounds.dy,
-                bmpDC, xSrc, ySrc, SRCCOPY);
-
-        DeleteDC(bmpDC);
+    SizeI bmpSize = renderedBmp->Size();
+    int xSrc = -min(tileOnScreen.x, 0);
+    int ySrc = -min(tileOnScreen.y, 0);
+    float factor = min(1.0f * bmpSize.dx / tileOnScreen.dx, 1.0f * bmpSize.dy / tileOnScreen.dy);
 
-#ifdef SHOW_TILE_LAYOUT
-        HPEN pen = CreatePen(PS_SOLID, 1, RGB(0xff, 0xff, 0x00));
-        HGDIOBJ oldPen = SelectObject(hdc, pen);
-        PaintRect(hdc, bounds);
-        DeletePen(SelectObject(hdc, oldPen));
-#endif
-    }
+    if (factor != 1.0f)
+        painter.DrawTile(renderedBmp, bounds, RectI((int)(xSrc * factor), (int)(ySrc * factor),
+                                                    (int)(bounds.dx * factor), (int)(bounds.dy * factor)));
+    else
+        painter.DrawTile(renderedBmp, bounds, RectI(xSrc, ySrc, bounds.dx, bounds.dy));
 
     if (entry->outOfDate) {
         if (renderOutOfDateCue)
@@ -674,8 +1165,34 @@ static int cmpTilePosition(const void *a, const void *b)
                                 ta->col - tb->col;
 }
 
+class HdcTilePainter : public TilePainter {
+    HDC hdc;
+
+public:
+    explicit HdcTilePainter(HDC hdc) : hdc(hdc) { }
+
+    virtual void DrawTile(RenderedBitmap *bmp, RectI target, RectI source) {
+        // DIBs are painted straight from memory (without requiring an HBITMAP)
+        bmp->Blit(hdc, target, source);
+
+#ifdef SHOW_TILE_LAYOUT
+        HPEN pen = CreatePen(PS_SOLID, 1, RGB(0xff, 0xff, 0x00));
+        HGDIOBJ oldPen = SelectObject(hdc, pen);
+        PaintRect(hdc, target);
+        DeletePen(SelectObject(hdc, oldPen));
+#endif
+    }
+};
+
 UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
                         PageInfo *pageInfo, bool *renderOutOfDateCue)
+{
+    HdcTilePainter painter(hdc);
+    return Paint(painter, bounds, dm, pageNo, pageInfo, renderOutOfDateCue);
+}
+
+UINT RenderCache::Paint(TilePainter& painter, RectI bounds, DisplayModel *dm, int pageNo,
+                        PageInfo *pageInfo, bool *renderOutOfDateCue)
 {
     assert(pageInfo->shown && 0.0 != pageInfo->visibleRatio);
 
@@ -706,7 +1223,7 @@ UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
             continue;
 
         bool isTargetRes = tile.res == targetRes;
-        UINT renderDelay = PaintTile(hdc, isect, dm, pageNo, tile, tileOnScreen, isTargetRes,
+        UINT renderDelay = PaintTile(painter, isect, dm, pageNo, tile, tileOnScreen, isTargetRes,
                                      renderOutOfDateCue, isTargetRes ? &neededScaling : NULL);
         if (!(isTargetRes && 0 == renderDelay) && tile.res < maxRes) {
             queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2));
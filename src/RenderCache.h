@@ -15,6 +15,15 @@ public:
     virtual void Callback(RenderedBitmap *bmp=NULL) = 0;
 };
 
+/* Receives the cached bitmaps RenderCache::Paint wants painted (either
+   blitted to a device context or e.g. composited on the GPU, cf. D2DCanvas) */
+class TilePainter {
+public:
+    virtual ~TilePainter() { }
+    // paint the source rectangle of bmp stretched into the target rectangle
+    virtual void DrawTile(RenderedBitmap *bmp, RectI target, RectI source) = 0;
+};
+
 /* A page is split into tiles of at most TILE_MAX_W x TILE_MAX_H pixels.
    A given tile starts at (col / 2^res * page_width, row / 2^res * page_height). */
 struct TilePosition {
@@ -42,11 +51,36 @@ struct BitmapCacheEntry {
     bool             outOfDate;
     int              refs;
 
-    BitmapCacheEntry(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile, RenderedBitmap *bitmap) :
-        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap), outOfDate(false), refs(1) { }
+    // used for deciding which bitmaps to drop first (cf. RenderCache::GetEvictionCandidate)
+    size_t           memSize;
+    // how long it took to render the bitmap (i.e. how costly dropping it would be)
+    double           renderTimeMs;
+    // GetTickCount() of when the bitmap was last needed
+    DWORD            lastUsed;
+    // whether this is a quick low resolution preview (cf. PageRenderRequest::preview)
+    bool             preview;
+    // GetTickCount() of when the bitmap was requested (cf. PageRenderRequest::timestamp)
+    // and whether it's been painted since (cf. RenderStats::requestToPaint)
+    DWORD            requestTime;
+    bool             painted;
+
+    BitmapCacheEntry(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile,
+                     RenderedBitmap *bitmap, size_t memSize, double renderTimeMs) :
+        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap),
+        outOfDate(false), refs(1), memSize(memSize), renderTimeMs(renderTimeMs),
+        lastUsed(GetTickCount()), preview(false), requestTime(0), painted(false) { }
     ~BitmapCacheEntry() { delete bitmap; }
 };
 
+/* Requests for visible tiles are rendered first, then those for pages
+   nearby (predictive rendering), then those for pages further ahead in
+   reading direction (cf. DisplayModel::PagePrefetched) and finally requests
+   which aren't related to the current view at all (e.g. thumbnails). Stale
+   requests (for pages which are no longer visible nearby) are dropped. */
+enum RenderPriority {
+    Priority_Visible, Priority_Nearby, Priority_Prefetch, Priority_Speculative, Priority_Stale
+};
+
 /* Even though this looks a lot like a BitmapCacheEntry, we keep it
    separate for clarity in the code (PageRenderRequests are reused,
    while BitmapCacheEntries are ref-counted) */
@@ -64,35 +98,117 @@ struct PageRenderRequest {
     // owned by the PageRenderRequest (use it before reusing the request)
     // on rendering success, the callback gets handed the RenderedBitmap
     RenderingCallback * renderCb;
+    // the engine to render with (dm->engine or a clone of it for rendering
+    // concurrently with other render threads), set by GetNextRequest
+    BaseEngine *        engine;
+    // if set, the tile is quickly rendered at PREVIEW_ZOOM_FACTOR * zoom
+    // (a request for the full quality rendering is queued right after it)
+    bool                preview;
+};
+
+/* For engines which SupportsConcurrentRendering, additional render threads
+   render with their own Clone() of a DisplayModel's engine so that
+   several tiles can be rendered at the same time */
+struct RenderEngineClone {
+    DisplayModel *      dm;
+    int                 threadNo;
+    // NULL if cloning failed (in which case dm->engine is used)
+    BaseEngine *        engine;
+    // set if the clone no longer matches dm->engine (e.g. after annotations changed)
+    bool                outOfDate;
+};
+
+// number of buckets of a RenderLatencyHistogram
+#define RENDER_LATENCY_BUCKETS 16
+
+/* Counts how often delays of [0, 1), [1, 2), [2, 4), [4, 8), ... ms occurred
+   (the last bucket also counts all longer delays) */
+struct RenderLatencyHistogram {
+    int                 buckets[RENDER_LATENCY_BUCKETS];
+    int                 count;
+    double              totalMs;
+
+    void Add(double ms);
+    // returns the upper bound of the bucket containing the p-th percentile
+    int Percentile(int p) const;
+};
+
+/* Rendering statistics for all documents with the same engine type
+   (for tuning tile size and cache parameters, cf. RenderCache::GetStats) */
+struct RenderStats {
+    DocType             engineType;
+    WCHAR               fileExt[8];
+    // time between a tile being requested and a render thread starting to render it
+    RenderLatencyHistogram queueWait;
+    // time it took to render a tile
+    RenderLatencyHistogram renderTime;
+    // time between a tile being requested and it first being painted
+    RenderLatencyHistogram requestToPaint;
+    // how often a tile at the needed resolution was resp. wasn't in the cache when painting
+    int                 cacheHits;
+    int                 cacheMisses;
 };
 
-#define MAX_PAGE_REQUESTS 8
+// maximum number of queued requests (if the queue is full,
+// the request with the lowest priority is dropped)
+#define MAX_PAGE_REQUESTS 16
+
+// upper limit for the number of render threads (the actual
+// count depends on the number of available processors)
+#define MAX_RENDER_THREADS 8
+
+// preview tiles are rendered at a quarter of the requested resolution
+#define PREVIEW_ZOOM_FACTOR 0.25f
+// tiles which previously rendered faster than this (in ms) don't need a preview
+#define PREVIEW_MIN_RENDER_TIME 50
 
-// keep this value reasonably low, else we'll run
-// out of GDI memory when caching many larger bitmaps
-#define MAX_BITMAPS_CACHED 64
+// over Remote Desktop, every repaint is sent across the network, so the
+// repaints for tiles finishing rendering in quick succession are coalesced
+#define REMOTE_REPAINT_DELAY 100
+
+// documents rendering faster than this (in ms per megapixel) are rendered in
+// larger tiles, documents rendering slower in smaller tiles, so that these
+// can be distributed among the render threads (cf. RenderCache::GetTileRes)
+#define CHEAP_RENDER_MS_PER_MEGAPIXEL       25
+#define EXPENSIVE_RENDER_MS_PER_MEGAPIXEL   250
+
+// upper limit for the number of cached bitmaps (usually, either the memory
+// limit or the GDI handle headroom are reached long before this value)
+#define MAX_BITMAPS_CACHED 256
 
 class RenderCache
 {
 private:
     BitmapCacheEntry *  cache[MAX_BITMAPS_CACHED];
     int                 cacheCount;
+    // sum of the memSize of all cached bitmaps
+    size_t              cacheMemory;
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION    cacheAccess;
 
-    PageRenderRequest   requests[MAX_PAGE_REQUESTS];
-    int                 requestCount;
-    PageRenderRequest * curReq;
+    // ordered from oldest to most recent request
+    Vec<PageRenderRequest> requests;
+    // the requests currently being rendered (one slot per render thread)
+    PageRenderRequest * curReqs[MAX_RENDER_THREADS];
     CRITICAL_SECTION    requestAccess;
-    HANDLE              renderThread;
+    HANDLE              renderThreads[MAX_RENDER_THREADS];
+    int                 renderThreadCount;
+    // protected by requestAccess
+    Vec<RenderEngineClone> engineClones;
 
     SizeI               maxTileSize;
     bool                isRemoteSession;
 
+    Vec<RenderStats>    stats;
+    CRITICAL_SECTION    statsAccess;
+
 public:
     COLORREF            textColor;
     COLORREF            backgroundColor;
+    // maximum memory to use for cached bitmaps (in MB)
+    // if zero, it's determined from the available memory
+    int                 maxMemoryMB;
 
     RenderCache();
     ~RenderCache();
@@ -104,21 +220,39 @@ public:
     bool    Exists(DisplayModel *dm, int pageNo, int rotation,
                    float zoom=INVALID_ZOOM, TilePosition *tile=NULL);
     void    FreeForDisplayModel(DisplayModel *dm) { FreePage(dm); }
-    void    KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm);
+    // moves the bitmaps of oldDm's visible pages to newDm (to be painted until
+    // they've been rerendered); bitmaps of unchangedPages (if given) are moved
+    // for all pages and don't have to be rerendered at all
+    void    KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm, Vec<bool> *unchangedPages=NULL);
+    // returns how much memory the bitmaps cached for dm take up
+    size_t  GetMemoryUsage(DisplayModel *dm);
     void    Invalidate(DisplayModel *dm, int pageNo, RectD rect);
     // returns how much time in ms has past since the most recent rendering
     // request for the visible part of the page if nothing at all could be
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
     UINT    Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
                   PageInfo *pageInfo, bool *renderOutOfDateCue);
+    UINT    Paint(TilePainter& painter, RectI bounds, DisplayModel *dm, int pageNo,
+                  PageInfo *pageInfo, bool *renderOutOfDateCue);
+
+    // returns a summary of the rendering statistics of all engine types
+    // (caller must free the result)
+    WCHAR * GetStats();
+    void    ResetStats();
 
 protected:
-    /* Interface for page rendering thread */
+    /* Interface for page rendering threads */
     HANDLE  startRendering;
 
-    bool    ClearCurrentRequest();
-    bool    GetNextRequest(PageRenderRequest *req);
-    void    Add(PageRenderRequest &req, RenderedBitmap *bitmap);
+    void    ClearCurrentRequest(int threadNo);
+    bool    GetNextRequest(int threadNo, PageRenderRequest *req);
+    bool    IsEngineBusy(BaseEngine *engine) const;
+    BaseEngine *GetEngineClone(DisplayModel *dm, int threadNo, bool *needsCloning);
+    BaseEngine *UseEngineClone(int threadNo);
+    void    FreeEngineClones(DisplayModel *dm, bool onlyOutOfDate=false);
+    void    Add(PageRenderRequest &req, RenderedBitmap *bitmap, double renderTimeMs);
+    // caller must hold statsAccess
+    RenderStats *GetStatsFor(DisplayModel *dm);
 
 private:
     USHORT  GetTileRes(DisplayModel *dm, int pageNo);
@@ -126,26 +260,38 @@ private:
     bool    ReduceTileSize();
 
     bool    IsRenderQueueFull() const {
-                return requestCount == MAX_PAGE_REQUESTS;
+                return requests.Count() >= MAX_PAGE_REQUESTS;
             }
     UINT    GetRenderDelay(DisplayModel *dm, int pageNo, TilePosition tile);
+    bool    NeedsPreview(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile);
+    bool    HasPrefetchMemory(DisplayModel *dm, int pageNo);
     void    RequestRendering(DisplayModel *dm, int pageNo, TilePosition tile, bool clearQueueForPage=true);
     bool    Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
                    TilePosition *tile=NULL, RectD *pageRect=NULL,
-                   RenderingCallback *callback=NULL);
+                   RenderingCallback *callback=NULL, bool preview=false);
     void    ClearQueueForDisplayModel(DisplayModel *dm, int pageNo=INVALID_PAGE_NO,
                                       TilePosition *tile=NULL);
-    void    AbortCurrentRequest();
+    void    ClearStaleRequests();
+    PageRenderRequest *GetCurrentRequest(DisplayModel *dm, int pageNo, TilePosition tile) const;
+    bool    IsRenderingFor(DisplayModel *dm) const;
+    void    AbortCurrentRequests(DisplayModel *dm=NULL, int pageNo=INVALID_PAGE_NO);
 
+    struct RenderThreadData {
+        RenderCache *   cache;
+        int             threadNo;
+    } threadData[MAX_RENDER_THREADS];
     static DWORD WINAPI RenderCacheThread(LPVOID data);
 
     BitmapCacheEntry *  Find(DisplayModel *dm, int pageNo, int rotation,
                              float zoom=INVALID_ZOOM, TilePosition *tile=NULL);
     void    DropCacheEntry(BitmapCacheEntry *entry);
+    void    RemoveCacheEntryAt(int idx);
+    size_t  GetMaxCacheMemory() const;
+    int     GetEvictionCandidate() const;
     void    FreePage(DisplayModel *dm=NULL, int pageNo=-1, TilePosition *tile=NULL);
     void    FreeNotVisible() { FreePage(); }
 
-    UINT    PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
+    UINT    PaintTile(TilePainter& painter, RectI bounds, DisplayModel *dm, int pageNo,
                       TilePosition tile, RectI tileOnScreen, bool renderMissing,
                       bool *renderOutOfDateCue, bool *renderedReplacement);
 };
@@ -11,13 +11,16 @@
 
 #include "AppPrefs.h"
 #include "AppTools.h"
+#include "FileUtil.h"
 #include "Notifications.h"
 #include "PdfEngine.h"
 #include "PdfSync.h"
 #include "resource.h"
 #include "Selection.h"
+#include "SumatraAbout.h"
 #include "SumatraDialogs.h"
 #include "SumatraPDF.h"
+#include "ThreadUtil.h"
 #include "Translations.h"
 #include "UITask.h"
 #include "WindowInfo.h"
@@ -160,6 +163,7 @@ static void ShowSearchResult(WindowInfo& win, TextSel *result, bool addNavPt)
 void ClearSearchResult(WindowInfo *win)
 {
     DeleteOldSelectionInfo(win, true);
+    ClearFindAllMatches(win);
     win->RepaintAsync();
 }
 
@@ -246,6 +250,151 @@ struct FindThreadData : public ProgressUpdateUI {
     }
 };
 
+class FindAllMatchesTask : public UITask {
+    WindowInfo *win;
+    HANDLE thread;
+    int pageNo;
+    Vec<SelectionOnPage> *matches;
+
+public:
+    FindAllMatchesTask(WindowInfo *win, HANDLE thread, int pageNo, Vec<SelectionOnPage> *matches) :
+        win(win), thread(thread), pageNo(pageNo), matches(matches) { }
+    ~FindAllMatchesTask() { delete matches; }
+
+    virtual void Execute() {
+        if (!WindowInfoStillValid(win) || win->findAllThread != thread || !win->findAllMatches)
+            return;
+        win->findAllMatches->Append(matches->LendData(), matches->Count());
+        if (win->dm->PageVisible(pageNo))
+            win->RepaintAsync();
+    }
+};
+
+struct FindAllThreadData : public FindAllSink, public ProgressUpdateUI {
+    WindowInfo *win;
+    HANDLE thread;
+    ScopedMem<WCHAR> text;
+    // FindAll doesn't interfere with the state of win->dm->textSearch this way
+    TextSearch search;
+
+    FindAllThreadData(WindowInfo& win, const WCHAR *text) :
+        win(&win), thread(NULL), text(str::Dup(text)),
+        search(win.dm->engine, win.dm->textCache) {
+        search.SetSensitive(win.findAllMatchCase);
+    }
+
+    virtual bool MatchesFound(int pageNo, int count, TextSel *matches) {
+        if (WasCanceled())
+            return false;
+        Vec<SelectionOnPage> *sel = SelectionOnPage::FromTextSelect(matches);
+        if (sel)
+            uitask::Post(new FindAllMatchesTask(win, thread, pageNo, sel));
+        return true;
+    }
+
+    virtual void UpdateProgress(int current, int total) { }
+
+    virtual bool WasCanceled() {
+        return !WindowInfoStillValid(win) || win->findAllCanceled;
+    }
+};
+
+class FindAllEndTask : public UITask {
+    WindowInfo *win;
+    FindAllThreadData *ftd;
+    ScopedHandle thread;
+    // -1 if the search has been canceled
+    int count;
+
+public:
+    FindAllEndTask(WindowInfo *win, FindAllThreadData *ftd, int count) :
+        win(win), ftd(ftd), count(count),
+        thread(win->findAllThread) { } // close the thread handle after execution
+    ~FindAllEndTask() { delete ftd; }
+
+    virtual void Execute() {
+        if (!WindowInfoStillValid(win) || win->findAllThread != thread)
+            return;
+        win->findAllThread = NULL;
+        if (count < 0 || !win->findAllMatches) {
+            // the matches are incomplete, so look for them again next time
+            str::ReplacePtr(&win->findAllText, NULL);
+            return;
+        }
+        ScopedMem<WCHAR> msg(str::Format(_TR("Found %d matches"), count));
+        ShowNotification(win, msg, true, false, NG_FIND_MATCH_COUNT);
+    }
+};
+
+static void CleanUpTextIndexCache();
+
+static DWORD WINAPI FindAllThread(LPVOID data)
+{
+    FindAllThreadData *ftd = (FindAllThreadData *)data;
+    WindowInfo *win = ftd->win;
+
+    // wait for StartFindAll to return (cf. FindThread)
+    while (!win->findAllThread)
+        Sleep(1);
+    ftd->thread = win->findAllThread;
+
+    int count = ftd->search.FindAll(ftd->text, ftd, ftd);
+
+    PageTextCache *textCache = win->dm->textCache;
+    if (textCache->HasIndexFile() && textCache->SaveIndex())
+        CleanUpTextIndexCache();
+
+    uitask::Post(new FindAllEndTask(win, ftd, ftd->WasCanceled() ? -1 : count));
+    return 0;
+}
+
+static void AbortFindAll(WindowInfo *win)
+{
+    if (win->findAllThread) {
+        win->findAllCanceled = true;
+        WaitForSingleObject(win->findAllThread, INFINITE);
+    }
+    win->findAllCanceled = false;
+}
+
+void ClearFindAllMatches(WindowInfo *win)
+{
+    AbortFindAll(win);
+    delete win->findAllMatches;
+    win->findAllMatches = NULL;
+    str::ReplacePtr(&win->findAllText, NULL);
+}
+
+// collects all matches of text on a thread of its own (unless they're
+// already known), so that they can be highlighted as well
+static void StartFindAll(WindowInfo *win, const WCHAR *text)
+{
+    bool matchCase = win->dm->textSearch->IsSensitive();
+    if (str::Eq(win->findAllText, text) && win->findAllMatchCase == matchCase)
+        return;
+
+    ClearFindAllMatches(win);
+    win->findAllMatches = new Vec<SelectionOnPage>();
+    win->findAllText = str::Dup(text);
+    win->findAllMatchCase = matchCase;
+
+    FindAllThreadData *ftd = new FindAllThreadData(*win, text);
+    win->findAllThread = NULL;
+    win->findAllThread = CreateThread(NULL, 0, FindAllThread, ftd, 0, 0);
+}
+
+void PaintFindAllMatches(WindowInfo *win, HDC hdc)
+{
+    Vec<RectI> rects;
+    for (size_t i = 0; i < win->findAllMatches->Count(); i++) {
+        RectI rect = win->findAllMatches->At(i).GetRect(win->dm);
+        if (!rect.IsEmpty())
+            rects.Append(rect);
+    }
+    // paint the other matches more lightly than the current one
+    PaintTransparentRectangles(hdc, win->canvasRc, rects, gGlobalPrefs->fixedPageUI.selectionColor, 0x30, 0);
+}
+
 class FindEndTask : public UITask {
     FindThreadData *ftd;
     TextSel*textSel;
@@ -276,6 +425,8 @@ public:
         } else if (textSel) {
             ShowSearchResult(*win, textSel, wasModifiedCanceled);
             ftd->HideUI(true, loopedAround);
+            if (gGlobalPrefs->highlightAllMatches)
+                StartFindAll(win, ftd->text);
         } else {
             // nothing found or search canceled
             ClearSearchResult(win);
@@ -285,12 +436,76 @@ public:
     }
 };
 
+// don't keep the text of more than that many documents cached on disk
+#define MAX_TEXT_INDEX_FILES 16
+
+// the text index is keyed by a fingerprint of the file (so that the
+// document doesn't have to be read entirely before every search)
+static WCHAR *GetTextIndexPath(BaseEngine *engine)
+{
+    if (!gGlobalPrefs->textIndexCache || !gGlobalPrefs->rememberOpenedFiles ||
+        !HasPermission(Perm_SavePreferences) || engine->IsPasswordProtected() ||
+        !engine->FileName()) {
+        return NULL;
+    }
+
+    unsigned char digest[16];
+    if (!CalcFileFingerprint(engine->FileName(), digest))
+        return NULL;
+    ScopedMem<char> fingerPrint(str::MemToHex(digest, 16));
+
+    ScopedMem<WCHAR> cachePath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+    if (!cachePath || !dir::Create(cachePath))
+        return NULL;
+    ScopedMem<WCHAR> fname(str::Format(L"%S.txtidx", fingerPrint));
+
+    return path::Join(cachePath, fname);
+}
+
+// removes the least recently written text indices
+static void CleanUpTextIndexCache()
+{
+    ScopedMem<WCHAR> cachePath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+    if (!cachePath)
+        return;
+    ScopedMem<WCHAR> pattern(path::Join(cachePath, L"*.txtidx"));
+
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind)
+        return;
+    Vec<WIN32_FIND_DATA> files;
+    do {
+        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            files.Append(fdata);
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    while (files.Count() > MAX_TEXT_INDEX_FILES) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < files.Count(); i++) {
+            if (CompareFileTime(&files.At(i).ftLastWriteTime, &files.At(oldest).ftLastWriteTime) < 0)
+                oldest = i;
+        }
+        ScopedMem<WCHAR> filePath(path::Join(cachePath, files.At(oldest).cFileName));
+        file::Delete(filePath);
+        files.RemoveAt(oldest);
+    }
+}
+
 static DWORD WINAPI FindThread(LPVOID data)
 {
     FindThreadData *ftd = (FindThreadData *)data;
     assert(ftd && ftd->win && ftd->win->dm);
     WindowInfo *win = ftd->win;
 
+    PageTextCache *textCache = win->dm->textCache;
+    if (!textCache->HasIndexFile()) {
+        ScopedMem<WCHAR> indexPath(GetTextIndexPath(win->dm->engine));
+        if (indexPath)
+            textCache->SetIndexFile(indexPath);
+    }
+
     TextSel *rect;
     win->dm->textSearch->SetDirection(ftd->direction);
     if (ftd->wasModified || !win->dm->ValidPageNo(win->dm->textSearch->GetCurrentPageNo()) ||
@@ -309,6 +524,9 @@ static DWORD WINAPI FindThread(LPVOID data)
         }
     }
 
+    if (textCache->HasIndexFile() && textCache->SaveIndex())
+        CleanUpTextIndexCache();
+
     // wait for FindTextOnThread to return so that
     // FindEndTask closes the correct handle to
     // the current find thread
@@ -384,7 +602,7 @@ bool OnInverseSearch(WindowInfo *win, int x, int y)
 
     // Clear the last forward-search result
     win->fwdSearchMark.rects.Reset();
-    InvalidateRect(win->hwndCanvas, NULL, FALSE);
+    win->RedrawAll();
 
     // On double-clicking error message will be shown to the user
     // if the PDF does not have a synchronization file
@@ -726,7 +944,20 @@ LRESULT OnDDExecute(HWND hwnd, WPARAM wparam, LPARAM lparam)
     else
         cmd.Set(str::conv::FromAnsi((const char*)command));
 
-    const WCHAR *currCmd = cmd;
+    ack.fAck = HandleDdeCmds(cmd) ? 1 : 0;
+
+Exit:
+    GlobalUnlock((HGLOBAL)hi);
+
+    lparam = ReuseDDElParam(lparam, WM_DDE_EXECUTE, WM_DDE_ACK, *(WORD *)&ack, hi);
+    PostMessage((HWND)wparam, WM_DDE_ACK, (WPARAM)hwnd, lparam);
+    return 0;
+}
+
+bool HandleDdeCmds(const WCHAR *cmds)
+{
+    DDEACK ack = { 0 };
+    const WCHAR *currCmd = cmds;
     while (!str::IsEmpty(currCmd)) {
         const WCHAR *nextCmd = NULL;
         if (!nextCmd) nextCmd = HandleSyncCmd(currCmd, ack);
@@ -740,13 +971,7 @@ LRESULT OnDDExecute(HWND hwnd, WPARAM wparam, LPARAM lparam)
         }
         currCmd = nextCmd;
     }
-
-Exit:
-    GlobalUnlock((HGLOBAL)hi);
-
-    lparam = ReuseDDElParam(lparam, WM_DDE_EXECUTE, WM_DDE_ACK, *(WORD *)&ack, hi);
-    PostMessage((HWND)wparam, WM_DDE_ACK, (WPARAM)hwnd, lparam);
-    return 0;
+    return ack.fAck != 0;
 }
 
 LRESULT OnDDETerminate(HWND hwnd, WPARAM wparam, LPARAM lparam)
@@ -755,3 +980,143 @@ LRESULT OnDDETerminate(HWND hwnd, WPARAM wparam, LPARAM lparam)
     PostMessage((HWND)wparam, WM_DDE_TERMINATE, (WPARAM)hwnd, 0L);
     return 0;
 }
+
+// command pipe handling
+
+// a message consists of a DWORD with flags followed by the commands
+#define COMMAND_PIPE_FORCE_REUSE    1
+#define COMMAND_PIPE_MAX_MSG_SIZE   (32 * 1024)
+// how long to wait if the pipe is busy with another new instance
+#define COMMAND_PIPE_TIMEOUT_MS     500
+
+#ifndef PIPE_REJECT_REMOTE_CLIENTS
+#define PIPE_REJECT_REMOTE_CLIENTS  0x00000008
+#endif
+
+// there's one pipe per session, so that commands only go to an instance
+// that's visible to the user
+static WCHAR *GetCommandPipeName()
+{
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    return str::Format(L"\\\\.\\pipe\\SumatraPDF-Commands-%u", sessionId);
+}
+
+class CommandPipeTask : public UITask {
+    ScopedMem<WCHAR> cmds;
+
+public:
+    explicit CommandPipeTask(WCHAR *cmds) : cmds(cmds) {
+        name = "CommandPipeTask";
+    }
+
+    virtual void Execute() {
+        HandleDdeCmds(cmds);
+    }
+};
+
+class CommandPipeServer : public ThreadBase {
+    HANDLE hPipe;
+
+public:
+    explicit CommandPipeServer(HANDLE hPipe) : ThreadBase("CommandPipeServer"), hPipe(hPipe) { }
+    virtual ~CommandPipeServer() { CloseHandle(hPipe); }
+
+    virtual void Run();
+    void Stop();
+};
+
+static CommandPipeServer *gCommandPipeServer = NULL;
+
+void CommandPipeServer::Run()
+{
+    ScopedMem<char> msg(AllocArray<char>(COMMAND_PIPE_MAX_MSG_SIZE));
+    while (!WasCancelRequested()) {
+        if (!ConnectNamedPipe(hPipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+            LogLastError();
+            return;
+        }
+        if (WasCancelRequested())
+            break;
+
+        // the commands are executed asynchronously, so that
+        // a hung UI thread doesn't block the new instance
+        DWORD accepted = 0, len = 0;
+        if (ReadFile(hPipe, msg, COMMAND_PIPE_MAX_MSG_SIZE, &len, NULL) &&
+            len > sizeof(DWORD) && 0 == (len - sizeof(DWORD)) % sizeof(WCHAR)) {
+            DWORD flags = *(DWORD *)msg.Get();
+            if ((flags & COMMAND_PIPE_FORCE_REUSE) || gGlobalPrefs->reuseInstance || gResidentMode) {
+                WCHAR *cmds = str::DupN((WCHAR *)(msg + sizeof(DWORD)), (len - sizeof(DWORD)) / sizeof(WCHAR));
+                uitask::Post(new CommandPipeTask(cmds));
+                accepted = 1;
+            }
+        }
+        DWORD written;
+        WriteFile(hPipe, &accepted, sizeof(accepted), &written, NULL);
+        FlushFileBuffers(hPipe);
+        DisconnectNamedPipe(hPipe);
+    }
+}
+
+void CommandPipeServer::Stop()
+{
+    RequestCancel();
+    // connecting to the pipe makes ConnectNamedPipe return
+    ScopedMem<WCHAR> pipeName(GetCommandPipeName());
+    HANDLE h = CreateFile(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+    Join();
+}
+
+// returns false if another instance is already listening for commands
+bool StartCommandPipeServer()
+{
+    if (gCommandPipeServer)
+        return true;
+
+    ScopedMem<WCHAR> pipeName(GetCommandPipeName());
+    DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE;
+    DWORD pipeMode = PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT;
+    HANDLE hPipe = CreateNamedPipe(pipeName, openMode, pipeMode | PIPE_REJECT_REMOTE_CLIENTS, 1,
+                                   sizeof(DWORD), COMMAND_PIPE_MAX_MSG_SIZE, 0, NULL);
+    // PIPE_REJECT_REMOTE_CLIENTS isn't supported before Windows Vista
+    if (INVALID_HANDLE_VALUE == hPipe && ERROR_INVALID_PARAMETER == GetLastError())
+        hPipe = CreateNamedPipe(pipeName, openMode, pipeMode, 1, sizeof(DWORD), COMMAND_PIPE_MAX_MSG_SIZE, 0, NULL);
+    if (INVALID_HANDLE_VALUE == hPipe)
+        return false;
+
+    gCommandPipeServer = new CommandPipeServer(hPipe);
+    gCommandPipeServer->Start();
+    return true;
+}
+
+void StopCommandPipeServer()
+{
+    if (!gCommandPipeServer)
+        return;
+    gCommandPipeServer->Stop();
+    delete gCommandPipeServer;
+    gCommandPipeServer = NULL;
+}
+
+bool SendCommandPipeMessage(const WCHAR *cmds, bool forceReuse)
+{
+    size_t cmdsLen = (str::Len(cmds) + 1) * sizeof(WCHAR);
+    if (sizeof(DWORD) + cmdsLen > COMMAND_PIPE_MAX_MSG_SIZE)
+        return false;
+
+    str::Str<char> msg;
+    DWORD flags = forceReuse ? COMMAND_PIPE_FORCE_REUSE : 0;
+    msg.Append((const char *)&flags, sizeof(flags));
+    msg.Append((const char *)cmds, cmdsLen);
+
+    // allow the running instance to bring its window to the foreground
+    AllowSetForegroundWindow(ASFW_ANY);
+
+    ScopedMem<WCHAR> pipeName(GetCommandPipeName());
+    DWORD accepted = 0, len = 0;
+    BOOL ok = CallNamedPipe(pipeName, msg.Get(), (DWORD)msg.Size(), &accepted, sizeof(accepted),
+                            &len, COMMAND_PIPE_TIMEOUT_MS);
+    return ok && sizeof(accepted) == len && 1 == accepted;
+}
@@ -43,6 +43,16 @@
 LRESULT OnDDEInitiate(HWND hwnd, WPARAM wparam, LPARAM lparam);
 LRESULT OnDDExecute(HWND hwnd, WPARAM wparam, LPARAM lparam);
 LRESULT OnDDETerminate(HWND hwnd, WPARAM wparam, LPARAM lparam);
+// executes one or more of the above commands, returns true if one succeeded
+bool HandleDdeCmds(const WCHAR *cmds);
+
+// the same commands can also be sent through a named pipe, which
+// is faster than DDE and doesn't block on a hung instance
+bool StartCommandPipeServer();
+void StopCommandPipeServer();
+// returns false if there's no running instance which accepted the commands
+// (without forceReuse, they're only accepted if gGlobalPrefs->reuseInstance is set)
+bool SendCommandPipeMessage(const WCHAR *cmds, bool forceReuse);
 
 #define HIDE_FWDSRCHMARK_TIMER_ID                4
 #define HIDE_FWDSRCHMARK_DELAY_IN_MS             400
@@ -56,6 +66,8 @@ void ClearSearchResult(WindowInfo *win);
 bool OnInverseSearch(WindowInfo *win, int x, int y);
 void ShowForwardSearchResult(WindowInfo *win, const WCHAR *fileName, UINT line, UINT col, UINT ret, UINT page, Vec<RectI> &rects);
 void PaintForwardSearchMark(WindowInfo *win, HDC hdc);
+void PaintFindAllMatches(WindowInfo *win, HDC hdc);
+void ClearFindAllMatches(WindowInfo *win);
 void OnMenuFindPrev(WindowInfo *win);
 void OnMenuFindNext(WindowInfo *win);
 void OnMenuFind(WindowInfo *win);
@@ -13,6 +13,10 @@
 #include "WindowInfo.h"
 #include "WinUtil.h"
 
+// text selections spanning at least this many pages are only
+// extracted once the clipboard's content is actually requested
+#define DELAYED_COPY_MIN_PAGES 10
+
 RectI SelectionOnPage::GetRect(DisplayModel *dm)
 {
     // if the page is not visible, we return an empty rectangle
@@ -223,8 +227,11 @@ void CopySelectionToClipboard(WindowInfo *win)
     CrashIf(!win->dm || !win->dm->engine);
     if (!win->dm || !win->dm->engine) return;
 
-    if (!OpenClipboard(NULL)) return;
+    if (!OpenClipboard(win->hwndFrame)) return;
     EmptyClipboard();
+    // EmptyClipboard should have sent WM_DESTROYCLIPBOARD for a previous delayed copy
+    delete win->delayedCopy;
+    win->delayedCopy = NULL;
 
 #ifndef DISABLE_DOCUMENT_RESTRICTIONS
     if (!win->dm->engine->AllowsCopyingText())
@@ -235,6 +242,18 @@ void CopySelectionToClipboard(WindowInfo *win)
         ScopedMem<WCHAR> selText;
         bool isTextSelection = win->dm->textSelection->result.len > 0;
         if (isTextSelection) {
+            TextSelection *textSel = win->dm->textSelection;
+            int fromPage, fromGlyph, toPage, toGlyph;
+            textSel->GetGlyphRange(&fromPage, &fromGlyph, &toPage, &toGlyph);
+            if (toPage - fromPage + 1 >= DELAYED_COPY_MIN_PAGES) {
+                // extracting the text of many pages takes a while and the
+                // text might never be pasted, so this is done in RenderDelayedCopy
+                win->delayedCopy = new TextSelection(win->dm->engine, win->dm->textCache);
+                win->delayedCopy->CopyGlyphRange(textSel);
+                SetClipboardData(CF_UNICODETEXT, NULL);
+                CloseClipboard();
+                return;
+            }
             selText.Set(win->dm->textSelection->ExtractText(L"\r\n"));
         }
         else {
@@ -270,6 +289,31 @@ void CopySelectionToClipboard(WindowInfo *win)
     CloseClipboard();
 }
 
+// called for WM_RENDERFORMAT (when the clipboard is already open)
+void RenderDelayedCopy(WindowInfo *win)
+{
+    if (!win->delayedCopy)
+        return;
+    ScopedMem<WCHAR> selText(win->delayedCopy->ExtractText(L"\r\n"));
+    if (selText)
+        CopyTextToClipboard(selText, true);
+}
+
+// renders a delayed copy while its text is still available
+// (i.e. before the document is closed or the window destroyed)
+void FlushDelayedCopy(WindowInfo *win)
+{
+    if (!win->delayedCopy)
+        return;
+    if (OpenClipboard(win->hwndFrame)) {
+        if (GetClipboardOwner() == win->hwndFrame)
+            RenderDelayedCopy(win);
+        CloseClipboard();
+    }
+    delete win->delayedCopy;
+    win->delayedCopy = NULL;
+}
+
 void OnSelectAll(WindowInfo *win, bool textOnly)
 {
     if (!HasPermission(Perm_CopySelection))
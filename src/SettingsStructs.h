@@ -219,6 +219,10 @@ struct GlobalPrefs {
     bool escToExit;
     // if true, we'll always open files using existing SumatraPDF process
     bool reuseInstance;
+    // if true, SumatraPDF keeps running in the notification area after
+    // its last window has been closed, so that further documents open
+    // faster (this implies ReuseInstance)
+    bool residentMode;
     // customization options for PDF, XPS, DjVu and PostScript UI
     FixedPageUI fixedPageUI;
     // customization options for eBooks (EPUB, Mobi, FictionBook) UI. If
@@ -254,6 +258,36 @@ struct GlobalPrefs {
     // if true, a document will be reloaded automatically whenever it's
     // changed (currently doesn't work for documents shown in the ebook UI)
     bool reloadModifiedDocuments;
+    // maximum amount of memory (in MB) used for caching rendered pages. if
+    // zero or negative, the limit is determined from the available memory
+    int bitmapCacheSize;
+    // maximum amount of memory (in MB) used per document for caching
+    // parsed page content. if zero or negative, a default of 40 MB is used
+    int displayListCacheSize;
+    // maximum amount of memory (in MB) used per document for caching
+    // rasterized glyphs (applies to documents opened afterwards). if zero
+    // or negative, a default of 8 MB is used
+    int glyphCacheSize;
+    // maximum amount of memory (in MB) used by all documents together for
+    // caching decoded images, fonts, etc. (the document used most recently
+    // gets the largest share). if zero or negative, a default of 512 MB is
+    // used
+    int resourceCacheSize;
+    // if true, large PDF and XPS documents on local drives are memory
+    // mapped instead of being read through the file system (note: other
+    // programs can't overwrite such documents while they're open)
+    bool memoryMapLargeFiles;
+    // if true, the text extracted for searching a document is cached on
+    // disk so that repeated searches don't have to extract it again (not
+    // for password protected documents)
+    bool textIndexCache;
+    // if true, documents are painted with Direct2D (if available) which
+    // makes scrolling and zooming on large displays less CPU intensive
+    bool useGpuCanvas;
+    // if true, all matches of the search text are highlighted (in addition
+    // to the current one) and their number is shown once they've all been
+    // found
+    bool highlightAllMatches;
     // default values for user added annotations in FixedPageUI documents
     // (preliminary and still subject to change)
     AnnotationDefaults annotationDefaults;
@@ -479,6 +513,7 @@ static const FieldInfo gGlobalPrefsFields[] = {
     { offsetof(GlobalPrefs, mainWindowBackground),     Type_Color,      0x8000f2ff                                                                                                            },
     { offsetof(GlobalPrefs, escToExit),                Type_Bool,       false                                                                                                                 },
     { offsetof(GlobalPrefs, reuseInstance),            Type_Bool,       false                                                                                                                 },
+    { offsetof(GlobalPrefs, residentMode),             Type_Bool,       false                                                                                                                 },
     { offsetof(GlobalPrefs, fixedPageUI),              Type_Struct,     (intptr_t)&gFixedPageUIInfo                                                                                           },
     { offsetof(GlobalPrefs, ebookUI),                  Type_Struct,     (intptr_t)&gEbookUIInfo                                                                                               },
     { offsetof(GlobalPrefs, comicBookUI),              Type_Struct,     (intptr_t)&gComicBookUIInfo                                                                                           },
@@ -491,6 +526,14 @@ static const FieldInfo gGlobalPrefsFields[] = {
     { offsetof(GlobalPrefs, forwardSearch),            Type_Struct,     (intptr_t)&gForwardSearchInfo                                                                                         },
     { offsetof(GlobalPrefs, defaultPasswords),         Type_String,     NULL                                                                                                                  },
     { offsetof(GlobalPrefs, reloadModifiedDocuments),  Type_Bool,       true                                                                                                                  },
+    { offsetof(GlobalPrefs, bitmapCacheSize),          Type_Int,        0                                                                                                                     },
+    { offsetof(GlobalPrefs, displayListCacheSize),     Type_Int,        0                                                                                                                     },
+    { offsetof(GlobalPrefs, glyphCacheSize),           Type_Int,        0                                                                                                                     },
+    { offsetof(GlobalPrefs, resourceCacheSize),        Type_Int,        0                                                                                                                     },
+    { offsetof(GlobalPrefs, memoryMapLargeFiles),      Type_Bool,       false                                                                                                                 },
+    { offsetof(GlobalPrefs, textIndexCache),           Type_Bool,       true                                                                                                                  },
+    { offsetof(GlobalPrefs, useGpuCanvas),             Type_Bool,       false                                                                                                                 },
+    { offsetof(GlobalPrefs, highlightAllMatches),      Type_Bool,       false                                                                                                                 },
     { offsetof(GlobalPrefs, annotationDefaults),       Type_Prerelease, (intptr_t)&gAnnotationDefaultsInfo                                                                                    },
     { (size_t)-1,                                      Type_Comment,    NULL                                                                                                                  },
     { offsetof(GlobalPrefs, rememberStatePerDocument), Type_Bool,       true                                                                                                                  },
@@ -518,7 +561,7 @@ static const FieldInfo gGlobalPrefsFields[] = {
     { offsetof(GlobalPrefs, timeOfLastUpdateCheck),    Type_Compact,    (intptr_t)&gFILETIMEInfo                                                                                              },
     { offsetof(GlobalPrefs, openCountWeek),            Type_Int,        0                                                                                                                     },
 };
-static const StructInfo gGlobalPrefsInfo = { sizeof(GlobalPrefs), 43, gGlobalPrefsFields, "\0\0MainWindowBackground\0EscToExit\0ReuseInstance\0FixedPageUI\0EbookUI\0ComicBookUI\0ChmUI\0ExternalViewers\0ShowMenubar\0ZoomLevels\0ZoomIncrement\0PrinterDefaults\0ForwardSearch\0DefaultPasswords\0ReloadModifiedDocuments\0AnnotationDefaults\0\0RememberStatePerDocument\0UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0VersionToSkip\0RememberOpenedFiles\0UseSysColors\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0WindowState\0WindowPos\0ShowToc\0SidebarDx\0TocDy\0ShowStartPage\0\0FileStates\0TimeOfLastUpdateCheck\0OpenCountWeek" };
+static const StructInfo gGlobalPrefsInfo = { sizeof(GlobalPrefs), 52, gGlobalPrefsFields, "\0\0MainWindowBackground\0EscToExit\0ReuseInstance\0ResidentMode\0FixedPageUI\0EbookUI\0ComicBookUI\0ChmUI\0ExternalViewers\0ShowMenubar\0ZoomLevels\0ZoomIncrement\0PrinterDefaults\0ForwardSearch\0DefaultPasswords\0ReloadModifiedDocuments\0BitmapCacheSize\0DisplayListCacheSize\0GlyphCacheSize\0ResourceCacheSize\0MemoryMapLargeFiles\0TextIndexCache\0UseGpuCanvas\0HighlightAllMatches\0AnnotationDefaults\0\0RememberStatePerDocument\0UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0VersionToSkip\0RememberOpenedFiles\0UseSysColors\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0WindowState\0WindowPos\0ShowToc\0SidebarDx\0TocDy\0ShowStartPage\0\0FileStates\0TimeOfLastUpdateCheck\0OpenCountWeek" };
 
 #endif
 
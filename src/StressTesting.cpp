@@ -3,6 +3,7 @@
 
 #include "BaseUtil.h"
 #include "StressTesting.h"
+#include <psapi.h>
 
 #include "AppPrefs.h"
 #include "AppTools.h"
@@ -10,12 +11,14 @@
 #include "Doc.h"
 #include "FileUtil.h"
 #include "HtmlWindow.h"
+#include "JsonParser.h"
 #include "Notifications.h"
 #include "ParseCommandLine.h"
 #include "RenderCache.h"
 #include "SimpleLog.h"
 #include "Search.h"
 #include "SumatraPDF.h"
+#include "ThreadUtil.h"
 #include "Timer.h"
 #include "WindowInfo.h"
 #include "WinUtil.h"
@@ -85,8 +88,47 @@ inline bool IsInRange(Vec<PageRange>& ranges, int pageNo)
     return false;
 }
 
-static void BenchLoadRender(BaseEngine *engine, int pagenum)
+// timings of a single page (negative for failures or if not measured)
+struct BenchPageResult {
+    int pageNo;
+    double loadMs, renderMs, textMs;
+};
+
+// results of benchmarking a single document (for -bench-output)
+struct BenchDocResult {
+    ScopedMem<char> filePath;
+    double loadMs, totalMs;
+    int pageCount;
+    Vec<BenchPageResult> pages;
+    int cacheHits, cacheMisses;
+    int glyphHits, glyphMisses;
+    size_t storeUsed, storeBudget;
+    size_t peakWorkingSet;
+    int gdiObjects;
+
+    BenchDocResult(const WCHAR *filePath) : filePath(str::conv::ToUtf8(filePath)),
+        loadMs(-1), totalMs(-1), pageCount(0), cacheHits(-1), cacheMisses(-1),
+        glyphHits(-1), glyphMisses(-1), storeUsed(0), storeBudget(0),
+        peakWorkingSet(0), gdiObjects(0) { }
+};
+
+typedef BOOL (WINAPI *GetProcessMemoryInfoProc)(HANDLE process, PPROCESS_MEMORY_COUNTERS counters, DWORD cb);
+
+// psapi.dll is loaded dynamically so that SumatraPDF doesn't have to link against it
+static size_t GetPeakWorkingSet()
+{
+    GetProcessMemoryInfoProc _GetProcessMemoryInfo = (GetProcessMemoryInfoProc)LoadDllFunc(L"psapi.dll", "GetProcessMemoryInfo");
+    PROCESS_MEMORY_COUNTERS pmc = { 0 };
+    if (!_GetProcessMemoryInfo || !_GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return pmc.PeakWorkingSetSize;
+}
+
+static void BenchLoadRender(BaseEngine *engine, int pagenum, BenchPageResult& result)
 {
+    result.pageNo = pagenum;
+    result.loadMs = result.renderMs = result.textMs = -1;
+
     Timer t(true);
     bool ok = engine->BenchLoadPage(pagenum);
     t.Stop();
@@ -97,6 +139,7 @@ static void BenchLoadRender(BaseEngine *engine, int pagenum)
     }
     double timems = t.GetTimeInMs();
     logbench("pageload   %3d: %.2f ms", pagenum, timems);
+    result.loadMs = timems;
 
     t.Start();
     RenderedBitmap *rendered = engine->RenderBitmap(pagenum, 1.0, 0);
@@ -109,6 +152,15 @@ static void BenchLoadRender(BaseEngine *engine, int pagenum)
     delete rendered;
     timems = t.GetTimeInMs();
     logbench("pagerender %3d: %.2f ms", pagenum, timems);
+    result.renderMs = timems;
+
+    t.Start();
+    ScopedMem<WCHAR> text(engine->ExtractPageText(pagenum, L"\n"));
+    t.Stop();
+
+    timems = t.GetTimeInMs();
+    logbench("pagetext   %3d: %.2f ms", pagenum, timems);
+    result.textMs = timems;
 }
 
 // <s> can be:
@@ -119,11 +171,13 @@ bool IsBenchPagesInfo(const WCHAR *s)
     return str::EqI(s, L"loadonly") || IsValidPageRange(s);
 }
 
-static void BenchFile(WCHAR *filePath, const WCHAR *pagesSpec)
+static void BenchFile(WCHAR *filePath, const WCHAR *pagesSpec, Vec<BenchDocResult *>& results)
 {
     if (!file::Exists(filePath)) {
         return;
     }
+    BenchDocResult *result = new BenchDocResult(filePath);
+    results.Append(result);
 
     Timer total(true);
     logbench("Starting: %s", filePath);
@@ -139,12 +193,14 @@ static void BenchFile(WCHAR *filePath, const WCHAR *pagesSpec)
 
     double timems = t.GetTimeInMs();
     logbench("load: %.2f ms", timems);
+    result->loadMs = timems;
     int pages = engine->PageCount();
     logbench("page count: %d", pages);
+    result->pageCount = pages;
 
     if (NULL == pagesSpec) {
         for (int i = 1; i <= pages; i++) {
-            BenchLoadRender(engine, i);
+            BenchLoadRender(engine, i, *result->pages.AppendBlanks(1));
         }
     }
 
@@ -154,42 +210,629 @@ static void BenchFile(WCHAR *filePath, const WCHAR *pagesSpec)
         for (size_t i = 0; i < ranges.Count(); i++) {
             for (int j = ranges.At(i).start; j <= ranges.At(i).end; j++) {
                 if (1 <= j && j <= pages)
-                    BenchLoadRender(engine, j);
+                    BenchLoadRender(engine, j, *result->pages.AppendBlanks(1));
             }
         }
     }
 
+    int hits, misses;
+    if (engine->BenchCacheStats(&hits, &misses)) {
+        logbench("page cache: %d hits, %d misses", hits, misses);
+        result->cacheHits = hits;
+        result->cacheMisses = misses;
+    }
+    if (engine->BenchGlyphCacheStats(&hits, &misses)) {
+        logbench("glyph cache: %d hits, %d misses", hits, misses);
+        result->glyphHits = hits;
+        result->glyphMisses = misses;
+    }
+    size_t used, budget;
+    if (engine->BenchResourceCacheStats(&used, &budget)) {
+        logbench("resource cache: %d KB used of %d KB", (int)(used / 1024), (int)(budget / 1024));
+        result->storeUsed = used;
+        result->storeBudget = budget;
+    }
+    result->gdiObjects = (int)GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS);
+
     delete engine;
     total.Stop();
 
     logbench("Finished (in %.2f ms): %s", total.GetTimeInMs(), filePath);
+    result->totalMs = total.GetTimeInMs();
+    // note: this is the peak for the process so far and not just for this document
+    result->peakWorkingSet = GetPeakWorkingSet();
 }
 
-static void BenchDir(WCHAR *dir)
+static void BenchDir(WCHAR *dir, Vec<BenchDocResult *>& results)
 {
     WStrVec files;
     ScopedMem<WCHAR> pattern(str::Format(L"%s\\*.pdf", dir));
     CollectPathsFromDirectory(pattern, files);
     for (size_t i = 0; i < files.Count(); i++) {
-        BenchFile(files.At(i), NULL);
+        BenchFile(files.At(i), NULL, results);
+    }
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double diff = *(const double *)a - *(const double *)b;
+    return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+// returns the p-th percentile (nearest rank) of the measured times
+// (i.e. ignoring negative values) or -1 if there are none
+static double GetPercentile(const Vec<BenchPageResult>& pages, int timeIdx, int p)
+{
+    Vec<double> times;
+    for (size_t i = 0; i < pages.Count(); i++) {
+        const BenchPageResult& page = pages.At(i);
+        double ms = 0 == timeIdx ? page.loadMs : 1 == timeIdx ? page.renderMs : page.textMs;
+        if (ms >= 0)
+            times.Append(ms);
     }
+    if (times.Count() == 0)
+        return -1;
+    times.Sort(cmpDouble);
+    size_t rank = (times.Count() * p + 99) / 100;
+    return times.At(max(rank, (size_t)1) - 1);
 }
 
-void BenchFileOrDir(WStrVec& pathsToBench)
+// names of the times passed to GetPercentile as timeIdx
+static const char *gBenchTimes[] = { "load_ms", "render_ms", "text_ms" };
+
+static const int gBenchPercentiles[] = { 50, 95, 99 };
+
+// failures (negative values) are reported as null (JSON) resp. empty (CSV)
+static void AppendBenchTime(str::Str<char>& out, double ms, const char *null)
+{
+    if (ms < 0)
+        out.Append(null);
+    else
+        out.AppendFmt("%.2f", ms);
+}
+
+static void AppendJsonString(str::Str<char>& out, const char *s)
+{
+    out.Append('"');
+    for (; *s; s++) {
+        if ('"' == *s || '\\' == *s)
+            out.AppendFmt("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            out.AppendFmt("\\u%04x", (unsigned char)*s);
+        else
+            out.Append(*s);
+    }
+    out.Append('"');
+}
+
+static void AppendCsvString(str::Str<char>& out, const char *s)
+{
+    out.Append('"');
+    for (; *s; s++) {
+        if ('"' == *s)
+            out.Append('"');
+        out.Append(*s);
+    }
+    out.Append('"');
+}
+
+static char *FormatBenchResultsAsJson(Vec<BenchDocResult *>& results)
+{
+    str::Str<char> out;
+    out.Append("{\n  \"documents\": [");
+    for (size_t i = 0; i < results.Count(); i++) {
+        BenchDocResult *doc = results.At(i);
+        out.Append(i > 0 ? ",\n    {" : "\n    {");
+        out.Append("\n      \"file\": ");
+        AppendJsonString(out, doc->filePath);
+        out.Append(",\n      \"load_ms\": ");
+        AppendBenchTime(out, doc->loadMs, "null");
+        out.Append(",\n      \"total_ms\": ");
+        AppendBenchTime(out, doc->totalMs, "null");
+        out.AppendFmt(",\n      \"page_count\": %d", doc->pageCount);
+        out.AppendFmt(",\n      \"peak_working_set_kb\": %d", (int)(doc->peakWorkingSet / 1024));
+        out.AppendFmt(",\n      \"gdi_objects\": %d", doc->gdiObjects);
+        if (doc->cacheHits >= 0)
+            out.AppendFmt(",\n      \"page_cache\": { \"hits\": %d, \"misses\": %d }", doc->cacheHits, doc->cacheMisses);
+        if (doc->glyphHits >= 0)
+            out.AppendFmt(",\n      \"glyph_cache\": { \"hits\": %d, \"misses\": %d }", doc->glyphHits, doc->glyphMisses);
+        if (doc->storeBudget > 0)
+            out.AppendFmt(",\n      \"store\": { \"used_kb\": %d, \"budget_kb\": %d }", (int)(doc->storeUsed / 1024), (int)(doc->storeBudget / 1024));
+        out.Append(",\n      \"summary\": {");
+        for (int j = 0; j < dimof(gBenchTimes); j++) {
+            out.AppendFmt("%s\n        \"%s\": {", j > 0 ? "," : "", gBenchTimes[j]);
+            for (int k = 0; k < dimof(gBenchPercentiles); k++) {
+                out.AppendFmt("%s \"p%d\": ", k > 0 ? "," : "", gBenchPercentiles[k]);
+                AppendBenchTime(out, GetPercentile(doc->pages, j, gBenchPercentiles[k]), "null");
+            }
+            out.Append(" }");
+        }
+        out.Append("\n      },\n      \"pages\": [");
+        for (size_t j = 0; j < doc->pages.Count(); j++) {
+            BenchPageResult& page = doc->pages.At(j);
+            out.AppendFmt("%s\n        { \"page\": %d, \"load_ms\": ", j > 0 ? "," : "", page.pageNo);
+            AppendBenchTime(out, page.loadMs, "null");
+            out.Append(", \"render_ms\": ");
+            AppendBenchTime(out, page.renderMs, "null");
+            out.Append(", \"text_ms\": ");
+            AppendBenchTime(out, page.textMs, "null");
+            out.Append(" }");
+        }
+        out.Append(doc->pages.Count() > 0 ? "\n      ]\n    }" : "]\n    }");
+    }
+    out.Append(results.Count() > 0 ? "\n  ]\n}\n" : "]\n}\n");
+    return out.StealData();
+}
+
+// one row per document and per page, followed by rows for the percentiles
+// (kind is either "document", "page" or the percentile such as "p95")
+static char *FormatBenchResultsAsCsv(Vec<BenchDocResult *>& results)
+{
+    str::Str<char> out;
+    out.Append("kind,file,page,load_ms,render_ms,text_ms,page_count,peak_working_set_kb,gdi_objects,store_used_kb,store_budget_kb\r\n");
+    for (size_t i = 0; i < results.Count(); i++) {
+        BenchDocResult *doc = results.At(i);
+        out.Append("document,");
+        AppendCsvString(out, doc->filePath);
+        out.Append(",,");
+        AppendBenchTime(out, doc->loadMs, "");
+        out.AppendFmt(",,,%d,%d,%d,%d,%d\r\n", doc->pageCount, (int)(doc->peakWorkingSet / 1024),
+                      doc->gdiObjects, (int)(doc->storeUsed / 1024), (int)(doc->storeBudget / 1024));
+        for (size_t j = 0; j < doc->pages.Count(); j++) {
+            BenchPageResult& page = doc->pages.At(j);
+            out.Append("page,");
+            AppendCsvString(out, doc->filePath);
+            out.AppendFmt(",%d,", page.pageNo);
+            AppendBenchTime(out, page.loadMs, "");
+            out.Append(",");
+            AppendBenchTime(out, page.renderMs, "");
+            out.Append(",");
+            AppendBenchTime(out, page.textMs, "");
+            out.Append(",,,,,\r\n");
+        }
+        for (int k = 0; k < dimof(gBenchPercentiles); k++) {
+            out.AppendFmt("p%d,", gBenchPercentiles[k]);
+            AppendCsvString(out, doc->filePath);
+            out.Append(",");
+            for (int j = 0; j < dimof(gBenchTimes); j++) {
+                out.Append(",");
+                AppendBenchTime(out, GetPercentile(doc->pages, j, gBenchPercentiles[k]), "");
+            }
+            out.Append(",,,,,\r\n");
+        }
+    }
+    return out.StealData();
+}
+
+void BenchFileOrDir(WStrVec& pathsToBench, const WCHAR *outputPath)
 {
     gLog = new slog::StderrLogger();
 
+    Vec<BenchDocResult *> results;
     size_t n = pathsToBench.Count() / 2;
     for (size_t i = 0; i < n; i++) {
         WCHAR *path = pathsToBench.At(2 * i);
         if (file::Exists(path))
-            BenchFile(path, pathsToBench.At(2 * i + 1));
+            BenchFile(path, pathsToBench.At(2 * i + 1), results);
         else if (dir::Exists(path))
-            BenchDir(path);
+            BenchDir(path, results);
         else
             logbench("Error: file or dir %s doesn't exist", path);
     }
 
+    if (outputPath) {
+        bool asCsv = str::EndsWithI(outputPath, L".csv");
+        ScopedMem<char> data(asCsv ? FormatBenchResultsAsCsv(results) : FormatBenchResultsAsJson(results));
+        if (!file::WriteAll(outputPath, data, str::Len(data)))
+            logbench("Error: failed to write %s", outputPath);
+    }
+    DeleteVecMembers(results);
+
+    delete gLog;
+}
+
+/* -bench-suite runs all documents listed in a manifest file (one path per
+   line, optionally followed by page ranges; lines starting with '#' are
+   ignored) through the same set of tests several times and reports the
+   minimum, median and maximum time per test, so that the results of two
+   builds can be compared with -bench-compare */
+
+// pages to test for documents without page ranges in the manifest
+#define BENCH_SUITE_DEFAULT_PAGES   L"1-5"
+// window width at which "fit width" zoom is tested
+#define BENCH_SUITE_FIT_WIDTH       1280
+// a term which usually isn't found (so that the entire document is searched)
+#define BENCH_SUITE_SEARCH_TERM     L"SumatraPDF-benchmark-search"
+// changes by more than this many percent are highlighted in comparisons
+#define BENCH_COMPARE_THRESHOLD     5
+
+struct BenchSuiteResult {
+    ScopedMem<char> filePath;
+    ScopedMem<char> test;
+    Vec<double> times;
+};
+
+static BenchSuiteResult *FindSuiteResult(Vec<BenchSuiteResult *>& results, const char *filePath, const char *test, bool create=false)
+{
+    for (size_t i = 0; i < results.Count(); i++) {
+        if (str::Eq(results.At(i)->filePath, filePath) && str::Eq(results.At(i)->test, test))
+            return results.At(i);
+    }
+    if (!create)
+        return NULL;
+    BenchSuiteResult *result = new BenchSuiteResult();
+    result->filePath.Set(str::Dup(filePath));
+    result->test.Set(str::Dup(test));
+    results.Append(result);
+    return result;
+}
+
+static void AddSuiteTime(Vec<BenchSuiteResult *>& results, const char *filePath, const char *test, Timer& t)
+{
+    FindSuiteResult(results, filePath, test, true)->times.Append(t.GetTimeInMs());
+}
+
+// opening a file without buffering makes Windows discard the cached
+// content of that file (unless it's still open elsewhere with buffering),
+// so that the next open measures reading it from disk
+static void EvictFromFileCache(const WCHAR *filePath)
+{
+    HANDLE h = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                          OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+    if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+}
+
+static void RunBenchSuiteTests(const WCHAR *filePath, Vec<PageRange>& ranges, Vec<BenchSuiteResult *>& results)
+{
+    ScopedMem<char> filePathUtf8(str::conv::ToUtf8(filePath));
+
+    EvictFromFileCache(filePath);
+    Timer t(true);
+    BaseEngine *engine = EngineManager::CreateEngine(filePath, gGlobalPrefs->chmUI.useFixedPageUI);
+    t.Stop();
+    if (!engine) {
+        logbench("Error: failed to load %s", filePath);
+        return;
+    }
+    AddSuiteTime(results, filePathUtf8, "open_cold", t);
+    delete engine;
+
+    t.Start();
+    engine = EngineManager::CreateEngine(filePath, gGlobalPrefs->chmUI.useFixedPageUI);
+    t.Stop();
+    if (!engine) {
+        logbench("Error: failed to load %s", filePath);
+        return;
+    }
+    AddSuiteTime(results, filePathUtf8, "open_warm", t);
+
+    Vec<int> pages;
+    for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
+        if (IsInRange(ranges, pageNo))
+            pages.Append(pageNo);
+    }
+
+    // zoom 0 stands for "fit width"
+    static const float zooms[] = { 0, 1.0f, 4.0f };
+    static const char *zoomNames[] = { "fit_width", "100", "400" };
+    static const int rotations[] = { 0, 90 };
+    for (int i = 0; i < dimof(zooms); i++) {
+        for (int j = 0; j < dimof(rotations); j++) {
+            t.Start();
+            for (size_t k = 0; k < pages.Count(); k++) {
+                int pageNo = pages.At(k);
+                float zoom = zooms[i];
+                if (0 == zoom) {
+                    RectD page = engine->Transform(engine->PageMediabox(pageNo), pageNo, 1.0f, rotations[j]);
+                    zoom = page.dx > 0 ? (float)(BENCH_SUITE_FIT_WIDTH / page.dx) : 1.0f;
+                }
+                RenderedBitmap *bmp = engine->RenderBitmap(pageNo, zoom, rotations[j]);
+                if (!bmp)
+                    logbench("Error: failed to render page %d of %s", pageNo, filePath);
+                delete bmp;
+            }
+            t.Stop();
+            ScopedMem<char> test(str::Format("render_%s_r%d", zoomNames[i], rotations[j]));
+            AddSuiteTime(results, filePathUtf8, test, t);
+        }
+    }
+
+    t.Start();
+    for (size_t k = 0; k < pages.Count(); k++) {
+        free(engine->ExtractPageText(pages.At(k), L"\n"));
+    }
+    t.Stop();
+    AddSuiteTime(results, filePathUtf8, "text", t);
+
+    {
+        PageTextCache textCache(engine);
+        TextSearch search(engine, &textCache);
+        t.Start();
+        search.FindFirst(1, BENCH_SUITE_SEARCH_TERM);
+        t.Stop();
+    }
+    AddSuiteTime(results, filePathUtf8, "search", t);
+
+    delete engine;
+}
+
+static double GetMedian(Vec<double>& times)
+{
+    times.Sort(cmpDouble);
+    size_t n = times.Count();
+    return n % 2 ? times.At(n / 2) : (times.At(n / 2 - 1) + times.At(n / 2)) / 2;
+}
+
+void RunBenchSuite(const WCHAR *manifestPath, int iterations, const WCHAR *outputPath)
+{
+    gLog = new slog::StderrLogger();
+
+    WStrVec filePaths;
+    WStrVec pageRanges;
+    ScopedMem<char> data(file::ReadAll(manifestPath, NULL));
+    if (!data)
+        logbench("Error: failed to read %s", manifestPath);
+    ScopedMem<WCHAR> manifest(data ? str::conv::FromUtf8(data) : NULL);
+    ScopedMem<WCHAR> manifestDir(path::GetDir(manifestPath));
+    WStrVec lines;
+    if (manifest)
+        lines.Split(manifest, L"\n", true);
+    for (size_t i = 0; i < lines.Count(); i++) {
+        WCHAR *line = lines.At(i);
+        str::TrimWS(line);
+        if (!*line || '#' == *line)
+            continue;
+        const WCHAR *ranges = BENCH_SUITE_DEFAULT_PAGES;
+        WCHAR *lastSpace = str::FindCharLast(line, ' ');
+        if (lastSpace && IsValidPageRange(lastSpace + 1)) {
+            *lastSpace = '\0';
+            ranges = lastSpace + 1;
+            str::TrimWS(line);
+        }
+        filePaths.Append(path::IsAbsolute(line) ? str::Dup(line) : path::Join(manifestDir, line));
+        pageRanges.Append(str::Dup(ranges));
+    }
+
+    Vec<BenchSuiteResult *> results;
+    for (int i = 1; i <= iterations; i++) {
+        for (size_t j = 0; j < filePaths.Count(); j++) {
+            logbench("Iteration %d of %d: %s", i, iterations, filePaths.At(j));
+            Vec<PageRange> ranges;
+            if (!file::Exists(filePaths.At(j)))
+                logbench("Error: file %s doesn't exist", filePaths.At(j));
+            else if (ParsePageRanges(pageRanges.At(j), ranges))
+                RunBenchSuiteTests(filePaths.At(j), ranges, results);
+        }
+    }
+
+    str::Str<char> out;
+    out.AppendFmt("{\n  \"iterations\": %d,\n  \"results\": [", iterations);
+    for (size_t i = 0; i < results.Count(); i++) {
+        BenchSuiteResult *result = results.At(i);
+        double median = GetMedian(result->times);
+        double min = result->times.At(0), max = result->times.Last();
+        logbench("%S: %S: %.2f ms (min %.2f ms, max %.2f ms)", result->filePath, result->test, median, min, max);
+        out.Append(i > 0 ? ",\n    { \"file\": " : "\n    { \"file\": ");
+        AppendJsonString(out, result->filePath);
+        out.AppendFmt(", \"test\": \"%s\", \"median_ms\": %.2f, \"min_ms\": %.2f, \"max_ms\": %.2f }",
+                      result->test, median, min, max);
+    }
+    out.Append(results.Count() > 0 ? "\n  ]\n}\n" : "]\n}\n");
+    if (outputPath && !file::WriteAll(outputPath, out.Get(), out.Size()))
+        logbench("Error: failed to write %s", outputPath);
+    DeleteVecMembers(results);
+
+    delete gLog;
+}
+
+// collects the median times from a -bench-suite results file
+class BenchSuiteReader : public json::ValueVisitor {
+public:
+    Vec<BenchSuiteResult *> results;
+
+    ~BenchSuiteReader() { DeleteVecMembers(results); }
+
+    virtual bool Visit(const char *path, const char *value, json::DataType type) {
+        if (!str::StartsWith(path, "/results["))
+            return true;
+        const char *key = str::FindCharLast(path, '/') + 1;
+        if (str::Eq(key, "file")) {
+            results.Append(new BenchSuiteResult());
+            results.Last()->filePath.Set(str::Dup(value));
+        }
+        else if (results.Count() == 0)
+            return true;
+        else if (str::Eq(key, "test"))
+            results.Last()->test.Set(str::Dup(value));
+        else if (str::Eq(key, "median_ms") && json::Type_Number == type)
+            results.Last()->times.Append(atof(value));
+        return true;
+    }
+};
+
+static bool ReadBenchSuiteResults(const WCHAR *filePath, BenchSuiteReader& reader)
+{
+    ScopedMem<char> data(file::ReadAll(filePath, NULL));
+    if (!data || !json::Parse(data, &reader)) {
+        logbench("Error: failed to parse %s", filePath);
+        return false;
+    }
+    return true;
+}
+
+void CompareBenchResults(const WCHAR *oldPath, const WCHAR *newPath)
+{
+    gLog = new slog::StderrLogger();
+
+    BenchSuiteReader oldResults, newResults;
+    if (ReadBenchSuiteResults(oldPath, oldResults) && ReadBenchSuiteResults(newPath, newResults)) {
+        logbench("median times of %s compared to %s:", newPath, oldPath);
+        for (size_t i = 0; i < newResults.results.Count(); i++) {
+            BenchSuiteResult *result = newResults.results.At(i);
+            BenchSuiteResult *old = FindSuiteResult(oldResults.results, result->filePath, result->test);
+            if (!result->test || result->times.Count() != 1)
+                continue;
+            double newMs = result->times.At(0);
+            if (!old || old->times.Count() != 1) {
+                logbench("%S: %S: %.2f ms (new)", result->filePath, result->test, newMs);
+                continue;
+            }
+            double oldMs = old->times.At(0);
+            double change = oldMs > 0 ? (newMs - oldMs) * 100 / oldMs : 0;
+            const WCHAR *note = change > BENCH_COMPARE_THRESHOLD ? L" (slower)" :
+                                change < -BENCH_COMPARE_THRESHOLD ? L" (faster)" : L"";
+            logbench("%S: %S: %.2f ms -> %.2f ms (%+.1f%%)%s", result->filePath, result->test, oldMs, newMs, change, note);
+        }
+    }
+
+    delete gLog;
+}
+
+/* -stress-concurrent renders, searches, extracts the text of and collects the
+   page elements of every document in a file or directory from several threads
+   at once (using both the same engine and, if supported, clones of it) for a
+   while and reports the throughput of each kind of operation as well as how
+   often threads had to wait for the engines' locks */
+
+enum ConcurrentStressOp {
+    Op_Render, Op_Search, Op_ExtractText, Op_GetElements, Op_Count
+};
+
+static const char *gConcurrentStressOpNames[] = { "render", "search", "text", "elements" };
+
+class ConcurrentStressTest {
+    class WorkerThread : public ThreadBase {
+        ConcurrentStressTest *test;
+        BaseEngine *engine;
+        ConcurrentStressOp op;
+    public:
+        WorkerThread(ConcurrentStressTest *test, BaseEngine *engine, ConcurrentStressOp op) :
+            ThreadBase("ConcurrentStressThread"), test(test), engine(engine), op(op) { }
+        virtual void Run() { test->RunOps(engine, op, this); }
+        bool ShouldStop() { return WasCancelRequested(); }
+    };
+    friend class WorkerThread;
+
+    const WCHAR *filePath;
+    LONG opCounts[Op_Count];
+
+    void RunOps(BaseEngine *engine, ConcurrentStressOp op, WorkerThread *thread) {
+        PageTextCache *textCache = Op_Search == op ? new PageTextCache(engine) : NULL;
+        int pageCount = engine->PageCount();
+        while (!thread->ShouldStop()) {
+            int pageNo = rand() % pageCount + 1;
+            switch (op) {
+            case Op_Render:
+                {
+                    static const float zooms[] = { 0.5f, 1.0f, 2.0f };
+                    static const int rotations[] = { 0, 90, 180, 270 };
+                    delete engine->RenderBitmap(pageNo, zooms[rand() % dimof(zooms)], rotations[rand() % dimof(rotations)]);
+                }
+                break;
+            case Op_Search:
+                {
+                    TextSearch search(engine, textCache);
+                    search.FindFirst(pageNo, L"the");
+                }
+                break;
+            case Op_ExtractText:
+                free(engine->ExtractPageText(pageNo, L"\n"));
+                break;
+            case Op_GetElements:
+                {
+                    Vec<PageElement *> *els = engine->GetElements(pageNo);
+                    if (els)
+                        DeleteVecMembers(*els);
+                    delete els;
+                }
+                break;
+            }
+            InterlockedIncrement(&opCounts[op]);
+        }
+        delete textCache;
+    }
+
+public:
+    ConcurrentStressTest(const WCHAR *filePath) : filePath(filePath) {
+        ZeroMemory(opCounts, sizeof(opCounts));
+    }
+
+    void Run(int seconds) {
+        logbench("Starting: %s", filePath);
+        BaseEngine *engine = EngineManager::CreateEngine(filePath, gGlobalPrefs->chmUI.useFixedPageUI);
+        if (!engine || engine->PageCount() <= 0) {
+            logbench("Error: failed to load %s", filePath);
+            delete engine;
+            return;
+        }
+        BaseEngine *clone = engine->SupportsConcurrentRendering() ? engine->Clone() : NULL;
+        int ctxWaits = 0, pagesWaits = 0;
+        bool hasLockStats = engine->BenchLockContention(&ctxWaits, &pagesWaits);
+
+        // one worker per operation on the shared engine and another one on the clone
+        Vec<WorkerThread *> threads;
+        for (int op = 0; op < Op_Count; op++) {
+            threads.Append(new WorkerThread(this, engine, (ConcurrentStressOp)op));
+            if (clone)
+                threads.Append(new WorkerThread(this, clone, (ConcurrentStressOp)op));
+        }
+        Timer t(true);
+        for (size_t i = 0; i < threads.Count(); i++) {
+            threads.At(i)->Start();
+        }
+        Sleep(seconds * 1000);
+        for (size_t i = 0; i < threads.Count(); i++) {
+            threads.At(i)->RequestCancel();
+        }
+        for (size_t i = 0; i < threads.Count(); i++) {
+            threads.At(i)->Join();
+            delete threads.At(i);
+        }
+        t.Stop();
+
+        double secs = t.GetTimeInMs() / 1000;
+        for (int op = 0; op < Op_Count; op++) {
+            logbench("%S: %d operations (%.1f/s)", gConcurrentStressOpNames[op], (int)opCounts[op], opCounts[op] / secs);
+        }
+        int ctxWaitsAfter, pagesWaitsAfter;
+        if (hasLockStats && engine->BenchLockContention(&ctxWaitsAfter, &pagesWaitsAfter))
+            logbench("lock waits: %d for ctxAccess, %d for pagesAccess", ctxWaitsAfter - ctxWaits, pagesWaitsAfter - pagesWaits);
+        else
+            logbench("lock waits: not available");
+
+        delete clone;
+        delete engine;
+        logbench("Finished (in %.2f ms): %s", t.GetTimeInMs(), filePath);
+    }
+};
+
+void RunConcurrentStressTest(const WCHAR *path, int seconds)
+{
+    gLog = new slog::StderrLogger();
+
+    WStrVec filePaths;
+    if (dir::Exists(path)) {
+        WStrVec allFiles;
+        ScopedMem<WCHAR> pattern(path::Join(path, L"*"));
+        CollectPathsFromDirectory(pattern, allFiles);
+        for (size_t i = 0; i < allFiles.Count(); i++) {
+            if (EngineManager::IsSupportedFile(allFiles.At(i)))
+                filePaths.Append(str::Dup(allFiles.At(i)));
+        }
+    }
+    else if (file::Exists(path)) {
+        filePaths.Append(str::Dup(path));
+    }
+    else {
+        logbench("Error: file or dir %s doesn't exist", path);
+    }
+
+    for (size_t i = 0; i < filePaths.Count(); i++) {
+        ConcurrentStressTest test(filePaths.At(i));
+        test.Run(seconds);
+    }
+
     delete gLog;
 }
 
@@ -398,26 +1041,70 @@ void DirFileProvider::Restart()
     OpenDir(startDir);
 }
 
+class StressTestDirIter : public ParallelDirIter {
+    const WCHAR *filter;
+public:
+    StressTestDirIter(const WCHAR *filter) : filter(filter) { }
+    // sniffing files is also done by the scanning threads
+    virtual bool IsMatch(const WCHAR *dir, const WCHAR *fileName) {
+        return IsStressTestSupportedFile(fileName, filter, dir);
+    }
+};
+
 static size_t GetAllMatchingFiles(const WCHAR *dir, const WCHAR *filter, WStrVec& files, bool showProgress)
 {
-    WStrVec dirsToVisit;
-    dirsToVisit.Append(str::Dup(dir));
-
-    while (dirsToVisit.Count() > 0) {
-        if (showProgress) {
+    // directories are listed in parallel (which matters for large
+    // corpora on network shares and for filters which require sniffing)
+    StressTestDirIter iter(filter);
+    iter.Start(dir, true);
+    for (WCHAR *path = iter.Next(); path; path = iter.Next()) {
+        files.Append(path);
+        if (showProgress && 0 == files.Count() % 1000) {
             wprintf(L".");
             fflush(stdout);
         }
-
-        ScopedMem<WCHAR> path(dirsToVisit[0]);
-        dirsToVisit.RemoveAt(0);
-        CollectStressTestSupportedFilesFromDirectory(path, filter, files);
-        ScopedMem<WCHAR> pattern(str::Format(L"%s\\*", path));
-        CollectPathsFromDirectory(pattern, dirsToVisit, true);
     }
+    // the order in which files are found differs between runs
+    files.SortNatural();
     return files.Count();
 }
 
+// resource usage is sampled after each file to detect slow growth (i.e. leaks
+// or caches which are never trimmed) which only shows during longer runs
+#define MEM_TREND_FILES     16
+#define MEM_TOP_GROWERS     5
+
+enum MemMetric { Mem_PrivateBytes, Mem_DocumentMemory, Mem_GdiObjects, Mem_UserObjects, Mem_MetricCount };
+
+static const WCHAR *gMemMetricNames[Mem_MetricCount] = {
+    L"private bytes (kB)", L"document memory (kB)", L"GDI objects", L"USER objects"
+};
+
+struct MemSample {
+    size_t values[Mem_MetricCount];
+};
+
+struct MemGrower {
+    WCHAR *filePath;
+    // increase of private bytes between loading the file and the next one
+    size_t growth;
+};
+
+// note: values for all windows of a parallel stress test are process-wide
+// except for the document memory (cf. GetDocumentMemoryUsage)
+static void SampleMemory(DisplayModel *dm, MemSample& sample)
+{
+    ZeroMemory(&sample, sizeof(sample));
+    GetProcessMemoryInfoProc _GetProcessMemoryInfo = (GetProcessMemoryInfoProc)LoadDllFunc(L"psapi.dll", "GetProcessMemoryInfo");
+    PROCESS_MEMORY_COUNTERS_EX pmc = { 0 };
+    if (_GetProcessMemoryInfo && _GetProcessMemoryInfo(GetCurrentProcess(), (PPROCESS_MEMORY_COUNTERS)&pmc, sizeof(pmc)))
+        sample.values[Mem_PrivateBytes] = pmc.PrivateUsage / 1024;
+    if (dm)
+        sample.values[Mem_DocumentMemory] = GetDocumentMemoryUsage(dm) / 1024;
+    sample.values[Mem_GdiObjects] = GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS);
+    sample.values[Mem_UserObjects] = GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS);
+}
+
 /* The idea of StressTest is to render a lot of PDFs sequentially, simulating
 a human advancing one page at a time. This is mostly to run through a large number
 of PDFs before a release to make sure we're crash proof. */
@@ -442,7 +1129,18 @@ class StressTest {
     // owned by StressTest
     TestFileProvider *fileProvider;
 
+    // the file that's been loaded last (until its resource usage has been sampled)
+    ScopedMem<WCHAR>  currFilePath;
+    MemSample         firstMemSample;
+    // the samples taken after each of the last MEM_TREND_FILES files
+    Vec<MemSample>    memSamples;
+    int               memSampleCount;
+    // sorted by growth (largest first)
+    Vec<MemGrower>    memGrowers;
+
     bool OpenFile(const WCHAR *fileName);
+    void SampleResourceUsage();
+    void PrintResourceUsage();
 
     bool GoToNextPage();
     bool GoToNextFile();
@@ -454,12 +1152,15 @@ public:
     StressTest(WindowInfo *win, RenderCache *renderCache, bool exitWhenDone) :
         win(win), renderCache(renderCache), currPage(0), pageForSearchStart(0),
         filesCount(0), cycles(1), fileIndex(0), fileProvider(NULL),
-        exitWhenDone(exitWhenDone)
+        memSampleCount(0), exitWhenDone(exitWhenDone)
     {
         timerId = gCurrStressTimerId++;
     }
     ~StressTest() {
         delete fileProvider;
+        for (size_t i = 0; i < memGrowers.Count(); i++) {
+            free(memGrowers.At(i).filePath);
+        }
     }
 
     void Start(const WCHAR *path, const WCHAR *filter, const WCHAR *ranges, int cycles);
@@ -481,6 +1182,9 @@ void StressTest::Start(TestFileProvider *fileProvider, int cycles)
     if (fileRanges.Count() == 0)
         fileRanges.Append(PageRange());
 
+    SampleMemory(NULL, firstMemSample);
+    memSamples.Append(firstMemSample);
+
     TickTimer();
 }
 
@@ -508,6 +1212,8 @@ void StressTest::Finished(bool success)
 {
     win->stressTest = NULL; // make sure we're not double-deleted
 
+    SampleResourceUsage();
+    PrintResourceUsage();
     if (success) {
         int secs = SecsSinceSystemTime(stressStartTime);
         ScopedMem<WCHAR> tm(FormatTime(secs));
@@ -521,6 +1227,7 @@ void StressTest::Finished(bool success)
 
 bool StressTest::GoToNextFile()
 {
+    SampleResourceUsage();
     for (;;) {
         ScopedMem<WCHAR> nextFile(fileProvider->NextFile());
         if (nextFile) {
@@ -587,6 +1294,7 @@ bool StressTest::OpenFile(const WCHAR *fileName)
     win->dm->GoToPage(currPage, 0);
     currPageRenderTime.Start();
     ++filesCount;
+    currFilePath.Set(str::Dup(fileName));
 
     pageForSearchStart = (rand() % win->dm->PageCount()) + 1;
     // search immediately in single page documents
@@ -697,6 +1405,68 @@ Next:
     TickTimer();
 }
 
+// samples the resource usage after a file has been tested (while it's still
+// loaded) and warns if any value has grown after each of the last few files
+void StressTest::SampleResourceUsage()
+{
+    if (!currFilePath)
+        return;
+
+    MemSample sample;
+    SampleMemory(win->dm, sample);
+    size_t prevPrivateBytes = memSamples.Last().values[Mem_PrivateBytes];
+    if (sample.values[Mem_PrivateBytes] > prevPrivateBytes) {
+        size_t growth = sample.values[Mem_PrivateBytes] - prevPrivateBytes;
+        size_t idx = 0;
+        while (idx < memGrowers.Count() && memGrowers.At(idx).growth >= growth) {
+            idx++;
+        }
+        if (idx < MEM_TOP_GROWERS) {
+            MemGrower grower = { currFilePath.StealData(), growth };
+            memGrowers.InsertAt(idx, grower);
+            if (memGrowers.Count() > MEM_TOP_GROWERS)
+                free(memGrowers.Pop().filePath);
+        }
+    }
+    currFilePath.Set(NULL);
+
+    memSamples.Append(sample);
+    if (memSamples.Count() > MEM_TREND_FILES + 1)
+        memSamples.RemoveAt(0);
+    if (++memSampleCount % MEM_TREND_FILES != 0)
+        return;
+
+    for (int i = 0; i < Mem_MetricCount; i++) {
+        bool increasing = true;
+        for (size_t j = 1; j < memSamples.Count() && increasing; j++) {
+            increasing = memSamples.At(j).values[i] > memSamples.At(j - 1).values[i];
+        }
+        if (increasing) {
+            wprintf(L"Warning: %s grew after each of the last %d files (from %d to %d)\n",
+                    gMemMetricNames[i], MEM_TREND_FILES, (int)memSamples.At(0).values[i], (int)sample.values[i]);
+        }
+    }
+    fflush(stdout);
+}
+
+void StressTest::PrintResourceUsage()
+{
+    // nothing has been sampled if the stress test failed to start
+    if (memSamples.Count() == 0)
+        return;
+    const MemSample& last = memSamples.Last();
+    wprintf(L"Resource usage after %d files:\n", filesCount);
+    for (int i = 0; i < Mem_MetricCount; i++) {
+        wprintf(L"  %s: %d (at start: %d)\n", gMemMetricNames[i], (int)last.values[i], (int)firstMemSample.values[i]);
+    }
+    if (memGrowers.Count() > 0)
+        wprintf(L"Files with the largest growth of private bytes:\n");
+    for (size_t i = 0; i < memGrowers.Count(); i++) {
+        wprintf(L"  %d kB: %s\n", (int)memGrowers.At(i).growth, memGrowers.At(i).filePath);
+    }
+    fflush(stdout);
+}
+
 // note: used from CrashHandler, shouldn't allocate memory
 void StressTest::GetLogInfo(str::Str<char> *s)
 {
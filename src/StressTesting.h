@@ -6,7 +6,10 @@
 
 bool IsValidPageRange(const WCHAR *ranges);
 bool IsBenchPagesInfo(const WCHAR *s);
-void BenchFileOrDir(WStrVec& pathsToBench);
+void BenchFileOrDir(WStrVec& pathsToBench, const WCHAR *outputPath=NULL);
+void RunBenchSuite(const WCHAR *manifestPath, int iterations, const WCHAR *outputPath=NULL);
+void CompareBenchResults(const WCHAR *oldPath, const WCHAR *newPath);
+void RunConcurrentStressTest(const WCHAR *path, int seconds);
 bool IsStressTesting();
 
 class WindowInfo;
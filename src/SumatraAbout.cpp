@@ -6,6 +6,9 @@
 
 #include "AppPrefs.h"
 #include "AppTools.h"
+#include "ChmEngine.h"
+#include "Dict.h"
+#include "Doc.h"
 #include "FileHistory.h"
 #include "FileUtil.h"
 using namespace Gdiplus;
@@ -13,7 +16,9 @@ using namespace Gdiplus;
 #include "PdfEngine.h"
 #include "resource.h"
 #include "SumatraPDF.h"
+#include "ThreadUtil.h"
 #include "Translations.h"
+#include "UITask.h"
 #include "Version.h"
 #include "WindowInfo.h"
 #include "WinUtil.h"
@@ -555,7 +560,7 @@ void DrawAboutPage(WindowInfo& win, HDC hdc)
 #define DOCLIST_MAX_THUMBNAILS_X    5
 #define DOCLIST_BOTTOM_BOX_DY      50
 
-static bool LoadThumbnail(DisplayState& state);
+static void LoadThumbnailsAsync(Vec<DisplayState *>& list);
 
 void DrawStartPage(WindowInfo& win, HDC hdc, FileHistory& fileHistory, COLORREF textColor, COLORREF backgroundColor)
 {
@@ -620,6 +625,7 @@ void DrawStartPage(WindowInfo& win, HDC hdc, FileHistory& fileHistory, COLORREF
     SelectObject(hdc, fontLeftTxt);
     SelectObject(hdc, GetStockBrush(NULL_BRUSH));
 
+    Vec<DisplayState *> missingThumbnails;
     win.staticLinks.Reset();
     for (int h = 0; h < height; h++) {
         for (int w = 0; w < width; w++) {
@@ -635,10 +641,11 @@ void DrawStartPage(WindowInfo& win, HDC hdc, FileHistory& fileHistory, COLORREF
                        THUMBNAIL_DX, THUMBNAIL_DY);
             if (isRtl)
                 page.x = rc.dx - page.x - page.dx;
-            bool loadOk = true;
+            // only paint a placeholder for missing thumbnails
+            // until they've been loaded from disk or rendered
             if (!state->thumbnail)
-                loadOk = LoadThumbnail(*state);
-            if (loadOk && state->thumbnail) {
+                missingThumbnails.Append(state);
+            else {
                 SizeI thumbSize = state->thumbnail->Size();
                 if (thumbSize.dx != THUMBNAIL_DX || thumbSize.dy != THUMBNAIL_DY) {
                     page.dy = thumbSize.dy * THUMBNAIL_DX / thumbSize.dx;
@@ -671,6 +678,7 @@ void DrawStartPage(WindowInfo& win, HDC hdc, FileHistory& fileHistory, COLORREF
             win.staticLinks.Append(StaticLinkInfo(rect.Union(page), state->filePath, state->filePath));
         }
     }
+    LoadThumbnailsAsync(missingThumbnails);
 
     /* render bottom links */
     rc.y += DOCLIST_MARGIN_TOP + height * THUMBNAIL_DY + (height - 1) * DOCLIST_MARGIN_BETWEEN_Y + DOCLIST_MARGIN_BOTTOM;
@@ -710,23 +718,31 @@ void DrawStartPage(WindowInfo& win, HDC hdc, FileHistory& fileHistory, COLORREF
     DeleteObject(penLinkLine);
 }
 
-// TODO: create in TEMP directory instead?
-static WCHAR *GetThumbnailPath(const WCHAR *filePath)
+// creates a fingerprint of a (normalized) path for identifying its thumbnail
+static bool GetThumbnailDigest(const WCHAR *filePath, unsigned char digest[16])
 {
-    // create a fingerprint of a (normalized) path for the file name
     // I'd have liked to also include the file's last modification time
     // in the fingerprint (much quicker than hashing the entire file's
     // content), but that's too expensive for files on slow drives
-    unsigned char digest[16];
     // TODO: why is this happening? Seen in crash reports e.g. 35043
     if (!filePath)
-        return NULL;
+        return false;
     ScopedMem<char> pathU(str::conv::ToUtf8(filePath));
     if (!pathU)
-        return NULL;
+        return false;
     if (path::HasVariableDriveLetter(filePath))
         pathU[0] = '?'; // ignore the drive letter, if it might change
     CalcMD5Digest((unsigned char *)pathU.Get(), str::Len(pathU), digest);
+    return true;
+}
+
+// path of a thumbnail as saved by previous versions (before ThumbnailStore)
+// TODO: create in TEMP directory instead?
+static WCHAR *GetThumbnailPath(const WCHAR *filePath)
+{
+    unsigned char digest[16];
+    if (!GetThumbnailDigest(filePath, digest))
+        return NULL;
     ScopedMem<char> fingerPrint(str::MemToHex(digest, 16));
 
     ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
@@ -737,53 +753,347 @@ static WCHAR *GetThumbnailPath(const WCHAR *filePath)
     return str::Format(L"%s\\%s.png", thumbsPath, fname);
 }
 
-// removes thumbnails that don't belong to any frequently used item in file history
-void CleanUpThumbnailCache(FileHistory& fileHistory)
+/* All thumbnails are kept in a single file, so that only one file has to be
+   read for displaying the start page. The file starts with a header which is
+   followed by records (each followed by pngLen bytes of PNG data). New records
+   are only ever appended (a record with pngLen 0 removes a thumbnail) and the
+   most recent record for a path counts. CleanUpThumbnailCache compacts the
+   file again. */
+
+#define THUMBNAIL_STORE_NAME    L"thumbnails.dat"
+#define THUMBNAIL_STORE_MAGIC   'SThm'
+#define THUMBNAIL_STORE_VERSION 1
+// name of the mutex serializing modifications of the file across instances
+#define THUMBNAIL_STORE_MUTEX   L"SumatraPDF-ThumbnailStore"
+
+struct ThumbnailStoreHeader {
+    uint32      magic;
+    uint32      version;
+};
+
+struct ThumbnailRecord {
+    // cf. GetThumbnailDigest
+    unsigned char digest[16];
+    // when the thumbnail was saved (for comparison with the document's modification time)
+    FILETIME    saved;
+    uint32      pngLen;
+};
+
+class ThumbnailStore {
+    struct Entry {
+        unsigned char digest[16];
+        FILETIME    saved;
+        // offset of the PNG data into the file
+        size_t      offset;
+        uint32      pngLen;
+    };
+
+    // the file is mapped into memory for reading
+    HANDLE      hFile;
+    HANDLE      hMap;
+    const char *data;
+    size_t      dataLen;
+    Vec<Entry>  entries;
+    // maps the hex digests of entries to their index
+    dict::MapStrToInt *entryIdx;
+    // note: the thumbnails are also read from a ThumbnailLoader thread
+    CRITICAL_SECTION access;
+
+    class ScopedStoreLock {
+        HANDLE hMutex;
+
+    public:
+        ScopedStoreLock() {
+            hMutex = CreateMutex(NULL, FALSE, THUMBNAIL_STORE_MUTEX);
+            // an abandoned mutex has still been acquired
+            if (hMutex && WAIT_FAILED == WaitForSingleObject(hMutex, INFINITE)) {
+                CloseHandle(hMutex);
+                hMutex = NULL;
+            }
+        }
+        ~ScopedStoreLock() {
+            if (hMutex) {
+                ReleaseMutex(hMutex);
+                CloseHandle(hMutex);
+            }
+        }
+        bool IsLocked() const { return hMutex != NULL; }
+    };
+
+    WCHAR *GetStorePath() {
+        ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+        return thumbsPath ? path::Join(thumbsPath, THUMBNAIL_STORE_NAME) : NULL;
+    }
+
+    void Close() {
+        if (data)
+            UnmapViewOfFile(data);
+        if (hMap)
+            CloseHandle(hMap);
+        if (hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+        hMap = NULL;
+        data = NULL;
+        dataLen = 0;
+        entries.Reset();
+        delete entryIdx;
+        entryIdx = NULL;
+    }
+
+    // (re)maps the file if it's been appended to since (possibly by another instance)
+    void Update();
+    Entry *Find(const WCHAR *filePath);
+
+public:
+    ThumbnailStore() : hFile(INVALID_HANDLE_VALUE), hMap(NULL), data(NULL), dataLen(0), entryIdx(NULL) {
+        InitializeCriticalSection(&access);
+    }
+    ~ThumbnailStore() {
+        Close();
+        DeleteCriticalSection(&access);
+    }
+
+    // returns the PNG data of a thumbnail (or NULL if there's none)
+    char *Read(const WCHAR *filePath, size_t *lenOut, FILETIME *savedOut);
+    bool GetSaveTime(const WCHAR *filePath, FILETIME *savedOut);
+    bool Write(const WCHAR *filePath, const char *png, size_t len);
+    bool Remove(const WCHAR *filePath) { return Write(filePath, NULL, 0); }
+    // rewrites the file with only the thumbnails of the given paths
+    void Compact(WStrVec& filePaths);
+};
+
+void ThumbnailStore::Update()
 {
-    ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
-    if (!thumbsPath)
+    if (hFile != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(hFile, &size) && (uint64)size.QuadPart == dataLen)
+            return;
+    }
+    Close();
+
+    ScopedMem<WCHAR> storePath(GetStorePath());
+    if (!storePath)
         return;
-    ScopedMem<WCHAR> pattern(path::Join(thumbsPath, L"*.png"));
+    hFile = CreateFile(storePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+        return;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size) || (uint64)size.QuadPart < sizeof(ThumbnailStoreHeader) ||
+        (uint64)size.QuadPart > SIZE_MAX)
+        return;
+    hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap)
+        data = (const char *)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+        return;
+    dataLen = (size_t)size.QuadPart;
 
-    WStrVec files;
-    WIN32_FIND_DATA fdata;
+    ThumbnailStoreHeader *hdr = (ThumbnailStoreHeader *)data;
+    if (hdr->magic != THUMBNAIL_STORE_MAGIC || hdr->version != THUMBNAIL_STORE_VERSION)
+        return;
+    entryIdx = new dict::MapStrToInt();
+    // the last record might not have been completely written before a crash
+    size_t offset = sizeof(ThumbnailStoreHeader);
+    while (offset + sizeof(ThumbnailRecord) <= dataLen) {
+        ThumbnailRecord rec;
+        memcpy(&rec, data + offset, sizeof(rec));
+        offset += sizeof(rec);
+        if (rec.pngLen > dataLen - offset)
+            break;
+        ScopedMem<char> key(str::MemToHex(rec.digest, sizeof(rec.digest)));
+        int idx;
+        Entry *entry;
+        if (entryIdx->Get(key, &idx)) {
+            entry = &entries.At(idx);
+        } else {
+            entryIdx->Insert(key, (int)entries.Count());
+            entry = entries.AppendBlanks(1);
+        }
+        memcpy(entry->digest, rec.digest, sizeof(rec.digest));
+        entry->saved = rec.saved;
+        entry->offset = offset;
+        entry->pngLen = rec.pngLen;
+        offset += rec.pngLen;
+    }
+}
 
-    HANDLE hfind = FindFirstFile(pattern, &fdata);
-    if (INVALID_HANDLE_VALUE == hfind)
+ThumbnailStore::Entry *ThumbnailStore::Find(const WCHAR *filePath)
+{
+    unsigned char digest[16];
+    if (!GetThumbnailDigest(filePath, digest))
+        return NULL;
+    Update();
+    if (!entryIdx)
+        return NULL;
+    ScopedMem<char> key(str::MemToHex(digest, sizeof(digest)));
+    int idx;
+    if (!entryIdx->Get(key, &idx))
+        return NULL;
+    return entries.At(idx).pngLen > 0 ? &entries.At(idx) : NULL;
+}
+
+char *ThumbnailStore::Read(const WCHAR *filePath, size_t *lenOut, FILETIME *savedOut)
+{
+    ScopedCritSec scope(&access);
+    Entry *entry = Find(filePath);
+    if (!entry)
+        return NULL;
+    char *png = (char *)memdup(data + entry->offset, entry->pngLen);
+    if (!png)
+        return NULL;
+    *lenOut = entry->pngLen;
+    *savedOut = entry->saved;
+    return png;
+}
+
+bool ThumbnailStore::GetSaveTime(const WCHAR *filePath, FILETIME *savedOut)
+{
+    ScopedCritSec scope(&access);
+    Entry *entry = Find(filePath);
+    if (entry)
+        *savedOut = entry->saved;
+    return entry != NULL;
+}
+
+bool ThumbnailStore::Write(const WCHAR *filePath, const char *png, size_t len)
+{
+    ThumbnailRecord rec;
+    if (!GetThumbnailDigest(filePath, rec.digest) || len > UINT32_MAX)
+        return false;
+    GetSystemTimeAsFileTime(&rec.saved);
+    rec.pngLen = (uint32)len;
+
+    ScopedMem<WCHAR> storePath(GetStorePath());
+    if (!storePath)
+        return false;
+    ScopedMem<WCHAR> thumbsPath(path::GetDir(storePath));
+    if (!dir::Create(thumbsPath))
+        return false;
+
+    // the lock makes sure that only a single instance creates the header
+    // and that records are never appended while the file is being compacted
+    str::Str<char> buf(sizeof(ThumbnailStoreHeader) + sizeof(rec) + len);
+    ScopedCritSec scope(&access);
+    ScopedStoreLock lock;
+    if (!lock.IsLocked())
+        return false;
+    ScopedHandle h(CreateFile(storePath, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (INVALID_HANDLE_VALUE == h)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(h, &size))
+        return false;
+    if (0 == size.QuadPart) {
+        ThumbnailStoreHeader hdr = { THUMBNAIL_STORE_MAGIC, THUMBNAIL_STORE_VERSION };
+        buf.Append((const char *)&hdr, sizeof(hdr));
+    }
+    buf.Append((const char *)&rec, sizeof(rec));
+    buf.Append(png, len);
+    DWORD written;
+    return WriteFile(h, buf.Get(), (DWORD)buf.Size(), &written, NULL) && written == buf.Size();
+}
+
+void ThumbnailStore::Compact(WStrVec& filePaths)
+{
+    ScopedCritSec scope(&access);
+    ScopedStoreLock lock;
+    if (!lock.IsLocked())
+        return;
+    Update();
+    if (!data)
+        return;
+    // don't rewrite the file if it doesn't contain anything to be removed
+    size_t needed = sizeof(ThumbnailStoreHeader);
+    Vec<Entry *> keep;
+    for (size_t i = 0; i < filePaths.Count(); i++) {
+        Entry *entry = Find(filePaths.At(i));
+        if (entry && !keep.Contains(entry)) {
+            keep.Append(entry);
+            needed += sizeof(ThumbnailRecord) + entry->pngLen;
+        }
+    }
+    if (needed == dataLen)
         return;
-    do {
-        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
-            files.Append(str::Dup(fdata.cFileName));
-    } while (FindNextFile(hfind, &fdata));
-    FindClose(hfind);
 
+    str::Str<char> buf(needed);
+    ThumbnailStoreHeader hdr = { THUMBNAIL_STORE_MAGIC, THUMBNAIL_STORE_VERSION };
+    buf.Append((const char *)&hdr, sizeof(hdr));
+    for (size_t i = 0; i < keep.Count(); i++) {
+        ThumbnailRecord rec;
+        memcpy(rec.digest, keep.At(i)->digest, sizeof(rec.digest));
+        rec.saved = keep.At(i)->saved;
+        rec.pngLen = keep.At(i)->pngLen;
+        buf.Append((const char *)&rec, sizeof(rec));
+        buf.Append(data + keep.At(i)->offset, rec.pngLen);
+    }
+    Close();
+
+    // replacing the file fails while another instance has it mapped, so
+    // the file is only compacted (at a later time) once it's no longer in use
+    ScopedMem<WCHAR> storePath(GetStorePath());
+    HANDLE hExclusive = CreateFile(storePath, GENERIC_READ, 0, NULL, OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hExclusive)
+        return;
+    CloseHandle(hExclusive);
+    ScopedMem<WCHAR> tmpPath(str::Join(storePath, L".tmp"));
+    if (!tmpPath || !file::WriteAll(tmpPath, buf.Get(), buf.Size()))
+        return;
+    if (!MoveFileEx(tmpPath, storePath, MOVEFILE_REPLACE_EXISTING))
+        file::Delete(tmpPath);
+}
+
+static ThumbnailStore gThumbnailStore;
+
+// removes thumbnails that don't belong to any frequently used item in file history
+void CleanUpThumbnailCache(FileHistory& fileHistory)
+{
+    WStrVec paths;
     Vec<DisplayState *> list;
     fileHistory.GetFrequencyOrder(list);
     for (size_t i = 0; i < list.Count() && i < FILE_HISTORY_MAX_FREQUENT * 2; i++) {
-        ScopedMem<WCHAR> bmpPath(GetThumbnailPath(list.At(i)->filePath));
-        if (!bmpPath)
-            continue;
-        int idx = files.Find(path::GetBaseName(bmpPath));
-        if (idx != -1) {
-            CrashIf(idx < 0 || files.Count() <= (size_t)idx);
-            WCHAR *fileName = files.At(idx);
-            files.RemoveAt(idx);
-            free(fileName);
-        }
+        if (list.At(i)->filePath)
+            paths.Append(str::Dup(list.At(i)->filePath));
     }
 
-    for (size_t i = 0; i < files.Count(); i++) {
-        ScopedMem<WCHAR> bmpPath(path::Join(thumbsPath, files.At(i)));
-        file::Delete(bmpPath);
+    // move thumbnails saved by previous versions into the ThumbnailStore
+    ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+    if (!thumbsPath)
+        return;
+    ScopedMem<WCHAR> pattern(path::Join(thumbsPath, L"*.png"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (hfind != INVALID_HANDLE_VALUE) {
+        WStrVec files;
+        do {
+            if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                files.Append(path::Join(thumbsPath, fdata.cFileName));
+        } while (FindNextFile(hfind, &fdata));
+        FindClose(hfind);
+
+        FILETIME saved;
+        for (size_t i = 0; i < paths.Count(); i++) {
+            ScopedMem<WCHAR> bmpPath(GetThumbnailPath(paths.At(i)));
+            if (!bmpPath || !files.Contains(bmpPath) || gThumbnailStore.GetSaveTime(paths.At(i), &saved))
+                continue;
+            size_t len;
+            ScopedMem<char> png(file::ReadAll(bmpPath, &len));
+            if (png)
+                gThumbnailStore.Write(paths.At(i), png, len);
+        }
+        for (size_t i = 0; i < files.Count(); i++) {
+            file::Delete(files.At(i));
+        }
     }
+
+    gThumbnailStore.Compact(paths);
 }
 
-static RenderedBitmap *LoadRenderedBitmap(const WCHAR *filePath)
+static RenderedBitmap *LoadRenderedBitmap(const char *data, size_t len)
 {
-    size_t len;
-    ScopedMem<char> data(file::ReadAll(filePath, &len));
-    if (!data)
-        return NULL;
     Bitmap *bmp = BitmapFromData(data, len);
     if (!bmp)
         return NULL;
@@ -797,23 +1107,38 @@ static RenderedBitmap *LoadRenderedBitmap(const WCHAR *filePath)
     return rendered;
 }
 
-static bool LoadThumbnail(DisplayState& ds)
+// returns the saved thumbnail for a file along with the time it's been saved
+static RenderedBitmap *LoadThumbnailBitmap(const WCHAR *filePath, FILETIME *savedOut)
 {
-    delete ds.thumbnail;
-    ds.thumbnail = NULL;
-
-    ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath)
-        return false;
+    size_t len;
+    ScopedMem<char> png(gThumbnailStore.Read(filePath, &len, savedOut));
+    if (!png) {
+        // thumbnails saved by previous versions are moved into the store on exit
+        ScopedMem<WCHAR> bmpPath(GetThumbnailPath(filePath));
+        if (!bmpPath)
+            return NULL;
+        png.Set(file::ReadAll(bmpPath, &len));
+        if (!png)
+            return NULL;
+        *savedOut = file::GetModificationTime(bmpPath);
+    }
 
-    RenderedBitmap *bmp = LoadRenderedBitmap(bmpPath);
-    if (!bmp || bmp->Size().IsEmpty()) {
+    RenderedBitmap *bmp = LoadRenderedBitmap(png, len);
+    if (bmp && bmp->Size().IsEmpty()) {
         delete bmp;
-        return false;
+        return NULL;
     }
+    return bmp;
+}
 
-    ds.thumbnail = bmp;
-    return true;
+static bool LoadThumbnail(DisplayState& ds)
+{
+    delete ds.thumbnail;
+    ds.thumbnail = NULL;
+
+    FILETIME saved;
+    ds.thumbnail = LoadThumbnailBitmap(ds.filePath, &saved);
+    return ds.thumbnail != NULL;
 }
 
 bool HasThumbnail(DisplayState& ds)
@@ -821,13 +1146,16 @@ bool HasThumbnail(DisplayState& ds)
     if (!ds.thumbnail && !LoadThumbnail(ds))
         return false;
 
-    ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath)
-        return true;
-    FILETIME bmpTime = file::GetModificationTime(bmpPath);
+    FILETIME saved;
+    if (!gThumbnailStore.GetSaveTime(ds.filePath, &saved)) {
+        ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
+        if (!bmpPath || !file::Exists(bmpPath))
+            return true;
+        saved = file::GetModificationTime(bmpPath);
+    }
     FILETIME fileTime = file::GetModificationTime(ds.filePath);
     // delete the thumbnail if the file is newer than the thumbnail
-    if (FileTimeDiffInSecs(fileTime, bmpTime) > 0) {
+    if (FileTimeDiffInSecs(fileTime, saved) > 0) {
         delete ds.thumbnail;
         ds.thumbnail = NULL;
     }
@@ -840,16 +1168,17 @@ void SaveThumbnail(DisplayState& ds)
     if (!ds.thumbnail)
         return;
 
-    ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath)
+    ScopedComPtr<IStream> stream;
+    if (FAILED(CreateStreamOnHGlobal(NULL, TRUE, &stream)))
         return;
-    ScopedMem<WCHAR> thumbsPath(path::GetDir(bmpPath));
-    if (dir::Create(thumbsPath)) {
-        CrashIf(!str::EndsWithI(bmpPath, L".png"));
-        Bitmap bmp(ds.thumbnail->GetBitmap(), NULL);
-        CLSID tmpClsid = GetEncoderClsid(L"image/png");
-        bmp.Save(bmpPath, &tmpClsid);
-    }
+    Bitmap bmp(ds.thumbnail->GetBitmap(), NULL);
+    CLSID tmpClsid = GetEncoderClsid(L"image/png");
+    if (bmp.Save(stream, &tmpClsid) != Ok)
+        return;
+    size_t len;
+    ScopedMem<char> png((char *)GetDataFromStream(stream, &len));
+    if (png)
+        gThumbnailStore.Write(ds.filePath, png, len);
 }
 
 void RemoveThumbnail(DisplayState& ds)
@@ -857,9 +1186,166 @@ void RemoveThumbnail(DisplayState& ds)
     if (!HasThumbnail(ds))
         return;
 
+    gThumbnailStore.Remove(ds.filePath);
     ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
     if (bmpPath)
         file::Delete(bmpPath);
     delete ds.thumbnail;
     ds.thumbnail = NULL;
 }
+
+// thumbnails for the start page are loaded (and frequently read documents
+// without a thumbnail rendered) on a background thread, so that painting
+// the start page doesn't stall on a long file history
+class ThumbnailLoader : public ThreadBase, public UITask
+{
+    WStrVec paths;
+    // one (possibly NULL) bitmap per path
+    Vec<RenderedBitmap *> bitmaps;
+    // whether the bitmap has been rendered (and still has to be saved)
+    Vec<bool> rendered;
+    bool renderMissing;
+
+    RenderedBitmap *RenderThumbnail(const WCHAR *filePath);
+
+public:
+    ThumbnailLoader(WStrVec& paths, bool renderMissing) :
+        ThreadBase("ThumbnailLoader"), paths(paths), renderMissing(renderMissing) { }
+    ~ThumbnailLoader() {
+        DeleteVecMembers(bitmaps);
+    }
+
+    virtual void Run();
+    virtual void Execute();
+};
+
+static ThumbnailLoader *gThumbnailLoader = NULL;
+// paths for which a thumbnail has already been requested (and couldn't be loaded)
+static WStrVec gThumbnailsRequested;
+static bool gThumbnailLoadingDeferred = false;
+
+RenderedBitmap *ThumbnailLoader::RenderThumbnail(const WCHAR *filePath)
+{
+    // Chm documents are rendered through MSHTML on the UI thread (when closed)
+    // and documents on slow drives would hold up the remaining thumbnails
+    if (ChmEngine::IsSupportedFile(filePath) || !path::IsOnFixedDrive(filePath))
+        return NULL;
+
+    // password protected documents fail to load without a PasswordUI
+    ScopedPtr<BaseEngine> engine(EngineManager::CreateEngine(filePath, NULL, NULL, true,
+                                                              gGlobalPrefs->ebookUI.useFixedPageUI));
+    if (!engine || WasCancelRequested())
+        return NULL;
+
+    RectD pageRect = engine->PageMediabox(1);
+    if (pageRect.IsEmpty())
+        return NULL;
+
+    pageRect = engine->Transform(pageRect, 1, 1.0f, 0);
+    float zoom = THUMBNAIL_DX / (float)pageRect.dx;
+    if (pageRect.dy > (float)THUMBNAIL_DY / zoom)
+        pageRect.dy = (float)THUMBNAIL_DY / zoom;
+    pageRect = engine->Transform(pageRect, 1, 1.0f, 0, true);
+
+    return engine->RenderBitmap(1, zoom, 0, &pageRect);
+}
+
+void ThumbnailLoader::Run()
+{
+    for (size_t i = 0; i < paths.Count() && !WasCancelRequested(); i++) {
+        FILETIME saved;
+        RenderedBitmap *bmp = LoadThumbnailBitmap(paths.At(i), &saved);
+        // thumbnails older than their document are re-rendered (cf. HasThumbnail)
+        if (bmp && FileTimeDiffInSecs(file::GetModificationTime(paths.At(i)), saved) > 0) {
+            delete bmp;
+            bmp = NULL;
+        }
+        bool isRendered = false;
+        if (!bmp && renderMissing) {
+            bmp = RenderThumbnail(paths.At(i));
+            isRendered = bmp != NULL;
+        }
+        if (bmp && bmp->Size().IsEmpty()) {
+            delete bmp;
+            bmp = NULL;
+        }
+        bitmaps.Append(bmp);
+        rendered.Append(isRendered);
+    }
+    uitask::Post(this);
+}
+
+void ThumbnailLoader::Execute()
+{
+    bool updated = false;
+    for (size_t i = 0; i < bitmaps.Count() && !WasCancelRequested(); i++) {
+        DisplayState *ds = gFileHistory.Find(paths.At(i));
+        if (!ds || ds->thumbnail || !bitmaps.At(i))
+            continue;
+        ds->thumbnail = bitmaps.At(i);
+        bitmaps.At(i) = NULL;
+        if (rendered.At(i))
+            SaveThumbnail(*ds);
+        // allow reloading the thumbnail if it's removed again
+        int idx = gThumbnailsRequested.Find(paths.At(i));
+        if (idx != -1) {
+            WCHAR *filePath = gThumbnailsRequested.At(idx);
+            gThumbnailsRequested.RemoveAt(idx);
+            free(filePath);
+        }
+        updated = true;
+    }
+    // prepare for clean-up (Join() just to be safe)
+    gThumbnailLoader = NULL;
+    Join();
+
+    for (size_t i = 0; i < gWindows.Count() && updated; i++) {
+        if (gWindows.At(i)->IsAboutWindow())
+            gWindows.At(i)->RedrawAll(true);
+    }
+}
+
+static void LoadThumbnailsAsync(Vec<DisplayState *>& list)
+{
+    // remaining thumbnails are requested when the start page
+    // is repainted after the current ThumbnailLoader is done
+    // (or after thumbnail loading is no longer deferred)
+    if (gThumbnailLoader || gThumbnailLoadingDeferred)
+        return;
+
+    WStrVec paths;
+    for (size_t i = 0; i < list.Count(); i++) {
+        const WCHAR *filePath = list.At(i)->filePath;
+        if (filePath && !list.At(i)->isMissing && !gThumbnailsRequested.Contains(filePath)) {
+            paths.Append(str::Dup(filePath));
+            gThumbnailsRequested.Append(str::Dup(filePath));
+        }
+    }
+    if (0 == paths.Count())
+        return;
+
+    gThumbnailLoader = new ThumbnailLoader(paths, HasPermission(Perm_SavePreferences));
+    gThumbnailLoader->Start();
+}
+
+void DeferThumbnailLoading(bool defer)
+{
+    if (gThumbnailLoadingDeferred == defer)
+        return;
+    gThumbnailLoadingDeferred = defer;
+    for (size_t i = 0; i < gWindows.Count() && !defer; i++) {
+        if (gWindows.At(i)->IsAboutWindow())
+            gWindows.At(i)->RedrawAll(true);
+    }
+}
+
+void AbortThumbnailLoading()
+{
+    if (gThumbnailLoader)
+        gThumbnailLoader->RequestCancel();
+    while (gThumbnailLoader) {
+        Sleep(10);
+        uitask::DrainQueue();
+    }
+    gThumbnailsRequested.Reset();
+}
@@ -28,5 +28,10 @@ void    CleanUpThumbnailCache(FileHistory& fileHistory);
 bool    HasThumbnail(DisplayState& ds);
 void    SaveThumbnail(DisplayState& ds);
 void    RemoveThumbnail(DisplayState& ds);
+// waits for thumbnails still being loaded for the start page
+void    AbortThumbnailLoading();
+// while deferred, the start page only shows placeholders for thumbnails
+// which haven't been loaded yet (so that they don't slow down startup)
+void    DeferThumbnailLoading(bool defer);
 
 #endif
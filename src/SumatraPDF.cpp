@@ -11,6 +11,7 @@
 #include "AppUtil.h"
 #include "CmdLineParser.h"
 #include "CrashHandler.h"
+#include "D2DCanvas.h"
 #include "DebugLog.h"
 #include "DirIter.h"
 #include "Doc.h"
@@ -50,6 +51,7 @@ using namespace Gdiplus;
 #include "ThreadUtil.h"
 #include "Toolbar.h"
 #include "Touch.h"
+#include "Trace.h"
 #include "Translations.h"
 #include "uia/Provider.h"
 #include "UITask.h"
@@ -65,6 +67,10 @@ bool             gDebugShowLinks = true;
 bool             gDebugShowLinks = false;
 #endif
 
+/* if true, the render cache's latency statistics are shown on top of
+   the document (cf. RenderCache::GetStats) */
+bool             gDebugShowRenderStats = false;
+
 /* if true, we're rendering everything with the GDI+ back-end,
    otherwise Fitz/MuPDF is used at least for screen rendering.
    In Debug builds, you can switch between the two through the Debug menu */
@@ -75,6 +81,11 @@ bool             gUseGdiRenderer = false;
 // embedded (e.g. in a web browser)
 WCHAR *          gPluginURL = NULL; // owned by CommandLineInfo in WinMain
 
+// in resident mode, closing the last window only hides it and SumatraPDF
+// keeps running in the notification area, so that the next document can
+// be shown without having to start a new process (cf. ResidentMode)
+bool             gResidentMode = false;
+
 #define ABOUT_BG_LOGO_COLOR     RGB(0xFF, 0xF2, 0x00)
 #define ABOUT_BG_GRAY_COLOR     RGB(0xCC, 0xCC, 0xCC)
 
@@ -122,6 +133,13 @@ WCHAR *          gPluginURL = NULL; // owned by CommandLineInfo in WinMain
 #define AUTO_RELOAD_TIMER_ID        5
 #define AUTO_RELOAD_DELAY_IN_MS     100
 
+#define DEFER_RENDERING_TIMER_ID    6
+#define DEFER_RENDERING_DELAY_IN_MS 150
+
+// sent by the notification area icon of a resident instance
+#define UWM_TRAY_ICON               (WM_APP + 1)
+#define TRAY_ICON_ID                1
+
 HINSTANCE                    ghinst = NULL;
 
 HCURSOR                      gCursorArrow;
@@ -143,6 +161,10 @@ static HCURSOR                      gCursorNo;
 static HBITMAP                      gBitmapReloadingCue;
 static RenderCache                  gRenderCache;
 static bool                         gCrashOnOpen = false;
+// the hidden window of a resident instance which owns the notification area icon
+static HWND                         gHwndTrayIcon = NULL;
+// sent when Explorer has been restarted (and the icon has to be added again)
+static UINT                         gMsgTaskbarCreated = 0;
 
 // in restricted mode, some features can be disabled (such as
 // opening files, printing, following URLs), so that SumatraPDF
@@ -162,6 +184,13 @@ static WStrVec                      gAllowedFileTypes;
 // being set up
 class FileExistenceChecker;
 static FileExistenceChecker *       gFileExistenceChecker = NULL;
+// gMemoryPressureWatcher compacts the caches of all background
+// documents whenever the system runs low on memory
+class MemoryPressureWatcher;
+static MemoryPressureWatcher *      gMemoryPressureWatcher = NULL;
+// QueryPerformanceCounter() value at startup, reset once the first page
+// has been painted (which is recorded as "TimeToFirstPage" when tracing)
+static LONGLONG                     gStartupTime = 0;
 
 static void UpdateUITextForLanguage();
 static void UpdateToolbarAndScrollbarState(WindowInfo& win);
@@ -476,12 +505,8 @@ static void UpdateSidebarDisplayState(WindowInfo *win, DisplayState *ds)
 {
     ds->showToc = win->tocVisible;
 
-    if (win->tocLoaded) {
-        win->tocState.Reset();
-        HTREEITEM hRoot = TreeView_GetRoot(win->hwndTocTree);
-        if (hRoot)
-            UpdateTocExpansionState(win, hRoot);
-    }
+    if (win->tocLoaded)
+        UpdateTocExpansionState(win);
 
     *ds->tocState = win->tocState;
 }
@@ -875,6 +900,250 @@ static void UnsubclassCanvas(HWND hwnd)
 // placeWindow : if true then the Window will be moved/sized according
 //   to the 'state' information even if the window was already placed
 //   before (isNewWindow=false)
+// determines which pages have cached bitmaps or text in prevDm and look the same in
+// the reloaded newDm, so that their bitmaps and text can be reused right away
+// (e.g. for the pages a LaTeX recompilation didn't change)
+static void FindUnchangedPages(DisplayModel *prevDm, DisplayModel *newDm, Vec<bool>& unchanged)
+{
+    unchanged.Reset();
+    if (prevDm->engineType != newDm->engineType)
+        return;
+    int pageCount = min(prevDm->PageCount(), newDm->PageCount());
+    unchanged.AppendBlanks(pageCount);
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        if (!gRenderCache.Exists(prevDm, pageNo, prevDm->Rotation()) && !prevDm->textCache->HasData(pageNo))
+            continue;
+        unsigned char prevDigest[16], newDigest[16];
+        if (prevDm->engine->GetPageDigest(pageNo, prevDigest) &&
+            newDm->engine->GetPageDigest(pageNo, newDigest)) {
+            unchanged.At(pageNo - 1) = memeq(prevDigest, newDigest, sizeof(prevDigest));
+        }
+    }
+}
+
+// delay before telling the user that a document is still being loaded
+#define SHOW_LOADING_DELAY_MS 500
+
+/* Creates the engine for a document on a background thread, so that the UI
+   remains responsive (and loading can be canceled) while e.g. a large document
+   or one on a slow network drive is being loaded. Password requests are
+   forwarded to the UI thread (cf. PasswordRequestTask). */
+class EngineLoadingThread : public ThreadBase, public PasswordUI, public NotificationWndCallback {
+    // one reference is held by the thread itself, one by LoadEngineInBackground
+    // and one by every pending PasswordRequestTask
+    LONG refCount;
+    ScopedMem<WCHAR> filePath;
+    bool useAlternateChmEngine;
+    bool enableEbookEngines;
+
+    // only to be accessed from the UI thread
+    WindowInfo *win;
+    PasswordUI *pwdUI;
+    NotificationWnd *wnd;
+
+    struct {
+        const WCHAR *fileName;
+        unsigned char *fileDigest;
+        unsigned char *decryptionKeyOut;
+        bool *saveKey;
+        WCHAR *result;
+    } pwdRequest;
+    HANDLE hPwdAnswered;
+
+public:
+    HANDLE hFinished;
+    BaseEngine *engine;
+    DocType engineType;
+
+    EngineLoadingThread(WindowInfo *win, const WCHAR *filePath, PasswordUI *pwdUI,
+                        bool useAlternateChmEngine, bool enableEbookEngines) :
+        ThreadBase("EngineLoadingThread"), refCount(2), filePath(str::Dup(filePath)),
+        useAlternateChmEngine(useAlternateChmEngine), enableEbookEngines(enableEbookEngines),
+        win(win), pwdUI(pwdUI), wnd(NULL), engine(NULL), engineType(Engine_None) {
+        ZeroMemory(&pwdRequest, sizeof(pwdRequest));
+        hPwdAnswered = CreateEvent(NULL, FALSE, FALSE, NULL);
+        hFinished = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+    virtual ~EngineLoadingThread() {
+        delete engine;
+        CloseHandle(hPwdAnswered);
+        CloseHandle(hFinished);
+    }
+
+    void AddRef() { InterlockedIncrement(&refCount); }
+    void Release() {
+        if (0 == InterlockedDecrement(&refCount))
+            delete this;
+    }
+
+    virtual void Run() {
+        engine = EngineManager::CreateEngine(filePath, this, &engineType,
+                                             useAlternateChmEngine, enableEbookEngines);
+        SetEvent(hFinished);
+        Release();
+    }
+
+    // called on the loading thread
+    virtual WCHAR *GetPassword(const WCHAR *fileName, unsigned char *fileDigest,
+                               unsigned char decryptionKeyOut[32], bool *saveKey);
+    // called on the UI thread
+    void AnswerPasswordRequest() {
+        if (pwdUI && !WasCancelRequested()) {
+            pwdRequest.result = pwdUI->GetPassword(pwdRequest.fileName, pwdRequest.fileDigest,
+                                                   pwdRequest.decryptionKeyOut, pwdRequest.saveKey);
+        } else {
+            *pwdRequest.saveKey = false;
+            pwdRequest.result = NULL;
+        }
+        SetEvent(hPwdAnswered);
+    }
+
+    // the loading engine can't be interrupted, so it's just abandoned
+    // (and deleted once the thread is done)
+    void Cancel() {
+        RequestCancel();
+        pwdUI = NULL;
+        HideNotification();
+    }
+    bool IsCanceled() { return WasCancelRequested(); }
+
+    void ShowNotification(bool showWin) {
+        // new windows are only shown once loading has finished
+        if (showWin && !IsWindowVisible(win->hwndFrame)) {
+            ShowWindow(win->hwndFrame, SW_SHOW);
+            UpdateWindow(win->hwndFrame);
+        }
+        ScopedMem<WCHAR> msg(str::Format(_TR("Loading file %s..."), path::GetBaseName(filePath)));
+        wnd = new NotificationWnd(win->hwndCanvas, msg, 0, false, this);
+        win->notifications->Add(wnd);
+    }
+    void HideNotification() {
+        if (wnd)
+            win->notifications->RemoveNotification(wnd);
+        wnd = NULL;
+    }
+    bool HasNotification() const { return wnd != NULL; }
+
+    // called when the notification has been closed by the user
+    virtual void RemoveNotification(NotificationWnd *wnd) {
+        CrashIf(wnd != this->wnd);
+        Cancel();
+    }
+};
+
+class PasswordRequestTask : public UITask {
+    EngineLoadingThread *loader;
+
+public:
+    PasswordRequestTask(EngineLoadingThread *loader) : loader(loader) {
+        name = "PasswordRequestTask";
+        loader->AddRef();
+    }
+    ~PasswordRequestTask() { loader->Release(); }
+
+    virtual void Execute() { loader->AnswerPasswordRequest(); }
+};
+
+WCHAR *EngineLoadingThread::GetPassword(const WCHAR *fileName, unsigned char *fileDigest,
+                                        unsigned char decryptionKeyOut[32], bool *saveKey)
+{
+    *saveKey = false;
+    if (WasCancelRequested())
+        return NULL;
+    pwdRequest.fileName = fileName;
+    pwdRequest.fileDigest = fileDigest;
+    pwdRequest.decryptionKeyOut = decryptionKeyOut;
+    pwdRequest.saveKey = saveKey;
+    uitask::Post(new PasswordRequestTask(this));
+    WaitForSingleObject(hPwdAnswered, INFINITE);
+    return pwdRequest.result;
+}
+
+// creates the engine for args.fileName while processing messages (without
+// translating accelerators, so that e.g. pressing Escape cancels loading)
+// returns NULL if loading failed or args.canceled is set
+static BaseEngine *LoadEngineInBackground(LoadArgs& args, PasswordUI *pwdUI, DocType *typeOut,
+                                          bool useAlternateChmEngine, bool enableEbookEngines)
+{
+    // embedded documents have already been downloaded and loading them synchronously
+    // prevents WM_DESTROY from being sent by the plugin's parent in the middle of loading
+    if (gPluginMode)
+        return EngineManager::CreateEngine(args.fileName, pwdUI, typeOut, useAlternateChmEngine, enableEbookEngines);
+
+    WindowInfo *win = args.win;
+    CrashIf(win->engineLoader);
+    EngineLoadingThread *loader = new EngineLoadingThread(win, args.fileName, pwdUI, useAlternateChmEngine, enableEbookEngines);
+    win->engineLoader = loader;
+    loader->Start();
+
+    DWORD start = GetTickCount();
+    while (!loader->IsCanceled()) {
+        DWORD timeout = INFINITE;
+        if (!loader->HasNotification()) {
+            DWORD elapsed = GetTickCount() - start;
+            timeout = elapsed < SHOW_LOADING_DELAY_MS ? SHOW_LOADING_DELAY_MS - elapsed : 0;
+        }
+        DWORD res = MsgWaitForMultipleObjects(1, &loader->hFinished, FALSE, timeout, QS_ALLINPUT);
+        if (WAIT_OBJECT_0 == res)
+            break;
+        if (WAIT_TIMEOUT == res && !loader->HasNotification()) {
+            loader->ShowNotification(args.showWin);
+            continue;
+        }
+        MSG msg;
+        while (!loader->IsCanceled() && PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (WM_QUIT == msg.message) {
+                // let the main message loop quit
+                PostQuitMessage((int)msg.wParam);
+                loader->Cancel();
+                break;
+            }
+            if (WM_KEYDOWN == msg.message && VK_ESCAPE == msg.wParam && FindWindowInfoByHwnd(msg.hwnd) == win) {
+                loader->Cancel();
+                break;
+            }
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
+    win->engineLoader = NULL;
+    loader->HideNotification();
+
+    BaseEngine *engine = NULL;
+    args.canceled = loader->IsCanceled();
+    if (!args.canceled) {
+        engine = loader->engine;
+        loader->engine = NULL;
+        if (typeOut)
+            *typeOut = loader->engineType;
+    }
+    loader->Release();
+    return engine;
+}
+
+// returns a clone of the engine of another window showing the same unmodified file,
+// so that both windows share the document's fonts, images and display lists
+// (cf. PdfSharedContext) instead of loading and caching all of them twice
+static BaseEngine *CloneEngineFromOtherWindow(WindowInfo *win, const WCHAR *filePath, FILETIME fileTime, DocType *typeOut)
+{
+    for (size_t i = 0; i < gWindows.Count(); i++) {
+        WindowInfo *other = gWindows.At(i);
+        if (other == win || !other->IsDocLoaded() || !path::IsSame(other->loadedFilePath, filePath))
+            continue;
+        // only cloned PDF and XPS engines share their caches
+        if (other->dm->engineType != Engine_PDF && other->dm->engineType != Engine_XPS)
+            continue;
+        if (other->dm->engine->IsStillLoading() || !FileTimeEq(other->loadedFileTime, fileTime))
+            continue;
+        BaseEngine *engine = other->dm->engine->Clone();
+        if (engine) {
+            *typeOut = other->dm->engineType;
+            return engine;
+        }
+    }
+    return NULL;
+}
+
 static bool LoadDocIntoWindow(LoadArgs& args, PasswordUI *pwdUI, DisplayState *state=NULL)
 {
     ScopedMem<WCHAR> title;
@@ -917,16 +1186,27 @@ static bool LoadDocIntoWindow(LoadArgs& args, PasswordUI *pwdUI, DisplayState *s
         showToc = state->showToc;
     }
 
+    DocType engineType = Engine_None;
+    FILETIME fileTime = file::GetModificationTime(args.fileName);
+    BaseEngine *engine = CloneEngineFromOtherWindow(win, args.fileName, fileTime, &engineType);
+    if (!engine) {
+        engine = LoadEngineInBackground(args, pwdUI, &engineType,
+                                        gGlobalPrefs->chmUI.useFixedPageUI,
+                                        gGlobalPrefs->ebookUI.useFixedPageUI);
+    }
+    // the window still shows the previous document (or the Frequently Read page)
+    if (args.canceled)
+        return false;
+
     DisplayModel *prevModel = win->dm;
     AbortFinding(args.win);
+    ClearFindAllMatches(args.win);
+    FlushDelayedCopy(win);
     delete win->pdfsync;
     win->pdfsync = NULL;
 
     str::ReplacePtr(&win->loadedFilePath, args.fileName);
-    DocType engineType;
-    BaseEngine *engine = EngineManager::CreateEngine(args.fileName, pwdUI, &engineType,
-                                                     gGlobalPrefs->chmUI.useFixedPageUI,
-                                                     gGlobalPrefs->ebookUI.useFixedPageUI);
+    win->loadedFileTime = fileTime;
 
     if (engine && Engine_Chm == engineType) {
         // make sure that MSHTML can't be used as a potential exploit
@@ -973,7 +1253,13 @@ static bool LoadDocIntoWindow(LoadArgs& args, PasswordUI *pwdUI, DisplayState *s
         if (engineType == Engine_ComicBook || engineType == Engine_ImageDir)
             win->dm->SetDisplayR2L(state ? state->displayR2L : gGlobalPrefs->comicBookUI.cbxMangaMode);
         if (prevModel && str::Eq(win->dm->FilePath(), prevModel->FilePath())) {
-            gRenderCache.KeepForDisplayModel(prevModel, win->dm);
+            Vec<bool> unchangedPages;
+            FindUnchangedPages(prevModel, win->dm, unchangedPages);
+            for (size_t i = 0; i < unchangedPages.Count(); i++) {
+                if (unchangedPages.At(i))
+                    win->dm->textCache->TakeData(prevModel->textCache, (int)i + 1);
+            }
+            gRenderCache.KeepForDisplayModel(prevModel, win->dm, &unchangedPages);
             win->dm->CopyNavHistory(*prevModel);
         }
         delete prevModel;
@@ -997,6 +1283,7 @@ static bool LoadDocIntoWindow(LoadArgs& args, PasswordUI *pwdUI, DisplayState *s
         win->userAnnots = LoadFileModifications(args.fileName);
         win->userAnnotsModified = false;
         win->dm->engine->UpdateUserAnnotations(win->userAnnots);
+        win->userHighlightsOverlaid = win->dm->engine->SetHighlightOverlay(true);
     }
 
     if (state) {
@@ -1112,6 +1399,9 @@ Error:
 
 void ReloadDocument(WindowInfo *win, bool autorefresh)
 {
+    // the document is still being (re)loaded
+    if (win->engineLoader)
+        return;
     if (!win->IsDocLoaded()) {
         if (!autorefresh && win->loadedFilePath) {
             LoadArgs args(win->loadedFilePath, win);
@@ -1282,18 +1572,48 @@ WindowInfo *CreateAndShowWindowInfo()
     return win;
 }
 
+static bool AddTrayIcon(HWND hwnd)
+{
+    NOTIFYICONDATA nid = { 0 };
+    // use the smallest structure size for compatibility with Windows XP
+    nid.cbSize = NOTIFYICONDATA_V2_SIZE;
+    nid.hWnd = hwnd;
+    nid.uID = TRAY_ICON_ID;
+    nid.uFlags = NIF_ICON | NIF_MESSAGE | NIF_TIP;
+    nid.uCallbackMessage = UWM_TRAY_ICON;
+    nid.hIcon = (HICON)LoadImage(ghinst, MAKEINTRESOURCE(IDI_SUMATRAPDF), IMAGE_ICON,
+                                 GetSystemMetrics(SM_CXSMICON), GetSystemMetrics(SM_CYSMICON), LR_SHARED);
+    str::BufSet(nid.szTip, dimof(nid.szTip), SUMATRA_WINDOW_TITLE);
+    return Shell_NotifyIcon(NIM_ADD, &nid);
+}
+
+static void RemoveTrayIcon()
+{
+    if (!gHwndTrayIcon)
+        return;
+    NOTIFYICONDATA nid = { 0 };
+    nid.cbSize = NOTIFYICONDATA_V2_SIZE;
+    nid.hWnd = gHwndTrayIcon;
+    nid.uID = TRAY_ICON_ID;
+    Shell_NotifyIcon(NIM_DELETE, &nid);
+    gHwndTrayIcon = NULL;
+}
+
 static void DeleteWindowInfo(WindowInfo *win)
 {
+    FlushDelayedCopy(win);
+    if (win->hwndFrame == gHwndTrayIcon)
+        RemoveTrayIcon();
     FileWatcherUnsubscribe(win->watcher);
     win->watcher = NULL;
 
     DeletePropertiesWindow(win->hwndFrame);
     gWindows.Remove(win);
 
-    ImageList_Destroy((HIMAGELIST)SendMessage(win->hwndToolbar, TB_GETIMAGELIST, 0, 0));
     DragAcceptFiles(win->hwndCanvas, FALSE);
 
     AbortFinding(win);
+    ClearFindAllMatches(win);
     AbortPrinting(win);
 
     if (win->uia_provider) {
@@ -1341,7 +1661,7 @@ static void RenameFileInHistory(const WCHAR *oldPath, const WCHAR *newPath)
     }
     ds = gFileHistory.Find(oldPath);
     if (ds) {
-        str::ReplacePtr(&ds->filePath, newPath);
+        gFileHistory.SetFilePath(ds, newPath);
         // merge Frequently Read data, so that a file
         // doesn't accidentally vanish from there
         ds->isPinned = ds->isPinned || oldIsPinned;
@@ -1430,7 +1750,7 @@ static WindowInfo* LoadDocumentOld(LoadArgs& args)
     if (failEarly) {
         ScopedMem<WCHAR> msg(str::Format(_TR("File %s not found"), fullPath));
         ShowNotification(win, msg, true /* autoDismiss */, true /* highlight */);
-        // display the notification ASAP (prefs::Save() can introduce a notable delay)
+        // display the notification ASAP
         win->RedrawAll(true);
 
         if (gFileHistory.MarkFileInexistent(fullPath)) {
@@ -1444,9 +1764,9 @@ static WindowInfo* LoadDocumentOld(LoadArgs& args)
 
     if (!gGlobalPrefs->ebookUI.useFixedPageUI && IsEbookFile(fullPath)) {
         if (!win) {
-            if ((1 == gWindows.Count()) && gWindows.At(0)->IsAboutWindow())
+            if ((1 == gWindows.Count()) && gWindows.At(0)->IsAboutWindow() && !gWindows.At(0)->engineLoader)
                 win = gWindows.At(0);
-        } else if (!win->IsAboutWindow() && !args.forceReuse)
+        } else if (!win->IsAboutWindow() && !args.forceReuse || win->engineLoader)
             win = NULL;
         if (!win) {
             // create a dummy window so that we can return
@@ -1464,11 +1784,12 @@ static WindowInfo* LoadDocumentOld(LoadArgs& args)
         return win;
     }
 
-    if (!win && 1 == gWindows.Count() && gWindows.At(0)->IsAboutWindow()) {
+    // windows into which a document is still being loaded can't be reused
+    if (!win && 1 == gWindows.Count() && gWindows.At(0)->IsAboutWindow() && !gWindows.At(0)->engineLoader) {
         win = gWindows.At(0);
         args.win = win;
         args.isNewWindow = false;
-    } else if (!win || win->IsDocLoaded() && !args.forceReuse) {
+    } else if (!win || win->IsDocLoaded() && !args.forceReuse || win->engineLoader) {
         WindowInfo *currWin = win;
         win = CreateWindowInfo();
         if (!win)
@@ -1483,6 +1804,9 @@ static WindowInfo* LoadDocumentOld(LoadArgs& args)
         // reuse the window if it only contains an error message
         args.forceReuse = true;
     }
+    // the hidden window of a resident instance is to be placed and shown like a new one
+    if (win->IsAboutWindow() && !IsWindowVisible(win->hwndFrame))
+        args.isNewWindow = true;
 
     if (!win->IsAboutWindow()) {
         CrashIf(!args.forceReuse);
@@ -1497,17 +1821,30 @@ static WindowInfo* LoadDocumentOld(LoadArgs& args)
     args.placeWindow = true;
     bool loaded = LoadDocIntoWindow(args, &pwdUI);
     // don't fail if a user tries to load an SMX file instead
-    if (!loaded && IsModificationsFile(fullPath)) {
+    if (!loaded && !args.canceled && IsModificationsFile(fullPath)) {
         *(WCHAR *)path::GetExt(fullPath) = '\0';
         loaded = LoadDocIntoWindow(args, &pwdUI);
     }
 
+    if (win->hwndFrame == gHwndTrayIcon && IsWindowVisible(win->hwndFrame))
+        RemoveTrayIcon();
+
     if (gPluginMode) {
         // hide the menu for embedded documents opened from the plugin
         SetMenu(win->hwndFrame, NULL);
         return win;
     }
 
+    if (args.canceled) {
+        // a new window hasn't been shown yet (unless loading took a while)
+        if (args.isNewWindow) {
+            CloseWindow(win, 1 == TotalWindowsCount());
+            return NULL;
+        }
+        win->RedrawAll(true);
+        return win;
+    }
+
     if (!loaded) {
         if (gFileHistory.MarkFileInexistent(fullPath))
             prefs::Save();
@@ -1517,7 +1854,9 @@ static WindowInfo* LoadDocumentOld(LoadArgs& args)
     FileWatcherUnsubscribe(win->watcher);
     win->watcher = NULL;
 
-    if (gGlobalPrefs->reloadModifiedDocuments)
+    // the plugin's (temporary) files don't change once they're complete and
+    // shouldn't be reloaded while they're still being downloaded
+    if (gGlobalPrefs->reloadModifiedDocuments && !gPluginMode)
         win->watcher = FileWatcherSubscribe(fullPath, new FileChangeCallback(win));
 
     if (gGlobalPrefs->rememberOpenedFiles) {
@@ -1614,6 +1953,61 @@ void WindowInfo::CleanUp(DisplayModel *dm)
     gRenderCache.FreeForDisplayModel(dm);
 }
 
+class UpdatePageSizesTask : public UITask
+{
+    WindowInfo *win;
+    // dm might no longer exist once the task is executed
+    LONG dmId;
+
+public:
+    UpdatePageSizesTask(WindowInfo *win, DisplayModel *dm) : win(win), dmId(dm->GetId()) {
+        name = "UpdatePageSizesTask";
+    }
+
+    virtual void Execute() {
+        // the document might have been closed or reloaded in the meantime
+        // (and a new DisplayModel might have been allocated at the same address)
+        if (!WindowInfoStillValid(win) || !win->dm || win->dm->GetId() != dmId)
+            return;
+        win->dm->UpdatePageSizes();
+        win->RepaintAsync();
+    }
+};
+
+void WindowInfo::PageSizesChanged(DisplayModel *dm)
+{
+    uitask::Post(new UpdatePageSizesTask(this, dm));
+}
+
+class DocumentLoadingTask : public UITask
+{
+    WindowInfo *win;
+    DisplayModel *dm;
+    bool completed;
+
+public:
+    DocumentLoadingTask(WindowInfo *win, DisplayModel *dm, bool completed) :
+        win(win), dm(dm), completed(completed) {
+        name = "DocumentLoadingTask";
+    }
+
+    virtual void Execute() {
+        if (!WindowInfoStillValid(win) || win->dm != dm)
+            return;
+        // reloading makes all pages, the outline, etc. available
+        if (completed)
+            ReloadDocument(win, true);
+        // retry rendering the pages which weren't available so far
+        else
+            win->RepaintAsync();
+    }
+};
+
+void WindowInfo::DocumentLoadingProgress(DisplayModel *dm, bool completed)
+{
+    uitask::Post(new DocumentLoadingTask(this, dm, completed));
+}
+
 static void UpdateCanvasScrollbars(DisplayModel *dm, HWND hwndCanvas, SizeI canvas)
 {
     SCROLLINFO si = { 0 };
@@ -1942,10 +2336,75 @@ public:
     }
 };
 
+// how long to wait before compacting documents again, so that
+// they aren't compacted continuously while memory stays low
+#define MEMORY_PRESSURE_COOLDOWN_MS 30000
+
+// frees everything that can be recreated on demand for all documents but
+// the one in the foreground window (the documents themselves stay loaded,
+// so that their scroll state is kept and switching back is immediate)
+static void CompactBackgroundDocuments()
+{
+    HWND hwndForeground = GetForegroundWindow();
+    for (size_t i = 0; i < gWindows.Count(); i++) {
+        WindowInfo *win = gWindows.At(i);
+        if (!win->IsDocLoaded() || win->hwndFrame == hwndForeground)
+            continue;
+        win->dm->engine->CompactMemory();
+        if (win->dm->textCache)
+            win->dm->textCache->Compact();
+        // bitmaps of visible windows would only have to be rendered again right away
+        if (IsIconic(win->hwndFrame))
+            gRenderCache.FreeForDisplayModel(win->dm);
+    }
+}
+
+class CompactDocumentsTask : public UITask
+{
+public:
+    CompactDocumentsTask() { name = "CompactDocumentsTask"; }
+    virtual void Execute() { CompactBackgroundDocuments(); }
+};
+
+class MemoryPressureWatcher : public ThreadBase
+{
+    HANDLE hLowMemory;
+
+    // returns true if the thread is to stop
+    bool WaitForCancel(DWORD waitMs) {
+        for (DWORD waited = 0; waited < waitMs && !WasCancelRequested(); waited += 500) {
+            Sleep(500);
+        }
+        return WasCancelRequested();
+    }
+
+public:
+    MemoryPressureWatcher() : ThreadBase("MemoryPressureWatcher") {
+        hLowMemory = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+    }
+    virtual ~MemoryPressureWatcher() {
+        if (hLowMemory)
+            CloseHandle(hLowMemory);
+    }
+
+    virtual void Run() {
+        if (!hLowMemory)
+            return;
+        while (!WasCancelRequested()) {
+            // the notification stays signaled for as long as memory is low
+            if (WaitForSingleObject(hLowMemory, 500) != WAIT_OBJECT_0)
+                continue;
+            uitask::Post(new CompactDocumentsTask());
+            if (WaitForCancel(MEMORY_PRESSURE_COOLDOWN_MS))
+                break;
+        }
+    }
+};
+
 #ifdef DRAW_PAGE_SHADOWS
 #define BORDER_SIZE   1
 #define SHADOW_OFFSET 4
-static void PaintPageFrameAndShadow(HDC hdc, RectI& bounds, RectI& pageRect, bool presentation)
+static void PaintPageFrameAndShadow(HDC hdc, D2DCanvas *canvas, RectI& bounds, RectI& pageRect, bool presentation)
 {
     // Frame info
     RectI frame = bounds;
@@ -1965,8 +2424,18 @@ static void PaintPageFrameAndShadow(HDC hdc, RectI& bounds, RectI& pageRect, boo
         shadow.y -= diff; shadow.dy += diff;
     }
 
+    // shadows only add to the bandwidth needed over Remote Desktop
+    bool drawShadow = !presentation && !GetSystemMetrics(SM_REMOTESESSION);
+    if (canvas) {
+        if (drawShadow)
+            canvas->FillRect(shadow, COL_PAGE_SHADOW);
+        canvas->FillRect(frame, presentation ? TRANSPARENT : COL_PAGE_FRAME);
+        canvas->FillRect(RectI(frame.x + 1, frame.y + 1, frame.dx - 2, frame.dy - 2), gRenderCache.backgroundColor);
+        return;
+    }
+
     // Draw shadow
-    if (!presentation) {
+    if (drawShadow) {
         ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(COL_PAGE_SHADOW));
         FillRect(hdc, &shadow.ToRECT(), brush);
     }
@@ -1979,8 +2448,12 @@ static void PaintPageFrameAndShadow(HDC hdc, RectI& bounds, RectI& pageRect, boo
     Rectangle(hdc, frame.x, frame.y, frame.x + frame.dx, frame.y + frame.dy);
 }
 #else
-static void PaintPageFrameAndShadow(HDC hdc, RectI& bounds, RectI& pageRect, bool presentation)
+static void PaintPageFrameAndShadow(HDC hdc, D2DCanvas *canvas, RectI& bounds, RectI& pageRect, bool presentation)
 {
+    if (canvas) {
+        canvas->FillRect(bounds, gRenderCache.backgroundColor);
+        return;
+    }
     ScopedGdiObj<HPEN> pe(CreatePen(PS_NULL, 0, 0));
     ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(gRenderCache.backgroundColor));
     SelectObject(hdc, pe);
@@ -2039,6 +2512,27 @@ static void DebugShowLinks(DisplayModel& dm, HDC hdc)
     }
 }
 
+/* debug code to tune tile size and cache parameters */
+static void DebugShowRenderStats(WindowInfo& win, HDC hdc)
+{
+    if (!gDebugShowRenderStats)
+        return;
+
+    ScopedMem<WCHAR> stats(gRenderCache.GetStats());
+    ScopedFont font(GetSimpleFont(hdc, L"Courier New", 12));
+    HGDIOBJ hPrevFont = SelectObject(hdc, font);
+    RectI rc = ClientRect(win.hwndCanvas);
+    RECT rcText = { 8, 8, rc.dx - 8, rc.dy - 8 };
+    DrawText(hdc, stats, -1, &rcText, DT_CALCRECT | DT_NOPREFIX | DT_LEFT);
+    RECT rcBg = { rcText.left - 4, rcText.top - 4, rcText.right + 4, rcText.bottom + 4 };
+    ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(RGB(0xff, 0xff, 0xe0)));
+    FillRect(hdc, &rcBg, brush);
+    SetTextColor(hdc, WIN_COL_BLACK);
+    SetBkMode(hdc, TRANSPARENT);
+    DrawText(hdc, stats, -1, &rcText, DT_NOPREFIX | DT_LEFT);
+    SelectObject(hdc, hPrevFont);
+}
+
 // cf. http://forums.fofou.org/sumatrapdf/topic?id=3183580
 static void GetGradientColor(COLORREF a, COLORREF b, float perc, TRIVERTEX *tv)
 {
@@ -2047,22 +2541,82 @@ static void GetGradientColor(COLORREF a, COLORREF b, float perc, TRIVERTEX *tv)
     tv->Blue = (COLOR16)((GetBValueSafe(a) + perc * (GetBValueSafe(b) - GetBValueSafe(a))) * 256);
 }
 
-static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
+// the engine renders highlights with multiply blending: with a color's
+// opacity a, each channel c results in a factor of (1 - a * (1 - c)),
+// which is approximated by AND-ing that color with the page's pixels
+#define ROP_PATAND 0x00A000C9
+
+static void PaintUserHighlights(WindowInfo& win, HDC hdc)
+{
+    DisplayModel *dm = win.dm;
+    RectI screen(PointI(), dm->viewPort.Size());
+    for (size_t i = 0; i < win.userAnnots->Count(); i++) {
+        PageAnnotation& annot = win.userAnnots->At(i);
+        if (annot.type != Annot_Highlight)
+            continue;
+        PageInfo *pageInfo = dm->GetPageInfo(annot.pageNo);
+        if (!pageInfo || 0.0f == pageInfo->visibleRatio)
+            continue;
+        RectI rect = dm->CvtToScreen(annot.pageNo, annot.rect);
+        rect = rect.Intersect(pageInfo->pageOnScreen).Intersect(screen);
+        if (rect.IsEmpty())
+            continue;
+
+        int a = annot.color.a;
+        COLORREF col = RGB(255 - (255 - annot.color.r) * a / 255,
+                           255 - (255 - annot.color.g) * a / 255,
+                           255 - (255 - annot.color.b) * a / 255);
+        ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(col));
+        HGDIOBJ prevBrush = SelectObject(hdc, brush);
+        PatBlt(hdc, rect.x, rect.y, rect.dx, rect.dy, ROP_PATAND);
+        SelectObject(hdc, prevBrush);
+    }
+}
+
+// what's left to paint with GDI for a page after its tiles have been painted
+struct PageOverlay {
+    RectI   bounds;
+    UINT    renderDelay;
+    bool    renderOutOfDateCue;
+};
+
+// if canvas is set, everything possible is painted on the GPU and hdc is
+// (lazily) obtained from the canvas for painting the remaining overlays;
+// returns whether the painted content only depends on the document's position
+// (so that it can be scrolled along with the document, cf. ScrollBuffer)
+static bool DrawDocument(WindowInfo& win, HDC hdc, D2DCanvas *canvas, RECT *rcArea)
 {
     DisplayModel* dm = win.dm;
     AssertCrash(dm);
-    if (!dm) return;
+    if (!dm) return false;
+    CrashIf(!hdc == !canvas);
+
+    // everything outside of rcArea is expected to be up-to-date already
+    RectI area = RectI::FromRECT(*rcArea);
+    int savedDC = 0;
+    if (!canvas) {
+        savedDC = SaveDC(hdc);
+        IntersectClipRect(hdc, rcArea->left, rcArea->top, rcArea->right, rcArea->bottom);
+    }
+    bool scrollable = !win.fwdSearchMark.show && !gDebugShowLinks && !gDebugShowRenderStats;
 
     bool paintOnBlackWithoutShadow = win.presentation ||
     // draw comic books and single images on a black background (without frame and shadow)
                                      dm->engine && dm->engine->IsImageCollection();
-    if (paintOnBlackWithoutShadow) {
-        ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(WIN_COL_BLACK));
-        FillRect(hdc, rcArea, brush);
-    }
-    else if (0 == gGlobalPrefs->fixedPageUI.gradientColors->Count()) {
-        ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(GetNoDocBgColor()));
-        FillRect(hdc, rcArea, brush);
+    // over Remote Desktop, a gradient can't be scrolled along and compresses badly,
+    // so paint its first color only
+    bool isRemoteSession = GetSystemMetrics(SM_REMOTESESSION);
+    if (paintOnBlackWithoutShadow || 0 == gGlobalPrefs->fixedPageUI.gradientColors->Count() || isRemoteSession) {
+        COLORREF bgColor = paintOnBlackWithoutShadow ? WIN_COL_BLACK : GetNoDocBgColor();
+        if (!paintOnBlackWithoutShadow && gGlobalPrefs->fixedPageUI.gradientColors->Count() > 0)
+            bgColor = gGlobalPrefs->fixedPageUI.gradientColors->At(0);
+        if (canvas) {
+            canvas->FillRect(RectI::FromRECT(*rcArea), bgColor);
+        }
+        else {
+            ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(bgColor));
+            FillRect(hdc, rcArea, brush);
+        }
     }
     else {
         COLORREF colors[3];
@@ -2106,11 +2660,17 @@ static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
         }
         else
             gr[0].LowerRight = 3;
+        // the gradient is relative to the viewport
+        scrollable = false;
         // TODO: disable for less than about two screen heights?
-        GradientFill(hdc, tv, dimof(tv), gr, needCenter ? 2 : 1, GRADIENT_FILL_RECT_V);
+        if (canvas)
+            canvas->GradientFill(tv, dimof(tv), gr, needCenter ? 2 : 1);
+        else
+            GradientFill(hdc, tv, dimof(tv), gr, needCenter ? 2 : 1, GRADIENT_FILL_RECT_V);
     }
 
-    bool rendering = false;
+    // pages don't overlap, so all tiles can be painted before all the overlays
+    Vec<PageOverlay> overlays;
     RectI screen(PointI(), dm->viewPort.Size());
 
     for (int pageNo = 1; pageNo <= dm->PageCount(); ++pageNo) {
@@ -2124,17 +2684,48 @@ static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
         RectI bounds = pageInfo->pageOnScreen.Intersect(screen);
         // don't paint the frame background for images
         if (!(dm->engine && dm->engine->IsImageCollection()))
-            PaintPageFrameAndShadow(hdc, bounds, pageInfo->pageOnScreen, win.presentation);
+            PaintPageFrameAndShadow(hdc, canvas, bounds, pageInfo->pageOnScreen, win.presentation);
 
-        bool renderOutOfDateCue = false;
-        UINT renderDelay = 0;
+        PageOverlay overlay = { bounds, 0, false };
+        RectI tileBounds = bounds.Intersect(area);
         if (!DoCachePageRendering(&win, pageNo)) {
-            if (dm->engine)
+            // note: GetGpuCanvas doesn't return a canvas for image collections
+            if (dm->engine && hdc)
                 dm->engine->RenderPage(hdc, pageInfo->pageOnScreen, pageNo, dm->ZoomReal(pageNo), dm->Rotation());
         }
+        else if (tileBounds.IsEmpty())
+            continue;
+        else if (canvas)
+            overlay.renderDelay = gRenderCache.Paint(*canvas, tileBounds, dm, pageNo, pageInfo, &overlay.renderOutOfDateCue);
         else
-            renderDelay = gRenderCache.Paint(hdc, bounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
+            overlay.renderDelay = gRenderCache.Paint(hdc, tileBounds, dm, pageNo, pageInfo, &overlay.renderOutOfDateCue);
+        if (overlay.renderDelay || overlay.renderOutOfDateCue)
+            overlays.Append(overlay);
+        if (gStartupTime && !overlay.renderDelay) {
+            if (trace::gEnabled) {
+                LARGE_INTEGER now;
+                QueryPerformanceCounter(&now);
+                trace::Record("TimeToFirstPage", pageNo, gStartupTime, now.QuadPart);
+            }
+            gStartupTime = 0;
+        }
+    }
+    if (overlays.Count() > 0)
+        scrollable = false;
 
+    bool paintHighlights = win.userHighlightsOverlaid && win.userAnnots && win.userAnnots->Count() > 0;
+    if (canvas) {
+        bool needsGdi = overlays.Count() > 0 || paintHighlights || win.findAllMatches || win.showSelection ||
+                        win.fwdSearchMark.show || gDebugShowLinks || gDebugShowRenderStats;
+        hdc = needsGdi ? canvas->GetDC() : NULL;
+        if (!hdc)
+            return false;
+    }
+
+    bool rendering = false;
+    for (size_t i = 0; i < overlays.Count(); i++) {
+        RectI bounds = overlays.At(i).bounds;
+        UINT renderDelay = overlays.At(i).renderDelay;
         if (renderDelay) {
             ScopedFont fontRightTxt(GetSimpleFont(hdc, L"MS Shell Dlg", 14));
             HGDIOBJ hPrevFont = SelectObject(hdc, fontRightTxt);
@@ -2145,6 +2736,8 @@ static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
                 else
                     DrawCenteredText(hdc, bounds, _TR("Please wait - rendering..."), IsUIRightToLeft());
                 rendering = true;
+            } else if (dm->engine->IsStillLoading()) {
+                DrawCenteredText(hdc, bounds, _TR("Please wait - loading..."), IsUIRightToLeft());
             } else {
                 DrawCenteredText(hdc, bounds, _TR("Couldn't render the page"), IsUIRightToLeft());
             }
@@ -2152,7 +2745,7 @@ static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
             continue;
         }
 
-        if (!renderOutOfDateCue)
+        if (!overlays.At(i).renderOutOfDateCue)
             continue;
 
         HDC bmpDC = CreateCompatibleDC(hdc);
@@ -2168,6 +2761,12 @@ static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
         }
     }
 
+    if (paintHighlights)
+        PaintUserHighlights(win, hdc);
+
+    if (win.findAllMatches)
+        PaintFindAllMatches(&win, hdc);
+
     if (win.showSelection)
         PaintSelection(&win, hdc);
 
@@ -2176,6 +2775,24 @@ static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
 
     if (!rendering)
         DebugShowLinks(*dm, hdc);
+    DebugShowRenderStats(win, hdc);
+
+    if (savedDC)
+        RestoreDC(hdc, savedDC);
+    return scrollable;
+}
+
+// returns the canvas for painting the document on the GPU (or NULL for painting it with GDI)
+static D2DCanvas *GetGpuCanvas(WindowInfo& win)
+{
+    // images are partially painted straight from the engine (cf. DoCachePageRendering)
+    if (!gGlobalPrefs->useGpuCanvas || !win.dm->engine || win.dm->engine->IsImageCollection()) {
+        delete win.canvas;
+        win.canvas = NULL;
+    }
+    else if (!win.canvas)
+        win.canvas = D2DCanvas::Create(win.hwndCanvas);
+    return win.canvas;
 }
 
 static void RerenderEverything()
@@ -2218,6 +2835,28 @@ void UpdateDocumentColors()
     RerenderEverything();
 }
 
+void UpdateRenderCacheSize()
+{
+    // the new limit applies as soon as the next page has been rendered
+    gRenderCache.maxMemoryMB = gGlobalPrefs->bitmapCacheSize;
+    SetDisplayListCacheSize(gGlobalPrefs->displayListCacheSize);
+    SetGlyphCacheSize(gGlobalPrefs->glyphCacheSize);
+    SetResourceCacheSize(gGlobalPrefs->resourceCacheSize);
+    SetMemoryMapLargeFiles(gGlobalPrefs->memoryMapLargeFiles);
+}
+
+// returns how much memory a window's document takes up, including its
+// cached bitmaps and text (cf. BaseEngine::GetMemoryUsage)
+size_t GetDocumentMemoryUsage(DisplayModel *dm)
+{
+    size_t mem = gRenderCache.GetMemoryUsage(dm);
+    if (dm->engine)
+        mem += dm->engine->GetMemoryUsage();
+    if (dm->textCache)
+        mem += dm->textCache->GetMemoryUsage();
+    return mem;
+}
+
 #if defined(SHOW_DEBUG_MENU_ITEMS) || defined(DEBUG)
 static void ToggleGdiDebugging()
 {
@@ -2562,11 +3201,47 @@ static void OnMouseRightButtonDblClick(WindowInfo& win, int x, int y, WPARAM key
     }
 }
 
+// scrolls the content of win.buffer along with the document, so that only the
+// newly exposed strips have to be painted; returns false if the buffer's content
+// can't be reused (in which case it has to be repainted completely)
+static bool ScrollBuffer(WindowInfo& win)
+{
+    DisplayModel *dm = win.dm;
+    if (!win.bufferScrollable || win.bufferLayoutCount != dm->GetLayoutCount())
+        return false;
+    int dx = dm->viewPort.x - win.bufferViewPortPos.x;
+    int dy = dm->viewPort.y - win.bufferViewPortPos.y;
+    SizeI size = win.canvasRc.Size();
+    if (abs(dx) >= size.dx || abs(dy) >= size.dy)
+        return false;
+
+    HDC hdc = win.buffer->GetDC();
+    RECT rcBuffer = RectI(PointI(), size).ToRECT();
+    if ((dx || dy) && !ScrollDC(hdc, -dx, -dy, &rcBuffer, &rcBuffer, NULL, NULL))
+        return false;
+    RectI exposed[2] = {
+        RectI(0, dy > 0 ? size.dy - dy : 0, size.dx, abs(dy)),
+        RectI(dx > 0 ? size.dx - dx : 0, 0, abs(dx), size.dy)
+    };
+    for (size_t i = 0; i < dimof(exposed); i++) {
+        RECT rc = exposed[i].ToRECT();
+        if (!exposed[i].IsEmpty() && !DrawDocument(win, hdc, NULL, &rc))
+            return false;
+    }
+    return true;
+}
+
 static void OnPaint(WindowInfo& win)
 {
+    TRACE_SCOPE("Paint");
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(win.hwndCanvas, &ps);
 
+    bool scrollPending = win.scrollPending;
+    bool bufferScrollable = win.bufferScrollable;
+    win.scrollPending = false;
+    win.bufferScrollable = false;
+
     if (win.IsAboutWindow()) {
         if (HasPermission(Perm_SavePreferences | Perm_DiskAccess) && gGlobalPrefs->rememberOpenedFiles && gGlobalPrefs->showStartPage) {
             DrawStartPage(win, win.buffer->GetDC(), gFileHistory, gRenderCache.textColor, gRenderCache.backgroundColor);
@@ -2596,8 +3271,24 @@ static void OnPaint(WindowInfo& win)
             FillRect(hdc, &ps.rcPaint, GetStockBrush(WHITE_BRUSH));
             break;
         default:
-            DrawDocument(win, win.buffer->GetDC(), &ps.rcPaint);
-            win.buffer->Flush(hdc);
+            D2DCanvas *canvas = GetGpuCanvas(win);
+            if (canvas && canvas->BeginDraw()) {
+                // the canvas always has to be painted completely
+                RECT rcCanvas = ClientRect(win.hwndCanvas).ToRECT();
+                DrawDocument(win, NULL, canvas, &rcCanvas);
+                if (!canvas->EndDraw())
+                    win.RepaintAsync();
+            }
+            else {
+                win.bufferScrollable = bufferScrollable;
+                if (scrollPending && ScrollBuffer(win))
+                    win.bufferScrollable = true;
+                else
+                    win.bufferScrollable = DrawDocument(win, win.buffer->GetDC(), NULL, &ps.rcPaint);
+                win.bufferViewPortPos = win.dm->viewPort.TL();
+                win.bufferLayoutCount = win.dm->GetLayoutCount();
+                win.buffer->Flush(hdc);
+            }
         }
     }
 
@@ -2617,6 +3308,7 @@ void OnMenuExit()
                 return;
         }
         AbortFinding(win);
+        ClearFindAllMatches(win);
         AbortPrinting(win);
     }
 
@@ -2641,6 +3333,8 @@ void CloseDocumentInWindow(WindowInfo *win)
     SetSidebarVisibility(win, false, gGlobalPrefs->showFavorites);
     ClearTocBox(win);
     AbortFinding(win, true);
+    ClearFindAllMatches(win);
+    FlushDelayedCopy(win);
     delete win->linkOnLastButtonDown;
     win->linkOnLastButtonDown = NULL;
     if (win->uia_provider)
@@ -2652,6 +3346,7 @@ void CloseDocumentInWindow(WindowInfo *win)
     win->pdfsync = NULL;
     delete win->userAnnots;
     win->userAnnots = NULL;
+    win->userHighlightsOverlaid = false;
     win->notifications->RemoveAllInGroup(NG_RESPONSE_TO_ACTION);
     win->notifications->RemoveAllInGroup(NG_PAGE_INFO_HELPER);
     win->mouseAction = MA_IDLE;
@@ -2684,6 +3379,76 @@ void QuitIfNoMoreWindows()
     }
 }
 
+// prepares the resources needed for the next document
+// while a resident instance waits in the notification area
+class EnginePreloadingThread : public ThreadBase {
+public:
+    EnginePreloadingThread() : ThreadBase("EnginePreloadingThread") { }
+    virtual ~EnginePreloadingThread() { }
+
+    virtual void Run() {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+        PreloadPdfEngineResources();
+        delete this;
+    }
+};
+
+// hides an about window and waits for the next document in the notification area
+static void HideInTray(WindowInfo *win)
+{
+    CrashIf(!win->IsAboutWindow());
+    ShowWindow(win->hwndFrame, SW_HIDE);
+    if (!gHwndTrayIcon && AddTrayIcon(win->hwndFrame))
+        gHwndTrayIcon = win->hwndFrame;
+    if (!gMsgTaskbarCreated)
+        gMsgTaskbarCreated = RegisterWindowMessage(L"TaskbarCreated");
+    // the first page of the next PDF document appears
+    // faster with fonts and a context already loaded
+    (new EnginePreloadingThread())->Start();
+}
+
+static void ShowFromTray(WindowInfo *win)
+{
+    RemoveTrayIcon();
+    if (!IsWindowVisible(win->hwndFrame)) {
+        bool maximize = WIN_STATE_MAXIMIZED == gGlobalPrefs->windowState ||
+                        WIN_STATE_FULLSCREEN == gGlobalPrefs->windowState;
+        ShowWindow(win->hwndFrame, maximize ? SW_MAXIMIZE : SW_SHOW);
+    }
+    SetForegroundWindow(win->hwndFrame);
+}
+
+static LRESULT OnTrayIcon(WindowInfo *win, LPARAM lParam)
+{
+    if (!win)
+        return 0;
+    switch (lParam) {
+    case WM_LBUTTONUP:
+    case WM_LBUTTONDBLCLK:
+        ShowFromTray(win);
+        break;
+    case WM_RBUTTONUP:
+    case WM_CONTEXTMENU:
+        OnTrayIconContextMenu(win);
+        break;
+    }
+    return 0;
+}
+
+// in resident mode, creates a hidden about window to wait in the notification
+// area once the last window has been closed (returns false if SumatraPDF should quit)
+bool StayResidentInTray()
+{
+    if (!gResidentMode || TotalWindowsCount() > 0)
+        return false;
+    WindowInfo *win = CreateWindowInfo();
+    if (!win)
+        return false;
+    UpdateToolbarAndScrollbarState(*win);
+    HideInTray(win);
+    return true;
+}
+
 void CloseDocumentAndDeleteWindowInfo(WindowInfo *win)
 {
     if (!win)
@@ -2716,6 +3481,19 @@ void CloseWindow(WindowInfo *win, bool quitIfLast, bool forceClose)
             return;
     }
 
+    // LoadEngineInBackground is still using win, so only
+    // close the window once loading has been canceled
+    if (win->engineLoader) {
+        win->engineLoader->Cancel();
+        if (forceClose)
+            /* the window has already been destroyed */;
+        else if (quitIfLast)
+            PostMessage(win->hwndFrame, WM_CLOSE, 0, 0);
+        else
+            PostMessage(win->hwndFrame, WM_COMMAND, IDM_CLOSE, 0);
+        return;
+    }
+
     if (win->userAnnotsModified) {
         // TODO: warn about unsaved changes
     }
@@ -2726,6 +3504,8 @@ void CloseWindow(WindowInfo *win, bool quitIfLast, bool forceClose)
         ExitFullScreen(*win);
 
     bool lastWindow = (1 == TotalWindowsCount());
+    // a resident instance keeps its last window (hidden) for the next document
+    bool stayResident = lastWindow && quitIfLast && !forceClose && gResidentMode;
     // hide the window before saving prefs (closing seems slightly faster that way)
     if (lastWindow && quitIfLast && !forceClose)
         ShowWindow(win->hwndFrame, SW_HIDE);
@@ -2737,7 +3517,7 @@ void CloseWindow(WindowInfo *win, bool quitIfLast, bool forceClose)
     if (forceClose) {
         // WM_DESTROY has already been sent, so don't destroy win->hwndFrame again
         DeleteWindowInfo(win);
-    } else if (lastWindow && !quitIfLast) {
+    } else if (lastWindow && (!quitIfLast || stayResident)) {
         /* last window - don't delete it */
         CloseDocumentInWindow(win);
     } else {
@@ -2746,7 +3526,10 @@ void CloseWindow(WindowInfo *win, bool quitIfLast, bool forceClose)
         DestroyWindow(hwndToDestroy);
     }
 
-    if (lastWindow && quitIfLast) {
+    if (stayResident) {
+        UpdateToolbarAndScrollbarState(*win);
+        HideInTray(win);
+    } else if (lastWindow && quitIfLast) {
         AssertCrash(0 == gWindows.Count());
         PostQuitMessage(0);
     } else if (lastWindow && !quitIfLast) {
@@ -2779,6 +3562,19 @@ static bool AppendFileFilterForDoc(DisplayModel *dm, str::Str<WCHAR>& fileFilter
     return true;
 }
 
+// concatenates the text of all pages
+class TextJoiner : public TextExtractionSink {
+    str::Str<WCHAR>& text;
+
+public:
+    explicit TextJoiner(str::Str<WCHAR>& text) : text(text) { }
+    virtual bool PageTextExtracted(int pageNo, WCHAR *pageText, RectI *coords) {
+        text.AppendAndFree(pageText);
+        free(coords);
+        return true;
+    }
+};
+
 static void OnMenuSaveAs(WindowInfo& win)
 {
     if (!HasPermission(Perm_DiskAccess)) return;
@@ -2875,10 +3671,8 @@ static void OnMenuSaveAs(WindowInfo& win)
     if (hasCopyPerm && str::EndsWithI(realDstFileName, L".txt") &&
         (2 == ofn.nFilterIndex || Engine_Txt != win.dm->engineType)) {
         str::Str<WCHAR> text(1024);
-        for (int pageNo = 1; pageNo <= win.dm->PageCount(); pageNo++) {
-            WCHAR *tmp = win.dm->engine->ExtractPageText(pageNo, L"\r\n", NULL, Target_Export);
-            text.AppendAndFree(tmp);
-        }
+        TextJoiner joiner(text);
+        win.dm->engine->ExtractTextRange(1, win.dm->PageCount(), L"\r\n", &joiner, false, Target_Export);
 
         ScopedMem<char> textUTF8(str::conv::ToUtf8(text.LendData()));
         ScopedMem<char> textUTF8BOM(str::Join(UTF8_BOM, textUTF8));
@@ -2930,12 +3724,11 @@ static void OnMenuSaveAs(WindowInfo& win)
         free(realDstFileName);
 }
 
-bool LinkSaver::SaveEmbedded(const unsigned char *data, size_t len)
+bool LinkSaver::AskForFileName()
 {
     if (!HasPermission(Perm_DiskAccess))
         return false;
 
-    WCHAR dstFileName[MAX_PATH];
     str::BufSet(dstFileName, dimof(dstFileName), fileName ? fileName : L"");
     CrashIf(fileName && str::FindChar(fileName, '/'));
 
@@ -2954,15 +3747,70 @@ bool LinkSaver::SaveEmbedded(const unsigned char *data, size_t len)
     ofn.nFilterIndex = 1;
     ofn.Flags = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
 
-    bool ok = GetSaveFileName(&ofn);
-    if (!ok)
+    return GetSaveFileName(&ofn);
+}
+
+bool LinkSaver::SaveEmbedded(const unsigned char *data, size_t len)
+{
+    if (!AskForFileName())
         return false;
-    ok = file::WriteAll(dstFileName, data, len);
+    bool ok = file::WriteAll(dstFileName, data, len);
     if (ok && IsUntrustedFile(owner->dm ? owner->dm->FilePath() : owner->loadedFilePath, gPluginURL))
         file::SetZoneIdentifier(dstFileName);
     return ok;
 }
 
+// attachments larger than this display their saving progress
+#define SAVE_PROGRESS_MIN_SIZE (8 * 1024 * 1024)
+
+bool LinkSaver::StartSaveEmbedded(size_t totalSize)
+{
+    if (!AskForFileName())
+        return false;
+    hFile = CreateFile(dstFileName, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                       CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == hFile)
+        return false;
+    this->totalSize = totalSize;
+    savedSize = 0;
+    if (totalSize >= SAVE_PROGRESS_MIN_SIZE) {
+        // (the progress message is a format string for the percentage)
+        ScopedMem<WCHAR> name(str::Replace(path::GetBaseName(dstFileName), L"%", L"%%"));
+        ScopedMem<WCHAR> progressMsg(str::Format(L"%s: %%d %%%%", name.Get()));
+        progress = new NotificationWnd(owner->hwndCanvas, L"", progressMsg, owner->notifications);
+        owner->notifications->Add(progress);
+    }
+    return true;
+}
+
+bool LinkSaver::SaveEmbeddedChunk(const unsigned char *data, size_t len)
+{
+    DWORD written;
+    if (!WriteFile(hFile, data, (DWORD)len, &written, NULL) || written != len)
+        return false;
+    savedSize += len;
+    if (progress && owner->notifications->Contains(progress)) {
+        // saving happens on the UI thread, so repaint the notification right away
+        progress->UpdateProgress((int)(100.0 * min(savedSize, totalSize) / totalSize), 100);
+        UpdateWindow(progress->hwnd());
+    }
+    return true;
+}
+
+bool LinkSaver::FinishSaveEmbedded(bool ok)
+{
+    CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+    if (progress && owner->notifications->Contains(progress))
+        owner->notifications->RemoveNotification(progress);
+    progress = NULL;
+    if (!ok)
+        file::Delete(dstFileName);
+    else if (IsUntrustedFile(owner->dm ? owner->dm->FilePath() : owner->loadedFilePath, gPluginURL))
+        file::SetZoneIdentifier(dstFileName);
+    return ok;
+}
+
 static void OnMenuRenameFile(WindowInfo &win)
 {
     if (!HasPermission(Perm_DiskAccess)) return;
@@ -3415,6 +4263,8 @@ void OnMenuAdvancedOptions()
     if (!HasPermission(Perm_DiskAccess) || !HasPermission(Perm_SavePreferences))
         return;
 
+    // make sure that the file is up-to-date
+    prefs::Flush();
     ScopedMem<WCHAR> path(prefs::GetSettingsPath());
     // TODO: disable/hide the menu item when there's no prefs file
     //       (happens e.g. when run in portable mode from a CD)?
@@ -3965,11 +4815,14 @@ static void FrameOnChar(WindowInfo& win, WPARAM key)
             for (size_t i = 0; i < win.selectionOnPage->Count(); i++) {
                 SelectionOnPage& sel = win.selectionOnPage->At(i);
                 win.userAnnots->Append(PageAnnotation(Annot_Highlight, sel.pageNo, sel.rect, PageAnnotation::Color(gGlobalPrefs->annotationDefaults.highlightColor, 0xCC)));
-                gRenderCache.Invalidate(win.dm, sel.pageNo, sel.rect);
+                if (!win.userHighlightsOverlaid)
+                    gRenderCache.Invalidate(win.dm, sel.pageNo, sel.rect);
             }
             win.userAnnotsModified = true;
             win.dm->engine->UpdateUserAnnotations(win.userAnnots);
-            ClearSearchResult(&win); // causes invalidated tiles to be rerendered
+            // causes invalidated tiles to be rerendered
+            // (or only the highlight overlay to be repainted)
+            ClearSearchResult(&win);
         }
 #endif
     }
@@ -4386,6 +5239,26 @@ static LRESULT OnSetCursor(WindowInfo& win, HWND hwnd)
     return FALSE;
 }
 
+// while zooming continuously (with Ctrl+wheel or a zoom gesture), the pages
+// are painted by scaling the already rendered bitmaps and are only rendered
+// anew once there's been no further zooming for DEFER_RENDERING_DELAY_IN_MS
+static void DeferRendering(WindowInfo& win, bool defer)
+{
+    if (!win.IsDocLoaded())
+        return;
+    if (defer) {
+        win.dm->deferRendering = true;
+        SetTimer(win.hwndCanvas, DEFER_RENDERING_TIMER_ID, DEFER_RENDERING_DELAY_IN_MS, NULL);
+        return;
+    }
+    KillTimer(win.hwndCanvas, DEFER_RENDERING_TIMER_ID);
+    if (!win.dm->deferRendering)
+        return;
+    win.dm->deferRendering = false;
+    // painting requests rendering for all visible tiles
+    win.RepaintAsync();
+}
+
 static void OnTimer(WindowInfo& win, HWND hwnd, WPARAM timerId)
 {
     POINT pt;
@@ -4394,7 +5267,8 @@ static void OnTimer(WindowInfo& win, HWND hwnd, WPARAM timerId)
     case REPAINT_TIMER_ID:
         win.delayedRepaintTimer = 0;
         KillTimer(hwnd, REPAINT_TIMER_ID);
-        win.RedrawAll();
+        // note: RedrawAll would prevent scrolling the buffer
+        InvalidateRect(hwnd, NULL, FALSE);
         break;
 
     case SMOOTHSCROLL_TIMER_ID:
@@ -4437,6 +5311,10 @@ static void OnTimer(WindowInfo& win, HWND hwnd, WPARAM timerId)
         ReloadDocument(&win, true);
         break;
 
+    case DEFER_RENDERING_TIMER_ID:
+        DeferRendering(win, false);
+        break;
+
     default:
         OnStressTestTimer(&win, (int)timerId);
         break;
@@ -4473,6 +5351,7 @@ static LRESULT CanvasOnMouseWheel(WindowInfo& win, UINT message, WPARAM wParam,
 
         float zoom = win.dm->NextZoomStep(delta < 0 ? ZOOM_MIN : ZOOM_MAX);
         PointI tmpPoint(pt.x, pt.y);
+        DeferRendering(win, true);
         win.dm->ZoomTo(zoom, &tmpPoint);
         UpdateToolbarState(&win);
 
@@ -4592,8 +5471,11 @@ static LRESULT OnGesture(WindowInfo& win, UINT message, WPARAM wParam, LPARAM lP
         case GID_ZOOM:
             if (gi.dwFlags != GF_BEGIN) {
                 float zoom = (float)LODWORD(gi.ullArguments) / (float)win.touchState.startArg;
+                DeferRendering(win, true);
                 ZoomToSelection(&win, zoom, false, true);
             }
+            if ((gi.dwFlags & GF_END))
+                DeferRendering(win, false);
             win.touchState.startArg = LODWORD(gi.ullArguments);
             break;
 
@@ -4798,16 +5680,20 @@ class RepaintCanvasTask : public UITask
 {
     UINT delay;
     WindowInfo *win;
+    bool scrolled;
 
 public:
-    RepaintCanvasTask(WindowInfo *win, UINT delay)
-        : win(win), delay(delay) {
+    RepaintCanvasTask(WindowInfo *win, UINT delay, bool scrolled=false)
+        : win(win), delay(delay), scrolled(scrolled) {
         name = "RepaintCanvasTask";
     }
 
     virtual void Execute() {
         if (!WindowInfoStillValid(win))
             return;
+        // (only modified on the UI thread)
+        if (!scrolled)
+            win->bufferScrollable = false;
         if (!delay)
             WndProcCanvas(win->hwndCanvas, WM_TIMER, REPAINT_TIMER_ID, 0);
         else if (!win->delayedRepaintTimer)
@@ -4822,6 +5708,12 @@ void WindowInfo::RepaintAsync(UINT delay)
     uitask::Post(new RepaintCanvasTask(this, delay));
 }
 
+void WindowInfo::RepaintScrolled()
+{
+    scrollPending = true;
+    uitask::Post(new RepaintCanvasTask(this, 0, true));
+}
+
 // Tests that various ways to crash will generate crash report.
 // Commented-out because they are ad-hoc. Left in code because
 // I don't want to write them again if I ever need to test crash reporting
@@ -5196,6 +6088,18 @@ static LRESULT FrameOnCommand(WindowInfo *win, HWND hwnd, UINT msg, WPARAM wPara
             ToggleGdiDebugging();
             break;
 
+        case IDM_DEBUG_RENDER_STATS:
+            {
+                // also dump the statistics to the debug log for later comparison
+                // (dbglog::LogF would truncate them)
+                ScopedMem<WCHAR> stats(gRenderCache.GetStats());
+                OutputDebugStringW(stats);
+                gDebugShowRenderStats = !gDebugShowRenderStats;
+                for (size_t i = 0; i < gWindows.Count(); i++)
+                    gWindows.At(i)->RedrawAll(true);
+            }
+            break;
+
         case IDM_DEBUG_EBOOK_UI:
             gGlobalPrefs->ebookUI.useFixedPageUI = !gGlobalPrefs->ebookUI.useFixedPageUI;
             // use the same setting to also toggle the CHM UI
@@ -5393,6 +6297,24 @@ InitMouseWheelInfo:
             CloseWindow(win, true);
             break;
 
+        // cf. CopySelectionToClipboard
+        case WM_RENDERFORMAT:
+            if (win && CF_UNICODETEXT == wParam)
+                RenderDelayedCopy(win);
+            break;
+
+        case WM_RENDERALLFORMATS:
+            if (win)
+                FlushDelayedCopy(win);
+            break;
+
+        case WM_DESTROYCLIPBOARD:
+            if (win) {
+                delete win->delayedCopy;
+                win->delayedCopy = NULL;
+            }
+            break;
+
         case WM_DESTROY:
             /* WM_DESTROY is generated by windows when close button is pressed
                or if we explicitly call DestroyWindow()
@@ -5405,6 +6327,7 @@ InitMouseWheelInfo:
         case WM_ENDSESSION:
             // TODO: check for unfinished print jobs in WM_QUERYENDSESSION?
             prefs::Save();
+            prefs::Flush();
             break;
 
         case WM_DDE_INITIATE:
@@ -5426,18 +6349,37 @@ InitMouseWheelInfo:
                 return MA_ACTIVATEANDEAT;
             return MA_ACTIVATE;
 
+        case UWM_TRAY_ICON:
+            return OnTrayIcon(win, lParam);
+
         default:
+            if (gMsgTaskbarCreated && msg == gMsgTaskbarCreated && hwnd == gHwndTrayIcon) {
+                // Explorer has been restarted and lost the notification area icon
+                if (!AddTrayIcon(hwnd))
+                    gHwndTrayIcon = NULL;
+                break;
+            }
             return DefWindowProc(hwnd, msg, wParam, lParam);
     }
     return 0;
 }
 
-static int RunMessageLoop()
+// idleTask is executed (and deleted) once all messages pending at startup
+// (including WM_PAINT for the first window) have been processed
+static int RunMessageLoop(UITask *idleTask=NULL)
 {
     HACCEL accTable = LoadAccelerators(ghinst, MAKEINTRESOURCE(IDC_SUMATRAPDF));
     MSG msg = { 0 };
 
-    while (GetMessage(&msg, NULL, 0, 0)) {
+    for (;;) {
+        if (idleTask && !PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE)) {
+            idleTask->Execute();
+            delete idleTask;
+            idleTask = NULL;
+        }
+        if (!GetMessage(&msg, NULL, 0, 0))
+            break;
+
         // dispatch the accelerator to the correct window
         WindowInfo *win = FindWindowInfoByHwnd(msg.hwnd);
         HWND accHwnd = win ? win->hwndFrame : msg.hwnd;
@@ -5447,6 +6389,7 @@ static int RunMessageLoop()
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
+    delete idleTask;
 
     return (int)msg.wParam;
 }
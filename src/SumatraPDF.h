@@ -68,17 +68,20 @@ enum MenuToolbarFlags {
 
 class WindowInfo;
 class EbookWindow;
+class DisplayModel;
 class Favorites;
 
 // all defined in SumatraPDF.cpp
 extern HINSTANCE                ghinst;
 extern bool                     gDebugShowLinks;
+extern bool                     gDebugShowRenderStats;
 extern bool                     gUseGdiRenderer;
 extern HCURSOR                  gCursorHand;
 extern HCURSOR                  gCursorArrow;
 extern HCURSOR                  gCursorIBeam;
 extern HFONT                    gDefaultGuiFont;
 extern WCHAR *                  gPluginURL;
+extern bool                     gResidentMode;
 extern Vec<WindowInfo*>         gWindows;
 extern Vec<EbookWindow*>        gEbookWindows;
 extern Favorites                gFavorites;
@@ -102,6 +105,8 @@ bool  WindowInfoStillValid(WindowInfo *win);
 void  SetCurrentLanguageAndRefreshUi(const char *langCode);
 void  ShowOrHideToolbarGlobally();
 void  UpdateDocumentColors();
+void  UpdateRenderCacheSize();
+size_t GetDocumentMemoryUsage(DisplayModel *dm);
 void  UpdateCurrentFileDisplayStateForWin(const SumatraWindow& win);
 bool  FrameOnKeydown(WindowInfo* win, WPARAM key, LPARAM lparam, bool inTextfield=false);
 void  SwitchToDisplayMode(WindowInfo *win, DisplayMode displayMode, bool keepContinuous=false);
@@ -120,6 +125,7 @@ void  CloseDocumentInWindow(WindowInfo *win);
 void  CloseDocumentAndDeleteWindowInfo(WindowInfo *win);
 void  OnMenuAbout();
 void  QuitIfNoMoreWindows();
+bool  StayResidentInTray();
 bool  ShouldSaveThumbnail(DisplayState& ds);
 void  SaveThumbnailForFile(const WCHAR *filePath, RenderedBitmap *bmp);
 
@@ -138,7 +144,7 @@ struct LoadArgs
 {
     LoadArgs(const WCHAR *fileName, WindowInfo *win=NULL) :
         fileName(fileName), win(win), showWin(true), forceReuse(false),
-        isNewWindow(false), allowFailure(true), placeWindow(true) { }
+        isNewWindow(false), allowFailure(true), placeWindow(true), canceled(false) { }
 
     const WCHAR *fileName;
     WindowInfo *win;
@@ -148,6 +154,8 @@ struct LoadArgs
     bool isNewWindow;
     bool allowFailure;
     bool placeWindow;
+    // set if the user canceled loading the document
+    bool canceled;
 };
 
 WindowInfo* LoadDocument(LoadArgs& args);
@@ -432,6 +432,11 @@ static void GetProps(Doc doc, PropertiesLayout *layoutData, DisplayModel *dm, bo
         layoutData->AddProperty(_TR("Page Size:"), str);
     }
 
+    if (dm) {
+        str = FormatSizeSuccint(GetDocumentMemoryUsage(dm));
+        layoutData->AddProperty(_TR("Memory Usage:"), str);
+    }
+
     str = FormatPermissions(doc);
     layoutData->AddProperty(_TR("Denied Permissions:"), str);
 
@@ -130,35 +130,56 @@ static bool InstanceInit(HINSTANCE hInstance, int nCmdShow)
     return true;
 }
 
-static void OpenUsingDde(const WCHAR *filePath, CommandLineInfo& i, bool isFirstWin)
+// the commands for making a previously running instance open filePath
+static void AppendOpenCmds(str::Str<WCHAR>& cmds, const WCHAR *filePath, CommandLineInfo& i, bool isFirstWin)
 {
-    // delegate file opening to a previously running instance by sending a DDE message
     WCHAR fullpath[MAX_PATH];
     GetFullPathName(filePath, dimof(fullpath), fullpath, NULL);
 
-    ScopedMem<WCHAR> cmd(str::Format(L"[" DDECOMMAND_OPEN L"(\"%s\", 0, 1, 0)]", fullpath));
-    DDEExecute(PDFSYNC_DDE_SERVICE, PDFSYNC_DDE_TOPIC, cmd);
-    if (i.destName && isFirstWin) {
-        cmd.Set(str::Format(L"[" DDECOMMAND_GOTO L"(\"%s\", \"%s\")]", fullpath, i.destName));
-        DDEExecute(PDFSYNC_DDE_SERVICE, PDFSYNC_DDE_TOPIC, cmd);
-    }
-    else if (i.pageNumber > 0 && isFirstWin) {
-        cmd.Set(str::Format(L"[" DDECOMMAND_PAGE L"(\"%s\", %d)]", fullpath, i.pageNumber));
-        DDEExecute(PDFSYNC_DDE_SERVICE, PDFSYNC_DDE_TOPIC, cmd);
-    }
+    cmds.AppendFmt(L"[" DDECOMMAND_OPEN L"(\"%s\", 0, 1, 0)]", fullpath);
+    if (i.destName && isFirstWin)
+        cmds.AppendFmt(L"[" DDECOMMAND_GOTO L"(\"%s\", \"%s\")]", fullpath, i.destName);
+    else if (i.pageNumber > 0 && isFirstWin)
+        cmds.AppendFmt(L"[" DDECOMMAND_PAGE L"(\"%s\", %d)]", fullpath, i.pageNumber);
     if ((i.startView != DM_AUTOMATIC || i.startZoom != INVALID_ZOOM ||
             i.startScroll.x != -1 && i.startScroll.y != -1) && isFirstWin) {
         const WCHAR *viewMode = prefs::conv::FromDisplayMode(i.startView);
-        cmd.Set(str::Format(L"[" DDECOMMAND_SETVIEW L"(\"%s\", \"%s\", %.2f, %d, %d)]",
-                                    fullpath, viewMode, i.startZoom, i.startScroll.x, i.startScroll.y));
-        DDEExecute(PDFSYNC_DDE_SERVICE, PDFSYNC_DDE_TOPIC, cmd);
+        cmds.AppendFmt(L"[" DDECOMMAND_SETVIEW L"(\"%s\", \"%s\", %.2f, %d, %d)]",
+                       fullpath, viewMode, i.startZoom, i.startScroll.x, i.startScroll.y);
     }
     if (i.forwardSearchOrigin && i.forwardSearchLine) {
         ScopedMem<WCHAR> sourcePath(path::Normalize(i.forwardSearchOrigin));
-        cmd.Set(str::Format(L"[" DDECOMMAND_SYNC L"(\"%s\", \"%s\", %d, 0, 0, 1)]",
-                                    fullpath, sourcePath, i.forwardSearchLine));
-        DDEExecute(PDFSYNC_DDE_SERVICE, PDFSYNC_DDE_TOPIC, cmd);
+        cmds.AppendFmt(L"[" DDECOMMAND_SYNC L"(\"%s\", \"%s\", %d, 0, 0, 1)]",
+                       fullpath, sourcePath, i.forwardSearchLine);
+    }
+}
+
+static void OpenUsingDde(const WCHAR *filePath, CommandLineInfo& i, bool isFirstWin)
+{
+    // delegate file opening to a previously running instance by sending a DDE message
+    str::Str<WCHAR> cmds;
+    AppendOpenCmds(cmds, filePath, i, isFirstWin);
+    DDEExecute(PDFSYNC_DDE_SERVICE, PDFSYNC_DDE_TOPIC, cmds.Get());
+}
+
+// hands the files to open over to an already running instance through its
+// command pipe, before doing any initialization (which would only be
+// needed for showing them in this instance)
+static bool HandOverToRunningInstance()
+{
+    CommandLineInfo i;
+    i.ParseCommandLine(GetCommandLine());
+    if (i.fileNames.Count() == 0 || i.printDialog || i.printerName || i.hwndPluginParent ||
+        i.makeDefault || i.showConsole || i.exitImmediately || i.tracePath || i.stressTestPath ||
+        i.pathsToBenchmark.Count() > 0 || i.benchSuitePath || i.benchCompareOld || i.concurrentStressPath) {
+        return false;
+    }
+
+    str::Str<WCHAR> cmds;
+    for (size_t n = 0; n < i.fileNames.Count(); n++) {
+        AppendOpenCmds(cmds, i.fileNames.At(n), i, 0 == n);
     }
+    return SendCommandPipeMessage(cmds.Get(), i.reuseInstance);
 }
 
 static WindowInfo *LoadOnStartup(const WCHAR *filePath, CommandLineInfo& i, bool isFirstWin)
@@ -215,6 +236,10 @@ static bool SetupPluginMode(CommandLineInfo& i)
     while (i.fileNames.Count() > 1) {
         free(i.fileNames.Pop());
     }
+    // the plugin launches us as soon as the beginning of a linearized PDF document
+    // has been downloaded, so that its first page can be displayed right away
+    if (i.pluginFileSize > 0)
+        PdfEngine::SetFileStillGrowing(i.fileNames.At(0), i.pluginFileSize);
 
     // don't save preferences for plugin windows (and don't allow fullscreen mode)
     // TODO: Perm_DiskAccess is required for saving viewed files and
@@ -286,10 +311,49 @@ static void SetupCrashHandler()
     InstallCrashHandler(crashDumpPath, symDir);
 }
 
+// initialization which isn't needed for showing the first document
+// (executed once the first window has been painted, cf. RunMessageLoop)
+class DeferredStartupTask : public UITask {
+    bool showStartPage;
+
+public:
+    explicit DeferredStartupTask(bool showStartPage) : showStartPage(showStartPage) {
+        name = "DeferredStartupTask";
+    }
+
+    virtual void Execute() {
+        TRACE_SCOPE("DeferredStartup");
+        // Make sure that we're still registered as default,
+        // if the user has explicitly told us to be
+        if (gGlobalPrefs->associatedExtensions && gWindows.Count() > 0)
+            RegisterForPdfExtentions(gWindows.At(0)->hwndFrame);
+
+        if (gGlobalPrefs->checkForUpdates && gWindows.Count() > 0)
+            AutoUpdateCheckAsync(gWindows.At(0)->hwndFrame, true);
+
+        DeferThumbnailLoading(false);
+        // only hide newly missing files when showing the start page on startup
+        if (showStartPage && gFileHistory.Get(0)) {
+            gFileExistenceChecker = new FileExistenceChecker();
+            gFileExistenceChecker->Start();
+        }
+        gMemoryPressureWatcher = new MemoryPressureWatcher();
+        gMemoryPressureWatcher->Start();
+        // call this once it's clear whether Perm_SavePreferences has been granted
+        prefs::RegisterForFileChanges();
+        // and this once it's clear whether Perm_InternetAccess has been granted
+        SubmitPendingCrashInfo();
+    }
+};
+
 int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
 {
     int retCode = 1;    // by default it's error
 
+    LARGE_INTEGER startupTime;
+    QueryPerformanceCounter(&startupTime);
+    gStartupTime = startupTime.QuadPart;
+
 #ifdef DEBUG
     // Memory leak detection (only enable _CRTDBG_LEAK_CHECK_DF for
     // regular termination so that leaks aren't checked on exceptions,
@@ -327,6 +391,9 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
     }
 #endif
 
+    if (HandOverToRunningInstance())
+        return 0;
+
     srand((unsigned int)time(NULL));
 
     // load uiautomationcore.dll before installing crash handler (i.e. initializing
@@ -348,6 +415,13 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 
     CommandLineInfo i;
     GetCommandLineInfo(i);
+    if (i.tracePath) {
+        trace::Start(i.tracePath);
+        // everything up to here can't be traced in more detail
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        trace::Record("StartupInit", -1, gStartupTime, now.QuadPart);
+    }
 
     SetCurrentLang(i.lang ? i.lang : gGlobalPrefs->uiLanguage);
 
@@ -355,11 +429,16 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
         RedirectIOToConsole();
     if (i.makeDefault)
         AssociateExeWithPdfExtension();
-    if (i.pathsToBenchmark.Count() > 0) {
-        BenchFileOrDir(i.pathsToBenchmark);
-        if (i.showConsole)
-            system("pause");
-    }
+    if (i.pathsToBenchmark.Count() > 0)
+        BenchFileOrDir(i.pathsToBenchmark, i.benchOutputPath);
+    if (i.benchSuitePath)
+        RunBenchSuite(i.benchSuitePath, i.benchSuiteIterations, i.benchOutputPath);
+    if (i.benchCompareOld)
+        CompareBenchResults(i.benchCompareOld, i.benchCompareNew);
+    if (i.concurrentStressPath)
+        RunConcurrentStressTest(i.concurrentStressPath, i.concurrentStressSecs);
+    if ((i.pathsToBenchmark.Count() > 0 || i.benchSuitePath || i.benchCompareOld || i.concurrentStressPath) && i.showConsole)
+        system("pause");
     if (i.exitImmediately)
         goto Exit;
     gCrashOnOpen = i.crashOnOpen;
@@ -377,7 +456,14 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
     gPolicyRestrictions = GetPolicies(i.restrictedUse);
     gRenderCache.textColor = i.textColor;
     gRenderCache.backgroundColor = i.backgroundColor;
+    UpdateRenderCacheSize();
     DebugGdiPlusDevice(gUseGdiRenderer);
+    // repaired and converted documents are only cached where thumbnails would be as well
+    if (HasPermission(Perm_SavePreferences | Perm_DiskAccess) && gGlobalPrefs->rememberOpenedFiles) {
+        ScopedMem<WCHAR> cacheDir(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+        SetRepairedXrefCacheDir(cacheDir);
+        SetConvertedPsCacheDir(cacheDir);
+    }
 
     if (i.inverseSearchCmdLine) {
         str::ReplacePtr(&gGlobalPrefs->inverseSearchCmdLine, i.inverseSearchCmdLine);
@@ -407,12 +493,22 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
     }
 
     bool showStartPage = i.fileNames.Count() == 0 && gGlobalPrefs->rememberOpenedFiles && gGlobalPrefs->showStartPage;
+    // thumbnails are loaded in DeferredStartupTask
+    DeferThumbnailLoading(true);
     if (showStartPage) {
         // make the shell prepare the image list, so that it's ready when the first window's loaded
         SHFILEINFO sfi;
         SHGetFileInfo(L".pdf", 0, &sfi, sizeof(sfi), SHGFI_SYSICONINDEX | SHGFI_SMALLICON | SHGFI_USEFILEATTRIBUTES);
     }
 
+    // neither the plugin nor stress tests and printing should linger after their last window
+    gResidentMode = (i.resident || gGlobalPrefs->residentMode) && !gPluginMode && !i.stressTestPath && !i.printDialog;
+    if (i.resident && 0 == i.fileNames.Count() && FindWindow(FRAME_CLASS_NAME, 0)) {
+        // there's already an instance to hand documents over to
+        retCode = 0;
+        goto Exit;
+    }
+
     if (!i.reuseInstance && gGlobalPrefs->reuseInstance && FindWindow(FRAME_CLASS_NAME, 0))
         i.reuseInstance = true;
 
@@ -423,6 +519,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
         if (i.reuseInstance && !i.printDialog) {
             OpenUsingDde(i.fileNames.At(n), i, isFirstWin);
         } else {
+            TRACE_SCOPE_N("LoadOnStartup", (int)n);
             win = LoadOnStartup(i.fileNames.At(n), i, isFirstWin);
             if (!win) {
                 retCode++;
@@ -443,7 +540,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
         goto Exit;
 
     if (isFirstWin) {
-        win = CreateAndShowWindowInfo();
+        // -resident without files starts out in the notification area
+        win = gResidentMode && i.resident ? CreateWindowInfo() : CreateAndShowWindowInfo();
         if (!win)
             goto Exit;
     }
@@ -451,14 +549,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
     UpdateUITextForLanguage(); // needed for RTL languages
     if (isFirstWin)
         UpdateToolbarAndScrollbarState(*win);
-
-    // Make sure that we're still registered as default,
-    // if the user has explicitly told us to be
-    if (gGlobalPrefs->associatedExtensions && win)
-        RegisterForPdfExtentions(win->hwndFrame);
-
-    if (gGlobalPrefs->checkForUpdates && gWindows.Count() > 0)
-        AutoUpdateCheckAsync(gWindows.At(0)->hwndFrame, true);
+    if (isFirstWin && gResidentMode && i.resident)
+        HideInTray(win);
 
     if (i.stressTestPath) {
         // don't save file history and preference changes
@@ -467,20 +559,20 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
         StartStressTest(&i, win, &gRenderCache);
     }
 
-    // only hide newly missing files when showing the start page on startup
-    if (showStartPage && gFileHistory.Get(0)) {
-        gFileExistenceChecker = new FileExistenceChecker();
-        gFileExistenceChecker->Start();
-    }
-    // call this once it's clear whether Perm_SavePreferences has been granted
-    prefs::RegisterForFileChanges();
+    if (!gPluginMode)
+        StartCommandPipeServer();
 
-    retCode = RunMessageLoop();
+    retCode = RunMessageLoop(new DeferredStartupTask(showStartPage));
 
+    AbortThumbnailLoading();
     CleanUpThumbnailCache(gFileHistory);
 
 Exit:
+    StopCommandPipeServer();
+    // write out pending settings changes before quitting
+    prefs::Flush();
     prefs::UnregisterForFileChanges();
+    trace::Stop();
 
     while (gWindows.Count() > 0) {
         DeleteWindowInfo(gWindows.At(0));
@@ -499,6 +591,8 @@ Exit:
 
     DeleteObject(gDefaultGuiFont);
     DeleteBitmap(gBitmapReloadingCue);
+    DeleteToolbarImageLists();
+    FreePreloadedPdfEngineResources();
 
     // wait for FileExistenceChecker to terminate
     // (which should be necessary only very rarely)
@@ -506,6 +600,11 @@ Exit:
         Sleep(10);
         uitask::DrainQueue();
     }
+    if (gMemoryPressureWatcher) {
+        gMemoryPressureWatcher->RequestCancel();
+        gMemoryPressureWatcher->Join();
+        delete gMemoryPressureWatcher;
+    }
 
     mui::Destroy();
     uitask::Destroy();
@@ -32,9 +32,18 @@ static void TreeView_ExpandRecursively(HWND hTree, HTREEITEM hItem, UINT flag, b
     }
 }
 
-static void CustomizeTocInfoTip(LPNMTVGETINFOTIP nmit)
+static DocTocItem *GetTocItem(WindowInfo *win, LPARAM lParam)
 {
-    DocTocItem *tocItem = (DocTocItem *)nmit->lParam;
+    if (lParam < 0 || (size_t)lParam >= win->tocNodes.Count())
+        return NULL;
+    return win->tocNodes.At(lParam).item;
+}
+
+static void CustomizeTocInfoTip(WindowInfo *win, LPNMTVGETINFOTIP nmit)
+{
+    DocTocItem *tocItem = GetTocItem(win, nmit->lParam);
+    if (!tocItem)
+        return;
     ScopedMem<WCHAR> path(tocItem->GetLink() ? tocItem->GetLink()->GetDestValue() : NULL);
     if (!path)
         return;
@@ -96,9 +105,9 @@ static void RelayoutTocItem(LPNMTVCUSTOMDRAW ntvcd)
 
     // Draw the page number right-aligned (if there is one)
     WindowInfo *win = FindWindowInfoByHwnd(hTV);
-    DocTocItem *tocItem = (DocTocItem *)item.lParam;
+    DocTocItem *tocItem = win ? GetTocItem(win, item.lParam) : NULL;
     ScopedMem<WCHAR> label;
-    if (tocItem->pageNo && win && win->IsDocLoaded() && win->dm->engine) {
+    if (tocItem && tocItem->pageNo && win->IsDocLoaded() && win->dm->engine) {
         label.Set(win->dm->engine->GetPageLabel(tocItem->pageNo));
         label.Set(str::Join(L"  ", label));
     }
@@ -169,7 +178,7 @@ static void GoToTocLinkForTVItem(WindowInfo* win, HWND hTV, HTREEITEM hItem=NULL
     item.hItem = hItem;
     item.mask = TVIF_PARAM;
     TreeView_GetItem(hTV, &item);
-    DocTocItem *tocItem = (DocTocItem *)item.lParam;
+    DocTocItem *tocItem = GetTocItem(win, item.lParam);
     if (!tocItem || !win->IsDocLoaded())
         return;
     if ((allowExternal || tocItem->GetLink() && Dest_ScrollTo == tocItem->GetLink()->GetDestType()) || tocItem->pageNo) {
@@ -187,6 +196,8 @@ void ClearTocBox(WindowInfo *win)
     SendMessage(win->hwndTocTree, WM_SETREDRAW, TRUE, 0);
     RedrawWindow(win->hwndTocTree, NULL, NULL, RDW_ERASE | RDW_FRAME | RDW_INVALIDATE | RDW_ALLCHILDREN);
 
+    win->tocPageIndex.Reset();
+    win->tocNodes.Reset();
     delete win->tocRoot;
     win->tocRoot = NULL;
 
@@ -207,15 +218,17 @@ void ToggleTocBox(WindowInfo *win)
     }
 }
 
-static HTREEITEM AddTocItemToView(HWND hwnd, DocTocItem *entry, HTREEITEM parent, bool toggleItem)
+static HTREEITEM AddTocItemToView(HWND hwnd, DocTocItem *entry, int nodeIdx, HTREEITEM parent, bool toggleItem)
 {
     TV_INSERTSTRUCT tvinsert;
     tvinsert.hParent = parent;
     tvinsert.hInsertAfter = TVI_LAST;
-    tvinsert.itemex.mask = TVIF_TEXT | TVIF_PARAM | TVIF_STATE;
+    tvinsert.itemex.mask = TVIF_TEXT | TVIF_PARAM | TVIF_STATE | TVIF_CHILDREN;
     tvinsert.itemex.state = entry->child && entry->open != toggleItem ? TVIS_EXPANDED : 0;
     tvinsert.itemex.stateMask = TVIS_EXPANDED;
-    tvinsert.itemex.lParam = (LPARAM)entry;
+    // children might only be added once the item is expanded
+    tvinsert.itemex.cChildren = entry->child ? 1 : 0;
+    tvinsert.itemex.lParam = (LPARAM)nodeIdx;
     // Replace unprintable whitespace with regular spaces
     str::NormalizeWS(entry->title);
     tvinsert.itemex.pszText = entry->title;
@@ -233,46 +246,80 @@ static HTREEITEM AddTocItemToView(HWND hwnd, DocTocItem *entry, HTREEITEM parent
     return TreeView_InsertItem(hwnd, &tvinsert);
 }
 
-static void PopulateTocTreeView(HWND hwnd, DocTocItem *entry, Vec<int>& tocState, HTREEITEM parent = NULL)
+static void FlattenTocTree(Vec<TocTreeNode>& nodes, DocTocItem *entry, int parent)
 {
+    int prev = -1;
     for (; entry; entry = entry->next) {
-        bool toggle = tocState.Contains(entry->id);
-        HTREEITEM node = AddTocItemToView(hwnd, entry, parent, toggle);
-        PopulateTocTreeView(hwnd, entry->child, tocState, node);
+        TocTreeNode node = { entry, parent, -1, NULL };
+        int idx = (int)nodes.Count();
+        nodes.Append(node);
+        if (prev != -1)
+            nodes.At(prev).next = idx;
+        prev = idx;
+        FlattenTocTree(nodes, entry->child, idx);
     }
 }
 
-static HTREEITEM TreeItemForPageNo(WindowInfo *win, HTREEITEM hItem, int pageNo)
+static int cmpTocNodesByPageNo(const void *a, const void *b)
 {
-    HTREEITEM hCurrItem = NULL;
+    TocTreeNode *n1 = *(TocTreeNode **)a, *n2 = *(TocTreeNode **)b;
+    if (n1->item->pageNo != n2->item->pageNo)
+        return n1->item->pageNo - n2->item->pageNo;
+    // items on the same page remain in document order
+    return n1 < n2 ? -1 : n1 > n2 ? 1 : 0;
+}
 
-    while (hItem) {
-        TVITEM item;
-        item.hItem = hItem;
-        item.mask = TVIF_PARAM | TVIF_STATE;
-        item.stateMask = TVIS_EXPANDED;
-        TreeView_GetItem(win->hwndTocTree, &item);
-
-        // return if this item is on the specified page (or on a latter page)
-        if (item.lParam) {
-            int page = ((DocTocItem *)item.lParam)->pageNo;
-            if (1 <= page && page <= pageNo)
-                hCurrItem = hItem;
-            if (page >= pageNo)
-                break;
-        }
+// adds the items starting at tocNodes[nodeIdx] and all their siblings
+// (and the children of the expanded ones) to the tree view
+static void PopulateTocTreeView(WindowInfo *win, int nodeIdx, HTREEITEM parent)
+{
+    for (; nodeIdx != -1; nodeIdx = win->tocNodes.At(nodeIdx).next) {
+        TocTreeNode& node = win->tocNodes.At(nodeIdx);
+        bool toggle = win->tocState.Contains(node.item->id);
+        node.hItem = AddTocItemToView(win->hwndTocTree, node.item, nodeIdx, parent, toggle);
+        if (node.item->child && node.item->open != toggle)
+            PopulateTocTreeView(win, nodeIdx + 1, node.hItem);
+    }
+}
 
-        // find any child item closer to the specified page
-        HTREEITEM hSubItem = NULL;
-        if ((item.state & TVIS_EXPANDED))
-            hSubItem = TreeItemForPageNo(win, TreeView_GetChild(win->hwndTocTree, hItem), pageNo);
-        if (hSubItem)
-            hCurrItem = hSubItem;
+// adds the children of a collapsed item when it's expanded for the first time
+static void PopulateTocChildren(WindowInfo *win, HTREEITEM hItem, LPARAM lParam)
+{
+    DocTocItem *tocItem = GetTocItem(win, lParam);
+    if (tocItem && tocItem->child && !TreeView_GetChild(win->hwndTocTree, hItem))
+        PopulateTocTreeView(win, (int)lParam + 1, hItem);
+}
 
-        hItem = TreeView_GetNextSibling(win->hwndTocTree, hItem);
+// returns the index of the node closest to but not after the given page
+// which is currently visible in the tree view (-1 if there's no such node)
+static int TocNodeForPageNo(WindowInfo *win, int pageNo)
+{
+    Vec<TocTreeNode *>& index = win->tocPageIndex;
+    size_t lo = 0, hi = index.Count();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (index.At(mid)->item->pageNo < pageNo)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-
-    return hCurrItem;
+    // prefer the first item on the page itself, else the last one before it
+    TocTreeNode *node = NULL;
+    if (lo < index.Count() && index.At(lo)->item->pageNo == pageNo)
+        node = index.At(lo);
+    else if (lo > 0)
+        node = index.At(lo - 1);
+    if (!node)
+        return -1;
+
+    // fall back to the outermost collapsed parent, if the node itself isn't visible
+    int nodeIdx = (int)(node - win->tocNodes.LendData());
+    for (int idx = node->parent; idx != -1; idx = win->tocNodes.At(idx).parent) {
+        HTREEITEM hParent = win->tocNodes.At(idx).hItem;
+        if (!hParent || !(TreeView_GetItemState(win->hwndTocTree, hParent, TVIS_EXPANDED) & TVIS_EXPANDED))
+            nodeIdx = idx;
+    }
+    return nodeIdx;
 }
 
 void UpdateTocSelection(WindowInfo *win, int currPageNo)
@@ -285,30 +332,33 @@ void UpdateTocSelection(WindowInfo *win, int currPageNo)
         return;
     // select the item closest to but not after the current page
     // (or the root item, if there's no such item)
-    HTREEITEM hItem = TreeItemForPageNo(win, hRoot, currPageNo);
+    int nodeIdx = TocNodeForPageNo(win, currPageNo);
+    HTREEITEM hItem = nodeIdx != -1 ? win->tocNodes.At(nodeIdx).hItem : NULL;
     if (NULL == hItem)
         hItem = hRoot;
     TreeView_SelectItem(win->hwndTocTree, hItem);
 }
 
-void UpdateTocExpansionState(WindowInfo *win, HTREEITEM hItem)
+void UpdateTocExpansionState(WindowInfo *win)
 {
-    while (hItem) {
-        TVITEM item;
-        item.hItem = hItem;
-        item.mask = TVIF_PARAM | TVIF_STATE;
-        item.stateMask = TVIS_EXPANDED;
-        TreeView_GetItem(win->hwndTocTree, &item);
-
+    // items which haven't been added to the tree view keep their previous state
+    Vec<int> prevState(win->tocState);
+    win->tocState.Reset();
+
+    for (size_t i = 0; i < win->tocNodes.Count(); i++) {
+        TocTreeNode& node = win->tocNodes.At(i);
+        if (!node.item->child)
+            continue;
         // add the ids of toggled items to tocState
-        DocTocItem *tocItem = item.lParam ? (DocTocItem *)item.lParam : NULL;
-        bool wasToggled = tocItem && !(item.state & TVIS_EXPANDED) == tocItem->open;
+        bool wasToggled;
+        if (node.hItem) {
+            bool expanded = (TreeView_GetItemState(win->hwndTocTree, node.hItem, TVIS_EXPANDED) & TVIS_EXPANDED) != 0;
+            wasToggled = expanded != node.item->open;
+        }
+        else
+            wasToggled = prevState.Contains(node.item->id);
         if (wasToggled)
-            win->tocState.Append(tocItem->id);
-
-        if (tocItem && tocItem->child)
-            UpdateTocExpansionState(win, TreeView_GetChild(win->hwndTocTree, hItem));
-        hItem = TreeView_GetNextSibling(win->hwndTocTree, hItem);
+            win->tocState.Append(node.item->id);
     }
 }
 
@@ -350,9 +400,18 @@ void LoadTocTree(WindowInfo *win)
     GetLeftRightCounts(win->tocRoot, l2r, r2l);
     bool isRTL = r2l > l2r;
 
+    // outlines can have tens of thousands of items, so only the visible ones
+    // are added to the tree view up front (cf. PopulateTocChildren)
+    FlattenTocTree(win->tocNodes, win->tocRoot, -1);
+    for (size_t i = 0; i < win->tocNodes.Count(); i++) {
+        if (win->tocNodes.At(i).item->pageNo > 0)
+            win->tocPageIndex.Append(&win->tocNodes.At(i));
+    }
+    win->tocPageIndex.Sort(cmpTocNodesByPageNo);
+
     SendMessage(win->hwndTocTree, WM_SETREDRAW, FALSE, 0);
     ToggleWindowStyle(win->hwndTocTree, WS_EX_LAYOUTRTL | WS_EX_NOINHERITLAYOUT, isRTL, GWL_EXSTYLE);
-    PopulateTocTreeView(win->hwndTocTree, win->tocRoot, win->tocState);
+    PopulateTocTreeView(win, 0, NULL);
     SendMessage(win->hwndTocTree, WM_SETREDRAW, TRUE, 0);
     UINT fl = RDW_ERASE | RDW_FRAME | RDW_INVALIDATE | RDW_ALLCHILDREN;
     RedrawWindow(win->hwndTocTree, NULL, NULL, fl);
@@ -417,8 +476,13 @@ static LRESULT OnTocTreeNotify(WindowInfo *win, LPNMTREEVIEW pnmtv)
             return CDRF_DODEFAULT;
 #endif
 
+        case TVN_ITEMEXPANDING:
+            if ((pnmtv->action & TVE_EXPAND))
+                PopulateTocChildren(win, pnmtv->itemNew.hItem, pnmtv->itemNew.lParam);
+            break;
+
         case TVN_GETINFOTIP:
-            CustomizeTocInfoTip((LPNMTVGETINFOTIP)pnmtv);
+            CustomizeTocInfoTip(win, (LPNMTVGETINFOTIP)pnmtv);
             break;
     }
     return -1;
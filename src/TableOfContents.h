@@ -16,6 +16,6 @@ void ClearTocBox(WindowInfo *win);
 void ToggleTocBox(WindowInfo *win);
 void LoadTocTree(WindowInfo *win);
 void UpdateTocSelection(WindowInfo *win, int currPageNo);
-void UpdateTocExpansionState(WindowInfo *win, HTREEITEM hItem);
+void UpdateTocExpansionState(WindowInfo *win);
 
 #endif
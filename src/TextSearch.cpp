@@ -4,8 +4,18 @@
 #include "BaseUtil.h"
 #include "TextSearch.h"
 
+#include "ThreadUtil.h"
+#include <emmintrin.h>
+#include <intrin.h>
+
 enum { SEARCH_PAGE, SKIP_PAGE };
 
+// only extract text on additional threads if at least that many pages remain
+#define MIN_PAGES_FOR_EXTRACTION    8
+#define MAX_EXTRACTION_THREADS      7
+// how often a search waiting for a page checks whether it's been canceled
+#define EXTRACTION_WAIT_IN_MS       100
+
 #define SkipWhitespace(c) for (; str::IsWs(*(c)); (c)++)
 // ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
 // cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
@@ -13,32 +23,139 @@ enum { SEARCH_PAGE, SKIP_PAGE };
 
 TextSearch::TextSearch(BaseEngine *engine, PageTextCache *textCache) :
     TextSelection(engine, textCache),
-    findText(NULL), anchor(NULL), pageText(NULL),
+    findText(NULL), anchor(NULL), anchorLower(NULL),
+    pinnedPage(0), pageText(NULL), pageFolded(NULL), pageLen(0),
     caseSensitive(false), forward(true),
     matchWordStart(false), matchWordEnd(false),
-    findPage(0), findIndex(0), lastText(NULL)
+    findPage(0), findIndex(0), lastText(NULL),
+    extractStart(0), extractNext(0)
 {
     findCache = AllocArray<BYTE>(this->engine->PageCount());
+    extractClaims = AllocArray<LONG>(this->engine->PageCount());
+    extractEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 }
 
 TextSearch::~TextSearch()
 {
+    CrashIf(extractThreads.Count() > 0);
     Clear();
     free(findCache);
+    free(extractClaims);
+    CloseHandle(extractEvent);
+}
+
+class TextExtractionThread : public ThreadBase {
+    TextSearch *search;
+    BaseEngine *engine;
+
+public:
+    TextExtractionThread(TextSearch *search, BaseEngine *engine) :
+        ThreadBase("TextExtractionThread"), search(search), engine(engine) { }
+
+    virtual void Run() {
+        int pageNo;
+        while (!WasCancelRequested() && (pageNo = search->ClaimNextPage()) != 0) {
+            search->textCache->ExtractData(pageNo, engine);
+            InterlockedExchange(&search->extractClaims[pageNo - 1], 0);
+            SetEvent(search->extractEvent);
+        }
+    }
+};
+
+static int GetExtractionThreadCount()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    // the search thread itself extracts pages as well
+    return limitValue((int)si.dwNumberOfProcessors - 1, 0, MAX_EXTRACTION_THREADS);
+}
+
+// returns false if the page is already being extracted by another thread
+bool TextSearch::ClaimPage(int pageNo)
+{
+    return 0 == InterlockedCompareExchange(&extractClaims[pageNo - 1], 1, 0);
+}
+
+// returns the next page in search order which still has to be extracted
+// (or 0 once all pages have been handed out)
+int TextSearch::ClaimNextPage()
+{
+    int total = engine->PageCount();
+    for (;;) {
+        int ix = InterlockedIncrement(&extractNext) - 1;
+        int pageNo = extractStart + (forward ? ix : -ix);
+        if (pageNo < 1 || pageNo > total)
+            return 0;
+        if (SKIP_PAGE != findCache[pageNo - 1] && !textCache->HasData(pageNo) && ClaimPage(pageNo))
+            return pageNo;
+    }
+}
+
+void TextSearch::StartExtraction(int pageNo)
+{
+    CrashIf(extractThreads.Count() > 0);
+    extractStart = pageNo;
+    extractNext = 0;
+
+    int threadCount = GetExtractionThreadCount();
+    // cloning might fail for some documents; then just search on a single thread
+    for (int i = (int)extractEngines.Count(); i < threadCount; i++) {
+        BaseEngine *clone = engine->Clone();
+        if (!clone)
+            break;
+        extractEngines.Append(clone);
+    }
+    for (size_t i = 0; i < extractEngines.Count(); i++) {
+        TextExtractionThread *thread = new TextExtractionThread(this, extractEngines.At(i));
+        extractThreads.Append(thread);
+        thread->Start();
+    }
+}
+
+void TextSearch::StopExtraction()
+{
+    for (size_t i = 0; i < extractThreads.Count(); i++) {
+        extractThreads.At(i)->RequestCancel();
+    }
+    for (size_t i = 0; i < extractThreads.Count(); i++) {
+        extractThreads.At(i)->Join();
+        delete extractThreads.At(i);
+    }
+    extractThreads.Reset();
+    // the clones hold a copy of the whole document, so they're
+    // only kept around for the duration of a single search
+    DeleteVecMembers(extractEngines);
 }
 
 void TextSearch::Reset()
 {
     pageText = NULL;
+    pageFolded = NULL;
+    if (pinnedPage)
+        textCache->Unpin(pinnedPage);
+    pinnedPage = 0;
     TextSelection::Reset();
 }
 
+void TextSearch::LoadPageText(int pageNo)
+{
+    if (pinnedPage != pageNo) {
+        textCache->Pin(pageNo);
+        if (pinnedPage)
+            textCache->Unpin(pinnedPage);
+        pinnedPage = pageNo;
+    }
+    pageText = textCache->GetData(pageNo, &pageLen);
+    pageFolded = NULL;
+}
+
 void TextSearch::SetText(const WCHAR *text)
 {
     // search text starting with a single space enables the 'Match word start'
     // and search text ending in a single space enables the 'Match word end' option
     // (that behavior already "kind of" exists without special treatment, but
     // usually is not quite what a user expects, so let's try to be cleverer)
+    bool prevMatchWordStart = this->matchWordStart, prevMatchWordEnd = this->matchWordEnd;
     this->matchWordStart = text[0] == ' ' && text[1] != ' ';
     this->matchWordEnd = str::EndsWith(text, L" ") && !str::EndsWith(text, L"  ");
 
@@ -49,6 +166,12 @@ void TextSearch::SetText(const WCHAR *text)
     if (str::Eq(this->lastText, text))
         return;
 
+    // when the search text is only extended (e.g. while the user is typing
+    // with "find as you type"), pages which didn't match the previous text
+    // can't match the new one either and don't have to be searched again
+    bool refine = this->lastText && str::StartsWith(text, this->lastText) &&
+                  prevMatchWordStart == this->matchWordStart && !prevMatchWordEnd;
+
     this->Clear();
     this->lastText = str::Dup(text);
     this->findText = str::Dup(text);
@@ -67,6 +190,12 @@ void TextSearch::SetText(const WCHAR *text)
         anchor = NULL;
     else
         anchor = str::DupN(text, 1);
+    // MatchLen treats all whitespace as identical, so only use non-whitespace
+    // anchors for finding candidate positions in FindAnchor
+    if (anchor && !str::IsWs(*anchor)) {
+        anchorLower = str::Dup(anchor);
+        CharLowerBuff(anchorLower, (DWORD)str::Len(anchorLower));
+    }
 
     if (str::EndsWith(this->findText, L" "))
         this->findText[str::Len(this->findText) - 1] = '\0';
@@ -75,7 +204,8 @@ void TextSearch::SetText(const WCHAR *text)
         this->findText[INT_MAX] = 0;
 #endif
 
-    memset(this->findCache, SEARCH_PAGE, this->engine->PageCount());
+    if (!refine)
+        memset(this->findCache, SEARCH_PAGE, this->engine->PageCount());
 }
 
 void TextSearch::SetSensitive(bool sensitive)
@@ -107,7 +237,7 @@ void TextSearch::SetLastResult(TextSelection *sel)
 
     findPage = min(startPage, endPage);
     findIndex = (findPage == startPage ? startGlyph : endGlyph) + (int)str::Len(findText);
-    pageText = textCache->GetData(findPage);
+    LoadPageText(findPage);
     forward = true;
 }
 
@@ -159,6 +289,100 @@ int TextSearch::MatchLen(const WCHAR *start) const
     return (int)(end - start);
 }
 
+// returns the first occurrence of needle starting in [s, end - len]
+// (blocks of 8 positions are prefiltered by comparing the first and last
+// character of needle at once with SSE2)
+static const WCHAR *FindSubstring(const WCHAR *s, const WCHAR *end, const WCHAR *needle, size_t len)
+{
+    if (0 == len || (size_t)(end - s) < len)
+        return NULL;
+    const WCHAR *last = end - len;
+
+    if (HasSSE2()) {
+        __m128i firstChar = _mm_set1_epi16((short)needle[0]);
+        __m128i lastChar = _mm_set1_epi16((short)needle[len - 1]);
+        for (; last - s >= 7; s += 8) {
+            __m128i blockFirst = _mm_loadu_si128((const __m128i *)s);
+            __m128i blockLast = _mm_loadu_si128((const __m128i *)(s + len - 1));
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(blockFirst, firstChar),
+                                                                _mm_cmpeq_epi16(blockLast, lastChar)));
+            while (mask) {
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                const WCHAR *c = s + bit / 2;
+                if (!memcmp(c, needle, len * sizeof(WCHAR)))
+                    return c;
+                mask &= ~(3U << (bit & ~1));
+            }
+        }
+    }
+
+    for (; s <= last; s++) {
+        if (*s == needle[0] && !memcmp(s, needle, len * sizeof(WCHAR)))
+            return s;
+    }
+    return NULL;
+}
+
+// returns the last occurrence of needle starting in [base, start)
+// (the match itself may extend beyond start but not beyond end)
+static const WCHAR *FindSubstringRev(const WCHAR *base, const WCHAR *start, const WCHAR *end, const WCHAR *needle, size_t len)
+{
+    if (0 == len || (size_t)(end - base) < len || start <= base)
+        return NULL;
+    const WCHAR *c = min(start - 1, end - len);
+
+    if (HasSSE2()) {
+        __m128i firstChar = _mm_set1_epi16((short)needle[0]);
+        __m128i lastChar = _mm_set1_epi16((short)needle[len - 1]);
+        for (; c - base >= 7; c -= 8) {
+            const WCHAR *block = c - 7;
+            __m128i blockFirst = _mm_loadu_si128((const __m128i *)block);
+            __m128i blockLast = _mm_loadu_si128((const __m128i *)(block + len - 1));
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(blockFirst, firstChar),
+                                                                _mm_cmpeq_epi16(blockLast, lastChar)));
+            while (mask) {
+                unsigned long bit;
+                _BitScanReverse(&bit, mask);
+                const WCHAR *m = block + bit / 2;
+                if (!memcmp(m, needle, len * sizeof(WCHAR)))
+                    return m;
+                mask &= ~(3U << (bit & ~1));
+            }
+        }
+    }
+
+    for (; c >= base; c--) {
+        if (*c == needle[0] && !memcmp(c, needle, len * sizeof(WCHAR)))
+            return c;
+    }
+    return NULL;
+}
+
+// finds the next occurrence of the anchor, either literally or - for
+// case-insensitive search - in the page's lowercase copy (matching the
+// anchor that way is a precondition for MatchLen succeeding)
+const WCHAR *TextSearch::FindAnchor()
+{
+    const WCHAR *haystack = pageText, *needle = anchor;
+    if (!caseSensitive) {
+        if (!pageFolded)
+            pageFolded = textCache->GetFoldedData(findPage);
+        if (!pageFolded)
+            return NULL;
+        haystack = pageFolded;
+        needle = anchorLower;
+    }
+
+    const WCHAR *start = haystack + limitValue(findIndex, 0, pageLen);
+    const WCHAR *found;
+    if (forward)
+        found = FindSubstring(start, haystack + pageLen, needle, str::Len(needle));
+    else
+        found = FindSubstringRev(haystack, start, haystack + pageLen, needle, str::Len(needle));
+    return found ? pageText + (found - haystack) : NULL;
+}
+
 static const WCHAR *GetNextIndex(const WCHAR *base, int offset, bool forward)
 {
     const WCHAR *c = base + offset + (forward ? 0 : -1);
@@ -180,6 +404,8 @@ bool TextSearch::FindTextInPage(int pageNo)
     do {
         if (!anchor)
             found = GetNextIndex(pageText, findIndex, forward);
+        else if (anchorLower)
+            found = FindAnchor();
         else if (forward)
             found = (caseSensitive ? StrStr : StrStrI)(pageText + findIndex, anchor);
         else
@@ -202,12 +428,43 @@ bool TextSearch::FindTextInPage(int pageNo)
     return true;
 }
 
+// makes the text of pageNo available for FindTextInPage (extracting the
+// following pages on additional threads, if worthwhile);
+// returns false if the search has been canceled in the meantime
+bool TextSearch::LoadPage(int pageNo, ProgressUpdateUI *tracker)
+{
+    int total = engine->PageCount();
+    if (!textCache->HasData(pageNo) && extractThreads.Count() == 0 &&
+        (forward ? total - pageNo : pageNo - 1) >= MIN_PAGES_FOR_EXTRACTION &&
+        engine->SupportsConcurrentRendering()) {
+        StartExtraction(pageNo);
+    }
+    // pages are extracted ahead by the extraction threads, so wait for the
+    // current page (if necessary) in order to report matches in page order
+    bool claimed = ClaimPage(pageNo);
+    while (!claimed && (!tracker || !tracker->WasCanceled())) {
+        // extractEvent is set whenever an extraction thread releases a page
+        WaitForSingleObject(extractEvent, EXTRACTION_WAIT_IN_MS);
+        claimed = ClaimPage(pageNo);
+    }
+    if (!claimed)
+        return false;
+
+    Reset();
+
+    LoadPageText(pageNo);
+    InterlockedExchange(&extractClaims[pageNo - 1], 0);
+    findIndex = forward ? 0 : pageLen;
+    return true;
+}
+
 bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI *tracker)
 {
     if (str::IsEmpty(findText))
         return false;
 
     int total = engine->PageCount();
+    bool found = false;
     while (1 <= pageNo && pageNo <= total && (!tracker || !tracker->WasCanceled())) {
         if (tracker)
             tracker->UpdateProgress(pageNo, total);
@@ -217,20 +474,23 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI *tracker)
             continue;
         }
 
-        Reset();
-
-        pageText = textCache->GetData(pageNo, &findIndex);
+        if (!LoadPage(pageNo, tracker))
+            break;
         if (pageText) {
-            if (forward)
-                findIndex = 0;
-            if (FindTextInPage(pageNo))
-                return true;
+            if (FindTextInPage(pageNo)) {
+                found = true;
+                break;
+            }
             findCache[pageNo - 1] = SKIP_PAGE;
         }
 
         pageNo += forward ? 1 : -1;
     }
 
+    StopExtraction();
+    if (found)
+        return true;
+
     // allow for the first/last page to be included in the next search
     findPage = forward ? total + 1 : 0;
 
@@ -246,6 +506,53 @@ TextSel *TextSearch::FindFirst(int page, const WCHAR *text, ProgressUpdateUI *tr
     return NULL;
 }
 
+int TextSearch::FindAll(const WCHAR *text, FindAllSink *sink, ProgressUpdateUI *tracker)
+{
+    SetText(text);
+    SetDirection(FIND_FORWARD);
+    if (str::IsEmpty(findText))
+        return 0;
+
+    int total = engine->PageCount();
+    int count = 0;
+    for (int pageNo = 1; pageNo <= total && (!tracker || !tracker->WasCanceled()); pageNo++) {
+        if (tracker)
+            tracker->UpdateProgress(pageNo, total);
+        if (SKIP_PAGE == findCache[pageNo - 1])
+            continue;
+        if (!LoadPage(pageNo, tracker))
+            break;
+        if (!pageText)
+            continue;
+
+        Vec<int> pages;
+        Vec<RectI> rects;
+        int pageCount = 0;
+        while (FindTextInPage(pageNo)) {
+            for (int i = 0; i < result.len; i++) {
+                pages.Append(pageNo);
+                rects.Append(result.rects[i]);
+            }
+            pageCount++;
+        }
+        if (0 == pageCount) {
+            findCache[pageNo - 1] = SKIP_PAGE;
+            continue;
+        }
+        count += pageCount;
+        TextSel matches = { (int)rects.Count(), pages.LendData(), rects.LendData() };
+        if (!sink->MatchesFound(pageNo, pageCount, &matches))
+            break;
+    }
+
+    StopExtraction();
+    Reset();
+    // the next FindNext has to start over
+    findPage = total + 1;
+
+    return count;
+}
+
 TextSel *TextSearch::FindNext(ProgressUpdateUI *tracker)
 {
     CrashIf(!findText);
@@ -258,7 +565,11 @@ TextSel *TextSearch::FindNext(ProgressUpdateUI *tracker)
         tracker->UpdateProgress(findPage, engine->PageCount());
     }
 
-    if (FindTextInPage())
+    // the page's text might have been dropped from textCache in the meantime
+    bool validPage = 1 <= findPage && findPage <= engine->PageCount();
+    if (validPage)
+        LoadPageText(findPage);
+    if (validPage && FindTextInPage())
         return &result;
     if (FindStartingAtPage(findPage + (forward ? 1 : -1), tracker))
         return &result;
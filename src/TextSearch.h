@@ -19,6 +19,19 @@ public:
     virtual bool WasCanceled() = 0;
 };
 
+// receives the matches found by TextSearch::FindAll
+class FindAllSink
+{
+public:
+    virtual ~FindAllSink() { }
+    // called (on the searching thread) for every page with at least one match;
+    // matches contains the rectangles of all count matches on that page;
+    // returning false stops the search
+    virtual bool MatchesFound(int pageNo, int count, TextSel *matches) = 0;
+};
+
+class TextExtractionThread;
+
 class TextSearch : public TextSelection
 {
 public:
@@ -30,6 +43,12 @@ public:
     void SetLastResult(TextSelection *sel);
     TextSel *FindFirst(int page, const WCHAR *text, ProgressUpdateUI *tracker=NULL);
     TextSel *FindNext(ProgressUpdateUI *tracker=NULL);
+    // reports all matches of text in the whole document to sink (page by page,
+    // extracting text the same way as FindFirst) and returns their number;
+    // note: this replaces the current search state
+    int FindAll(const WCHAR *text, FindAllSink *sink, ProgressUpdateUI *tracker=NULL);
+
+    bool IsSensitive() const { return caseSensitive; }
 
     // note: the result might not be a valid page number!
     int GetCurrentPageNo() const { return findPage; }
@@ -47,25 +66,54 @@ protected:
     bool matchWordEnd;
 
     void SetText(const WCHAR *text);
+    const WCHAR *FindAnchor();
     bool FindTextInPage(int pageNo = 0);
     bool FindStartingAtPage(int pageNo, ProgressUpdateUI *tracker);
+    bool LoadPage(int pageNo, ProgressUpdateUI *tracker);
+    void LoadPageText(int pageNo);
     int MatchLen(const WCHAR *start) const;
 
     void Clear()
     {
         str::ReplacePtr(&findText, NULL);
         str::ReplacePtr(&anchor, NULL);
+        str::ReplacePtr(&anchorLower, NULL);
         str::ReplacePtr(&lastText, NULL);
         Reset();
     }
     void Reset();
 
 private:
+    // pageText and pageFolded point into textCache, so their page is kept
+    // pinned until another page is loaded (0 if no page is pinned)
+    int pinnedPage;
     const WCHAR *pageText;
+    // lowercase copy of pageText (only used for case-insensitive search)
+    const WCHAR *pageFolded;
+    int pageLen;
     int findIndex;
+    // lowercase copy of anchor (NULL if anchor can't be matched literally)
+    WCHAR *anchorLower;
 
     WCHAR *lastText;
     BYTE *findCache;
+
+    // for engines supporting concurrent rendering, the text of the pages
+    // about to be searched is extracted ahead on several threads
+    friend class TextExtractionThread;
+    Vec<BaseEngine *> extractEngines;
+    Vec<TextExtractionThread *> extractThreads;
+    // set for pages currently being extracted (by any thread)
+    LONG *extractClaims;
+    // set by the extraction threads whenever they've finished a page
+    HANDLE extractEvent;
+    int extractStart;
+    LONG extractNext;
+
+    bool ClaimPage(int pageNo);
+    int ClaimNextPage();
+    void StartExtraction(int pageNo);
+    void StopExtraction();
 };
 
 #endif
@@ -4,15 +4,375 @@
 #include "BaseUtil.h"
 #include "TextSelection.h"
 
-PageTextCache::PageTextCache(BaseEngine *engine) : engine(engine)
+#include "FileUtil.h"
+
+// drop the least recently used pages once the cache grows beyond that size
+#define MAX_TEXT_CACHE_SIZE     (48 * 1024 * 1024)
+
+// consecutive glyphs sharing the same vertical extent (usually all glyphs
+// of a line's span) are stored relative to a common GlyphRun
+struct GlyphRun {
+    int32_t start; // index of the run's first glyph
+    int32_t x, y, dy;
+};
+
+struct GlyphBox {
+    int16_t x; // relative to GlyphRun::x
+    int16_t dx;
+};
+
+struct PageTextData {
+    WCHAR     * text;
+    // lowercase copy of text (created on demand for case-insensitive search)
+    WCHAR     * folded;
+    int         len;
+    GlyphRun  * runs;
+    int         runCount;
+    GlyphBox  * boxes;
+    // decoded glyph coordinates (created on demand)
+    RectI     * coords;
+    // spatial index over coords (created on demand)
+    GlyphGrid * grid;
+    // word and line boundaries (created on demand)
+    TextRuns  * words;
+    TextRuns  * lines;
+    size_t      size;
+    // number of callers currently using the page's data (cf. Pin)
+    int         pinCount;
+    // previous and next page in LRU order
+    int         lruPrev, lruNext;
+    // offset of the page's record in the index file (or -1)
+    int64       indexOffset;
+};
+
+static bool FitsInt16(int value)
+{
+    return value == (int16_t)value;
+}
+
+static bool EncodeCoords(PageTextData& data, const RectI *coords)
+{
+    if (0 == data.len)
+        return true;
+    data.boxes = AllocArray<GlyphBox>(data.len);
+    if (!data.boxes)
+        return false;
+
+    Vec<GlyphRun> runs;
+    for (int i = 0; i < data.len; i++) {
+        RectI rc = coords ? coords[i] : RectI();
+        if (0 == runs.Count() || runs.Last().y != rc.y || runs.Last().dy != rc.dy ||
+            !FitsInt16(rc.x - runs.Last().x)) {
+            GlyphRun run = { i, rc.x, rc.y, rc.dy };
+            runs.Append(run);
+        }
+        data.boxes[i].x = (int16_t)(rc.x - runs.Last().x);
+        // glyphs are never wider than 32767 units
+        data.boxes[i].dx = (int16_t)limitValue(rc.dx, (int)INT16_MIN, (int)INT16_MAX);
+    }
+    data.runCount = (int)runs.Count();
+    data.runs = runs.StealData();
+    return true;
+}
+
+static RectI *DecodeCoords(PageTextData& data)
+{
+    RectI *coords = AllocArray<RectI>(data.len);
+    if (!coords)
+        return NULL;
+    for (int r = 0; r < data.runCount; r++) {
+        GlyphRun& run = data.runs[r];
+        int end = r + 1 < data.runCount ? data.runs[r + 1].start : data.len;
+        for (int i = run.start; i < end; i++) {
+            coords[i] = RectI(run.x + data.boxes[i].x, run.y, data.boxes[i].dx, run.dy);
+        }
+    }
+    return coords;
+}
+
+// only create a GlyphGrid for pages with that many glyphs
+#define MIN_GLYPHS_FOR_GRID     256
+#define MAX_GRID_CELLS_PER_AXIS 256
+
+/* Buckets a page's glyphs into a regular grid of cells, so that hit testing
+   only has to look at glyphs close to a point (yields the same results as
+   looking at all glyphs in TextSelection::FindClosestGlyph) */
+class GlyphGrid {
+    RectI   bounds;
+    int     cols, rows;
+    int     cellDx, cellDy;
+    // the glyphs overlapping cell i are cellGlyphs[cellStart[i]] to cellGlyphs[cellStart[i + 1] - 1]
+    int   * cellStart;
+    int   * cellGlyphs;
+
+    int Col(int x) const { return limitValue((x - bounds.x) / cellDx, 0, cols - 1); }
+    int Row(int y) const { return limitValue((y - bounds.y) / cellDy, 0, rows - 1); }
+    void VisitCell(int col, int row, const RectI *coords, PointI pt, int *result, unsigned int *maxDist) const;
+
+public:
+    GlyphGrid(const RectI *coords, int len);
+    ~GlyphGrid() {
+        free(cellStart);
+        free(cellGlyphs);
+    }
+
+    bool IsValid() const { return cellStart && cellGlyphs; }
+    size_t Size() const { return sizeof(*this) + (cols * rows + 1 + cellStart[cols * rows]) * sizeof(int); }
+    int FindClosestGlyph(const RectI *coords, PointI pt, PointI ptDist) const;
+};
+
+static bool IsLineBreak(const RectI& glyph)
+{
+    return !glyph.x && !glyph.dx;
+}
+
+GlyphGrid::GlyphGrid(const RectI *coords, int len) :
+    cols(1), rows(1), cellDx(1), cellDy(1), cellStart(NULL), cellGlyphs(NULL)
+{
+    int count = 0;
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    for (int i = 0; i < len; i++) {
+        if (IsLineBreak(coords[i]))
+            continue;
+        RectI rc = RectI::FromXY(coords[i].x, coords[i].y, coords[i].x + coords[i].dx, coords[i].y + coords[i].dy);
+        x0 = min(x0, rc.x); x1 = max(x1, rc.x + rc.dx);
+        y0 = min(y0, rc.y); y1 = max(y1, rc.y + rc.dy);
+        count++;
+    }
+    if (0 == count)
+        return;
+    bounds = RectI(x0, y0, x1 - x0, y1 - y0);
+
+    // aim for about four glyphs per cell
+    double cells = max(count / 4, 1);
+    double aspect = 1.0 * max(bounds.dx, 1) / max(bounds.dy, 1);
+    cols = limitValue((int)sqrt(cells * aspect), 1, MAX_GRID_CELLS_PER_AXIS);
+    rows = limitValue((int)(cells / cols), 1, MAX_GRID_CELLS_PER_AXIS);
+    cellDx = bounds.dx / cols + 1;
+    cellDy = bounds.dy / rows + 1;
+
+    cellStart = AllocArray<int>(cols * rows + 1);
+    ScopedMem<int> fill(AllocArray<int>(cols * rows));
+    if (!cellStart || !fill)
+        return;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < len; i++) {
+            if (IsLineBreak(coords[i]))
+                continue;
+            RectI rc = RectI::FromXY(coords[i].x, coords[i].y, coords[i].x + coords[i].dx, coords[i].y + coords[i].dy);
+            for (int row = Row(rc.y); row <= Row(rc.y + rc.dy); row++) {
+                for (int col = Col(rc.x); col <= Col(rc.x + rc.dx); col++) {
+                    int cell = row * cols + col;
+                    if (0 == pass)
+                        cellStart[cell + 1]++;
+                    else
+                        cellGlyphs[cellStart[cell] + fill[cell]++] = i;
+                }
+            }
+        }
+        if (0 == pass) {
+            for (int cell = 0; cell < cols * rows; cell++) {
+                cellStart[cell + 1] += cellStart[cell];
+            }
+            cellGlyphs = AllocArray<int>(max(cellStart[cols * rows], 1));
+            if (!cellGlyphs)
+                return;
+        }
+    }
+}
+
+void GlyphGrid::VisitCell(int col, int row, const RectI *coords, PointI pt, int *result, unsigned int *maxDist) const
+{
+    int cell = row * cols + col;
+    for (int j = cellStart[cell]; j < cellStart[cell + 1]; j++) {
+        int i = cellGlyphs[j];
+        unsigned int dist = distSq(pt.x - coords[i].x - coords[i].dx / 2,
+                                   pt.y - coords[i].y - coords[i].dy / 2);
+        // glyphs can be visited repeatedly from several cells
+        if (dist < *maxDist || dist == *maxDist && i < *result) {
+            *result = i;
+            *maxDist = dist;
+        }
+    }
+}
+
+// pt is used for testing whether the point is over a glyph and
+// ptDist for determining the distance to a glyph's center
+int GlyphGrid::FindClosestGlyph(const RectI *coords, PointI pt, PointI ptDist) const
+{
+    int result = -1;
+    unsigned int maxDist = UINT_MAX;
+
+    // prefer glyphs the cursor is actually over (all of which overlap pt's cell)
+    int cell = Row(pt.y) * cols + Col(pt.x);
+    for (int j = cellStart[cell]; j < cellStart[cell + 1]; j++) {
+        int i = cellGlyphs[j];
+        if (!coords[i].Contains(pt))
+            continue;
+        unsigned int dist = distSq(ptDist.x - coords[i].x - coords[i].dx / 2,
+                                   ptDist.y - coords[i].y - coords[i].dy / 2);
+        if (dist < maxDist || dist == maxDist && i < result) {
+            result = i;
+            maxDist = dist;
+        }
+    }
+    if (result != -1)
+        return result;
+
+    // else look at rings of cells around ptDist's cell until no unvisited
+    // cell can contain a glyph center closer than the closest one found
+    int col = Col(ptDist.x), row = Row(ptDist.y);
+    for (int ring = 0; ; ring++) {
+        int c0 = col - ring, c1 = col + ring, r0 = row - ring, r1 = row + ring;
+        if (c0 < 0 && c1 >= cols && r0 < 0 && r1 >= rows)
+            break;
+        for (int c = max(c0, 0); c <= min(c1, cols - 1); c++) {
+            if (r0 >= 0)
+                VisitCell(c, r0, coords, ptDist, &result, &maxDist);
+            if (r1 < rows && r1 != r0)
+                VisitCell(c, r1, coords, ptDist, &result, &maxDist);
+        }
+        for (int r = max(r0 + 1, 0); r <= min(r1 - 1, rows - 1); r++) {
+            if (c0 >= 0)
+                VisitCell(c0, r, coords, ptDist, &result, &maxDist);
+            if (c1 < cols && c1 != c0)
+                VisitCell(c1, r, coords, ptDist, &result, &maxDist);
+        }
+
+        if (-1 == result)
+            continue;
+        // glyph centers in unvisited cells are at least that far away
+        int bound = INT_MAX;
+        if (c0 > 0)
+            bound = min(bound, ptDist.x - (bounds.x + c0 * cellDx));
+        if (c1 < cols - 1)
+            bound = min(bound, bounds.x + (c1 + 1) * cellDx - ptDist.x);
+        if (r0 > 0)
+            bound = min(bound, ptDist.y - (bounds.y + r0 * cellDy));
+        if (r1 < rows - 1)
+            bound = min(bound, bounds.y + (r1 + 1) * cellDy - ptDist.y);
+        if (INT_MAX == bound || bound > 0 && maxDist < (unsigned int)bound * (unsigned int)bound)
+            break;
+    }
+
+    return result;
+}
+
+/* Maximal runs of consecutive characters matching a predicate (e.g. all the
+   words or all the lines of a page), so that the endpoints of the run at a
+   given position can be found in constant time (yields the same results as
+   scanning the text character by character) */
+class TextRuns {
+    struct Run {
+        int start, end;
+    };
+    int     len;
+    Run   * runs;
+    int     count;
+    // runsBefore[i] is the number of runs starting before position i
+    int   * runsBefore;
+
+public:
+    TextRuns(const WCHAR *text, int len, bool (* inRun)(WCHAR c));
+    ~TextRuns() {
+        free(runs);
+        free(runsBefore);
+    }
+
+    bool IsValid() const { return runs && runsBefore; }
+    size_t Size() const { return sizeof(*this) + count * sizeof(Run) + (len + 1) * sizeof(int); }
+    int FindEndpoint(int idx, bool forward, bool skipGap) const;
+};
+
+TextRuns::TextRuns(const WCHAR *text, int len, bool (* inRun)(WCHAR c)) :
+    len(len), runs(NULL), count(0), runsBefore(NULL)
+{
+    int total = 0;
+    for (int i = 0; i < len; i++) {
+        if (inRun(text[i]) && (0 == i || !inRun(text[i - 1])))
+            total++;
+    }
+    runs = AllocArray<Run>(max(total, 1));
+    runsBefore = AllocArray<int>(len + 1);
+    if (!IsValid())
+        return;
+    for (int i = 0; i < len; i++) {
+        runsBefore[i] = count;
+        if (!inRun(text[i]))
+            continue;
+        if (0 == i || !inRun(text[i - 1]))
+            runs[count++].start = i;
+        runs[count - 1].end = i + 1;
+    }
+    runsBefore[len] = count;
+}
+
+// skipGap determines whether to skip over the characters between two runs
+// before looking for the previous run's start (or the next run's end)
+int TextRuns::FindEndpoint(int idx, bool forward, bool skipGap) const
+{
+    if (!forward) {
+        if (idx <= 0 || idx > len)
+            return idx;
+        int k = runsBefore[idx] - 1;
+        if (k < 0)
+            return skipGap ? 0 : idx;
+        if (skipGap || runs[k].end >= idx)
+            return runs[k].start;
+        return idx;
+    }
+
+    if (idx < 0 || idx >= len)
+        return idx;
+    int k = runsBefore[idx + 1] - 1;
+    if (k >= 0 && runs[k].end > idx)
+        return runs[k].end;
+    if (!skipGap)
+        return idx;
+    return k + 1 < count ? runs[k + 1].end : len;
+}
+
+static bool IsWordChar(WCHAR c)
+{
+    return iswordchar(c) != 0;
+}
+
+static bool IsNotLineBreak(WCHAR c)
+{
+    return c != '\n';
+}
+
+static size_t DataSize(PageTextData& data)
+{
+    size_t size = (data.len + 1) * sizeof(WCHAR) + data.runCount * sizeof(GlyphRun) + data.len * sizeof(GlyphBox);
+    if (data.folded)
+        size += (data.len + 1) * sizeof(WCHAR);
+    if (data.coords)
+        size += data.len * sizeof(RectI);
+    if (data.grid)
+        size += data.grid->Size();
+    if (data.words)
+        size += data.words->Size();
+    if (data.lines)
+        size += data.lines->Size();
+    return size;
+}
+
+static HANDLE OpenForAppending(const WCHAR *filePath)
+{
+    return CreateFile(filePath, FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+PageTextCache::PageTextCache(BaseEngine *engine) : engine(engine), cacheSize(0),
+    lruFirst(-1), lruLast(-1), indexFile(NULL)
 {
     int count = engine->PageCount();
-    coords = AllocArray<RectI *>(count);
-    text = AllocArray<WCHAR *>(count);
-    lens = AllocArray<int>(count);
-#ifdef DEBUG
-    debug_size = count * (sizeof(RectI *) + sizeof(WCHAR *) + sizeof(int));
-#endif
+    pages = AllocArray<PageTextData>(count);
+    for (int i = 0; i < count; i++) {
+        pages[i].lruPrev = pages[i].lruNext = -1;
+        pages[i].indexOffset = -1;
+    }
 
     InitializeCriticalSection(&access);
 }
@@ -22,47 +382,489 @@ PageTextCache::~PageTextCache()
     EnterCriticalSection(&access);
 
     for (int i = 0; i < engine->PageCount(); i++) {
-        free(coords[i]);
-        free(text[i]);
+        FreeData(i + 1);
     }
+    CrashIf(cacheSize != 0);
 
-    free(coords);
-    free(text);
-    free(lens);
+    free(pages);
+    free(indexFile);
 
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
 }
 
+size_t PageTextCache::GetMemoryUsage()
+{
+    ScopedCritSec scope(&access);
+    return cacheSize;
+}
+
+void PageTextCache::Compact()
+{
+    ScopedCritSec scope(&access);
+    EvictData(0);
+}
+
+void PageTextCache::TakeData(PageTextCache *other, int pageNo)
+{
+    CrashIf(pageNo < 1 || pageNo > engine->PageCount() || pageNo > other->engine->PageCount());
+    ScopedCritSec scope(&access);
+    ScopedCritSec otherScope(&other->access);
+
+    PageTextData& src = other->pages[pageNo - 1];
+    PageTextData& data = pages[pageNo - 1];
+    // pointers to the data of pinned pages are still in use
+    if (!src.text || data.text || src.pinCount > 0)
+        return;
+
+    other->UnlinkData(pageNo);
+    other->cacheSize -= src.size;
+    int64 indexOffset = data.indexOffset;
+    int pinCount = data.pinCount;
+    data = src;
+    data.lruPrev = data.lruNext = -1;
+    data.indexOffset = indexOffset;
+    data.pinCount = pinCount;
+    cacheSize += data.size;
+    UseData(pageNo);
+
+    indexOffset = src.indexOffset;
+    ZeroMemory(&src, sizeof(src));
+    src.lruPrev = src.lruNext = -1;
+    src.indexOffset = indexOffset;
+}
+
+void PageTextCache::Pin(int pageNo)
+{
+    CrashIf(pageNo < 1 || pageNo > engine->PageCount());
+    ScopedCritSec scope(&access);
+    pages[pageNo - 1].pinCount++;
+}
+
+void PageTextCache::Unpin(int pageNo)
+{
+    CrashIf(pageNo < 1 || pageNo > engine->PageCount());
+    ScopedCritSec scope(&access);
+    PageTextData& data = pages[pageNo - 1];
+    CrashIf(data.pinCount <= 0);
+    data.pinCount--;
+    if (0 == data.pinCount)
+        EvictData(MAX_TEXT_CACHE_SIZE);
+}
+
 bool PageTextCache::HasData(int pageNo)
 {
     CrashIf(pageNo < 1 || pageNo > engine->PageCount());
-    return text[pageNo - 1] != NULL;
+    return pages[pageNo - 1].text != NULL;
 }
 
 const WCHAR *PageTextCache::GetData(int pageNo, int *lenOut, RectI **coordsOut)
 {
     ScopedCritSec scope(&access);
 
-    if (!text[pageNo - 1]) {
-        text[pageNo - 1] = engine->ExtractPageText(pageNo, L"\n", &coords[pageNo - 1]);
-        if (!text[pageNo - 1]) {
-            text[pageNo - 1] = str::Dup(L"");
-            lens[pageNo - 1] = 0;
-        }
-        else {
-            lens[pageNo - 1] = (int)str::Len(text[pageNo - 1]);
-        }
-#ifdef DEBUG
-        debug_size += (lens[pageNo - 1] + 1) * (sizeof(WCHAR) + sizeof(RectI));
-#endif
+    PageTextData& data = pages[pageNo - 1];
+    if (!data.text && (-1 == data.indexOffset || !LoadFromIndex(pageNo))) {
+        RectI *pageCoords = NULL;
+        WCHAR *pageText = engine->ExtractPageText(pageNo, L"\n", &pageCoords);
+        StoreData(pageNo, pageText, pageCoords);
+    }
+    if (coordsOut && !data.coords && data.len > 0) {
+        cacheSize -= data.size;
+        data.coords = DecodeCoords(data);
+        data.size = DataSize(data);
+        cacheSize += data.size;
     }
+    UseData(pageNo);
+    EvictData(MAX_TEXT_CACHE_SIZE);
 
     if (lenOut)
-        *lenOut = lens[pageNo - 1];
+        *lenOut = data.len;
     if (coordsOut)
-        *coordsOut = coords[pageNo - 1];
-    return text[pageNo - 1];
+        *coordsOut = data.coords;
+    return data.text;
+}
+
+const WCHAR *PageTextCache::GetFoldedData(int pageNo, int *lenOut)
+{
+    ScopedCritSec scope(&access);
+    const WCHAR *pageText = GetData(pageNo, lenOut);
+
+    PageTextData& data = pages[pageNo - 1];
+    if (!data.folded) {
+        data.folded = str::DupN(pageText, data.len);
+        if (!data.folded)
+            return NULL;
+        if (data.len > 0)
+            CharLowerBuff(data.folded, data.len);
+        cacheSize -= data.size;
+        data.size = DataSize(data);
+        cacheSize += data.size;
+    }
+    UseData(pageNo);
+
+    return data.folded;
+}
+
+GlyphGrid *PageTextCache::GetGlyphGrid(int pageNo)
+{
+    RectI *coords;
+    int len;
+    ScopedCritSec scope(&access);
+    GetData(pageNo, &len, &coords);
+
+    PageTextData& data = pages[pageNo - 1];
+    if (!data.grid && coords && len >= MIN_GLYPHS_FOR_GRID) {
+        data.grid = new GlyphGrid(coords, len);
+        if (!data.grid->IsValid()) {
+            delete data.grid;
+            data.grid = NULL;
+        }
+        cacheSize -= data.size;
+        data.size = DataSize(data);
+        cacheSize += data.size;
+    }
+    UseData(pageNo);
+
+    return data.grid;
+}
+
+int PageTextCache::FindEndpoint(int pageNo, int idx, bool lines, bool forward, bool skipGap)
+{
+    int len;
+    ScopedCritSec scope(&access);
+    const WCHAR *text = GetData(pageNo, &len);
+
+    PageTextData& data = pages[pageNo - 1];
+    TextRuns *& runs = lines ? data.lines : data.words;
+    if (!runs && text) {
+        runs = new TextRuns(text, len, lines ? IsNotLineBreak : IsWordChar);
+        if (!runs->IsValid()) {
+            delete runs;
+            runs = NULL;
+        }
+        cacheSize -= data.size;
+        data.size = DataSize(data);
+        cacheSize += data.size;
+    }
+    UseData(pageNo);
+
+    if (!runs)
+        return idx;
+    return runs->FindEndpoint(idx, forward, skipGap);
+}
+
+void PageTextCache::ExtractData(int pageNo, BaseEngine *pageEngine)
+{
+    if (HasData(pageNo))
+        return;
+    if (pages[pageNo - 1].indexOffset != -1) {
+        ScopedCritSec scope(&access);
+        if (pages[pageNo - 1].text || LoadFromIndex(pageNo)) {
+            UseData(pageNo);
+            EvictData(MAX_TEXT_CACHE_SIZE);
+            return;
+        }
+    }
+
+    RectI *pageCoords = NULL;
+    WCHAR *pageText = pageEngine->ExtractPageText(pageNo, L"\n", &pageCoords);
+
+    ScopedCritSec scope(&access);
+    if (pages[pageNo - 1].text) {
+        // the page has been extracted by GetData in the meantime
+        free(pageText);
+        free(pageCoords);
+        return;
+    }
+    StoreData(pageNo, pageText, pageCoords);
+    UseData(pageNo);
+    EvictData(MAX_TEXT_CACHE_SIZE);
+}
+
+// note: the following methods must be called with access held
+
+void PageTextCache::StoreData(int pageNo, WCHAR *pageText, RectI *pageCoords)
+{
+    PageTextData& data = pages[pageNo - 1];
+    CrashIf(data.text);
+    data.text = pageText ? pageText : str::Dup(L"");
+    data.len = pageText ? (int)str::Len(pageText) : 0;
+    if (!EncodeCoords(data, pageCoords))
+        data.len = 0;
+    free(pageCoords);
+    data.size = DataSize(data);
+    cacheSize += data.size;
+}
+
+void PageTextCache::UseData(int pageNo)
+{
+    int ix = pageNo - 1;
+    PageTextData& data = pages[ix];
+    if (lruFirst == ix)
+        return;
+    // unlink the page (if it's linked at all)
+    if (data.lruPrev != -1)
+        pages[data.lruPrev].lruNext = data.lruNext;
+    if (data.lruNext != -1)
+        pages[data.lruNext].lruPrev = data.lruPrev;
+    if (lruLast == ix)
+        lruLast = data.lruPrev;
+    // and move it to the front
+    data.lruPrev = -1;
+    data.lruNext = lruFirst;
+    if (lruFirst != -1)
+        pages[lruFirst].lruPrev = ix;
+    lruFirst = ix;
+    if (-1 == lruLast)
+        lruLast = ix;
+}
+
+// removes the page from the LRU list
+void PageTextCache::UnlinkData(int pageNo)
+{
+    int ix = pageNo - 1;
+    PageTextData& data = pages[ix];
+    if (data.lruPrev != -1)
+        pages[data.lruPrev].lruNext = data.lruNext;
+    if (data.lruNext != -1)
+        pages[data.lruNext].lruPrev = data.lruPrev;
+    if (lruFirst == ix)
+        lruFirst = data.lruNext;
+    if (lruLast == ix)
+        lruLast = data.lruPrev;
+    data.lruPrev = data.lruNext = -1;
+}
+
+void PageTextCache::FreeData(int pageNo)
+{
+    PageTextData& data = pages[pageNo - 1];
+    if (!data.text)
+        return;
+    UnlinkData(pageNo);
+
+    free(data.text);
+    free(data.folded);
+    free(data.runs);
+    free(data.boxes);
+    free(data.coords);
+    delete data.grid;
+    delete data.words;
+    delete data.lines;
+    cacheSize -= data.size;
+
+    int64 indexOffset = data.indexOffset;
+    int pinCount = data.pinCount;
+    ZeroMemory(&data, sizeof(data));
+    data.lruPrev = data.lruNext = -1;
+    data.indexOffset = indexOffset;
+    data.pinCount = pinCount;
+}
+
+// drops the least recently used pages which aren't pinned (except for the
+// most recently used one, whose data GetData is about to return)
+void PageTextCache::EvictData(size_t maxSize)
+{
+    HANDLE hIndex = INVALID_HANDLE_VALUE;
+    for (int ix = lruLast; cacheSize > maxSize && ix != -1 && ix != lruFirst; ) {
+        PageTextData& data = pages[ix];
+        int prev = data.lruPrev;
+        if (data.pinCount > 0) {
+            ix = prev;
+            continue;
+        }
+        // keep the page's text available through the index
+        if (indexFile && -1 == data.indexOffset) {
+            if (INVALID_HANDLE_VALUE == hIndex)
+                hIndex = OpenForAppending(indexFile);
+            AppendToIndex(hIndex, ix + 1);
+        }
+        FreeData(ix + 1);
+        ix = prev;
+    }
+    if (hIndex != INVALID_HANDLE_VALUE)
+        CloseHandle(hIndex);
+}
+
+/* The index file consists of a TextIndexHeader followed by any number of
+   records, each consisting of a TextIndexPageHeader followed by len WCHARs
+   of text, runCount GlyphRuns and len GlyphBoxes (pages are appended as
+   they're extracted, so a later record for a page overrides earlier ones) */
+
+#define TEXT_INDEX_MAGIC    0x49545853 /* 'SXTI' */
+#define TEXT_INDEX_VERSION  2
+
+struct TextIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pageCount;
+};
+
+struct TextIndexPageHeader {
+    int32_t pageNo;
+    int32_t len;
+    int32_t runCount;
+};
+
+static int64 RecordSize(const TextIndexPageHeader& rec)
+{
+    return sizeof(TextIndexPageHeader) + (int64)rec.len * (sizeof(WCHAR) + sizeof(GlyphBox)) +
+           (int64)rec.runCount * sizeof(GlyphRun);
+}
+
+static bool ReadAt(HANDLE h, int64 offset, void *buffer, size_t len)
+{
+    if (0 == len)
+        return true;
+    LARGE_INTEGER off;
+    off.QuadPart = offset;
+    DWORD read;
+    return SetFilePointerEx(h, off, NULL, FILE_BEGIN) &&
+           ReadFile(h, buffer, (DWORD)len, &read, NULL) && read == len;
+}
+
+static bool WriteAtEnd(HANDLE h, const void *data, size_t len)
+{
+    if (0 == len)
+        return true;
+    DWORD written;
+    return WriteFile(h, data, (DWORD)len, &written, NULL) && written == len;
+}
+
+void PageTextCache::SetIndexFile(const WCHAR *filePath)
+{
+    ScopedCritSec scope(&access);
+    str::ReplacePtr(&indexFile, filePath);
+    if (!indexFile || LoadIndex())
+        return;
+
+    // start a new index, if it's missing, outdated or corrupted
+    for (int i = 0; i < engine->PageCount(); i++) {
+        pages[i].indexOffset = -1;
+    }
+    TextIndexHeader header = { TEXT_INDEX_MAGIC, TEXT_INDEX_VERSION, engine->PageCount() };
+    if (!file::WriteAll(indexFile, &header, sizeof(header)))
+        str::ReplacePtr(&indexFile, NULL);
+}
+
+bool PageTextCache::LoadIndex()
+{
+    ScopedHandle h(file::OpenReadOnly(indexFile));
+    if (INVALID_HANDLE_VALUE == h)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(h, &fileSize))
+        return false;
+
+    TextIndexHeader header;
+    if (!ReadAt(h, 0, &header, sizeof(header)))
+        return false;
+    if (header.magic != TEXT_INDEX_MAGIC || header.version != TEXT_INDEX_VERSION ||
+        header.pageCount != engine->PageCount()) {
+        return false;
+    }
+
+    int64 offset = sizeof(header);
+    while (offset < fileSize.QuadPart) {
+        TextIndexPageHeader rec;
+        if (!ReadAt(h, offset, &rec, sizeof(rec)))
+            return false;
+        if (rec.pageNo < 1 || rec.pageNo > engine->PageCount() || rec.len < 0 ||
+            rec.runCount < 0 || rec.runCount > rec.len) {
+            return false;
+        }
+        if (offset + RecordSize(rec) > fileSize.QuadPart)
+            return false;
+        pages[rec.pageNo - 1].indexOffset = offset;
+        offset += RecordSize(rec);
+    }
+    return true;
+}
+
+bool PageTextCache::LoadFromIndex(int pageNo)
+{
+    PageTextData& data = pages[pageNo - 1];
+    CrashIf(data.text || -1 == data.indexOffset);
+    ScopedHandle h(file::OpenReadOnly(indexFile));
+    if (INVALID_HANDLE_VALUE == h)
+        return false;
+
+    TextIndexPageHeader rec;
+    if (!ReadAt(h, data.indexOffset, &rec, sizeof(rec)) || rec.pageNo != pageNo ||
+        rec.len < 0 || rec.runCount < 0 || rec.runCount > rec.len) {
+        return false;
+    }
+
+    ScopedMem<WCHAR> text(AllocArray<WCHAR>(rec.len + 1));
+    ScopedMem<GlyphRun> runs(rec.runCount > 0 ? AllocArray<GlyphRun>(rec.runCount) : NULL);
+    ScopedMem<GlyphBox> boxes(rec.len > 0 ? AllocArray<GlyphBox>(rec.len) : NULL);
+    if (!text || rec.runCount > 0 && !runs || rec.len > 0 && !boxes)
+        return false;
+    int64 offset = data.indexOffset + sizeof(rec);
+    if (!ReadAt(h, offset, text, rec.len * sizeof(WCHAR)))
+        return false;
+    offset += rec.len * sizeof(WCHAR);
+    if (!ReadAt(h, offset, runs, rec.runCount * sizeof(GlyphRun)))
+        return false;
+    offset += rec.runCount * sizeof(GlyphRun);
+    if (!ReadAt(h, offset, boxes, rec.len * sizeof(GlyphBox)))
+        return false;
+    // runs must cover all glyphs in order
+    if (rec.len > 0 && (0 == rec.runCount || runs[0].start != 0))
+        return false;
+    for (int r = 1; r < rec.runCount; r++) {
+        if (runs[r].start <= runs[r - 1].start || runs[r].start >= rec.len)
+            return false;
+    }
+
+    data.text = text.StealData();
+    data.len = rec.len;
+    data.runs = runs.StealData();
+    data.runCount = rec.runCount;
+    data.boxes = boxes.StealData();
+    data.size = DataSize(data);
+    cacheSize += data.size;
+    return true;
+}
+
+// h must have been opened with OpenForAppending
+bool PageTextCache::AppendToIndex(HANDLE h, int pageNo)
+{
+    PageTextData& data = pages[pageNo - 1];
+    CrashIf(!data.text);
+    if (INVALID_HANDLE_VALUE == h)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(h, &fileSize))
+        return false;
+
+    TextIndexPageHeader rec = { pageNo, data.len, data.runCount };
+    bool ok = WriteAtEnd(h, &rec, sizeof(rec)) &&
+              WriteAtEnd(h, data.text, data.len * sizeof(WCHAR)) &&
+              WriteAtEnd(h, data.runs, data.runCount * sizeof(GlyphRun)) &&
+              WriteAtEnd(h, data.boxes, data.len * sizeof(GlyphBox));
+    if (ok)
+        data.indexOffset = fileSize.QuadPart;
+    return ok;
+}
+
+bool PageTextCache::SaveIndex()
+{
+    ScopedCritSec scope(&access);
+    if (!indexFile)
+        return true;
+
+    HANDLE h = INVALID_HANDLE_VALUE;
+    bool ok = true;
+    for (int i = 0; i < engine->PageCount() && ok; i++) {
+        if (!pages[i].text || pages[i].indexOffset != -1)
+            continue;
+        if (INVALID_HANDLE_VALUE == h)
+            h = OpenForAppending(indexFile);
+        ok = AppendToIndex(h, i + 1);
+    }
+    if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+    return ok;
 }
 
 TextSelection::TextSelection(BaseEngine *engine, PageTextCache *textCache) :
@@ -93,9 +895,11 @@ void TextSelection::Reset()
 // glyph following it, which will be the first glyph (not) to be selected)
 int TextSelection::FindClosestGlyph(int pageNo, double x, double y)
 {
+    ScopedTextPin pin(textCache, pageNo);
     int textLen;
     RectI *coords;
     textCache->GetData(pageNo, &textLen, &coords);
+    GlyphGrid *grid = textCache->GetGlyphGrid(pageNo);
     PointD pt = PointD(x, y);
 
     unsigned int maxDist = UINT_MAX;
@@ -103,7 +907,9 @@ int TextSelection::FindClosestGlyph(int pageNo, double x, double y)
     bool overGlyph = false;
     int result = -1;
 
-    for (int i = 0; i < textLen; i++) {
+    if (grid)
+        result = grid->FindClosestGlyph(coords, pti, PointI((int)x, (int)y));
+    for (int i = 0; i < textLen && !grid; i++) {
         if (!coords[i].x && !coords[i].dx)
             continue;
         if (overGlyph && !coords[i].Contains(pti))
@@ -141,11 +947,13 @@ int TextSelection::FindClosestGlyph(int pageNo, double x, double y)
     return result;
 }
 
-void TextSelection::FillResultRects(int pageNo, int glyph, int length, WStrVec *lines)
+// if text is non-NULL, the text of all selected lines is appended to it instead
+void TextSelection::FillResultRects(int pageNo, int glyph, int length, str::Str<WCHAR> *text, const WCHAR *lineSep)
 {
+    ScopedTextPin pin(textCache, pageNo);
     int len;
     RectI *coords;
-    const WCHAR *text = textCache->GetData(pageNo, &len, &coords);
+    const WCHAR *pageText = textCache->GetData(pageNo, &len, &coords);
     CrashIf(len < glyph + length);
     RectI mediabox = engine->PageMediabox(pageNo).Round();
     RectI *c = &coords[glyph], *end = c + length;
@@ -162,8 +970,10 @@ void TextSelection::FillResultRects(int pageNo, int glyph, int length, WStrVec *
         if (bbox.IsEmpty())
             continue;
 
-        if (lines) {
-            lines->Push(str::DupN(text + (c0 - coords), c - c0));
+        if (text) {
+            if (text->Count() > 0)
+                text->Append(lineSep);
+            text->Append(pageText + (c0 - coords), c - c0);
             continue;
         }
 
@@ -185,6 +995,7 @@ void TextSelection::FillResultRects(int pageNo, int glyph, int length, WStrVec *
 
 bool TextSelection::IsOverGlyph(int pageNo, double x, double y)
 {
+    ScopedTextPin pin(textCache, pageNo);
     int textLen;
     RectI *coords;
     textCache->GetData(pageNo, &textLen, &coords);
@@ -244,6 +1055,7 @@ void TextSelection::SelectUpTo(int pageNo, int glyphIx)
 
 void TextSelection::SelectWordAt(int pageNo, double x, double y)
 {
+    ScopedTextPin pin(textCache, pageNo);
     int ix = FindClosestGlyph(pageNo, x, y);
     int textLen;
     const WCHAR *text = textCache->GetData(pageNo, &textLen);
@@ -266,9 +1078,20 @@ void TextSelection::CopySelection(TextSelection *orig)
     SelectUpTo(orig->endPage, orig->endGlyph);
 }
 
+void TextSelection::CopyGlyphRange(TextSelection *orig)
+{
+    Reset();
+    startPage = orig->startPage;
+    startGlyph = orig->startGlyph;
+    endPage = orig->endPage;
+    endGlyph = orig->endGlyph;
+}
+
 WCHAR *TextSelection::ExtractText(WCHAR *lineSep)
 {
-    WStrVec lines;
+    // all lines are appended to a single buffer (instead of
+    // being collected individually and then joined)
+    str::Str<WCHAR> text(1024);
 
     int fromPage, fromGlyph, toPage, toGlyph;
     GetGlyphRange(&fromPage, &fromGlyph, &toPage, &toGlyph);
@@ -279,10 +1102,10 @@ WCHAR *TextSelection::ExtractText(WCHAR *lineSep)
         int glyph = page == fromPage ? fromGlyph : 0;
         int length = (page == toPage ? toGlyph : textLen) - glyph;
         if (length > 0)
-            FillResultRects(page, glyph, length, &lines);
+            FillResultRects(page, glyph, length, &text, lineSep);
     }
 
-    return lines.Join(lineSep);
+    return text.StealData();
 }
 
 void TextSelection::GetGlyphRange(int *fromPage, int *fromGlyph, int *toPage, int *toGlyph) const
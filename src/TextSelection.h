@@ -6,29 +6,100 @@
 
 #include "BaseEngine.h"
 
-class WStrVec;
-
 #define iswordchar(c) IsCharAlphaNumeric(c)
 
 inline unsigned int distSq(int x, int y) { return x * x + y * y; }
 
+struct PageTextData;
+class GlyphGrid;
+class TextRuns;
+
+/* Caches the text (and glyph coordinates) extracted from a document's pages.
+   Glyph coordinates are stored compactly and only decoded into RectIs when
+   asked for, and the least recently used pages are dropped when the cache
+   grows beyond its size limit (pointers returned by GetData and the like
+   are only guaranteed to remain valid while the page is pinned, as pinned
+   pages are never dropped) */
 class PageTextCache {
     BaseEngine* engine;
-    RectI    ** coords;
-    WCHAR    ** text;
-    int       * lens;
-#ifdef DEBUG
-    size_t      debug_size;
-#endif
+    PageTextData * pages;
+    // size of all cached data in bytes
+    size_t      cacheSize;
+    // most and least recently used page (doubly linked through PageTextData)
+    int         lruFirst, lruLast;
 
     CRITICAL_SECTION access;
 
+    // optional file persisting the extracted text (cf. SetIndexFile)
+    WCHAR     * indexFile;
+
+    void StoreData(int pageNo, WCHAR *pageText, RectI *pageCoords);
+    void UseData(int pageNo);
+    void UnlinkData(int pageNo);
+    void FreeData(int pageNo);
+    void EvictData(size_t maxSize);
+    bool LoadIndex();
+    bool LoadFromIndex(int pageNo);
+    bool AppendToIndex(HANDLE h, int pageNo);
+    int FindEndpoint(int pageNo, int idx, bool lines, bool forward, bool skipGap);
+
 public:
     PageTextCache(BaseEngine *engine);
     ~PageTextCache();
 
     bool HasData(int pageNo);
     const WCHAR *GetData(int pageNo, int *lenOut=NULL, RectI **coordsOut=NULL);
+    // same as GetData but with all characters converted to lowercase (as by CharLower)
+    const WCHAR *GetFoldedData(int pageNo, int *lenOut=NULL);
+    // spatial index over the page's glyph coordinates for hit testing
+    // (NULL for pages with only a few glyphs)
+    GlyphGrid *GetGlyphGrid(int pageNo);
+    // returns the start of the word ending at idx (or the end of the word
+    // starting at idx if forward); if skipGap, the closest word before (or
+    // after) idx is used instead when idx isn't next to a word
+    // (this takes constant time once the page's words have been indexed)
+    int FindWordEndpoint(int pageNo, int idx, bool forward, bool skipGap=false) {
+        return FindEndpoint(pageNo, idx, false, forward, skipGap);
+    }
+    // same as FindWordEndpoint for lines
+    int FindLineEndpoint(int pageNo, int idx, bool forward, bool skipGap=false) {
+        return FindEndpoint(pageNo, idx, true, forward, skipGap);
+    }
+    // extracts a page's text with a different engine (e.g. a Clone() used on
+    // another thread) without blocking concurrent calls for other pages
+    void ExtractData(int pageNo, BaseEngine *pageEngine);
+    // moves a page's text from another cache (e.g. for a page which
+    // hasn't changed when the document has been reloaded)
+    void TakeData(PageTextCache *other, int pageNo);
+    // keeps a page's data from being dropped until it's unpinned again
+    // (calls can be nested; cf. ScopedTextPin)
+    void Pin(int pageNo);
+    void Unpin(int pageNo);
+
+    // allows to load the text of pages previously stored in filePath (which
+    // should be unique to a file's content) instead of extracting it again
+    void SetIndexFile(const WCHAR *filePath);
+    bool HasIndexFile() const { return indexFile != NULL; }
+
+    // returns how much memory the cached text and glyph coordinates take up
+    size_t GetMemoryUsage();
+    // frees the text of all pages which haven't been used recently
+    // (it's loaded from the index or extracted again when needed)
+    void Compact();
+    // appends the text of all pages which aren't stored in the index yet
+    // (returns false only on failure)
+    bool SaveIndex();
+};
+
+class ScopedTextPin {
+    PageTextCache *textCache;
+    int pageNo;
+
+public:
+    ScopedTextPin(PageTextCache *textCache, int pageNo) : textCache(textCache), pageNo(pageNo) {
+        textCache->Pin(pageNo);
+    }
+    ~ScopedTextPin() { textCache->Unpin(pageNo); }
 };
 
 struct TextSel {
@@ -54,6 +125,9 @@ public:
     }
     void SelectWordAt(int pageNo, double x, double y);
     void CopySelection(TextSelection *orig);
+    // same as CopySelection except that result isn't filled
+    // (which is all that's needed for ExtractText)
+    void CopyGlyphRange(TextSelection *orig);
     WCHAR *ExtractText(WCHAR *lineSep);
     void Reset();
 
@@ -69,7 +143,7 @@ protected:
     PageTextCache * textCache;
 
     int FindClosestGlyph(int pageNo, double x, double y);
-    void FillResultRects(int pageNo, int glyph, int length, WStrVec *lines=NULL);
+    void FillResultRects(int pageNo, int glyph, int length, str::Str<WCHAR> *text=NULL, const WCHAR *lineSep=NULL);
 };
 
 #endif
@@ -549,15 +549,21 @@ static void CreatePageBox(WindowInfo& win)
 #define WS_REBAR (WS_CHILD | WS_CLIPCHILDREN | WS_BORDER | RBS_VARHEIGHT | \
                   RBS_BANDBORDERS | CCS_NODIVIDER | CCS_NOPARENTALIGN)
 
-void CreateToolbar(WindowInfo *win)
-{
-    HWND hwndToolbar = CreateWindowEx(0, TOOLBARCLASSNAME, NULL, WS_TOOLBAR,
-                                      0, 0, 0, 0, win->hwndFrame,(HMENU)IDC_TOOLBAR, ghinst, NULL);
-    win->hwndToolbar = hwndToolbar;
-    SendMessage(hwndToolbar, TB_BUTTONSTRUCTSIZE, (WPARAM)sizeof(TBBUTTON), 0);
+// the toolbar bitmap is loaded and (for higher DPI settings) stretched only
+// once per DPI factor and the resulting image list is shared by all windows
+struct ToolbarImageList {
+    float uiDPIFactor;
+    HIMAGELIST himl;
+};
 
-    ShowWindow(hwndToolbar, SW_SHOW);
-    TBBUTTON tbButtons[TOOLBAR_BUTTONS_COUNT];
+static Vec<ToolbarImageList> gToolbarImageLists;
+
+static HIMAGELIST GetToolbarImageList(float uiDPIFactor)
+{
+    for (size_t i = 0; i < gToolbarImageLists.Count(); i++) {
+        if (gToolbarImageLists.At(i).uiDPIFactor == uiDPIFactor)
+            return gToolbarImageLists.At(i).himl;
+    }
 
     // the name of the bitmap contains the number of icons so that after adding/removing
     // icons a complete default toolbar is used rather than an incomplete customized one
@@ -565,9 +571,9 @@ void CreateToolbar(WindowInfo *win)
     SizeI size = GetBitmapSize(hbmp);
     // stretch the toolbar bitmaps for higher DPI settings
     // TODO: get nicely interpolated versions of the toolbar icons for higher resolutions
-    if (size.dy < TOOLBAR_MIN_ICON_SIZE * win->uiDPIFactor) {
-        size.dx *= (int)(win->uiDPIFactor + 0.5f);
-        size.dy *= (int)(win->uiDPIFactor + 0.5f);
+    if (size.dy < TOOLBAR_MIN_ICON_SIZE * uiDPIFactor) {
+        size.dx *= (int)(uiDPIFactor + 0.5f);
+        size.dy *= (int)(uiDPIFactor + 0.5f);
         hbmp = (HBITMAP)CopyImage(hbmp, IMAGE_BITMAP, size.dx, size.dy, LR_COPYDELETEORG);
     }
     // Assume square icons
@@ -575,8 +581,33 @@ void CreateToolbar(WindowInfo *win)
     ImageList_AddMasked(himl, hbmp, RGB(0xFF, 0, 0xFF));
     DeleteObject(hbmp);
 
+    ToolbarImageList entry = { uiDPIFactor, himl };
+    gToolbarImageLists.Append(entry);
+    return himl;
+}
+
+void DeleteToolbarImageLists()
+{
+    for (size_t i = 0; i < gToolbarImageLists.Count(); i++) {
+        ImageList_Destroy(gToolbarImageLists.At(i).himl);
+    }
+    gToolbarImageLists.Reset();
+}
+
+void CreateToolbar(WindowInfo *win)
+{
+    HWND hwndToolbar = CreateWindowEx(0, TOOLBARCLASSNAME, NULL, WS_TOOLBAR,
+                                      0, 0, 0, 0, win->hwndFrame,(HMENU)IDC_TOOLBAR, ghinst, NULL);
+    win->hwndToolbar = hwndToolbar;
+    SendMessage(hwndToolbar, TB_BUTTONSTRUCTSIZE, (WPARAM)sizeof(TBBUTTON), 0);
+
+    ShowWindow(hwndToolbar, SW_SHOW);
+    TBBUTTON tbButtons[TOOLBAR_BUTTONS_COUNT];
+
+    HIMAGELIST himl = GetToolbarImageList(win->uiDPIFactor);
+
     // in Plugin mode, replace the Open with a Save As button
-    if (gPluginMode && size.dx / size.dy == 13) {
+    if (gPluginMode && ImageList_GetImageCount(himl) == 13) {
         gToolbarButtons[0].bmpIndex = 12;
         gToolbarButtons[0].cmdId = IDM_SAVEAS;
         gToolbarButtons[0].toolTip = _TRN("Save As");
@@ -14,5 +14,6 @@ void UpdateToolbarPageText(WindowInfo *win, int pageCount, bool updateOnly=false
 void UpdateFindbox(WindowInfo* win);
 void ShowOrHideToolbarGlobally();
 void UpdateToolbarState(WindowInfo *win);
+void DeleteToolbarImageLists();
 
 #endif
@@ -259,6 +259,61 @@ const char *gOriginalStrings[STRINGS_COUNT] = {
 
 const char **GetOriginalStrings() { return &gOriginalStrings[0]; }
 
+#define STRINGS_HASH_BUCKETS 64
+#define STRINGS_HASH_SLOTS 512
+
+// perfect hash of gOriginalStrings (cf. GetEnglishStringIndex): the seed
+// for the strings of every bucket and the index + 1 of the string in every slot
+static const uint16_t gOriginalStringsHashSeeds[STRINGS_HASH_BUCKETS] = {
+  1, 2, 2, 1, 2, 1, 1, 0, 1, 1, 1, 2, 1, 2, 2, 3,
+  2, 4, 1, 1, 1, 3, 0, 1, 1, 1, 2, 1, 2, 0, 1, 2,
+  4, 11, 1, 1, 2, 0, 1, 2, 11, 1, 6, 3, 1, 6, 1, 5,
+  3, 3, 1, 15, 5, 8, 5, 4, 1, 2, 8, 1, 1, 4, 2, 3
+};
+
+static const uint16_t gOriginalStringsHashSlots[STRINGS_HASH_SLOTS] = {
+  130, 133, 141, 138, 0, 96, 0, 24, 0, 0, 0, 226, 62, 0, 85, 21,
+  0, 0, 71, 0, 81, 33, 0, 127, 124, 0, 0, 0, 0, 0, 0, 236,
+  180, 10, 0, 0, 224, 6, 63, 0, 50, 0, 0, 151, 98, 137, 0, 242,
+  203, 0, 206, 101, 68, 0, 47, 0, 0, 14, 0, 0, 0, 190, 0, 188,
+  0, 76, 0, 0, 23, 0, 77, 83, 9, 0, 61, 0, 0, 79, 0, 0,
+  0, 139, 172, 0, 0, 0, 0, 239, 0, 59, 0, 0, 41, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 58, 0, 213, 208, 181, 153, 102, 0, 57, 0,
+  146, 100, 0, 55, 217, 0, 173, 238, 44, 0, 0, 109, 0, 0, 0, 90,
+  104, 56, 0, 0, 32, 0, 0, 0, 0, 19, 154, 91, 152, 176, 158, 28,
+  150, 0, 166, 0, 184, 95, 13, 126, 8, 20, 0, 39, 202, 175, 0, 169,
+  168, 140, 31, 0, 0, 88, 5, 52, 70, 0, 122, 0, 155, 0, 229, 0,
+  0, 114, 0, 0, 0, 17, 84, 0, 142, 0, 164, 0, 0, 0, 0, 60,
+  185, 0, 0, 99, 218, 0, 222, 0, 106, 75, 228, 147, 0, 237, 0, 53,
+  0, 0, 118, 129, 0, 0, 0, 0, 29, 223, 234, 0, 0, 2, 0, 0,
+  0, 212, 0, 0, 0, 49, 0, 0, 0, 0, 0, 0, 0, 157, 87, 0,
+  0, 143, 196, 160, 0, 0, 171, 0, 0, 73, 0, 0, 107, 0, 215, 0,
+  128, 136, 0, 94, 45, 0, 233, 197, 0, 148, 0, 0, 0, 80, 0, 0,
+  219, 0, 113, 0, 0, 0, 0, 0, 121, 0, 0, 0, 93, 192, 38, 3,
+  0, 209, 64, 120, 162, 78, 0, 0, 92, 0, 110, 0, 0, 0, 30, 86,
+  221, 199, 117, 115, 0, 0, 0, 0, 0, 0, 183, 0, 131, 0, 66, 0,
+  43, 0, 0, 0, 34, 0, 74, 189, 0, 198, 0, 0, 0, 0, 0, 0,
+  216, 82, 12, 0, 105, 25, 48, 170, 0, 7, 0, 0, 240, 0, 54, 214,
+  0, 0, 161, 0, 40, 0, 15, 135, 22, 97, 205, 0, 72, 149, 243, 0,
+  0, 0, 163, 27, 0, 111, 37, 156, 125, 167, 16, 36, 0, 232, 0, 0,
+  103, 207, 0, 0, 0, 165, 0, 0, 0, 0, 244, 193, 0, 145, 174, 0,
+  0, 178, 211, 235, 0, 0, 231, 11, 0, 35, 0, 46, 0, 0, 42, 204,
+  0, 0, 182, 119, 0, 0, 220, 0, 0, 69, 0, 0, 0, 0, 0, 0,
+  186, 144, 0, 0, 112, 0, 225, 0, 195, 201, 179, 0, 132, 0, 0, 1,
+  0, 0, 0, 0, 0, 0, 4, 200, 51, 67, 0, 194, 18, 0, 0, 0,
+  210, 0, 177, 0, 0, 0, 0, 0, 0, 191, 0, 0, 0, 159, 0, 0,
+  26, 65, 123, 0, 0, 0, 108, 0, 0, 0, 0, 241, 0, 0, 0, 134,
+  0, 89, 0, 0, 0, 0, 0, 0, 230, 187, 0, 0, 116, 0, 0, 227
+};
+
+void GetOriginalStringsHash(const uint16_t **seeds, int *bucketsCount, const uint16_t **slots, int *slotsCount)
+{
+    *seeds = &gOriginalStringsHashSeeds[0];
+    *bucketsCount = STRINGS_HASH_BUCKETS;
+    *slots = &gOriginalStringsHashSlots[0];
+    *slotsCount = STRINGS_HASH_SLOTS;
+}
+
 
 const char * gTranslations_sq = 
   "&P\303\253r\0"\
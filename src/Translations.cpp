@@ -67,6 +67,8 @@ extern const char *     gLangCodes;
 const LANGID *          GetLangIds();
 bool                    IsLangRtl(int langIdx);
 const char **           GetOriginalStrings();
+void                    GetOriginalStringsHash(const uint16_t **seeds, int *bucketsCount,
+                                               const uint16_t **slots, int *slotsCount);
 
 // used locally, gCurrLangCode points into gLangCodes
 static const char *     gCurrLangCode = NULL;
@@ -268,15 +270,28 @@ const char *DetectUserLang()
     return "en";
 }
 
-static int GetEnglishStringIndex(const char* txt)
+// FNV-1a, must match hash_string in scripts/trans_gen.py
+static uint32_t HashString(const char *s, uint32_t seed)
 {
-    const char **origStrings = GetOriginalStrings();
-    for (int idx = 0; idx < gStringsCount; idx++) {
-        const char *s = origStrings[idx];
-        if (str::Eq(s, txt))
-            return idx;
+    uint32_t h = 2166136261U ^ seed;
+    for (; *s; s++) {
+        h = (h ^ (uint8_t)*s) * 16777619U;
     }
-    return -1;
+    return h;
+}
+
+// trans_gen.py generates a perfect hash for the original strings
+// (cf. gen_strings_hash), so that a lookup takes a single comparison
+static int GetEnglishStringIndex(const char* txt)
+{
+    const uint16_t *seeds, *slots;
+    int bucketsCount, slotsCount;
+    GetOriginalStringsHash(&seeds, &bucketsCount, &slots, &slotsCount);
+    uint32_t seed = seeds[HashString(txt, 0) % bucketsCount];
+    int idx = slots[HashString(txt, seed) % slotsCount] - 1;
+    if (idx < 0 || !str::Eq(GetOriginalStrings()[idx], txt))
+        return -1;
+    return idx;
 }
 
 const WCHAR *GetTranslation(const char *s)
@@ -64,6 +64,23 @@ static void ParseCommandLineTest()
         utassert(str::Eq(L"1,3,8-34", i.pathsToBenchmark.At(3)));
     }
 
+    {
+        CommandLineInfo i;
+        i.ParseCommandLine(L"SumatraPDF.exe -bench foo.pdf loadonly -bench-output results.json");
+        utassert(2 == i.pathsToBenchmark.Count());
+        utassert(str::Eq(L"loadonly", i.pathsToBenchmark.At(1)));
+        utassert(str::Eq(L"results.json", i.benchOutputPath));
+    }
+
+    {
+        CommandLineInfo i;
+        i.ParseCommandLine(L"SumatraPDF.exe -bench-suite corpus.txt 5x -bench-output new.json");
+        utassert(str::Eq(L"corpus.txt", i.benchSuitePath));
+        utassert(5 == i.benchSuiteIterations);
+        utassert(str::Eq(L"new.json", i.benchOutputPath));
+        utassert(i.exitImmediately);
+    }
+
     {
         CommandLineInfo i;
         utassert(i.textColor == WIN_COL_BLACK && i.backgroundColor == WIN_COL_WHITE);
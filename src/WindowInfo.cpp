@@ -4,6 +4,7 @@
 #include "BaseUtil.h"
 #include "WindowInfo.h"
 
+#include "D2DCanvas.h"
 #include "FileUtil.h"
 #include "Notifications.h"
 #include "PdfSync.h"
@@ -18,7 +19,7 @@
 
 WindowInfo::WindowInfo(HWND hwnd) :
     dm(NULL), menu(NULL), hwndFrame(hwnd), isMenuHidden(false),
-    linkOnLastButtonDown(NULL), url(NULL), selectionOnPage(NULL),
+    linkOnLastButtonDown(NULL), url(NULL), selectionOnPage(NULL), delayedCopy(NULL),
     tocLoaded(false), tocVisible(false), tocRoot(NULL), tocKeepSelection(false),
     isFullScreen(false), presentation(PM_DISABLED), tocBeforeFullScreen(false),
     windowStateBeforePresentation(0), nonFullScreenWindowStyle(0),
@@ -29,6 +30,9 @@ WindowInfo::WindowInfo(HWND hwnd) :
     hwndSidebarSplitter(NULL), hwndFavSplitter(NULL),
     hwndInfotip(NULL), infotipVisible(false),
     findThread(NULL), findCanceled(false), printThread(NULL), printCanceled(false),
+    findAllThread(NULL), findAllCanceled(false), findAllMatches(NULL),
+    findAllText(NULL), findAllMatchCase(false),
+    engineLoader(NULL),
     showSelection(false), mouseAction(MA_IDLE), dragStartPending(false),
     prevZoomVirtual(INVALID_ZOOM), prevDisplayMode(DM_AUTOMATIC),
     loadedFilePath(NULL), currPageNo(0),
@@ -36,11 +40,13 @@ WindowInfo::WindowInfo(HWND hwnd) :
     delayedRepaintTimer(0), watcher(NULL),
     pdfsync(NULL), stressTest(NULL),
     hwndFavBox(NULL), hwndFavTree(NULL),
-    userAnnots(NULL), userAnnotsModified(false),
-    uia_provider(NULL)
+    userAnnots(NULL), userAnnotsModified(false), userHighlightsOverlaid(false),
+    uia_provider(NULL), canvas(NULL), bufferScrollable(false),
+    bufferLayoutCount(0), scrollPending(false)
 {
     dpi = win::GetHwndDpi(hwndFrame, &uiDPIFactor);
     touchState.panStarted = false;
+    ZeroMemory(&loadedFileTime, sizeof(loadedFileTime));
     buffer = new DoubleBuffer(hwndCanvas, canvasRc);
     linkHandler = new LinkHandler(*this);
     notifications = new Notifications();
@@ -63,7 +69,11 @@ WindowInfo::~WindowInfo()
     delete pdfsync;
     delete linkHandler;
     delete buffer;
+    delete canvas;
     delete selectionOnPage;
+    delete findAllMatches;
+    free(findAllText);
+    delete delayedCopy;
     delete linkOnLastButtonDown;
     delete tocRoot;
     delete notifications;
@@ -89,6 +99,9 @@ void WindowInfo::UpdateCanvasSize()
     // about the change of the canvas size
     delete buffer;
     buffer = new DoubleBuffer(hwndCanvas, canvasRc);
+    bufferScrollable = false;
+    if (canvas)
+        canvas->Resize(canvasRc.Size());
 
     if (IsDocLoaded()) {
         // the display model needs to know the full size (including scroll bars)
@@ -115,6 +128,7 @@ SizeI WindowInfo::GetViewPortSize()
 
 void WindowInfo::RedrawAll(bool update)
 {
+    bufferScrollable = false;
     InvalidateRect(this->hwndCanvas, NULL, false);
     if (update)
         UpdateWindow(this->hwndCanvas);
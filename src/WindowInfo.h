@@ -8,13 +8,26 @@
 
 class Synchronizer;
 class DoubleBuffer;
+class D2DCanvas;
 class SelectionOnPage;
 class LinkHandler;
 class Notifications;
+class NotificationWnd;
 class StressTest;
+class EngineLoadingThread;
 struct WatchedFile;
 class SumatraUIAutomationProvider;
 
+/* A ToC item in document order (cf. WindowInfo::tocNodes) */
+struct TocTreeNode {
+    DocTocItem *item;
+    // indices into WindowInfo::tocNodes (-1 if there's no such node)
+    int parent, next;
+    // NULL until the item has been added to the tree view
+    // (which only happens once its parent is expanded)
+    HTREEITEM hItem;
+};
+
 /* Describes actions which can be performed by mouse */
 enum MouseAction {
     MA_IDLE = 0,
@@ -70,6 +83,8 @@ public:
     bool IsNotPdf() const { return dm && dm->engineType != Engine_PDF; }
 
     WCHAR *         loadedFilePath;
+    // modification time of loadedFilePath when it was loaded (cf. CloneEngineFromOtherWindow)
+    FILETIME        loadedFileTime;
     DisplayModel *  dm;
 
     HWND            hwndFrame;
@@ -94,6 +109,10 @@ public:
     // an array of ids for ToC items that have been expanded/collapsed by user
     Vec<int>        tocState;
     DocTocItem *    tocRoot;
+    // the flattened tocRoot (the tree view items' lParam is an index into it)
+    Vec<TocTreeNode> tocNodes;
+    // all tocNodes pointing to a page, sorted by page number
+    Vec<TocTreeNode *> tocPageIndex;
 
     // state related to favorites
     HWND            hwndFavBox;
@@ -116,6 +135,18 @@ public:
     float           uiDPIFactor;
 
     DoubleBuffer *  buffer;
+    // if set, the document is painted with Direct2D instead
+    // of through buffer (cf. gGlobalPrefs->useGpuCanvas)
+    D2DCanvas *     canvas;
+    // whether buffer can be scrolled along with the document instead of being
+    // repainted (not if its content depends on more than the document's position,
+    // e.g. because of a gradient background or a "Please wait" message)
+    bool            bufferScrollable;
+    // dm->viewPort's position and dm->GetLayoutCount() when buffer was painted
+    PointI          bufferViewPortPos;
+    int             bufferLayoutCount;
+    // set by RepaintScrolled until the next WM_PAINT
+    bool            scrollPending;
 
     MouseAction     mouseAction;
     bool            dragStartPending;
@@ -141,6 +172,9 @@ public:
     /* after selection is done, the selected area is converted
      * to user coordinates for each page which has not empty intersection with it */
     Vec<SelectionOnPage> *selectionOnPage;
+    /* a text selection which has been copied to the clipboard but whose
+     * text is only extracted when it's requested (cf. CopySelectionToClipboard) */
+    TextSelection *delayedCopy;
 
     // a list of static links (mainly used for About and Frequently Read pages)
     Vec<StaticLinkInfo> staticLinks;
@@ -173,6 +207,18 @@ public:
     HANDLE          findThread;
     bool            findCanceled;
 
+    // all matches of findAllText (cf. GlobalPrefs::highlightAllMatches),
+    // collected page by page by findAllThread
+    HANDLE          findAllThread;
+    bool            findAllCanceled;
+    Vec<SelectionOnPage> *findAllMatches;
+    WCHAR *         findAllText;
+    bool            findAllMatchCase;
+
+    // set while a document is being loaded into this window
+    // (cf. LoadEngineInBackground in SumatraPDF.cpp)
+    EngineLoadingThread *engineLoader;
+
     LinkHandler *   linkHandler;
     PageElement *   linkOnLastButtonDown;
     const WCHAR *   url;
@@ -196,6 +242,9 @@ public:
 
     Vec<PageAnnotation> *userAnnots;
     bool            userAnnotsModified;
+    // whether the engine leaves highlights to be painted as an
+    // overlay (cf. BaseEngine::SetHighlightOverlay)
+    bool            userHighlightsOverlaid;
 
     SumatraUIAutomationProvider * uia_provider;
 
@@ -228,10 +277,13 @@ public:
     virtual void LaunchBrowser(const WCHAR *url);
     virtual void FocusFrame(bool always);
     virtual void SaveDownload(const WCHAR *url, const unsigned char *data, size_t len);
-    virtual void Repaint() { RepaintAsync(); };
+    virtual void Repaint(UINT delay) { RepaintAsync(delay); };
+    virtual void RepaintScrolled();
     virtual void UpdateScrollbars(SizeI canvas);
     virtual void RequestRendering(int pageNo);
     virtual void CleanUp(DisplayModel *dm);
+    virtual void PageSizesChanged(DisplayModel *dm);
+    virtual void DocumentLoadingProgress(DisplayModel *dm, bool completed);
 };
 
 class LinkHandler {
@@ -253,10 +305,22 @@ class LinkSaver : public LinkSaverUI {
     WindowInfo *owner;
     const WCHAR *fileName;
 
+    // for saving in chunks
+    WCHAR dstFileName[MAX_PATH];
+    HANDLE hFile;
+    size_t totalSize, savedSize;
+    NotificationWnd *progress;
+
+    bool AskForFileName();
+
 public:
-    LinkSaver(WindowInfo& win, const WCHAR *fileName) : owner(&win), fileName(fileName) { }
+    LinkSaver(WindowInfo& win, const WCHAR *fileName) : owner(&win), fileName(fileName),
+        hFile(INVALID_HANDLE_VALUE), totalSize(0), savedSize(0), progress(NULL) { }
 
     virtual bool SaveEmbedded(const unsigned char *data, size_t cbCount);
+    virtual bool StartSaveEmbedded(size_t totalSize);
+    virtual bool SaveEmbeddedChunk(const unsigned char *data, size_t cbCount);
+    virtual bool FinishSaveEmbedded(bool ok);
 };
 
 #endif
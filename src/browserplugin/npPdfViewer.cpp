@@ -196,7 +196,9 @@ bool GetExePath(WCHAR *lpPath, DWORD len)
     return true;
 }
 
-HANDLE CreateTempFile(WCHAR *filePathBufOut, size_t bufSize)
+// SumatraPDF may read the file while it's still being written to
+// (and relies on the extension for identifying such files)
+HANDLE CreateTempFile(WCHAR *filePathBufOut, size_t bufSize, const WCHAR *ext=NULL)
 {
     ScopedMem<WCHAR> tmpPath(path::GetTempPath(L"nPV"));
     if (!tmpPath)
@@ -204,9 +206,15 @@ HANDLE CreateTempFile(WCHAR *filePathBufOut, size_t bufSize)
         plogf("sp: CreateTempFile(): GetTempPath() failed");
         return NULL;
     }
+    if (ext)
+    {
+        // GetTempFileName has created an empty .tmp file which isn't needed
+        DeleteFile(tmpPath);
+        tmpPath.Set(str::Join(tmpPath, ext));
+    }
     str::BufSet(filePathBufOut, bufSize, tmpPath);
 
-    HANDLE hFile = CreateFile(filePathBufOut, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+    HANDLE hFile = CreateFile(filePathBufOut, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
                               FILE_ATTRIBUTE_NORMAL, NULL);
     if (INVALID_HANDLE_VALUE == hFile)
     {
@@ -284,8 +292,28 @@ struct InstanceData {
     WCHAR       exepath[MAX_PATH];
     float       progress, prevProgress;
     uint32_t    totalSize, currSize;
+    bool        isPdf, isLinearized, launchedEarly;
 };
 
+// linearized PDF documents of at least this size are passed on to SumatraPDF
+// as soon as the first EARLY_LAUNCH_SIZE bytes have been downloaded, so that
+// it can display the first page while the download continues
+// (cf. PdfEngine::SetFileStillGrowing)
+#define MIN_EARLY_LAUNCH_FILE_SIZE  (1024 * 1024)
+#define EARLY_LAUNCH_SIZE           (256 * 1024)
+
+// the linearization dictionary is the first object of a linearized document
+bool IsLinearizedPdf(const char *data, int len)
+{
+    len = min(len, 1024);
+    for (int i = 0; i + 11 <= len; i++)
+    {
+        if (!memcmp(data + i, "/Linearized", 11))
+            return true;
+    }
+    return false;
+}
+
 #define COL_WINDOW_BG RGB(0xcc, 0xcc, 0xcc)
 
 enum Magnitudes { KB = 1024, MB = 1024 * KB, GB = 1024 * MB };
@@ -522,7 +550,8 @@ NPError NP_LOADDS NPP_NewStream(NPP instance, NPMIMEType type, NPStream* stream,
     // browser at some point
 
     *stype = NP_ASFILE;
-    data->hFile = CreateTempFile(data->filepath, dimof(data->filepath));
+    data->isPdf = str::EqI(type, "application/pdf");
+    data->hFile = CreateTempFile(data->filepath, dimof(data->filepath), data->isPdf ? L".pdf" : NULL);
     if (data->hFile)
     {
         plogf("sp: using temporary file: %S", data->filepath);
@@ -545,6 +574,9 @@ int32_t NP_LOADDS NPP_WriteReady(NPP instance, NPStream* stream)
     return res;
 }
 
+// finalSize is the size of a document that's still being downloaded
+void LaunchWithSumatra(InstanceData *data, const char *url_utf8, uint32_t finalSize=0);
+
 int32_t NP_LOADDS NPP_Write(NPP instance, NPStream* stream, int32_t offset, int32_t len, void* buffer)
 {
     InstanceData *data = (InstanceData *)instance->pdata;
@@ -568,10 +600,21 @@ int32_t NP_LOADDS NPP_Write(NPP instance, NPStream* stream, int32_t offset, int3
     data->progress = stream->end > 0 ? 1.0f * (offset + len) / stream->end : 0;
     TriggerRepaintOnProgressChange(data);
 
+    if (0 == offset && data->isPdf)
+        data->isLinearized = IsLinearizedPdf((const char *)buffer, len);
+    if (data->hFile && data->isLinearized && !data->launchedEarly &&
+        data->totalSize >= MIN_EARLY_LAUNCH_FILE_SIZE &&
+        EARLY_LAUNCH_SIZE <= data->currSize && data->currSize < data->totalSize)
+    {
+        plogf("sp: NPP_Write() launching SumatraPDF at %d of %d bytes", data->currSize, data->totalSize);
+        data->launchedEarly = true;
+        LaunchWithSumatra(data, stream->url, data->totalSize);
+    }
+
     return bytesWritten;
 }
 
-void LaunchWithSumatra(InstanceData *data, const char *url_utf8)
+void LaunchWithSumatra(InstanceData *data, const char *url_utf8, uint32_t finalSize)
 {
     if (!file::Exists(data->filepath))
         plogf("sp: NPP_StreamAsFile() error: file doesn't exist");
@@ -591,8 +634,9 @@ void LaunchWithSumatra(InstanceData *data, const char *url_utf8)
     if (str::Len(url) > 4096)
         url.Set(NULL);
 
-    ScopedMem<WCHAR> cmdLine(str::Format(L"\"%s\" -plugin \"%s\" %d \"%s\"",
-        data->exepath, url ? url : L"", (HWND)data->npwin->window, data->filepath));
+    ScopedMem<WCHAR> sizeArg(finalSize > 0 ? str::Format(L"-plugin-size %u ", finalSize) : str::Dup(L""));
+    ScopedMem<WCHAR> cmdLine(str::Format(L"\"%s\" %s-plugin \"%s\" %d \"%s\"",
+        data->exepath, sizeArg, url ? url : L"", (HWND)data->npwin->window, data->filepath));
     data->hProcess = LaunchProcess(cmdLine);
     if (!data->hProcess)
     {
@@ -663,7 +707,7 @@ NPError NP_LOADDS NPP_DestroyStream(NPP instance, NPStream* stream, NPReason rea
         goto Exit;
 
     CloseHandle(data->hFile);
-    if (stream)
+    if (stream && !data->hProcess)
         LaunchWithSumatra(data, stream->url);
 
 Exit:
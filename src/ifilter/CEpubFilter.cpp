@@ -40,6 +40,8 @@ HRESULT CEpubFilter::OnInit()
         return E_FAIL;
 
     m_state = STATE_EPUB_START;
+    m_spineIdx = 0;
+    m_textSize = 0;
     return S_OK;
 }
 
@@ -54,11 +56,8 @@ static bool IsoDateParse(const WCHAR *isoDate, SYSTEMTIME *timeOut)
     // don't bother about the day of week, we won't display it anyway
 }
 
-static WCHAR *ExtractHtmlText(EpubDoc *doc)
+static WCHAR *ExtractHtmlText(const char *data, size_t len)
 {
-    size_t len;
-    const char *data = doc->GetTextData(&len);
-
     str::Str<char> text(len / 2);
     HtmlPullParser p(data, len);
     HtmlToken *t;
@@ -147,12 +146,27 @@ HRESULT CEpubFilter::GetNextChunkValue(CChunkValue &chunkValue)
         // fall through
 
     case STATE_EPUB_CONTENT:
-        m_state = STATE_EPUB_END;
-        str.Set(ExtractHtmlText(m_epubDoc));
-        if (!str::IsEmpty(str.Get())) {
+        // extract the text one spine file at a time (instead of through
+        // GetTextData which concatenates the whole book) so that only
+        // a single file's HTML and text have to be held in memory
+        while (m_spineIdx < m_epubDoc->GetSpineCount() && m_textSize < MAX_INDEXED_TEXT_SIZE) {
+            size_t len;
+            ScopedMem<char> html(m_epubDoc->GetSpineFileData(m_spineIdx++, &len));
+            if (!html)
+                continue;
+            str.Set(ExtractHtmlText(html, len));
+            if (str::IsEmpty(str.Get()))
+                continue;
+            len = str::Len(str);
+            if (m_textSize + len * sizeof(WCHAR) > MAX_INDEXED_TEXT_SIZE) {
+                len = (MAX_INDEXED_TEXT_SIZE - m_textSize) / sizeof(WCHAR);
+                str.Get()[len] = '\0';
+            }
+            m_textSize += len * sizeof(WCHAR);
             chunkValue.SetTextValue(PKEY_Search_Contents, str, CHUNK_TEXT);
             return S_OK;
         }
+        m_state = STATE_EPUB_END;
         // fall through
 
     case STATE_EPUB_END:
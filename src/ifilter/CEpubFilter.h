@@ -12,7 +12,7 @@ class CEpubFilter : public CFilterBase
 {
 public:
     CEpubFilter(long *plRefCount) : CFilterBase(plRefCount),
-        m_state(STATE_EPUB_END), m_epubDoc(NULL) { }
+        m_state(STATE_EPUB_END), m_spineIdx(0), m_textSize(0), m_epubDoc(NULL) { }
     virtual ~CEpubFilter() { CleanUp(); }
 
     virtual HRESULT OnInit();
@@ -27,5 +27,9 @@ public:
 
 private:
     EPUB_FILTER_STATE m_state;
+    // the spine file to extract the text from next
+    size_t m_spineIdx;
+    // number of bytes of text returned so far (cf. MAX_INDEXED_TEXT_SIZE)
+    size_t m_textSize;
     EpubDoc *m_epubDoc;
 };
@@ -34,12 +34,13 @@ HRESULT CPdfFilter::OnInit()
     if (!stream)
         return E_FAIL;
 
-    m_pdfEngine = PdfEngine::CreateFromStream(stream);
+    m_pdfEngine = PdfEngine::CreateTextEngine(stream);
     if (!m_pdfEngine)
         return E_FAIL;
 
     m_state = STATE_PDF_START;
     m_iPageNo = 0;
+    m_textSize = 0;
     return S_OK;
 }
 
@@ -101,10 +102,16 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue &chunkValue)
         // fall through
 
     case STATE_PDF_CONTENT:
-        while (++m_iPageNo <= m_pdfEngine->PageCount()) {
+        while (++m_iPageNo <= m_pdfEngine->PageCount() && m_textSize < MAX_INDEXED_TEXT_SIZE) {
             str.Set(m_pdfEngine->ExtractPageText(m_iPageNo, L"\r\n"));
             if (str::IsEmpty(str.Get()))
                 continue;
+            size_t len = str::Len(str);
+            if (m_textSize + len * sizeof(WCHAR) > MAX_INDEXED_TEXT_SIZE) {
+                len = (MAX_INDEXED_TEXT_SIZE - m_textSize) / sizeof(WCHAR);
+                str.Get()[len] = '\0';
+            }
+            m_textSize += len * sizeof(WCHAR);
             chunkValue.SetTextValue(PKEY_Search_Contents, str, CHUNK_TEXT);
             return S_OK;
         }
@@ -12,7 +12,7 @@ class CPdfFilter : public CFilterBase
 {
 public:
     CPdfFilter(long *plRefCount) : CFilterBase(plRefCount),
-        m_state(STATE_PDF_END), m_iPageNo(-1), m_pdfEngine(NULL) { }
+        m_state(STATE_PDF_END), m_iPageNo(-1), m_textSize(0), m_pdfEngine(NULL) { }
     virtual ~CPdfFilter() { CleanUp(); }
 
     virtual HRESULT OnInit();
@@ -28,5 +28,7 @@ public:
 private:
     PDF_FILTER_STATE m_state;
     int m_iPageNo;
+    // number of bytes of text returned so far (cf. MAX_INDEXED_TEXT_SIZE)
+    size_t m_textSize;
     PdfEngine *m_pdfEngine;
 };
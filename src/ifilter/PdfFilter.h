@@ -7,6 +7,10 @@
 #define SZ_PDF_FILTER_CLSID   L"{55808EA8-81FE-43c6-AAE8-1D8149F941D3}"
 #define SZ_PDF_FILTER_HANDLER L"{26CA6565-F22A-4f5e-B688-0AD051D56E96}"
 
+// Windows Search truncates what it indexes anyway, so there's
+// no point in extracting more text than this per document
+#define MAX_INDEXED_TEXT_SIZE (4 * 1024 * 1024)
+
 #ifdef BUILD_TEX_IFILTER
 #define SZ_TEX_FILTER_CLSID   L"{AF57F784-ED93-4f2c-8C1D-CCDCB6E27CA6}"
 #define SZ_TEX_FILTER_HANDLER L"{3FAB27F8-08EC-4b9e-9EEE-181A6E846B8D}"
@@ -2,6 +2,7 @@
    License: GPLv3 */
 
 #include "BaseUtil.h"
+#include "ThreadUtil.h"
 #include "WinUtil.h"
 
 #include "CPdfFilter.h"
@@ -103,7 +104,11 @@ STDAPI_(BOOL) DllMain(HINSTANCE hInstance, DWORD dwReason, LPVOID lpReserved)
 
 STDAPI DllCanUnloadNow(VOID)
 {
-    return g_lRefCount == 0 ? S_OK : S_FALSE;
+    if (g_lRefCount != 0)
+        return S_FALSE;
+    // the thread pool's threads run code of this DLL
+    DrainThreadPool();
+    return S_OK;
 }
 
 // disable warning C6387 which is wrongly issued due to a compiler bug; cf.
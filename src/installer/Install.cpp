@@ -59,42 +59,79 @@ static inline void ProgressStep()
         PostMessage(gHwndProgressBar, PBM_STEPIT, 0, 0);
 }
 
-static bool ExtractFiles(lzma::SimpleArchive *archive)
-{
-    lzma::FileInfo *fi;
+struct DecompressTask {
+    lzma::SimpleArchive *archive;
+    int idx;
     char *uncompressed;
+    HANDLE hThread;
+};
 
-    FileTransaction trans;
+static DWORD WINAPI DecompressThread(LPVOID data)
+{
+    DecompressTask *task = (DecompressTask *)data;
+    task->uncompressed = lzma::GetFileDataByIdx(task->archive, task->idx, NULL);
+    return 0;
+}
+
+// all files are compressed independently, so they're decompressed in parallel
+// (one thread per file) while this thread writes them to disk as they're done
+static bool ExtractFiles(lzma::SimpleArchive *archive)
+{
+    DecompressTask tasks[MAX_LZMA_ARCHIVE_FILES];
+    int count = 0;
     for (int i = 0; gPayloadData[i].fileName; i++) {
         if (!gPayloadData[i].install)
             continue;
         int idx = lzma::GetIdxFromName(archive, gPayloadData[i].fileName);
-        if (-1 == idx) {
+        if (-1 == idx || count >= (int)dimof(tasks)) {
             NotifyFailed(_TR("Some files to be installed are damaged or missing"));
             return false;
         }
+        DecompressTask task = { archive, idx, NULL, NULL };
+        tasks[count++] = task;
+    }
+    for (int i = 0; i < count; i++) {
+        tasks[i].hThread = CreateThread(NULL, 0, DecompressThread, &tasks[i], 0, NULL);
+    }
 
-        fi = &archive->files[idx];
-        uncompressed = lzma::GetFileDataByIdx(archive, idx, NULL);
-        if (!uncompressed) {
+    FileTransaction trans;
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        // files for which no thread could be created are decompressed here
+        if (tasks[i].hThread) {
+            WaitForSingleObject(tasks[i].hThread, INFINITE);
+            CloseHandle(tasks[i].hThread);
+        }
+        else {
+            DecompressThread(&tasks[i]);
+        }
+        // keep waiting for the remaining threads after a failure
+        if (!ok) {
+            free(tasks[i].uncompressed);
+            continue;
+        }
+
+        lzma::FileInfo *fi = &archive->files[tasks[i].idx];
+        if (!tasks[i].uncompressed) {
             NotifyFailed(_TR("The installer has been corrupted. Please download it again.\nSorry for the inconvenience!"));
-            return false;
+            ok = false;
+            continue;
         }
         ScopedMem<WCHAR> filePath(str::conv::FromUtf8(fi->name));
         ScopedMem<WCHAR> extPath(path::Join(gGlobalData.installDir, filePath));
-        bool ok = trans.WriteAll(extPath, uncompressed, fi->uncompressedSize);
-        free(uncompressed);
+        ok = trans.WriteAll(extPath, tasks[i].uncompressed, fi->uncompressedSize);
+        free(tasks[i].uncompressed);
         if (!ok) {
             ScopedMem<WCHAR> msg(str::Format(_TR("Couldn't write %s to disk"), filePath));
             NotifyFailed(msg);
-            return false;
+            continue;
         }
         trans.SetModificationTime(extPath, fi->ftModified);
 
         ProgressStep();
     }
 
-    return trans.Commit();
+    return ok && trans.Commit();
 }
 
 static bool InstallCopyFiles()
@@ -965,6 +965,7 @@ static void InstallInstallerCrashHandler()
     }
     ScopedMem<WCHAR> crashDumpPath(path::Join(tempDir, CRASH_DUMP_FILE_NAME));
     InstallCrashHandler(crashDumpPath, tempDir);
+    SubmitPendingCrashInfo();
 }
 #endif
 
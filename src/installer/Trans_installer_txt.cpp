@@ -58,6 +58,34 @@ const char *gOriginalStrings[STRINGS_COUNT] = {
 
 const char **GetOriginalStrings() { return &gOriginalStrings[0]; }
 
+#define STRINGS_HASH_BUCKETS 16
+#define STRINGS_HASH_SLOTS 128
+
+// perfect hash of gOriginalStrings (cf. GetEnglishStringIndex): the seed
+// for the strings of every bucket and the index + 1 of the string in every slot
+static const uint16_t gOriginalStringsHashSeeds[STRINGS_HASH_BUCKETS] = {
+  1, 2, 3, 1, 1, 1, 5, 1, 1, 2, 1, 1, 1, 1, 1, 1
+};
+
+static const uint16_t gOriginalStringsHashSlots[STRINGS_HASH_SLOTS] = {
+  0, 11, 0, 0, 0, 18, 27, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 36, 0, 0, 32, 0, 25, 37, 0, 0, 24, 0, 40, 0, 30,
+  6, 42, 23, 0, 39, 0, 0, 9, 0, 43, 0, 31, 0, 19, 0, 0,
+  8, 0, 0, 0, 5, 10, 0, 16, 3, 0, 0, 0, 0, 0, 35, 0,
+  0, 0, 0, 22, 0, 0, 0, 0, 0, 7, 4, 0, 0, 0, 0, 38,
+  34, 33, 20, 0, 0, 0, 0, 0, 2, 15, 0, 0, 0, 0, 0, 28,
+  26, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 13, 12, 0, 14,
+  21, 0, 0, 0, 29, 17, 0, 0, 0, 0, 0, 0, 41, 0, 0, 0
+};
+
+void GetOriginalStringsHash(const uint16_t **seeds, int *bucketsCount, const uint16_t **slots, int *slotsCount)
+{
+    *seeds = &gOriginalStringsHashSeeds[0];
+    *bucketsCount = STRINGS_HASH_BUCKETS;
+    *slots = &gOriginalStringsHashSlots[0];
+    *slotsCount = STRINGS_HASH_SLOTS;
+}
+
 
 const char * gTranslations_sq = 
   "&Opsionet\0"\
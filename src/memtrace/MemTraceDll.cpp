@@ -10,7 +10,8 @@ to an external collection and visualization process via named pipe.
 The dll can either be injected into arbitrary processes or an app can load it
 by itself (easier to integrate than injecting dll).
 
-If the collection process doesn't run when memtrace.dll is initialized, we do
+If the collection process doesn't run when memtrace.dll is initialized, we
+either aggregate allocations in-process (see MEMTRACE_SUMMARY below) or do
 nothing.
 
 The data sent via named pipe is framed as messages (packets):
@@ -461,6 +462,257 @@ static void QueueMessageForSending(Vec<byte>& msg)
     }
 }
 
+/* In aggregation mode (used when no collector is running and the environment
+variable MEMTRACE_SUMMARY contains the path of a file to write to), nothing is
+sent anywhere. Instead, allocations are aggregated in-process by callstack
+(as hashed by RtlCaptureStackBackTrace) and a summary of the allocation sites
+with the most live memory is appended to that file on exit and whenever
+Ctrl+Shift+F12 is pressed. */
+
+#define MAX_ALLOC_SITES     (1 << 14)
+#define LIVE_ALLOC_BUCKETS  (1 << 18)
+#define LIVE_ALLOCS_CHUNK   4096
+#define SITE_FRAMES         8
+// how many frames of the hooks themselves not to capture
+#define SITE_FRAMES_SKIPPED 2
+#define SUMMARY_SITES       50
+#define SUMMARY_HOTKEY_POLL_MS 250
+
+struct AllocSite {
+    ULONG       hash; // 0 for unused slots
+    int         frameCount;
+    void *      frames[SITE_FRAMES];
+    size_t      liveBytes;
+    size_t      peakBytes;
+    int         liveCount;
+    int         totalCount;
+};
+
+struct LiveAlloc {
+    void *      addr;
+    size_t      size;
+    AllocSite * site;
+    LiveAlloc * next;
+};
+
+static bool             gAggregate;
+static char             gSummaryPath[MAX_PATH];
+
+// all of the following are protected by gMemMutex as well
+
+// gSites is an open addressing hash table of MAX_ALLOC_SITES entries
+// (gSites[CATCH_ALL_SITE] collects all allocations once it's full)
+static AllocSite *      gSites;
+static int              gSitesUsed;
+// allocations that haven't been freed yet (so that a free can be
+// attributed to the allocation site), hashed by address
+static LiveAlloc **     gLiveAllocs;
+static LiveAlloc *      gLiveAllocsFreeList;
+static size_t           gLiveBytes;
+static size_t           gPeakLiveBytes;
+
+#define CATCH_ALL_SITE 1
+
+static bool InitAggregation()
+{
+    DWORD len = GetEnvironmentVariableA("MEMTRACE_SUMMARY", gSummaryPath, dimof(gSummaryPath));
+    if (0 == len || len >= dimof(gSummaryPath))
+        return false;
+    gSites = (AllocSite *)HeapAlloc(gHeap, HEAP_ZERO_MEMORY, MAX_ALLOC_SITES * sizeof(AllocSite));
+    gLiveAllocs = (LiveAlloc **)HeapAlloc(gHeap, HEAP_ZERO_MEMORY, LIVE_ALLOC_BUCKETS * sizeof(LiveAlloc *));
+    if (!gSites || !gLiveAllocs) {
+        lf("memtrace.dll: failed to allocate the aggregation tables");
+        return false;
+    }
+    // the catch-all site has an empty callstack
+    gSites[CATCH_ALL_SITE].hash = CATCH_ALL_SITE;
+    gSitesUsed = 1;
+    return true;
+}
+
+static inline size_t LiveAllocBucket(void *addr)
+{
+    // heap blocks are at least 8-byte aligned
+    return ((size_t)addr >> 3) % LIVE_ALLOC_BUCKETS;
+}
+
+static AllocSite *GetAllocSite(ULONG hash, void **frames, int frameCount)
+{
+    if (0 == hash)
+        hash = CATCH_ALL_SITE;
+    for (int i = 0; i < MAX_ALLOC_SITES; i++) {
+        AllocSite *site = &gSites[(hash + i) % MAX_ALLOC_SITES];
+        if (site->hash == hash && site->frameCount == frameCount &&
+            0 == memcmp(site->frames, frames, frameCount * sizeof(void *))) {
+            return site;
+        }
+        if (0 == site->hash) {
+            // keep a few slots free so that lookups for new sites terminate quickly
+            if (gSitesUsed >= MAX_ALLOC_SITES * 3 / 4)
+                break;
+            site->hash = hash;
+            site->frameCount = frameCount;
+            memcpy(site->frames, frames, frameCount * sizeof(void *));
+            gSitesUsed++;
+            return site;
+        }
+    }
+    return &gSites[CATCH_ALL_SITE];
+}
+
+static void RemoveLiveAlloc(void *addr)
+{
+    LiveAlloc **prev = &gLiveAllocs[LiveAllocBucket(addr)];
+    for (LiveAlloc *la = *prev; la; prev = &la->next, la = la->next) {
+        if (la->addr != addr)
+            continue;
+        la->site->liveBytes -= la->size;
+        la->site->liveCount--;
+        gLiveBytes -= la->size;
+        *prev = la->next;
+        la->next = gLiveAllocsFreeList;
+        gLiveAllocsFreeList = la;
+        return;
+    }
+}
+
+static void RecordAlloc(void *addr, size_t size)
+{
+    void *frames[SITE_FRAMES];
+    ULONG hash = 0;
+    int frameCount = RtlCaptureStackBackTrace(SITE_FRAMES_SKIPPED, SITE_FRAMES, frames, &hash);
+
+    ScopedCritSec cs(&gMemMutex);
+    if (!gLiveAllocsFreeList) {
+        LiveAlloc *chunk = (LiveAlloc *)HeapAlloc(gHeap, 0, LIVE_ALLOCS_CHUNK * sizeof(LiveAlloc));
+        if (!chunk)
+            return;
+        for (int i = 0; i < LIVE_ALLOCS_CHUNK; i++) {
+            chunk[i].next = gLiveAllocsFreeList;
+            gLiveAllocsFreeList = &chunk[i];
+        }
+    }
+    // the address might have been freed without us noticing (e.g. through RtlReAllocateHeap)
+    RemoveLiveAlloc(addr);
+
+    AllocSite *site = GetAllocSite(hash, frames, frameCount);
+    site->liveBytes += size;
+    site->liveCount++;
+    site->totalCount++;
+    if (site->liveBytes > site->peakBytes)
+        site->peakBytes = site->liveBytes;
+    gLiveBytes += size;
+    if (gLiveBytes > gPeakLiveBytes)
+        gPeakLiveBytes = gLiveBytes;
+
+    LiveAlloc *la = gLiveAllocsFreeList;
+    gLiveAllocsFreeList = la->next;
+    la->addr = addr;
+    la->size = size;
+    la->site = site;
+    size_t bucket = LiveAllocBucket(addr);
+    la->next = gLiveAllocs[bucket];
+    gLiveAllocs[bucket] = la;
+}
+
+static void RecordFree(void *addr)
+{
+    ScopedCritSec cs(&gMemMutex);
+    RemoveLiveAlloc(addr);
+}
+
+static int CmpAllocSitesByLiveBytes(const void *a, const void *b)
+{
+    const AllocSite *sa = (const AllocSite *)a, *sb = (const AllocSite *)b;
+    if (sa->liveBytes != sb->liveBytes)
+        return sa->liveBytes > sb->liveBytes ? -1 : 1;
+    return sa->peakBytes > sb->peakBytes ? -1 : sa->peakBytes < sb->peakBytes ? 1 : 0;
+}
+
+static void WriteSummaryLine(HANDLE hFile, const char *fmt, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, fmt);
+    int len = _vsnprintf_s(buf, dimof(buf), _TRUNCATE, fmt, args);
+    va_end(args);
+    if (len < 0)
+        len = (int)strlen(buf);
+    DWORD written;
+    WriteFile(hFile, buf, (DWORD)len, &written, NULL);
+}
+
+// note: doesn't allocate from the process heaps (so that it can't deadlock
+// and doesn't distort the statistics it's writing out)
+static void WriteSummary()
+{
+    if (!gAggregate)
+        return;
+
+    // copy the (at most SUMMARY_SITES) sites with the most live memory
+    // so that the lock isn't held while writing them out
+    AllocSite *sites = (AllocSite *)HeapAlloc(gHeap, 0, MAX_ALLOC_SITES * sizeof(AllocSite));
+    if (!sites)
+        return;
+    size_t liveBytes, peakLiveBytes;
+    int sitesUsed;
+    {
+        ScopedCritSec cs(&gMemMutex);
+        memcpy(sites, gSites, MAX_ALLOC_SITES * sizeof(AllocSite));
+        liveBytes = gLiveBytes;
+        peakLiveBytes = gPeakLiveBytes;
+        sitesUsed = gSitesUsed;
+    }
+    qsort(sites, MAX_ALLOC_SITES, sizeof(AllocSite), CmpAllocSitesByLiveBytes);
+
+    HANDLE hFile = CreateFileA(gSummaryPath, FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
+                               OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == hFile) {
+        lf("memtrace.dll: couldn't open %s", gSummaryPath);
+        HeapFree(gHeap, 0, sites);
+        return;
+    }
+    SYSTEMTIME time;
+    GetLocalTime(&time);
+    WriteSummaryLine(hFile, "=== memtrace summary %04d-%02d-%02d %02d:%02d:%02d ===\r\n",
+                     time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond);
+    WriteSummaryLine(hFile, "live: %Iu bytes, peak: %Iu bytes, allocation sites: %d\r\n\r\n",
+                     liveBytes, peakLiveBytes, sitesUsed);
+    for (int i = 0; i < SUMMARY_SITES && sites[i].hash; i++) {
+        AllocSite& site = sites[i];
+        WriteSummaryLine(hFile, "live: %Iu bytes in %d blocks, peak: %Iu bytes, allocations: %d\r\n",
+                         site.liveBytes, site.liveCount, site.peakBytes, site.totalCount);
+        for (int j = 0; j < site.frameCount; j++) {
+            HMODULE hMod = NULL;
+            char modPath[MAX_PATH] = { 0 };
+            if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                   (LPCSTR)site.frames[j], &hMod)) {
+                GetModuleFileNameA(hMod, modPath, dimof(modPath));
+            }
+            const char *modName = strrchr(modPath, '\\');
+            modName = modName ? modName + 1 : *modPath ? modPath : "?";
+            WriteSummaryLine(hFile, "    %s+0x%Ix\r\n", modName, (size_t)site.frames[j] - (size_t)hMod);
+        }
+    }
+    WriteSummaryLine(hFile, "\r\n");
+    CloseHandle(hFile);
+    HeapFree(gHeap, 0, sites);
+}
+
+static DWORD WINAPI SummaryHotkeyThreadProc(void* data)
+{
+    bool wasPressed = false;
+    while (!gStopSendThread) {
+        WaitForSingleObject(gSendThreadEvent, SUMMARY_HOTKEY_POLL_MS);
+        bool isPressed = (GetAsyncKeyState(VK_CONTROL) & 0x8000) && (GetAsyncKeyState(VK_SHIFT) & 0x8000) &&
+                         (GetAsyncKeyState(VK_F12) & 0x8000);
+        if (isPressed && !wasPressed)
+            WriteSummary();
+        wasPressed = isPressed;
+    }
+    return 0;
+}
+
 WindowsDllInterceptor gNtdllIntercept;
 
 //http://msdn.microsoft.com/en-us/library/windows/hardware/ff552108(v=vs.85).aspx
@@ -470,7 +722,7 @@ BOOLEAN (WINAPI *gRtlFreeHeapOrig)(PVOID heapHandle, ULONG flags, PVOID heapBase
 
 PVOID WINAPI RtlAllocateHeapHook(PVOID heapHandle, ULONG flags, SIZE_T size)
 {
-    if (!gPipe || (gHeap == heapHandle) || gStopSendThread)
+    if (!(gPipe || gAggregate) || (gHeap == heapHandle) || gStopSendThread)
         return gRtlAllocateHeapOrig(heapHandle, flags, size);
 
     PerThreadData threadDataEmergency = { true, true };
@@ -483,6 +735,13 @@ PVOID WINAPI RtlAllocateHeapHook(PVOID heapHandle, ULONG flags, SIZE_T size)
     if (inAlloc)
         return res;
 
+    if (gAggregate) {
+        if (res)
+            RecordAlloc(res, size);
+        threadData->inAlloc = false;
+        return res;
+    }
+
     AllocData d = { (uint32)size, (uint32)res };
     Vec<byte> msg;
     SerializeType((byte*)&d, &allocDataTypeInfo, msg);
@@ -493,7 +752,7 @@ PVOID WINAPI RtlAllocateHeapHook(PVOID heapHandle, ULONG flags, SIZE_T size)
 
 BOOLEAN WINAPI RtlFreeHeapHook(PVOID heapHandle, ULONG flags, PVOID heapBase)
 {
-    if (!gPipe || (gHeap == heapHandle) || gStopSendThread)
+    if (!(gPipe || gAggregate) || (gHeap == heapHandle) || gStopSendThread)
         return gRtlFreeHeapOrig(heapHandle, flags, heapBase);
 
     PerThreadData threadDataEmergency = { true, true };
@@ -501,6 +760,15 @@ BOOLEAN WINAPI RtlFreeHeapHook(PVOID heapHandle, ULONG flags, PVOID heapBase)
     bool inFree = threadData->inFree;
     // prevent infinite recursion
     threadData->inFree = true;
+    if (gAggregate) {
+        // forget the block before it's freed, as its address
+        // could be handed out again right afterwards
+        if (!inFree && heapBase)
+            RecordFree(heapBase);
+        BOOLEAN res = gRtlFreeHeapOrig(heapHandle, flags, heapBase);
+        threadData->inFree = inFree;
+        return res;
+    }
     BOOLEAN res = gRtlFreeHeapOrig(heapHandle, flags, heapBase);
     if (inFree)
         return res;
@@ -535,26 +803,30 @@ static void InstallHooks()
 static BOOL ProcessAttach()
 {
     lf("memtrace.dll: ProcessAttach()");
-    if (!OpenPipe()) {
-        lf("memtrace.dll: couldn't open pipe");
-        return FALSE;
-    } else {
-        lf("memtrace.dll: opened pipe");
-    }
-
     gHeap = HeapCreate(0, 0, 0);
     if (!gHeap) {
         lf("memtrace.dll: failed to create heap");
         return FALSE;
     }
 
+    if (OpenPipe()) {
+        lf("memtrace.dll: opened pipe");
+    } else if (InitAggregation()) {
+        lf("memtrace.dll: aggregating allocations, summary goes to %s", gSummaryPath);
+        gAggregate = true;
+    } else {
+        lf("memtrace.dll: couldn't open pipe");
+        HeapDestroy(gHeap);
+        return FALSE;
+    }
+
     InitializeCriticalSection(&gMemMutex);
     gSendThreadEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
     if (!gSendThreadEvent) {
         lf("memtrace.dll: couldn't create gSendThreadEvent");
         return FALSE;
     }
-    gSendThread = CreateThread(NULL, 0, DataSendThreadProc, NULL, 0, 0);
+    gSendThread = CreateThread(NULL, 0, gAggregate ? SummaryHotkeyThreadProc : DataSendThreadProc, NULL, 0, 0);
     if (!gSendThread) {
         lf("memtrace.dll: couldn't create gSendThread");
         return FALSE;
@@ -589,6 +861,7 @@ static BOOL ProcessDetach()
 {
     lf("memtrace.dll: ProcessDetach()");
     TerminateSendingThread();
+    WriteSummary();
     ClosePipe();
     DeleteCriticalSection(&gMemMutex);
     CloseHandle(gSendThreadEvent);
@@ -54,6 +54,7 @@ void Destroy()
 {
     FreeControlCreators();
     FreeLayoutCreators();
+    FreeParsedPaths();
     css::Destroy();
     DestroyBase();
 }
@@ -218,8 +219,13 @@ void RequestRepaint(Control *c, const Rect *r1, const Rect *r2)
 void RequestLayout(Control *c)
 {
     HwndWrapper *wnd = GetRootHwndWnd(c);
-    if (wnd)
-        wnd->RequestLayout();
+    if (!wnd)
+        return;
+    // c's content has changed, even if it ends up at the same position
+    // (and all controls which are moved are invalidated by SetPosition)
+    RequestRepaint(c);
+    // controls which haven't been laid out yet can't invalidate their own area
+    wnd->RequestLayout(c->pos.IsEmptyArea() != FALSE);
 }
 
 }
@@ -32,15 +32,18 @@ struct FontCacheEntry {
 
 static Vec<FontCacheEntry> *gFontsCache = NULL;
 
-// Graphics objects cannot be used across threads. We have a per-thread
-// cache so that it's easy to grab Graphics object to be used for
-// measuring text
+// Graphics objects cannot be used by several threads at once. We have a
+// per-thread cache so that it's easy to grab Graphics object to be used for
+// measuring text. Entries no longer used by any thread are handed to the
+// next thread asking for one (formatting threads are short-lived) and
+// only up to MAX_IDLE_GRAPHICS unused entries are kept around
+#define MAX_IDLE_GRAPHICS 4
+
 struct GraphicsCacheEntry
 {
     enum {
         bmpDx = 32,
         bmpDy = 4,
-        stride = bmpDx * 4,
     };
 
     DWORD       threadId;
@@ -48,7 +51,6 @@ struct GraphicsCacheEntry
 
     Graphics *  gfx;
     Bitmap *    bmp;
-    BYTE        data[bmpDx * bmpDy * 4];
 
     bool Create();
     void Free();
@@ -69,12 +71,12 @@ void InitGraphicsMode(Graphics *g)
 
 bool GraphicsCacheEntry::Create()
 {
-    memset(data, 0, sizeof(data));
     refCount = 1;
     threadId = GetCurrentThreadId();
     // using a small bitmap under assumption that Graphics used only
     // for measuring text doesn't need the actual bitmap
-    bmp = ::new Bitmap(bmpDx, bmpDy, stride, PixelFormat32bppARGB, data);
+    // (the bitmap owns its pixels, as entries are copied around in gGraphicsCache)
+    bmp = ::new Bitmap(bmpDx, bmpDy, PixelFormat32bppARGB);
     if (!bmp)
         return false;
     gfx = ::new Graphics((Image*)bmp);
@@ -154,33 +156,42 @@ Graphics *AllocGraphicsForMeasureText()
     ScopedMuiCritSec muiCs;
 
     DWORD threadId = GetCurrentThreadId();
+    GraphicsCacheEntry *idle = NULL;
     for (GraphicsCacheEntry *e = gGraphicsCache->IterStart(); e; e = gGraphicsCache->IterNext()) {
         if (e->threadId == threadId) {
             e->refCount++;
             return e->gfx;
         }
+        if (!idle && 0 == e->refCount)
+            idle = e;
+    }
+    // the first entry (for ui thread) is never idle
+    if (idle) {
+        idle->threadId = threadId;
+        idle->refCount = 1;
+        return idle->gfx;
     }
     GraphicsCacheEntry ce;
     ce.Create();
     gGraphicsCache->Append(ce);
-    if (gGraphicsCache->Count() < 64)
-        return ce.gfx;
-
-    // try to limit the size of cache by evicting the oldest entries, but don't remove
-    // first (for ui thread) or last (one we just added) entries
-    for (size_t i = 1; i < gGraphicsCache->Count() - 1; i++) {
-        GraphicsCacheEntry e = gGraphicsCache->At(i);
-        if (0 == e.refCount) {
-            e.Free();
-            gGraphicsCache->RemoveAt(i);
-            return ce.gfx;
-        }
-    }
-    // We shouldn't get here - indicates ref counting problem
-    CrashIf(true);
     return ce.gfx;
 }
 
+// limit the number of unused Graphics objects kept in the cache
+static void ReleaseIdleGraphics()
+{
+    size_t idleCount = 0;
+    for (size_t i = gGraphicsCache->Count(); i > 1; i--) {
+        GraphicsCacheEntry& e = gGraphicsCache->At(i - 1);
+        if (e.refCount != 0)
+            continue;
+        if (++idleCount <= MAX_IDLE_GRAPHICS)
+            continue;
+        e.Free();
+        gGraphicsCache->RemoveAt(i - 1);
+    }
+}
+
 void FreeGraphicsForMeasureText(Graphics *gfx)
 {
     ScopedMuiCritSec muiCs;
@@ -191,6 +202,8 @@ void FreeGraphicsForMeasureText(Graphics *gfx)
             CrashIf(e->threadId != threadId);
             e->refCount--;
             CrashIf(e->refCount < 0);
+            if (0 == e->refCount)
+                ReleaseIdleGraphics();
             return;
         }
     }
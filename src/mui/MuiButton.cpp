@@ -269,9 +269,8 @@ void ButtonVector::Paint(Graphics *gfx, int offX, int offY)
 
     // graphicsPath bbox can have non-zero X,Y
     Rect gpBbox;
-    Brush *brFill = BrushFromColorData(s->fill, bbox);
-    Brush *brStroke = BrushFromColorData(s->stroke, bbox);
-    Pen pen(brStroke, s->strokeWidth);
+    // the pen's brush is set below (it doesn't influence the bounds)
+    Pen pen(Color(), s->strokeWidth);
     pen.SetMiterLimit(1.f);
     pen.SetAlignment(PenAlignmentInset);
     if (0.f == s->strokeWidth)
@@ -290,14 +289,16 @@ void ButtonVector::Paint(Graphics *gfx, int offX, int offY)
     int x = offX + elOffX + s->padding.left + (int)s->borderWidth.left + gpBbox.X;
     int y = offY + elOffY + s->padding.top  + (int)s->borderWidth.top  + gpBbox.Y;
 
-    // TODO: can I avoid making a copy of GraphicsPath?
-    GraphicsPath *tmp = graphicsPath->Clone();
-    Matrix m;
-    m.Translate((float)x, (float)y);
-    tmp->Transform(&m);
-    gfx->FillPath(brFill, tmp);
+    // translate the canvas instead of (a copy of) the path,
+    // the brushes must then be translated the other way
+    RectF brBbox(bbox.X - x, bbox.Y - y, bbox.Width, bbox.Height);
+    Brush *brFill = BrushFromColorData(s->fill, brBbox);
+    pen.SetBrush(BrushFromColorData(s->stroke, brBbox));
+    gfx->TranslateTransform((float)x, (float)y);
+    gfx->FillPath(brFill, graphicsPath);
     if (0.f != s->strokeWidth)
-        gfx->DrawPath(&pen, tmp);
+        gfx->DrawPath(&pen, graphicsPath);
+    gfx->TranslateTransform((float)-x, (float)-y);
 }
 
 void ButtonVector::UpdateAfterStyleChange()
@@ -66,9 +66,15 @@ static Style *gStyleButtonMouseOver = NULL;
 struct StyleCacheEntry {
     Style *     style;
     size_t      styleId;
+    // value of gStylesGen when styleId was last verified
+    size_t      stylesGen;
     CachedStyle cachedStyle;
 };
 
+// changes every time any style is changed, so that as long as no style
+// changes, cached styles are valid without walking their inheritance chain
+static size_t gStylesGen = 1;
+
 // Those must be VecSegmented so that code can retain pointers to
 // their elements (we can't move the memory)
 static VecSegmented<Prop> *            gAllProps = NULL;
@@ -491,14 +497,26 @@ void Style::Set(Prop *prop)
     CrashIf(!prop);
     for (Prop **p = props.IterStart(); p; p = props.IterNext()) {
         if ((*p)->type == prop->type) {
-            if (!prop->Eq(*p))
+            if (!prop->Eq(*p)) {
                 ++gen;
+                ++gStylesGen;
+            }
             *p = prop;
             return;
         }
     }
     props.Append(prop);
     ++gen;
+    ++gStylesGen;
+}
+
+void Style::SetInheritsFrom(Style *parent)
+{
+    if (parent == inheritsFrom)
+        return;
+    inheritsFrom = parent;
+    ++gen;
+    ++gStylesGen;
 }
 
 void Style::SetName(const char *styleName)
@@ -588,6 +606,9 @@ static size_t GetStyleId(Style *style) {
 // If a given style doesn't exist, we add it to the cache.
 // If it exists but it was modified or gStyleDefault was modified, we update the cache.
 // If it exists and didn't change, we return cached entry.
+// This is called whenever a control changes its state (e.g. on mouse hover),
+// so in the common case of no style having changed since the last call,
+// it neither searches the cache nor walks the inheritance chain.
 CachedStyle *CacheStyle(Style *style, bool *changedOut)
 {
     bool changedTmp;
@@ -596,16 +617,24 @@ CachedStyle *CacheStyle(Style *style, bool *changedOut)
     *changedOut = false;
 
     ScopedMuiCritSec muiCs;
-    StyleCacheEntry *e;
+    StyleCacheEntry *e = NULL;
+    if (style)
+        e = style->cacheEntry;
+    else {
+        for (e = gStyleCache->IterStart(); e; e = gStyleCache->IterNext()) {
+            if (!e->style)
+                break;
+        }
+    }
     bool updateEntry = false;
-    for (e = gStyleCache->IterStart(); e; e = gStyleCache->IterNext()) {
-        if (e->style == style) {
-            if (e->styleId == GetStyleId(style)) {
-                return &e->cachedStyle;
-            }
-            updateEntry = true;
-            break;
+    if (e) {
+        if (e->stylesGen == gStylesGen)
+            return &e->cachedStyle;
+        if (e->styleId == GetStyleId(style)) {
+            e->stylesGen = gStylesGen;
+            return &e->cachedStyle;
         }
+        updateEntry = true;
     }
 
     *changedOut = true;
@@ -642,11 +671,14 @@ CachedStyle *CacheStyle(Style *style, bool *changedOut)
     if (updateEntry) {
         e->cachedStyle = s;
         e->styleId = GetStyleId(style);
+        e->stylesGen = gStylesGen;
         return &e->cachedStyle;
     }
 
-    StyleCacheEntry newEntry = { style, GetStyleId(style), s };
+    StyleCacheEntry newEntry = { style, GetStyleId(style), gStylesGen, s };
     e = gStyleCache->Append(newEntry);
+    if (style)
+        style->cacheEntry = e;
     return &e->cachedStyle;
 }
 
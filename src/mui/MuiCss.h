@@ -200,15 +200,23 @@ struct Prop {
     static Prop *AllocWidth(PropType type, float width);
 };
 
+struct CachedStyle;
+struct StyleCacheEntry;
+
 class Style {
     // if property is not found here, we'll search the
     // inheritance chain
     Style *         inheritsFrom;
     // generation number, changes every time we change the style
     size_t          gen;
+    // set by CacheStyle so that a cached style can be found
+    // without searching the whole cache
+    StyleCacheEntry *cacheEntry;
+
+    friend CachedStyle* CacheStyle(Style *style, bool *changedOut);
 
 public:
-    Style(Style *inheritsFrom=NULL) : inheritsFrom(inheritsFrom) {
+    Style(Style *inheritsFrom=NULL) : inheritsFrom(inheritsFrom), cacheEntry(NULL) {
         gen = 1; // so that we can use 0 for NULL
     }
 
@@ -227,7 +235,7 @@ public:
     void SetPadding(int top, int right, int bottom, int left);
 
     Style * GetInheritsFrom() const;
-    void SetInheritsFrom(Style *parent) { inheritsFrom = parent; }
+    void SetInheritsFrom(Style *parent);
     size_t GetIdentity() const;
 };
 
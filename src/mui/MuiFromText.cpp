@@ -22,10 +22,19 @@ struct LayoutCreatorNode {
     LayoutCreatorFunc       creator;
 };
 
+struct ParsedPathNode {
+    ParsedPathNode *        next;
+    const char *            pathData;
+    GraphicsPath *          gp;
+};
+
 // This is an extensiblity point that allows creating custom controls and layouts
 // unknown to mui that appear in text description
 static ControlCreatorNode *gControlCreators = NULL;
 static LayoutCreatorNode  *gLayoutCreators = NULL;
+// the same svg paths are used by every window created from the same
+// description, so they're only parsed once
+static ParsedPathNode     *gParsedPaths = NULL;
 
 void RegisterControlCreatorFor(const char *typeName, ControlCreatorFunc creator)
 {
@@ -89,6 +98,40 @@ void FreeLayoutCreators()
     }
 }
 
+// returns a copy of the parsed path which is owned by the caller
+static GraphicsPath *GraphicsPathFromPathDataCached(const char *pathData)
+{
+    ParsedPathNode *curr;
+    for (curr = gParsedPaths; curr; curr = curr->next) {
+        if (str::Eq(pathData, curr->pathData))
+            break;
+    }
+    if (!curr) {
+        GraphicsPath *gp = svg::GraphicsPathFromPathData(pathData);
+        if (!gp)
+            return NULL;
+        curr = AllocStruct<ParsedPathNode>();
+        curr->pathData = str::Dup(pathData);
+        curr->gp = gp;
+        ListInsert(&gParsedPaths, curr);
+    }
+    return curr->gp->Clone();
+}
+
+void FreeParsedPaths()
+{
+    ParsedPathNode *curr = gParsedPaths;
+    ParsedPathNode *next;
+    while (curr) {
+        next = curr->next;
+        free((void*)curr->pathData);
+        ::delete curr->gp;
+        free(curr);
+        curr = next;
+    }
+    gParsedPaths = NULL;
+}
+
 Button *FindButtonNamed(const ParsedMui& muiInfo, const char *name)
 {
     for (size_t i = 0; i < muiInfo.buttons.Count(); i++) {
@@ -338,7 +381,7 @@ static ButtonVector* ButtonVectorFromDef(TxtNode* structDef)
     b->SetNamedEventClick(def->clicked);
 
     if (def->path ){
-        GraphicsPath *gp = svg::GraphicsPathFromPathData(def->path);
+        GraphicsPath *gp = GraphicsPathFromPathDataCached(def->path);
         b->SetGraphicsPath(gp);
     }
     if (def->styleDefault) {
@@ -32,3 +32,5 @@ void FreeControlCreators();
 typedef ILayout * (*LayoutCreatorFunc)(ParsedMui *, TxtNode *);
 void RegisterLayoutCreatorFor(const char *layoutName, LayoutCreatorFunc creator);
 void FreeLayoutCreators();
+
+void FreeParsedPaths();
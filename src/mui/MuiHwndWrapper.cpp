@@ -112,12 +112,13 @@ void HwndWrapper::TopLevelLayout()
 }
 
 // mark for re-layout as soon as possible
-void HwndWrapper::RequestLayout()
+void HwndWrapper::RequestLayout(bool invalidateAll)
 {
     layoutRequested = true;
     markedForRepaint = true;
     // trigger message queue so that the layout request is processed
-    InvalidateRect(hwndParent, NULL, TRUE);
+    if (invalidateAll)
+        InvalidateRect(hwndParent, NULL, TRUE);
     UpdateWindow(hwndParent);
 }
 
@@ -36,7 +36,10 @@ public:
     void            SetMinSize(Size minSize);
     void            SetMaxSize(Size maxSize);
 
-    void            RequestLayout();
+    // invalidateAll can be false if the caller invalidates the
+    // controls that changed (layout changes will be invalidated
+    // by Control::SetPosition)
+    void            RequestLayout(bool invalidateAll=true);
     void            MarkForRepaint() { markedForRepaint = true; }
     void            LayoutIfRequested();
     void            SetHwnd(HWND hwnd);
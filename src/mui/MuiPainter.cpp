@@ -41,16 +41,32 @@ void Painter::PaintBackground(Graphics *g, Rect r)
     g->FillRectangle(br, r);
 }
 
+// matches the windows which intersect with the area to be repainted
+class WndDirtyAreaFilter : public WndFilter
+{
+    Rect dirty;
+
+public:
+    WndDirtyAreaFilter(Rect dirty) : dirty(dirty) { }
+    virtual ~WndDirtyAreaFilter() { }
+    virtual bool Matches(Control *c, int offX, int offY) {
+        Rect r(offX, offY, c->pos.Width, c->pos.Height);
+        return r.IntersectsWith(dirty) != FALSE;
+    }
+};
+
 // Paint windows in z-order by first collecting the windows
 // and then painting consecutive layers with the same z-order,
 // starting with the lowest z-order.
 // We don't sort because we want to preserve the order of
 // containment of windows with the same z-order and non-stable
 // sort could change it.
-static void PaintWindowsInZOrder(Graphics *g, Control *c)
+// Only windows intersecting with dirty are painted, as the
+// rest of the cached bitmap is still up-to-date.
+static void PaintWindowsInZOrder(Graphics *g, Control *c, Rect dirty)
 {
     Vec<CtrlAndOffset>  toPaint;
-    WndFilter           wndFilter;
+    WndDirtyAreaFilter  wndFilter(dirty);
     CtrlAndOffset *     coff;
     Pen                 debugPen(Color(255, 0, 0), 1);
 
@@ -94,15 +110,12 @@ void Painter::Paint(HWND hwnd, bool isDirty)
     PAINTSTRUCT ps;
     HDC dc = BeginPaint(hwnd, &ps);
 
-    Region clip;
-
-    // TODO: be intelligent about only repainting changed
-    // parts for perf. Note: if cacheBmp changes, we need
-    // to repaint everything
     Graphics gDC(dc);
-    gDC.GetClip(&clip);
-
     ClientRect r(hwnd);
+    // only the invalidated part of the cached bitmap needs to be repainted
+    // (all changes to controls are invalidated through RequestRepaint)
+    Rect dirty(ps.rcPaint.left, ps.rcPaint.top, ps.rcPaint.right - ps.rcPaint.left,
+               ps.rcPaint.bottom - ps.rcPaint.top);
 
     // TODO: fix showing black parts when resizing a window.
     // my theory is that we see black background on right/bottom
@@ -130,23 +143,22 @@ void Painter::Paint(HWND hwnd, bool isDirty)
     if (BitmapNotBigEnough(cacheBmp, r.dx, r.dy)) {
         ::delete cacheBmp;
         cacheBmp = ::new Bitmap(r.dx, r.dy, &gDC);
+        // a new bitmap has to be painted completely
+        dirty = r.ToGdipRect();
         isDirty = true;
     }
 
-    //TODO: log clipBounds for debugging
-    //Rect clipBounds;
-    //clip.GetBounds(&cliBounds)
-
     // draw to a bitmap cache unless we were asked to skip
     // this step and just blit cached bitmap because the caller
     // knows it didn't change
     if (isDirty) {
         Graphics g((Image*)cacheBmp);
         InitGraphicsMode(&g);
-        g.SetClip(&clip, CombineModeReplace);
+        g.SetClip(dirty, CombineModeReplace);
 
+        // gradients are relative to the whole window
         PaintBackground(&g, r.ToGdipRect());
-        PaintWindowsInZOrder(&g, wnd);
+        PaintWindowsInZOrder(&g, wnd, dirty);
     }
 
     // TODO: try to manually draw only the part that falls within
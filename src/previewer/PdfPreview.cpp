@@ -3,22 +3,73 @@
 
 #include "BaseUtil.h"
 #include "PdfPreview.h"
+
+#include "FileUtil.h"
+#include "TgaReader.h"
 #include "WinUtil.h"
 
-IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE *pdwAlpha)
+// at most this many thumbnails are cached (the least recently used ones are removed first)
+#define THUMBNAIL_CACHE_MAX_FILES   500
+// thumbnails are cached by a hash over a document's size and its first and
+// last bytes (where e.g. a PDF document changes with every incremental update)
+#define FINGERPRINT_CHUNK_SIZE      (64 * 1024)
+
+static bool ReadStreamAt(IStream *stream, ULONGLONG offset, char *buffer, ULONG len)
 {
-    BaseEngine *engine = GetEngine();
-    if (!engine)
-        return E_FAIL;
+    LARGE_INTEGER off;
+    off.QuadPart = offset;
+    if (FAILED(stream->Seek(off, STREAM_SEEK_SET, NULL)))
+        return false;
+    ULONG read;
+    return SUCCEEDED(stream->Read(buffer, len, &read)) && read == len;
+}
 
-    RectD page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
-    float zoom = min(cx / (float)page.dx, cx / (float)page.dy) - 0.001f;
-    RectI thumb = RectD(0, 0, page.dx * zoom, page.dy * zoom).Round();
+static bool GetStreamFingerprint(IStream *stream, unsigned char digest[16])
+{
+    STATSTG stat;
+    if (FAILED(stream->Stat(&stat, STATFLAG_NONAME)))
+        return false;
+    ULONGLONG size = stat.cbSize.QuadPart;
+    ULONG chunk = (ULONG)min(size, FINGERPRINT_CHUNK_SIZE);
+    size_t len = sizeof(size) + 2 * chunk;
+    ScopedMem<char> data(AllocArray<char>(len));
+    if (!data)
+        return false;
+    memcpy(data, &size, sizeof(size));
+    bool ok = ReadStreamAt(stream, 0, data + sizeof(size), chunk) &&
+              ReadStreamAt(stream, size - chunk, data + sizeof(size) + chunk, chunk);
+    // the engine expects to read the stream from the start
+    LARGE_INTEGER zero = { 0 };
+    stream->Seek(zero, STREAM_SEEK_SET, NULL);
+    if (ok)
+        CalcMD5DigestWin(data, len, digest);
+    return ok;
+}
+
+// returns NULL if thumbnails can't be cached for this stream
+WCHAR *PreviewBase::GetThumbnailCachePath(UINT cx)
+{
+    unsigned char digest[16];
+    if (!m_pStream || !GetStreamFingerprint(m_pStream, digest))
+        return NULL;
+    ScopedMem<WCHAR> dir(GetSpecialFolder(CSIDL_LOCAL_APPDATA, true));
+    if (!dir)
+        return NULL;
+    dir.Set(path::Join(dir, L"SumatraPDF\\PreviewCache"));
+    if (!dir::CreateAll(dir))
+        return NULL;
+    ScopedMem<char> hash(str::MemToHex(digest, dimof(digest)));
+    ScopedMem<WCHAR> fileName(str::Format(L"%S-%u.tga", hash, cx));
+    return path::Join(dir, fileName);
+}
 
+// copies hbmp into a 32-bit DIB section as required for IThumbnailProvider
+static HBITMAP CreateThumbnailDIB(HBITMAP hbmp, SizeI size)
+{
     BITMAPINFO bmi = { 0 };
     bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
-    bmi.bmiHeader.biHeight = thumb.dy;
-    bmi.bmiHeader.biWidth = thumb.dx;
+    bmi.bmiHeader.biHeight = size.dy;
+    bmi.bmiHeader.biWidth = size.dx;
     bmi.bmiHeader.biPlanes = 1;
     bmi.bmiHeader.biBitCount = 32;
     bmi.bmiHeader.biCompression = BI_RGB;
@@ -26,52 +77,169 @@ IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE
     unsigned char *bmpData = NULL;
     HBITMAP hthumb = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, (void **)&bmpData, NULL, 0);
     if (!hthumb)
-        return E_OUTOFMEMORY;
-
-    page = engine->Transform(thumb.Convert<double>(), 1, zoom, 0, true);
-    RenderedBitmap *bmp = engine->RenderBitmap(1, zoom, 0, &page);
+        return NULL;
 
     HDC hdc = GetDC(NULL);
-    if (bmp && GetDIBits(hdc, bmp->GetBitmap(), 0, thumb.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
+    if (GetDIBits(hdc, hbmp, 0, size.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
         // cf. http://msdn.microsoft.com/en-us/library/bb774612(v=VS.85).aspx
-        for (int i = 0; i < thumb.dx * thumb.dy; i++)
+        for (int i = 0; i < size.dx * size.dy; i++)
             bmpData[4 * i + 3] = 0xFF;
-
-        *phbmp = hthumb;
-        if (pdwAlpha)
-            *pdwAlpha = WTSAT_RGB;
     }
     else {
         DeleteObject(hthumb);
         hthumb = NULL;
     }
-
     ReleaseDC(NULL, hdc);
+
+    return hthumb;
+}
+
+static HBITMAP LoadCachedThumbnail(const WCHAR *cachePath)
+{
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(cachePath, &len));
+    if (!data)
+        return NULL;
+
+    HBITMAP hthumb = NULL;
+    ScopedGdiPlus gdiPlus;
+    Gdiplus::Bitmap *bmp = tga::ImageFromData(data, len);
+    HBITMAP hbmp;
+    if (bmp && Gdiplus::Ok == bmp->GetHBITMAP((Gdiplus::ARGB)Gdiplus::Color::White, &hbmp)) {
+        hthumb = CreateThumbnailDIB(hbmp, SizeI(bmp->GetWidth(), bmp->GetHeight()));
+        DeleteObject(hbmp);
+    }
     delete bmp;
 
-    return hthumb ? S_OK : E_NOTIMPL;
+    if (hthumb) {
+        // keep recently used thumbnails from being pruned
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        file::SetModificationTime(cachePath, now);
+    }
+    return hthumb;
+}
+
+static void SaveCachedThumbnail(const WCHAR *cachePath, HBITMAP hthumb)
+{
+    size_t len;
+    ScopedMem<unsigned char> data(tga::SerializeBitmap(hthumb, &len));
+    if (!data || !file::WriteAll(cachePath, data, len))
+        return;
+
+    // remove the least recently used thumbnail once there are too many
+    ScopedMem<WCHAR> dir(path::GetDir(cachePath));
+    ScopedMem<WCHAR> pattern(path::Join(dir, L"*.tga"));
+    WIN32_FIND_DATA fd;
+    HANDLE hFind = FindFirstFile(pattern, &fd);
+    if (INVALID_HANDLE_VALUE == hFind)
+        return;
+    int count = 0;
+    FILETIME oldestTime;
+    ScopedMem<WCHAR> oldest;
+    do {
+        count++;
+        if (!oldest || CompareFileTime(&fd.ftLastWriteTime, &oldestTime) < 0) {
+            oldest.Set(str::Dup(fd.cFileName));
+            oldestTime = fd.ftLastWriteTime;
+        }
+    } while (FindNextFile(hFind, &fd));
+    FindClose(hFind);
+
+    if (count > THUMBNAIL_CACHE_MAX_FILES) {
+        ScopedMem<WCHAR> oldestPath(path::Join(dir, oldest));
+        file::Delete(oldestPath);
+    }
+}
+
+IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE *pdwAlpha)
+{
+    // rendering can be skipped for documents which have been seen before
+    ScopedMem<WCHAR> cachePath(GetThumbnailCachePath(cx));
+    HBITMAP hthumb = cachePath ? LoadCachedThumbnail(cachePath) : NULL;
+    if (hthumb) {
+        *phbmp = hthumb;
+        if (pdwAlpha)
+            *pdwAlpha = WTSAT_RGB;
+        return S_OK;
+    }
+
+    // unless the document's already been loaded for the preview pane,
+    // load it just for rendering the thumbnail
+    ScopedPtr<BaseEngine> thumbEngine(!m_engine && m_pStream ? LoadThumbnailEngine(m_pStream) : NULL);
+    BaseEngine *engine = m_engine ? m_engine : thumbEngine;
+    if (!engine)
+        return E_FAIL;
+
+    RectD page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
+    float zoom = min(cx / (float)page.dx, cx / (float)page.dy) - 0.001f;
+    RectI thumb = RectD(0, 0, page.dx * zoom, page.dy * zoom).Round();
+
+    page = engine->Transform(thumb.Convert<double>(), 1, zoom, 0, true);
+    RenderedBitmap *bmp = engine->RenderBitmap(1, zoom, 0, &page);
+    if (bmp)
+        hthumb = CreateThumbnailDIB(bmp->GetBitmap(), thumb.Size());
+    delete bmp;
+    if (!hthumb)
+        return E_NOTIMPL;
+
+    if (cachePath)
+        SaveCachedThumbnail(cachePath, hthumb);
+    *phbmp = hthumb;
+    if (pdwAlpha)
+        *pdwAlpha = WTSAT_RGB;
+    return S_OK;
 }
 
 #define COL_WINDOW_BG   RGB(0x99, 0x99, 0x99)
 #define PREVIEW_MARGIN  2
 #define UWM_PAINT_AGAIN (WM_USER + 1)
 
+// number of rendered pages kept for scrolling back and forth
+#define PREVIEW_CACHE_SIZE  4
+
+// fits a page (as returned by PageRenderer::GetPageRect) into the preview area
+static RectI LayoutPage(RectD page, RectI area, float *zoomOut)
+{
+    float zoom = (float)min(area.dx / page.dx, area.dy / page.dy) - 0.001f;
+    RectI onScreen = RectD(area.x, area.y, page.dx * zoom, page.dy * zoom).Round();
+    onScreen.Offset((area.dx - onScreen.dx) / 2, (area.dy - onScreen.dy) / 2);
+    *zoomOut = zoom;
+    return onScreen;
+}
+
+/* Renders the visible page on a background thread and, once that's done,
+   the pages just after and just before it (in scrolling direction first),
+   so that scrolling through a document doesn't have to wait for rendering. */
 class PageRenderer {
     BaseEngine *engine;
     HWND hwnd;
 
-    int currPage;
-    RenderedBitmap *currBmp;
-    // due to rounding differences, currBmp->Size() and currSize can differ slightly
-    SizeI currSize;
+    struct CachedPage {
+        int pageNo;
+        // due to rounding differences, bmp->Size() and size can differ slightly
+        SizeI size;
+        RenderedBitmap *bmp;
+    };
+    // the most recently used page comes first
+    Vec<CachedPage> cache;
+
+    // the visible page and the area it's laid out in
     int reqPage;
-    float reqZoom;
-    SizeI reqSize;
-    bool reqAbort;
+    RectI reqArea;
+    // 1 when scrolling down, -1 when scrolling up
+    int reqDirection;
+    // the page currently being rendered (0 if there's none)
+    int renderPage;
+    SizeI renderSize;
+    bool renderAbort;
     AbortCookie *abortCookie;
 
     CRITICAL_SECTION currAccess;
     HANDLE thread;
+    // signaled whenever there might be something to render
+    HANDLE hRequest;
+    bool stopThread;
 
     // seeking inside an IStream spins an inner event loop
     // which can cause reentrance in OnPaint and leave an
@@ -80,16 +248,37 @@ class PageRenderer {
     // sections can't prevent recursion without the risk of deadlock)
     bool preventRecursion;
 
+    int FindCached(int pageNo, SizeI size) {
+        for (size_t i = 0; i < cache.Count(); i++) {
+            if (cache.At(i).pageNo == pageNo && cache.At(i).size == size)
+                return (int)i;
+        }
+        return -1;
+    }
+
 public:
     PageRenderer(BaseEngine *engine, HWND hwnd) : engine(engine), hwnd(hwnd),
-        currPage(0), currBmp(NULL), reqPage(0), reqZoom(0), reqAbort(false),
-        abortCookie(NULL), thread(NULL), preventRecursion(false) {
+        reqPage(0), reqDirection(1), renderPage(0), renderAbort(false),
+        abortCookie(NULL), stopThread(false), preventRecursion(false) {
         InitializeCriticalSection(&currAccess);
+        hRequest = CreateEvent(NULL, FALSE, FALSE, NULL);
+        thread = CreateThread(NULL, 0, RenderThread, this, 0, 0);
     }
     ~PageRenderer() {
-        if (thread)
+        EnterCriticalSection(&currAccess);
+        stopThread = true;
+        if (abortCookie)
+            abortCookie->Abort();
+        LeaveCriticalSection(&currAccess);
+        SetEvent(hRequest);
+        if (thread) {
             WaitForSingleObject(thread, INFINITE);
-        delete currBmp;
+            CloseHandle(thread);
+        }
+        CloseHandle(hRequest);
+        for (size_t i = 0; i < cache.Count(); i++) {
+            delete cache.At(i).bmp;
+        }
         DeleteCriticalSection(&currAccess);
     }
 
@@ -105,49 +294,97 @@ public:
         return bbox;
     }
 
-    void Render(HDC hdc, RectI target, int pageNo, float zoom) {
+    void Render(HDC hdc, RectI target, RectI area, int pageNo) {
         ScopedCritSec scope(&currAccess);
-        if (currBmp && currPage == pageNo && currSize == target.Size())
-            currBmp->StretchDIBits(hdc, target);
-        else if (!thread) {
-            reqPage = pageNo;
-            reqZoom = zoom;
-            reqSize = target.Size();
-            reqAbort = false;
-            thread = CreateThread(NULL, 0, RenderThread, this, 0, 0);
+        if (pageNo != reqPage && reqPage != 0)
+            reqDirection = pageNo > reqPage ? 1 : -1;
+        reqPage = pageNo;
+        reqArea = area;
+
+        int idx = FindCached(pageNo, target.Size());
+        if (idx != -1) {
+            // move the page to the front
+            CachedPage page = cache.At(idx);
+            cache.RemoveAt(idx);
+            cache.InsertAt(0, page);
+            page.bmp->StretchDIBits(hdc, target);
         }
-        else if (reqPage != pageNo || reqSize != target.Size()) {
+        else if (renderPage != 0 && (renderPage != pageNo || renderSize != target.Size())) {
+            // the visible page takes precedence over prefetching
             if (abortCookie)
                 abortCookie->Abort();
-            reqAbort = true;
+            renderAbort = true;
         }
+        SetEvent(hRequest);
     }
 
 protected:
+    // returns 0 if all pages around the visible one have been rendered
+    // (the engine is only accessed outside of currAccess, as reading from
+    // the IStream might have to wait for the UI thread)
+    int GetNextPage(float *zoom, SizeI *size) {
+        EnterCriticalSection(&currAccess);
+        int pages[] = { reqPage, reqPage + reqDirection, reqPage - reqDirection };
+        RectI area = reqArea;
+        bool stop = stopThread || !reqPage;
+        LeaveCriticalSection(&currAccess);
+        if (stop)
+            return 0;
+
+        for (int i = 0; i < dimof(pages); i++) {
+            int pageNo = pages[i];
+            if (pageNo < 1 || pageNo > engine->PageCount())
+                continue;
+            // this thread doesn't need to prevent recursion
+            RectD page = engine->Transform(engine->PageMediabox(pageNo), pageNo, 1.0, 0);
+            if (page.IsEmpty())
+                continue;
+            RectI onScreen = LayoutPage(page, area, zoom);
+            ScopedCritSec scope(&currAccess);
+            if (FindCached(pageNo, onScreen.Size()) == -1) {
+                *size = onScreen.Size();
+                renderPage = pageNo;
+                renderSize = onScreen.Size();
+                renderAbort = false;
+                return pageNo;
+            }
+        }
+        return 0;
+    }
+
     static DWORD WINAPI RenderThread(LPVOID data) {
         ScopedCom comScope; // because the engine reads data from a COM IStream
 
         PageRenderer *pr = (PageRenderer *)data;
-        RenderedBitmap *bmp = pr->engine->RenderBitmap(pr->reqPage, pr->reqZoom, 0, NULL, Target_View, &pr->abortCookie);
-
-        ScopedCritSec scope(&pr->currAccess);
-
-        if (!pr->reqAbort) {
-            delete pr->currBmp;
-            pr->currBmp = bmp;
-            pr->currPage = pr->reqPage;
-            pr->currSize = pr->reqSize;
+        for (;;) {
+            WaitForSingleObject(pr->hRequest, INFINITE);
+            for (;;) {
+                float zoom;
+                SizeI size;
+                int pageNo = pr->GetNextPage(&zoom, &size);
+                if (!pageNo)
+                    break;
+
+                RenderedBitmap *bmp = pr->engine->RenderBitmap(pageNo, zoom, 0, NULL, Target_View, &pr->abortCookie);
+
+                ScopedCritSec scope(&pr->currAccess);
+                if (bmp && !pr->renderAbort) {
+                    CachedPage page = { pageNo, size, bmp };
+                    pr->cache.InsertAt(0, page);
+                    if (pr->cache.Count() > PREVIEW_CACHE_SIZE)
+                        delete pr->cache.Pop().bmp;
+                    if (pageNo == pr->reqPage)
+                        PostMessage(pr->hwnd, UWM_PAINT_AGAIN, 0, 0);
+                }
+                else
+                    delete bmp;
+                delete pr->abortCookie;
+                pr->abortCookie = NULL;
+                pr->renderPage = 0;
+            }
+            if (pr->stopThread)
+                break;
         }
-        else
-            delete bmp;
-        delete pr->abortCookie;
-        pr->abortCookie = NULL;
-
-        HANDLE thread = pr->thread;
-        pr->thread = NULL;
-        PostMessage(pr->hwnd, UWM_PAINT_AGAIN, 0, 0);
-
-        CloseHandle(thread);
         return 0;
     }
 };
@@ -168,13 +405,12 @@ static LRESULT OnPaint(HWND hwnd)
         RectD page = preview->renderer->GetPageRect(pageNo);
         if (!page.IsEmpty()) {
             rect.Inflate(-PREVIEW_MARGIN, -PREVIEW_MARGIN);
-            float zoom = (float)min(rect.dx / page.dx, rect.dy / page.dy) - 0.001f;
-            RectI onScreen = RectD(rect.x, rect.y, page.dx * zoom, page.dy * zoom).Round();
-            onScreen.Offset((rect.dx - onScreen.dx) / 2, (rect.dy - onScreen.dy) / 2);
+            float zoom;
+            RectI onScreen = LayoutPage(page, rect, &zoom);
 
             RECT rcPage = onScreen.ToRECT();
             FillRect(hdc, &rcPage, brushWhite);
-            preview->renderer->Render(hdc, onScreen, pageNo, zoom);
+            preview->renderer->Render(hdc, onScreen, rect, pageNo);
         }
     }
 
@@ -310,6 +546,11 @@ BaseEngine *CPdfPreview::LoadEngine(IStream *stream)
     return PdfEngine::CreateFromStream(stream);
 }
 
+BaseEngine *CPdfPreview::LoadThumbnailEngine(IStream *stream)
+{
+    return PdfEngine::CreateThumbnailEngine(stream);
+}
+
 #ifdef BUILD_XPS_PREVIEW
 BaseEngine *CXpsPreview::LoadEngine(IStream *stream)
 {
@@ -233,6 +233,9 @@ protected:
     FILETIME    m_dateStamp;
 
     virtual BaseEngine *LoadEngine(IStream *stream) = 0;
+    // engines which only need to render page 1 can be loaded more cheaply
+    virtual BaseEngine *LoadThumbnailEngine(IStream *stream) { return LoadEngine(stream); }
+    WCHAR *GetThumbnailCachePath(UINT cx);
 };
 
 class CPdfPreview : public PreviewBase {
@@ -241,6 +244,7 @@ public:
 
 protected:
     virtual BaseEngine *LoadEngine(IStream *stream);
+    virtual BaseEngine *LoadThumbnailEngine(IStream *stream);
 };
 
 #ifdef BUILD_XPS_PREVIEW
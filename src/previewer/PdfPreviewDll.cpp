@@ -4,6 +4,7 @@
 #include "BaseUtil.h"
 #include "PdfPreview.h"
 
+#include "ThreadUtil.h"
 #include "WinUtil.h"
 
 HINSTANCE g_hInstance = NULL;
@@ -99,7 +100,11 @@ STDAPI_(BOOL) DllMain(HINSTANCE hInstance, DWORD dwReason, LPVOID lpReserved)
 
 STDAPI DllCanUnloadNow(VOID)
 {
-    return g_lRefCount == 0 ? S_OK : S_FALSE;
+    if (g_lRefCount != 0)
+        return S_FALSE;
+    // the thread pool's threads run code of this DLL
+    DrainThreadPool();
+    return S_OK;
 }
 
 // disable warning C6387 which is wrongly issued due to a compiler bug; cf.
@@ -11,11 +11,18 @@ assert() or CrashIf() but CrashAlwaysIf().
 
 To write new regression test:
 - add a file src/regress/Regress${NN}.cpp with Regress${NN} function
-- #include "Regress${NN}.cpp" right before RunTest() function
-- call Regress${NN} function from RunTests()
+- #include "Regress${NN}.cpp" right before gTests
+- add Regress${NN} function to gTests
+
+By default, each test runs in a worker process of its own (as many at a time
+as there are processors; use -jobs 1 to run all tests in this process). A test
+also fails if it takes considerably longer than its runtime stored in
+regress-baseline.txt next to the executable (missing runtimes are added to it,
+-update-baseline replaces all of them).
 */
 
 #include "BaseUtil.h"
+#include "CmdLineParser.h"
 #include "DbgHelpDyn.h"
 #include "DirIter.h"
 #include "Doc.h"
@@ -24,20 +31,30 @@ To write new regression test:
 using namespace Gdiplus;
 #include "GdiPlusUtil.h"
 #include "Mui.h"
+#include "Timer.h"
 #include "WinUtil.h"
 
 static WCHAR *gTestFilesDir;
+// set for worker processes (which run a single test, cf. RunWorker)
+static bool gIsWorker = false;
 
 static WCHAR *TestFilesDir()
 {
     return gTestFilesDir;
 }
 
+static void Pause()
+{
+    // worker processes share the console with the process that launched them
+    if (!gIsWorker)
+        system("pause");
+}
+
 static int Usage()
 {
     printf("regress.exe\n");
     printf("Error: didn't find test files on this computer!\n");
-    system("pause");
+    Pause();
     return 1;
 }
 
@@ -69,7 +86,7 @@ static void VerifyFileExists(const WCHAR *filePath)
 {
     if (!file::Exists(filePath)) {
         wprintf(L"File '%s' doesn't exist!\n", filePath);
-        system("pause");
+        Pause();
         exit(1);
     }
 }
@@ -166,15 +183,221 @@ static void UninstallCrashHandler()
 
 #include "Regress00.cpp"
 
-static void RunTests()
+struct RegressTest {
+    const WCHAR *name;
+    void (*func)();
+};
+
+static RegressTest gTests[] = {
+    { L"Regress00", Regress00 },
+    { L"Regress01", Regress01 },
+    { L"Regress02", Regress02 },
+};
+
+// a test fails if it takes that much longer than its baseline runtime
+// (both relatively and absolutely, to allow for some noise)
+#define MAX_SLOWDOWN_PERCENT    50
+#define MIN_SLOWDOWN_MS         200
+
+// returns the test's runtime in ms
+static int RunTest(RegressTest& test)
 {
-    Regress00();
-    Regress01();
-    Regress02();
+    Timer t(true);
+    test.func();
+    t.Stop();
+    return (int)t.GetTimeInMs();
+}
+
+// runtimes differ too much between machines for keeping
+// the baseline with the (shared) test files
+static WCHAR *GetBaselinePath()
+{
+    ScopedMem<WCHAR> exePath(GetExePath());
+    ScopedMem<WCHAR> exeDir(path::GetDir(exePath));
+    return path::Join(exeDir, L"regress-baseline.txt");
+}
+
+// the baseline contains a line "<test name> <runtime in ms>" per test;
+// runtimes[i] is set to -1 for tests without a baseline
+static void LoadBaseline(const WCHAR *filePath, int *runtimes)
+{
+    for (size_t i = 0; i < dimof(gTests); i++) {
+        runtimes[i] = -1;
+    }
+    ScopedMem<char> data(file::ReadAll(filePath, NULL));
+    if (!data)
+        return;
+    ScopedMem<WCHAR> text(str::conv::FromUtf8(data));
+    WStrVec lines;
+    lines.Split(text, L"\n", true);
+    for (size_t i = 0; i < lines.Count(); i++) {
+        ScopedMem<WCHAR> name;
+        int ms;
+        if (!str::Parse(lines.At(i), L"%S %d", &name, &ms))
+            continue;
+        for (size_t j = 0; j < dimof(gTests); j++) {
+            if (str::Eq(gTests[j].name, name))
+                runtimes[j] = ms;
+        }
+    }
+}
+
+static bool SaveBaseline(const WCHAR *filePath, int *runtimes)
+{
+    str::Str<char> data;
+    for (size_t i = 0; i < dimof(gTests); i++) {
+        if (runtimes[i] >= 0)
+            data.AppendFmt("%S %d\r\n", gTests[i].name, runtimes[i]);
+    }
+    return file::WriteAll(filePath, data.Get(), data.Size());
+}
+
+// runs a single test for RunTestsInParallel and
+// writes its runtime to the file at resultPath
+static int RunWorker(const WCHAR *testName, const WCHAR *resultPath)
+{
+    for (size_t i = 0; i < dimof(gTests); i++) {
+        if (!str::Eq(gTests[i].name, testName))
+            continue;
+        ScopedMem<char> ms(str::Format("%d", RunTest(gTests[i])));
+        return resultPath && file::WriteAll(resultPath, ms.Get(), str::Len(ms)) ? 0 : 1;
+    }
+    wprintf(L"Unknown test '%s'!\n", testName);
+    return 1;
+}
+
+static HANDLE LaunchWorker(RegressTest& test, const WCHAR *resultPath)
+{
+    ScopedMem<WCHAR> exePath(GetExePath());
+    ScopedMem<WCHAR> cmdLine(str::Format(L"\"%s\" /regress -test %s -result \"%s\"",
+                                         exePath, test.name, resultPath));
+    return LaunchProcess(cmdLine);
+}
+
+// runs each test in a worker process of its own with up to jobs workers at
+// a time; runtimes[i] is set to -1 for tests which failed (i.e. crashed)
+static void RunTestsInParallel(int jobs, int *runtimes)
+{
+    Vec<HANDLE> workers;
+    Vec<size_t> workerTests;
+    WStrVec resultPaths;
+    jobs = min(jobs, MAXIMUM_WAIT_OBJECTS);
+
+    size_t next = 0;
+    while (next < dimof(gTests) || workers.Count() > 0) {
+        for (; next < dimof(gTests) && workers.Count() < (size_t)jobs; next++) {
+            ScopedMem<WCHAR> resultPath(path::GetTempPath(L"Reg"));
+            HANDLE hProcess = resultPath ? LaunchWorker(gTests[next], resultPath) : NULL;
+            if (!hProcess) {
+                wprintf(L"Couldn't launch a worker for %s!\n", gTests[next].name);
+                runtimes[next] = -1;
+                continue;
+            }
+            workers.Append(hProcess);
+            workerTests.Append(next);
+            resultPaths.Append(resultPath.StealData());
+        }
+        if (workers.Count() == 0)
+            break;
+
+        DWORD res = WaitForMultipleObjects((DWORD)workers.Count(), workers.LendData(), FALSE, INFINITE);
+        size_t ix = res - WAIT_OBJECT_0;
+        CrashAlwaysIf(ix >= workers.Count());
+
+        DWORD exitCode = 1;
+        GetExitCodeProcess(workers.At(ix), &exitCode);
+        int ms = -1;
+        ScopedMem<char> result(file::ReadAll(resultPaths.At(ix), NULL));
+        if (exitCode != 0 || !result || !str::Parse(result, "%d%$", &ms))
+            ms = -1;
+        runtimes[workerTests.At(ix)] = ms;
+
+        CloseHandle(workers.At(ix));
+        file::Delete(resultPaths.At(ix));
+        free(resultPaths.At(ix));
+        workers.RemoveAt(ix);
+        workerTests.RemoveAt(ix);
+        resultPaths.RemoveAt(ix);
+    }
+}
+
+// returns the number of failed tests
+static int RunTests(int jobs, bool updateBaseline)
+{
+    int runtimes[dimof(gTests)];
+    if (jobs > 1) {
+        RunTestsInParallel(jobs, runtimes);
+    }
+    else {
+        // a crash in this process aborts all remaining tests
+        for (size_t i = 0; i < dimof(gTests); i++) {
+            runtimes[i] = RunTest(gTests[i]);
+        }
+    }
+
+    ScopedMem<WCHAR> baselinePath(GetBaselinePath());
+    int baseline[dimof(gTests)];
+    LoadBaseline(baselinePath, baseline);
+
+    int failed = 0;
+    bool baselineChanged = false;
+    for (size_t i = 0; i < dimof(gTests); i++) {
+        const WCHAR *name = gTests[i].name;
+        if (runtimes[i] < 0) {
+            wprintf(L"%s: FAILED (crashed)\n", name);
+            failed++;
+        }
+        else if (baseline[i] < 0 || updateBaseline) {
+            wprintf(L"%s: %d ms (new baseline)\n", name, runtimes[i]);
+            baseline[i] = runtimes[i];
+            baselineChanged = true;
+        }
+        else if (runtimes[i] > baseline[i] + max(baseline[i] * MAX_SLOWDOWN_PERCENT / 100, MIN_SLOWDOWN_MS)) {
+            wprintf(L"%s: FAILED (%d ms, baseline %d ms)\n", name, runtimes[i], baseline[i]);
+            failed++;
+        }
+        else {
+            wprintf(L"%s: %d ms (baseline %d ms)\n", name, runtimes[i], baseline[i]);
+        }
+    }
+    fflush(stdout);
+
+    if (baselineChanged && !SaveBaseline(baselinePath, baseline))
+        wprintf(L"Couldn't save the baseline to %s!\n", baselinePath);
+    return failed;
+}
+
+static int GetProcessorCount()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
 }
 
 int RegressMain()
 {
+    const WCHAR *testName = NULL, *resultPath = NULL;
+    int jobs = GetProcessorCount();
+    bool updateBaseline = false;
+
+    WStrVec argList;
+    ParseCmdLine(GetCommandLine(), argList);
+    for (size_t i = 1; i < argList.Count(); i++) {
+        const WCHAR *arg = argList.At(i);
+        bool hasParam = i + 1 < argList.Count();
+        if (str::EqI(arg, L"-test") && hasParam)
+            testName = argList.At(++i);
+        else if (str::EqI(arg, L"-result") && hasParam)
+            resultPath = argList.At(++i);
+        else if (str::EqI(arg, L"-jobs") && hasParam)
+            jobs = _wtoi(argList.At(++i));
+        else if (str::EqI(arg, L"-update-baseline"))
+            updateBaseline = true;
+    }
+
+    gIsWorker = testName != NULL;
+    if (gIsWorker)
+        AttachConsole(ATTACH_PARENT_PROCESS);
     RedirectIOToConsole();
 
     if (!FindTestFilesDir()) {
@@ -186,12 +409,22 @@ int RegressMain()
     ScopedGdiPlus gdi;
     mui::Initialize();
 
-    RunTests();
+    int result;
+    if (gIsWorker) {
+        result = RunWorker(testName, resultPath);
+    }
+    else {
+        int failed = RunTests(jobs, updateBaseline);
+        if (failed > 0)
+            printf("%d of %d tests failed!\n", failed, (int)dimof(gTests));
+        else
+            printflush("All tests completed successfully!\n");
+        result = failed > 0 ? 1 : 0;
+    }
 
-    printflush("All tests completed successfully!\n");
     mui::Destroy();
     UninstallCrashHandler();
 
-    system("pause");
-    return 0;
+    Pause();
+    return result;
 }
@@ -104,6 +104,7 @@
 #define IDM_DEBUG_MUI                   595
 #define IDM_DEBUG_ANNOTATION            596
 #define IDM_ADVANCED_OPTIONS            597
+#define IDM_DEBUG_RENDER_STATS          598
 #define IDM_FAV_FIRST                   600
 #define IDM_FAV_LAST                    800
 #define IDC_GOTO_PAGE_EDIT              1000
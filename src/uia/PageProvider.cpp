@@ -221,6 +221,7 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationPageProvider::get_Value(BSTR *pRetV
     if (released)
         return E_FAIL;
 
+    ScopedTextPin pin(dm->textCache, pageNum);
     const WCHAR * pageContent = dm->textCache->GetData(pageNum);
     if (!pageContent) {
         *pRetVal = NULL;
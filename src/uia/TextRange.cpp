@@ -129,87 +129,22 @@ void SumatraUIAutomationTextRange::ValidateEndEndpoint()
 int SumatraUIAutomationTextRange::FindPreviousWordEndpoint(int pageno, int idx, bool dontReturnInitial)
 {
     // based on TextSelection::SelectWordAt
-    int textLen;
-    const WCHAR *pageText = document->GetDM()->textCache->GetData(pageno, &textLen);
-    
-    if (dontReturnInitial) {
-        for (; idx > 0; idx--)
-        {
-            if (iswordchar(pageText[idx - 1]))
-                break;
-        }
-    }
-
-    for (; idx > 0; idx--)
-    {
-        if (!iswordchar(pageText[idx - 1]))
-            break;
-    }
-    return idx;
+    return document->GetDM()->textCache->FindWordEndpoint(pageno, idx, false, dontReturnInitial);
 }
 
 int SumatraUIAutomationTextRange::FindNextWordEndpoint(int pageno, int idx, bool dontReturnInitial)
 {
-    int textLen;
-    const WCHAR *pageText = document->GetDM()->textCache->GetData(pageno, &textLen);
-
-    if (dontReturnInitial) {
-        for (; idx < textLen; idx++)
-        {
-            if (iswordchar(pageText[idx]))
-                break;
-        }
-    }
-
-    for (; idx < textLen; idx++)
-    {
-        if (!iswordchar(pageText[idx]))
-            break;
-    }
-    return idx;
+    return document->GetDM()->textCache->FindWordEndpoint(pageno, idx, true, dontReturnInitial);
 }
 
 int SumatraUIAutomationTextRange::FindPreviousLineEndpoint(int pageno, int idx, bool dontReturnInitial)
 {
-    int textLen;
-    const WCHAR *pageText = document->GetDM()->textCache->GetData(pageno, &textLen);
-    
-    if (dontReturnInitial)
-    {
-        for (; idx > 0; idx--)
-        {
-            if (pageText[idx - 1] != L'\n')
-                break;
-        }
-    }
-
-    for (; idx > 0; idx--) 
-    {
-        if (pageText[idx - 1] == L'\n')
-            break;
-    }
-    return idx;
+    return document->GetDM()->textCache->FindLineEndpoint(pageno, idx, false, dontReturnInitial);
 }
 
 int SumatraUIAutomationTextRange::FindNextLineEndpoint(int pageno, int idx, bool dontReturnInitial)
 {
-    int textLen;
-    const WCHAR *pageText = document->GetDM()->textCache->GetData(pageno, &textLen);
-    
-    if (dontReturnInitial) {
-        for (; idx < textLen; idx++)
-        {
-            if (pageText[idx] != L'\n')
-                break;
-        }
-    }
-
-    for (; idx < textLen; idx++)
-    {
-        if (pageText[idx] == L'\n')
-            break;
-    }
-    return idx;
+    return document->GetDM()->textCache->FindLineEndpoint(pageno, idx, true, dontReturnInitial);
 }
 
 // IUnknown
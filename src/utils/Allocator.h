@@ -165,6 +165,16 @@ public:
         FreeAll();
     }
 
+    // total size of all allocated blocks (memory is only
+    // released by FreeAll, so this is also the peak usage)
+    size_t BytesAllocated() const {
+        size_t total = 0;
+        for (MemBlockNode *curr = firstBlock; curr; curr = curr->next) {
+            total += curr->size;
+        }
+        return total;
+    }
+
     void AllocBlock(size_t minSize) {
         minSize = RoundUp(minSize, allocRounding);
         size_t size = minBlockSize;
@@ -235,6 +245,146 @@ public:
     }
 };
 
+// SharedPoolAllocator is a PoolAllocator which can be used by several threads
+// at once without locking: pieces are carved out of the current block with a
+// single interlocked addition and new blocks are installed with an interlocked
+// compare-and-swap. Iterating and FreeAll() must not overlap with allocations.
+class SharedPoolAllocator : public Allocator {
+
+    size_t  minBlockSize;
+    size_t  allocRounding;
+
+    struct MemBlockNode {
+        struct MemBlockNode * volatile next;
+        LONG                  size;
+        // can temporarily grow larger than size
+        volatile LONG         used;
+        // where the last piece ends, once the block is full
+        volatile LONG         end;
+
+        size_t               Used() { return (size_t)min(used, end); }
+        char *               DataStart() { return (char*)this + sizeof(MemBlockNode); }
+        // data follows here
+    };
+
+    MemBlockNode * volatile currBlock;
+    MemBlockNode * volatile firstBlock;
+
+    // iteration state
+    MemBlockNode *  currIter;
+    size_t          iterPos;
+
+    void Init() {
+        currBlock = NULL;
+        firstBlock = NULL;
+    }
+
+    // returns a new block whose first size bytes are already allocated
+    MemBlockNode *NewBlock(size_t size) {
+        size_t blockSize = max(minBlockSize, size);
+        CrashAlwaysIf(blockSize > INT_MAX);
+        MemBlockNode *node = (MemBlockNode*)calloc(1, sizeof(MemBlockNode) + blockSize);
+        CrashAlwaysIf(!node);
+        node->size = node->end = (LONG)blockSize;
+        node->used = (LONG)size;
+        return node;
+    }
+
+public:
+    template <typename T>
+    T *IterStart() {
+        currIter = firstBlock;
+        iterPos = 0;
+        CrashIf(currIter && (currIter->Used() % sizeof(T) != 0));
+        return IterNext<T>();
+    }
+
+    template <typename T>
+    T* IterNext() {
+        while (currIter && currIter->Used() == iterPos) {
+            currIter = currIter->next;
+            iterPos = 0;
+        }
+        if (!currIter)
+            return NULL;
+        T *elPtr = reinterpret_cast<T*>(currIter->DataStart() + iterPos);
+        iterPos += sizeof(T);
+        return elPtr;
+    }
+
+    SharedPoolAllocator(size_t rounding=8) : minBlockSize(4096),
+        allocRounding(rounding), currIter(NULL), iterPos((size_t)-1) {
+        Init();
+    }
+
+    void SetMinBlockSize(size_t newMinBlockSize) {
+        CrashIf(currBlock); // can only be changed before first allocation
+        minBlockSize = newMinBlockSize;
+    }
+
+    void SetAllocRounding(size_t newRounding) {
+        CrashIf(currBlock); // can only be changed before first allocation
+        allocRounding = newRounding;
+    }
+
+    void FreeAll() {
+        MemBlockNode *curr = firstBlock;
+        while (curr) {
+            MemBlockNode *next = curr->next;
+            free(curr);
+            curr = next;
+        }
+        Init();
+    }
+
+    virtual ~SharedPoolAllocator() {
+        FreeAll();
+    }
+
+    // Allocator methods
+    virtual void *Realloc(void *mem, size_t size) {
+        CrashAlwaysIf(true);
+        return NULL;
+    }
+
+    virtual void Free(void *mem) {
+        // does nothing, we can't free individual pieces of memory
+    }
+
+    virtual void *Alloc(size_t size) {
+        size = RoundUp(size, allocRounding);
+        // used may temporarily grow by one piece per allocating thread beyond size
+        CrashAlwaysIf(size > INT_MAX / 64);
+        for (;;) {
+            MemBlockNode *block = currBlock;
+            if (block) {
+                LONG offset = InterlockedExchangeAdd(&block->used, (LONG)size);
+                if ((size_t)offset + size <= (size_t)block->size)
+                    return block->DataStart() + offset;
+                // only the first thread to overflow the block knows where the last piece ends
+                if (offset <= block->size)
+                    block->end = offset;
+            }
+            MemBlockNode *node = NewBlock(size);
+            if (InterlockedCompareExchangePointer((void **)&currBlock, node, block) != block) {
+                // another thread has installed a new block in the meantime
+                free(node);
+                continue;
+            }
+            if (block)
+                block->next = node;
+            else
+                firstBlock = node;
+            return node->DataStart();
+        }
+    }
+
+    template <typename T>
+    T *AllocStruct() {
+        return (T *)Alloc(sizeof(T));
+    }
+};
+
 // A helper for allocating an array of elements of type T
 // either on stack (if they fit within StackBufInBytes)
 // or in memory. Allocating on stack is a perf optimization
@@ -3,6 +3,18 @@
 
 #include "BaseUtil.h"
 
+bool HasSSE2()
+{
+#ifdef _WIN64
+    return true;
+#else
+    static int hasSSE2 = -1;
+    if (-1 == hasSSE2)
+        hasSSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? 1 : 0;
+    return hasSSE2 != 0;
+#endif
+}
+
 size_t RoundToPowerOf2(size_t size)
 {
     size_t n = 1;
@@ -160,6 +160,8 @@ inline bool memeq(const void *s1, const void *s2, size_t len)
 
 size_t      RoundToPowerOf2(size_t size);
 uint32_t    MurmurHash2(const void *key, size_t len);
+// whether SSE2 instructions can be used (always true for 64-bit builds)
+bool        HasSSE2();
 
 template <typename T>
 void ListInsert(T** root, T* el)
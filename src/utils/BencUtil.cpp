@@ -5,15 +5,25 @@
 #include "BencUtil.h"
 
 BencObj *BencObj::Decode(const char *bytes, size_t *lenOut)
+{
+    return Decode(bytes, lenOut, false);
+}
+
+BencObj *BencObj::DecodeInPlace(char *bytes, size_t *lenOut)
+{
+    return Decode(bytes, lenOut, true);
+}
+
+BencObj *BencObj::Decode(const char *bytes, size_t *lenOut, bool inPlace)
 {
     size_t len;
-    BencObj *result = BencString::Decode(bytes, &len);
+    BencObj *result = BencString::Decode(bytes, &len, inPlace);
     if (!result)
         result = BencInt::Decode(bytes, &len);
     if (!result)
-        result = BencArray::Decode(bytes, &len);
+        result = BencArray::Decode(bytes, &len, inPlace);
     if (!result)
-        result = BencDict::Decode(bytes, &len);
+        result = BencDict::Decode(bytes, &len, inPlace);
 
     // if the caller isn't interested in the amount of bytes
     // processed, verify that we've processed all of them
@@ -47,13 +57,34 @@ static const char *ParseBencInt(const char *bytes, int64_t& value)
     return bytes;
 }
 
-BencString::BencString(const WCHAR *value) : BencObj(BT_STRING)
+// returns the start of the string's data (or NULL) and sets len
+// to the data's length and lenOut to the length of the encoded string
+static const char *ParseBencString(const char *bytes, size_t& len, size_t& lenOut)
+{
+    if (!bytes || !str::IsDigit(*bytes))
+        return NULL;
+
+    int64_t len64;
+    const char *start = ParseBencInt(bytes, len64);
+    if (!start || *start != ':' || len64 < 0)
+        return NULL;
+
+    start++;
+    len = (size_t)len64;
+    if (memchr(start, '\0', len))
+        return NULL;
+
+    lenOut = (start - bytes) + len;
+    return start;
+}
+
+BencString::BencString(const WCHAR *value) : BencObj(BT_STRING), ownsValue(true)
 {
     assert(value);
     this->value = str::conv::ToUtf8(value);
 }
 
-BencString::BencString(const char *rawValue, size_t len) : BencObj(BT_STRING)
+BencString::BencString(const char *rawValue, size_t len) : BencObj(BT_STRING), ownsValue(true)
 {
     assert(rawValue);
     if (len == (size_t)-1)
@@ -71,23 +102,23 @@ char *BencString::Encode() const
     return str::Format("%" PRIuPTR ":%s", str::Len(value), value);
 }
 
-BencString *BencString::Decode(const char *bytes, size_t *lenOut)
+BencString *BencString::Decode(const char *bytes, size_t *lenOut, bool inPlace)
 {
-    if (!bytes || !str::IsDigit(*bytes))
-        return NULL;
-
-    int64_t len;
-    const char *start = ParseBencInt(bytes, len);
-    if (!start || *start != ':' || len < 0)
-        return NULL;
-
-    start++;
-    if (memchr(start, '\0', (size_t)len))
+    size_t len, totalLen;
+    const char *start = ParseBencString(bytes, len, totalLen);
+    if (!start)
         return NULL;
 
     if (lenOut)
-        *lenOut = (start - bytes) + (size_t)len;
-    return new BencString(start, (size_t)len);
+        *lenOut = totalLen;
+    if (!inPlace)
+        return new BencString(start, len);
+    // move the data over the length prefix (which is at least two bytes
+    // long), so that there's room for the terminating zero
+    char *value = const_cast<char *>(bytes);
+    memmove(value, start, len);
+    value[len] = '\0';
+    return new BencString(value, false);
 }
 
 char *BencInt::Encode() const
@@ -139,7 +170,7 @@ char *BencArray::Encode() const
     return bytes.StealData();
 }
 
-BencArray *BencArray::Decode(const char *bytes, size_t *lenOut)
+BencArray *BencArray::Decode(const char *bytes, size_t *lenOut, bool inPlace)
 {
     if (!bytes || *bytes != 'l')
         return NULL;
@@ -148,7 +179,7 @@ BencArray *BencArray::Decode(const char *bytes, size_t *lenOut)
     size_t ix = 1;
     while (bytes[ix] != 'e') {
         size_t len;
-        BencObj *obj = BencObj::Decode(bytes + ix, &len);
+        BencObj *obj = BencObj::Decode(bytes + ix, &len, inPlace);
         if (!obj) {
             delete list;
             return NULL;
@@ -162,62 +193,66 @@ BencArray *BencArray::Decode(const char *bytes, size_t *lenOut)
     return list;
 }
 
-static int keycmp(const void *a, const void *b)
+// returns the index of the first key not ordered before key
+size_t BencDict::FindKey(const char *key) const
 {
-    return strcmp(*(char **)a, *(char **)b);
+    // keys are usually added in order (e.g. when decoding)
+    size_t count = keys.Count();
+    if (0 == count || strcmp(keys.At(count - 1), key) < 0)
+        return count;
+
+    size_t lo = 0, hi = count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(keys.At(mid), key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
 BencObj *BencDict::GetObj(const char *key) const
 {
-    char **found = (char **)bsearch(&key, keys.LendData(), keys.Count(), sizeof(key), keycmp);
-    if (found)
-        return values.At(found - keys.LendData());
+    size_t idx = FindKey(key);
+    if (idx < keys.Count() && str::Eq(keys.At(idx), key))
+        return values.At(idx);
     return NULL;
 }
 
-/* Per bencoding spec, keys must be ordered alphabetically when serialized,
-   so we insert them in sorted order. This might be expensive due to lots of
-   memory copying for lots of insertions in random order (more efficient would
-   probably be: append at the end and sort when insertions are done or use a
-   proper hash table instead of two parallel arrays). */
-void BencDict::Add(const char *key, BencObj *obj)
+// Per bencoding spec, keys must be ordered alphabetically when serialized,
+// so we insert them in sorted order (takes ownership of key)
+void BencDict::Insert(char *key, BencObj *obj)
 {
-    CrashIf(!key || !obj || values.Contains(obj));
-    if (!key || !obj || values.Contains(obj)) return;
-
-    // determine the ordered insertion index
-    size_t oix = 0;
-    if (keys.Count() > lastIdx && strcmp(keys.At(lastIdx), key) < 0)
-        oix = lastIdx + 1;
-    for (; oix < keys.Count(); oix++) {
-        if (strcmp(keys.At(oix), key) >= 0)
-            break;
-    }
-
+    size_t oix = FindKey(key);
     if (oix < keys.Count() && str::Eq(keys.At(oix), key)) {
         // overwrite a previous value
+        free(key);
         delete values.At(oix);
         values.At(oix) = obj;
     }
     else {
-        keys.InsertAt(oix, str::Dup(key));
+        keys.InsertAt(oix, key);
         values.InsertAt(oix, obj);
     }
-    lastIdx = oix;
+}
+
+void BencDict::Add(const char *key, BencObj *obj)
+{
+    CrashIf(!key || !obj || values.Contains(obj));
+    if (!key || !obj || values.Contains(obj)) return;
+    Insert(str::Dup(key), obj);
 }
 
 BencObj *BencDict::Remove(const char *key)
 {
-    char **found = (char **)bsearch(&key, keys.LendData(), keys.Count(), sizeof(key), keycmp);
-    if (!found)
+    size_t idx = FindKey(key);
+    if (idx >= keys.Count() || !str::Eq(keys.At(idx), key))
         return NULL;
-    size_t idx = found - keys.LendData();
     free(keys.At(idx));
     keys.RemoveAt(idx);
     BencObj *removed = values.At(idx);
     values.RemoveAt(idx);
-    if (idx <= lastIdx)
-        lastIdx--;
     return removed;
 }
 
@@ -237,7 +272,7 @@ char *BencDict::Encode() const
     return bytes.StealData();
 }
 
-BencDict *BencDict::Decode(const char *bytes, size_t *lenOut)
+BencDict *BencDict::Decode(const char *bytes, size_t *lenOut, bool inPlace)
 {
     if (!bytes || *bytes != 'd')
         return NULL;
@@ -245,23 +280,20 @@ BencDict *BencDict::Decode(const char *bytes, size_t *lenOut)
     BencDict *dict = new BencDict();
     size_t ix = 1;
     while (bytes[ix] != 'e') {
-        size_t len;
-        BencString *key = BencString::Decode(bytes + ix, &len);
-        if (!key || key->Type() != BT_STRING) {
-            delete key;
+        size_t len, keyLen;
+        const char *key = ParseBencString(bytes + ix, keyLen, len);
+        if (!key) {
             delete dict;
             return NULL;
         }
         ix += len;
-        BencObj *obj = BencObj::Decode(bytes + ix, &len);
+        BencObj *obj = BencObj::Decode(bytes + ix, &len, inPlace);
         if (!obj) {
-            delete key;
             delete dict;
             return NULL;
         }
         ix += len;
-        dict->Add(key->RawValue(), obj);
-        delete key;
+        dict->Insert(str::DupN(key, keyLen), obj);
     }
 
     if (lenOut)
@@ -30,21 +30,35 @@ public:
 
     virtual char *Encode() const = 0;
     static BencObj *Decode(const char *bytes, size_t *lenOut=NULL);
+    // same as Decode, except that strings aren't copied but are moved within
+    // bytes (which is thus modified and must outlive the returned object)
+    static BencObj *DecodeInPlace(char *bytes, size_t *lenOut=NULL);
+
+protected:
+    static BencObj *Decode(const char *bytes, size_t *lenOut, bool inPlace);
 };
 
 class BencString : public BencObj {
     char *value;
+    // false for strings decoded in place
+    bool ownsValue;
+
+    BencString(char *value, bool ownsValue) :
+        BencObj(BT_STRING), value(value), ownsValue(ownsValue) { }
 
 public:
     BencString(const WCHAR *value);
     BencString(const char *rawValue, size_t len);
-    virtual ~BencString() { free(value); }
+    virtual ~BencString() {
+        if (ownsValue)
+            free(value);
+    }
 
     WCHAR *Value() const;
     const char *RawValue() const { return value; }
 
     virtual char *Encode() const;
-    static BencString *Decode(const char *bytes, size_t *lenOut);
+    static BencString *Decode(const char *bytes, size_t *lenOut, bool inPlace=false);
 };
 
 class BencInt : public BencObj {
@@ -106,18 +120,20 @@ public:
     BencDict *GetDict(size_t index) const;
 
     virtual char *Encode() const;
-    static BencArray *Decode(const char *bytes, size_t *lenOut);
+    static BencArray *Decode(const char *bytes, size_t *lenOut, bool inPlace=false);
 };
 
 class BencDict : public BencObj {
+    // sorted, so that keys can be looked up through binary search
     Vec<char *> keys;
     Vec<BencObj *> values;
-    size_t lastIdx;
 
+    size_t FindKey(const char *key) const;
     BencObj *GetObj(const char *key) const;
+    void Insert(char *key, BencObj *obj);
 
 public:
-    BencDict() : BencObj(BT_DICT), lastIdx(0) { }
+    BencDict() : BencObj(BT_DICT) { }
     virtual ~BencDict() {
         FreeVecMembers(keys);
         DeleteVecMembers(values);
@@ -166,7 +182,7 @@ public:
     }
 
     virtual char *Encode() const;
-    static BencDict *Decode(const char *bytes, size_t *lenOut);
+    static BencDict *Decode(const char *bytes, size_t *lenOut, bool inPlace=false);
 };
 
 #endif
@@ -4,23 +4,44 @@
 #include "BaseUtil.h"
 #include "BitReader.h"
 
+#include "ByteOrderDecoder.h"
+
 // Bit reader is a streaming reader of bits from underlying memory data
+// (which are read 64 bits at a time into a buffer)
 
 // data has to be valid for the lifetime of this class
 BitReader::BitReader(uint8_t *data, size_t len) :
     data(data), dataLen(len), currBitPos(0)
 {
     bitsCount = len * 8;
+    Fill();
 }
 
 BitReader::~BitReader() {
 }
 
+// loads the 8 bytes starting at the current byte into buf
+// (bytes past the end of data are read as 0)
+void BitReader::Fill() {
+    size_t currBytePos = currBitPos / 8;
+    bufBitPos = currBytePos * 8;
+    buf = 0;
+    if (currBytePos + 8 <= dataLen) {
+        // fast path - all 8 bytes are available
+        const uint8_t *d = data + currBytePos;
+        buf = ((uint64_t)UInt32BE(d) << 32) | UInt32BE(d + 4);
+        return;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        buf = (buf << 8) | GetByte(currBytePos + i);
+    }
+}
+
 // advance position in the bit stream
 // returns false if we've eaten bits more than we have
 bool BitReader::Eat(size_t bitsCount) {
     currBitPos += bitsCount;
-    return (currBitPos <= bitsCount);
+    return (currBitPos <= this->bitsCount);
 }
 
 size_t BitReader::BitsLeft() {
@@ -33,35 +54,10 @@ size_t BitReader::BitsLeft() {
 // If asked for more bits than we have left, the extra bits will be 0
 uint32_t BitReader::Peek(size_t bitsCount) {
     assert(bitsCount <= 32);
-    size_t currBytePos = currBitPos / 8;
-    uint8_t currByte = GetByte(currBytePos);
-    uint8_t currBit = currBitPos % 8;
-    currByte = currByte << currBit;
-    uint8_t bitsLeft = 8 - currBit;
-    uint32_t ret = 0;
-    while (bitsCount > 0) {
-        assert(bitsLeft >= 0);
-        if (0 == bitsLeft) {
-            ++currBytePos;
-            currByte = GetByte(currBytePos);
-            bitsLeft = 8;
-        }
-        // being conservative here, could probably handle
-        // bitsLeft other than 8
-        if ((8 == bitsLeft) && (bitsCount >= 8)) {
-            // fast path - 8 bits at a time
-            ret = (ret << 8) | currByte;
-            bitsLeft = 0;
-            bitsCount -= 8;
-        } else {
-            // slow path - 1 bit at a time
-            ret = ret << 1;
-            if ((0x80 & currByte) != 0)
-                ret |= 1;
-            currByte = currByte << 1;
-            --bitsLeft;
-            --bitsCount;
-        }
-    }
-    return ret;
+    if (0 == bitsCount)
+        return 0;
+    // after a refill, at most 7 bits at the start of buf have already been read
+    if (currBitPos < bufBitPos || currBitPos - bufBitPos + bitsCount > 64)
+        Fill();
+    return (uint32_t)((buf << (currBitPos - bufBitPos)) >> (64 - bitsCount));
 }
@@ -11,6 +11,11 @@ class BitReader
             return 0;
         return data[pos];
     }
+    void Fill();
+
+    // up to 64 bits starting at the bit position bufBitPos (msb first)
+    uint64_t    buf;
+    size_t      bufBitPos;
 
 public:
     BitReader(uint8_t *data, size_t len);
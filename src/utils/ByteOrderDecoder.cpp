@@ -74,6 +74,36 @@ void ByteOrderDecoder::Bytes(char *dest, size_t len)
     curr += len;
 }
 
+void ByteOrderDecoder::UInt16Array(uint16 *dest, size_t count)
+{
+    CrashIf(left / sizeof(uint16) < count);
+    if (LittleEndian == byteOrder) {
+        for (size_t i = 0; i < count; i++)
+            dest[i] = UInt16LE(curr + i * sizeof(uint16));
+    }
+    else {
+        for (size_t i = 0; i < count; i++)
+            dest[i] = UInt16BE(curr + i * sizeof(uint16));
+    }
+    left -= count * sizeof(uint16);
+    curr += count * sizeof(uint16);
+}
+
+void ByteOrderDecoder::UInt32Array(uint32 *dest, size_t count)
+{
+    CrashIf(left / sizeof(uint32) < count);
+    if (LittleEndian == byteOrder) {
+        for (size_t i = 0; i < count; i++)
+            dest[i] = UInt32LE(curr + i * sizeof(uint32));
+    }
+    else {
+        for (size_t i = 0; i < count; i++)
+            dest[i] = UInt32BE(curr + i * sizeof(uint32));
+    }
+    left -= count * sizeof(uint32);
+    curr += count * sizeof(uint32);
+}
+
 void ByteOrderDecoder::Skip(size_t len)
 {
     CrashIf(left < len);
@@ -23,6 +23,9 @@ public:
     int32  Int32() { return (int32)UInt32(); }
 
     void   Bytes(char *dest, size_t len);
+    // decode arrays of count numbers at once
+    void   UInt16Array(uint16 *dest, size_t count);
+    void   UInt32Array(uint32 *dest, size_t count);
 
     void   Skip(size_t len);
     void   Unskip(size_t len);
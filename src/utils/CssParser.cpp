@@ -4,6 +4,8 @@
 #include "BaseUtil.h"
 #include "CssParser.h"
 
+#include "HtmlPullParser.h"
+
 // TODO: the following parser doesn't comply yet with
 // http://www.w3.org/TR/CSS21/syndata.html#syntax
 
@@ -13,12 +15,9 @@ static bool SkipWsAndComments(const char*& s, const char *end)
     const char *start = s;
     for (; s < end && str::IsWs(*s); s++);
     while (s + 2 <= end && s[0] == '/' && s[1] == '*') {
-        for (s += 2; s < end; s++) {
-            if (s + 2 <= end && s[0] == '*' && s[1] == '/') {
-                s += 2;
-                break;
-            }
-        }
+        s += 2;
+        if (SkipUntil(s, end, "*/"))
+            s += 2;
         for (; s < end && str::IsWs(*s); s++);
     }
     return start != s;
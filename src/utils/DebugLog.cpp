@@ -43,7 +43,7 @@ void CrashLogF(const char *fmt, ...)
 
     va_list args;
     va_start(args, fmt);
-    gCrashLog->AppendAndFree(str::FmtV(fmt, args));
+    gCrashLog->AppendFmtV(fmt, args);
     gCrashLog->Append("\r\n");
     va_end(args);
 }
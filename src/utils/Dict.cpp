@@ -15,9 +15,10 @@ hash table. The actual dict class is a wrapper that provides
 a type-safe API and handles policy decisions like allocations
 (if they are necessary).
 
-Our hash table uses the same parameters as the one in redis
-(but without complexity of incremental hashing):
-- we use chaining on collisions
+Our hash table uses open addressing:
+- we use linear probing with Robin Hood hashing on collisions
+- the entries store the hashes of their keys
+- small tables store their entries inline
 - size of the hash table is power of two
 
 TODO:
@@ -62,138 +63,173 @@ class WStrKeyHasherComparator : public HasherComparator {
 static StrKeyHasherComparator gStrKeyHasherComparator;
 static WStrKeyHasherComparator gWStrKeyHasherComparator;
 
+// number of entries stored inside HashTable itself, so that
+// small tables don't need an allocation of their own
+#define INLINE_ENTRIES_COUNT 8
+
 struct HashTableEntry {
     uintptr_t key;
     uintptr_t val;
-    struct HashTableEntry *next;
+    // the key's hash is stored so that we only compare keys with the same hash
+    // and don't have to re-hash them when resizing; 0 for unused entries
+    size_t hash;
 };
 
 // not a class so that it can be allocated with an allocator
 struct HashTable {
-    HashTableEntry **entries;
-    HashTableEntry *freeList;
+    HashTableEntry *entries;
 
     size_t nEntries;
     size_t nUsed; // total number of inserted entries
 
     // for debugging
     size_t nResizes;
-    size_t nCollisions;
+
+    HashTableEntry inlineEntries[INLINE_ENTRIES_COUNT];
 };
 
+static inline size_t HashKey(HasherComparator *hc, uintptr_t key)
+{
+    size_t hash = hc->Hash(key);
+    // 0 marks unused entries
+    return hash ? hash : 1;
+}
+
+// how far an entry is away from the position its hash maps to
+static inline size_t ProbeDistance(HashTable *h, size_t pos)
+{
+    return (pos - h->entries[pos].hash) & (h->nEntries - 1);
+}
+
 static HashTable *NewHashTable(size_t size, Allocator *allocator)
 {
     CrashIf(!allocator); // we'll leak otherwise
     HashTable *h = (HashTable*)Allocator::AllocZero(allocator, sizeof(HashTable));
     // number of hash table entries should be power of 2
-    size = RoundToPowerOf2(size);
+    size = RoundToPowerOf2(max(size, (size_t)INLINE_ENTRIES_COUNT));
     // entries are not allocated with allocator since those are large blocks
-    // and we don't want to waste their memory after 
-    h->entries = AllocArray<HashTableEntry*>(size);
+    // and we don't want to waste their memory after resizing
+    if (size > INLINE_ENTRIES_COUNT)
+        h->entries = AllocArray<HashTableEntry>(size);
+    else
+        h->entries = h->inlineEntries;
     h->nEntries = size;
     return h;
 }
 
 static void DeleteHashTable(HashTable *h)
 {
-    free(h->entries);
+    if (h->entries != h->inlineEntries)
+        free(h->entries);
     // the rest is freed by allocator
 }
 
-static void HashTableResize(HashTable *h, HasherComparator *hc)
+// This is a Robin Hood hash table: on collisions, we linearly probe for
+// a free entry but entries which are closer to the position their hash maps
+// to make room for those which are further away. This keeps probe sequences
+// short and allows lookups of missing keys to stop early.
+// returns the entry at which the key has been stored (which stays
+// valid until the next insertion or removal)
+static HashTableEntry *InsertNewEntry(HashTable *h, size_t hash, uintptr_t key, uintptr_t val)
 {
-    size_t newSize = RoundToPowerOf2(h->nEntries + 1);
-    CrashIf(newSize <= h->nEntries);
-    HashTableEntry **newEntries = AllocArray<HashTableEntry*>(newSize);
-    HashTableEntry *e, *next;
-    size_t hash, pos;
-    for (size_t i = 0; i < h->nEntries; i++) {
-        e = h->entries[i];
-        while (e) {
-            next = e->next;
-            hash = hc->Hash(e->key);
-            pos = hash % newSize;
-            e->next = newEntries[pos];
-            newEntries[pos] = e;
-            e = next;
+    size_t mask = h->nEntries - 1;
+    size_t pos = hash & mask;
+    HashTableEntry toInsert = { key, val, hash };
+    HashTableEntry *inserted = NULL;
+    for (size_t dist = 0; ; dist++, pos = (pos + 1) & mask) {
+        HashTableEntry *e = &h->entries[pos];
+        if (!e->hash) {
+            *e = toInsert;
+            return inserted ? inserted : e;
+        }
+        size_t existingDist = ProbeDistance(h, pos);
+        if (existingDist < dist) {
+            Swap(*e, toInsert);
+            if (!inserted)
+                inserted = e;
+            dist = existingDist;
         }
     }
-    free(h->entries);
-    h->entries = newEntries;
+}
+
+static void HashTableResize(HashTable *h)
+{
+    size_t newSize = h->nEntries * 2;
+    HashTableEntry *oldEntries = h->entries;
+    size_t oldSize = h->nEntries;
+    h->entries = AllocArray<HashTableEntry>(newSize);
     h->nEntries = newSize;
+    for (size_t i = 0; i < oldSize; i++) {
+        HashTableEntry *e = &oldEntries[i];
+        if (e->hash)
+            InsertNewEntry(h, e->hash, e->key, e->val);
+    }
+    if (oldEntries != h->inlineEntries)
+        free(oldEntries);
     h->nResizes += 1;
-
-    CrashIf(h->nUsed >= (h->nEntries * 3) / 2);
 }
 
 // micro optimization: this is called often, so we want this check inlined. Resizing logic
 // is called rarely, so doesn't need to be inlined
-static inline void HashTableResizeIfNeeded(HashTable *h, HasherComparator *hc)
+static inline void HashTableResizeIfNeeded(HashTable *h)
 {
-    // per http://stackoverflow.com/questions/1603712/when-should-i-do-rehashing-of-entire-hash-table/1604428#1604428
-    // when using collision chaining, load factor can be 150%
-    if (h->nUsed < (h->nEntries * 3) / 2)
+    // with open addressing, the load factor must stay well below 100%
+    if (h->nUsed + 1 <= (h->nEntries * 3) / 4)
         return;
-    HashTableResize(h, hc);
+    HashTableResize(h);
+}
+
+static HashTableEntry *FindEntry(HashTable *h, HasherComparator *hc, uintptr_t key, size_t hash)
+{
+    size_t mask = h->nEntries - 1;
+    size_t pos = hash & mask;
+    for (size_t dist = 0; ; dist++, pos = (pos + 1) & mask) {
+        HashTableEntry *e = &h->entries[pos];
+        // if the key were present, it would've displaced any entry closer to its position
+        if (!e->hash || ProbeDistance(h, pos) < dist)
+            return NULL;
+        if (e->hash == hash && hc->Equal(key, e->key))
+            return e;
+    }
 }
 
 // note: allocator must be NULL for get, non-NULL for create
 static HashTableEntry *GetOrCreateEntry(HashTable *h, HasherComparator *hc, uintptr_t key, Allocator *allocator, bool& newEntry)
 {
     bool shouldCreate = (allocator != NULL);
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry *e = h->entries[pos];
+    size_t hash = HashKey(hc, key);
     newEntry = false;
-    while (e) {
-        if (hc->Equal(key, e->key))
-            return e;
-        e = e->next;
-    }
-    if (!shouldCreate)
-        return NULL;
-
-    if (h->freeList) {
-        e = h->freeList;
-        h->freeList = h->freeList->next;
-    } else {
-        e = (HashTableEntry*)Allocator::AllocZero(allocator, sizeof(HashTableEntry));
-    }
-    e->next = h->entries[pos];
-    h->entries[pos] = e;
+    HashTableEntry *e = FindEntry(h, hc, key, hash);
+    if (e || !shouldCreate)
+        return e;
+
+    HashTableResizeIfNeeded(h);
+    e = InsertNewEntry(h, hash, key, 0);
     h->nUsed++;
-    if (e->next != NULL)
-        h->nCollisions++;
     newEntry = true;
     return e;
 }
 
 static bool RemoveEntry(HashTable *h, HasherComparator *hc, uintptr_t key, uintptr_t *removedValOut)
 {
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry *e = h->entries[pos];
-    while (e) {
-        if (hc->Equal(key, e->key))
-            break;
-        e = e->next;
-    }
+    HashTableEntry *e = FindEntry(h, hc, key, HashKey(hc, key));
     if (!e)
         return false;
+    *removedValOut = e->val;
 
-    // remove the the entry from the list
-    HashTableEntry *e2 = h->entries[pos];
-    if (e2 == e) {
-        h->entries[pos] = e->next;
-    } else {
-        while (e2->next != e) {
-            e2 = e2->next;
-        }
-        e2->next = e->next;
+    // shift the following entries back until one is at the position its
+    // hash maps to (so that no tombstones are needed)
+    size_t mask = h->nEntries - 1;
+    size_t pos = e - h->entries;
+    for (;;) {
+        size_t next = (pos + 1) & mask;
+        if (!h->entries[next].hash || 0 == ProbeDistance(h, next))
+            break;
+        h->entries[pos] = h->entries[next];
+        pos = next;
     }
-    e->next = h->freeList;
-    h->freeList = e;
-    *removedValOut = e->val;
+    ZeroMemory(&h->entries[pos], sizeof(HashTableEntry));
+
     CrashIf(0 == h->nUsed);
     h->nUsed -= 1;
     return true;
@@ -243,8 +279,6 @@ bool MapStrToInt::Insert(const char *key, int val, int *existingValOut, const ch
     e->val = (intptr_t)val;
     if (existingKeyOut)
         *existingKeyOut = (const char *)e->key;
-
-    HashTableResizeIfNeeded(h, &gStrKeyHasherComparator);
     return true;
 }
 
@@ -299,15 +333,13 @@ bool MapWStrToInt::Insert(const WCHAR *key, int val, int *prevVal)
     }
     e->key = (intptr_t)Allocator::StrDup(allocator, key);
     e->val = (intptr_t)val;
-
-    HashTableResizeIfNeeded(h, &gWStrKeyHasherComparator);
     return true;
 }
 
 bool MapWStrToInt::Remove(const WCHAR *key, int *removedValOut)
 {
     uintptr_t removedVal;
-    bool removed = RemoveEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &removedVal);
+    bool removed = RemoveEntry(h, &gWStrKeyHasherComparator, (uintptr_t)key, &removedVal);
     if (removed && removedValOut)
         *removedValOut = (int)removedVal;
     return removed;
@@ -8,14 +8,10 @@ namespace dict {
 
 struct HashTable;
 
-// we are very generous with default initial size. It's a trade-off
-// between memory used by hash table and how often we need to resize it.
-// We allocate size*sizeof(ptr) which is 64k on 32-bit for 16k entries.
-// 64k is very little on today's machines, especially for short-lived
-// hash tables.
-// Should use smaller values for long-lived hash tables, especially
-// if there are many of them.
-enum { DEFAULT_HASH_TABLE_INITIAL_SIZE = 16*1024 };
+// tables of up to this size don't need a separate allocation; the table
+// doubles in size once it's 75% full, so pass a larger initial size
+// if the final number of entries is known in advance
+enum { DEFAULT_HASH_TABLE_INITIAL_SIZE = 8 };
 
 // a dictionary whose keys are char * strings and the values are integers
 // note: StrToInt would be more natural name but it's re-#define'd in <shlwapi.h>
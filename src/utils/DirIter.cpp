@@ -5,6 +5,7 @@
 #include "DirIter.h"
 
 #include "FileUtil.h"
+#include "ThreadUtil.h"
 
 // Start directory traversal in a given dir
 bool DirIter::StartDirIter(const WCHAR *dir)
@@ -94,6 +95,98 @@ const WCHAR *DirIter::Next()
     return currPath;
 }
 
+class DirScanTask : public ThreadPoolTask {
+    ParallelDirIter *iter;
+    ScopedMem<WCHAR> dir;
+
+public:
+    DirScanTask(ParallelDirIter *iter, WCHAR *dir) : iter(iter), dir(dir) { }
+
+    virtual void Run() {
+        WStrVec files;
+        ScopedMem<WCHAR> pattern(path::Join(dir, L"*"));
+        WIN32_FIND_DATA fdata;
+        HANDLE hfind = FindFirstFile(pattern, &fdata);
+        // it's ok if we fail, this might be an auth problem,
+        // we keep going
+        if (hfind != INVALID_HANDLE_VALUE) {
+            do {
+                if ((fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                    if (iter->recursive && !IsSpecialDir(fdata.cFileName))
+                        iter->QueueDir(path::Join(dir, fdata.cFileName));
+                }
+                else if (IsRegularFile(fdata.dwFileAttributes) && iter->IsMatch(dir, fdata.cFileName)) {
+                    files.Append(path::Join(dir, fdata.cFileName));
+                }
+            } while (!WasCancelRequested() && FindNextFile(hfind, &fdata));
+            FindClose(hfind);
+        }
+        iter->DirScanned(files);
+    }
+};
+
+ParallelDirIter::ParallelDirIter() : recursive(false), tasks(NULL), pendingDirs(0)
+{
+    InitializeCriticalSection(&access);
+    hFound = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+ParallelDirIter::~ParallelDirIter()
+{
+    if (tasks) {
+        tasks->RequestCancel();
+        // waits for all running tasks to finish
+        delete tasks;
+    }
+    DeleteVecMembers(scanners);
+    CloseHandle(hFound);
+    DeleteCriticalSection(&access);
+}
+
+void ParallelDirIter::Start(const WCHAR *dir, bool recursive)
+{
+    CrashIf(tasks);
+    this->recursive = recursive;
+    tasks = new TaskGroup();
+    QueueDir(str::Dup(dir));
+}
+
+// takes ownership of dir
+void ParallelDirIter::QueueDir(WCHAR *dir)
+{
+    DirScanTask *task = new DirScanTask(this, dir);
+    {
+        ScopedCritSec scope(&access);
+        pendingDirs++;
+        scanners.Append(task);
+    }
+    tasks->Queue(task);
+}
+
+void ParallelDirIter::DirScanned(WStrVec& files)
+{
+    ScopedCritSec scope(&access);
+    while (files.Count() > 0) {
+        found.Append(files.Pop());
+    }
+    pendingDirs--;
+    if (found.Count() > 0 || 0 == pendingDirs)
+        SetEvent(hFound);
+}
+
+WCHAR *ParallelDirIter::Next()
+{
+    for (;;) {
+        EnterCriticalSection(&access);
+        WCHAR *path = found.Count() > 0 ? found.Pop() : NULL;
+        bool done = 0 == pendingDirs;
+        LeaveCriticalSection(&access);
+        if (path || done)
+            return path;
+        WaitForSingleObject(hFound, INFINITE);
+    }
+}
+
 bool CollectPathsFromDirectory(const WCHAR *pattern, WStrVec& paths, bool dirsInsteadOfFiles)
 {
     ScopedMem<WCHAR> dirPath(path::GetDir(pattern));
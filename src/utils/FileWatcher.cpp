@@ -15,41 +15,62 @@
 This code is tricky, so here's a high-level overview. More info at:
 http://qualapps.blogspot.com/2010/05/understanding-readdirectorychangesw.html
 
-We use ReadDirectoryChangesW() with overlapped i/o and i/o completion
-callback function.
-
-Callback function is called in the context of the thread that called
-ReadDirectoryChangesW() but only if it's in alertable state.
-Our ui thread isn't so we create our own thread and run code that
-calls ReadDirectoryChangesW() on that thread via QueueUserAPC().
+We use ReadDirectoryChangesW() with overlapped i/o and an i/o completion
+port which is serviced by our own thread. All directory handles are
+associated with that port (with COMPLETION_KEY_DIR_CHANGES), while requests
+for starting and stopping to monitor a directory are posted to the port
+with their own completion keys, so that all i/o is issued (and cancelled)
+on the watcher thread (CancelIo only cancels i/o issued by the calling thread).
 
 g_watchedDirs and g_watchedFiles are shared between the main thread and
 worker thread so must be protected via g_threadCritSec.
 
 ReadDirectChangesW() doesn't always work for files on network drives,
 so for those files, we do manual checks, by using a timeout to
-periodically wake up thread.
+periodically wake up thread. Files which don't change are checked less
+and less often, as are files for which checking takes long.
+
+Saving or copying a file usually results in several notifications, so
+observers are only notified once a file hasn't changed for a while
+(FILEWATCH_SETTLE_IN_MS).
+
+Directories can be watched as well (e.g. for image directories), in which
+case the observer is notified whenever a file in that directory has been
+modified, added, removed or renamed (this isn't supported on network drives).
+
+If ReadDirectoryChangesW() fails (or completes with an error), monitoring
+the directory is retried after FILEWATCH_DELAY_IN_MS. A WatchedDir is freed
+on the watcher thread once it's been stopped and no i/o is pending for it
+any more (and no request for starting to monitor it is queued).
 */
 
 /*
 TODO:
   - should I end the thread when there are no files to watch?
 
-  - a single file copy can generate multiple notifications for the same
-    file. add some delay mechanism so that subsequent change notifications
-    cancel a previous, delayed one ? E.g. a copy f2.pdf f.pdf generates 3
-    notifications if f2.pdf is 2 MB.
-
   - try to handle short file names as well: http://blogs.msdn.com/b/ericgu/archive/2005/10/07/478396.aspx
     but how to test it?
 
-  - I could try to remove the need for g_threadCritSec by queing all code
-    that touches g_watchedDirs/g_watchedFiles onto a thread via APC, but that's
+  - I could try to remove the need for g_threadCritSec by posting all code
+    that touches g_watchedDirs/g_watchedFiles to the completion port, but that's
     probably an overkill
 */
 
 // there's a balance between responsiveness to changes and efficiency
 #define FILEWATCH_DELAY_IN_MS       1000
+// files on network drives which haven't changed are checked at most this rarely
+#define FILEWATCH_MAX_DELAY_IN_MS   16000
+// observers are notified once a file hasn't changed for this long...
+#define FILEWATCH_SETTLE_IN_MS      500
+// ...but at the latest this long after the first change (for files being written continuously)
+#define FILEWATCH_MAX_SETTLE_IN_MS  5000
+
+enum {
+    COMPLETION_KEY_DIR_CHANGES,
+    COMPLETION_KEY_START_MONITORING,
+    COMPLETION_KEY_STOP_MONITORING,
+    COMPLETION_KEY_AWAKE,
+};
 
 // Some people use overlapped.hEvent to store data but I'm playing it safe.
 struct OverlappedEx {
@@ -69,6 +90,14 @@ struct WatchedDir {
     HANDLE          hDir;
     OverlappedEx    overlapped;
     char            buf[8*1024];
+    // if true, a ReadDirectoryChangesW() request hasn't completed yet
+    bool            ioPending;
+    // if true, COMPLETION_KEY_START_MONITORING has been posted for this dir
+    bool            startQueued;
+    // if true, monitoring has failed (and changes might have been missed),
+    // so it's retried at GetTickCount() nextRetry
+    bool            failed;
+    DWORD           nextRetry;
 };
 
 struct WatchedFile {
@@ -76,18 +105,28 @@ struct WatchedFile {
     WatchedDir *            watchedDir;
     const WCHAR *           filePath;
     FileChangeObserver *    observer;
+    // if true, filePath is watchedDir itself (and not a file inside it)
+    bool                    isDir;
 
     // if true, the file is on a network drive and we have
     // to check if it changed manually, by periodically checking
     // file state for changes
     bool                    isManualCheck;
     FileState               fileState;
+    // GetTickCount() of when to check next and the current interval
+    DWORD                   nextCheck;
+    DWORD                   checkInterval;
+
+    // if true, the observer will be notified once the file has settled
+    bool                    changePending;
+    // GetTickCount() of the first and the most recent pending change
+    DWORD                   firstChange, lastChange;
 };
 
 static HANDLE           g_threadHandle = 0;
 static DWORD            g_threadId = 0;
 
-static HANDLE           g_threadControlHandle = 0;
+static HANDLE           g_completionPort = 0;
 
 // protects data structures shared between ui thread and file
 // watcher thread i.e. g_watchedDirs, g_watchedFiles
@@ -100,7 +139,7 @@ static void StartMonitoringDirForChanges(WatchedDir *wd);
 
 static void AwakeWatcherThread()
 {
-    SetEvent(g_threadControlHandle);
+    PostQueuedCompletionStatus(g_completionPort, 0, COMPLETION_KEY_AWAKE, NULL);
 }
 
 static void GetFileState(const WCHAR *filePath, FileState* fs)
@@ -135,31 +174,46 @@ static bool FileStateChanged(const WCHAR *filePath, FileState *fs)
     return true;
 }
 
+// the observer is notified by NotifySettledFiles()
+static void MarkFileChanged(WatchedFile *wf)
+{
+    DWORD now = GetTickCount();
+    if (!wf->changePending)
+        wf->firstChange = now;
+    wf->lastChange = now;
+    wf->changePending = true;
+}
+
 // TODO: per internet, fileName could be short, 8.3 dos-style name
 // and we don't handle that. On the other hand, I've only seen references
 // to it wrt. to rename/delete operation, which we don't get notified about
-//
-// TODO: to collapse multiple notifications for the same file, could put it on a
-// queue, restart the thread with a timeout, restart the process if we
-// get notified again before timeout expires, call OnFileChanges() when
-// timeout expires
 static void NotifyAboutFile(WatchedDir *d, const WCHAR *fileName)
 {
     lf(L"NotifyAboutFile(): %s", fileName);
 
     for (WatchedFile *wf = g_watchedFiles; wf; wf = wf->next) {
-        if (wf->watchedDir != d)
+        if (wf->watchedDir != d || wf->isDir)
             continue;
         const WCHAR *wfFileName = path::GetBaseName(wf->filePath);
 
-        if (!str::EqI(fileName, wfFileName))
+        if (fileName && !str::EqI(fileName, wfFileName))
             continue;
 
         // NOTE: It is not recommended to check whether the timestamp has changed
         // because the time granularity is so big that this can cause genuine
         // file notifications to be ignored. (This happens for instance for
         // PDF files produced by pdftex from small.tex document)
-        wf->observer->OnFileChanged();
+        MarkFileChanged(wf);
+    }
+}
+
+static void NotifyAboutDir(WatchedDir *d)
+{
+    lf(L"NotifyAboutDir(): %s", d->dirPath);
+
+    for (WatchedFile *wf = g_watchedFiles; wf; wf = wf->next) {
+        if (wf->watchedDir == d && wf->isDir)
+            MarkFileChanged(wf);
     }
 }
 
@@ -169,7 +223,7 @@ static void DeleteWatchedDir(WatchedDir *wd)
     free(wd);
 }
 
-static void CALLBACK ReadDirectoryChangesNotification(DWORD errCode,
+static void ReadDirectoryChangesNotification(DWORD errCode,
     DWORD bytesTransfered, LPOVERLAPPED overlapped)
 {
     ScopedCritSec cs(&g_threadCritSec);
@@ -180,21 +234,36 @@ static void CALLBACK ReadDirectoryChangesNotification(DWORD errCode,
     lf(L"ReadDirectoryChangesNotification() dir: %s, numBytes: %d", wd->dirPath, (int)bytesTransfered);
 
     CrashIf(wd != wd->overlapped.data);
+    wd->ioPending = false;
 
-    if (errCode == ERROR_OPERATION_ABORTED) {
-        lf("   ERROR_OPERATION_ABORTED");
-        DeleteWatchedDir(wd);
+    // StopMonitoringDir() has been called
+    if (!wd->hDir) {
+        lf("   stopped (error %d)", (int)errCode);
+        if (!wd->startQueued)
+            DeleteWatchedDir(wd);
+        return;
+    }
+
+    if (errCode != ERROR_SUCCESS && errCode != ERROR_NOTIFY_ENUM_DIR) {
+        lf("   error %d", (int)errCode);
+        wd->failed = true;
+        wd->nextRetry = GetTickCount() + FILEWATCH_DELAY_IN_MS;
         return;
     }
 
-    // This might mean overflow? Not sure.
-    if (!bytesTransfered)
+    // the buffer overflowed, so it's unknown which files have changed
+    if (!bytesTransfered) {
+        StartMonitoringDirForChanges(wd);
+        NotifyAboutFile(wd, NULL);
+        NotifyAboutDir(wd);
         return;
+    }
 
     FILE_NOTIFY_INFORMATION *notify = (FILE_NOTIFY_INFORMATION*)wd->buf;
 
     // collect files that changed, removing duplicates
     WStrVec changedFiles;
+    bool dirChanged = false;
     for (;;) {
         WCHAR *fileName = str::DupN(notify->FileName, notify->FileNameLength / sizeof(WCHAR));
         if (notify->Action == FILE_ACTION_MODIFIED) {
@@ -208,6 +277,8 @@ static void CALLBACK ReadDirectoryChangesNotification(DWORD errCode,
         } else {
             lf(L"ReadDirectoryChangesNotification() action=%d, for '%s'", (int)notify->Action, fileName);
         }
+        // for watched directories, any change to their content counts
+        dirChanged = true;
         free(fileName);
 
         // step to the next entry if there is one
@@ -222,44 +293,104 @@ static void CALLBACK ReadDirectoryChangesNotification(DWORD errCode,
     for (WCHAR **f = changedFiles.IterStart(); f; f = changedFiles.IterNext()) {
         NotifyAboutFile(wd, *f);
     }
+    if (dirChanged)
+        NotifyAboutDir(wd);
 }
 
-static void CALLBACK StartMonitoringDirForChangesAPC(ULONG_PTR arg)
+// must be called on the watcher thread
+static void StartMonitoringDir(WatchedDir *wd)
 {
-    WatchedDir *wd = (WatchedDir*)arg;
+    ScopedCritSec cs(&g_threadCritSec);
+
+    CrashIf(g_threadId != GetCurrentThreadId());
+    wd->startQueued = false;
+
+    // StopMonitoringDir() was called while no i/o was pending
+    if (!wd->hDir) {
+        lf("StartMonitoringDir() wd=0x%p already stopped", wd);
+        if (!wd->ioPending)
+            DeleteWatchedDir(wd);
+        return;
+    }
+    if (wd->ioPending)
+        return;
+
     ZeroMemory(&wd->overlapped, sizeof(wd->overlapped));
 
     OVERLAPPED *overlapped = (OVERLAPPED*)&(wd->overlapped);
     wd->overlapped.data = (HANDLE)wd;
 
-    lf(L"StartMonitoringDirForChangesAPC() %s", wd->dirPath);
-
-    CrashIf(g_threadId != GetCurrentThreadId());
+    lf(L"StartMonitoringDir() %s", wd->dirPath);
 
-    ReadDirectoryChangesW(
+    BOOL ok = ReadDirectoryChangesW(
          wd->hDir,
          wd->buf,                           // read results buffer
          sizeof(wd->buf),                   // length of buffer
          FALSE,                             // bWatchSubtree
-         FILE_NOTIFY_CHANGE_LAST_WRITE,     // filter conditions
+         FILE_NOTIFY_CHANGE_LAST_WRITE |    // filter conditions
+         FILE_NOTIFY_CHANGE_FILE_NAME,
          NULL,                              // bytes returned
          overlapped,                        // overlapped buffer
-         ReadDirectoryChangesNotification); // completion routine
+         NULL);                             // completion routine (cf. g_completionPort)
+    if (!ok) {
+        LogLastError();
+        wd->failed = true;
+        wd->nextRetry = GetTickCount() + FILEWATCH_DELAY_IN_MS;
+        return;
+    }
+    wd->ioPending = true;
+    if (wd->failed) {
+        wd->failed = false;
+        NotifyAboutFile(wd, NULL);
+        NotifyAboutDir(wd);
+    }
 }
 
+// must be called with g_threadCritSec held
 static void StartMonitoringDirForChanges(WatchedDir *wd)
 {
-    QueueUserAPC(StartMonitoringDirForChangesAPC, g_threadHandle, (ULONG_PTR)wd);
+    wd->startQueued = true;
+    PostQueuedCompletionStatus(g_completionPort, 0, COMPLETION_KEY_START_MONITORING, (OVERLAPPED *)wd);
+}
+
+// returns how many ms it'll take until deadline (0 if it's already passed)
+static DWORD TimeUntil(DWORD deadline, DWORD now)
+{
+    int left = (int)(deadline - now);
+    return left > 0 ? (DWORD)left : 0;
 }
 
 static DWORD GetTimeoutInMs()
 {
     ScopedCritSec cs(&g_threadCritSec);
+    DWORD now = GetTickCount();
+    DWORD timeout = INFINITE;
+    for (WatchedDir *wd = g_watchedDirs; wd; wd = wd->next) {
+        if (wd->failed && !wd->startQueued)
+            timeout = min(timeout, TimeUntil(wd->nextRetry, now));
+    }
     for (WatchedFile *wf = g_watchedFiles; wf; wf = wf->next) {
         if (wf->isManualCheck)
-            return FILEWATCH_DELAY_IN_MS;
+            timeout = min(timeout, TimeUntil(wf->nextCheck, now));
+        if (wf->changePending) {
+            timeout = min(timeout, TimeUntil(wf->lastChange + FILEWATCH_SETTLE_IN_MS, now));
+            timeout = min(timeout, TimeUntil(wf->firstChange + FILEWATCH_MAX_SETTLE_IN_MS, now));
+        }
+    }
+    return timeout;
+}
+
+// re-arms directories for which monitoring has failed
+static void RetryFailedDirs()
+{
+    ScopedCritSec cs(&g_threadCritSec);
+
+    for (WatchedDir *wd = g_watchedDirs; wd; wd = wd->next) {
+        if (!wd->failed || wd->startQueued || TimeUntil(wd->nextRetry, GetTickCount()) > 0)
+            continue;
+        lf(L"RetryFailedDirs() %s", wd->dirPath);
+        StartMonitoringDirForChanges(wd);
     }
-    return INFINITE;
 }
 
 static void RunManualCheck()
@@ -267,46 +398,90 @@ static void RunManualCheck()
     ScopedCritSec cs(&g_threadCritSec);
 
     for (WatchedFile *wf = g_watchedFiles; wf; wf = wf->next) {
-        if (!wf->isManualCheck)
+        if (!wf->isManualCheck || TimeUntil(wf->nextCheck, GetTickCount()) > 0)
             continue;
+        DWORD start = GetTickCount();
         if (FileStateChanged(wf->filePath, &wf->fileState)) {
             lf(L"RunManualCheck() %s changed", wf->filePath);
-            wf->observer->OnFileChanged();
+            MarkFileChanged(wf);
+            wf->checkInterval = FILEWATCH_DELAY_IN_MS;
         }
+        else {
+            // check files less often while they don't change
+            wf->checkInterval = min(wf->checkInterval * 2, FILEWATCH_MAX_DELAY_IN_MS);
+        }
+        // don't spend more than about a tenth of the time on checking slow shares
+        DWORD now = GetTickCount();
+        wf->checkInterval = max(wf->checkInterval, min((now - start) * 10, FILEWATCH_MAX_DELAY_IN_MS));
+        wf->nextCheck = now + wf->checkInterval;
     }
 }
 
-static DWORD WINAPI FileWatcherThread(void *param)
+static void NotifySettledFiles()
 {
-    HANDLE handles[1];
-    // must be alertable to receive ReadDirectoryChangesW() callbacks and APCs
-    BOOL alertable = TRUE;
+    ScopedCritSec cs(&g_threadCritSec);
 
-    for (;;) {
-        handles[0] = g_threadControlHandle;
-        DWORD timeout = GetTimeoutInMs();
-        DWORD obj = WaitForMultipleObjectsEx(1, handles, FALSE, timeout, alertable);
-        if (WAIT_TIMEOUT == obj) {
-            RunManualCheck();
+    DWORD now = GetTickCount();
+    for (WatchedFile *wf = g_watchedFiles; wf; wf = wf->next) {
+        if (!wf->changePending)
             continue;
-        }
-
-        if (WAIT_IO_COMPLETION == obj) {
-            // APC complete. Nothing to do
-            lf("FileWatcherThread(): APC complete");
+        if (now - wf->lastChange < FILEWATCH_SETTLE_IN_MS && now - wf->firstChange < FILEWATCH_MAX_SETTLE_IN_MS)
             continue;
-        }
+        lf(L"NotifySettledFiles() %s", wf->filePath);
+        wf->changePending = false;
+        wf->observer->OnFileChanged();
+    }
+}
 
-        int n = (int)(obj - WAIT_OBJECT_0);
+// must be called on the watcher thread
+static void StopMonitoringDir(WatchedDir *wd)
+{
+    ScopedCritSec cs(&g_threadCritSec);
 
-        if (n == 0) {
-            // a thread was explicitly awaken
-            ResetEvent(g_threadControlHandle);
-            lf("FileWatcherThread(): g_threadControlHandle signalled");
-        } else {
-            dbglog::CrashLogF("FileWatcherThread(): n=%d", n);
+    lf("StopMonitoringDir() wd=0x%p", wd);
+
+    // this will cause ReadDirectoryChangesNotification() to be called
+    // with errCode = ERROR_OPERATION_ABORTED (if i/o is pending, else
+    // StartMonitoringDir() might be about to be called)
+    BOOL ok = CancelIo(wd->hDir);
+    if (!ok)
+        LogLastError();
+    SafeCloseHandle(&wd->hDir);
+    if (!wd->ioPending && !wd->startQueued)
+        DeleteWatchedDir(wd);
+}
+
+static DWORD WINAPI FileWatcherThread(void *param)
+{
+    for (;;) {
+        DWORD timeout = GetTimeoutInMs();
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED *overlapped = NULL;
+        BOOL ok = GetQueuedCompletionStatus(g_completionPort, &bytes, &key, &overlapped, timeout);
+        DWORD errCode = ok ? ERROR_SUCCESS : GetLastError();
+
+        if (!overlapped) {
+            // either timed out or a thread was explicitly awaken
+            lf("FileWatcherThread(): timeout or COMPLETION_KEY_AWAKE");
+        }
+        else if (COMPLETION_KEY_DIR_CHANGES == key) {
+            ReadDirectoryChangesNotification(errCode, bytes, overlapped);
+        }
+        else if (COMPLETION_KEY_START_MONITORING == key) {
+            StartMonitoringDir((WatchedDir *)overlapped);
+        }
+        else if (COMPLETION_KEY_STOP_MONITORING == key) {
+            StopMonitoringDir((WatchedDir *)overlapped);
+        }
+        else {
+            dbglog::CrashLogF("FileWatcherThread(): key=%d", (int)key);
             CrashIf(true);
         }
+
+        RetryFailedDirs();
+        RunManualCheck();
+        NotifySettledFiles();
     }
 }
 
@@ -316,7 +491,7 @@ static void StartThreadIfNecessary()
         return;
 
     InitializeCriticalSection(&g_threadCritSec);
-    g_threadControlHandle = CreateEvent(NULL, TRUE, FALSE, NULL);
+    g_completionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
 
     g_threadHandle = CreateThread(NULL, 0, FileWatcherThread, 0, 0, &g_threadId);
     SetThreadName(g_threadId, "FileWatcherThread");
@@ -332,19 +507,6 @@ static WatchedDir *FindExistingWatchedDir(const WCHAR *dirPath)
     return NULL;
 }
 
-static void CALLBACK StopMonitoringDirAPC(ULONG_PTR arg)
-{
-    WatchedDir *wd = (WatchedDir*)arg;
-    lf("StopMonitoringDirAPC() wd=0x%p", wd);
-
-    // this will cause ReadDirectoryChangesNotification() to be called
-    // with errCode = ERROR_OPERATION_ABORTED
-    BOOL ok = CancelIo(wd->hDir);
-    if (!ok)
-        LogLastError();
-    SafeCloseHandle(&wd->hDir);
-}
-
 static WatchedDir *NewWatchedDir(const WCHAR *dirPath)
 {
     HANDLE hDir = CreateFile(
@@ -354,6 +516,10 @@ static WatchedDir *NewWatchedDir(const WCHAR *dirPath)
         FILE_FLAG_BACKUP_SEMANTICS  | FILE_FLAG_OVERLAPPED, NULL);
     if (INVALID_HANDLE_VALUE == hDir)
         return NULL;
+    if (!CreateIoCompletionPort(hDir, g_completionPort, COMPLETION_KEY_DIR_CHANGES, 0)) {
+        CloseHandle(hDir);
+        return NULL;
+    }
 
     WatchedDir *wd = AllocStruct<WatchedDir>();
     wd->hDir = hDir;
@@ -366,15 +532,22 @@ static WatchedDir *NewWatchedDir(const WCHAR *dirPath)
 static WatchedFile *NewWatchedFile(const WCHAR *filePath, FileChangeObserver *observer)
 {
     bool isManualCheck = PathIsNetworkPath(filePath);
-    ScopedMem<WCHAR> dirPath(path::GetDir(filePath));
+    bool isDir = dir::Exists(filePath);
+    if (isDir && isManualCheck) {
+        delete observer;
+        return NULL;
+    }
+    ScopedMem<WCHAR> dirPath(isDir ? str::Dup(filePath) : path::GetDir(filePath));
     WatchedDir *wd = NULL;
     bool newDir = false;
     if (!isManualCheck) {
         wd = FindExistingWatchedDir(dirPath);
         if (!wd) {
             wd = NewWatchedDir(dirPath);
-            if (!wd)
+            if (!wd) {
+                delete observer;
                 return NULL;
+            }
             newDir = true;
         }
     }
@@ -383,12 +556,15 @@ static WatchedFile *NewWatchedFile(const WCHAR *filePath, FileChangeObserver *ob
     wf->filePath = str::Dup(filePath);
     wf->observer = observer;
     wf->watchedDir = wd;
+    wf->isDir = isDir;
     wf->isManualCheck = isManualCheck;
 
     ListInsert(&g_watchedFiles, wf);
 
     if (wf->isManualCheck) {
         GetFileState(filePath, &wf->fileState);
+        wf->checkInterval = FILEWATCH_DELAY_IN_MS;
+        wf->nextCheck = GetTickCount() + wf->checkInterval;
         AwakeWatcherThread();
     } else {
         if (newDir)
@@ -406,7 +582,8 @@ static void DeleteWatchedFile(WatchedFile *wf)
 }
 
 /* Subscribe for notifications about file changes. When a file changes, we'll
-call observer->OnFileChanged().
+call observer->OnFileChanged(). If path is a directory, we'll call it when
+any file inside it changes.
 
 We take ownership of observer object.
 
@@ -419,7 +596,7 @@ WatchedFile *FileWatcherSubscribe(const WCHAR *path, FileChangeObserver *observe
 
     lf(L"FileWatcherSubscribe() path: %s", path);
 
-    if (!file::Exists(path)) {
+    if (!file::Exists(path) && !dir::Exists(path)) {
         delete observer;
         return NULL;
     }
@@ -447,7 +624,7 @@ static void RemoveWatchedDirIfNotReferenced(WatchedDir *wd)
     bool ok = ListRemove(&g_watchedDirs, wd);
     CrashIf(!ok);
     // memory will be eventually freed in ReadDirectoryChangesNotification()
-    QueueUserAPC(StopMonitoringDirAPC, g_threadHandle, (ULONG_PTR)wd);
+    PostQueuedCompletionStatus(g_completionPort, 0, COMPLETION_KEY_STOP_MONITORING, (OVERLAPPED *)wd);
 }
 
 static void RemoveWatchedFile(WatchedFile *wf)
@@ -250,7 +250,8 @@ void GetBaseTransform(Matrix& m, RectF pageRect, float zoom, int rotation)
     m.Rotate((REAL)rotation, MatrixOrderAppend);
 }
 
-static Bitmap *WICDecodeImageFromStream(IStream *stream)
+// if size isn't empty, the image is scaled down to that size while decoding
+static Bitmap *WICDecodeImageFromStream(IStream *stream, Size size=Size())
 {
     ScopedCom com;
 
@@ -262,9 +263,16 @@ static Bitmap *WICDecodeImageFromStream(IStream *stream)
                                          &pDecoder));
     ScopedComPtr<IWICBitmapFrameDecode> srcFrame;
     HR(pDecoder->GetFrame(0, &srcFrame));
+    IWICBitmapSource *source = srcFrame;
+    ScopedComPtr<IWICBitmapScaler> pScaler;
+    if (size.Width > 0 && size.Height > 0) {
+        HR(pFactory->CreateBitmapScaler(&pScaler));
+        HR(pScaler->Initialize(srcFrame, size.Width, size.Height, WICBitmapInterpolationModeFant));
+        source = pScaler;
+    }
     ScopedComPtr<IWICFormatConverter> pConverter;
     HR(pFactory->CreateFormatConverter(&pConverter));
-    HR(pConverter->Initialize(srcFrame, GUID_WICPixelFormat32bppBGRA,
+    HR(pConverter->Initialize(source, GUID_WICPixelFormat32bppBGRA,
                               WICBitmapDitherTypeNone, NULL, 0.f, WICBitmapPaletteTypeCustom));
 
     UINT w, h;
@@ -368,6 +376,23 @@ Bitmap *BitmapFromData(const char *data, size_t len)
     return bmp;
 }
 
+// decodes the image at size (which should have the image's aspect ratio) instead of
+// at its original size, which needs considerably less memory for large images;
+// returns NULL for formats not supported by WIC
+Bitmap *ScaledBitmapFromData(const char *data, size_t len, Size size)
+{
+    ImgFormat format = GfxFormatFromData(data, len);
+    if (Img_Unknown == format || Img_TGA == format || Img_WebP == format)
+        return NULL;
+    if (size.Width <= 0 || size.Height <= 0)
+        return NULL;
+
+    ScopedComPtr<IStream> stream(CreateStreamFromData(data, len));
+    if (!stream)
+        return NULL;
+    return WICDecodeImageFromStream(stream, size);
+}
+
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
 Size BitmapSizeFromData(const char *data, size_t len)
 {
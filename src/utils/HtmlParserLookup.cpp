@@ -6,160 +6,170 @@
 #include "BaseUtil.h"
 #include "HtmlParserLookup.h"
 
-#define CS1(c1)             (c1)
-#define CS2(c1, c2)         (CS1(c1) | (c2 << 8))
-#define CS3(c1, c2, c3)     (CS2(c1, c2) | (c3 << 16))
-#define CS4(c1, c2, c3, c4) (CS3(c1, c2, c3) | (c4 << 24))
+#define lower(c) ((c) < 'A' || (c) > 'Z' ? (c) : (c) - 'A' + 'a')
 
-#define STR1(s) ((s)[0])
-#define STR2(s) (STR1(s) | ((s)[1] << 8))
-#define STR3(s) (STR2(s) | ((s)[2] << 16))
-#define STR4(s) (STR3(s) | ((s)[3] << 24))
+// the key combines the length with the first, second, middle,
+// second to last and last character (len must be at least 2)
+#define KEY_STEP(key, c) ((key) * 31 + (uint8_t)(c))
+#define KEY(s, len) KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP((uint32_t)(len), \
+    (s)[0]), (s)[1]), (s)[(len) / 2]), (s)[(len) - 2]), (s)[(len) - 1])
+#define KEYi(s, len) KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP((uint32_t)(len), \
+    lower((s)[0])), lower((s)[1])), lower((s)[(len) / 2])), lower((s)[(len) - 2])), lower((s)[(len) - 1]))
+#define KEY1(s) KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(1, (s)[0]), (s)[0]), (s)[0]), (s)[0]), (s)[0])
+#define KEY1i(s) KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(KEY_STEP(1, lower((s)[0])), lower((s)[0])), \
+    lower((s)[0])), lower((s)[0])), lower((s)[0]))
 
-#define lower(c) ((c) < 'A' || (c) > 'Z' ? (c) : (c) - 'A' + 'a')
+// returns the top bits of a multiplicative hash of key and seed
+#define SLOT(key, seed, bits) ((((key) ^ (seed)) * 0x9E3779B1) >> (32 - (bits)))
 
-#define STR1i(s) (lower((s)[0]))
-#define STR2i(s) (STR1i(s) | (lower((s)[1]) << 8))
-#define STR3i(s) (STR2i(s) | (lower((s)[2]) << 16))
-#define STR4i(s) (STR3i(s) | (lower((s)[3]) << 24))
+static const uint16_t gHtmlTagDisp[32] = {
+    2, 3, 2, 6, 1, 2, 3, 1, 0, 1, 4, 2, 1, 2, 1, 0,
+    2, 1, 4, 2, 1, 0, 0, 2, 1, 6, 4, 1, 5, 1, 0, 4
+};
+
+static const struct {
+    const char *name;
+    size_t len;
+    HtmlTag value;
+} gHtmlTagTable[128] = {
+    { "", 0, Tag_NotFound },
+    { "svg", 3, Tag_Svg },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "h3", 2, Tag_H3 },
+    { "br", 2, Tag_Br },
+    { "small", 5, Tag_Small },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "p", 1, Tag_P },
+    { "", 0, Tag_NotFound },
+    { "font", 4, Tag_Font },
+    { "image", 5, Tag_Image },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "h5", 2, Tag_H5 },
+    { "", 0, Tag_NotFound },
+    { "pre", 3, Tag_Pre },
+    { "h1", 2, Tag_H1 },
+    { "style", 5, Tag_Style },
+    { "s", 1, Tag_S },
+    { "dt", 2, Tag_Dt },
+    { "td", 2, Tag_Td },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "b", 1, Tag_B },
+    { "", 0, Tag_NotFound },
+    { "tr", 2, Tag_Tr },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "tt", 2, Tag_Tt },
+    { "title", 5, Tag_Title },
+    { "", 0, Tag_NotFound },
+    { "basefont", 8, Tag_Basefont },
+    { "section", 7, Tag_Section },
+    { "", 0, Tag_NotFound },
+    { "link", 4, Tag_Link },
+    { "video", 5, Tag_Video },
+    { "", 0, Tag_NotFound },
+    { "lh", 2, Tag_Lh },
+    { "strike", 6, Tag_Strike },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "h6", 2, Tag_H6 },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "h2", 2, Tag_H2 },
+    { "dd", 2, Tag_Dd },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "h4", 2, Tag_H4 },
+    { "param", 5, Tag_Param },
+    { "audio", 5, Tag_Audio },
+    { "", 0, Tag_NotFound },
+    { "ol", 2, Tag_Ol },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "head", 4, Tag_Head },
+    { "strong", 6, Tag_Strong },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "em", 2, Tag_Em },
+    { "frame", 5, Tag_Frame },
+    { "a", 1, Tag_A },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "div", 3, Tag_Div },
+    { "", 0, Tag_NotFound },
+    { "table", 5, Tag_Table },
+    { "", 0, Tag_NotFound },
+    { "abbr", 4, Tag_Abbr },
+    { "li", 2, Tag_Li },
+    { "", 0, Tag_NotFound },
+    { "sup", 3, Tag_Sup },
+    { "", 0, Tag_NotFound },
+    { "u", 1, Tag_U },
+    { "meta", 4, Tag_Meta },
+    { "", 0, Tag_NotFound },
+    { "col", 3, Tag_Col },
+    { "span", 4, Tag_Span },
+    { "code", 4, Tag_Code },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "subtitle", 8, Tag_Subtitle },
+    { "img", 3, Tag_Img },
+    { "html", 4, Tag_Html },
+    { "ul", 2, Tag_Ul },
+    { "", 0, Tag_NotFound },
+    { "blockquote", 10, Tag_Blockquote },
+    { "th", 2, Tag_Th },
+    { "i", 1, Tag_I },
+    { "nav", 3, Tag_Nav },
+    { "mbp:pagebreak", 13, Tag_Mbp_Pagebreak },
+    { "", 0, Tag_NotFound },
+    { "script", 6, Tag_Script },
+    { "sub", 3, Tag_Sub },
+    { "", 0, Tag_NotFound },
+    { "dl", 2, Tag_Dl },
+    { "", 0, Tag_NotFound },
+    { "object", 6, Tag_Object },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "input", 5, Tag_Input },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "body", 4, Tag_Body },
+    { "center", 6, Tag_Center },
+    { "pagebreak", 9, Tag_Pagebreak },
+    { "", 0, Tag_NotFound },
+    { "", 0, Tag_NotFound },
+    { "hr", 2, Tag_Hr },
+    { "", 0, Tag_NotFound },
+    { "acronym", 7, Tag_Acronym },
+    { "area", 4, Tag_Area },
+    { "", 0, Tag_NotFound },
+    { "base", 4, Tag_Base },
+};
 
 HtmlTag FindHtmlTag(const char *name, size_t len)
 {
-    uint32_t key = 0 == len ? 0 : 1 == len ? STR1i(name) :
-                   2 == len ? STR2i(name) : 3 == len ? STR3i(name) : STR4i(name);
-    switch (key) {
-    case CS1('a'): return Tag_A;
-    case CS4('a','b','b','r'):
-        if (4 == len) return Tag_Abbr;
-        break;
-    case CS4('a','c','r','o'):
-        if (7 == len && CS3('n','y','m') == STR3i(name + 4)) return Tag_Acronym;
-        break;
-    case CS4('a','r','e','a'):
-        if (4 == len) return Tag_Area;
-        break;
-    case CS4('a','u','d','i'):
-        if (5 == len && CS1('o') == STR1i(name + 4)) return Tag_Audio;
-        break;
-    case CS1('b'): return Tag_B;
-    case CS4('b','a','s','e'):
-        if (4 == len) return Tag_Base;
-        if (8 == len && CS4('f','o','n','t') == STR4i(name + 4)) return Tag_Basefont;
-        break;
-    case CS4('b','l','o','c'):
-        if (10 == len && str::EqNI(name + 4, "kquote", 6)) return Tag_Blockquote;
-        break;
-    case CS4('b','o','d','y'):
-        if (4 == len) return Tag_Body;
-        break;
-    case CS2('b','r'): return Tag_Br;
-    case CS4('c','e','n','t'):
-        if (6 == len && CS2('e','r') == STR2i(name + 4)) return Tag_Center;
-        break;
-    case CS4('c','o','d','e'):
-        if (4 == len) return Tag_Code;
-        break;
-    case CS3('c','o','l'): return Tag_Col;
-    case CS2('d','d'): return Tag_Dd;
-    case CS3('d','i','v'): return Tag_Div;
-    case CS2('d','l'): return Tag_Dl;
-    case CS2('d','t'): return Tag_Dt;
-    case CS2('e','m'): return Tag_Em;
-    case CS4('f','o','n','t'):
-        if (4 == len) return Tag_Font;
-        break;
-    case CS4('f','r','a','m'):
-        if (5 == len && CS1('e') == STR1i(name + 4)) return Tag_Frame;
-        break;
-    case CS2('h','1'): return Tag_H1;
-    case CS2('h','2'): return Tag_H2;
-    case CS2('h','3'): return Tag_H3;
-    case CS2('h','4'): return Tag_H4;
-    case CS2('h','5'): return Tag_H5;
-    case CS2('h','6'): return Tag_H6;
-    case CS4('h','e','a','d'):
-        if (4 == len) return Tag_Head;
-        break;
-    case CS2('h','r'): return Tag_Hr;
-    case CS4('h','t','m','l'):
-        if (4 == len) return Tag_Html;
-        break;
-    case CS1('i'): return Tag_I;
-    case CS4('i','m','a','g'):
-        if (5 == len && CS1('e') == STR1i(name + 4)) return Tag_Image;
-        break;
-    case CS3('i','m','g'): return Tag_Img;
-    case CS4('i','n','p','u'):
-        if (5 == len && CS1('t') == STR1i(name + 4)) return Tag_Input;
-        break;
-    case CS2('l','h'): return Tag_Lh;
-    case CS2('l','i'): return Tag_Li;
-    case CS4('l','i','n','k'):
-        if (4 == len) return Tag_Link;
-        break;
-    case CS4('m','b','p',':'):
-        if (13 == len && str::EqNI(name + 4, "pagebreak", 9)) return Tag_Mbp_Pagebreak;
-        break;
-    case CS4('m','e','t','a'):
-        if (4 == len) return Tag_Meta;
-        break;
-    case CS3('n','a','v'): return Tag_Nav;
-    case CS4('o','b','j','e'):
-        if (6 == len && CS2('c','t') == STR2i(name + 4)) return Tag_Object;
-        break;
-    case CS2('o','l'): return Tag_Ol;
-    case CS1('p'): return Tag_P;
-    case CS4('p','a','g','e'):
-        if (9 == len && str::EqNI(name + 4, "break", 5)) return Tag_Pagebreak;
-        break;
-    case CS4('p','a','r','a'):
-        if (5 == len && CS1('m') == STR1i(name + 4)) return Tag_Param;
-        break;
-    case CS3('p','r','e'): return Tag_Pre;
-    case CS1('s'): return Tag_S;
-    case CS4('s','c','r','i'):
-        if (6 == len && CS2('p','t') == STR2i(name + 4)) return Tag_Script;
-        break;
-    case CS4('s','e','c','t'):
-        if (7 == len && CS3('i','o','n') == STR3i(name + 4)) return Tag_Section;
-        break;
-    case CS4('s','m','a','l'):
-        if (5 == len && CS1('l') == STR1i(name + 4)) return Tag_Small;
-        break;
-    case CS4('s','p','a','n'):
-        if (4 == len) return Tag_Span;
-        break;
-    case CS4('s','t','r','i'):
-        if (6 == len && CS2('k','e') == STR2i(name + 4)) return Tag_Strike;
-        break;
-    case CS4('s','t','r','o'):
-        if (6 == len && CS2('n','g') == STR2i(name + 4)) return Tag_Strong;
-        break;
-    case CS4('s','t','y','l'):
-        if (5 == len && CS1('e') == STR1i(name + 4)) return Tag_Style;
-        break;
-    case CS3('s','u','b'): return Tag_Sub;
-    case CS4('s','u','b','t'):
-        if (8 == len && CS4('i','t','l','e') == STR4i(name + 4)) return Tag_Subtitle;
-        break;
-    case CS3('s','u','p'): return Tag_Sup;
-    case CS3('s','v','g'): return Tag_Svg;
-    case CS4('t','a','b','l'):
-        if (5 == len && CS1('e') == STR1i(name + 4)) return Tag_Table;
-        break;
-    case CS2('t','d'): return Tag_Td;
-    case CS2('t','h'): return Tag_Th;
-    case CS4('t','i','t','l'):
-        if (5 == len && CS1('e') == STR1i(name + 4)) return Tag_Title;
-        break;
-    case CS2('t','r'): return Tag_Tr;
-    case CS2('t','t'): return Tag_Tt;
-    case CS1('u'): return Tag_U;
-    case CS2('u','l'): return Tag_Ul;
-    case CS4('v','i','d','e'):
-        if (5 == len && CS1('o') == STR1i(name + 4)) return Tag_Video;
-        break;
-    }
+    if (0 == len)
+        return Tag_NotFound;
+    uint32_t key = 1 == len ? KEY1i(name) : KEYi(name, len);
+    uint32_t slot = SLOT(key, gHtmlTagDisp[SLOT(key, 0, 5)], 7);
+    if (len == gHtmlTagTable[slot].len && str::EqNI(gHtmlTagTable[slot].name, name, len))
+        return gHtmlTagTable[slot].value;
     return Tag_NotFound;
 }
 
@@ -190,24 +200,29 @@ bool IsInlineTag(HtmlTag item)
     }
 }
 
+static const uint16_t gAlignAttrDisp[2] = {
+    0, 10
+};
+
+static const struct {
+    const char *name;
+    size_t len;
+    AlignAttr value;
+} gAlignAttrTable[4] = {
+    { "left", 4, Align_Left },
+    { "right", 5, Align_Right },
+    { "justify", 7, Align_Justify },
+    { "center", 6, Align_Center },
+};
+
 AlignAttr FindAlignAttr(const char *name, size_t len)
 {
-    uint32_t key = 0 == len ? 0 : 1 == len ? STR1i(name) :
-                   2 == len ? STR2i(name) : 3 == len ? STR3i(name) : STR4i(name);
-    switch (key) {
-    case CS4('c','e','n','t'):
-        if (6 == len && CS2('e','r') == STR2i(name + 4)) return Align_Center;
-        break;
-    case CS4('j','u','s','t'):
-        if (7 == len && CS3('i','f','y') == STR3i(name + 4)) return Align_Justify;
-        break;
-    case CS4('l','e','f','t'):
-        if (4 == len) return Align_Left;
-        break;
-    case CS4('r','i','g','h'):
-        if (5 == len && CS1('t') == STR1i(name + 4)) return Align_Right;
-        break;
-    }
+    if (0 == len)
+        return Align_NotFound;
+    uint32_t key = 1 == len ? KEY1i(name) : KEYi(name, len);
+    uint32_t slot = SLOT(key, gAlignAttrDisp[SLOT(key, 0, 1)], 2);
+    if (len == gAlignAttrTable[slot].len && str::EqNI(gAlignAttrTable[slot].name, name, len))
+        return gAlignAttrTable[slot].value;
     return Align_NotFound;
 }
 
@@ -215,1131 +230,597 @@ AlignAttr FindAlignAttr(const char *name, size_t len)
 // http://en.wikipedia.org/wiki/List_of_XML_and_HTML_character_entity_references
 // and http://www.w3.org/TR/MathML2/bycodes.html
 
+static const uint16_t gHtmlEntityRuneDisp[128] = {
+    9, 3, 24, 0, 2, 20, 19, 0, 9, 6, 3, 8, 8, 1, 3, 11,
+    3, 11, 11, 34, 12, 1, 0, 16, 14, 17, 5, 0, 10, 7, 5, 19,
+    16, 0, 3, 3, 4, 0, 6, 7, 15, 26, 3, 3, 1, 1, 4, 3,
+    1, 3, 8, 7, 20, 1, 15, 2, 10, 56, 3, 8, 4, 4, 0, 0,
+    7, 15, 1, 15, 2, 7, 7, 1, 3, 34, 13, 3, 71, 30, 9, 23,
+    9, 3, 2, 3, 2, 2, 25, 10, 19, 3, 4, 23, 4, 9, 21, 10,
+    4, 24, 14, 3, 1, 6, 8, 6, 10, 4, 12, 13, 26, 2, 1, 2,
+    13, 18, 9, 10, 1, 6, 22, 17, 3, 5, 10, 3, 15, 11, 39, 3
+};
+
+static const struct {
+    const char *name;
+    size_t len;
+    uint32_t value;
+} gHtmlEntityRuneTable[512] = {
+    { "mdash", 5, 8212 },
+    { "spades", 6, 9824 },
+    { "", 0, (uint32_t)-1 },
+    { "emsp", 4, 8195 },
+    { "diams", 5, 9830 },
+    { "Yuml", 4, 376 },
+    { "int", 3, 8747 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "cup", 3, 8746 },
+    { "lsaquo", 6, 8249 },
+    { "Ccaron", 6, 268 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "varrho", 6, 1009 },
+    { "uuml", 4, 252 },
+    { "Hacek", 5, 711 },
+    { "Euml", 4, 203 },
+    { "", 0, (uint32_t)-1 },
+    { "tcedil", 6, 355 },
+    { "Nacute", 6, 323 },
+    { "", 0, (uint32_t)-1 },
+    { "Eta", 3, 919 },
+    { "Zcaron", 6, 381 },
+    { "sbquo", 5, 8218 },
+    { "", 0, (uint32_t)-1 },
+    { "ouml", 4, 246 },
+    { "odblac", 6, 337 },
+    { "scedil", 6, 351 },
+    { "Lstrok", 6, 321 },
+    { "", 0, (uint32_t)-1 },
+    { "radic", 5, 8730 },
+    { "hArr", 4, 8660 },
+    { "Racute", 6, 340 },
+    { "trade", 5, 8482 },
+    { "pound", 5, 163 },
+    { "", 0, (uint32_t)-1 },
+    { "Ccedil", 6, 199 },
+    { "ordm", 4, 186 },
+    { "ocirc", 5, 244 },
+    { "tau", 3, 964 },
+    { "", 0, (uint32_t)-1 },
+    { "Beta", 4, 914 },
+    { "Ouml", 4, 214 },
+    { "Emacr", 5, 274 },
+    { "Iogon", 5, 302 },
+    { "psi", 3, 968 },
+    { "itilde", 6, 297 },
+    { "Edot", 4, 278 },
+    { "straightepsilon", 15, 1013 },
+    { "", 0, (uint32_t)-1 },
+    { "ENG", 3, 330 },
+    { "oacute", 6, 243 },
+    { "image", 5, 8465 },
+    { "rfloor", 6, 8971 },
+    { "ring", 4, 730 },
+    { "Tcaron", 6, 356 },
+    { "straightphi", 11, 981 },
+    { "Tau", 3, 932 },
+    { "cdot", 4, 267 },
+    { "piv", 3, 982 },
+    { "imacr", 5, 299 },
+    { "Egrave", 6, 200 },
+    { "oplus", 5, 8853 },
+    { "euml", 4, 235 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "Imacr", 5, 298 },
+    { "varphi", 6, 966 },
+    { "sigmaf", 6, 962 },
+    { "oelig", 5, 339 },
+    { "cedil", 5, 184 },
+    { "fnof", 4, 402 },
+    { "ang", 3, 8736 },
+    { "kappa", 5, 954 },
+    { "DoubleDot", 9, 168 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "ge", 2, 8805 },
+    { "ccaron", 6, 269 },
+    { "thorn", 5, 254 },
+    { "delta", 5, 948 },
+    { "mu", 2, 956 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "eacute", 6, 233 },
+    { "", 0, (uint32_t)-1 },
+    { "abreve", 6, 259 },
+    { "zdot", 4, 380 },
+    { "Omega", 5, 937 },
+    { "Kappa", 5, 922 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "Uogon", 5, 370 },
+    { "", 0, (uint32_t)-1 },
+    { "sub", 3, 8834 },
+    { "prime", 5, 8242 },
+    { "ncedil", 6, 326 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "digamma", 7, 989 },
+    { "ogon", 4, 731 },
+    { "cong", 4, 8773 },
+    { "times", 5, 215 },
+    { "shy", 3, 173 },
+    { "Zdot", 4, 379 },
+    { "Breve", 5, 728 },
+    { "eta", 3, 951 },
+    { "Pi", 2, 928 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "lacute", 6, 314 },
+    { "cacute", 6, 263 },
+    { "part", 4, 8706 },
+    { "OElig", 5, 338 },
+    { "varpi", 5, 982 },
+    { "Mu", 2, 924 },
+    { "Idot", 4, 304 },
+    { "", 0, (uint32_t)-1 },
+    { "Omacr", 5, 332 },
+    { "permil", 6, 8240 },
+    { "Cdot", 4, 266 },
+    { "ordf", 4, 170 },
+    { "lcaron", 6, 318 },
+    { "Gamma", 5, 915 },
+    { "", 0, (uint32_t)-1 },
+    { "DownBreve", 9, 785 },
+    { "brvbar", 6, 166 },
+    { "weierp", 6, 8472 },
+    { "", 0, (uint32_t)-1 },
+    { "Prime", 5, 8243 },
+    { "ycirc", 5, 375 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "Scedil", 6, 350 },
+    { "Ograve", 6, 210 },
+    { "crarr", 5, 8629 },
+    { "Iuml", 4, 207 },
+    { "there4", 6, 8756 },
+    { "Ncaron", 6, 327 },
+    { "szlig", 5, 223 },
+    { "sup", 3, 8835 },
+    { "Psi", 3, 936 },
+    { "", 0, (uint32_t)-1 },
+    { "racute", 6, 341 },
+    { "Cacute", 6, 262 },
+    { "", 0, (uint32_t)-1 },
+    { "Hcirc", 5, 292 },
+    { "varepsilon", 10, 949 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "middot", 6, 183 },
+    { "rsaquo", 6, 8250 },
+    { "jcirc", 5, 309 },
+    { "imped", 5, 437 },
+    { "", 0, (uint32_t)-1 },
+    { "sdot", 4, 8901 },
+    { "Eacute", 6, 201 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "otilde", 6, 245 },
+    { "uArr", 4, 8657 },
+    { "gamma", 5, 947 },
+    { "", 0, (uint32_t)-1 },
+    { "laquo", 5, 171 },
+    { "clubs", 5, 9827 },
+    { "utilde", 6, 361 },
+    { "aogon", 5, 261 },
+    { "theta", 5, 952 },
+    { "", 0, (uint32_t)-1 },
+    { "or", 2, 8744 },
+    { "", 0, (uint32_t)-1 },
+    { "Tcedil", 6, 354 },
+    { "rceil", 5, 8969 },
+    { "upsih", 5, 978 },
+    { "cent", 4, 162 },
+    { "Ncedil", 6, 325 },
+    { "backepsilon", 11, 1014 },
+    { "Hstrok", 6, 294 },
+    { "sect", 4, 167 },
+    { "zacute", 6, 378 },
+    { "zcaron", 6, 382 },
+    { "not", 3, 172 },
+    { "Scaron", 6, 352 },
+    { "omega", 5, 969 },
+    { "sube", 4, 8838 },
+    { "tilde", 5, 732 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "Upsilon", 7, 933 },
+    { "gt", 2, 62 },
+    { "macr", 4, 175 },
+    { "Atilde", 6, 195 },
+    { "Ubreve", 6, 364 },
+    { "Aring", 5, 197 },
+    { "ne", 2, 8800 },
+    { "iquest", 6, 191 },
+    { "", 0, (uint32_t)-1 },
+    { "nu", 2, 957 },
+    { "ETH", 3, 208 },
+    { "", 0, (uint32_t)-1 },
+    { "quot", 4, 34 },
+    { "", 0, (uint32_t)-1 },
+    { "Igrave", 6, 204 },
+    { "Scirc", 5, 348 },
+    { "iuml", 4, 239 },
+    { "Acirc", 5, 194 },
+    { "icirc", 5, 238 },
+    { "Gbreve", 6, 286 },
+    { "ecaron", 6, 283 },
+    { "zwj", 3, 8205 },
+    { "", 0, (uint32_t)-1 },
+    { "rlm", 3, 8207 },
+    { "ni", 2, 8715 },
+    { "iogon", 5, 303 },
+    { "micro", 5, 181 },
+    { "raquo", 5, 187 },
+    { "edot", 4, 279 },
+    { "gdot", 4, 289 },
+    { "", 0, (uint32_t)-1 },
+    { "aacute", 6, 225 },
+    { "para", 4, 182 },
+    { "", 0, (uint32_t)-1 },
+    { "aring", 5, 229 },
+    { "plusmn", 6, 177 },
+    { "ncaron", 6, 328 },
+    { "prop", 4, 8733 },
+    { "sum", 3, 8721 },
+    { "beta", 4, 946 },
+    { "nsub", 4, 8836 },
+    { "emacr", 5, 275 },
+    { "bdquo", 5, 8222 },
+    { "", 0, (uint32_t)-1 },
+    { "ldquo", 5, 8220 },
+    { "", 0, (uint32_t)-1 },
+    { "infin", 5, 8734 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "Epsilon", 7, 917 },
+    { "frasl", 5, 8260 },
+    { "ensp", 4, 8194 },
+    { "supe", 4, 8839 },
+    { "hearts", 6, 9829 },
+    { "", 0, (uint32_t)-1 },
+    { "copy", 4, 169 },
+    { "sup1", 4, 185 },
+    { "acirc", 5, 226 },
+    { "Ecirc", 5, 202 },
+    { "Kcedil", 6, 310 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "Oacute", 6, 211 },
+    { "otimes", 6, 8855 },
+    { "acute", 5, 180 },
+    { "", 0, (uint32_t)-1 },
+    { "tstrok", 6, 359 },
+    { "nabla", 5, 8711 },
+    { "", 0, (uint32_t)-1 },
+    { "dstrok", 6, 273 },
+    { "circ", 4, 710 },
+    { "UnderBar", 8, 818 },
+    { "Udblac", 6, 368 },
+    { "ugrave", 6, 249 },
+    { "yacute", 6, 253 },
+    { "dcaron", 6, 271 },
+    { "Phi", 3, 934 },
+    { "curren", 6, 164 },
+    { "isin", 4, 8712 },
+    { "", 0, (uint32_t)-1 },
+    { "Yacute", 6, 221 },
+    { "Gdot", 4, 288 },
+    { "Xi", 2, 926 },
+    { "gacute", 6, 501 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "frac12", 6, 189 },
+    { "gbreve", 6, 287 },
+    { "", 0, (uint32_t)-1 },
+    { "omacr", 5, 333 },
+    { "rarr", 4, 8594 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "minus", 5, 8722 },
+    { "lmidot", 6, 320 },
+    { "euro", 4, 8364 },
+    { "Sacute", 6, 346 },
+    { "uacute", 6, 250 },
+    { "ndash", 5, 8211 },
+    { "Agrave", 6, 192 },
+    { "", 0, (uint32_t)-1 },
+    { "auml", 4, 228 },
+    { "sup2", 4, 178 },
+    { "deg", 3, 176 },
+    { "", 0, (uint32_t)-1 },
+    { "AElig", 5, 198 },
+    { "ograve", 6, 242 },
+    { "lt", 2, 60 },
+    { "lfloor", 6, 8970 },
+    { "Dcaron", 6, 270 },
+    { "lceil", 5, 8968 },
+    { "zwnj", 4, 8204 },
+    { "Ocirc", 5, 212 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "harr", 4, 8596 },
+    { "iota", 4, 953 },
+    { "Umacr", 5, 362 },
+    { "loz", 3, 9674 },
+    { "notin", 5, 8713 },
+    { "Chi", 3, 935 },
+    { "OverBar", 7, 175 },
+    { "hellip", 6, 8230 },
+    { "Upsi", 4, 978 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "apos", 4, 39 },
+    { "udblac", 6, 369 },
+    { "Iacute", 6, 205 },
+    { "forall", 6, 8704 },
+    { "", 0, (uint32_t)-1 },
+    { "dArr", 4, 8659 },
+    { "", 0, (uint32_t)-1 },
+    { "lang", 4, 9001 },
+    { "", 0, (uint32_t)-1 },
+    { "Lambda", 6, 923 },
+    { "", 0, (uint32_t)-1 },
+    { "rsquo", 5, 8217 },
+    { "uarr", 4, 8593 },
+    { "larr", 4, 8592 },
+    { "sacute", 6, 347 },
+    { "", 0, (uint32_t)-1 },
+    { "varsigma", 8, 962 },
+    { "Lcaron", 6, 317 },
+    { "atilde", 6, 227 },
+    { "Ucirc", 5, 219 },
+    { "Jcirc", 5, 308 },
+    { "sup3", 4, 179 },
+    { "Dstrok", 6, 272 },
+    { "Sigma", 5, 931 },
+    { "aelig", 5, 230 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "ccedil", 6, 231 },
+    { "rho", 3, 961 },
+    { "", 0, (uint32_t)-1 },
+    { "scirc", 5, 349 },
+    { "alefsym", 7, 8501 },
+    { "Uacute", 6, 218 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "Cedilla", 7, 184 },
+    { "Theta", 5, 920 },
+    { "asymp", 5, 8776 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "bull", 4, 8226 },
+    { "lstrok", 6, 322 },
+    { "oslash", 6, 248 },
+    { "amp", 3, 38 },
+    { "exist", 5, 8707 },
+    { "", 0, (uint32_t)-1 },
+    { "Icirc", 5, 206 },
+    { "empty", 5, 8709 },
+    { "hcirc", 5, 293 },
+    { "iexcl", 5, 161 },
+    { "Gammad", 6, 988 },
+    { "DiacriticalTilde", 16, 732 },
+    { "DiacriticalDoubleAcute", 22, 733 },
+    { "rcaron", 6, 345 },
+    { "", 0, (uint32_t)-1 },
+    { "oline", 5, 8254 },
+    { "Amacr", 5, 256 },
+    { "nacute", 6, 324 },
+    { "", 0, (uint32_t)-1 },
+    { "eth", 3, 240 },
+    { "Itilde", 6, 296 },
+    { "yen", 3, 165 },
+    { "ecirc", 5, 234 },
+    { "Gcirc", 5, 284 },
+    { "tcaron", 6, 357 },
+    { "Nu", 2, 925 },
+    { "", 0, (uint32_t)-1 },
+    { "napos", 5, 329 },
+    { "Ccirc", 5, 264 },
+    { "thetasym", 8, 977 },
+    { "Rcaron", 6, 344 },
+    { "wcirc", 5, 373 },
+    { "", 0, (uint32_t)-1 },
+    { "umacr", 5, 363 },
+    { "gcirc", 5, 285 },
+    { "kgreen", 6, 312 },
+    { "rArr", 4, 8658 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "DiacriticalDot", 14, 729 },
+    { "darr", 4, 8595 },
+    { "yuml", 4, 255 },
+    { "zeta", 4, 950 },
+    { "lcedil", 6, 316 },
+    { "", 0, (uint32_t)-1 },
+    { "lowast", 6, 8727 },
+    { "ijlig", 5, 307 },
+    { "Odblac", 6, 336 },
+    { "ucirc", 5, 251 },
+    { "Ycirc", 5, 374 },
+    { "scaron", 6, 353 },
+    { "", 0, (uint32_t)-1 },
+    { "Uuml", 4, 220 },
+    { "Zacute", 6, 377 },
+    { "Ecaron", 6, 282 },
+    { "", 0, (uint32_t)-1 },
+    { "amacr", 5, 257 },
+    { "frac14", 6, 188 },
+    { "egrave", 6, 232 },
+    { "", 0, (uint32_t)-1 },
+    { "Iota", 4, 921 },
+    { "cap", 3, 8745 },
+    { "", 0, (uint32_t)-1 },
+    { "PlusMinus", 9, 177 },
+    { "eng", 3, 331 },
+    { "iacute", 6, 237 },
+    { "THORN", 5, 222 },
+    { "rcedil", 6, 343 },
+    { "ccirc", 5, 265 },
+    { "phi", 3, 966 },
+    { "vartheta", 8, 977 },
+    { "equiv", 5, 8801 },
+    { "", 0, (uint32_t)-1 },
+    { "divide", 6, 247 },
+    { "", 0, (uint32_t)-1 },
+    { "Aacute", 6, 193 },
+    { "uml", 3, 168 },
+    { "Ntilde", 6, 209 },
+    { "Alpha", 5, 913 },
+    { "", 0, (uint32_t)-1 },
+    { "kcedil", 6, 311 },
+    { "igrave", 6, 236 },
+    { "ntilde", 6, 241 },
+    { "rang", 4, 9002 },
+    { "lambda", 6, 955 },
+    { "lrm", 3, 8206 },
+    { "Utilde", 6, 360 },
+    { "", 0, (uint32_t)-1 },
+    { "Uring", 5, 366 },
+    { "", 0, (uint32_t)-1 },
+    { "Delta", 5, 916 },
+    { "Gcedil", 6, 290 },
+    { "agrave", 6, 224 },
+    { "", 0, (uint32_t)-1 },
+    { "Oslash", 6, 216 },
+    { "omicron", 7, 959 },
+    { "", 0, (uint32_t)-1 },
+    { "Abreve", 6, 258 },
+    { "reg", 3, 174 },
+    { "frac34", 6, 190 },
+    { "ubreve", 6, 365 },
+    { "Omicron", 7, 927 },
+    { "Rcedil", 6, 342 },
+    { "xi", 2, 958 },
+    { "and", 3, 8743 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "Lmidot", 6, 319 },
+    { "Dagger", 6, 8225 },
+    { "thinsp", 6, 8201 },
+    { "Eogon", 5, 280 },
+    { "chi", 3, 967 },
+    { "pi", 2, 960 },
+    { "rdquo", 5, 8221 },
+    { "", 0, (uint32_t)-1 },
+    { "lArr", 4, 8656 },
+    { "Aogon", 5, 260 },
+    { "epsilon", 7, 949 },
+    { "", 0, (uint32_t)-1 },
+    { "uogon", 5, 371 },
+    { "IJlig", 5, 306 },
+    { "", 0, (uint32_t)-1 },
+    { "prod", 4, 8719 },
+    { "Zeta", 4, 918 },
+    { "Lcedil", 6, 315 },
+    { "", 0, (uint32_t)-1 },
+    { "", 0, (uint32_t)-1 },
+    { "perp", 4, 8869 },
+    { "", 0, (uint32_t)-1 },
+    { "real", 4, 8476 },
+    { "le", 2, 8804 },
+    { "upsilon", 7, 965 },
+    { "Lacute", 6, 313 },
+    { "Rho", 3, 929 },
+    { "sim", 3, 8764 },
+    { "Auml", 4, 196 },
+    { "Ugrave", 6, 217 },
+    { "Otilde", 6, 213 },
+    { "hstrok", 6, 295 },
+    { "alpha", 5, 945 },
+    { "Wcirc", 5, 372 },
+    { "", 0, (uint32_t)-1 },
+    { "varkappa", 8, 1008 },
+    { "lsquo", 5, 8216 },
+    { "sigma", 5, 963 },
+    { "uring", 5, 367 },
+    { "Tstrok", 6, 358 },
+    { "", 0, (uint32_t)-1 },
+    { "dagger", 6, 8224 },
+    { "nbsp", 4, 160 },
+    { "eogon", 5, 281 },
+    { "", 0, (uint32_t)-1 },
+};
+
 uint32_t FindHtmlEntityRune(const char *name, size_t len)
 {
-    uint32_t key = 0 == len ? 0 : 1 == len ? STR1(name) :
-                   2 == len ? STR2(name) : 3 == len ? STR3(name) : STR4(name);
-    switch (key) {
-    case CS4('A','E','l','i'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 198;
-        break;
-    case CS4('A','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 193;
-        break;
-    case CS4('A','b','r','e'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 258;
-        break;
-    case CS4('A','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 194;
-        break;
-    case CS4('A','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 192;
-        break;
-    case CS4('A','l','p','h'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 913;
-        break;
-    case CS4('A','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 256;
-        break;
-    case CS4('A','o','g','o'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 260;
-        break;
-    case CS4('A','r','i','n'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 197;
-        break;
-    case CS4('A','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 195;
-        break;
-    case CS4('A','u','m','l'):
-        if (4 == len) return 196;
-        break;
-    case CS4('B','e','t','a'):
-        if (4 == len) return 914;
-        break;
-    case CS4('B','r','e','v'):
-        if (5 == len && CS1('e') == STR1(name + 4)) return 728;
-        break;
-    case CS4('C','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 262;
-        break;
-    case CS4('C','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 268;
-        break;
-    case CS4('C','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 199;
-        break;
-    case CS4('C','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 264;
-        break;
-    case CS4('C','d','o','t'):
-        if (4 == len) return 266;
-        break;
-    case CS4('C','e','d','i'):
-        if (7 == len && CS3('l','l','a') == STR3(name + 4)) return 184;
-        break;
-    case CS3('C','h','i'): return 935;
-    case CS4('D','a','g','g'):
-        if (6 == len && CS2('e','r') == STR2(name + 4)) return 8225;
-        break;
-    case CS4('D','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 270;
-        break;
-    case CS4('D','e','l','t'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 916;
-        break;
-    case CS4('D','i','a','c'):
-        if (14 == len && str::EqN(name + 4, "riticalDot", 10)) return 729;
-        if (22 == len && str::EqN(name + 4, "riticalDoubleAcute", 18)) return 733;
-        if (16 == len && str::EqN(name + 4, "riticalTilde", 12)) return 732;
-        break;
-    case CS4('D','o','u','b'):
-        if (9 == len && str::EqN(name + 4, "leDot", 5)) return 168;
-        break;
-    case CS4('D','o','w','n'):
-        if (9 == len && str::EqN(name + 4, "Breve", 5)) return 785;
-        break;
-    case CS4('D','s','t','r'):
-        if (6 == len && CS2('o','k') == STR2(name + 4)) return 272;
-        break;
-    case CS3('E','N','G'): return 330;
-    case CS3('E','T','H'): return 208;
-    case CS4('E','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 201;
-        break;
-    case CS4('E','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 282;
-        break;
-    case CS4('E','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 202;
-        break;
-    case CS4('E','d','o','t'):
-        if (4 == len) return 278;
-        break;
-    case CS4('E','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 200;
-        break;
-    case CS4('E','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 274;
-        break;
-    case CS4('E','o','g','o'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 280;
-        break;
-    case CS4('E','p','s','i'):
-        if (7 == len && CS3('l','o','n') == STR3(name + 4)) return 917;
-        break;
-    case CS3('E','t','a'): return 919;
-    case CS4('E','u','m','l'):
-        if (4 == len) return 203;
-        break;
-    case CS4('G','a','m','m'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 915;
-        if (6 == len && CS2('a','d') == STR2(name + 4)) return 988;
-        break;
-    case CS4('G','b','r','e'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 286;
-        break;
-    case CS4('G','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 290;
-        break;
-    case CS4('G','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 284;
-        break;
-    case CS4('G','d','o','t'):
-        if (4 == len) return 288;
-        break;
-    case CS4('H','a','c','e'):
-        if (5 == len && CS1('k') == STR1(name + 4)) return 711;
-        break;
-    case CS4('H','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 292;
-        break;
-    case CS4('H','s','t','r'):
-        if (6 == len && CS2('o','k') == STR2(name + 4)) return 294;
-        break;
-    case CS4('I','J','l','i'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 306;
-        break;
-    case CS4('I','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 205;
-        break;
-    case CS4('I','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 206;
-        break;
-    case CS4('I','d','o','t'):
-        if (4 == len) return 304;
-        break;
-    case CS4('I','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 204;
-        break;
-    case CS4('I','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 298;
-        break;
-    case CS4('I','o','g','o'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 302;
-        break;
-    case CS4('I','o','t','a'):
-        if (4 == len) return 921;
-        break;
-    case CS4('I','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 296;
-        break;
-    case CS4('I','u','m','l'):
-        if (4 == len) return 207;
-        break;
-    case CS4('J','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 308;
-        break;
-    case CS4('K','a','p','p'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 922;
-        break;
-    case CS4('K','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 310;
-        break;
-    case CS4('L','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 313;
-        break;
-    case CS4('L','a','m','b'):
-        if (6 == len && CS2('d','a') == STR2(name + 4)) return 923;
-        break;
-    case CS4('L','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 317;
-        break;
-    case CS4('L','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 315;
-        break;
-    case CS4('L','m','i','d'):
-        if (6 == len && CS2('o','t') == STR2(name + 4)) return 319;
-        break;
-    case CS4('L','s','t','r'):
-        if (6 == len && CS2('o','k') == STR2(name + 4)) return 321;
-        break;
-    case CS2('M','u'): return 924;
-    case CS4('N','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 323;
-        break;
-    case CS4('N','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 327;
-        break;
-    case CS4('N','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 325;
-        break;
-    case CS4('N','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 209;
-        break;
-    case CS2('N','u'): return 925;
-    case CS4('O','E','l','i'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 338;
-        break;
-    case CS4('O','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 211;
-        break;
-    case CS4('O','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 212;
-        break;
-    case CS4('O','d','b','l'):
-        if (6 == len && CS2('a','c') == STR2(name + 4)) return 336;
-        break;
-    case CS4('O','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 210;
-        break;
-    case CS4('O','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 332;
-        break;
-    case CS4('O','m','e','g'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 937;
-        break;
-    case CS4('O','m','i','c'):
-        if (7 == len && CS3('r','o','n') == STR3(name + 4)) return 927;
-        break;
-    case CS4('O','s','l','a'):
-        if (6 == len && CS2('s','h') == STR2(name + 4)) return 216;
-        break;
-    case CS4('O','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 213;
-        break;
-    case CS4('O','u','m','l'):
-        if (4 == len) return 214;
-        break;
-    case CS4('O','v','e','r'):
-        if (7 == len && CS3('B','a','r') == STR3(name + 4)) return 175;
-        break;
-    case CS3('P','h','i'): return 934;
-    case CS2('P','i'): return 928;
-    case CS4('P','l','u','s'):
-        if (9 == len && str::EqN(name + 4, "Minus", 5)) return 177;
-        break;
-    case CS4('P','r','i','m'):
-        if (5 == len && CS1('e') == STR1(name + 4)) return 8243;
-        break;
-    case CS3('P','s','i'): return 936;
-    case CS4('R','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 340;
-        break;
-    case CS4('R','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 344;
-        break;
-    case CS4('R','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 342;
-        break;
-    case CS3('R','h','o'): return 929;
-    case CS4('S','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 346;
-        break;
-    case CS4('S','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 352;
-        break;
-    case CS4('S','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 350;
-        break;
-    case CS4('S','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 348;
-        break;
-    case CS4('S','i','g','m'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 931;
-        break;
-    case CS4('T','H','O','R'):
-        if (5 == len && CS1('N') == STR1(name + 4)) return 222;
-        break;
-    case CS3('T','a','u'): return 932;
-    case CS4('T','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 356;
-        break;
-    case CS4('T','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 354;
-        break;
-    case CS4('T','h','e','t'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 920;
-        break;
-    case CS4('T','s','t','r'):
-        if (6 == len && CS2('o','k') == STR2(name + 4)) return 358;
-        break;
-    case CS4('U','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 218;
-        break;
-    case CS4('U','b','r','e'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 364;
-        break;
-    case CS4('U','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 219;
-        break;
-    case CS4('U','d','b','l'):
-        if (6 == len && CS2('a','c') == STR2(name + 4)) return 368;
-        break;
-    case CS4('U','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 217;
-        break;
-    case CS4('U','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 362;
-        break;
-    case CS4('U','n','d','e'):
-        if (8 == len && CS4('r','B','a','r') == STR4(name + 4)) return 818;
-        break;
-    case CS4('U','o','g','o'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 370;
-        break;
-    case CS4('U','p','s','i'):
-        if (4 == len) return 978;
-        if (7 == len && CS3('l','o','n') == STR3(name + 4)) return 933;
-        break;
-    case CS4('U','r','i','n'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 366;
-        break;
-    case CS4('U','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 360;
-        break;
-    case CS4('U','u','m','l'):
-        if (4 == len) return 220;
-        break;
-    case CS4('W','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 372;
-        break;
-    case CS2('X','i'): return 926;
-    case CS4('Y','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 221;
-        break;
-    case CS4('Y','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 374;
-        break;
-    case CS4('Y','u','m','l'):
-        if (4 == len) return 376;
-        break;
-    case CS4('Z','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 377;
-        break;
-    case CS4('Z','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 381;
-        break;
-    case CS4('Z','d','o','t'):
-        if (4 == len) return 379;
-        break;
-    case CS4('Z','e','t','a'):
-        if (4 == len) return 918;
-        break;
-    case CS4('a','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 225;
-        break;
-    case CS4('a','b','r','e'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 259;
-        break;
-    case CS4('a','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 226;
-        break;
-    case CS4('a','c','u','t'):
-        if (5 == len && CS1('e') == STR1(name + 4)) return 180;
-        break;
-    case CS4('a','e','l','i'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 230;
-        break;
-    case CS4('a','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 224;
-        break;
-    case CS4('a','l','e','f'):
-        if (7 == len && CS3('s','y','m') == STR3(name + 4)) return 8501;
-        break;
-    case CS4('a','l','p','h'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 945;
-        break;
-    case CS4('a','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 257;
-        break;
-    case CS3('a','m','p'): return 38;
-    case CS3('a','n','d'): return 8743;
-    case CS3('a','n','g'): return 8736;
-    case CS4('a','o','g','o'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 261;
-        break;
-    case CS4('a','p','o','s'):
-        if (4 == len) return 39;
-        break;
-    case CS4('a','r','i','n'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 229;
-        break;
-    case CS4('a','s','y','m'):
-        if (5 == len && CS1('p') == STR1(name + 4)) return 8776;
-        break;
-    case CS4('a','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 227;
-        break;
-    case CS4('a','u','m','l'):
-        if (4 == len) return 228;
-        break;
-    case CS4('b','a','c','k'):
-        if (11 == len && str::EqN(name + 4, "epsilon", 7)) return 1014;
-        break;
-    case CS4('b','d','q','u'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 8222;
-        break;
-    case CS4('b','e','t','a'):
-        if (4 == len) return 946;
-        break;
-    case CS4('b','r','v','b'):
-        if (6 == len && CS2('a','r') == STR2(name + 4)) return 166;
-        break;
-    case CS4('b','u','l','l'):
-        if (4 == len) return 8226;
-        break;
-    case CS4('c','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 263;
-        break;
-    case CS3('c','a','p'): return 8745;
-    case CS4('c','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 269;
-        break;
-    case CS4('c','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 231;
-        break;
-    case CS4('c','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 265;
-        break;
-    case CS4('c','d','o','t'):
-        if (4 == len) return 267;
-        break;
-    case CS4('c','e','d','i'):
-        if (5 == len && CS1('l') == STR1(name + 4)) return 184;
-        break;
-    case CS4('c','e','n','t'):
-        if (4 == len) return 162;
-        break;
-    case CS3('c','h','i'): return 967;
-    case CS4('c','i','r','c'):
-        if (4 == len) return 710;
-        break;
-    case CS4('c','l','u','b'):
-        if (5 == len && CS1('s') == STR1(name + 4)) return 9827;
-        break;
-    case CS4('c','o','n','g'):
-        if (4 == len) return 8773;
-        break;
-    case CS4('c','o','p','y'):
-        if (4 == len) return 169;
-        break;
-    case CS4('c','r','a','r'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 8629;
-        break;
-    case CS3('c','u','p'): return 8746;
-    case CS4('c','u','r','r'):
-        if (6 == len && CS2('e','n') == STR2(name + 4)) return 164;
-        break;
-    case CS4('d','A','r','r'):
-        if (4 == len) return 8659;
-        break;
-    case CS4('d','a','g','g'):
-        if (6 == len && CS2('e','r') == STR2(name + 4)) return 8224;
-        break;
-    case CS4('d','a','r','r'):
-        if (4 == len) return 8595;
-        break;
-    case CS4('d','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 271;
-        break;
-    case CS3('d','e','g'): return 176;
-    case CS4('d','e','l','t'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 948;
-        break;
-    case CS4('d','i','a','m'):
-        if (5 == len && CS1('s') == STR1(name + 4)) return 9830;
-        break;
-    case CS4('d','i','g','a'):
-        if (7 == len && CS3('m','m','a') == STR3(name + 4)) return 989;
-        break;
-    case CS4('d','i','v','i'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 247;
-        break;
-    case CS4('d','s','t','r'):
-        if (6 == len && CS2('o','k') == STR2(name + 4)) return 273;
-        break;
-    case CS4('e','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 233;
-        break;
-    case CS4('e','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 283;
-        break;
-    case CS4('e','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 234;
-        break;
-    case CS4('e','d','o','t'):
-        if (4 == len) return 279;
-        break;
-    case CS4('e','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 232;
-        break;
-    case CS4('e','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 275;
-        break;
-    case CS4('e','m','p','t'):
-        if (5 == len && CS1('y') == STR1(name + 4)) return 8709;
-        break;
-    case CS4('e','m','s','p'):
-        if (4 == len) return 8195;
-        break;
-    case CS3('e','n','g'): return 331;
-    case CS4('e','n','s','p'):
-        if (4 == len) return 8194;
-        break;
-    case CS4('e','o','g','o'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 281;
-        break;
-    case CS4('e','p','s','i'):
-        if (7 == len && CS3('l','o','n') == STR3(name + 4)) return 949;
-        break;
-    case CS4('e','q','u','i'):
-        if (5 == len && CS1('v') == STR1(name + 4)) return 8801;
-        break;
-    case CS3('e','t','a'): return 951;
-    case CS3('e','t','h'): return 240;
-    case CS4('e','u','m','l'):
-        if (4 == len) return 235;
-        break;
-    case CS4('e','u','r','o'):
-        if (4 == len) return 8364;
-        break;
-    case CS4('e','x','i','s'):
-        if (5 == len && CS1('t') == STR1(name + 4)) return 8707;
-        break;
-    case CS4('f','n','o','f'):
-        if (4 == len) return 402;
-        break;
-    case CS4('f','o','r','a'):
-        if (6 == len && CS2('l','l') == STR2(name + 4)) return 8704;
-        break;
-    case CS4('f','r','a','c'):
-        if (6 == len && CS2('1','2') == STR2(name + 4)) return 189;
-        if (6 == len && CS2('1','4') == STR2(name + 4)) return 188;
-        if (6 == len && CS2('3','4') == STR2(name + 4)) return 190;
-        break;
-    case CS4('f','r','a','s'):
-        if (5 == len && CS1('l') == STR1(name + 4)) return 8260;
-        break;
-    case CS4('g','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 501;
-        break;
-    case CS4('g','a','m','m'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 947;
-        break;
-    case CS4('g','b','r','e'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 287;
-        break;
-    case CS4('g','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 285;
-        break;
-    case CS4('g','d','o','t'):
-        if (4 == len) return 289;
-        break;
-    case CS2('g','e'): return 8805;
-    case CS2('g','t'): return 62;
-    case CS4('h','A','r','r'):
-        if (4 == len) return 8660;
-        break;
-    case CS4('h','a','r','r'):
-        if (4 == len) return 8596;
-        break;
-    case CS4('h','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 293;
-        break;
-    case CS4('h','e','a','r'):
-        if (6 == len && CS2('t','s') == STR2(name + 4)) return 9829;
-        break;
-    case CS4('h','e','l','l'):
-        if (6 == len && CS2('i','p') == STR2(name + 4)) return 8230;
-        break;
-    case CS4('h','s','t','r'):
-        if (6 == len && CS2('o','k') == STR2(name + 4)) return 295;
-        break;
-    case CS4('i','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 237;
-        break;
-    case CS4('i','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 238;
-        break;
-    case CS4('i','e','x','c'):
-        if (5 == len && CS1('l') == STR1(name + 4)) return 161;
-        break;
-    case CS4('i','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 236;
-        break;
-    case CS4('i','j','l','i'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 307;
-        break;
-    case CS4('i','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 299;
-        break;
-    case CS4('i','m','a','g'):
-        if (5 == len && CS1('e') == STR1(name + 4)) return 8465;
-        break;
-    case CS4('i','m','p','e'):
-        if (5 == len && CS1('d') == STR1(name + 4)) return 437;
-        break;
-    case CS4('i','n','f','i'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 8734;
-        break;
-    case CS3('i','n','t'): return 8747;
-    case CS4('i','o','g','o'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 303;
-        break;
-    case CS4('i','o','t','a'):
-        if (4 == len) return 953;
-        break;
-    case CS4('i','q','u','e'):
-        if (6 == len && CS2('s','t') == STR2(name + 4)) return 191;
-        break;
-    case CS4('i','s','i','n'):
-        if (4 == len) return 8712;
-        break;
-    case CS4('i','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 297;
-        break;
-    case CS4('i','u','m','l'):
-        if (4 == len) return 239;
-        break;
-    case CS4('j','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 309;
-        break;
-    case CS4('k','a','p','p'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 954;
-        break;
-    case CS4('k','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 311;
-        break;
-    case CS4('k','g','r','e'):
-        if (6 == len && CS2('e','n') == STR2(name + 4)) return 312;
-        break;
-    case CS4('l','A','r','r'):
-        if (4 == len) return 8656;
-        break;
-    case CS4('l','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 314;
-        break;
-    case CS4('l','a','m','b'):
-        if (6 == len && CS2('d','a') == STR2(name + 4)) return 955;
-        break;
-    case CS4('l','a','n','g'):
-        if (4 == len) return 9001;
-        break;
-    case CS4('l','a','q','u'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 171;
-        break;
-    case CS4('l','a','r','r'):
-        if (4 == len) return 8592;
-        break;
-    case CS4('l','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 318;
-        break;
-    case CS4('l','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 316;
-        break;
-    case CS4('l','c','e','i'):
-        if (5 == len && CS1('l') == STR1(name + 4)) return 8968;
-        break;
-    case CS4('l','d','q','u'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 8220;
-        break;
-    case CS2('l','e'): return 8804;
-    case CS4('l','f','l','o'):
-        if (6 == len && CS2('o','r') == STR2(name + 4)) return 8970;
-        break;
-    case CS4('l','m','i','d'):
-        if (6 == len && CS2('o','t') == STR2(name + 4)) return 320;
-        break;
-    case CS4('l','o','w','a'):
-        if (6 == len && CS2('s','t') == STR2(name + 4)) return 8727;
-        break;
-    case CS3('l','o','z'): return 9674;
-    case CS3('l','r','m'): return 8206;
-    case CS4('l','s','a','q'):
-        if (6 == len && CS2('u','o') == STR2(name + 4)) return 8249;
-        break;
-    case CS4('l','s','q','u'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 8216;
-        break;
-    case CS4('l','s','t','r'):
-        if (6 == len && CS2('o','k') == STR2(name + 4)) return 322;
-        break;
-    case CS2('l','t'): return 60;
-    case CS4('m','a','c','r'):
-        if (4 == len) return 175;
-        break;
-    case CS4('m','d','a','s'):
-        if (5 == len && CS1('h') == STR1(name + 4)) return 8212;
-        break;
-    case CS4('m','i','c','r'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 181;
-        break;
-    case CS4('m','i','d','d'):
-        if (6 == len && CS2('o','t') == STR2(name + 4)) return 183;
-        break;
-    case CS4('m','i','n','u'):
-        if (5 == len && CS1('s') == STR1(name + 4)) return 8722;
-        break;
-    case CS2('m','u'): return 956;
-    case CS4('n','a','b','l'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 8711;
-        break;
-    case CS4('n','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 324;
-        break;
-    case CS4('n','a','p','o'):
-        if (5 == len && CS1('s') == STR1(name + 4)) return 329;
-        break;
-    case CS4('n','b','s','p'):
-        if (4 == len) return 160;
-        break;
-    case CS4('n','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 328;
-        break;
-    case CS4('n','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 326;
-        break;
-    case CS4('n','d','a','s'):
-        if (5 == len && CS1('h') == STR1(name + 4)) return 8211;
-        break;
-    case CS2('n','e'): return 8800;
-    case CS2('n','i'): return 8715;
-    case CS3('n','o','t'): return 172;
-    case CS4('n','o','t','i'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 8713;
-        break;
-    case CS4('n','s','u','b'):
-        if (4 == len) return 8836;
-        break;
-    case CS4('n','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 241;
-        break;
-    case CS2('n','u'): return 957;
-    case CS4('o','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 243;
-        break;
-    case CS4('o','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 244;
-        break;
-    case CS4('o','d','b','l'):
-        if (6 == len && CS2('a','c') == STR2(name + 4)) return 337;
-        break;
-    case CS4('o','e','l','i'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 339;
-        break;
-    case CS4('o','g','o','n'):
-        if (4 == len) return 731;
-        break;
-    case CS4('o','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 242;
-        break;
-    case CS4('o','l','i','n'):
-        if (5 == len && CS1('e') == STR1(name + 4)) return 8254;
-        break;
-    case CS4('o','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 333;
-        break;
-    case CS4('o','m','e','g'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 969;
-        break;
-    case CS4('o','m','i','c'):
-        if (7 == len && CS3('r','o','n') == STR3(name + 4)) return 959;
-        break;
-    case CS4('o','p','l','u'):
-        if (5 == len && CS1('s') == STR1(name + 4)) return 8853;
-        break;
-    case CS2('o','r'): return 8744;
-    case CS4('o','r','d','f'):
-        if (4 == len) return 170;
-        break;
-    case CS4('o','r','d','m'):
-        if (4 == len) return 186;
-        break;
-    case CS4('o','s','l','a'):
-        if (6 == len && CS2('s','h') == STR2(name + 4)) return 248;
-        break;
-    case CS4('o','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 245;
-        break;
-    case CS4('o','t','i','m'):
-        if (6 == len && CS2('e','s') == STR2(name + 4)) return 8855;
-        break;
-    case CS4('o','u','m','l'):
-        if (4 == len) return 246;
-        break;
-    case CS4('p','a','r','a'):
-        if (4 == len) return 182;
-        break;
-    case CS4('p','a','r','t'):
-        if (4 == len) return 8706;
-        break;
-    case CS4('p','e','r','m'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 8240;
-        break;
-    case CS4('p','e','r','p'):
-        if (4 == len) return 8869;
-        break;
-    case CS3('p','h','i'): return 966;
-    case CS2('p','i'): return 960;
-    case CS3('p','i','v'): return 982;
-    case CS4('p','l','u','s'):
-        if (6 == len && CS2('m','n') == STR2(name + 4)) return 177;
-        break;
-    case CS4('p','o','u','n'):
-        if (5 == len && CS1('d') == STR1(name + 4)) return 163;
-        break;
-    case CS4('p','r','i','m'):
-        if (5 == len && CS1('e') == STR1(name + 4)) return 8242;
-        break;
-    case CS4('p','r','o','d'):
-        if (4 == len) return 8719;
-        break;
-    case CS4('p','r','o','p'):
-        if (4 == len) return 8733;
-        break;
-    case CS3('p','s','i'): return 968;
-    case CS4('q','u','o','t'):
-        if (4 == len) return 34;
-        break;
-    case CS4('r','A','r','r'):
-        if (4 == len) return 8658;
-        break;
-    case CS4('r','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 341;
-        break;
-    case CS4('r','a','d','i'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 8730;
-        break;
-    case CS4('r','a','n','g'):
-        if (4 == len) return 9002;
-        break;
-    case CS4('r','a','q','u'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 187;
-        break;
-    case CS4('r','a','r','r'):
-        if (4 == len) return 8594;
-        break;
-    case CS4('r','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 345;
-        break;
-    case CS4('r','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 343;
-        break;
-    case CS4('r','c','e','i'):
-        if (5 == len && CS1('l') == STR1(name + 4)) return 8969;
-        break;
-    case CS4('r','d','q','u'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 8221;
-        break;
-    case CS4('r','e','a','l'):
-        if (4 == len) return 8476;
-        break;
-    case CS3('r','e','g'): return 174;
-    case CS4('r','f','l','o'):
-        if (6 == len && CS2('o','r') == STR2(name + 4)) return 8971;
-        break;
-    case CS3('r','h','o'): return 961;
-    case CS4('r','i','n','g'):
-        if (4 == len) return 730;
-        break;
-    case CS3('r','l','m'): return 8207;
-    case CS4('r','s','a','q'):
-        if (6 == len && CS2('u','o') == STR2(name + 4)) return 8250;
-        break;
-    case CS4('r','s','q','u'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 8217;
-        break;
-    case CS4('s','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 347;
-        break;
-    case CS4('s','b','q','u'):
-        if (5 == len && CS1('o') == STR1(name + 4)) return 8218;
-        break;
-    case CS4('s','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 353;
-        break;
-    case CS4('s','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 351;
-        break;
-    case CS4('s','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 349;
-        break;
-    case CS4('s','d','o','t'):
-        if (4 == len) return 8901;
-        break;
-    case CS4('s','e','c','t'):
-        if (4 == len) return 167;
-        break;
-    case CS3('s','h','y'): return 173;
-    case CS4('s','i','g','m'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 963;
-        if (6 == len && CS2('a','f') == STR2(name + 4)) return 962;
-        break;
-    case CS3('s','i','m'): return 8764;
-    case CS4('s','p','a','d'):
-        if (6 == len && CS2('e','s') == STR2(name + 4)) return 9824;
-        break;
-    case CS4('s','t','r','a'):
-        if (15 == len && str::EqN(name + 4, "ightepsilon", 11)) return 1013;
-        if (11 == len && str::EqN(name + 4, "ightphi", 7)) return 981;
-        break;
-    case CS3('s','u','b'): return 8834;
-    case CS4('s','u','b','e'):
-        if (4 == len) return 8838;
-        break;
-    case CS3('s','u','m'): return 8721;
-    case CS3('s','u','p'): return 8835;
-    case CS4('s','u','p','1'):
-        if (4 == len) return 185;
-        break;
-    case CS4('s','u','p','2'):
-        if (4 == len) return 178;
-        break;
-    case CS4('s','u','p','3'):
-        if (4 == len) return 179;
-        break;
-    case CS4('s','u','p','e'):
-        if (4 == len) return 8839;
-        break;
-    case CS4('s','z','l','i'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 223;
-        break;
-    case CS3('t','a','u'): return 964;
-    case CS4('t','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 357;
-        break;
-    case CS4('t','c','e','d'):
-        if (6 == len && CS2('i','l') == STR2(name + 4)) return 355;
-        break;
-    case CS4('t','h','e','r'):
-        if (6 == len && CS2('e','4') == STR2(name + 4)) return 8756;
-        break;
-    case CS4('t','h','e','t'):
-        if (5 == len && CS1('a') == STR1(name + 4)) return 952;
-        if (8 == len && CS4('a','s','y','m') == STR4(name + 4)) return 977;
-        break;
-    case CS4('t','h','i','n'):
-        if (6 == len && CS2('s','p') == STR2(name + 4)) return 8201;
-        break;
-    case CS4('t','h','o','r'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 254;
-        break;
-    case CS4('t','i','l','d'):
-        if (5 == len && CS1('e') == STR1(name + 4)) return 732;
-        break;
-    case CS4('t','i','m','e'):
-        if (5 == len && CS1('s') == STR1(name + 4)) return 215;
-        break;
-    case CS4('t','r','a','d'):
-        if (5 == len && CS1('e') == STR1(name + 4)) return 8482;
-        break;
-    case CS4('t','s','t','r'):
-        if (6 == len && CS2('o','k') == STR2(name + 4)) return 359;
-        break;
-    case CS4('u','A','r','r'):
-        if (4 == len) return 8657;
-        break;
-    case CS4('u','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 250;
-        break;
-    case CS4('u','a','r','r'):
-        if (4 == len) return 8593;
-        break;
-    case CS4('u','b','r','e'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 365;
-        break;
-    case CS4('u','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 251;
-        break;
-    case CS4('u','d','b','l'):
-        if (6 == len && CS2('a','c') == STR2(name + 4)) return 369;
-        break;
-    case CS4('u','g','r','a'):
-        if (6 == len && CS2('v','e') == STR2(name + 4)) return 249;
-        break;
-    case CS4('u','m','a','c'):
-        if (5 == len && CS1('r') == STR1(name + 4)) return 363;
-        break;
-    case CS3('u','m','l'): return 168;
-    case CS4('u','o','g','o'):
-        if (5 == len && CS1('n') == STR1(name + 4)) return 371;
-        break;
-    case CS4('u','p','s','i'):
-        if (5 == len && CS1('h') == STR1(name + 4)) return 978;
-        if (7 == len && CS3('l','o','n') == STR3(name + 4)) return 965;
-        break;
-    case CS4('u','r','i','n'):
-        if (5 == len && CS1('g') == STR1(name + 4)) return 367;
-        break;
-    case CS4('u','t','i','l'):
-        if (6 == len && CS2('d','e') == STR2(name + 4)) return 361;
-        break;
-    case CS4('u','u','m','l'):
-        if (4 == len) return 252;
-        break;
-    case CS4('v','a','r','e'):
-        if (10 == len && str::EqN(name + 4, "psilon", 6)) return 949;
-        break;
-    case CS4('v','a','r','k'):
-        if (8 == len && CS4('a','p','p','a') == STR4(name + 4)) return 1008;
-        break;
-    case CS4('v','a','r','p'):
-        if (6 == len && CS2('h','i') == STR2(name + 4)) return 966;
-        if (5 == len && CS1('i') == STR1(name + 4)) return 982;
-        break;
-    case CS4('v','a','r','r'):
-        if (6 == len && CS2('h','o') == STR2(name + 4)) return 1009;
-        break;
-    case CS4('v','a','r','s'):
-        if (8 == len && CS4('i','g','m','a') == STR4(name + 4)) return 962;
-        break;
-    case CS4('v','a','r','t'):
-        if (8 == len && CS4('h','e','t','a') == STR4(name + 4)) return 977;
-        break;
-    case CS4('w','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 373;
-        break;
-    case CS4('w','e','i','e'):
-        if (6 == len && CS2('r','p') == STR2(name + 4)) return 8472;
-        break;
-    case CS2('x','i'): return 958;
-    case CS4('y','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 253;
-        break;
-    case CS4('y','c','i','r'):
-        if (5 == len && CS1('c') == STR1(name + 4)) return 375;
-        break;
-    case CS3('y','e','n'): return 165;
-    case CS4('y','u','m','l'):
-        if (4 == len) return 255;
-        break;
-    case CS4('z','a','c','u'):
-        if (6 == len && CS2('t','e') == STR2(name + 4)) return 378;
-        break;
-    case CS4('z','c','a','r'):
-        if (6 == len && CS2('o','n') == STR2(name + 4)) return 382;
-        break;
-    case CS4('z','d','o','t'):
-        if (4 == len) return 380;
-        break;
-    case CS4('z','e','t','a'):
-        if (4 == len) return 950;
-        break;
-    case CS3('z','w','j'): return 8205;
-    case CS4('z','w','n','j'):
-        if (4 == len) return 8204;
-        break;
-    }
+    if (0 == len)
+        return (uint32_t)-1;
+    uint32_t key = 1 == len ? KEY1(name) : KEY(name, len);
+    uint32_t slot = SLOT(key, gHtmlEntityRuneDisp[SLOT(key, 0, 7)], 9);
+    if (len == gHtmlEntityRuneTable[slot].len && str::EqN(gHtmlEntityRuneTable[slot].name, name, len))
+        return gHtmlEntityRuneTable[slot].value;
     return (uint32_t)-1;
 }
 
+static const uint16_t gCssPropDisp[8] = {
+    13, 4, 8, 14, 1, 14, 10, 11
+};
+
+static const struct {
+    const char *name;
+    size_t len;
+    CssProp value;
+} gCssPropTable[32] = {
+    { "padding-right", 13, Css_Padding_Right },
+    { "", 0, Css_Unknown },
+    { "text-decoration", 15, Css_Text_Decoration },
+    { "opacity", 7, Css_Opacity },
+    { "margin-bottom", 13, Css_Margin_Bottom },
+    { "margin-right", 12, Css_Margin_Right },
+    { "page-break-before", 17, Css_Page_Break_Before },
+    { "display", 7, Css_Display },
+    { "padding-top", 11, Css_Padding_Top },
+    { "font-size", 9, Css_Font_Size },
+    { "margin-left", 11, Css_Margin_Left },
+    { "font-weight", 11, Css_Font_Weight },
+    { "", 0, Css_Unknown },
+    { "list-style", 10, Css_List_Style },
+    { "margin-top", 10, Css_Margin_Top },
+    { "", 0, Css_Unknown },
+    { "padding", 7, Css_Padding },
+    { "text-indent", 11, Css_Text_Indent },
+    { "margin", 6, Css_Margin },
+    { "max-width", 9, Css_Max_Width },
+    { "padding-left", 12, Css_Padding_Left },
+    { "color", 5, Css_Color },
+    { "word-wrap", 9, Css_Word_Wrap },
+    { "font-family", 11, Css_Font_Family },
+    { "text-align", 10, Css_Text_Align },
+    { "white-space", 11, Css_White_Space },
+    { "text-underline", 14, Css_Text_Underline },
+    { "padding-bottom", 14, Css_Padding_Bottom },
+    { "page-break-after", 16, Css_Page_Break_After },
+    { "", 0, Css_Unknown },
+    { "font", 4, Css_Font },
+    { "font-style", 10, Css_Font_Style },
+};
+
 CssProp FindCssProp(const char *name, size_t len)
 {
-    uint32_t key = 0 == len ? 0 : 1 == len ? STR1i(name) :
-                   2 == len ? STR2i(name) : 3 == len ? STR3i(name) : STR4i(name);
-    switch (key) {
-    case CS4('c','o','l','o'):
-        if (5 == len && CS1('r') == STR1i(name + 4)) return Css_Color;
-        break;
-    case CS4('d','i','s','p'):
-        if (7 == len && CS3('l','a','y') == STR3i(name + 4)) return Css_Display;
-        break;
-    case CS4('f','o','n','t'):
-        if (4 == len) return Css_Font;
-        if (11 == len && str::EqNI(name + 4, "-family", 7)) return Css_Font_Family;
-        if (9 == len && str::EqNI(name + 4, "-size", 5)) return Css_Font_Size;
-        if (10 == len && str::EqNI(name + 4, "-style", 6)) return Css_Font_Style;
-        if (11 == len && str::EqNI(name + 4, "-weight", 7)) return Css_Font_Weight;
-        break;
-    case CS4('l','i','s','t'):
-        if (10 == len && str::EqNI(name + 4, "-style", 6)) return Css_List_Style;
-        break;
-    case CS4('m','a','r','g'):
-        if (6 == len && CS2('i','n') == STR2i(name + 4)) return Css_Margin;
-        if (13 == len && str::EqNI(name + 4, "in-bottom", 9)) return Css_Margin_Bottom;
-        if (11 == len && str::EqNI(name + 4, "in-left", 7)) return Css_Margin_Left;
-        if (12 == len && str::EqNI(name + 4, "in-right", 8)) return Css_Margin_Right;
-        if (10 == len && str::EqNI(name + 4, "in-top", 6)) return Css_Margin_Top;
-        break;
-    case CS4('m','a','x','-'):
-        if (9 == len && str::EqNI(name + 4, "width", 5)) return Css_Max_Width;
-        break;
-    case CS4('o','p','a','c'):
-        if (7 == len && CS3('i','t','y') == STR3i(name + 4)) return Css_Opacity;
-        break;
-    case CS4('p','a','d','d'):
-        if (7 == len && CS3('i','n','g') == STR3i(name + 4)) return Css_Padding;
-        if (14 == len && str::EqNI(name + 4, "ing-bottom", 10)) return Css_Padding_Bottom;
-        if (12 == len && str::EqNI(name + 4, "ing-left", 8)) return Css_Padding_Left;
-        if (13 == len && str::EqNI(name + 4, "ing-right", 9)) return Css_Padding_Right;
-        if (11 == len && str::EqNI(name + 4, "ing-top", 7)) return Css_Padding_Top;
-        break;
-    case CS4('p','a','g','e'):
-        if (16 == len && str::EqNI(name + 4, "-break-after", 12)) return Css_Page_Break_After;
-        if (17 == len && str::EqNI(name + 4, "-break-before", 13)) return Css_Page_Break_Before;
-        break;
-    case CS4('t','e','x','t'):
-        if (10 == len && str::EqNI(name + 4, "-align", 6)) return Css_Text_Align;
-        if (15 == len && str::EqNI(name + 4, "-decoration", 11)) return Css_Text_Decoration;
-        if (11 == len && str::EqNI(name + 4, "-indent", 7)) return Css_Text_Indent;
-        if (14 == len && str::EqNI(name + 4, "-underline", 10)) return Css_Text_Underline;
-        break;
-    case CS4('w','h','i','t'):
-        if (11 == len && str::EqNI(name + 4, "e-space", 7)) return Css_White_Space;
-        break;
-    case CS4('w','o','r','d'):
-        if (9 == len && str::EqNI(name + 4, "-wrap", 5)) return Css_Word_Wrap;
-        break;
-    }
+    if (0 == len)
+        return Css_Unknown;
+    uint32_t key = 1 == len ? KEY1i(name) : KEYi(name, len);
+    uint32_t slot = SLOT(key, gCssPropDisp[SLOT(key, 0, 3)], 5);
+    if (len == gCssPropTable[slot].len && str::EqNI(gCssPropTable[slot].name, name, len))
+        return gCssPropTable[slot].value;
     return Css_Unknown;
 }
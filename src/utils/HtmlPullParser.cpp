@@ -4,6 +4,9 @@
 #include "BaseUtil.h"
 #include "HtmlPullParser.h"
 
+#include <emmintrin.h>
+#include <intrin.h>
+
 // returns -1 if didn't find
 int HtmlEntityNameToRune(const char *name, size_t nameLen)
 {
@@ -30,20 +33,45 @@ int HtmlEntityNameToRune(const WCHAR *name, size_t nameLen)
     return FindHtmlEntityRune(asciiName, nameLen);
 }
 
-bool SkipUntil(const char*& s, const char *end, char c)
+// returns the first occurrence of either c1, c2 or c3 in [s, end) or end
+// (text between tags is usually long enough for comparing blocks of
+// 16 characters at once with SSE2 to pay off)
+static const char *FindCharOf(const char *s, const char *end, char c1, char c2, char c3)
 {
-    while ((s < end) && (*s != c)) {
-        ++s;
+    if (HasSSE2()) {
+        __m128i v1 = _mm_set1_epi8(c1);
+        __m128i v2 = _mm_set1_epi8(c2);
+        __m128i v3 = _mm_set1_epi8(c3);
+        for (; end - s >= 16; s += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)s);
+            __m128i found = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, v1), _mm_cmpeq_epi8(block, v2)),
+                                         _mm_cmpeq_epi8(block, v3));
+            unsigned int mask = _mm_movemask_epi8(found);
+            if (mask) {
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                return s + bit;
+            }
+        }
     }
+
+    for (; s < end && *s != c1 && *s != c2 && *s != c3; s++);
+    return s;
+}
+
+bool SkipUntil(const char*& s, const char *end, char c)
+{
+    s = FindCharOf(s, end, c, c, c);
     return *s == c;
 }
 
 bool SkipUntil(const char*& s, const char *end, char *term)
 {
     size_t len = str::Len(term);
-    for (; s < end; s++) {
+    while ((s = FindCharOf(s, end, *term, *term, *term)) < end) {
         if (s + len <= end && str::StartsWith(s, term))
             return true;
+        s++;
     }
     return false;
 }
@@ -347,17 +375,15 @@ NoNextAttr:
 // Returns false if didn't find
 static bool SkipUntilTagEnd(const char*& s, const char *end)
 {
-    while (s < end) {
+    while ((s = FindCharOf(s, end, '>', '\'', '"')) < end) {
         char c = *s++;
         if ('>' == c) {
             --s;
             return true;
         }
-        if (('\'' == c) || ('"' == c)) {
-            if (!SkipUntil(s, end, c))
-                return false;
-            ++s;
-        }
+        if (!SkipUntil(s, end, c))
+            return false;
+        ++s;
     }
     return false;
 }
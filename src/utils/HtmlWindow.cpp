@@ -254,7 +254,7 @@ public:
     HW_IInternetProtocol() : refCount(1), data(NULL), dataLen(0), dataCurrPos(0) { }
 
 protected:
-    virtual ~HW_IInternetProtocol() { }
+    virtual ~HW_IInternetProtocol() { free(data); }
 
 public:
     // IUnknown
@@ -282,8 +282,9 @@ protected:
     LONG refCount;
 
     // those are filled in Start() and represent data to be sent
-    // for a given url
-    const unsigned char *data;
+    // for a given url (data is a copy, as the HtmlWindowCallback
+    // is free to discard its own data before it's been read)
+    unsigned char *data;
     size_t dataLen;
     size_t dataCurrPos;
 };
@@ -400,9 +401,12 @@ STDMETHODIMP HW_IInternetProtocol::Start(
         return INET_E_OBJECT_NOT_FOUND;
     if (!win->htmlWinCb)
         return INET_E_OBJECT_NOT_FOUND;
-    data = win->htmlWinCb->GetDataForUrl(urlRest, &dataLen);
-    if (!data)
+    const unsigned char *cbData = win->htmlWinCb->GetDataForUrl(urlRest, &dataLen);
+    if (!cbData)
         return INET_E_DATA_NOT_AVAILABLE;
+    data = (unsigned char *)memdup(cbData, dataLen);
+    if (!data)
+        return E_OUTOFMEMORY;
 
     const WCHAR *imgExt = GfxFileExtFromData((const char *)data, dataLen);
     ScopedMem<WCHAR> mime(MimeFromUrl(urlRest, imgExt));
@@ -22,6 +22,7 @@ public:
 
     // allows for providing data for a given url.
     // returning NULL means data wasn't provided.
+    // the data is copied, so it only has to remain valid until the next call
     virtual const unsigned char *GetDataForUrl(const WCHAR *url, size_t *len) = 0;
 
     // called when left mouse button is clicked in the web control window.
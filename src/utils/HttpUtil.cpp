@@ -48,29 +48,66 @@ Error:
     goto Exit;
 }
 
-// Download content of a url to a file
-bool HttpGetToFile(const WCHAR *url, const WCHAR *destFilePath)
+#define DOWNLOAD_CHUNK_SIZE (64 * 1024)
+
+// Download content of a url to a file, writing the data to disk as it arrives
+// (so that the partial file can be used while the download is in progress).
+// If resume is true and destFilePath already contains the beginning of the
+// content (e.g. from an interrupted download), only the remainder is requested
+// and a partial file is kept on failure so that the download can be resumed
+bool HttpGetToFile(const WCHAR *url, const WCHAR *destFilePath, HttpProgressCallback *progress, bool resume)
 {
     bool ok = false;
-    char buf[1024];
+    char *buf = NULL;
     HINTERNET hFile = NULL, hInet = NULL;
+    ScopedMem<WCHAR> rangeHeader;
+    size_t downloaded = 0, total = 0;
+    DWORD statusCode = 0, contentLength = 0, infoSize;
+    LARGE_INTEGER fileSize;
 
     HANDLE hf = CreateFile(destFilePath, GENERIC_WRITE, FILE_SHARE_READ, NULL,
-            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,  NULL);
+            resume ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,  NULL);
     if (INVALID_HANDLE_VALUE == hf)
         goto Exit;
 
+    if (resume && GetFileSizeEx(hf, &fileSize) && fileSize.QuadPart > 0) {
+        downloaded = (size_t)fileSize.QuadPart;
+        rangeHeader.Set(str::Format(L"Range: bytes=%Iu-\r\n", downloaded));
+    }
+
     hInet = InternetOpen(USER_AGENT, INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0);
     if (!hInet)
         goto Exit;
 
-    hFile = InternetOpenUrl(hInet, url, NULL, 0, 0, 0);
+    hFile = InternetOpenUrl(hInet, url, rangeHeader, rangeHeader ? (DWORD)-1 : 0, 0, 0);
     if (!hFile)
         goto Exit;
 
+    infoSize = sizeof(statusCode);
+    if (!HttpQueryInfo(hFile, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &statusCode, &infoSize, 0))
+        statusCode = 0; // not an http(s) url
+    if (statusCode >= 400)
+        goto Exit;
+    if (downloaded > 0 && statusCode != 206) {
+        // the server sends the whole content again, so start over
+        downloaded = 0;
+        if (!SetEndOfFile(hf))
+            goto Exit;
+    }
+    else if (downloaded > 0 && INVALID_SET_FILE_POINTER == SetFilePointer(hf, 0, NULL, FILE_END))
+        goto Exit;
+
+    infoSize = sizeof(contentLength);
+    if (HttpQueryInfo(hFile, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER, &contentLength, &infoSize, 0))
+        total = downloaded + contentLength;
+
+    buf = AllocArray<char>(DOWNLOAD_CHUNK_SIZE);
+    if (!buf)
+        goto Exit;
+
     DWORD dwRead;
     for (;;) {
-        if (!InternetReadFile(hFile, buf, sizeof(buf), &dwRead))
+        if (!InternetReadFile(hFile, buf, DOWNLOAD_CHUNK_SIZE, &dwRead))
             goto Exit;
         if (dwRead == 0)
             break;
@@ -82,16 +119,21 @@ bool HttpGetToFile(const WCHAR *url, const WCHAR *destFilePath)
 
         if (size != dwRead)
             goto Exit;
+
+        downloaded += dwRead;
+        if (progress && !progress->Progress(downloaded, total))
+            goto Exit;
     }
 
     ok = true;
 Exit:
+    free(buf);
     CloseHandle(hf);
     if (hFile)
         InternetCloseHandle(hFile);
     if (hInet)
         InternetCloseHandle(hInet);
-    if (!ok)
+    if (!ok && !resume)
         file::Delete(destFilePath);
     return ok;
 }
@@ -4,9 +4,16 @@
 #ifndef HttpUtil_h
 #define HttpUtil_h
 
+class HttpProgressCallback {
+public:
+    // called whenever another chunk has been written to disk (total is 0
+    // if the server didn't send a Content-Length); return false to abort
+    virtual bool Progress(size_t downloaded, size_t total) = 0;
+};
+
 bool  HttpPost(const WCHAR *server, const WCHAR *url, str::Str<char> *headers, str::Str<char> *data);
 DWORD HttpGet(const WCHAR *url, str::Str<char> *dataOut);
-bool  HttpGetToFile(const WCHAR *url, const WCHAR *destFilePath);
+bool  HttpGetToFile(const WCHAR *url, const WCHAR *destFilePath, HttpProgressCallback *progress=NULL, bool resume=false);
 
 class HttpReqCallback;
 
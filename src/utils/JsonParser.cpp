@@ -6,11 +6,20 @@
 
 namespace json {
 
-static inline const char *SkipWS(const char *s)
+static int HexValue(char c)
 {
-    while (str::IsWs(*s))
-        s++;
-    return s;
+    if ('0' <= c && c <= '9')
+        return c - '0';
+    if ('a' <= c && c <= 'f')
+        return c - 'a' + 10;
+    if ('A' <= c && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static inline bool IsNumberChar(char c)
+{
+    return str::IsDigit(c) || '-' == c || '+' == c || '.' == c || 'e' == c || 'E' == c;
 }
 
 static inline const char *SkipDigits(const char *s)
@@ -20,194 +29,310 @@ static inline const char *SkipDigits(const char *s)
     return s;
 }
 
-class ParseArgs {
-public:
-    str::Str<char> path;
-    bool canceled;
-    ValueVisitor *visitor;
-
-    ParseArgs(ValueVisitor *visitor) : canceled(false), visitor(visitor) { }
-};
+static bool IsValidNumber(const char *s)
+{
+    // integer part
+    if ('-' == *s)
+        s++;
+    if ('0' == *s)
+        s++;
+    else if (str::IsDigit(*s))
+        s = SkipDigits(s + 1);
+    else
+        return false;
+    // fractional part
+    if ('.' == *s) {
+        if (!str::IsDigit(*++s))
+            return false;
+        s = SkipDigits(s);
+    }
+    // magnitude
+    if ('e' == *s || 'E' == *s) {
+        s++;
+        if ('+' == *s || '-' == *s)
+            s++;
+        if (!str::IsDigit(*s))
+            return false;
+        s = SkipDigits(s);
+    }
+    return !*s;
+}
 
-static const char *ParseValue(ParseArgs& args, const char *data);
+StreamParser::StreamParser(ValueVisitor *visitor) :
+    visitor(visitor), state(State_Start), isKey(false), matched(0),
+    keyword(NULL), keywordType(Type_Null), codepoint(0) { }
 
-static const char *ExtractString(str::Str<char>& string, const char *data)
+void StreamParser::Emit(const char *val, DataType type)
 {
-    while (*++data) {
-        if ('"' == *data)
-            return data + 1;
-        if ('\\' != *data) {
-            string.Append(*data);
-            continue;
-        }
-        // parse escape sequence
-        int i;
-        switch (*++data) {
-            case '"': case '\\': case '/':
-                string.Append(*data);
-                break;
-            case 'b': string.Append('\b'); break;
-            case 'f': string.Append('\f'); break;
-            case 'n': string.Append('\n'); break;
-            case 'r': string.Append('\r'); break;
-            case 't': string.Append('\t'); break;
-            case 'u':
-                if (str::Parse(data + 1, "%4x", &i) && 0 < i && i < 0x10000) {
-                    char buf[5] = { 0 };
-                    wchar_t c = (wchar_t)i;
-                    WideCharToMultiByte(CP_UTF8, 0, &c, 1, buf, dimof(buf), NULL, NULL);
-                    string.Append(buf);
-                    data += 4;
-                    break;
-                }
-                return NULL;
-            default:
-                return NULL;
-        }
-    }
-    return NULL;
+    if (!visitor->Visit(path.Get(), val, type))
+        state = State_Canceled;
 }
 
-static const char *ParseString(ParseArgs& args, const char *data)
+void StreamParser::StartValue()
 {
-    str::Str<char> string;
-    data = ExtractString(string, data);
-    if (data)
-        args.canceled = !args.visitor->Visit(args.path.Get(), string.Get(), Type_String);
-    return data;
+    value.Reset();
 }
 
-static const char *ParseNumber(ParseArgs& args, const char *data)
+void StreamParser::EndValue()
 {
-    const char *start = data;
-    // integer part
-    if ('-' == *data)
-        data++;
-    if ('0' == *data)
-        data++;
-    else if (str::IsDigit(*data))
-        data = SkipDigits(data + 1);
-    else
-        return NULL;
-    // fractional part
-    if ('.' == *data)
-        data = SkipDigits(data + 1);
-    // magnitude
-    if ('e' == *data || 'E' == *data) {
-        data++;
-        if ('+' == *data || '-' == *data)
-            data++;
-        data = SkipDigits(data + 1);
-    }
-    // validity check
-    if (!str::IsDigit(*(data - 1)) || str::IsDigit(*data))
-        return NULL;
-
-    char *number = str::DupN(start, data - start);
-    args.canceled = !args.visitor->Visit(args.path.Get(), number, Type_Number);
-    free(number);
-    return data;
+    if (State_Canceled == state)
+        return;
+    if (stack.Count() > 0)
+        path.RemoveAt(stack.Last().pathLen, path.Size() - stack.Last().pathLen);
+    state = stack.Count() > 0 ? State_AfterValue : State_End;
 }
 
-static const char *ParseObject(ParseArgs& args, const char *data)
+void StreamParser::EndNumber()
 {
-    data = SkipWS(data + 1);
-    if ('}' == *data)
-        return data + 1;
-
-    size_t pathIdx = args.path.Size();
-    for (;;) {
-        data = SkipWS(data);
-        if ('"' != *data)
-            return NULL;
-        args.path.Append('/');
-        data = ExtractString(args.path, data);
-        if (!data)
-            return NULL;
-        data = SkipWS(data);
-        if (':' != *data)
-            return NULL;
-
-        data = ParseValue(args, data + 1);
-        if (args.canceled || !data)
-            return data;
-        args.path.RemoveAt(pathIdx, args.path.Size() - pathIdx);
-
-        data = SkipWS(data);
-        if ('}' == *data)
-            return data + 1;
-        if (',' != *data)
-            return NULL;
-        data++;
+    if (!IsValidNumber(value.Get())) {
+        state = State_Error;
+        return;
     }
+    Emit(value.Get(), Type_Number);
+    EndValue();
 }
 
-static const char *ParseArray(ParseArgs& args, const char *data)
+// returns false once parsing can't continue
+bool StreamParser::Process(char c)
 {
-    data = SkipWS(data + 1);
-    if (']' == *data)
-        return data + 1;
-
-    size_t pathIdx = args.path.Size();
-    for (int idx = 0; ; idx++) {
-        args.path.AppendFmt("[%d]", idx);
-        data = ParseValue(args, data);
-        if (args.canceled || !data)
-            return data;
-        args.path.RemoveAt(pathIdx, args.path.Size() - pathIdx);
-
-        data = SkipWS(data);
-        if (']' == *data)
-            return data + 1;
-        if (',' != *data)
-            return NULL;
-        data++;
+    switch (state) {
+    case State_Start:
+        // skip the UTF-8 BOM
+        if (matched < 3 && c == UTF8_BOM[matched]) {
+            matched++;
+            return true;
+        }
+        if (matched > 0 && matched < 3) {
+            state = State_Error;
+            return false;
+        }
+        state = State_Value;
+        return Process(c);
+
+    case State_Value:
+        if (str::IsWs(c))
+            return true;
+        StartValue();
+        switch (c) {
+        case '"':
+            isKey = false;
+            state = State_String;
+            return true;
+        case '0': case '1': case '2': case '3':
+        case '4': case '5': case '6': case '7':
+        case '8': case '9': case '-':
+            value.Append(c);
+            state = State_Number;
+            return true;
+        case '{': {
+            Container obj = { '{', path.Size(), 0 };
+            stack.Append(obj);
+            state = State_ObjectStart;
+            return true;
+        }
+        case '[': {
+            Container arr = { '[', path.Size(), 0 };
+            stack.Append(arr);
+            path.Append("[0]");
+            state = State_ArrayStart;
+            return true;
+        }
+        case 't': keyword = "true"; keywordType = Type_Bool; break;
+        case 'f': keyword = "false"; keywordType = Type_Bool; break;
+        case 'n': keyword = "null"; keywordType = Type_Null; break;
+        default:
+            state = State_Error;
+            return false;
+        }
+        matched = 1;
+        state = State_Keyword;
+        return true;
+
+    case State_String:
+        if ('"' == c) {
+            if (isKey) {
+                state = State_Colon;
+                return true;
+            }
+            Emit(value.Get(), Type_String);
+            EndValue();
+        }
+        else if ('\\' == c)
+            state = State_Escape;
+        else
+            (isKey ? path : value).Append(c);
+        return state != State_Canceled;
+
+    case State_Escape: {
+        str::Str<char>& string = isKey ? path : value;
+        switch (c) {
+        case '"': case '\\': case '/':
+            string.Append(c);
+            break;
+        case 'b': string.Append('\b'); break;
+        case 'f': string.Append('\f'); break;
+        case 'n': string.Append('\n'); break;
+        case 'r': string.Append('\r'); break;
+        case 't': string.Append('\t'); break;
+        case 'u':
+            matched = 0;
+            codepoint = 0;
+            state = State_Unicode;
+            return true;
+        default:
+            state = State_Error;
+            return false;
+        }
+        state = State_String;
+        return true;
+    }
+
+    case State_Unicode:
+        if (HexValue(c) < 0) {
+            state = State_Error;
+            return false;
+        }
+        codepoint = codepoint * 16 + HexValue(c);
+        if (++matched < 4)
+            return true;
+        if (0 == codepoint) {
+            state = State_Error;
+            return false;
+        }
+        {
+            char buf[5] = { 0 };
+            wchar_t wc = (wchar_t)codepoint;
+            WideCharToMultiByte(CP_UTF8, 0, &wc, 1, buf, dimof(buf), NULL, NULL);
+            (isKey ? path : value).Append(buf);
+        }
+        state = State_String;
+        return true;
+
+    case State_Number:
+        if (IsNumberChar(c)) {
+            value.Append(c);
+            return true;
+        }
+        EndNumber();
+        if (State_Error == state || State_Canceled == state)
+            return false;
+        return Process(c);
+
+    case State_Keyword:
+        if (c != keyword[matched]) {
+            state = State_Error;
+            return false;
+        }
+        if (keyword[++matched])
+            return true;
+        Emit(keyword, keywordType);
+        EndValue();
+        return state != State_Canceled;
+
+    case State_AfterValue:
+        if (str::IsWs(c))
+            return true;
+        if ('{' == stack.Last().type) {
+            if (',' == c) {
+                state = State_Key;
+                return true;
+            }
+            if ('}' == c) {
+                stack.Pop();
+                EndValue();
+                return true;
+            }
+        }
+        else {
+            if (',' == c) {
+                Container& arr = stack.Last();
+                path.AppendFmt("[%d]", ++arr.arrayIdx);
+                state = State_Value;
+                return true;
+            }
+            if (']' == c) {
+                stack.Pop();
+                EndValue();
+                return true;
+            }
+        }
+        state = State_Error;
+        return false;
+
+    case State_ObjectStart:
+        if ('}' == c) {
+            stack.Pop();
+            EndValue();
+            return true;
+        }
+        // fall through
+    case State_Key:
+        if (str::IsWs(c))
+            return true;
+        if ('"' != c) {
+            state = State_Error;
+            return false;
+        }
+        path.Append('/');
+        isKey = true;
+        state = State_String;
+        return true;
+
+    case State_Colon:
+        if (str::IsWs(c))
+            return true;
+        if (':' != c) {
+            state = State_Error;
+            return false;
+        }
+        state = State_Value;
+        return true;
+
+    case State_ArrayStart:
+        if (str::IsWs(c))
+            return true;
+        if (']' == c) {
+            path.RemoveAt(stack.Last().pathLen, path.Size() - stack.Last().pathLen);
+            stack.Pop();
+            EndValue();
+            return true;
+        }
+        state = State_Value;
+        return Process(c);
+
+    case State_End:
+        if (str::IsWs(c))
+            return true;
+        state = State_Error;
+        return false;
+
+    default:
+        return false;
     }
 }
 
-static const char *ParseKeyword(ParseArgs& args, const char *data,
-                                const char *keyword, DataType type)
+bool StreamParser::Feed(const char *data, size_t len)
 {
-    if (!str::StartsWith(data, keyword))
-        return NULL;
-    args.canceled = !args.visitor->Visit(args.path.Get(), keyword, type);
-    return data + str::Len(keyword);
+    for (size_t i = 0; i < len; i++) {
+        if (!Process(data[i]))
+            return false;
+    }
+    return state != State_Error && state != State_Canceled;
 }
 
-static const char *ParseValue(ParseArgs& args, const char *data)
+bool StreamParser::Finish()
 {
-    data = SkipWS(data);
-    switch (*data) {
-    case '"':
-        return ParseString(args, data);
-    case '0': case '1': case '2': case '3':
-    case '4': case '5': case '6': case '7':
-    case '8': case '9': case '-':
-        return ParseNumber(args, data);
-    case '{':
-        return ParseObject(args, data);
-    case '[':
-        return ParseArray(args, data);
-    case 't':
-        return ParseKeyword(args, data, "true", Type_Bool);
-    case 'f':
-        return ParseKeyword(args, data, "false", Type_Bool);
-    case 'n':
-        return ParseKeyword(args, data, "null", Type_Null);
-    default:
-        return NULL;
-    }
+    // a number at the end of the data hasn't been terminated yet
+    if (State_Number == state)
+        EndNumber();
+    return State_End == state || State_Canceled == state;
 }
 
 bool Parse(const char *data, ValueVisitor *visitor)
 {
-    ParseArgs args(visitor);
-    if (str::StartsWith(data, UTF8_BOM))
-        data += 3;
-    const char *end = ParseValue(args, data);
-    if (!end)
-        return false;
-    return args.canceled || !*SkipWS(end);
+    StreamParser parser(visitor);
+    parser.Feed(data, str::Len(data));
+    return parser.Finish();
 }
 
 }
@@ -29,6 +29,58 @@ public:
 // returns false on error
 bool Parse(const char *data, ValueVisitor *visitor);
 
+// incremental parser for data that is read in chunks (e.g. large files):
+// only the path to the current value and the current value itself are
+// held in memory, so memory use doesn't grow with the size of the data
+
+// paths and values are guaranteed not to contain NUL characters
+// (the escape sequence \u0000 is rejected)
+
+class StreamParser {
+    enum State {
+        State_Start, State_Value, State_String, State_Escape, State_Unicode,
+        State_Number, State_Keyword, State_AfterValue, State_ObjectStart,
+        State_Key, State_Colon, State_ArrayStart, State_End,
+        State_Error, State_Canceled
+    };
+    struct Container {
+        // '{' or '['
+        char type;
+        // length of the path to the container
+        size_t pathLen;
+        int arrayIdx;
+    };
+
+    ValueVisitor *visitor;
+    State state;
+    Vec<Container> stack;
+    str::Str<char> path;
+    str::Str<char> value;
+    // whether the current string is a dictionary key (collected into path)
+    bool isKey;
+    // UTF-8 BOM bytes or keyword characters or \u digits matched so far
+    size_t matched;
+    const char *keyword;
+    DataType keywordType;
+    int codepoint;
+
+    bool Process(char c);
+    void Emit(const char *val, DataType type);
+    void StartValue();
+    void EndValue();
+    void EndNumber();
+
+public:
+    explicit StreamParser(ValueVisitor *visitor);
+
+    // data must be UTF-8 encoded and can be split at any byte
+    // returns false on error or after the visitor has stopped parsing
+    bool Feed(const char *data, size_t len);
+    // to be called after all the data has been fed
+    // returns false on error (same as Parse)
+    bool Finish();
+};
+
 }
 
 #endif
@@ -38,13 +38,51 @@ struct PdbRecordHeader {
 STATIC_ASSERT(sizeof(PdbHeader) == kPdbHeaderLen, pdbHeaderSize);
 STATIC_ASSERT(sizeof(PdbRecordHeader) == 8, pdbRecHeaderSize);
 
-PdbReader::PdbReader(const WCHAR *filePath) :
-    data(file::ReadAll(filePath, &dataSize))
+PdbReader::PdbReader(const WCHAR *filePath) : data(NULL), dataSize(0), hMap(NULL)
 {
+    if (!MapFile(filePath)) {
+        dataCopy.Set(file::ReadAll(filePath, &dataSize));
+        data = dataCopy;
+    }
     if (!ParseHeader())
         recOffsets.Reset();
 }
 
+PdbReader::~PdbReader()
+{
+    if (hMap) {
+        UnmapViewOfFile(data);
+        CloseHandle(hMap);
+    }
+}
+
+// cf. fz_open_file_mapped in PdfEngine.cpp
+bool PdbReader::MapFile(const WCHAR *filePath)
+{
+    // allow other programs to still modify and delete the file
+    ScopedHandle hFile(CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+    if (INVALID_HANDLE_VALUE == hFile)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0 || (uint64_t)size.QuadPart > SIZE_MAX)
+        return false;
+
+    // the mapping keeps the file open as long as it's needed
+    hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap)
+        data = (const char *)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        // e.g. due to a lack of address space
+        if (hMap)
+            CloseHandle(hMap);
+        hMap = NULL;
+        return false;
+    }
+    dataSize = (size_t)size.QuadPart;
+    return true;
+}
+
 bool PdbReader::ParseHeader()
 {
     CrashIf(recOffsets.Count() > 0);
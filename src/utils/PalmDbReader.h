@@ -8,21 +8,29 @@
 #define kPdbHeaderLen 78
 
 class PdbReader {
-    ScopedMem<char> data;
+    // the file is memory mapped (so that only the records that are
+    // actually accessed are read from disk) or, if mapping it fails,
+    // read into dataCopy
+    const char *    data;
     size_t          dataSize;
+    HANDLE          hMap;
+    ScopedMem<char> dataCopy;
     // offset of each pdb record within the file + a sentinel
     // value equal to file size to simplify use
     Vec<uint32_t>   recOffsets;
     // cache so that we can compare with str::Eq
     char            dbType[9];
 
+    bool MapFile(const WCHAR *filePath);
     bool ParseHeader();
 
 public:
     PdbReader(const WCHAR *filePath);
+    ~PdbReader();
 
     const char *GetDbType();
     size_t GetRecordCount();
+    // the returned data is read-only and valid for the lifetime of the reader
     const char *GetRecord(size_t recNo, size_t *sizeOut);
 };
 
@@ -0,0 +1,115 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "RectIndex.h"
+
+// don't bother with a grid for only a few rectangles
+#define MIN_RECTS_FOR_GRID      16
+#define MAX_GRID_CELLS_PER_AXIS 64
+
+void RectIndex::Append(RectD rect, void *userData)
+{
+    CrashIf(built);
+    rects.Append(rect);
+    data.Append(userData);
+}
+
+int RectIndex::Col(double x) const
+{
+    return limitValue((int)((x - bounds.x) / cellDx), 0, cols - 1);
+}
+
+int RectIndex::Row(double y) const
+{
+    return limitValue((int)((y - bounds.y) / cellDy), 0, rows - 1);
+}
+
+void RectIndex::Build()
+{
+    CrashIf(built);
+    built = true;
+    // rectangles with negative width or height never contain a point
+    // (while RectD::Union would also ignore those with zero width or height)
+    bool empty = true;
+    double x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    for (size_t i = 0; i < rects.Count(); i++) {
+        RectD rc = rects.At(i);
+        if (rc.dx < 0 || rc.dy < 0)
+            continue;
+        if (empty) {
+            x0 = rc.x; x1 = rc.x + rc.dx;
+            y0 = rc.y; y1 = rc.y + rc.dy;
+        }
+        x0 = min(x0, rc.x); x1 = max(x1, rc.x + rc.dx);
+        y0 = min(y0, rc.y); y1 = max(y1, rc.y + rc.dy);
+        empty = false;
+    }
+    bounds = RectD(x0, y0, x1 - x0, y1 - y0);
+
+    cols = rows = 1;
+    if (!empty && rects.Count() >= MIN_RECTS_FOR_GRID) {
+        // aim for about two rectangles per cell
+        double cells = rects.Count() / 2.0;
+        double aspect = max(bounds.dx, 1.0) / max(bounds.dy, 1.0);
+        cols = limitValue((int)sqrt(cells * aspect), 1, MAX_GRID_CELLS_PER_AXIS);
+        rows = limitValue((int)(cells / cols), 1, MAX_GRID_CELLS_PER_AXIS);
+    }
+    cellDx = max(bounds.dx / cols, 1.0);
+    cellDy = max(bounds.dy / rows, 1.0);
+
+    cellStart = AllocArray<int>(cols * rows + 1);
+    ScopedMem<int> fill(AllocArray<int>(cols * rows));
+    if (!cellStart || !fill) {
+        // fall back to testing all rectangles
+        cols = rows = 0;
+        return;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < rects.Count(); i++) {
+            RectD rc = rects.At(i);
+            if (rc.dx < 0 || rc.dy < 0)
+                continue;
+            for (int row = Row(rc.y); row <= Row(rc.y + rc.dy); row++) {
+                for (int col = Col(rc.x); col <= Col(rc.x + rc.dx); col++) {
+                    int cell = row * cols + col;
+                    if (0 == pass)
+                        cellStart[cell + 1]++;
+                    else
+                        cellRects[cellStart[cell] + fill[cell]++] = (int)i;
+                }
+            }
+        }
+        if (0 == pass) {
+            for (int cell = 0; cell < cols * rows; cell++) {
+                cellStart[cell + 1] += cellStart[cell];
+            }
+            cellRects = AllocArray<int>(max(cellStart[cols * rows], 1));
+            if (!cellRects) {
+                cols = rows = 0;
+                return;
+            }
+        }
+    }
+}
+
+int RectIndex::Find(PointD pt) const
+{
+    CrashIf(!built);
+
+    if (0 == cols) {
+        for (size_t i = 0; i < rects.Count(); i++) {
+            if (rects.At(i).Contains(pt))
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // points outside of bounds map to a border cell
+    int cell = Row(pt.y) * cols + Col(pt.x);
+    for (int j = cellStart[cell]; j < cellStart[cell + 1]; j++) {
+        if (rects.At(cellRects[j]).Contains(pt))
+            return cellRects[j];
+    }
+    return -1;
+}
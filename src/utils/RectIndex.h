@@ -0,0 +1,49 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifndef RectIndex_h
+#define RectIndex_h
+
+/* Spatial index for quickly finding which of many rectangles (e.g.
+   a page's links) contains a given point. Rectangles are bucketed
+   into a regular grid of cells, so that a lookup only has to test
+   the rectangles overlapping the point's cell.
+
+   Usage: Append() all rectangles, Build() and then Find() as often
+   as needed (Find() is safe to call from several threads). */
+class RectIndex {
+    Vec<RectD>  rects;
+    Vec<void *> data;
+    bool        built;
+
+    RectD   bounds;
+    int     cols, rows;
+    double  cellDx, cellDy;
+    // the rectangles overlapping cell i are cellRects[cellStart[i]]
+    // to cellRects[cellStart[i + 1] - 1] (in ascending order)
+    int   * cellStart;
+    int   * cellRects;
+
+    int Col(double x) const;
+    int Row(double y) const;
+
+public:
+    RectIndex() : built(false), cols(0), rows(0), cellDx(1), cellDy(1), cellStart(NULL), cellRects(NULL) { }
+    ~RectIndex() {
+        free(cellStart);
+        free(cellRects);
+    }
+
+    void Append(RectD rect, void *userData=NULL);
+    // must be called after the last Append()
+    void Build();
+
+    // returns the index of the first appended rectangle containing pt or -1
+    int Find(PointD pt) const;
+
+    size_t Count() const { return rects.Count(); }
+    RectD RectAt(size_t idx) const { return rects.At(idx); }
+    void *DataAt(size_t idx) const { return data.At(idx); }
+};
+
+#endif
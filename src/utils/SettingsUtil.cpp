@@ -511,12 +511,279 @@ static void *DeserializeStructBencRec(const StructInfo *info, BencDict *dict, ui
     return base;
 }
 
-void *DeserializeStructBenc(const StructInfo *info, const char *data, void *strct, CompactCallback cb)
+void *DeserializeStructBenc(const StructInfo *info, char *data, void *strct, CompactCallback cb)
 {
     void *result = NULL;
-    BencObj *root = BencObj::Decode(data);
+    BencObj *root = BencObj::DecodeInPlace(data);
     if (root && BT_DICT == root->Type())
         result = DeserializeStructBencRec(info, static_cast<BencDict *>(root), (uint8_t *)strct, cb);
     delete root;
     return result;
 }
+
+/* Binary snapshots are a faster alternative to the text serialization
+   for caching settings. Each struct is written as the number of its
+   fields followed by the fields' values in order (fields missing at the
+   end are set to their defaults when deserializing). The data is only
+   meant to be read back by the same build, which callers should assert
+   through GetStructInfoHash. */
+
+#define BIN_NULL_STRING ((uint32_t)-1)
+
+class BinReader {
+    const char *data;
+    size_t left;
+
+public:
+    bool ok;
+
+    BinReader(const char *data, size_t len) : data(data), left(len), ok(true) { }
+
+    const char *Read(size_t len) {
+        if (!ok || len > left) {
+            ok = false;
+            return NULL;
+        }
+        const char *d = data;
+        data += len;
+        left -= len;
+        return d;
+    }
+    template <typename T>
+    T Get() {
+        T value = 0;
+        const char *d = Read(sizeof(T));
+        if (d)
+            memcpy(&value, d, sizeof(T));
+        return value;
+    }
+    size_t Left() const { return left; }
+};
+
+template <typename T>
+static inline void AppendBin(str::Str<char>& out, T value)
+{
+    out.Append((const char *)&value, sizeof(T));
+}
+
+static void SerializeStructBinRec(str::Str<char>& out, const StructInfo *info, const uint8_t *base);
+
+static void SerializeFieldBin(str::Str<char>& out, const uint8_t *base, const FieldInfo& field)
+{
+    const uint8_t *fieldPtr = base + field.offset;
+    float f;
+
+    switch (field.type) {
+    case Type_Struct: case Type_Compact:
+        SerializeStructBinRec(out, GetSubstruct(field), fieldPtr);
+        break;
+    case Type_Prerelease:
+#if !(defined(SVN_PRE_RELEASE_VER) || defined(DEBUG))
+        // mirror the text serialization which skips these (so that they're reset to defaults)
+        AppendBin(out, (uint16_t)0);
+#else
+        SerializeStructBinRec(out, GetSubstruct(field), fieldPtr);
+#endif
+        break;
+    case Type_Array:
+        if (!*(Vec<void *> **)fieldPtr) {
+            AppendBin(out, (uint32_t)0);
+            break;
+        }
+        AppendBin(out, (uint32_t)(*(Vec<void *> **)fieldPtr)->Count());
+        for (size_t i = 0; i < (*(Vec<void *> **)fieldPtr)->Count(); i++) {
+            SerializeStructBinRec(out, GetSubstruct(field), (const uint8_t *)(*(Vec<void *> **)fieldPtr)->At(i));
+        }
+        break;
+    case Type_Bool:
+        AppendBin(out, (uint8_t)(*(bool *)fieldPtr ? 1 : 0));
+        break;
+    case Type_Color: case Type_Int:
+        AppendBin(out, *(int *)fieldPtr);
+        break;
+    case Type_Float:
+        // round the same way as the text serialization does
+        f = *(float *)fieldPtr;
+        str::Parse(ScopedMem<char>(str::Format("%g", f)), "%f", &f);
+        AppendBin(out, f);
+        break;
+    case Type_String:
+        if (!*(const WCHAR **)fieldPtr) {
+            AppendBin(out, BIN_NULL_STRING);
+            break;
+        }
+        AppendBin(out, (uint32_t)str::Len(*(const WCHAR **)fieldPtr));
+        out.Append((const char *)*(const WCHAR **)fieldPtr, str::Len(*(const WCHAR **)fieldPtr) * sizeof(WCHAR));
+        break;
+    case Type_Utf8String:
+        if (!*(const char **)fieldPtr) {
+            AppendBin(out, BIN_NULL_STRING);
+            break;
+        }
+        AppendBin(out, (uint32_t)str::Len(*(const char **)fieldPtr));
+        out.Append(*(const char **)fieldPtr, str::Len(*(const char **)fieldPtr));
+        break;
+    case Type_ColorArray: case Type_FloatArray: case Type_IntArray:
+        AppendBin(out, (uint32_t)(*(Vec<int> **)fieldPtr)->Count());
+        for (size_t i = 0; i < (*(Vec<int> **)fieldPtr)->Count(); i++) {
+            FieldInfo info = { 0 };
+            info.type = Type_IntArray == field.type ? Type_Int : Type_FloatArray == field.type ? Type_Float : Type_Color;
+            SerializeFieldBin(out, (const uint8_t *)&(*(Vec<int> **)fieldPtr)->At(i), info);
+        }
+        break;
+    case Type_Comment:
+        break;
+    default:
+        CrashIf(true);
+    }
+}
+
+static void SerializeStructBinRec(str::Str<char>& out, const StructInfo *info, const uint8_t *base)
+{
+    AppendBin(out, info->fieldCount);
+    for (size_t i = 0; i < info->fieldCount; i++) {
+        SerializeFieldBin(out, base, info->fields[i]);
+    }
+}
+
+static void DeserializeStructBinRec(BinReader& r, const StructInfo *info, uint8_t *base, bool useDefaults=false);
+
+static void DeserializeFieldBin(BinReader& r, const FieldInfo& field, uint8_t *base)
+{
+    uint8_t *fieldPtr = base + field.offset;
+    uint32_t len;
+    const char *s;
+
+    switch (field.type) {
+    case Type_Struct: case Type_Compact: case Type_Prerelease:
+        DeserializeStructBinRec(r, GetSubstruct(field), fieldPtr);
+        break;
+    case Type_Array:
+        len = r.Get<uint32_t>();
+        *(Vec<void *> **)fieldPtr = new Vec<void *>();
+        for (uint32_t i = 0; i < len && r.ok; i++) {
+            // append before deserializing so that partial data is freed on failure
+            uint8_t *item = AllocArray<uint8_t>(GetSubstruct(field)->structSize);
+            (*(Vec<void *> **)fieldPtr)->Append(item);
+            DeserializeStructBinRec(r, GetSubstruct(field), item);
+        }
+        break;
+    case Type_Bool:
+        *(bool *)fieldPtr = r.Get<uint8_t>() != 0;
+        break;
+    case Type_Color: case Type_Int:
+        *(int *)fieldPtr = r.Get<int>();
+        break;
+    case Type_Float:
+        *(float *)fieldPtr = r.Get<float>();
+        break;
+    case Type_String:
+        len = r.Get<uint32_t>();
+        if (BIN_NULL_STRING == len || !r.ok)
+            break;
+        if (len > r.Left() / sizeof(WCHAR)) {
+            r.ok = false;
+            break;
+        }
+        s = r.Read(len * sizeof(WCHAR));
+        if (s)
+            *(WCHAR **)fieldPtr = str::DupN((const WCHAR *)s, len);
+        break;
+    case Type_Utf8String:
+        len = r.Get<uint32_t>();
+        if (BIN_NULL_STRING == len || !r.ok)
+            break;
+        s = r.Read(len);
+        if (s)
+            *(char **)fieldPtr = str::DupN(s, len);
+        break;
+    case Type_ColorArray: case Type_FloatArray: case Type_IntArray:
+        len = r.Get<uint32_t>();
+        *(Vec<int> **)fieldPtr = new Vec<int>();
+        if (len > r.Left() / sizeof(int)) {
+            r.ok = false;
+            break;
+        }
+        s = r.Read(len * sizeof(int));
+        if (s)
+            memcpy((*(Vec<int> **)fieldPtr)->AppendBlanks(len), s, len * sizeof(int));
+        break;
+    case Type_Comment:
+        break;
+    default:
+        CrashIf(true);
+        r.ok = false;
+    }
+}
+
+static void DeserializeStructBinRec(BinReader& r, const StructInfo *info, uint8_t *base, bool useDefaults)
+{
+    uint16_t fieldCount = useDefaults ? 0 : r.Get<uint16_t>();
+    if (fieldCount > info->fieldCount)
+        r.ok = false;
+    for (size_t i = 0; i < info->fieldCount; i++) {
+        const FieldInfo& field = info->fields[i];
+        if (r.ok && i < fieldCount) {
+            DeserializeFieldBin(r, field, base);
+        }
+        else if (Type_Struct == field.type || Type_Compact == field.type || Type_Prerelease == field.type) {
+            DeserializeStructBinRec(r, GetSubstruct(field), base + field.offset, true);
+        }
+        else if (Type_Array == field.type) {
+            if (!*(Vec<void *> **)(base + field.offset))
+                *(Vec<void *> **)(base + field.offset) = new Vec<void *>();
+        }
+        else if (field.type != Type_Comment) {
+            // for fields not present in the snapshot (and for the
+            // remainder of a struct after a read error)
+            DeserializeField(field, base, NULL);
+        }
+    }
+}
+
+char *SerializeStructBin(const StructInfo *info, const void *strct, size_t *sizeOut)
+{
+    str::Str<char> out;
+    SerializeStructBinRec(out, info, (const uint8_t *)strct);
+    if (sizeOut)
+        *sizeOut = out.Size();
+    return out.StealData();
+}
+
+void *DeserializeStructBin(const StructInfo *info, const char *data, size_t dataLen)
+{
+    BinReader r(data, dataLen);
+    void *strct = AllocArray<uint8_t>(info->structSize);
+    DeserializeStructBinRec(r, info, (uint8_t *)strct);
+    if (!r.ok || r.Left() > 0) {
+        FreeStruct(info, strct);
+        return NULL;
+    }
+    return strct;
+}
+
+static void AppendStructInfoSchema(str::Str<char>& out, const StructInfo *info)
+{
+    AppendBin(out, info->structSize);
+    AppendBin(out, info->fieldCount);
+    const char *fieldName = info->fieldNames;
+    for (size_t i = 0; i < info->fieldCount; i++, fieldName += str::Len(fieldName) + 1) {
+        const FieldInfo& field = info->fields[i];
+        AppendBin(out, field.type);
+        out.Append(fieldName, str::Len(fieldName) + 1);
+        if (Type_Comment == field.type)
+            continue;
+        AppendBin(out, (uint32_t)field.offset);
+        if (Type_Struct == field.type || Type_Compact == field.type ||
+            Type_Prerelease == field.type || Type_Array == field.type) {
+            AppendStructInfoSchema(out, GetSubstruct(field));
+        }
+    }
+}
+
+uint32_t GetStructInfoHash(const StructInfo *info)
+{
+    str::Str<char> schema;
+    AppendStructInfoSchema(schema, info);
+    return MurmurHash2(schema.Get(), schema.Size());
+}
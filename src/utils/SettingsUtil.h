@@ -53,10 +53,17 @@ char *SerializeStruct(const StructInfo *info, const void *strct, const char *pre
 void *DeserializeStruct(const StructInfo *info, const char *data, void *strct=NULL);
 void FreeStruct(const StructInfo *info, void *strct);
 
+// binary snapshots are faster to (de)serialize but only valid for the exact
+// same StructInfo (as identified by GetStructInfoHash)
+char *SerializeStructBin(const StructInfo *info, const void *strct, size_t *sizeOut=NULL);
+void *DeserializeStructBin(const StructInfo *info, const char *data, size_t dataLen);
+uint32_t GetStructInfoHash(const StructInfo *info);
+
 // Benc doesn't need compact serialization, so allow to use Type_Compact for custom deserialization
 class BencDict;
 typedef bool (* CompactCallback)(BencDict *dict, const FieldInfo *field, const char *fieldName, uint8_t *fieldPtr);
 
-void *DeserializeStructBenc(const StructInfo *info, const char *data, void *strct=NULL, CompactCallback cb=NULL);
+// note: data is modified during deserialization
+void *DeserializeStructBenc(const StructInfo *info, char *data, void *strct=NULL, CompactCallback cb=NULL);
 
 #endif
@@ -15,8 +15,9 @@ public:
     {
         va_list args;
         va_start(args, fmt);
-        ScopedMem<WCHAR> s(str::FmtV(fmt, args));
-        Log(s);
+        str::Str<WCHAR, 256> s;
+        s.AppendFmtV(fmt, args);
+        Log(s.Get());
         va_end(args);
     }
 
@@ -71,7 +72,10 @@ public:
     {
         if (s) {
             // DbgView displays one line per OutputDebugString call
-            OutputDebugString(ScopedMem<WCHAR>(str::Format(L"%s\n", s)));
+            str::Str<WCHAR, 256> line;
+            line.Append(s);
+            line.Append(L'\n');
+            OutputDebugString(line.Get());
         }
     }
 };
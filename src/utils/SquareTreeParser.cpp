@@ -96,9 +96,74 @@ SquareTreeNode::~SquareTreeNode()
     }
 }
 
+// nodes with fewer items are searched linearly
+#define MIN_INDEXED_ITEMS 16
+
+// case-insensitive (for ASCII) version of FNV-1a, consistent with str::EqI
+static uint32_t HashKeyI(const char *key, bool isChild)
+{
+    uint32_t hash = isChild ? 2166136261U : 84696351U;
+    for (; *key; key++) {
+        char c = *key;
+        if ('A' <= c && c <= 'Z')
+            c += 'a' - 'A';
+        hash = (hash ^ (uint8_t)c) * 16777619U;
+    }
+    return hash;
+}
+
+// returns the index of the first item with the given key and kind or -1
+int SquareTreeNode::FindFirst(const char *key, bool isChild) const
+{
+    if (data.Count() < MIN_INDEXED_ITEMS) {
+        for (size_t i = 0; i < data.Count(); i++) {
+            const DataItem& item = data.At(i);
+            if (item.isChild == isChild && str::EqI(key, item.key))
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // the index is an open-addressing hash table of item indices + 1
+    if (indexedCount != data.Count() || 0 == index.Count()) {
+        index.Reset();
+        index.AppendBlanks(RoundToPowerOf2(data.Count() * 2));
+        size_t mask = index.Count() - 1;
+        for (size_t i = 0; i < data.Count(); i++) {
+            const DataItem& item = data.At(i);
+            size_t slot = HashKeyI(item.key, item.isChild) & mask;
+            for (; index.At(slot); slot = (slot + 1) & mask) {
+                const DataItem& other = data.At(index.At(slot) - 1);
+                if (other.isChild == item.isChild && str::EqI(other.key, item.key))
+                    break;
+            }
+            // only the first item for a key is indexed
+            if (!index.At(slot))
+                index.At(slot) = (int)i + 1;
+        }
+        indexedCount = data.Count();
+    }
+
+    size_t mask = index.Count() - 1;
+    for (size_t slot = HashKeyI(key, isChild) & mask; index.At(slot); slot = (slot + 1) & mask) {
+        const DataItem& item = data.At(index.At(slot) - 1);
+        if (item.isChild == isChild && str::EqI(key, item.key))
+            return index.At(slot) - 1;
+    }
+    return -1;
+}
+
 const char *SquareTreeNode::GetValue(const char *key, size_t *startIdx) const
 {
-    for (size_t i = startIdx ? *startIdx : 0; i < data.Count(); i++) {
+    if (!startIdx || 0 == *startIdx) {
+        int i = FindFirst(key, false);
+        if (i < 0)
+            return NULL;
+        if (startIdx)
+            *startIdx = i + 1;
+        return data.At(i).value.str;
+    }
+    for (size_t i = *startIdx; i < data.Count(); i++) {
         DataItem& item = data.At(i);
         if (str::EqI(key, item.key) && !item.isChild) {
             if (startIdx)
@@ -111,7 +176,15 @@ const char *SquareTreeNode::GetValue(const char *key, size_t *startIdx) const
 
 SquareTreeNode *SquareTreeNode::GetChild(const char *key, size_t *startIdx) const
 {
-    for (size_t i = startIdx ? *startIdx : 0; i < data.Count(); i++) {
+    if (!startIdx || 0 == *startIdx) {
+        int i = FindFirst(key, true);
+        if (i < 0)
+            return NULL;
+        if (startIdx)
+            *startIdx = i + 1;
+        return data.At(i).value.child;
+    }
+    for (size_t i = *startIdx; i < data.Count(); i++) {
         DataItem& item = data.At(i);
         if (str::EqI(key, item.key) && item.isChild) {
             if (startIdx)
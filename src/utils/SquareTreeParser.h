@@ -5,8 +5,16 @@
 #define SquareTreeParser_h
 
 class SquareTreeNode {
+    // hash index of the first item for every key (built on demand, as nodes
+    // are looked up by all the field names of a struct when deserializing)
+    mutable Vec<int> index;
+    // data.Count() at the time of building the index
+    mutable size_t indexedCount;
+
+    int FindFirst(const char *key, bool isChild) const;
+
 public:
-    SquareTreeNode() { }
+    SquareTreeNode() : indexedCount(0) { }
     ~SquareTreeNode();
 
     struct DataItem {
@@ -21,6 +29,8 @@ public:
         DataItem(const char *key, const char *string) : key(key), isChild(false) { value.str = string; }
         DataItem(const char *key, SquareTreeNode *node) : key(key), isChild(true) { value.child = node; }
     };
+    // note: the index is rebuilt whenever the number of items changes
+    // (so items may be removed or appended but not otherwise modified)
     Vec<DataItem> data;
 
     const char *GetValue(const char *key, size_t *startIdx=NULL) const;
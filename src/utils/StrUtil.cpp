@@ -4,8 +4,83 @@
 /* The most basic things, including string handling functions */
 #include "BaseUtil.h"
 
+#include <emmintrin.h>
+
 namespace str {
 
+// most strings converted from and to UTF-8 are pure ASCII, in which case
+// characters can be widened resp. narrowed 16 at a time with SSE2 instead
+// of having MultiByteToWideChar resp. WideCharToMultiByte process them twice
+
+static bool IsAscii(const char *s, size_t len)
+{
+    size_t i = 0;
+    if (HasSSE2()) {
+        __m128i bits = _mm_setzero_si128();
+        for (; len - i >= 16; i += 16) {
+            bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i *)(s + i)));
+        }
+        if (_mm_movemask_epi8(bits))
+            return false;
+    }
+    for (; i < len; i++) {
+        if ((unsigned char)s[i] >= 0x80)
+            return false;
+    }
+    return true;
+}
+
+static bool IsAscii(const WCHAR *s, size_t len)
+{
+    size_t i = 0;
+    if (HasSSE2()) {
+        __m128i bits = _mm_setzero_si128();
+        for (; len - i >= 8; i += 8) {
+            bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i *)(s + i)));
+        }
+        // check whether any of the bits above 0x7F is set
+        bits = _mm_and_si128(bits, _mm_set1_epi16((short)0xFF80));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(bits, _mm_setzero_si128())) != 0xFFFF)
+            return false;
+    }
+    for (; i < len; i++) {
+        if (s[i] >= 0x80)
+            return false;
+    }
+    return true;
+}
+
+static void WidenAscii(const char *s, size_t len, WCHAR *dst)
+{
+    size_t i = 0;
+    if (HasSSE2()) {
+        __m128i zero = _mm_setzero_si128();
+        for (; len - i >= 16; i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(block, zero));
+            _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(block, zero));
+        }
+    }
+    for (; i < len; i++) {
+        dst[i] = s[i];
+    }
+}
+
+static void NarrowAscii(const WCHAR *s, size_t len, char *dst)
+{
+    size_t i = 0;
+    if (HasSSE2()) {
+        for (; len - i >= 16; i += 16) {
+            __m128i block1 = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i block2 = _mm_loadu_si128((const __m128i *)(s + i + 8));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(block1, block2));
+        }
+    }
+    for (; i < len; i++) {
+        dst[i] = (char)s[i];
+    }
+}
+
 size_t Len(const char *s)
 {
     return s ? strlen(s) : 0;
@@ -263,11 +338,27 @@ WCHAR *DupN(const WCHAR *s, size_t lenCch)
     return res;
 }
 
+// note: only ASCII characters are lowercased (as by tolower in the "C" locale)
 void ToLower(char *s)
 {
     if (!s) return;
-    for (; *s; s++)
-        *s = (char)tolower(*s);
+    if (HasSSE2()) {
+        size_t len = str::Len(s);
+        __m128i upperA = _mm_set1_epi8('A' - 1);
+        __m128i upperZ = _mm_set1_epi8('Z' + 1);
+        __m128i caseBit = _mm_set1_epi8(0x20);
+        for (; len >= 16; s += 16, len -= 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)s);
+            // signed comparisons work, as bytes >= 0x80 aren't between 'A' and 'Z' either way
+            __m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(block, upperA), _mm_cmplt_epi8(block, upperZ));
+            block = _mm_or_si128(block, _mm_and_si128(isUpper, caseBit));
+            _mm_storeu_si128((__m128i *)s, block);
+        }
+    }
+    for (; *s; s++) {
+        if ('A' <= *s && *s <= 'Z')
+            *s += 'a' - 'A';
+    }
 }
 
 void ToLower(WCHAR *s)
@@ -283,6 +374,16 @@ char *ToMultiByte(const WCHAR *txt, UINT codePage, int cchTxtLen)
     AssertCrash(txt);
     if (!txt) return NULL;
 
+    if (CP_UTF8 == codePage && cchTxtLen != 0) {
+        size_t len = cchTxtLen < 0 ? str::Len(txt) : (size_t)cchTxtLen;
+        if (IsAscii(txt, len)) {
+            char *res = AllocArray<char>(len + 1);
+            if (res)
+                NarrowAscii(txt, len, res);
+            return res;
+        }
+    }
+
     int requiredBufSize = WideCharToMultiByte(codePage, 0, txt, cchTxtLen, NULL, 0, NULL, NULL);
     if (0 == requiredBufSize)
         return NULL;
@@ -315,6 +416,16 @@ WCHAR *ToWideChar(const char *src, UINT codePage, int cbSrcLen)
     AssertCrash(src);
     if (!src) return NULL;
 
+    if (CP_UTF8 == codePage && cbSrcLen != 0) {
+        size_t len = cbSrcLen < 0 ? str::Len(src) : (size_t)cbSrcLen;
+        if (IsAscii(src, len)) {
+            WCHAR *res = AllocArray<WCHAR>(len + 1);
+            if (res)
+                WidenAscii(src, len, res);
+            return res;
+        }
+    }
+
     int requiredBufSize = MultiByteToWideChar(codePage, 0, src, cbSrcLen, NULL, 0);
     if (0 == requiredBufSize)
         return NULL;
@@ -360,6 +471,15 @@ bool BufFmtV(char *buf, size_t bufCchSize, const char *fmt, va_list args)
     return false;
 }
 
+bool BufFmt(char *buf, size_t bufCchSize, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    bool ok = BufFmtV(buf, bufCchSize, fmt, args);
+    va_end(args);
+    return ok;
+}
+
 char *FmtV(const char *fmt, va_list args)
 {
     char    message[256];
@@ -407,6 +527,15 @@ bool BufFmtV(WCHAR *buf, size_t bufCchSize, const WCHAR *fmt, va_list args)
     return false;
 }
 
+bool BufFmt(WCHAR *buf, size_t bufCchSize, const WCHAR *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    bool ok = BufFmtV(buf, bufCchSize, fmt, args);
+    va_end(args);
+    return ok;
+}
+
 WCHAR *FmtV(const WCHAR *fmt, va_list args)
 {
     WCHAR   message[256];
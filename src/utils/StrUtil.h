@@ -95,10 +95,14 @@ inline const WCHAR * Find(const WCHAR *str, const WCHAR *find) {
     return wcsstr(str, find);
 }
 
+// BufFmt(V) format into a caller-provided buffer without allocating
+// and return false if the result had to be truncated
 bool    BufFmtV(char *buf, size_t bufCchSize, const char *fmt, va_list args);
+bool    BufFmt(char *buf, size_t bufCchSize, const char *fmt, ...);
 char *  FmtV(const char *fmt, va_list args);
 char *  Format(const char *fmt, ...);
 bool    BufFmtV(WCHAR *buf, size_t bufCchSize, const WCHAR *fmt, va_list args);
+bool    BufFmt(WCHAR *buf, size_t bufCchSize, const WCHAR *fmt, ...);
 WCHAR * FmtV(const WCHAR *fmt, va_list args);
 WCHAR * Format(const WCHAR *fmt, ...);
 
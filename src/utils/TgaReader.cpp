@@ -287,6 +287,50 @@ static void ReadPixel(ReadState& s, char *dst)
         s.data += s.n;
 }
 
+// same as calling ReadPixel for all pixels of a row of a truecolor image
+// (without conversion), but copying entire RLE packets at once
+static void ReadTruecolorRow(ReadState& s, char *dst, int w)
+{
+    if (!s.isRLE) {
+        size_t rowLen = (size_t)w * s.n;
+        if ((size_t)(s.end - s.data) < rowLen) {
+            s.failed = true;
+            return;
+        }
+        memcpy(dst, s.data, rowLen);
+        s.data += rowLen;
+        return;
+    }
+
+    while (w > 0) {
+        if (0 == s.repeat && s.data < s.end) {
+            s.repeat = (*s.data & 0x7F) + 1;
+            s.repeatSame = (*s.data & 0x80);
+            s.data++;
+        }
+        int count = min(s.repeat, w);
+        size_t packetLen = (size_t)(s.repeatSame ? 1 : count) * s.n;
+        if (0 == count || (size_t)(s.end - s.data) < packetLen) {
+            s.failed = true;
+            return;
+        }
+        if (s.repeatSame) {
+            for (int i = 0; i < count; i++) {
+                CopyPixel(dst + i * s.n, s.data, s.n);
+            }
+        }
+        else {
+            memcpy(dst, s.data, packetLen);
+            s.data += packetLen;
+        }
+        s.repeat -= count;
+        if (s.repeatSame && 0 == s.repeat)
+            s.data += s.n;
+        dst += count * s.n;
+        w -= count;
+    }
+}
+
 Gdiplus::Bitmap *ImageFromData(const char *data, size_t len)
 {
     if (len < sizeof(TgaHeader))
@@ -323,8 +367,15 @@ Gdiplus::Bitmap *ImageFromData(const char *data, size_t len)
     Status ok = bmp.LockBits(&bmpRect, ImageLockModeWrite, format, &bmpData);
     if (ok != Ok)
         return NULL;
-    for (int y = 0; y < h; y++) {
+    // most images can be copied row by row
+    bool copyRows = !invertX && n == s.n &&
+                    (Type_Truecolor == s.type || Type_Truecolor_RLE == s.type);
+    for (int y = 0; y < h && !s.failed; y++) {
         char *rowOut = (char *)bmpData.Scan0 + bmpData.Stride * (invertY ? y : h - 1 - y);
+        if (copyRows) {
+            ReadTruecolorRow(s, rowOut, w);
+            continue;
+        }
         for (int x = 0; x < w; x++) {
             ReadPixel(s, rowOut + n * (invertX ? w - 1 - x : x));
         }
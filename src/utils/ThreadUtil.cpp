@@ -81,3 +81,204 @@ bool ThreadBase::Join(DWORD waitMs)
     }
     return false;
 }
+
+// pool threads exit after having been idle for this long
+#define POOL_THREAD_IDLE_MS 5000
+
+static LONG gPoolInitState = 0;
+static CRITICAL_SECTION gPoolAccess;
+// one queue of not yet started tasks per priority
+static ThreadPoolTask *gPoolQueueHead[TaskPriorityCount];
+static ThreadPoolTask *gPoolQueueTail[TaskPriorityCount];
+// released once for every queued task
+static HANDLE gPoolTasksAvailable = NULL;
+// handles of all started threads (including ones which have exited
+// by themselves, until they're pruned when the next thread is started)
+static Vec<HANDLE> gPoolThreads;
+static int gPoolThreadCount = 0;
+// threads currently waiting for gPoolTasksAvailable
+static int gPoolWaitingCount = 0;
+// times gPoolTasksAvailable has been released without a thread having
+// woken up for it yet
+static int gPoolWakeupCount = 0;
+// set by DrainThreadPool to make all waiting threads exit
+static bool gPoolDraining = false;
+static int gPoolMaxThreads = 1;
+
+// the pool is initialized on first use, as it's also used by DLLs
+static void InitializePool()
+{
+    if (0 == InterlockedCompareExchange(&gPoolInitState, 1, 0)) {
+        InitializeCriticalSection(&gPoolAccess);
+        gPoolTasksAvailable = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        gPoolMaxThreads = max((int)si.dwNumberOfProcessors, 1);
+        InterlockedExchange(&gPoolInitState, 2);
+    }
+    while (gPoolInitState != 2) {
+        Sleep(0);
+    }
+}
+
+// returns the first task of the highest priority (belonging to group,
+// if group isn't NULL); must be called from within gPoolAccess
+static ThreadPoolTask *PopPoolTask(TaskGroup *group)
+{
+    for (int prio = 0; prio < TaskPriorityCount; prio++) {
+        ThreadPoolTask **task = &gPoolQueueHead[prio], *prev = NULL;
+        for (; *task; prev = *task, task = &(*task)->next) {
+            if (group && (*task)->group != group)
+                continue;
+            ThreadPoolTask *found = *task;
+            *task = found->next;
+            if (gPoolQueueTail[prio] == found)
+                gPoolQueueTail[prio] = prev;
+            found->next = NULL;
+            return found;
+        }
+    }
+    return NULL;
+}
+
+void RunPoolTask(ThreadPoolTask *task)
+{
+    TaskGroup *group = task->group;
+    if (!group->WasCancelRequested())
+        task->Run();
+    // neither task nor group may be accessed once the task is no longer
+    // pending (TaskGroup::Wait checks pending within gPoolAccess as well)
+    ScopedCritSec scope(&gPoolAccess);
+    if (0 == --group->pending)
+        SetEvent(group->hDone);
+}
+
+static DWORD WINAPI PoolThreadProc(void *)
+{
+    SetThreadName(GetCurrentThreadId(), "ThreadPool");
+    EnterCriticalSection(&gPoolAccess);
+    for (;;) {
+        gPoolWaitingCount++;
+        LeaveCriticalSection(&gPoolAccess);
+        DWORD res = WaitForSingleObject(gPoolTasksAvailable, POOL_THREAD_IDLE_MS);
+        EnterCriticalSection(&gPoolAccess);
+        gPoolWaitingCount--;
+        if (WAIT_TIMEOUT == res) {
+            // if the semaphore has been released more often than there are
+            // still threads waiting for it, this one is needed after all
+            if (gPoolWakeupCount > gPoolWaitingCount && !gPoolDraining)
+                continue;
+            break;
+        }
+        gPoolWakeupCount--;
+        if (gPoolDraining)
+            break;
+        // the task might already have been run by TaskGroup::Wait
+        ThreadPoolTask *task = PopPoolTask(NULL);
+        LeaveCriticalSection(&gPoolAccess);
+        if (task)
+            RunPoolTask(task);
+        EnterCriticalSection(&gPoolAccess);
+    }
+    gPoolThreadCount--;
+    LeaveCriticalSection(&gPoolAccess);
+    return 0;
+}
+
+bool ThreadPoolTask::WasCancelRequested() const
+{
+    return group && group->WasCancelRequested();
+}
+
+TaskGroup::TaskGroup() : pending(0), cancelRequested(false)
+{
+    hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+TaskGroup::~TaskGroup()
+{
+    Wait();
+    CloseHandle(hDone);
+}
+
+void TaskGroup::Queue(ThreadPoolTask *task, TaskPriority priority)
+{
+    CrashIf(!task || task->group || priority < 0 || priority >= TaskPriorityCount);
+    InitializePool();
+    task->group = this;
+
+    ScopedCritSec scope(&gPoolAccess);
+    pending++;
+    if (gPoolQueueTail[priority])
+        gPoolQueueTail[priority]->next = task;
+    else
+        gPoolQueueHead[priority] = task;
+    gPoolQueueTail[priority] = task;
+
+    // start another thread, unless there's a waiting one which
+    // hasn't been woken up for a previously queued task yet
+    if (gPoolWaitingCount <= gPoolWakeupCount && gPoolThreadCount < gPoolMaxThreads) {
+        for (size_t i = gPoolThreads.Count(); i > 0; i--) {
+            if (WaitForSingleObject(gPoolThreads.At(i - 1), 0) == WAIT_OBJECT_0) {
+                CloseHandle(gPoolThreads.At(i - 1));
+                gPoolThreads.RemoveAt(i - 1);
+            }
+        }
+        HANDLE hThread = CreateThread(NULL, 0, PoolThreadProc, NULL, 0, 0);
+        if (hThread) {
+            gPoolThreads.Append(hThread);
+            gPoolThreadCount++;
+        }
+    }
+    gPoolWakeupCount++;
+    ReleaseSemaphore(gPoolTasksAvailable, 1, NULL);
+}
+
+void TaskGroup::Wait()
+{
+    // nothing can have been queued before the pool was initialized
+    if (gPoolInitState != 2)
+        return;
+    for (;;) {
+        EnterCriticalSection(&gPoolAccess);
+        if (0 == pending) {
+            LeaveCriticalSection(&gPoolAccess);
+            return;
+        }
+        ThreadPoolTask *task = PopPoolTask(this);
+        LeaveCriticalSection(&gPoolAccess);
+        if (task)
+            RunPoolTask(task);
+        else
+            WaitForSingleObject(hDone, INFINITE);
+    }
+}
+
+void DrainThreadPool()
+{
+    if (gPoolInitState != 2)
+        return;
+    EnterCriticalSection(&gPoolAccess);
+    gPoolDraining = true;
+    int count = gPoolThreadCount;
+    gPoolWakeupCount += count;
+    if (count > 0)
+        ReleaseSemaphore(gPoolTasksAvailable, count, NULL);
+    LeaveCriticalSection(&gPoolAccess);
+
+    // no new threads can be started as there mustn't be any tasks left to queue
+    for (size_t i = 0; i < gPoolThreads.Count(); i++) {
+        WaitForSingleObject(gPoolThreads.At(i), INFINITE);
+        CloseHandle(gPoolThreads.At(i));
+    }
+    gPoolThreads.Reset();
+
+    EnterCriticalSection(&gPoolAccess);
+    // consume the releases which threads exiting on their own haven't
+    while (WaitForSingleObject(gPoolTasksAvailable, 0) == WAIT_OBJECT_0) {
+        // nothing to do
+    }
+    gPoolWakeupCount = 0;
+    gPoolDraining = false;
+    LeaveCriticalSection(&gPoolAccess);
+}
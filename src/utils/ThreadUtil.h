@@ -47,6 +47,69 @@ public:
     virtual void Run() = 0;
 };
 
+enum TaskPriority {
+    TaskPriorityHigh, TaskPriorityNormal, TaskPriorityLow,
+    TaskPriorityCount // must be at the end!
+};
+
+class TaskGroup;
+
+/* A unit of work to be executed by the process-wide thread pool
+   (cf. TaskGroup::Queue). Tasks are owned by whoever queues them
+   and may only be deleted after TaskGroup::Wait has returned. */
+class ThreadPoolTask {
+public:
+    // used by the thread pool
+    TaskGroup *         group;
+    ThreadPoolTask *    next;
+
+    ThreadPoolTask() : group(NULL), next(NULL) { }
+    virtual ~ThreadPoolTask() { }
+
+    // over-write this to implement the actual task
+    // note: for longer running tasks, make sure to occasionally poll WasCancelRequested
+    virtual void Run() = 0;
+
+    bool WasCancelRequested() const;
+};
+
+/* Tasks which are to be waited for (and canceled) together. The tasks are
+   executed by a pool of at most as many threads as there are processors,
+   which is shared by all task groups (threads which haven't been needed for
+   a while exit by themselves), so that parallel work doesn't oversubscribe
+   the processors. */
+class TaskGroup {
+    // number of queued tasks which haven't finished yet
+    int                 pending;
+    // signaled whenever the last pending task has finished
+    HANDLE              hDone;
+    bool                cancelRequested;
+
+    friend void RunPoolTask(ThreadPoolTask *task);
+
+public:
+    TaskGroup();
+    // waits for all queued tasks to finish
+    ~TaskGroup();
+
+    // can be called from any thread
+    void Queue(ThreadPoolTask *task, TaskPriority priority=TaskPriorityNormal);
+
+    // tasks which haven't started yet won't be run at all, it's up to
+    // running tasks to call WasCancelRequested and stop processing
+    void RequestCancel() { cancelRequested = true; }
+    bool WasCancelRequested() const { return cancelRequested; }
+
+    // synchronously waits for all queued tasks to finish. In the meantime,
+    // the calling thread runs those tasks which haven't been started yet
+    // (so that tasks can wait for tasks they've queued themselves)
+    void Wait();
+};
+
+// makes all pool threads exit and waits for them to have done so, e.g. before
+// a DLL containing the pool is unloaded (mustn't be called while tasks are pending)
+void DrainThreadPool();
+
 void SetThreadName(DWORD threadId, const char *threadName);
 
 #endif
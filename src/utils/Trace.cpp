@@ -0,0 +1,88 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "Trace.h"
+
+#include "FileUtil.h"
+
+// stop recording once this many events have been collected
+// (at 32 bytes per event, this caps memory use at 64 MB)
+#define MAX_TRACE_EVENTS (2 * 1024 * 1024)
+
+namespace trace {
+
+bool gEnabled = false;
+
+struct Event {
+    const char *name;
+    int arg;
+    DWORD threadId;
+    LONGLONG start, end;
+};
+
+static CRITICAL_SECTION gEventsAccess;
+static Vec<Event> *gEvents = NULL;
+static WCHAR *gPath = NULL;
+static LARGE_INTEGER gStart, gFreq;
+
+void Start(const WCHAR *path)
+{
+    CrashIf(gEnabled);
+    InitializeCriticalSection(&gEventsAccess);
+    gEvents = new Vec<Event>(4096);
+    gPath = str::Dup(path);
+    QueryPerformanceFrequency(&gFreq);
+    QueryPerformanceCounter(&gStart);
+    gEnabled = true;
+}
+
+void Record(const char *name, int arg, LONGLONG start, LONGLONG end)
+{
+    Event ev = { name, arg, GetCurrentThreadId(), start, end };
+    ScopedCritSec scope(&gEventsAccess);
+    if (!gEnabled || gEvents->Count() >= MAX_TRACE_EVENTS)
+        return;
+    gEvents->Append(ev);
+}
+
+static double ToMicroSecs(LONGLONG t)
+{
+    return (double)(t - gStart.QuadPart) * 1000000.0 / (double)gFreq.QuadPart;
+}
+
+// saves all collected events and stops recording any further ones
+bool Stop()
+{
+    if (!gEnabled)
+        return false;
+    {
+        ScopedCritSec scope(&gEventsAccess);
+        gEnabled = false;
+    }
+
+    str::Str<char> json(gEvents->Count() * 96 + 64);
+    json.Append("{\"traceEvents\":[\n");
+    for (size_t i = 0; i < gEvents->Count(); i++) {
+        Event& ev = gEvents->At(i);
+        double ts = ToMicroSecs(ev.start);
+        double dur = ToMicroSecs(ev.end) - ts;
+        json.AppendFmt("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f",
+                       i > 0 ? ",\n" : "", ev.name, (int)GetCurrentProcessId(), (int)ev.threadId, ts, dur);
+        if (ev.arg != -1)
+            json.AppendFmt(",\"args\":{\"n\":%d}", ev.arg);
+        json.Append("}");
+    }
+    json.Append("\n]}\n");
+    bool ok = file::WriteAll(gPath, json.Get(), json.Size());
+
+    // scopes still running on other threads might be about to call Record
+    // (which is harmless once gEnabled has been reset), so keep
+    // gEventsAccess around and only free the events
+    delete gEvents;
+    gEvents = NULL;
+    str::ReplacePtr(&gPath, NULL);
+    return ok;
+}
+
+}
@@ -0,0 +1,57 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifndef Trace_h
+#define Trace_h
+
+/* Records how long hot code paths take (and on which thread) and saves
+   the events in Chrome's trace event format (for chrome://tracing).
+
+Usage:
+
+    void RenderPage(int pageNo) {
+        TRACE_SCOPE_N("RenderPage", pageNo);
+        ...
+    }
+
+When tracing hasn't been started, a scope costs a single check of a global
+flag. Names must be string literals (they're only stored as pointers). */
+
+namespace trace {
+
+extern bool gEnabled;
+
+// events are collected in memory until Stop() saves them to path
+void Start(const WCHAR *path);
+bool Stop();
+
+void Record(const char *name, int arg, LONGLONG start, LONGLONG end);
+
+class Scope {
+    const char *name;
+    int arg;
+    LONGLONG start;
+
+public:
+    explicit Scope(const char *name, int arg=-1) : name(name), arg(arg), start(0) {
+        if (gEnabled) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            start = now.QuadPart;
+        }
+    }
+    ~Scope() {
+        if (gEnabled && start) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            Record(name, arg, start, now.QuadPart);
+        }
+    }
+};
+
+}
+
+#define TRACE_SCOPE(name) trace::Scope _traceScope(name)
+#define TRACE_SCOPE_N(name, arg) trace::Scope _traceScope(name, arg)
+
+#endif
@@ -27,17 +27,68 @@ namespace uitask {
 
 static HWND gTaskDispatchHwnd = NULL;
 
+// tasks posted but not yet picked up by the ui thread, most recently
+// posted first; any thread can push to it without taking a lock
+// (the ui thread always takes the whole list, so there's no ABA problem)
+static UITask * volatile gPostedTasks = NULL;
+// tasks picked up but not yet executed, in execution order
+// (only accessed by the ui thread)
+static UITask *gPendingTasks = NULL;
+
 #define UITASK_CLASS_NAME   L"UITask_Wnd_Class"
 #define WM_EXECUTE_TASK     (WM_USER + 1)
+#define CONTINUE_TIMER_ID   1
 
-static LRESULT CALLBACK WndProcTaskDispatch(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+// a burst of tasks is executed in slices of at most this length,
+// so that user input is still handled in between
+#define MAX_SLICE_MS        50
+
+static void FetchPostedTasks()
+{
+    UITask *task = (UITask *)InterlockedExchangePointer((void **)&gPostedTasks, NULL);
+    if (!task)
+        return;
+    // reverse the list so that tasks are executed in the order they were posted
+    UITask *fetched = NULL;
+    while (task) {
+        UITask *next = task->next;
+        task->next = fetched;
+        fetched = task;
+        task = next;
+    }
+    UITask **last = &gPendingTasks;
+    while (*last)
+        last = &(*last)->next;
+    *last = fetched;
+}
+
+// returns false if there are still tasks left after maxMs milliseconds
+static bool ExecuteTasks(DWORD maxMs)
 {
-    UITask *task;
-    if (WM_EXECUTE_TASK == msg) {
-        task = (UITask*)lParam;
+    DWORD start = GetTickCount();
+    for (;;) {
+        if (!gPendingTasks)
+            FetchPostedTasks();
+        UITask *task = gPendingTasks;
+        if (!task)
+            return true;
+        gPendingTasks = task->next;
         lf("executing %s", task->name);
         task->Execute();
         delete task;
+        if (maxMs != INFINITE && GetTickCount() - start >= maxMs)
+            return !gPendingTasks && !gPostedTasks;
+    }
+}
+
+static LRESULT CALLBACK WndProcTaskDispatch(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    if (WM_EXECUTE_TASK == msg || (WM_TIMER == msg && CONTINUE_TIMER_ID == wParam)) {
+        KillTimer(hwnd, CONTINUE_TIMER_ID);
+        // WM_TIMER is only delivered once the message queue is empty,
+        // so input messages are handled before the remaining tasks
+        if (!ExecuteTasks(MAX_SLICE_MS))
+            SetTimer(hwnd, CONTINUE_TIMER_ID, USER_TIMER_MINIMUM, NULL);
         return 0;
     }
     return DefWindowProc(hwnd, msg, wParam, lParam);
@@ -64,8 +115,10 @@ void DrainQueue()
     CrashIf(!gTaskDispatchHwnd);
     MSG msg;
     while (PeekMessage(&msg, gTaskDispatchHwnd, WM_EXECUTE_TASK, WM_EXECUTE_TASK, PM_REMOVE)) {
-        DispatchMessage(&msg);
+        // the tasks are executed below
     }
+    KillTimer(gTaskDispatchHwnd, CONTINUE_TIMER_ID);
+    ExecuteTasks(INFINITE);
 }
 
 void Destroy()
@@ -79,7 +132,15 @@ void Post(UITask *task)
 {
     CrashIf(!task || !gTaskDispatchHwnd);
     lf("posting %s", task->name);
-    PostMessage(gTaskDispatchHwnd, WM_EXECUTE_TASK, 0, (LPARAM)task);
+    UITask *head;
+    do {
+        head = gPostedTasks;
+        task->next = head;
+    } while (InterlockedCompareExchangePointer((void **)&gPostedTasks, task, head) != head);
+    // only wake up the ui thread for the first task of a batch, the
+    // others are picked up together with it
+    if (!head)
+        PostMessage(gTaskDispatchHwnd, WM_EXECUTE_TASK, 0, 0);
 }
 
 // arg can be NULL
@@ -12,8 +12,10 @@ class UITask
 public:
     // for debugging
     const char *name;
+    // used by uitask for linking queued tasks
+    UITask *next;
 
-    UITask() : name("UITask") {}
+    UITask() : name("UITask"), next(NULL) {}
     virtual ~UITask() {}
     virtual void Execute() = 0;
 };
@@ -30,7 +32,8 @@ void    Destroy();
 void    DrainQueue();
 
 // Can be called from any thread. Queues the task to be executed
-// as soon as possible on ui thread.
+// as soon as possible on ui thread. Tasks are executed in the order
+// they've been posted (by the same thread).
 void    Post(UITask *);
 
 void    PostFunc(UITaskFuncPtr, void *arg);
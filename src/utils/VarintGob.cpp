@@ -39,9 +39,8 @@ int UVarintGobDecode(const uint8_t *d, int dLen, uint64_t *resOut)
         return 0;
     char numLenEncoded = (char)b;
     int numLen = -numLenEncoded;
-    CrashIf(numLen < 1);
-    CrashIf(numLen > 8);
-    if (numLen > dLen)
+    // d might come from an untrusted source
+    if (numLen < 1 || numLen > 8 || numLen > dLen)
         return 0;
     uint64_t res = 0;
     for (int i=0; i < numLen; i++) {
@@ -119,3 +118,125 @@ int VarintGobEncode(int64_t val, uint8_t *d, int dLen)
     return UVarintGobEncode(uVal, d, dLen);
 }
 
+
+#define GOB_HEADER_LEN   8
+#define GOB_CHECKSUM_LEN 4
+// a length byte followed by up to 8 value bytes
+#define GOB_MAX_VARINT_LEN 9
+
+static void AppendUInt32LE(str::Str<char>& data, uint32_t val)
+{
+    for (int i = 0; i < 4; i++) {
+        data.Append((char)((val >> (8 * i)) & 0xFF));
+    }
+}
+
+static uint32_t UInt32LE(const uint8_t *d)
+{
+    return d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24);
+}
+
+GobEncoder::GobEncoder(uint32_t magic, uint32_t version)
+{
+    AppendUInt32LE(data, magic);
+    AppendUInt32LE(data, version);
+}
+
+void GobEncoder::Int(int64_t val)
+{
+    uint8_t buf[GOB_MAX_VARINT_LEN];
+    int n = VarintGobEncode(val, buf, dimof(buf));
+    data.Append((const char *)buf, n);
+}
+
+void GobEncoder::UInt(uint64_t val)
+{
+    uint8_t buf[GOB_MAX_VARINT_LEN];
+    int n = UVarintGobEncode(val, buf, dimof(buf));
+    data.Append((const char *)buf, n);
+}
+
+void GobEncoder::Bytes(const void *d, size_t len)
+{
+    UInt(len);
+    data.Append((const char *)d, len);
+}
+
+void GobEncoder::Align(size_t alignment)
+{
+    CrashIf(0 == alignment);
+    while (data.Size() % alignment != 0) {
+        data.Append('\0');
+    }
+}
+
+char *GobEncoder::Finish(size_t *lenOut)
+{
+    AppendUInt32LE(data, MurmurHash2(data.Get(), data.Size()));
+    if (lenOut)
+        *lenOut = data.Size();
+    return data.StealData();
+}
+
+GobDecoder::GobDecoder(const char *recData, size_t recLen, uint32_t magic, uint32_t version) :
+    data((const uint8_t *)recData), len(0), pos(GOB_HEADER_LEN), ok(false)
+{
+    if (!data || recLen < GOB_HEADER_LEN + GOB_CHECKSUM_LEN)
+        return;
+    len = recLen - GOB_CHECKSUM_LEN;
+    ok = UInt32LE(data) == magic && UInt32LE(data + 4) == version &&
+         UInt32LE(data + len) == MurmurHash2(data, len);
+}
+
+uint64_t GobDecoder::UInt()
+{
+    uint64_t val = 0;
+    int n = 0;
+    if (ok && pos < len)
+        n = UVarintGobDecode(data + pos, (int)min(len - pos, (size_t)INT_MAX), &val);
+    if (0 == n) {
+        ok = false;
+        return 0;
+    }
+    pos += n;
+    return val;
+}
+
+int64_t GobDecoder::Int()
+{
+    int64_t val = 0;
+    int n = 0;
+    if (ok && pos < len)
+        n = VarintGobDecode(data + pos, (int)min(len - pos, (size_t)INT_MAX), &val);
+    if (0 == n) {
+        ok = false;
+        return 0;
+    }
+    pos += n;
+    return val;
+}
+
+const char *GobDecoder::Bytes(size_t *lenOut)
+{
+    uint64_t bytesLen = UInt();
+    *lenOut = 0;
+    if (!ok || bytesLen > len - pos) {
+        ok = false;
+        return NULL;
+    }
+    const char *bytes = (const char *)data + pos;
+    pos += (size_t)bytesLen;
+    *lenOut = (size_t)bytesLen;
+    return bytes;
+}
+
+void GobDecoder::Align(size_t alignment)
+{
+    CrashIf(0 == alignment);
+    size_t aligned = (pos + alignment - 1) / alignment * alignment;
+    if (!ok || aligned > len) {
+        ok = false;
+        return;
+    }
+    pos = aligned;
+}
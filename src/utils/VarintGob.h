@@ -10,4 +10,51 @@ int VarintGobDecode(const uint8_t *d, int dLen, int64_t *resOut);
 int UVarintGobEncode(uint64_t val, uint8_t *d, int dLen);
 int UVarintGobDecode(const uint8_t *d, int dLen, uint64_t *resOut);
 
+/* Compact binary records (e.g. for caches) consist of a 32-bit magic value,
+   a 32-bit version, any number of varint encoded values and byte strings
+   and a 32-bit checksum of all the preceding data. A record is only decoded
+   if its magic value, version and checksum match, so that outdated formats
+   and corrupted files are both simply ignored. */
+
+class GobEncoder {
+    str::Str<char> data;
+
+public:
+    GobEncoder(uint32_t magic, uint32_t version);
+
+    void Int(int64_t val);
+    void UInt(uint64_t val);
+    // a byte string is encoded as its length followed by its data
+    void Bytes(const void *d, size_t len);
+    // pads the data with zeros so that the next value starts at a multiple
+    // of alignment (so that e.g. arrays in a memory mapped record can be
+    // accessed in place)
+    void Align(size_t alignment);
+
+    // appends the checksum and returns the record (to be freed by the caller)
+    char *Finish(size_t *lenOut);
+};
+
+class GobDecoder {
+    const uint8_t *data;
+    // length of data without the checksum
+    size_t len;
+    size_t pos;
+    bool ok;
+
+public:
+    GobDecoder(const char *data, size_t len, uint32_t magic, uint32_t version);
+
+    // false if the record is invalid or more values have been decoded than it contains
+    bool IsOk() const { return ok; }
+    bool AtEnd() const { return pos == len; }
+
+    // these return 0 resp. NULL once IsOk() is false
+    int64_t Int();
+    uint64_t UInt();
+    // returns a pointer to the data of a byte string within the record
+    const char *Bytes(size_t *lenOut);
+    void Align(size_t alignment);
+};
+
 #endif
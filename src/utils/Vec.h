@@ -292,8 +292,10 @@ inline void DeleteVecMembers(Vec<T>& v)
 
 namespace str {
 
-template <typename T>
-class Str : public Vec<T> {
+// for building short strings without any allocation, use a larger BUF_SIZE
+// (e.g. str::Str<WCHAR, 256> for a Str allocated on the stack)
+template <typename T, size_t BUF_SIZE=16>
+class Str : public Vec<T, BUF_SIZE> {
 public:
     Str(size_t capHint=0, Allocator *allocator=NULL) : Vec(capHint, allocator) { }
 
@@ -309,12 +311,28 @@ public:
         Vec::Append(src, size);
     }
 
+    // formats straight into the buffer (growing it as needed)
+    // instead of into a temporary allocation
+    void AppendFmtV(const T* fmt, va_list args)
+    {
+        size_t cchAvail = max(cap - len, (size_t)64);
+        for (;;) {
+            EnsureCap(len + cchAvail);
+            if (BufFmtV(els + len, cap - len + PADDING, fmt, args))
+                break;
+            cchAvail *= 2;
+        }
+        size_t cchAppended = Len(els + len);
+        len += cchAppended;
+        // unused elements must be zero (BufFmtV may have written past the end)
+        memset(els + len, 0, (cap + PADDING - len) * sizeof(T));
+    }
+
     void AppendFmt(const T* fmt, ...)
     {
         va_list args;
         va_start(args, fmt);
-        T *res = FmtV(fmt, args);
-        AppendAndFree(res);
+        AppendFmtV(fmt, args);
         va_end(args);
     }
 
@@ -11,12 +11,14 @@
    reallocate memory, so once the element has been added to the
    array, it forever occupies the same piece of memory.
    It's also safe to read allocated elements in any thread.
+   With SharedPoolAllocator as A, several threads can append at once
+   (but iterating must not overlap with appending).
 */
-template <typename T>
+template <typename T, typename A=PoolAllocator>
 class VecSegmented {
 protected:
-    size_t        len;
-    PoolAllocator allocator;
+    volatile LONG len;
+    A             allocator;
 
 public:
 
@@ -37,7 +39,7 @@ public:
 
     T* AllocAtEnd(size_t count = 1) {
         void *p = allocator.Alloc(count * sizeof(T));
-        len += count;
+        InterlockedExchangeAdd(&len, (LONG)count);
         return reinterpret_cast<T*>(p);
     }
 
@@ -54,11 +56,11 @@ public:
 #endif
 
     size_t Count() const {
-        return len;
+        return (size_t)len;
     }
 
     size_t Size() const {
-        return len;
+        return (size_t)len;
     }
 
     T* Append(const T& el) {
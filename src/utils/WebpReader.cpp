@@ -26,15 +26,29 @@ Bitmap *ImageFromData(const char *data, size_t len)
     if (!WebPGetInfo((const uint8_t *)data, len, &w, &h))
         return NULL;
 
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config))
+        return NULL;
+    // filtering and upsampling are done on a second thread for lossy images
+    config.options.use_threads = 1;
+
     Bitmap bmp(w, h, PixelFormat32bppARGB);
     Rect bmpRect(0, 0, w, h);
     BitmapData bmpData;
     Status ok = bmp.LockBits(&bmpRect, ImageLockModeWrite, PixelFormat32bppARGB, &bmpData);
     if (ok != Ok)
         return NULL;
-    if (!WebPDecodeBGRAInto((const uint8_t *)data, len, (uint8_t *)bmpData.Scan0, bmpData.Stride * h, bmpData.Stride))
-        return NULL;
+    // decode straight into the bitmap's pixels
+    config.output.colorspace = MODE_BGRA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = (uint8_t *)bmpData.Scan0;
+    config.output.u.RGBA.stride = bmpData.Stride;
+    config.output.u.RGBA.size = bmpData.Stride * h;
+    VP8StatusCode status = WebPDecode((const uint8_t *)data, len, &config);
+    WebPFreeDecBuffer(&config.output);
     bmp.UnlockBits(&bmpData);
+    if (status != VP8_STATUS_OK)
+        return NULL;
 
     // hack to avoid the use of ::new (because there won't be a corresponding ::delete)
     return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
@@ -7,6 +7,7 @@
 #include <io.h>
 #include <fcntl.h>
 #include <mlang.h>
+#include <emmintrin.h>
 
 #include "DebugLog.h"
 
@@ -924,11 +925,49 @@ inline int mul255(int a, int b)
     return x >> 8;
 }
 
-void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor)
+// computes base + mul255(x, diff) for 8 16-bit values at once
+// (using 32-bit intermediates, as diff can be negative)
+static inline __m128i Mul255AddSSE2(__m128i x, __m128i diff, __m128i base)
+{
+    __m128i lo = _mm_mullo_epi16(x, diff);
+    __m128i hi = _mm_mulhi_epi16(x, diff);
+    __m128i round = _mm_set1_epi32(128);
+    __m128i p0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round);
+    __m128i p1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round);
+    p0 = _mm_srai_epi32(_mm_add_epi32(p0, _mm_srai_epi32(p0, 8)), 8);
+    p1 = _mm_srai_epi32(_mm_add_epi32(p1, _mm_srai_epi32(p1, 8)), 8);
+    return _mm_add_epi16(_mm_packs_epi32(p0, p1), base);
+}
+
+// updates the colors of count / 16 * 16 bytes and returns the number of bytes updated
+static size_t UpdateColorsSSE2(uint8_t *bytes, size_t count, const int base[4], const int diff[4])
+{
+    __m128i base16 = _mm_setr_epi16((short)base[0], (short)base[1], (short)base[2], (short)base[3],
+                                    (short)base[0], (short)base[1], (short)base[2], (short)base[3]);
+    __m128i diff16 = _mm_setr_epi16((short)diff[0], (short)diff[1], (short)diff[2], (short)diff[3],
+                                    (short)diff[0], (short)diff[1], (short)diff[2], (short)diff[3]);
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; count - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+        __m128i lo = Mul255AddSSE2(_mm_unpacklo_epi8(v, zero), diff16, base16);
+        __m128i hi = Mul255AddSSE2(_mm_unpackhi_epi8(v, zero), diff16, base16);
+        _mm_storeu_si128((__m128i *)(bytes + i), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+// replaces black with textColor and white with bgColor (interpolating all
+// other colors) for 8-bit DIBs (by only changing the palette), 24-bit and 32-bit DIBs
+// returns false for other DIB formats (which can be handled by UpdateBitmapColors)
+bool UpdateDIBColors(BITMAPINFO *bmi, void *data, COLORREF textColor, COLORREF bgColor)
 {
     if ((textColor & 0xFFFFFF) == WIN_COL_BLACK &&
         (bgColor & 0xFFFFFF) == WIN_COL_WHITE)
-        return;
+        return true;
+    WORD bitCount = bmi->bmiHeader.biBitCount;
+    if (bitCount != 8 && bitCount != 24 && bitCount != 32 || bmi->bmiHeader.biCompression != BI_RGB)
+        return false;
 
     // color order in DIB is blue-green-red-alpha
     int base[4] = { GetBValueSafe(textColor), GetGValueSafe(textColor), GetRValueSafe(textColor), 0 };
@@ -939,6 +978,45 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor)
         255
     };
 
+    if (24 == bitCount) {
+        // rows are padded to a multiple of 4 bytes
+        size_t rowBytes = (size_t)bmi->bmiHeader.biWidth * 3;
+        size_t stride = (rowBytes + 3) / 4 * 4;
+        uint8_t *row = (uint8_t *)data;
+        for (int y = 0; y < abs(bmi->bmiHeader.biHeight); y++, row += stride) {
+            for (size_t i = 0; i < rowBytes; i++) {
+                size_t k = i % 3;
+                row[i] = (uint8_t)(base[k] + mul255(row[i], diff[k]));
+            }
+        }
+        return true;
+    }
+
+    uint8_t *bytes;
+    size_t count;
+    if (8 == bitCount) {
+        bytes = (uint8_t *)bmi->bmiColors;
+        count = bmi->bmiHeader.biClrUsed * 4;
+    }
+    else {
+        bytes = (uint8_t *)data;
+        count = (size_t)bmi->bmiHeader.biWidth * abs(bmi->bmiHeader.biHeight) * 4;
+    }
+    // 16 is a multiple of 4, so the remaining bytes still start with blue
+    size_t i = HasSSE2() ? UpdateColorsSSE2(bytes, count, base, diff) : 0;
+    for (; i < count; i++) {
+        size_t k = i % 4;
+        bytes[i] = (uint8_t)(base[k] + mul255(bytes[i], diff[k]));
+    }
+    return true;
+}
+
+void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor)
+{
+    if ((textColor & 0xFFFFFF) == WIN_COL_BLACK &&
+        (bgColor & 0xFFFFFF) == WIN_COL_WHITE)
+        return;
+
     HDC hDC = GetDC(NULL);
     BITMAPINFO bmi = { 0 };
     SizeI size = GetBitmapSize(hbmp);
@@ -954,10 +1032,7 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor)
     ScopedMem<unsigned char> bmpData((unsigned char *)malloc(bmpBytes));
     CrashIf(!bmpData);
     if (GetDIBits(hDC, hbmp, 0, size.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
-        for (int i = 0; i < bmpBytes; i++) {
-            int k = i % 4;
-            bmpData[i] = (uint8_t)(base[k] + mul255(bmpData[i], diff[k]));
-        }
+        UpdateDIBColors(&bmi, bmpData, textColor, bgColor);
         SetDIBits(hDC, hbmp, 0, size.dy, bmpData, &bmi, DIB_RGB_COLORS);
     }
 
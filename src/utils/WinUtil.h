@@ -164,6 +164,7 @@ public:
 
 void    InitAllCommonControls();
 SizeI   GetBitmapSize(HBITMAP hbmp);
+bool    UpdateDIBColors(BITMAPINFO *bmi, void *data, COLORREF textColor, COLORREF bgColor);
 void    UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor);
 unsigned char *SerializeBitmap(HBITMAP hbmp, size_t *bmpBytesOut);
 COLORREF AdjustLightness(COLORREF c, float factor);
@@ -17,6 +17,7 @@ ZipFile::ZipFile(const WCHAR *path, ZipMethod method, Allocator *allocator) :
     filenames(0, allocator), fileinfo(0, allocator), filepos(0, allocator),
     allocator(allocator), commentLen(0)
 {
+    InitializeCriticalSection(&ufAccess);
     zlib_filefunc64_def ffunc;
     fill_win32_filefunc64(&ffunc);
     uf = unzOpen2_64(path, &ffunc);
@@ -28,6 +29,7 @@ ZipFile::ZipFile(IStream *stream, ZipMethod method, Allocator *allocator) :
     filenames(0, allocator), fileinfo(0, allocator), filepos(0, allocator),
     allocator(allocator), commentLen(0)
 {
+    InitializeCriticalSection(&ufAccess);
     zlib_filefunc64_def ffunc;
     fill_win32s_filefunc64(&ffunc);
     uf = unzOpen2_64(stream, &ffunc);
@@ -37,9 +39,9 @@ ZipFile::ZipFile(IStream *stream, ZipMethod method, Allocator *allocator) :
 
 ZipFile::~ZipFile()
 {
-    if (!uf)
-        return;
-    unzClose(uf);
+    if (uf)
+        unzClose(uf);
+    DeleteCriticalSection(&ufAccess);
 }
 
 // cf. http://www.pkware.com/documents/casestudies/APPNOTE.TXT Appendix D
@@ -106,13 +108,9 @@ char *ZipFile::GetFileDataByName(const WCHAR *fileName, size_t *len)
     return GetFileDataByIdx(GetFileIndex(fileName), len);
 }
 
-char *ZipFile::GetFileDataByIdx(size_t fileindex, size_t *len)
+// must be called within ufAccess
+bool ZipFile::GoToFile(size_t fileindex)
 {
-    if (!uf)
-        return NULL;
-    if (fileindex >= filenames.Count())
-        return NULL;
-
     int err = -1;
     if (filepos.At(fileindex).num_of_file != INVALID_ZIP_FILE_POS)
         err = unzGoToFilePos64(uf, &filepos.At(fileindex));
@@ -122,42 +120,88 @@ char *ZipFile::GetFileDataByIdx(size_t fileindex, size_t *len)
         str::conv::ToCodePageBuf(fileNameA, dimof(fileNameA), filenames.At(fileindex), cp);
         err = unzLocateFile(uf, fileNameA, 0);
     }
+    return UNZ_OK == err;
+}
+
+// reads either the uncompressed or the raw (still compressed) data of the current file
+// must be called within ufAccess
+bool ZipFile::ReadCurrentFile(char *buf, unsigned int len, bool raw)
+{
+    int method, level;
+    int err = raw ? unzOpenCurrentFile2(uf, &method, &level, 1) : unzOpenCurrentFilePassword(uf, NULL);
     if (err != UNZ_OK)
+        return false;
+    unsigned int readBytes = unzReadCurrentFile(uf, buf, len);
+    // for non-raw reads, this fails on a CRC mismatch (file content is likely damaged)
+    err = unzCloseCurrentFile(uf);
+    return readBytes == len && UNZ_OK == err;
+}
+
+static bool InflateRaw(const char *data, unsigned int len, char *out, unsigned int outLen)
+{
+    z_stream stream = { 0 };
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = len;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = outLen;
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return false;
+    int res = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    return Z_STREAM_END == res && stream.total_out == outLen;
+}
+
+char *ZipFile::GetFileDataByIdx(size_t fileindex, size_t *len)
+{
+    if (!uf)
         return NULL;
-    err = unzOpenCurrentFilePassword(uf, NULL);
-    if (err != UNZ_OK)
+    if (fileindex >= filenames.Count())
         return NULL;
 
-    unsigned int len2 = (unsigned int)fileinfo.At(fileindex).uncompressed_size;
+    const unz_file_info64& finfo = fileinfo.At(fileindex);
+    unsigned int len2 = (unsigned int)finfo.uncompressed_size;
     // overflow check
-    if (len2 != fileinfo.At(fileindex).uncompressed_size ||
+    if (len2 != finfo.uncompressed_size ||
         len2 + sizeof(WCHAR) < sizeof(WCHAR) ||
-        len2 / 1024 > fileinfo.At(fileindex).compressed_size) {
-        unzCloseCurrentFile(uf);
+        len2 / 1024 > finfo.compressed_size) {
         return NULL;
     }
+    // (unencrypted) deflated data is only read while holding ufAccess and then
+    // inflated outside of it, so that several threads can extract files at once
+    bool inflateRaw = Zip_Deflate == finfo.compression_method && !(finfo.flag & 1);
+    unsigned int rawLen = (unsigned int)finfo.compressed_size;
+    if (inflateRaw && rawLen != finfo.compressed_size)
+        return NULL;
 
     char *result = (char *)Allocator::Alloc(allocator, len2 + sizeof(WCHAR));
-    if (result) {
-        unsigned int readBytes = unzReadCurrentFile(uf, result, len2);
-        // zero-terminate for convenience
-        result[len2] = result[len2 + 1] = '\0';
-        if (readBytes != len2) {
-            Allocator::Free(allocator, result);
-            result = NULL;
-        }
-        else if (len) {
-            *len = len2;
-        }
+    ScopedMem<char> rawData(inflateRaw ? (char *)malloc(rawLen) : NULL);
+    if (!result || (inflateRaw && !rawData)) {
+        Allocator::Free(allocator, result);
+        return NULL;
     }
 
-    err = unzCloseCurrentFile(uf);
-    if (err != UNZ_OK) {
-        // CRC mismatch, file content is likely damaged
+    bool ok;
+    {
+        ScopedCritSec scope(&ufAccess);
+        ok = GoToFile(fileindex);
+        if (ok && inflateRaw)
+            ok = ReadCurrentFile(rawData, rawLen, true);
+        else if (ok)
+            ok = ReadCurrentFile(result, len2, false);
+    }
+    if (ok && inflateRaw) {
+        ok = InflateRaw(rawData, rawLen, result, len2) &&
+             crc32(0, (const Bytef *)result, len2) == finfo.crc;
+    }
+    if (!ok) {
         Allocator::Free(allocator, result);
-        result = NULL;
+        return NULL;
     }
 
+    // zero-terminate for convenience
+    result[len2] = result[len2 + 1] = '\0';
+    if (len)
+        *len = len2;
     return result;
 }
 
@@ -185,6 +229,7 @@ char *ZipFile::GetComment(size_t *len)
     char *comment = (char *)Allocator::Alloc(allocator, commentLen + 1);
     if (!comment)
         return NULL;
+    ScopedCritSec scope(&ufAccess);
     int read = unzGetGlobalComment(uf, comment, commentLen);
     if (read <= 0) {
         Allocator::Free(allocator, comment);
@@ -267,7 +312,7 @@ bool ZipCreator::AddFileFromDir(const WCHAR *filePath, const WCHAR *dir)
     return AddFile(filePath, nameInZip);
 }
 
-static bool AppendFileToZip(zipFile& zf, const WCHAR *nameInZip, const char *fileData, size_t fileSize)
+static bool AppendFileToZip(zipFile& zf, const WCHAR *nameInZip, const char *fileData, size_t fileSize, bool compress=true)
 {
 #ifdef _WIN64
     CrashIf(fileSize > UINT_MAX);
@@ -277,7 +322,9 @@ static bool AppendFileToZip(zipFile& zf, const WCHAR *nameInZip, const char *fil
     ScopedMem<char> nameInZipUtf(str::conv::ToUtf8(nameInZip));
     str::TransChars(nameInZipUtf, "\\", "/");
     zip_fileinfo zi = { 0 };
-    int err = zipOpenNewFileInZip64(zf, nameInZipUtf, &zi, NULL, 0, NULL, 0, NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION, 1);
+    int method = compress ? Z_DEFLATED : 0;
+    int level = compress ? Z_DEFAULT_COMPRESSION : 0;
+    int err = zipOpenNewFileInZip64(zf, nameInZipUtf, &zi, NULL, 0, NULL, 0, NULL, method, level, 1);
     if (ZIP_OK == err) {
         err = zipWriteInFileInZip(zf, fileData, (unsigned int)fileSize);
         if (ZIP_OK == err)
@@ -319,6 +366,8 @@ bool ZipCreator::SaveAs(const WCHAR *zipFilePath)
 }
 
 // TODO: using this for XPS files results in documents that Microsoft XPS Viewer can't read
+// note: files are stored uncompressed, as the stream is only ever read
+// back right away and deflating would take most of the time needed
 IStream *OpenDirAsZipStream(const WCHAR *dirPath, bool recursive)
 {
     ScopedComPtr<IStream> stream;
@@ -346,7 +395,7 @@ IStream *OpenDirAsZipStream(const WCHAR *dirPath, bool recursive)
         const WCHAR *nameInZip = filePath + dirLen;
         size_t fileSize;
         ScopedMem<char> fileData(file::ReadAll(filePath, &fileSize));
-        ok = fileData && AppendFileToZip(zf, nameInZip, fileData, fileSize);
+        ok = fileData && AppendFileToZip(zf, nameInZip, fileData, fileSize, false);
     }
     int err = zipClose(zf, NULL);
     if (!ok || err != ZIP_OK)
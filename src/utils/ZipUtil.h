@@ -8,6 +8,8 @@
 
 enum ZipMethod { Zip_Any=-1, Zip_None=0, Zip_Deflate=8, Zip_Deflate64=9, Zip_Bzip=12 };
 
+// ZipFile may be used from several threads at once (while the archive
+// is read sequentially, deflated files are inflated concurrently)
 class ZipFile {
     unzFile uf;
     Allocator *allocator;
@@ -15,8 +17,12 @@ class ZipFile {
     Vec<unz_file_info64> fileinfo;
     Vec<unz64_file_pos> filepos;
     uLong commentLen;
+    // guards uf
+    CRITICAL_SECTION ufAccess;
 
     void ExtractFilenames(ZipMethod method=Zip_Any);
+    bool GoToFile(size_t fileindex);
+    bool ReadCurrentFile(char *buf, unsigned int len, bool raw);
 
 public:
     ZipFile(const WCHAR *path, ZipMethod method=Zip_Any, Allocator *allocator=NULL);
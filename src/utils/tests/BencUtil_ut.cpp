@@ -206,6 +206,25 @@ static void BencTestParseDicts()
     BencTestParseDict("d1:Zi-23e2:able3:keyi35ee", 3);
 }
 
+static void BencTestDecodeInPlace()
+{
+    const char *benc = "d4:borg1:a3:rumll3:leeee5:valuei35ee";
+    ScopedMem<char> data(str::Dup(benc));
+    BencObj *obj = BencObj::DecodeInPlace(data);
+    utassert(obj && obj->Type() == BT_DICT);
+    BencDict *dict = static_cast<BencDict *>(obj);
+    BencString *val = dict->GetString("borg");
+    utassert(val && str::Eq(val->RawValue(), "a"));
+    utassert(val->RawValue() >= data.Get() && val->RawValue() < data.Get() + str::Len(benc));
+    BencArray *list = dict->GetArray("rum");
+    utassert(list && list->GetArray(0) && list->GetArray(0)->GetString(0));
+    utassert(str::Eq(list->GetArray(0)->GetString(0)->RawValue(), "lee"));
+    utassert(dict->GetInt("value") && dict->GetInt("value")->Value() == 35);
+    utassert(!dict->GetString("missing") && !dict->GetInt("borg"));
+    BencTestSerialization(obj, benc);
+    delete obj;
+}
+
 #define ITERATION_COUNT 128
 
 static void BencTestArrayAppend()
@@ -397,6 +416,7 @@ void BencTest()
     BencTestParseRawStrings();
     BencTestParseArrays();
     BencTestParseDicts();
+    BencTestDecodeInPlace();
     BencTestArrayAppend();
     BencTestDictAppend();
     BencTestStress();
@@ -149,6 +149,27 @@ void ByteOrderTests()
         utassert(memeq(ABC, b, 3));
         utassert(26 == d.Offset());
     }
+
+    {
+        uint16 a16[2]; uint32 a32[3];
+        ByteOrderDecoder d(d1, sizeof(d1), ByteOrderDecoder::BigEndian);
+        d.Skip(3);
+        d.UInt16Array(a16, 2);
+        utassert(a16[0] == 0x100 && a16[1] == 0xfffe);
+        utassert(7 == d.Offset());
+        d.Skip(2);
+        d.UInt32Array(a32, 3);
+        utassert(a32[0] == 1 && a32[1] == 0x1000000 && a32[2] == 0xfffffffe);
+        utassert(21 == d.Offset());
+
+        d.Unskip(12);
+        d.ChangeOrder(ByteOrderDecoder::LittleEndian);
+        d.UInt32Array(a32, 3);
+        utassert(a32[0] == 0x1000000 && a32[1] == 1 && a32[2] == 0xfeffffff);
+        d.UInt16Array(a16, 1);
+        utassert(a16[0] == 2);
+        utassert(23 == d.Offset());
+    }
 }
 
 #undef ABC
@@ -80,7 +80,36 @@ void DictTestMapStrToInt()
     FreeVecMembers(toRemove);
 }
 
+// removing entries shifts the following entries back, so check that
+// all remaining entries can still be found after interleaved removals
+static void DictTestMapWStrToInt()
+{
+    dict::MapWStrToInt d;
+    bool ok;
+    int val;
+
+    for (int i = 0; i < 256; i++) {
+        ok = d.Insert(ScopedMem<WCHAR>(str::Format(L"key%d", i)), i, NULL);
+        utassert(ok);
+    }
+    utassert(256 == d.Count());
+    for (int i = 0; i < 256; i += 3) {
+        ok = d.Remove(ScopedMem<WCHAR>(str::Format(L"key%d", i)), &val);
+        utassert(ok && val == i);
+    }
+    for (int i = 0; i < 256; i++) {
+        ok = d.Get(ScopedMem<WCHAR>(str::Format(L"key%d", i)), &val);
+        utassert(ok == (i % 3 != 0));
+        utassert(!ok || val == i);
+    }
+    ok = d.Insert(L"key0", 1000, &val);
+    utassert(ok);
+    ok = d.Insert(L"key1", 1000, &val);
+    utassert(!ok && val == 1);
+}
+
 void DictTest()
 {
     DictTestMapStrToInt();
+    DictTestMapWStrToInt();
 }
@@ -123,6 +123,38 @@ static void Test03()
     utassert(!t);
 }
 
+static void Test05()
+{
+    utassert(Tag_P == FindHtmlTag("p", 1));
+    utassert(Tag_Blockquote == FindHtmlTag("BlockQuote", 10));
+    utassert(Tag_Mbp_Pagebreak == FindHtmlTag("mbp:pagebreak", 13));
+    utassert(Tag_NotFound == FindHtmlTag("pp", 2));
+    utassert(Tag_NotFound == FindHtmlTag("spans", 5));
+    utassert(Tag_NotFound == FindHtmlTag("", 0));
+    utassert(Css_Padding_Right == FindCssProp("padding-right", 13));
+    utassert(Css_Unknown == FindCssProp("padding-rigth", 13));
+    utassert(Align_Justify == FindAlignAttr("JUSTIFY", 7));
+    utassert(0x2019 == FindHtmlEntityRune("rsquo", 5));
+    utassert((uint32_t)-1 == FindHtmlEntityRune("Rsquo", 5));
+}
+
+// text and attributes longer than a single SSE2 block
+static void Test04()
+{
+    const char *s = "<p title='0123456789abcdef>0123456789'>0123456789abcdef 0123&amp;456789<!-- 0123456789abcdef -->";
+    HtmlPullParser parser(s, str::Len(s));
+    HtmlToken *t = parser.Next();
+    utassert(t && t->IsStartTag() && Tag_P == t->tag);
+    AttrInfo *a = t->GetAttrByName("title");
+    utassert(a && str::EqNIx(a->val, a->valLen, "0123456789abcdef>0123456789"));
+    t = parser.Next();
+    utassert(t && t->IsText() && str::EqNIx(t->s, t->sLen, "0123456789abcdef 0123&amp;456789"));
+    ScopedMem<char> text(ResolveHtmlEntities(t->s, t->sLen));
+    utassert(str::Eq(text, "0123456789abcdef 0123&456789"));
+    t = parser.Next();
+    utassert(!t);
+}
+
 void HtmlPullParser_UnitTests()
 {
     Test00("<p a1='>' foo=bar />", HtmlToken::EmptyElementTag);
@@ -134,4 +166,6 @@ void HtmlPullParser_UnitTests()
     Test01();
     Test02();
     Test03();
+    Test04();
+    Test05();
 }
@@ -133,4 +133,25 @@ void JsonTest()
 }";
     JsonVerifier sampleVerifier(testData, dimof(testData));
     utassert(json::Parse(jsonSample, &sampleVerifier));
+
+    // the same data fed in chunks of varying sizes
+    for (size_t chunkSize = 1; chunkSize < 8; chunkSize++) {
+        JsonVerifier chunkVerifier(testData, dimof(testData));
+        json::StreamParser parser(&chunkVerifier);
+        size_t len = str::Len(jsonSample);
+        for (size_t off = 0; off < len; off += chunkSize) {
+            utassert(parser.Feed(jsonSample + off, min(chunkSize, len - off)));
+        }
+        utassert(parser.Finish());
+    }
+
+    JsonValue number("", "12.5", json::Type_Number);
+    JsonVerifier numberVerifier(&number, 1);
+    json::StreamParser numberParser(&numberVerifier);
+    utassert(numberParser.Feed("12", 2) && numberParser.Feed(".5", 2));
+    utassert(numberParser.Finish());
+
+    json::StreamParser errorParser(&verifyError);
+    utassert(!errorParser.Feed("{\"key\\u0000\": 1}", 17));
+    utassert(!errorParser.Finish());
 }
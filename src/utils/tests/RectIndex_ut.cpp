@@ -0,0 +1,59 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "RectIndex.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+static void RectIndexSmallTest()
+{
+    RectIndex index;
+    index.Build();
+    utassert(-1 == index.Find(PointD(0, 0)));
+
+    RectIndex index2;
+    index2.Append(RectD(0, 0, 10, 10));
+    index2.Append(RectD(5, 5, 10, 10), &index);
+    index2.Append(RectD(20, 0, -5, 10));
+    index2.Build();
+    utassert(0 == index2.Find(PointD(5, 5)));
+    utassert(1 == index2.Find(PointD(15, 15)));
+    utassert(&index == index2.DataAt(1));
+    utassert(-1 == index2.Find(PointD(17, 5)));
+}
+
+// compares lookups against testing all rectangles in order
+static void RectIndexGridTest()
+{
+    Vec<RectD> rects;
+    RectIndex index;
+    srand(1);
+    for (int i = 0; i < 500; i++) {
+        RectD rc(rand() % 600, rand() % 800, rand() % 50, rand() % 20);
+        rects.Append(rc);
+        index.Append(rc);
+    }
+    // rectangles of width or height 0 still contain points on their edge
+    rects.Append(RectD(700, 900, 0, 0));
+    index.Append(RectD(700, 900, 0, 0));
+    index.Build();
+    utassert((int)rects.Count() - 1 == index.Find(PointD(700, 900)));
+
+    for (int i = 0; i < 1000; i++) {
+        PointD pt(rand() % 800 - 50 + 0.5 * (i % 2), rand() % 1000 - 50);
+        int expected = -1;
+        for (size_t j = 0; j < rects.Count() && -1 == expected; j++) {
+            if (rects.At(j).Contains(pt))
+                expected = (int)j;
+        }
+        utassert(expected == index.Find(pt));
+    }
+}
+
+void RectIndexTest()
+{
+    RectIndexSmallTest();
+    RectIndexGridTest();
+}
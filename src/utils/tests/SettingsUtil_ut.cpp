@@ -152,6 +152,17 @@ Key = Value";
     utassert(2 == data->sutStructItems->At(1)->nested.colorArray->Count());
     utassert(0x12785634 == data->sutStructItems->At(1)->nested.colorArray->At(0));
     utassert(!data->internalString);
+
+    size_t binSize;
+    ScopedMem<char> bin(SerializeStructBin(&gSutStructInfo, data, &binSize));
+    utassert(bin && binSize > 0);
+    SutStruct *copy = (SutStruct *)DeserializeStructBin(&gSutStructInfo, bin, binSize);
+    utassert(copy && 0 == copy->internal);
+    utassert(str::Eq(ScopedMem<char>(SerializeStruct(&gSutStructInfo, data)), ScopedMem<char>(SerializeStruct(&gSutStructInfo, copy))));
+    FreeStruct(&gSutStructInfo, copy);
+    utassert(!DeserializeStructBin(&gSutStructInfo, bin, binSize - 1));
+    utassert(GetStructInfoHash(&gSutStructInfo) != GetStructInfoHash(&gSutStructItemInfo));
+
     utassert(!str::Eq(serialized, ScopedMem<char>(SerializeStruct(&gSutStructInfo, data))));
     data->sutStructItems->At(0)->nested.point.x++;
     utassert(!str::Eq(serialized, ScopedMem<char>(SerializeStruct(&gSutStructInfo, data, unknownOnly))));
@@ -173,4 +173,22 @@ void SquareTreeTest()
     utassert(mixed.root && mixed.root->GetChild("node1") && mixed.root->GetChild("node2"));
     utassert(0 == mixed.root->GetChild("node1")->data.Count());
     utassert(str::Eq(mixed.root->GetChild("node2")->GetValue("Key"), "value"));
+
+    // larger nodes are looked up through a hash index
+    str::Str<char> manyKeys;
+    for (int i = 0; i < 40; i++) {
+        manyKeys.AppendFmt("Key%d = %d\n", i, i);
+    }
+    manyKeys.Append("key7 = duplicate\nkey7 [\n]\n");
+    SquareTree many(manyKeys.Get());
+    utassert(many.root && 42 == many.root->data.Count());
+    utassert(str::Eq(many.root->GetValue("key39"), "39"));
+    utassert(str::Eq(many.root->GetValue("KEY7"), "7"));
+    utassert(many.root->GetChild("Key7") == many.root->data.At(41).value.child);
+    utassert(!many.root->GetValue("key40") && !many.root->GetChild("key8"));
+    size_t off = 0;
+    utassert(str::Eq(many.root->GetValue("key7", &off), "7") && 8 == off);
+    utassert(str::Eq(many.root->GetValue("key7", &off), "duplicate") && 41 == off);
+    many.root->data.RemoveAt(7);
+    utassert(str::Eq(many.root->GetValue("key7"), "duplicate"));
 }
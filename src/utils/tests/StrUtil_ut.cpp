@@ -337,6 +337,31 @@ void StrTest()
         WCHAR wstr[] = L"aAbBcC... 1-9";
         str::ToLower(wstr);
         utassert(str::Eq(wstr, L"aabbcc... 1-9"));
+
+        char longStr[] = "The Quick Brown Fox Jumps Over The Lazy Dog @[`{ \xC4\xA3";
+        str::ToLower(longStr);
+        utassert(str::Eq(longStr, "the quick brown fox jumps over the lazy dog @[`{ \xC4\xA3"));
+    }
+
+    {
+        // ASCII strings are converted without Windows API calls
+        const char *ascii = "Some ASCII text that's longer than 16 characters";
+        ScopedMem<WCHAR> wide(str::conv::FromUtf8(ascii));
+        utassert(str::Eq(wide, L"Some ASCII text that's longer than 16 characters"));
+        ScopedMem<char> narrow(str::conv::ToUtf8(wide));
+        utassert(str::Eq(narrow, ascii));
+        wide.Set(str::conv::FromUtf8(ascii, 4));
+        utassert(str::Eq(wide, L"Some"));
+        narrow.Set(str::conv::ToUtf8(L"Some ASCII", 4));
+        utassert(str::Eq(narrow, "Some"));
+        wide.Set(str::conv::FromUtf8(""));
+        utassert(str::Eq(wide, L""));
+
+        const char *utf8 = "Some text that isn't ASCII: \xC4\xA3";
+        wide.Set(str::conv::FromUtf8(utf8));
+        utassert(str::Eq(wide, L"Some text that isn't ASCII: \u0123"));
+        narrow.Set(str::conv::ToUtf8(wide));
+        utassert(str::Eq(narrow, utf8));
     }
 
     struct {
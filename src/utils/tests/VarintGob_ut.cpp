@@ -113,7 +113,37 @@ static void GobEncodingTest()
     utassert(0 == dLen);
 }
 
+static void GobRecordTest()
+{
+    GobEncoder enc(0x12345678, 3);
+    enc.Int(-5);
+    enc.Align(4);
+    enc.UInt(300);
+    enc.Bytes("abc", 3);
+    size_t len;
+    ScopedMem<char> data(enc.Finish(&len));
+    utassert(data && len == 8 + 1 + 3 + 3 + 4 + 4);
+
+    GobDecoder dec(data, len, 0x12345678, 3);
+    utassert(dec.IsOk());
+    utassert(-5 == dec.Int());
+    dec.Align(4);
+    utassert(300 == dec.UInt());
+    size_t bytesLen;
+    const char *bytes = dec.Bytes(&bytesLen);
+    utassert(3 == bytesLen && str::EqN(bytes, "abc", 3));
+    utassert(dec.IsOk() && dec.AtEnd());
+    utassert(0 == dec.UInt() && !dec.IsOk());
+
+    utassert(!GobDecoder(data, len, 0x12345678, 2).IsOk());
+    utassert(!GobDecoder(data, len - 1, 0x12345678, 3).IsOk());
+    data[9] ^= 1;
+    utassert(!GobDecoder(data, len, 0x12345678, 3).IsOk());
+    utassert(!GobDecoder(NULL, 0, 0x12345678, 3).IsOk());
+}
+
 void VarintGobTest()
 {
     GobEncodingTest();
+    GobRecordTest();
 }
@@ -4,6 +4,7 @@
 #include "BaseUtil.h"
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
+#include "VecSegmented.h"
 
 // must be last due to assert() over-write
 #include "UtAssert.h"
@@ -94,6 +95,49 @@ static size_t VecTestAppendFmt()
     return l;
 }
 
+#define APPENDING_THREADS   4
+#define APPENDS_PER_THREAD  10000
+
+typedef VecSegmented<int, SharedPoolAllocator> SharedVecSegmented;
+
+static DWORD WINAPI AppendingThread(void *data)
+{
+    SharedVecSegmented *v = (SharedVecSegmented *)data;
+    for (int i = 0; i < APPENDS_PER_THREAD; i++) {
+        v->Append(i);
+    }
+    return 0;
+}
+
+static void SharedVecSegmentedTest()
+{
+    SharedVecSegmented v;
+    HANDLE threads[APPENDING_THREADS];
+    for (int i = 0; i < APPENDING_THREADS; i++) {
+        threads[i] = CreateThread(NULL, 0, AppendingThread, &v, 0, NULL);
+        utassert(threads[i] != NULL);
+    }
+    WaitForMultipleObjects(APPENDING_THREADS, threads, TRUE, INFINITE);
+    for (int i = 0; i < APPENDING_THREADS; i++) {
+        CloseHandle(threads[i]);
+    }
+
+    utassert(APPENDING_THREADS * APPENDS_PER_THREAD == v.Count());
+    // every value must have been appended once per thread
+    Vec<int> counts;
+    counts.AppendBlanks(APPENDS_PER_THREAD);
+    size_t n = 0;
+    for (int *el = v.IterStart(); el; el = v.IterNext()) {
+        utassert(0 <= *el && *el < APPENDS_PER_THREAD);
+        counts.At(*el)++;
+        n++;
+    }
+    utassert(v.Count() == n);
+    for (size_t i = 0; i < counts.Count(); i++) {
+        utassert(APPENDING_THREADS == counts.At(i));
+    }
+}
+
 void VecTest()
 {
     Vec<int> ints;
@@ -249,4 +293,5 @@ void VecTest()
 
     WStrVecTest();
     StrListTest();
+    SharedVecSegmentedTest();
 }
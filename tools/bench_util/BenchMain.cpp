@@ -0,0 +1,390 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+/* Measures the throughput of commonly used utils over generated inputs
+   resembling what they usually have to deal with (e.g. EPUB content,
+   settings files). Every benchmark runs repeatedly for at least
+   MIN_BENCH_MS and the results are printed in the same JSON resp. CSV
+   format as used for -bench (so that they can be saved and compared):
+
+   bench_util.exe [-out <results.json|results.csv>] [-lzsa <archive.lzsa>] [<name filter>]
+*/
+
+#include "BaseUtil.h"
+#include "BencUtil.h"
+#include "CmdLineParser.h"
+#include "CssParser.h"
+#include "Dict.h"
+#include "FileUtil.h"
+#include "HtmlPullParser.h"
+#include "JsonParser.h"
+#include "LzmaSimpleArchive.h"
+#include "SquareTreeParser.h"
+#include "Timer.h"
+#include "ZipUtil.h"
+
+// each benchmark runs for at least that long (after a warm-up run)
+#define MIN_BENCH_MS    500
+
+typedef void (*BenchFunc)(const char *data, size_t len);
+
+struct BenchResult {
+    const char *name;
+    size_t bytes;
+    int iterations;
+    double totalMs;
+};
+
+static Vec<BenchResult> gResults;
+static const char *gFilter = NULL;
+
+static void RunBench(const char *name, BenchFunc func, const char *data, size_t len)
+{
+    if (gFilter && !str::StartsWithI(name, gFilter))
+        return;
+
+    func(data, len);
+    BenchResult res = { name, len, 0, 0 };
+    Timer t(true);
+    do {
+        func(data, len);
+        res.iterations++;
+    } while ((res.totalMs = t.GetTimeInMs()) < MIN_BENCH_MS);
+    gResults.Append(res);
+    fprintf(stderr, "%s: %.3f ms per iteration\n", name, res.totalMs / res.iterations);
+}
+
+static double MegabytesPerSec(BenchResult& res)
+{
+    if (0 == res.bytes || res.totalMs <= 0)
+        return -1;
+    return (double)res.bytes * res.iterations / (1024 * 1024) / (res.totalMs / 1000);
+}
+
+static char *FormatResultsAsJson()
+{
+    str::Str<char> out;
+    out.Append("{\n  \"benchmarks\": [");
+    for (size_t i = 0; i < gResults.Count(); i++) {
+        BenchResult& res = gResults.At(i);
+        out.AppendFmt("%s\n    { \"name\": \"%s\", \"iterations\": %d, \"bytes\": %d, \"total_ms\": %.2f, \"iteration_ms\": %.3f, \"mb_per_sec\": ",
+                      i > 0 ? "," : "", res.name, res.iterations, (int)res.bytes, res.totalMs, res.totalMs / res.iterations);
+        double mbs = MegabytesPerSec(res);
+        if (mbs < 0)
+            out.Append("null");
+        else
+            out.AppendFmt("%.2f", mbs);
+        out.Append(" }");
+    }
+    out.Append(gResults.Count() > 0 ? "\n  ]\n}\n" : "]\n}\n");
+    return out.StealData();
+}
+
+static char *FormatResultsAsCsv()
+{
+    str::Str<char> out;
+    out.Append("name,iterations,bytes,total_ms,iteration_ms,mb_per_sec\r\n");
+    for (size_t i = 0; i < gResults.Count(); i++) {
+        BenchResult& res = gResults.At(i);
+        out.AppendFmt("\"%s\",%d,%d,%.2f,%.3f,", res.name, res.iterations, (int)res.bytes, res.totalMs, res.totalMs / res.iterations);
+        double mbs = MegabytesPerSec(res);
+        if (mbs >= 0)
+            out.AppendFmt("%.2f", mbs);
+        out.Append("\r\n");
+    }
+    return out.StealData();
+}
+
+// inputs
+
+#define GENERATED_ITEMS 10000
+
+static char *GenerateHtml()
+{
+    str::Str<char> s;
+    s.Append("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<html xmlns=\"http://www.w3.org/1999/xhtml\">\n");
+    s.Append("<head><title>Chapter</title><link rel=\"stylesheet\" href=\"style.css\" /></head>\n<body>\n");
+    for (int i = 0; i < GENERATED_ITEMS; i++) {
+        s.AppendFmt("<p class=\"c%d\" id=\"p%d\">Lorem ipsum dolor sit amet, <i>consectetur</i> adipisici elit &amp; "
+                    "sed eiusmod tempor <a href=\"#n%d\">incidunt</a> ut labore et dolore magna aliqua.<br/></p>\n",
+                    i % 7, i, i);
+    }
+    s.Append("</body>\n</html>\n");
+    return s.StealData();
+}
+
+static char *GenerateCss()
+{
+    str::Str<char> s;
+    for (int i = 0; i < GENERATED_ITEMS; i++) {
+        s.AppendFmt("p.c%d, div > span.c%d:first-child { margin: 0 0 1em; font-size: %dpt; color: #333; text-indent: 1.5em }\n",
+                    i, i, 8 + i % 10);
+    }
+    return s.StealData();
+}
+
+static char *GenerateSquareTree()
+{
+    str::Str<char> s;
+    s.Append("# settings\n");
+    for (int i = 0; i < GENERATED_ITEMS; i++) {
+        s.AppendFmt("FileStates [\n\tFilePath = C:\\Users\\Name\\Documents\\file %d.pdf\n\tPageNo = %d\n"
+                    "\tZoom = fit page\n\tScrollPos = 0 %d\n\tFavorites [\n\t\tPageNo = %d\n\t]\n]\n",
+                    i, i % 100, i * 10, i % 10);
+    }
+    return s.StealData();
+}
+
+static char *GenerateJson()
+{
+    str::Str<char> s;
+    s.Append("{ \"items\": [");
+    for (int i = 0; i < GENERATED_ITEMS; i++) {
+        s.AppendFmt("%s\n  { \"id\": %d, \"name\": \"item \\u0041 %d\", \"size\": %d.5, \"tags\": [\"a\", \"b\"], \"ok\": true, \"next\": null }",
+                    i > 0 ? "," : "", i, i, i * 3);
+    }
+    s.Append("\n] }\n");
+    return s.StealData();
+}
+
+static char *GenerateBenc(size_t *lenOut)
+{
+    BencArray files;
+    for (int i = 0; i < GENERATED_ITEMS; i++) {
+        BencDict *dict = new BencDict();
+        ScopedMem<WCHAR> path(str::Format(L"C:\\Users\\Name\\Documents\\file %d.pdf", i));
+        dict->Add("FilePath", path);
+        dict->Add("PageNo", i % 100);
+        dict->Add("Zoom", L"fit page");
+        files.Add(dict);
+    }
+    char *data = files.Encode();
+    *lenOut = str::Len(data);
+    return data;
+}
+
+// benchmarks
+
+// len is the size of the appended ints in bytes
+static void BenchVecAppend(const char *data, size_t len)
+{
+    Vec<int> v;
+    len /= sizeof(int);
+    for (size_t i = 0; i < len; i++) {
+        v.Append((int)i);
+    }
+    int sum = 0;
+    for (int *item = v.IterStart(); item; item = v.IterNext()) {
+        sum += *item;
+    }
+    CrashAlwaysIf(v.Count() != len || (0 == sum && len > 1));
+}
+
+static void BenchToWideChar(const char *data, size_t len)
+{
+    ScopedMem<WCHAR> s(str::conv::FromUtf8(data, len));
+    CrashAlwaysIf(!s);
+}
+
+static void BenchToUtf8(const char *data, size_t len)
+{
+    ScopedMem<char> s(str::conv::ToUtf8((const WCHAR *)data, len / sizeof(WCHAR)));
+    CrashAlwaysIf(!s);
+}
+
+static Vec<char *> gDictKeys;
+
+static void BenchDict(const char *data, size_t len)
+{
+    dict::MapStrToInt map;
+    for (size_t i = 0; i < gDictKeys.Count(); i++) {
+        map.Insert(gDictKeys.At(i), (int)i);
+    }
+    int val;
+    for (size_t i = 0; i < gDictKeys.Count(); i++) {
+        bool ok = map.Get(gDictKeys.At(i), &val);
+        CrashAlwaysIf(!ok || val != (int)i);
+    }
+}
+
+static void BenchHtmlPullParser(const char *data, size_t len)
+{
+    HtmlPullParser parser(data, len);
+    HtmlToken *tok;
+    int attrs = 0;
+    while ((tok = parser.Next()) != NULL && !tok->IsError()) {
+        if (tok->IsStartTag()) {
+            for (AttrInfo *attr = tok->NextAttr(); attr; attr = tok->NextAttr()) {
+                attrs++;
+            }
+        }
+    }
+    CrashAlwaysIf(0 == attrs);
+}
+
+static void BenchCssPullParser(const char *data, size_t len)
+{
+    CssPullParser parser(data, len);
+    int props = 0;
+    while (parser.NextRule()) {
+        while (parser.NextSelector()) {
+        }
+        while (parser.NextProperty()) {
+            props++;
+        }
+    }
+    CrashAlwaysIf(0 == props);
+}
+
+static void BenchSquareTree(const char *data, size_t len)
+{
+    SquareTree sqt(data);
+    CrashAlwaysIf(!sqt.root);
+}
+
+class CountingVisitor : public json::ValueVisitor {
+public:
+    int count;
+    CountingVisitor() : count(0) { }
+    virtual bool Visit(const char *path, const char *value, json::DataType type) {
+        count++;
+        return true;
+    }
+};
+
+static void BenchJsonParser(const char *data, size_t len)
+{
+    CountingVisitor visitor;
+    bool ok = json::Parse(data, &visitor);
+    CrashAlwaysIf(!ok || 0 == visitor.count);
+}
+
+static void BenchBencDecode(const char *data, size_t len)
+{
+    ScopedMem<BencObj> obj(BencObj::Decode(data));
+    CrashAlwaysIf(!obj);
+}
+
+static void BenchZipFile(const char *data, size_t len)
+{
+    ZipFile archive((const WCHAR *)data);
+    CrashAlwaysIf(0 == archive.GetFileCount());
+    for (size_t i = 0; i < archive.GetFileCount(); i++) {
+        ScopedMem<char> fileData(archive.GetFileDataByIdx(i));
+        CrashAlwaysIf(!fileData);
+    }
+}
+
+static void BenchLzmaSimpleArchive(const char *data, size_t len)
+{
+    lzma::SimpleArchive archive;
+    bool ok = lzma::ParseSimpleArchive(data, len, &archive);
+    CrashAlwaysIf(!ok);
+    for (int i = 0; i < archive.filesCount; i++) {
+        ScopedMem<char> fileData(lzma::GetFileDataByIdx(&archive, i, NULL));
+        CrashAlwaysIf(!fileData);
+    }
+}
+
+// creates a ZIP archive from the generated inputs and
+// returns its path (or NULL on failure)
+static WCHAR *CreateZipFile(const char **inputs, size_t count)
+{
+    WCHAR *zipPath = path::GetTempPath(L"ben");
+    if (!zipPath)
+        return NULL;
+    ZipCreator zc;
+    WStrVec filePaths;
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++) {
+        filePaths.Append(path::GetTempPath(L"ben"));
+        ScopedMem<WCHAR> nameInZip(str::Format(L"file%d.txt", (int)i));
+        ok = filePaths.Last() && file::WriteAll(filePaths.Last(), inputs[i], str::Len(inputs[i])) &&
+             zc.AddFile(filePaths.Last(), nameInZip);
+    }
+    ok = ok && zc.SaveAs(zipPath);
+    for (size_t i = 0; i < filePaths.Count(); i++) {
+        if (filePaths.At(i))
+            file::Delete(filePaths.At(i));
+    }
+    if (!ok) {
+        file::Delete(zipPath);
+        free(zipPath);
+        zipPath = NULL;
+    }
+    return zipPath;
+}
+
+int main(int argc, char **argv)
+{
+    const WCHAR *outputPath = NULL, *lzsaPath = NULL;
+    ScopedMem<char> filter;
+
+    WStrVec argList;
+    ParseCmdLine(GetCommandLine(), argList);
+    for (size_t i = 1; i < argList.Count(); i++) {
+        if (str::Eq(argList.At(i), L"-out") && i + 1 < argList.Count())
+            outputPath = argList.At(++i);
+        else if (str::Eq(argList.At(i), L"-lzsa") && i + 1 < argList.Count())
+            lzsaPath = argList.At(++i);
+        else if (!filter)
+            filter.Set(str::conv::ToUtf8(argList.At(i)));
+        else {
+            fprintf(stderr, "bench_util.exe [-out <results.json|results.csv>] [-lzsa <archive.lzsa>] [<name filter>]\n");
+            return 1;
+        }
+    }
+    gFilter = filter;
+
+    ScopedMem<char> html(GenerateHtml());
+    ScopedMem<char> css(GenerateCss());
+    ScopedMem<char> sqt(GenerateSquareTree());
+    ScopedMem<char> json(GenerateJson());
+    size_t bencLen;
+    ScopedMem<char> benc(GenerateBenc(&bencLen));
+    ScopedMem<WCHAR> htmlW(str::conv::FromUtf8(html));
+    for (int i = 0; i < GENERATED_ITEMS * 10; i++) {
+        gDictKeys.Append(str::Format("key-%d/%x", i, i * 7919));
+    }
+
+    RunBench("Vec.Append", BenchVecAppend, NULL, GENERATED_ITEMS * 100 * sizeof(int));
+    RunBench("str.conv.FromUtf8", BenchToWideChar, html, str::Len(html));
+    RunBench("str.conv.ToUtf8", BenchToUtf8, (const char *)htmlW.Get(), str::Len(htmlW) * sizeof(WCHAR));
+    RunBench("Dict.MapStrToInt", BenchDict, NULL, 0);
+    RunBench("HtmlPullParser", BenchHtmlPullParser, html, str::Len(html));
+    RunBench("CssPullParser", BenchCssPullParser, css, str::Len(css));
+    RunBench("SquareTree", BenchSquareTree, sqt, str::Len(sqt));
+    RunBench("JsonParser", BenchJsonParser, json, str::Len(json));
+    RunBench("BencUtil.Decode", BenchBencDecode, benc, bencLen);
+
+    const char *zipInputs[] = { html, css, sqt, json };
+    ScopedMem<WCHAR> zipPath(CreateZipFile(zipInputs, dimof(zipInputs)));
+    if (zipPath)
+        RunBench("ZipFile", BenchZipFile, (const char *)zipPath.Get(), (size_t)file::GetSize(zipPath));
+    else
+        fprintf(stderr, "Error: failed to create a ZIP archive\n");
+
+    // there's no LZSA compressor in utils, so the archive must be provided
+    // (e.g. one of the installer's archives)
+    ScopedMem<char> lzsa;
+    size_t lzsaLen = 0;
+    if (lzsaPath)
+        lzsa.Set(file::ReadAll(lzsaPath, &lzsaLen));
+    if (lzsa)
+        RunBench("LzmaSimpleArchive", BenchLzmaSimpleArchive, lzsa, lzsaLen);
+    else if (lzsaPath)
+        fprintf(stderr, "Error: failed to read %S\n", lzsaPath);
+
+    if (zipPath)
+        file::Delete(zipPath);
+    FreeVecMembers(gDictKeys);
+
+    ScopedMem<char> results(outputPath && str::EndsWithI(outputPath, L".csv") ? FormatResultsAsCsv() : FormatResultsAsJson());
+    if (!outputPath)
+        fputs(results, stdout);
+    else if (!file::WriteAll(outputPath, results, str::Len(results))) {
+        fprintf(stderr, "Error: failed to write %S\n", outputPath);
+        return 1;
+    }
+    return 0;
+}
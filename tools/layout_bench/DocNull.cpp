@@ -0,0 +1,16 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include "Doc.h"
+
+// dummy methods for CreateFormatter and CreateFormatterArgsDoc in EbookFormatter.cpp
+// (layout_bench creates its formatters directly, while Doc.cpp would require all engines)
+Doc::Doc(const Doc& other) { Clear(); }
+Doc::~Doc() { }
+void Doc::Clear() { type = Doc_None; generic = NULL; error = Error_None; }
+EpubDoc *Doc::AsEpub() const { return NULL; }
+Fb2Doc *Doc::AsFb2() const { return NULL; }
+MobiDoc *Doc::AsMobi() const { return NULL; }
+MobiTestDoc *Doc::AsMobiTest() const { return NULL; }
+const char *Doc::GetHtmlData(size_t &len) { len = 0; return NULL; }
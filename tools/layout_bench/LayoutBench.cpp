@@ -0,0 +1,214 @@
+/* Copyright 2014 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+/* Benchmarks HtmlFormatter in isolation (i.e. without EbookEngine and
+   without rendering): an EPUB, FB2 or Mobi document is laid out at every
+   combination of page size and font (fastest of several runs) and the
+   time spent in parsing, CSS and text measurement is reported along with
+   the size of the text allocator:
+
+   layout_bench.exe <file> [-sizes 320x480,600x800] [-fonts Georgia:12.5,Verdana:10] [-runs <count>]
+*/
+
+#include "BaseUtil.h"
+#include "CmdLineParser.h"
+#include "EbookDoc.h"
+#include "EbookFormatter.h"
+#include "GdiPlusUtil.h"
+#include "MobiDoc.h"
+#include "Mui.h"
+#include "Timer.h"
+
+// the same defaults as for EbookEngine
+#define DEFAULT_FONT_NAME   L"Georgia"
+#define DEFAULT_FONT_SIZE   12.5f
+
+#define DEFAULT_RUNS        3
+
+struct PageSize {
+    int dx, dy;
+};
+
+struct FontSpec {
+    const WCHAR *name;
+    float size;
+};
+
+static PageSize gDefaultSizes[] = { { 320, 480 }, { 600, 800 }, { 1024, 768 } };
+static FontSpec gDefaultFonts[] = { { DEFAULT_FONT_NAME, DEFAULT_FONT_SIZE }, { DEFAULT_FONT_NAME, 16.f }, { L"Verdana", 10.f } };
+
+// only one of the documents is set
+class LayoutDoc {
+public:
+    EpubDoc *epubDoc;
+    Fb2Doc *fb2Doc;
+    MobiDoc *mobiDoc;
+
+    LayoutDoc() : epubDoc(NULL), fb2Doc(NULL), mobiDoc(NULL) { }
+    ~LayoutDoc() {
+        delete epubDoc;
+        delete fb2Doc;
+        delete mobiDoc;
+    }
+
+    bool Load(const WCHAR *filePath) {
+        if (EpubDoc::IsSupportedFile(filePath))
+            epubDoc = EpubDoc::CreateFromFile(filePath);
+        else if (Fb2Doc::IsSupportedFile(filePath))
+            fb2Doc = Fb2Doc::CreateFromFile(filePath);
+        else if (MobiDoc::IsSupportedFile(filePath)) {
+            mobiDoc = MobiDoc::CreateFromFile(filePath);
+            // PalmDOC and TealDoc files aren't laid out with MobiFormatter
+            if (mobiDoc && Pdb_Mobipocket != mobiDoc->GetDocType()) {
+                delete mobiDoc;
+                mobiDoc = NULL;
+            }
+        }
+        return epubDoc || fb2Doc || mobiDoc;
+    }
+
+    const char *GetHtmlData(size_t *lenOut) {
+        if (epubDoc)
+            return epubDoc->GetTextData(lenOut);
+        if (fb2Doc)
+            return fb2Doc->GetTextData(lenOut);
+        return mobiDoc->GetBookHtmlData(*lenOut);
+    }
+
+    // same formatters as used by EbookEngine
+    HtmlFormatter *CreateFormatter(HtmlFormatterArgs *args) {
+        if (epubDoc)
+            return new EpubFormatter(args, epubDoc);
+        if (fb2Doc)
+            return new Fb2Formatter(args, fb2Doc);
+        return new MobiFormatter(args, mobiDoc);
+    }
+};
+
+struct LayoutResult {
+    int pageCount;
+    double totalMs;
+    HtmlFormatterStats stats;
+    size_t allocatorBytes;
+};
+
+static void LayoutOnce(LayoutDoc& doc, PageSize size, FontSpec font, LayoutResult& res)
+{
+    PoolAllocator textAllocator;
+    HtmlFormatterArgs args;
+    args.htmlStr = doc.GetHtmlData(&args.htmlStrLen);
+    args.pageDx = (float)size.dx;
+    args.pageDy = (float)size.dy;
+    args.SetFontName(font.name);
+    args.fontSize = font.size;
+    args.textAllocator = &textAllocator;
+    args.measureAlgo = MeasureTextQuick;
+    ZeroMemory(&res.stats, sizeof(res.stats));
+    args.stats = &res.stats;
+
+    res.pageCount = 0;
+    Timer t(true);
+    HtmlFormatter *formatter = doc.CreateFormatter(&args);
+    for (HtmlPage *page = formatter->Next(false); page; page = formatter->Next(false)) {
+        res.pageCount++;
+        delete page;
+    }
+    delete formatter;
+    res.totalMs = t.GetTimeInMs();
+    res.allocatorBytes = textAllocator.BytesAllocated();
+}
+
+static void BenchLayout(LayoutDoc& doc, PageSize size, FontSpec font, int runs)
+{
+    LayoutResult best;
+    for (int i = 0; i < runs; i++) {
+        LayoutResult res;
+        LayoutOnce(doc, size, font, res);
+        if (0 == i || res.totalMs < best.totalMs)
+            best = res;
+    }
+
+    double pagesPerSec = best.totalMs > 0 ? best.pageCount * 1000 / best.totalMs : 0;
+    printf("%dx%d, %S %.1fpt: %d pages in %.2f ms (%.1f pages/s), parsing: %.2f ms, css: %.2f ms, measuring: %.2f ms, text allocator: %d kB\n",
+           size.dx, size.dy, font.name, font.size, best.pageCount, best.totalMs, pagesPerSec,
+           best.stats.parseMs, best.stats.cssMs, best.stats.measureMs, (int)(best.allocatorBytes / 1024));
+}
+
+static int Usage()
+{
+    fprintf(stderr, "layout_bench.exe <file> [-sizes 320x480,600x800] [-fonts Georgia:12.5,Verdana:10] [-runs <count>]\n");
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    setlocale(LC_ALL, "C");
+
+    WStrVec argList;
+    ParseCmdLine(GetCommandLine(), argList);
+    if (argList.Count() < 2)
+        return Usage();
+
+    Vec<PageSize> sizes;
+    Vec<FontSpec> fonts;
+    WStrVec fontNames;
+    int runs = DEFAULT_RUNS;
+    for (size_t i = 2; i < argList.Count(); i++) {
+        bool hasParam = i + 1 < argList.Count();
+        if (str::Eq(argList.At(i), L"-sizes") && hasParam) {
+            WStrVec parts;
+            parts.Split(argList.At(++i), L",", true);
+            for (size_t j = 0; j < parts.Count(); j++) {
+                PageSize size;
+                if (!str::Parse(parts.At(j), L"%dx%d%$", &size.dx, &size.dy) || size.dx <= 0 || size.dy <= 0)
+                    return Usage();
+                sizes.Append(size);
+            }
+        }
+        else if (str::Eq(argList.At(i), L"-fonts") && hasParam) {
+            WStrVec parts;
+            parts.Split(argList.At(++i), L",", true);
+            for (size_t j = 0; j < parts.Count(); j++) {
+                ScopedMem<WCHAR> name;
+                FontSpec font;
+                if (!str::Parse(parts.At(j), L"%S:%f%$", &name, &font.size) || font.size <= 0)
+                    return Usage();
+                fontNames.Append(name.StealData());
+                font.name = fontNames.Last();
+                fonts.Append(font);
+            }
+        }
+        else if (str::Eq(argList.At(i), L"-runs") && hasParam) {
+            runs = _wtoi(argList.At(++i));
+            if (runs < 1)
+                return Usage();
+        }
+        else
+            return Usage();
+    }
+    if (0 == sizes.Count())
+        sizes.Append(gDefaultSizes, dimof(gDefaultSizes));
+    if (0 == fonts.Count())
+        fonts.Append(gDefaultFonts, dimof(gDefaultFonts));
+
+    ScopedGdiPlus gdi;
+    mui::Initialize();
+
+    int result = 0;
+    LayoutDoc *doc = new LayoutDoc();
+    if (doc->Load(argList.At(1))) {
+        for (size_t i = 0; i < sizes.Count(); i++) {
+            for (size_t j = 0; j < fonts.Count(); j++) {
+                BenchLayout(*doc, sizes.At(i), fonts.At(j), runs);
+            }
+        }
+    }
+    else {
+        fprintf(stderr, "Error: %S isn't a supported EPUB, FB2 or Mobi document\n", argList.At(1));
+        result = 1;
+    }
+    delete doc;
+
+    mui::Destroy();
+    return result;
+}
@@ -22,6 +22,7 @@ extern void FileUtilTest();
 extern void HtmlPrettyPrintTest();
 extern void HtmlPullParser_UnitTests();
 extern void JsonTest();
+extern void RectIndexTest();
 extern void SettingsUtilTest();
 extern void SigSlotTest();
 extern void SimpleLogTest();
@@ -46,6 +47,7 @@ int main(int argc, char **argv)
     HtmlPrettyPrintTest();
     HtmlPullParser_UnitTests();
     JsonTest();
+    RectIndexTest();
     SettingsUtilTest();
     SigSlotTest();
     SimpleLogTest();